@@ -45,6 +45,7 @@ std::vector<StreamTypes> AppMain::kEnabledStreamTypes = { StreamTypes::PV };
 AppMain::AppMain() :
 	m_recording(false),
 	m_currentHeight(1.0f),
+	m_heightRayQuery(RayQueryService::kInvalidHandle),
 	m_coordAxes("Unlit_VS.cso", "UnlitTexture_PS.cso", make_shared<Mesh>("coord_axes.obj")),
 	m_qrCodeCoordAxes("Unlit_VS.cso", "UnlitTexture_PS.cso", make_shared<Mesh>("coord_axes.obj")),
 	m_coordAxesTexture("coord_axes.png"),
@@ -160,7 +161,11 @@ void AppMain::Update()
 			{				
 				float distance;
 				XMVECTOR normal;
-				if (m_mixedReality.GetSurfaceMappingInterface()->TestRayIntersection(frame.eyeGazeOrigin, frame.eyeGazeDirection, distance, normal))
+				auto surfaceMapping = m_mixedReality.GetSurfaceMappingInterface();
+				// The distance is recorded with this frame, so the ray is not left to the worker thread
+				RayQueryService::Handle eyeGazeRayQuery = surfaceMapping->SubmitRayQuery(frame.eyeGazeOrigin, frame.eyeGazeDirection);
+				surfaceMapping->ExecuteRayQueries();
+				if (surfaceMapping->GetRayQueryResult(eyeGazeRayQuery, distance, normal))
 				{
 					frame.eyeGazeDistance = distance;
 				}
@@ -188,10 +193,15 @@ void AppMain::Update()
 		const XMVECTOR projectPosition = headPosition + horizontalOffset;	
 		const XMVECTOR headSide = XMVector3Normalize(XMVector3Cross(headForward, minusY));
 
-		if (m_mixedReality.GetSurfaceMappingInterface()->TestRayIntersection(projectPosition, minusY, distance, normal))
+		// The ray is traversed on the worker thread and its result read the next frame,
+		// which the smoothing of the height hides
+		auto surfaceMapping = m_mixedReality.GetSurfaceMappingInterface();
+		if (surfaceMapping->GetRayQueryResult(m_heightRayQuery, distance, normal))
 		{
 			m_currentHeight = 0.9f * m_currentHeight + 0.1f * distance;
 		}
+		m_heightRayQuery = surfaceMapping->SubmitRayQuery(projectPosition, minusY);
+		surfaceMapping->DispatchRayQueries();
 
 		m_coordAxisTransform = XMMatrixMultiply(
 			XMMatrixTranslationFromVector(-projectPosition - m_currentHeight * minusY),
@@ -84,4 +84,5 @@ private:
 	Timer m_frameDeltaTimer;
 	bool m_recording;
 	float m_currentHeight;
+	RayQueryService::Handle m_heightRayQuery;	// Submitted last frame
 };
@@ -0,0 +1,151 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Read-only view of a whole file, mapped in memory instead of read through a buffer.
+//
+// Portable (no DirectX / WinRT dependencies) so that it can also be built and
+// checked by desktop tools: the *FromApp functions are used on Windows, which
+// are also allowed in UWP apps, and mmap elsewhere.
+
+#include <cstdint>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+class MappedFile
+{
+public:
+
+	MappedFile() = default;
+	~MappedFile() { Close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Empty files open with a null data pointer
+	bool Open(const std::string& filename)
+	{
+		Close();
+
+#ifdef _WIN32
+		int wideLength = MultiByteToWideChar(CP_ACP, 0, filename.c_str(), -1, nullptr, 0);
+		std::wstring wideFilename(wideLength > 0 ? wideLength - 1 : 0, L'\0');
+		if (wideLength > 1)
+			MultiByteToWideChar(CP_ACP, 0, filename.c_str(), -1, &wideFilename[0], wideLength);
+
+		m_file = CreateFile2(wideFilename.c_str(), GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING, nullptr);
+		if (m_file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER size;
+		FILETIME lastWriteTime;
+		if (!GetFileSizeEx(m_file, &size) || !GetFileTime(m_file, nullptr, nullptr, &lastWriteTime))
+		{
+			Close();
+			return false;
+		}
+		m_size = (size_t) size.QuadPart;
+		m_lastWriteTime = ((uint64_t) lastWriteTime.dwHighDateTime << 32) | lastWriteTime.dwLowDateTime;
+
+		if (m_size > 0)
+		{
+			m_mapping = CreateFileMappingFromApp(m_file, nullptr, PAGE_READONLY, 0, nullptr);
+			if (m_mapping)
+				m_data = static_cast<const unsigned char*>(MapViewOfFileFromApp(m_mapping, FILE_MAP_READ, 0, 0));
+		}
+#else
+		m_file = open(filename.c_str(), O_RDONLY);
+		if (m_file < 0)
+			return false;
+
+		struct stat status;
+		if (fstat(m_file, &status) != 0)
+		{
+			Close();
+			return false;
+		}
+		m_size = (size_t) status.st_size;
+		m_lastWriteTime = (uint64_t) status.st_mtim.tv_sec * 1000000000ull + (uint64_t) status.st_mtim.tv_nsec;
+
+		if (m_size > 0)
+		{
+			void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_file, 0);
+			if (data != MAP_FAILED)
+				m_data = static_cast<const unsigned char*>(data);
+		}
+#endif
+
+		if (m_size > 0 && !m_data)
+		{
+			Close();
+			return false;
+		}
+
+		return true;
+	}
+
+	void Close()
+	{
+#ifdef _WIN32
+		if (m_data)
+			UnmapViewOfFile(m_data);
+		if (m_mapping)
+			CloseHandle(m_mapping);
+		if (m_file != INVALID_HANDLE_VALUE)
+			CloseHandle(m_file);
+		m_mapping = nullptr;
+		m_file = INVALID_HANDLE_VALUE;
+#else
+		if (m_data)
+			munmap(const_cast<unsigned char*>(m_data), m_size);
+		if (m_file >= 0)
+			close(m_file);
+		m_file = -1;
+#endif
+
+		m_data = nullptr;
+		m_size = 0;
+		m_lastWriteTime = 0;
+	}
+
+	bool IsOpen() const { return m_size == 0 ? IsFileOpen() : m_data != nullptr; }
+	const unsigned char* GetData() const { return m_data; }
+	size_t GetSize() const { return m_size; }
+
+	// In the units of the platform, only meant to be compared with other values from the same platform
+	uint64_t GetLastWriteTime() const { return m_lastWriteTime; }
+
+private:
+
+#ifdef _WIN32
+	bool IsFileOpen() const { return m_file != INVALID_HANDLE_VALUE; }
+
+	HANDLE m_file = INVALID_HANDLE_VALUE;
+	HANDLE m_mapping = nullptr;
+#else
+	bool IsFileOpen() const { return m_file >= 0; }
+
+	int m_file = -1;
+#endif
+
+	const unsigned char* m_data = nullptr;
+	size_t m_size = 0;
+	uint64_t m_lastWriteTime = 0;
+};
@@ -13,6 +13,8 @@
 
 #include "DrawCall.h"
 #include "Common/FileUtilities.h"
+#include "Common/MappedFile.h"
+#include "ObjLoader.h"
 
 #include <iostream>
 #include <fstream>
@@ -20,7 +22,9 @@
 
 #include <wincodec.h>
 
+#include <atomic>
 #include <cassert>
+#include <thread>
 
 using namespace std;
 
@@ -837,6 +841,16 @@ ConstantBuffer& Shader::GetConstantBuffer(unsigned uIdx)
 // Mesh
 //
 
+// Copy of the positions and indices that the build thread builds the BVH from, also used for the ray tests meanwhile
+struct Mesh::PendingBvhBuild
+{
+	vector<XMFLOAT3> positions;
+	vector<uint32_t> indices;
+	shared_ptr<const MeshBvh> bvh;
+	atomic<bool> done{ false };
+	thread buildThread;
+};
+
 Mesh::Mesh(MeshType type)
 	: m_drawStyle(DS_TRILIST), m_d3dBuffersNeedUpdate(true), m_boundingBoxNeedsUpdate(true)
 {
@@ -870,125 +884,63 @@ Mesh::Mesh(string filename)
 	if (!FileExists(filename))
 		filename = string("Media/Meshes/") + filename;
 
-	FILE* pFile = OpenFile(filename, "r");
-	assert(pFile);
-	if (!pFile)
+	// Same search as OpenFile: the filename as-is, then relative to the executable location
+	MappedFile sourceFile;
+	if (!sourceFile.Open(filename))
+	{
+		filename = GetExecutablePath() + "/" + filename;
+		sourceFile.Open(filename);
+	}
+	assert(sourceFile.IsOpen());
+	if (!sourceFile.IsOpen())
 		return;
 
-	auto &vertices = GetVertices();
-	vertices.clear();
-	auto &indices = GetIndices();
-	indices.clear();
+	uint64_t sourceSize = sourceFile.GetSize();
+	uint64_t sourceLastWriteTime = sourceFile.GetLastWriteTime();
 
-	unsigned verticesPerPolygon = 0;
-	vector<XMVECTOR> positions;
-	vector<XMFLOAT2> texcoords;
-	vector<XMVECTOR> normals;
+	// The cache next to the file has the parsed vertices and the BVH
+	vector<ObjVertex> vertices;
+	vector<uint32_t> indices;
+	auto bvh = make_shared<MeshBvh>();
+	string cacheFilename = GetMeshCacheFilename(filename);
+	MappedFile cacheFile;
+	bool cached = cacheFile.Open(cacheFilename) &&
+		ReadMeshCache(cacheFile.GetData(), cacheFile.GetSize(), sourceSize, sourceLastWriteTime, vertices, indices, *bvh);
+	cacheFile.Close();
 
-	map<vector<unsigned>, unsigned> knownVertices;
-
-	char rawLine[1024];
-	stringstream line;
-	while(feof(pFile) == 0)
+	bool parsed = cached;
+	if (!cached)
 	{
-		line.clear();
-		fgets(rawLine, 1024, pFile);
-		line.str(rawLine);
-
-		if(line.peek() == '#')
-			continue;
-
-		string word;
-		line >> word;
-
-		if(word == "v")
-		{
-			XMFLOAT4 position;
-			line >> position.x >> position.y >> position.z;
-			position.w = 1.0f;
-
-			positions.push_back(XMLoadFloat4(&position));
-		}
-
-		if(word == "vn")
-		{
-			XMFLOAT4 normal;
-			line >> normal.x >> normal.y >> normal.z;
-			normal.w = 0.0f;
-
-			normals.push_back(XMLoadFloat4(&normal));
-		}
-
-		if(word == "vt")
-		{
-			XMFLOAT2 texcoord;
-			line >> texcoord.x >> texcoord.y;
-			texcoord.y = 1-texcoord.y;	// Invert v because DX likes texcoords top-down
-
-			texcoords.push_back(texcoord);
-		}
-
-		if(word == "f")
-		{
-			verticesPerPolygon = 0;
-
-			for(;;)
-			{
-				line >> word;
-				if (line.fail())
-					break;
-
-				word += "/";
-				++verticesPerPolygon;
-
-				size_t startIndex = 0;
-				vector<unsigned> ptnSet { 0, 0, 0 };
-				for (size_t i = 0; i < 3; ++i)
-				{
-					size_t endIndex = word.find_first_of('/', startIndex);
-					if (endIndex != startIndex)
-					{
-						string value = word.substr(startIndex, endIndex - startIndex);
-						ptnSet[i] = atoi(value.c_str());
-					}
-					startIndex = endIndex + 1;
-				}
-				
-				auto iterator = knownVertices.find(ptnSet);
-				if (iterator != knownVertices.end())
-				{
-					indices.push_back(iterator->second);
-				}
-				else
-				{
-					Mesh::Vertex vertex;
-					memset(&vertex, 0, sizeof(vertex));
-					if (ptnSet[0] != 0)
-						vertex.position = positions[ptnSet[0] - 1];
-					if (ptnSet[1] != 0)
-						vertex.texcoord = texcoords[ptnSet[1] - 1];
-					if (ptnSet[2] != 0)
-						vertex.normal = normals[ptnSet[2] - 1];
-
-					vertices.push_back(vertex);
-					indices.push_back((unsigned) vertices.size() - 1);
-					knownVertices[ptnSet] = (unsigned) vertices.size() - 1;
-				}
-			}
-		}
+		parsed = ParseObj(reinterpret_cast<const char*>(sourceFile.GetData()), sourceFile.GetSize(), vertices, indices);
+		assert(parsed);
 	}
+	sourceFile.Close();
 
-	fclose(pFile);
-
-	assert(verticesPerPolygon == 3);	// Loader only handles triangle meshes
+	m_vertices.resize(vertices.size());
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		m_vertices[i].position = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(vertices[i].position));
+		m_vertices[i].normal = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(vertices[i].normal));
+		m_vertices[i].texcoord = XMFLOAT2(vertices[i].texcoord[0], vertices[i].texcoord[1]);
+	}
+	m_indices.assign(indices.begin(), indices.end());
 
-	// Invert the winding order to account for DX default (clockwise)
-	for(size_t i = 0; i < indices.size(); i +=3)
+	if (cached)
 	{
-		unsigned temp = indices[i + 0];
-		indices[i + 0] = indices[i + 2];
-		indices[i + 2] = temp;
+		UpdateBoundingBox(bvh, 1);
 	}
+	else
+	{
+		// Only built on the first load of an OBJ file, which can be large, and then read from the cache
+		UpdateBoundingBox(max(thread::hardware_concurrency(), 1u));
+		if (parsed && m_bvh)
+			WriteMeshCache(cacheFilename, sourceSize, sourceLastWriteTime, vertices, indices, *m_bvh);
+	}
+}
+
+Mesh::~Mesh()
+{
+	JoinBvhBuild();
 }
 
 void Mesh::LoadPlane(MeshType type)
@@ -1098,6 +1050,7 @@ void Mesh::LoadBox(const float width, const float height, const float depth)
 	XMFLOAT2 ct = { 1.f, 1.f };
 	XMFLOAT2 dt = { 0.f, 1.f };
 
+	Clear();
 	m_vertices.resize(6 * 2 * 3);
 	for (size_t i = 0; i < 6; ++i)
 	{
@@ -1197,8 +1150,7 @@ void Mesh::LoadCylinder(const float radius, const float height)
 	discs.push_back({ center + upDir * height / 2.0f, upDir, rightDir, radius, radius });
 	discs.push_back({ center + upDir * height / 2.0f, upDir, rightDir, 0.0f, 0.0f });
 
-	m_vertices.clear();
-	m_indices.clear();
+	Clear();
 	AppendGeometryForDiscs(discs, segmentCount);
 	GenerateSmoothNormals();
 }
@@ -1216,8 +1168,7 @@ void Mesh::LoadRoundedBox(const float width, const float height, const float dep
 	discs.push_back({ center + upDir * height / 2.0f, upDir, rightDir, width / 2.0f, depth / 2.0f });
 	discs.push_back({ center + upDir * height / 2.0f, upDir, rightDir, 0.0f, 0.0f });
 
-	m_vertices.clear();
-	m_indices.clear();
+	Clear();
 	AppendGeometryForDiscs(discs, segmentCount, DiscMode::RoundedSquare);
 	GenerateSmoothNormals();
 }
@@ -1231,7 +1182,7 @@ void Mesh::LoadSphere()
 	XMVECTOR yAxis = XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
 	XMVECTOR zAxis = XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f);
 
-	m_vertices.clear();
+	Clear();
 	for (unsigned discIndex = 0; discIndex <= segmentCount; ++discIndex)
 	{
 		float pitchAngle = XM_PI * ((float)discIndex / (float)segmentCount);
@@ -1435,6 +1386,8 @@ void Mesh::AppendGeometryForDiscs(const std::vector<Disc>& discs, unsigned segme
 	if (discs.empty())
 		return;
 
+	Dequantize();
+
 	auto AppendVerticesFunction = (discMode == DiscMode::Circle) ? AppendVerticesForCircleDisc : 
 		(discMode == DiscMode::Square) ? AppendVerticesForSquareDisc : AppendVerticesForRoundedSquareDisc;
 
@@ -1527,6 +1480,8 @@ void Mesh::AppendGeometryForDiscs(const std::vector<Disc>& discs, unsigned segme
 
 bool Mesh::SaveToFile(const std::string& filename)
 {
+	Dequantize();
+
 	ofstream out(filename);
 	if (!out.is_open())
 		return false;
@@ -1551,6 +1506,8 @@ void Mesh::Clear()
 
 void Mesh::BakeTransform(const XMMATRIX& transform)
 {
+	Dequantize();
+
 	m_boundingBoxNeedsUpdate = true;
 	m_d3dBuffersNeedUpdate = true;
 
@@ -1563,6 +1520,8 @@ void Mesh::BakeTransform(const XMMATRIX& transform)
 
 void Mesh::GenerateSmoothNormals()
 {
+	Dequantize();
+
 	m_d3dBuffersNeedUpdate = true;
 
 	for (size_t index = 0; index < m_indices.size(); index += 3)
@@ -1588,6 +1547,7 @@ void Mesh::UpdateVertices(Vertex* pVertices, unsigned vertexCount)
 {
 	m_boundingBoxNeedsUpdate = true;
 	m_d3dBuffersNeedUpdate = true;
+	m_quantizedVertices.clear();
 
 	if (!pVertices)
 	{
@@ -1608,6 +1568,7 @@ void Mesh::UpdateVertices(Vertex* pVertices, unsigned vertexCount, unsigned* pIn
 {
 	m_boundingBoxNeedsUpdate = true;
 	m_d3dBuffersNeedUpdate = true;
+	m_quantizedVertices.clear();
 
 	if (!pVertices || !pIndices)
 	{
@@ -1625,6 +1586,8 @@ void Mesh::UpdateVertices(Vertex* pVertices, unsigned vertexCount, unsigned* pIn
 
 std::vector<Mesh::Vertex>& Mesh::GetVertices()
 {
+	Dequantize();
+
 	m_d3dBuffersNeedUpdate = true;
 	m_boundingBoxNeedsUpdate = true;
 
@@ -1639,6 +1602,38 @@ std::vector<unsigned>& Mesh::GetIndices()
 	return m_indices;
 }
 
+void Mesh::Quantize()
+{
+	if (IsQuantized() || m_vertices.empty())
+		return;
+
+	m_d3dBuffersNeedUpdate = true;
+	m_boundingBoxNeedsUpdate = true;
+
+	Vertex& firstVertex = m_vertices[0];
+	m_quantizedVertices.resize(m_vertices.size());
+	QuantizeVertices((const float*) &firstVertex.position, (const float*) &firstVertex.normal, &firstVertex.texcoord.x, sizeof(Vertex), m_vertices.size(),
+		m_quantizedVertices.data(), m_positionDequantization);
+
+	vector<Vertex>().swap(m_vertices);
+}
+
+void Mesh::Dequantize()
+{
+	if (!IsQuantized())
+		return;
+
+	m_d3dBuffersNeedUpdate = true;
+	m_boundingBoxNeedsUpdate = true;
+
+	m_vertices.resize(m_quantizedVertices.size());
+	Vertex& firstVertex = m_vertices[0];
+	DequantizeVertices(m_quantizedVertices.data(), m_quantizedVertices.size(), m_positionDequantization,
+		(float*) &firstVertex.position, (float*) &firstVertex.normal, &firstVertex.texcoord.x, sizeof(Vertex));
+
+	vector<QuantizedVertex>().swap(m_quantizedVertices);
+}
+
 ID3D11Buffer* Mesh::GetVertexBuffer()
 {
 	if (m_d3dBuffersNeedUpdate)
@@ -1655,111 +1650,50 @@ ID3D11Buffer* Mesh::GetIndexBuffer()
 	return m_d3dIndexBuffer.Get();
 }
 
-bool Mesh::BoundingBoxNode::TestRayIntersection(const vector<Vertex>& vertices, const XMVECTOR& rayOriginInWorldSpace, const XMVECTOR& rayDirectionInWorldSpace,
-	const XMMATRIX& worldTransform, float &distance, XMVECTOR& normalInLocalSpace,
-	float maxDistance, bool returnFurthest)
+bool Mesh::TestRayIntersection(const XMVECTOR& rayOriginInWorldSpace, const XMVECTOR& rayDirectionInWorldSpace, const XMMATRIX& worldTransform, float &distance, XMVECTOR &normal, float maxDistance, bool returnFurthest)
 {
-	//	XMVector3Transform()
-	BoundingBox boundingBoxInWorldSpace;
-	boundingBox.Transform(boundingBoxInWorldSpace, worldTransform);
-	if (!boundingBoxInWorldSpace.Intersects(rayOriginInWorldSpace, XMVector3Normalize(rayDirectionInWorldSpace), distance))
+	if (IsEmpty())
 		return false;
 
-	bool hit = false;
-	float closestDistance = FLT_MAX;
-	float furthestDistance = -1.0f;
-	XMVECTOR returnedNormal = XMVectorZero();
-
-	if (!children.empty())
-	{
-		float currentDistance = 0.0f;
-		XMVECTOR currentNormal = XMVectorZero();
-
-		for (auto& node : children)
-		{
-			if (node.TestRayIntersection(vertices, rayOriginInWorldSpace, rayDirectionInWorldSpace, worldTransform, currentDistance, currentNormal, maxDistance, returnFurthest))
-			{
-				if (!returnFurthest
-					&& currentDistance < closestDistance)
-				{
-					closestDistance = currentDistance;
-					returnedNormal = currentNormal;
-					hit = true;
-				}
-
-				if (returnFurthest
-					&& currentDistance > furthestDistance
-					&& currentDistance <= maxDistance)
-				{
-					furthestDistance = currentDistance;
-					returnedNormal = currentNormal;
-					hit = true;
-				}
-			}
-		}
-	}
-	else
-	{
-		float currentDistance = 0.0f;
-		XMVECTOR currentNormal = XMVectorZero();
-
-		for (size_t i = 0; i < indicesContained.size(); i += 3)
-		{
-			XMVECTOR v1 = XMVector3Transform(vertices[indicesContained[i + 0]].position, worldTransform);
-			XMVECTOR v2 = XMVector3Transform(vertices[indicesContained[i + 1]].position, worldTransform);
-			XMVECTOR v3 = XMVector3Transform(vertices[indicesContained[i + 2]].position, worldTransform);
-
-			if (TriangleTests::Intersects(rayOriginInWorldSpace, rayDirectionInWorldSpace, v1, v2, v3, currentDistance))
-			{
-				// Calculate normal and reject backfacing triangles (clockwise winding order)
-				XMVECTOR ab = v2 - v1;
-				XMVECTOR ac = v3 - v1;
-				currentNormal = XMVector3Normalize(XMVector3Cross(ac, ab));
+	if (m_boundingBoxNeedsUpdate)
+		UpdateBoundingBox();
 
-				if (XMVectorGetX(XMVector3Dot(XMVectorNegate(rayDirectionInWorldSpace), currentNormal)) < 0)
-					continue;
+	if (m_drawStyle != Mesh::DS_TRILIST)
+		return false;
 
-				if (!returnFurthest
-					&& currentDistance < closestDistance)
-				{
-					closestDistance = currentDistance;
-					returnedNormal = currentNormal;
-					hit = true;
-				}
+	// Transform the ray to local space once instead of every tested triangle to world space.
+	//	The direction is not renormalized, so distances along it are still world space distances.
+	XMVECTOR determinant;
+	XMMATRIX worldToLocal = XMMatrixInverse(&determinant, worldTransform);
+	XMFLOAT3 rayOrigin, rayDirection;
+	XMStoreFloat3(&rayOrigin, XMVector3TransformCoord(rayOriginInWorldSpace, worldToLocal));
+	XMStoreFloat3(&rayDirection, XMVector3TransformNormal(rayDirectionInWorldSpace, worldToLocal));
 
-				if (returnFurthest
-					&& currentDistance > furthestDistance
-					&& currentDistance <= maxDistance)
-				{
-					furthestDistance = currentDistance;
-					returnedNormal = currentNormal;
-					hit = true;
-				}
-			}
-		}
-	}
+	// Mirroring transforms flip the winding order, and with it which faces are backfacing (clockwise winding order is front)
+	bool mirrored = XMVectorGetX(determinant) < 0.0f;
 
-	if (hit)
+	MeshBvh::Hit hit;
+	MeshBvh::HitMode hitMode = returnFurthest ? MeshBvh::HitMode::Furthest : MeshBvh::HitMode::Closest;
+	MeshBvh::Culling culling = mirrored ? MeshBvh::Culling::FrontFaces : MeshBvh::Culling::BackFaces;
+	if (IsBvhBuildPending())
 	{
-		distance = returnFurthest ? furthestDistance : closestDistance;
-		normalInLocalSpace = returnedNormal;
+		if (!MeshBvh::IntersectTriangles(m_pendingBvhBuild->positions.data(), sizeof(XMFLOAT3), m_pendingBvhBuild->indices.data(), m_pendingBvhBuild->indices.size(),
+			&rayOrigin.x, &rayDirection.x, hit, hitMode, culling, maxDistance))
+			return false;
 	}
-
-	return hit;
-}
-
-bool Mesh::TestRayIntersection(const XMVECTOR& rayOriginInWorldSpace, const XMVECTOR& rayDirectionInWorldSpace, const XMMATRIX& worldTransform, float &distance, XMVECTOR &normal, float maxDistance, bool returnFurthest)
-{
-	if (IsEmpty())
+	else if (!m_bvh || !m_bvh->Intersect(&rayOrigin.x, &rayDirection.x, hit, hitMode, culling, maxDistance))
+	{
 		return false;
+	}
 
-	if (m_boundingBoxNeedsUpdate)
-		UpdateBoundingBox();
-
-	if (m_drawStyle != Mesh::DS_TRILIST)
-		return false;
+	// Normals transform with the inverse transpose
+	XMVECTOR normalInLocalSpace = XMVectorSet(hit.normal[0], hit.normal[1], hit.normal[2], 0.0f);
+	normal = XMVector3Normalize(XMVector3TransformNormal(normalInLocalSpace, XMMatrixTranspose(worldToLocal)));
+	if (mirrored)
+		normal = XMVectorNegate(normal);
 
-	return m_boundingBoxNode.TestRayIntersection(m_vertices, rayOriginInWorldSpace, rayDirectionInWorldSpace, worldTransform, distance, normal, maxDistance, returnFurthest);
+	distance = hit.distance;
+	return true;
 }
 
 bool Mesh::TestRayIntersection(const XMVECTOR& rayOriginInWorldSpace, const XMVECTOR& rayDirectionInWorldSpace, const XMMATRIX& worldTransform, float& distance)
@@ -1777,96 +1711,97 @@ bool Mesh::TestPointInside(const XMVECTOR& pointInWorldSpace, const XMMATRIX& wo
 		UpdateBoundingBox();
 
 	BoundingOrientedBox orientedBoundingBox;
-	BoundingOrientedBox::CreateFromBoundingBox(orientedBoundingBox, m_boundingBoxNode.boundingBox);	
+	BoundingOrientedBox::CreateFromBoundingBox(orientedBoundingBox, m_boundingBox);	
 	orientedBoundingBox.Transform(orientedBoundingBox, worldTransform);
 
 	return orientedBoundingBox.Contains(pointInWorldSpace) == CONTAINS;
 }
 
-void Mesh::BoundingBoxNode::GenerateChildNodes(const vector<Mesh::Vertex>& vertices, const vector<unsigned>& indices, unsigned currentDepth)
+const BoundingBox& Mesh::GetBoundingBox()
 {
-	indicesContained.clear();
-	if (currentDepth == 1)
-	{
-		indicesContained = indices;
-	}
-	else
-	{
-		for (size_t i = 0; i < indices.size(); i += 3)
-		{
-			unsigned indexA = indices[i + 0];
-			unsigned indexB = indices[i + 1];
-			unsigned indexC = indices[i + 2];
+	if (m_boundingBoxNeedsUpdate)
+		UpdateBoundingBox();
 
-			if (boundingBox.Contains(vertices[indexA].position) == ContainmentType::CONTAINS ||
-				boundingBox.Contains(vertices[indexB].position) == ContainmentType::CONTAINS ||
-				boundingBox.Contains(vertices[indexC].position) == ContainmentType::CONTAINS)
-			{
-				indicesContained.push_back(indexA);
-				indicesContained.push_back(indexB);
-				indicesContained.push_back(indexC);
-			}
-		}
-	}
+	return m_boundingBox;
+}
 
-	if(indices.size() / 3 > targetTriangleCount)
-	{
-		XMFLOAT3 childExtents;
-		childExtents.x = boundingBox.Extents.x / 2.0f;
-		childExtents.y = boundingBox.Extents.y / 2.0f;
-		childExtents.z = boundingBox.Extents.z / 2.0f;
+shared_ptr<const MeshBvh> Mesh::GetBvh()
+{
+	if (m_boundingBoxNeedsUpdate)
+		UpdateBoundingBox();
 
-		float xSigns[8] = { 1.0f, -1.0f, 1.0f, -1.0f, 1.0f, -1.0f, 1.0f, -1.0f };
-		float ySigns[8] = { 1.0f, 1.0f, 1.0f, 1.0f, -1.0f, -1.0f, -1.0f, -1.0f };
-		float zSigns[8] = { 1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, -1.0f, -1.0f };
+	IsBvhBuildPending();
+	return m_bvh;
+}
 
-		children.resize(8);
-		for (unsigned i = 0; i < 8; ++i)
-		{
-			auto& child = children[i];
-			child.boundingBox.Center.x = boundingBox.Center.x + xSigns[i] * childExtents.x;
-			child.boundingBox.Center.y = boundingBox.Center.y + ySigns[i] * childExtents.y;
-			child.boundingBox.Center.z = boundingBox.Center.z + zSigns[i] * childExtents.z;
-			child.boundingBox.Extents = childExtents;
-			child.GenerateChildNodes(vertices, indicesContained, currentDepth + 1);
-		}
-	}
-	else
+bool Mesh::IsBvhBuildPending()
+{
+	if (m_pendingBvhBuild && m_pendingBvhBuild->done.load(memory_order_acquire))
 	{
-		children.clear();
+		m_pendingBvhBuild->buildThread.join();
+		m_bvh = m_pendingBvhBuild->bvh;
+		m_pendingBvhBuild = nullptr;
 	}
+
+	return m_pendingBvhBuild != nullptr;
 }
 
-const BoundingBox& Mesh::GetBoundingBox()
+// The build cannot be stopped, so this waits for it to finish
+void Mesh::JoinBvhBuild()
 {
-	if (m_boundingBoxNeedsUpdate)
-		UpdateBoundingBox();
+	if (m_pendingBvhBuild && m_pendingBvhBuild->buildThread.joinable())
+		m_pendingBvhBuild->buildThread.join();
+}
 
-	return m_boundingBoxNode.boundingBox;
+void Mesh::UpdateBoundingBox(unsigned bvhThreadCount)
+{
+	UpdateBoundingBox(nullptr, bvhThreadCount);
 }
 
-void Mesh::UpdateBoundingBox()
+// The BVH is built unless one is given, which must have been built from the same vertices and indices
+void Mesh::UpdateBoundingBox(shared_ptr<const MeshBvh> prebuiltBvh, unsigned bvhThreadCount)
 {
 	m_boundingBoxNeedsUpdate = false;
 
+	// The build of the previous geometry is dropped once done, there is at most one build thread per mesh
+	JoinBvhBuild();
+	m_pendingBvhBuild = nullptr;
+
 	if (IsEmpty())
 	{
-		m_boundingBoxNode.boundingBox = BoundingBox(XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, 0.0f));
-		m_boundingBoxNode.children.clear();
+		m_boundingBox = BoundingBox(XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, 0.0f));
+		m_bvh = nullptr;
 		return;
 	}
 
+	// Quantized positions are decoded for the bounds and the BVH, which keeps its own copy of the triangles
+	const unsigned char* pPositions = nullptr;
+	size_t positionStride = 0;
+	vector<XMFLOAT4> dequantizedPositions;
+	if (IsQuantized())
+	{
+		dequantizedPositions.resize(m_quantizedVertices.size());
+		DequantizeVertices(m_quantizedVertices.data(), m_quantizedVertices.size(), m_positionDequantization, &dequantizedPositions[0].x, nullptr, nullptr, sizeof(XMFLOAT4));
+		pPositions = (const unsigned char*) dequantizedPositions.data();
+		positionStride = sizeof(XMFLOAT4);
+	}
+	else
+	{
+		pPositions = (const unsigned char*) &m_vertices[0].position;
+		positionStride = sizeof(Vertex);
+	}
+
 	float minX, minY, minZ;
 	minX = minY = minZ = FLT_MAX;
 	float maxX, maxY, maxZ;
 	maxX = maxY = maxZ = -FLT_MAX;
 
-	for (unsigned i = 0; i < m_vertices.size(); ++i)
+	for (unsigned i = 0; i < GetVertexCount(); ++i)
 	{
-		Vertex& vertex = m_vertices[i];
-		float x = XMVectorGetX(vertex.position);
-		float y = XMVectorGetY(vertex.position);
-		float z = XMVectorGetZ(vertex.position);
+		const float* position = (const float*) (pPositions + i * positionStride);
+		float x = position[0];
+		float y = position[1];
+		float z = position[2];
 
 		if (x < minX)
 			minX = x;
@@ -1884,15 +1819,47 @@ void Mesh::UpdateBoundingBox()
 			maxZ = z;
 	}
 
-	m_boundingBoxNode.boundingBox.Extents.x = (maxX - minX) / 2.0f;
-	m_boundingBoxNode.boundingBox.Extents.y = (maxY - minY) / 2.0f;
-	m_boundingBoxNode.boundingBox.Extents.z = (maxZ - minZ) / 2.0f;
+	m_boundingBox.Extents.x = (maxX - minX) / 2.0f;
+	m_boundingBox.Extents.y = (maxY - minY) / 2.0f;
+	m_boundingBox.Extents.z = (maxZ - minZ) / 2.0f;
+
+	m_boundingBox.Center.x = minX + m_boundingBox.Extents.x;
+	m_boundingBox.Center.y = minY + m_boundingBox.Extents.y;
+	m_boundingBox.Center.z = minZ + m_boundingBox.Extents.z;
+
+	if (prebuiltBvh)
+	{
+		m_bvh = prebuiltBvh;
+		return;
+	}
+
+	static_assert(sizeof(unsigned) == sizeof(uint32_t), "Mesh indices are passed to the BVH as uint32_t");
+
+	if (m_asyncBvhBuild)
+	{
+		// The build reads its own copy of the geometry, which can change meanwhile
+		m_bvh = nullptr;
+		m_pendingBvhBuild = make_unique<PendingBvhBuild>();
+		PendingBvhBuild* build = m_pendingBvhBuild.get();
+		build->positions.resize(GetVertexCount());
+		for (unsigned i = 0; i < GetVertexCount(); ++i)
+			memcpy(&build->positions[i], pPositions + i * positionStride, sizeof(XMFLOAT3));
+		build->indices.assign(m_indices.begin(), m_indices.end());
 
-	m_boundingBoxNode.boundingBox.Center.x = minX + m_boundingBoxNode.boundingBox.Extents.x;
-	m_boundingBoxNode.boundingBox.Center.y = minY + m_boundingBoxNode.boundingBox.Extents.y;
-	m_boundingBoxNode.boundingBox.Center.z = minZ + m_boundingBoxNode.boundingBox.Extents.z;
+		build->buildThread = thread([build, bvhThreadCount]()
+		{
+			auto bvh = make_shared<MeshBvh>();
+			bvh->Build(build->positions.data(), sizeof(XMFLOAT3), build->positions.size(), build->indices.data(), build->indices.size(), bvhThreadCount);
+			build->bvh = bvh;
+			build->done.store(true, memory_order_release);
+		});
+		return;
+	}
 
-	m_boundingBoxNode.GenerateChildNodes(m_vertices, m_indices, 1);
+	// Out of range indices leave the hierarchy empty, so that the rays miss the mesh instead of reading past its vertices
+	auto bvh = make_shared<MeshBvh>();
+	bvh->Build(pPositions, positionStride, GetVertexCount(), reinterpret_cast<const uint32_t*>(m_indices.data()), m_indices.size(), bvhThreadCount);
+	m_bvh = bvh;
 }
 
 // Updates the vertex/index buffers if they already exists and is large enough, otherwise recreates them
@@ -1907,21 +1874,25 @@ void Mesh::UpdateD3DBuffers()
 		return;
 	}
 
-	if (m_d3dVertexBuffer && m_d3dVertexBufferDesc.ByteWidth / m_d3dVertexBufferDesc.StructureByteStride >= m_vertices.size())
+	// The buffer is recreated when the vertex format changes
+	const void* pVertexData = IsQuantized() ? (const void*) m_quantizedVertices.data() : (const void*) m_vertices.data();
+	unsigned vertexStride = GetVertexStride();
+
+	if (m_d3dVertexBuffer && m_d3dVertexBufferDesc.StructureByteStride == vertexStride && m_d3dVertexBufferDesc.ByteWidth / vertexStride >= GetVertexCount())
 	{
-		g_d3dContext->UpdateSubresource(m_d3dVertexBuffer.Get(), 0, nullptr, m_vertices.data(), (UINT) m_vertices.size() * sizeof(Vertex), 1);
+		g_d3dContext->UpdateSubresource(m_d3dVertexBuffer.Get(), 0, nullptr, pVertexData, GetVertexCount() * vertexStride, 1);
 	}
 	else
 	{
 		memset(&m_d3dVertexBufferDesc, 0, sizeof(D3D11_BUFFER_DESC));
-		m_d3dVertexBufferDesc.ByteWidth = (UINT) m_vertices.size() * sizeof(Vertex);
+		m_d3dVertexBufferDesc.ByteWidth = GetVertexCount() * vertexStride;
 		m_d3dVertexBufferDesc.Usage = D3D11_USAGE_DEFAULT;
 		m_d3dVertexBufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-		m_d3dVertexBufferDesc.StructureByteStride = sizeof(Vertex);
+		m_d3dVertexBufferDesc.StructureByteStride = vertexStride;
 
 		D3D11_SUBRESOURCE_DATA data;
 		memset(&data, 0, sizeof(data));
-		data.pSysMem = m_vertices.data();
+		data.pSysMem = pVertexData;
 
 		g_d3dDevice->CreateBuffer(&m_d3dVertexBufferDesc, &data, &m_d3dVertexBuffer);
 		assert(m_d3dVertexBuffer);
@@ -1957,6 +1928,14 @@ const float DrawCall::DefaultFontSize = 64.0f;
 XMMATRIX DrawCall::m_mtxLightViewProj;
 XMMATRIX DrawCall::m_mtxCameraView;
 DrawCall::Projection DrawCall::m_cameraProj;
+FrameConstants DrawCall::m_frameConstants;
+
+RenderQueue DrawCall::m_renderQueue;
+vector<DrawCall::QueuedDraw> DrawCall::m_queuedDraws;
+map<tuple<Shader*, Shader*, Shader*, bool, bool>, uint64_t> DrawCall::m_renderQueueShaderKeys;
+Microsoft::WRL::ComPtr<ID3D11Buffer> DrawCall::m_renderQueueInstanceBuffer;
+size_t DrawCall::m_renderQueueInstanceBufferSize = 0;
+FrameConstants::Inputs DrawCall::m_renderQueueFrameInputs;
 
 XMVECTOR DrawCall::vAmbient;
 DrawCall::Light DrawCall::vLights[kMaxLights];
@@ -2221,6 +2200,12 @@ bool DrawCall::ResizeSwapChain(unsigned newWidth, unsigned newHeight)
 
 void DrawCall::Uninitialize()
 {
+	m_renderQueue.Clear();
+	m_queuedDraws.clear();
+	m_renderQueueShaderKeys.clear();
+	m_renderQueueInstanceBuffer.Reset();
+	m_renderQueueInstanceBufferSize = 0;
+
 	m_shaderStore.clear();
 
 	m_backBuffer.reset();
@@ -2272,12 +2257,18 @@ bool DrawCall::IsSinglePassSteroEnabled()
 
 void DrawCall::EnableSinglePassStereo(bool enabled)
 {
-	if (IsSinglePassSteroSupported())
+	if (IsSinglePassSteroSupported() && m_singlePassStereoEnabled != enabled)
+	{
+		// The queued draws were submitted for the previous mode
+		FlushRenderQueue();
 		m_singlePassStereoEnabled = enabled;
+	}
 }
 
 void DrawCall::PushView(const XMMATRIX& mtxLeft, const XMMATRIX& mtxRight)
 {
+	FlushRenderQueue();
+
 	m_activeView.mtx = mtxLeft;
 	m_activeView.mtxRight = mtxRight;
 	m_viewStack.push(m_activeView);
@@ -2285,6 +2276,8 @@ void DrawCall::PushView(const XMMATRIX& mtxLeft, const XMMATRIX& mtxRight)
 
 void DrawCall::PushView(const XMVECTOR& vEye, const XMVECTOR vAt, const XMVECTOR &vUp)
 {
+	FlushRenderQueue();
+
 	m_activeView.mtx = m_activeView.mtxRight = XMMatrixLookAtRH(vEye, vAt, vUp);
 	m_viewStack.push(m_activeView);
 }
@@ -2295,6 +2288,8 @@ void DrawCall::PopView()
 	if(m_viewStack.size() <=1)
 		return;
 
+	FlushRenderQueue();
+
 	m_viewStack.pop();
 	m_activeView = m_viewStack.top();
 }
@@ -2306,6 +2301,8 @@ XMMATRIX DrawCall::GetView()
 
 void DrawCall::PushProj(const XMMATRIX& mtxLeft, const XMMATRIX& mtxRight)
 {
+	FlushRenderQueue();
+
 	memset(&m_activeProjection, 0, sizeof(m_activeProjection));
 
 	m_activeProjection.mtx = mtxLeft;
@@ -2316,6 +2313,8 @@ void DrawCall::PushProj(const XMMATRIX& mtxLeft, const XMMATRIX& mtxRight)
 
 void DrawCall::PushProj(float fFOV, float fAspect, float fNear, float fFar)
 {
+	FlushRenderQueue();
+
 	m_activeProjection.mtx = XMMatrixPerspectiveFovRH(fFOV, fAspect, fNear, fFar);
 	m_activeProjection.fNearPlaneHeight = tan(fFOV * .5f) * 2.f * fNear;
 	m_activeProjection.fNearPlaneWidth = m_activeProjection.fNearPlaneHeight * fAspect;
@@ -2328,6 +2327,8 @@ void DrawCall::PushProj(float fFOV, float fAspect, float fNear, float fFar)
 
 void DrawCall::PushProjOrtho(float fWidth, float fHeight, float fNear, float fFar)
 {
+	FlushRenderQueue();
+
 	m_activeProjection.mtx = XMMatrixOrthographicRH(fWidth, fHeight, fNear, fFar);
 	m_activeProjection.fNearPlaneHeight = fHeight;
 	m_activeProjection.fNearPlaneWidth = fWidth;
@@ -2344,6 +2345,8 @@ void DrawCall::PopProj()
 	if (m_viewStack.size() <= 1)
 		return;
 
+	FlushRenderQueue();
+
 	m_projectionStack.pop();
 	m_activeProjection = m_projectionStack.top();
 }
@@ -2355,11 +2358,13 @@ XMMATRIX DrawCall::GetProj()
 
 void DrawCall::StoreCurrentViewProjAsLightViewProj()
 {
+	FlushRenderQueue();
 	m_mtxLightViewProj = XMMatrixMultiply(m_activeView.mtx, m_activeProjection.mtx);
 }
 
 void DrawCall::StoreCurrentViewAsCameraView()
 {
+	FlushRenderQueue();
 	m_mtxCameraView = m_activeView.mtx;
 	m_cameraProj = m_activeProjection;
 }
@@ -2371,6 +2376,8 @@ shared_ptr<Texture2D> DrawCall::GetBackBuffer()
 
 void DrawCall::SetBackBuffer(shared_ptr<Texture2D> backBuffer)
 {
+	FlushRenderQueue();
+
 	if (m_renderPassIndexStack.empty())
 		m_activeRenderPassIndex = 0;
 
@@ -2447,6 +2454,8 @@ void DrawCall::PushRenderPass(unsigned renderPassIndex, shared_ptr<Texture2D> re
 
 void DrawCall::PushRenderPass(unsigned renderPassIndex, vector<shared_ptr<Texture2D>> renderTargets)
 {
+	FlushRenderQueue();
+
 	m_renderPassIndexStack.push(renderPassIndex);
 	m_activeRenderPassIndex = renderPassIndex;
 
@@ -2459,6 +2468,8 @@ void DrawCall::PushRenderPass(unsigned renderPassIndex, vector<shared_ptr<Textur
 
 void DrawCall::PopRenderPass()
 {
+	FlushRenderQueue();
+
 	m_renderPassIndexStack.pop();
 	if (m_renderPassIndexStack.empty())
 		m_activeRenderPassIndex = 0;
@@ -2510,12 +2521,16 @@ bool DrawCall::IsRightEyePassActive()
 
 void DrawCall::PushRightEyePass(unsigned renderPassIndex, shared_ptr<Texture2D> renderTarget)
 {
+	FlushRenderQueue();
+
 	m_sRightEyePassStates.push(true);
 	PushRenderPass(renderPassIndex, renderTarget);
 }
 
 void DrawCall::PopRightEyePass()
 {
+	FlushRenderQueue();
+
 	m_sRightEyePassStates.pop();
 	PopRenderPass();
 }
@@ -2579,14 +2594,7 @@ void DrawCall::PushAlphaBlendState(BlendState blendState)
 {
 	m_sAlphaBlendStates.push(blendState);
 
-	if (m_sAlphaBlendStates.top() == BLEND_ALPHA)
-		g_d3dContext->OMSetBlendState(m_d3dAlphaBlendEnabledState.Get(), nullptr, 0xffffffff);
-	else if (m_sAlphaBlendStates.top() == BLEND_ADDITIVE)
-		g_d3dContext->OMSetBlendState(m_d3dAdditiveBlendEnabledState.Get(), nullptr, 0xffffffff);
-	else if(m_sAlphaBlendStates.top() == BLEND_COLOR_DISABLED)
-		g_d3dContext->OMSetBlendState(m_d3dColorWriteDisabledState.Get(), nullptr, 0xffffffff);
-	else
-		g_d3dContext->OMSetBlendState(nullptr, nullptr, 0xffffffff);
+	SetD3DBlendState(m_sAlphaBlendStates.top());
 }
 
 void DrawCall::PopAlphaBlendState()
@@ -2596,24 +2604,14 @@ void DrawCall::PopAlphaBlendState()
 
 	m_sAlphaBlendStates.pop();
 
-	if (m_sAlphaBlendStates.top() == BLEND_ALPHA)
-		g_d3dContext->OMSetBlendState(m_d3dAlphaBlendEnabledState.Get(), nullptr, 0xffffffff);
-	else if (m_sAlphaBlendStates.top() == BLEND_ADDITIVE)
-		g_d3dContext->OMSetBlendState(m_d3dAdditiveBlendEnabledState.Get(), nullptr, 0xffffffff);
-	else if (m_sAlphaBlendStates.top() == BLEND_COLOR_DISABLED)
-		g_d3dContext->OMSetBlendState(m_d3dColorWriteDisabledState.Get(), nullptr, 0xffffffff);
-	else
-		g_d3dContext->OMSetBlendState(nullptr, nullptr, 0xffffffff);
+	SetD3DBlendState(m_sAlphaBlendStates.top());
 }
 
 void DrawCall::PushDepthTestState(bool bEnabled)
 {
 	m_sDepthTestStates.push(bEnabled);
 
-	if (!m_sDepthTestStates.top())
-		g_d3dContext->OMSetDepthStencilState(m_d3dDepthTestDisabledState.Get(), 0);
-	else
-		g_d3dContext->OMSetDepthStencilState(nullptr, 0);
+	SetD3DDepthTestState(m_sDepthTestStates.top());
 }
 
 void DrawCall::PopDepthTestState()
@@ -2623,20 +2621,14 @@ void DrawCall::PopDepthTestState()
 
 	m_sDepthTestStates.pop();
 
-	if (!m_sDepthTestStates.top())
-		g_d3dContext->OMSetDepthStencilState(m_d3dDepthTestDisabledState.Get(), 0);
-	else
-		g_d3dContext->OMSetDepthStencilState(nullptr, 0);
+	SetD3DDepthTestState(m_sDepthTestStates.top());
 }
 
 void DrawCall::PushBackfaceCullingState(bool bEnabled)
 {
 	m_sBackfaceCullingStates.push(bEnabled);
 
-	if (!m_sBackfaceCullingStates.top())
-		g_d3dContext->RSSetState(m_d3dBackfaceCullingDisabledState.Get());
-	else
-		g_d3dContext->RSSetState(nullptr);
+	SetD3DBackfaceCullingState(m_sBackfaceCullingStates.top());
 }
 
 void DrawCall::PopBackfaceCullingState()
@@ -2646,7 +2638,32 @@ void DrawCall::PopBackfaceCullingState()
 
 	m_sBackfaceCullingStates.pop();
 
-	if (!m_sBackfaceCullingStates.top())
+	SetD3DBackfaceCullingState(m_sBackfaceCullingStates.top());
+}
+
+void DrawCall::SetD3DBlendState(BlendState blendState)
+{
+	if (blendState == BLEND_ALPHA)
+		g_d3dContext->OMSetBlendState(m_d3dAlphaBlendEnabledState.Get(), nullptr, 0xffffffff);
+	else if (blendState == BLEND_ADDITIVE)
+		g_d3dContext->OMSetBlendState(m_d3dAdditiveBlendEnabledState.Get(), nullptr, 0xffffffff);
+	else if (blendState == BLEND_COLOR_DISABLED)
+		g_d3dContext->OMSetBlendState(m_d3dColorWriteDisabledState.Get(), nullptr, 0xffffffff);
+	else
+		g_d3dContext->OMSetBlendState(nullptr, nullptr, 0xffffffff);
+}
+
+void DrawCall::SetD3DDepthTestState(bool enabled)
+{
+	if (!enabled)
+		g_d3dContext->OMSetDepthStencilState(m_d3dDepthTestDisabledState.Get(), 0);
+	else
+		g_d3dContext->OMSetDepthStencilState(nullptr, 0);
+}
+
+void DrawCall::SetD3DBackfaceCullingState(bool enabled)
+{
+	if (!enabled)
 		g_d3dContext->RSSetState(m_d3dBackfaceCullingDisabledState.Get());
 	else
 		g_d3dContext->RSSetState(nullptr);
@@ -2681,6 +2698,8 @@ shared_ptr<Shader> DrawCall::LoadShaderUsingShaderStore(Shader::ShaderType type,
 
 void DrawCall::Present()
 {
+	FlushRenderQueue();
+
 	if (g_d3dSwapChain)
 		g_d3dSwapChain->Present(0, 0);
 }
@@ -2852,16 +2871,43 @@ void DrawCall::SetInstanceCapacity(unsigned instanceCapacity, bool enableParticl
 		m_particleInstances.clear();
 	}
 
-	vector<D3D11_INPUT_ELEMENT_DESC> elements = g_instancedElements;
 	unsigned instanceSize = sizeof(Instance);
 	m_instances.resize(instanceCapacity);
 	if (enableParticleInstancing)
 	{
-		elements = g_instancedParticleElements;
 		instanceSize = sizeof(ParticleInstance);
 		m_particleInstances.resize(instanceCapacity);
 	}
 
+	m_particleInstancingEnabled = enableParticleInstancing;
+	CreateInputLayouts();
+
+	D3D11_BUFFER_DESC d3dBufferDesc;
+	memset(&d3dBufferDesc, 0, sizeof(D3D11_BUFFER_DESC));
+	d3dBufferDesc.ByteWidth = instanceCapacity * instanceSize;
+
+	d3dBufferDesc.Usage = D3D11_USAGE_DEFAULT;
+	d3dBufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	d3dBufferDesc.StructureByteStride = instanceSize;
+
+	g_d3dDevice->CreateBuffer(&d3dBufferDesc, nullptr, &m_instanceBuffer);
+	assert(m_instanceBuffer);
+
+	m_instanceBufferNeedsUpdate = true;
+}
+
+void DrawCall::CreateInputLayouts()
+{
+	vector<D3D11_INPUT_ELEMENT_DESC> elements = m_particleInstancingEnabled ? g_instancedParticleElements : g_instancedElements;
+
+	// The first three elements are the vertex ones
+	if (m_quantizedVertexLayout)
+	{
+		elements[0].Format = DXGI_FORMAT_R16G16B16A16_UNORM;
+		elements[1].Format = DXGI_FORMAT_R16G16_SNORM;
+		elements[2].Format = DXGI_FORMAT_R16G16_FLOAT;
+	}
+
 	if (!m_instancingLayout && GetVertexShader())
 	{
 		g_d3dDevice->CreateInputLayout(elements.data(), (UINT) elements.size(), GetVertexShader()->GetBytecode(), GetVertexShader()->GetBytecodeSize(), &m_instancingLayout);
@@ -2876,20 +2922,6 @@ void DrawCall::SetInstanceCapacity(unsigned instanceCapacity, bool enableParticl
 
 		g_d3dDevice->CreateInputLayout(elements.data(), (UINT) elements.size(), GetVertexShaderSPS()->GetBytecode(), GetVertexShaderSPS()->GetBytecodeSize(), &m_instancingLayoutSPS);
 	}
-
-	D3D11_BUFFER_DESC d3dBufferDesc;
-	memset(&d3dBufferDesc, 0, sizeof(D3D11_BUFFER_DESC));
-	d3dBufferDesc.ByteWidth = instanceCapacity * instanceSize;
-
-	d3dBufferDesc.Usage = D3D11_USAGE_DEFAULT;
-	d3dBufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-	d3dBufferDesc.StructureByteStride = instanceSize;
-
-	g_d3dDevice->CreateBuffer(&d3dBufferDesc, nullptr, &m_instanceBuffer);
-	assert(m_instanceBuffer);
-
-	m_instanceBufferNeedsUpdate = true;
-	m_particleInstancingEnabled = enableParticleInstancing;
 }
 
 DrawCall::Instance* DrawCall::GetInstanceBuffer()
@@ -2994,12 +3026,166 @@ void DrawCall::Draw(unsigned instancesToDraw)
 	g_d3dContext->DrawIndexedInstanced(m_mesh->GetIndexCount(), instancesToDraw, 0, 0, 0);
 }
 
-void DrawCall::SetupDraw(unsigned instancesToDraw)
+void DrawCall::Submit(unsigned instancesToDraw)
 {
+	PrepareDraw();
+
+	unsigned instanceCapacity = (unsigned) (m_particleInstancingEnabled ? m_particleInstances.size() : m_instances.size());
+	if (instancesToDraw > instanceCapacity)
+		instancesToDraw = instanceCapacity;
+
+	ShaderSet& shaderSet = m_shaderSets[m_activeRenderPassIndex];
+	assert(shaderSet.vertexShader && shaderSet.pixelShader);
+	Shader* vertexShader = shaderSet.vertexShader.get();
 	if (GetCurrentRenderTarget()->IsStereo() && IsSinglePassSteroEnabled())
-		g_d3dContext->IASetInputLayout(m_instancingLayoutSPS.Get());
-	else
-		g_d3dContext->IASetInputLayout(m_instancingLayout.Get());
+		vertexShader = shaderSet.vertexShaderSPS.get();
+
+	// The keys only need to be equal for the same shaders and input layout, they are numbered in order of first use
+	auto shaderKey = m_renderQueueShaderKeys.insert({ make_tuple(vertexShader, shaderSet.pixelShader.get(), shaderSet.geometryShader.get(),
+		m_quantizedVertexLayout, m_particleInstancingEnabled), (uint64_t) m_renderQueueShaderKeys.size() }).first->second;
+
+	// The queued draws use the frame constants of their submission, since the lights and ambient are public statics that can change before the flush
+	FrameConstants::Inputs frameInputs = GetFrameConstantInputs();
+	if (!m_renderQueue.IsEmpty() && memcmp(&frameInputs, &m_renderQueueFrameInputs, sizeof(frameInputs)) != 0)
+		FlushRenderQueue();
+	m_renderQueueFrameInputs = frameInputs;
+
+	QueuedDraw queuedDraw;
+	queuedDraw.drawCall = this;
+	queuedDraw.mesh = m_mesh;
+	queuedDraw.blendState = m_sAlphaBlendStates.top();
+	queuedDraw.depthTest = m_sDepthTestStates.top();
+	queuedDraw.backfaceCulling = m_sBackfaceCullingStates.top();
+
+	DrawConstants::Inputs drawInputs = GetDrawConstantInputs();
+
+	RenderQueue::Submission submission;
+	submission.stateKey = ((uint64_t) queuedDraw.blendState << 2) | (queuedDraw.depthTest ? 0 : 2) | (queuedDraw.backfaceCulling ? 0 : 1);
+	submission.shaderKey = shaderKey;
+	submission.meshKey = (uint64_t) (uintptr_t) m_mesh.get();
+	submission.ordered = queuedDraw.blendState != BLEND_NONE || !queuedDraw.depthTest;	// Depends on what was drawn before
+	submission.constants = &drawInputs;
+	submission.constantsSize = sizeof(drawInputs);
+	submission.instances = m_particleInstancingEnabled ? (const void*) m_particleInstances.data() : (const void*) m_instances.data();
+	submission.instanceCount = instancesToDraw;
+	submission.instanceStride = m_particleInstancingEnabled ? sizeof(ParticleInstance) : sizeof(Instance);
+	submission.userData = m_queuedDraws.size();
+
+	m_queuedDraws.push_back(queuedDraw);
+	m_renderQueue.Submit(submission);
+}
+
+void DrawCall::FlushRenderQueue()
+{
+	if (m_renderQueue.IsEmpty())
+		return;
+
+	m_renderQueue.Build();
+
+	// The instances of all the batches are uploaded at once, each batch starting at its offset
+	const vector<unsigned char>& instanceData = m_renderQueue.GetInstanceData();
+	if (!instanceData.empty())
+	{
+		if (instanceData.size() > m_renderQueueInstanceBufferSize)
+		{
+			m_renderQueueInstanceBufferSize = max(instanceData.size(), 2 * m_renderQueueInstanceBufferSize);
+			m_renderQueueInstanceBuffer.Reset();
+
+			D3D11_BUFFER_DESC desc = { (UINT) m_renderQueueInstanceBufferSize, D3D11_USAGE_DYNAMIC, D3D11_BIND_VERTEX_BUFFER, D3D11_CPU_ACCESS_WRITE, 0, 0 };
+			g_d3dDevice->CreateBuffer(&desc, nullptr, &m_renderQueueInstanceBuffer);
+			assert(m_renderQueueInstanceBuffer);
+		}
+
+		D3D11_MAPPED_SUBRESOURCE mapped;
+		g_d3dContext->Map(m_renderQueueInstanceBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+		memcpy(mapped.pData, instanceData.data(), instanceData.size());
+		g_d3dContext->Unmap(m_renderQueueInstanceBuffer.Get(), 0);
+	}
+
+	m_frameConstants.Update(m_renderQueueFrameInputs);
+	bool singlePassStereo = GetCurrentRenderTarget()->IsStereo() && IsSinglePassSteroEnabled();
+
+	// Only what changed since the previous batch is set
+	for (auto& batch : m_renderQueue.GetBatches())
+	{
+		QueuedDraw& queuedDraw = m_queuedDraws[batch.userData];
+		DrawCall* drawCall = queuedDraw.drawCall;
+		ShaderSet& shaderSet = drawCall->m_shaderSets[m_activeRenderPassIndex];
+		shared_ptr<Shader> vertexShader = singlePassStereo ? shaderSet.vertexShaderSPS : shaderSet.vertexShader;
+
+		if (batch.changes & RenderQueue::kStateChanged)
+		{
+			SetD3DBlendState(queuedDraw.blendState);
+			SetD3DDepthTestState(queuedDraw.depthTest);
+			SetD3DBackfaceCullingState(queuedDraw.backfaceCulling);
+		}
+
+		if (batch.changes & RenderQueue::kShaderChanged)
+		{
+			g_d3dContext->IASetInputLayout(singlePassStereo ? drawCall->m_instancingLayoutSPS.Get() : drawCall->m_instancingLayout.Get());
+
+			vertexShader->Bind();
+			shaderSet.pixelShader->Bind();
+			if (shaderSet.geometryShader)
+				shaderSet.geometryShader->Bind();
+			else
+				g_d3dContext->GSSetShader(nullptr, nullptr, 0);
+		}
+
+		if (batch.changes & (RenderQueue::kShaderChanged | RenderQueue::kConstantsChanged))
+		{
+			drawCall->m_drawConstants.Update(*static_cast<const DrawConstants::Inputs*>(batch.constants), m_frameConstants);
+			drawCall->UpdateShaderConstants(vertexShader);
+			drawCall->UpdateShaderConstants(shaderSet.pixelShader);
+			if (shaderSet.geometryShader)
+				drawCall->UpdateShaderConstants(shaderSet.geometryShader);
+		}
+
+		if (batch.changes & RenderQueue::kMeshChanged)
+		{
+			ID3D11Buffer* vertexBuffer = queuedDraw.mesh->GetVertexBuffer();
+			UINT vertexStride = queuedDraw.mesh->GetVertexStride();
+			UINT vertexOffset = 0;
+			g_d3dContext->IASetVertexBuffers(0, 1, &vertexBuffer, &vertexStride, &vertexOffset);
+			g_d3dContext->IASetIndexBuffer(queuedDraw.mesh->GetIndexBuffer(), DXGI_FORMAT_R32_UINT, 0);
+
+			if (queuedDraw.mesh->GetDrawStyle() == Mesh::DS_LINELIST)
+				g_d3dContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_LINELIST);
+			else
+				g_d3dContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+		}
+
+		UINT instanceStride = (UINT) batch.instanceStride;
+		UINT instanceOffset = (UINT) batch.instanceOffset;
+		g_d3dContext->IASetVertexBuffers(1, 1, m_renderQueueInstanceBuffer.GetAddressOf(), &instanceStride, &instanceOffset);
+
+		UINT instanceCount = (UINT) batch.instanceCount;
+		if (singlePassStereo)
+			instanceCount *= 2;
+
+		g_d3dContext->DrawIndexedInstanced(queuedDraw.mesh->GetIndexCount(), instanceCount, 0, 0, 0);
+	}
+
+	// Back to the states of the stacks, which the draws that are not queued expect
+	SetD3DBlendState(m_sAlphaBlendStates.top());
+	SetD3DDepthTestState(m_sDepthTestStates.top());
+	SetD3DBackfaceCullingState(m_sBackfaceCullingStates.top());
+
+	m_renderQueue.Clear();
+	m_queuedDraws.clear();
+}
+
+// What Draw and Submit both need before the draw is set up or queued
+void DrawCall::PrepareDraw()
+{
+	// The mesh can be quantized after the draw call was created
+	if (m_mesh->IsQuantized() != m_quantizedVertexLayout)
+	{
+		m_quantizedVertexLayout = m_mesh->IsQuantized();
+		m_instancingLayout.Reset();
+		m_instancingLayoutSPS.Reset();
+		CreateInputLayouts();
+	}
 
 	// Auto-scale quad to fullscreen if in fullscreen pass
 	if(!m_sFullscreenPassStates.empty() && m_sFullscreenPassStates.top())
@@ -3007,6 +3193,19 @@ void DrawCall::SetupDraw(unsigned instancesToDraw)
 		float fAspect = GetCurrentRenderTarget()->GetWidth() / (float) GetCurrentRenderTarget()->GetHeight();
 		SetWorldTransform(XMMatrixScaling(fAspect, 1.f, 1.f));
 	}
+}
+
+void DrawCall::SetupDraw(unsigned instancesToDraw)
+{
+	PrepareDraw();
+
+	if (GetCurrentRenderTarget()->IsStereo() && IsSinglePassSteroEnabled())
+		g_d3dContext->IASetInputLayout(m_instancingLayoutSPS.Get());
+	else
+		g_d3dContext->IASetInputLayout(m_instancingLayout.Get());
+
+	UpdateFrameConstants();
+	m_drawConstants.Update(GetDrawConstantInputs(), m_frameConstants);
 
 	ShaderSet& shaderSet = m_shaderSets[m_activeRenderPassIndex];
 	assert(shaderSet.vertexShader && shaderSet.pixelShader);
@@ -3054,7 +3253,7 @@ void DrawCall::SetupDraw(unsigned instancesToDraw)
 	buffers[1] = m_instanceBuffer.Get();
 
 	UINT strides[2];
-	strides[0] = sizeof(Mesh::Vertex);
+	strides[0] = m_mesh->GetVertexStride();
 	strides[1] = instanceSize;
 
 	UINT offsets[2];
@@ -3070,160 +3269,80 @@ void DrawCall::SetupDraw(unsigned instancesToDraw)
 		g_d3dContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 }
 
-void DrawCall::UpdateShaderConstants(shared_ptr<Shader> shader)
+DrawConstants::Inputs DrawCall::GetDrawConstantInputs()
 {
-	for(unsigned i=0; i<shader->GetContantBufferCount(); ++i)
+	DrawConstants::Inputs drawInputs;
+	XMStoreFloat4x4(reinterpret_cast<XMFLOAT4X4*>(drawInputs.world), allInstanceWorldTransform);
+	const PositionDequantization* dequantization = m_mesh->IsQuantized() ? &m_mesh->GetPositionDequantization() : nullptr;
+	for (int axis = 0; axis < 3; ++axis)
 	{
-		ConstantBuffer& buffer = shader->GetConstantBuffer(i);
+		drawInputs.positionScale[axis] = dequantization ? dequantization->scale[axis] : 1.0f;
+		drawInputs.positionOffset[axis] = dequantization ? dequantization->offset[axis] : 0.0f;
+	}
+	drawInputs.positionScale[3] = dequantization ? 1.0f : 0.0f;		// w tells the vertex shader that the normals are octahedral encoded
+	drawInputs.positionOffset[3] = 0.0f;
 
-		// Grab the camera view and proj settings (which may be different from active view and proj if this is a fullscreen pass)
-		XMMATRIX mtxCameraView = m_activeView.mtx;
-		Projection cameraProj = m_activeProjection;
-		if(!m_sFullscreenPassStates.empty() && m_sFullscreenPassStates.top() == true)	// For fullscreen pass, use the camera view matrix instead of the view matrix
-		{
-			mtxCameraView = m_mtxCameraView;
-			cameraProj = m_cameraProj;
-		}
+	return drawInputs;
+}
 
-		for(unsigned j=0; j<buffer.constants.size(); ++j)
-		{
-			Constant& constant = buffer.constants[j];
+FrameConstants::Inputs DrawCall::GetFrameConstantInputs()
+{
+	auto StoreMatrix = [](float destination[16], const XMMATRIX& matrix)
+	{
+		XMStoreFloat4x4(reinterpret_cast<XMFLOAT4X4*>(destination), matrix);
+	};
 
-			XMMATRIX mtx;
-			XMVECTOR v;
+	// Fullscreen passes use the camera view and projection for the light and projection constants
+	XMMATRIX mtxCameraView = m_activeView.mtx;
+	Projection cameraProj = m_activeProjection;
+	if (!m_sFullscreenPassStates.empty() && m_sFullscreenPassStates.top() == true)
+	{
+		mtxCameraView = m_mtxCameraView;
+		cameraProj = m_cameraProj;
+	}
 
-			switch(constant.id)
-			{
-			case CONST_WORLD_MATRIX:
-				mtx = XMMatrixTranspose(allInstanceWorldTransform);
-				memcpy(buffer.staging.get() + constant.startOffset, &mtx, constant.size);
-				break;
-			case CONST_WORLDVIEWPROJ_MATRIX:
-				if (constant.elementCount == 0)
-				{
-					XMMATRIX view = m_activeView.mtx;
-					XMMATRIX proj = m_activeProjection.mtx;
-					if (IsRightEyePassActive())
-					{
-						view = m_activeView.mtxRight;
-						proj = m_activeProjection.mtxRight;
-					}
-
-					mtx = XMMatrixTranspose(XMMatrixMultiply(allInstanceWorldTransform, XMMatrixMultiply(view, proj)));
-					memcpy(buffer.staging.get() + constant.startOffset, &mtx, constant.size);
-				}
-				else if (constant.elementCount == 2)
-				{
-					mtx = XMMatrixTranspose(XMMatrixMultiply(allInstanceWorldTransform, XMMatrixMultiply(m_activeView.mtx, m_activeProjection.mtx)));
-					memcpy(buffer.staging.get() + constant.startOffset, &mtx, constant.size / 2);
+	FrameConstants::Inputs inputs;
+	StoreMatrix(inputs.view[0], m_activeView.mtx);
+	StoreMatrix(inputs.view[1], m_activeView.mtxRight);
+	StoreMatrix(inputs.projection[0], m_activeProjection.mtx);
+	StoreMatrix(inputs.projection[1], m_activeProjection.mtxRight);
+	StoreMatrix(inputs.cameraView, mtxCameraView);
+	StoreMatrix(inputs.lightViewProjection, m_mtxLightViewProj);
+	XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(inputs.lightPosition), vLights[uActiveLightIdx].vLightPosW);
+	XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(inputs.ambient), vAmbient);
+	inputs.nearPlaneHeight = cameraProj.fNearPlaneHeight;
+	inputs.nearPlaneWidth = cameraProj.fNearPlaneWidth;
+	inputs.nearPlaneDistance = cameraProj.fNear;
+	inputs.farPlaneDistance = cameraProj.fFar;
+	inputs.projectionRange = cameraProj.fRange;
 
-					mtx = XMMatrixTranspose(XMMatrixMultiply(allInstanceWorldTransform, XMMatrixMultiply(m_activeView.mtxRight, m_activeProjection.mtxRight)));
-					memcpy(buffer.staging.get() + constant.startOffset + constant.size / 2, &mtx, constant.size / 2);
-				}
-				break;
-			case CONST_VIEWPROJ_MATRIX:
-				if (constant.elementCount == 0)
-				{
-					XMMATRIX view = m_activeView.mtx;
-					XMMATRIX proj = m_activeProjection.mtx;
-					if (IsRightEyePassActive())
-					{
-						view = m_activeView.mtxRight;
-						proj = m_activeProjection.mtxRight;
-					}
-
-					mtx = XMMatrixTranspose(XMMatrixMultiply(view, proj));
-					memcpy(buffer.staging.get() + constant.startOffset, &mtx, constant.size);
-				}
-				else if (constant.elementCount == 2)
-				{
-					mtx = XMMatrixTranspose(XMMatrixMultiply(m_activeView.mtx, m_activeProjection.mtx));
-					memcpy(buffer.staging.get() + constant.startOffset, &mtx, constant.size/2);
+	return inputs;
+}
 
-					mtx = XMMatrixTranspose(XMMatrixMultiply(m_activeView.mtxRight, m_activeProjection.mtxRight));
-					memcpy(buffer.staging.get() + constant.startOffset + constant.size / 2, &mtx, constant.size / 2);
-				}
-				break;
-			case CONST_VIEW_MATRIX:
-				if (constant.elementCount == 0)
-				{
-					XMMATRIX view = m_activeView.mtx;
-					XMMATRIX proj = m_activeProjection.mtx;
-					if (IsRightEyePassActive())
-					{
-						view = m_activeView.mtxRight;
-						proj = m_activeProjection.mtxRight;
-					}
-
-					mtx = XMMatrixTranspose(view);
-					memcpy(buffer.staging.get() + constant.startOffset, &mtx, constant.size);
-				}
-				else if (constant.elementCount == 2)
-				{
-					mtx = XMMatrixTranspose(m_activeView.mtx);
-					memcpy(buffer.staging.get() + constant.startOffset, &mtx, constant.size/2);
+void DrawCall::UpdateFrameConstants()
+{
+	m_frameConstants.Update(GetFrameConstantInputs());
+}
 
-					mtx = XMMatrixTranspose(m_activeView.mtxRight);
-					memcpy(buffer.staging.get() + constant.startOffset + constant.size / 2, &mtx, constant.size / 2);
-				}
-				break;
-			case CONST_INVVIEW_MATRIX:
-				if (constant.elementCount == 0)
-				{
-					XMMATRIX view = XMMatrixInverse(nullptr, m_activeView.mtx);
-					if (IsRightEyePassActive())
-						view = XMMatrixInverse(nullptr, m_activeView.mtxRight);
+void DrawCall::UpdateShaderConstants(shared_ptr<Shader> shader)
+{
+	unsigned eye = IsRightEyePassActive() ? 1 : 0;
 
-					mtx = XMMatrixTranspose(view);
-					memcpy(buffer.staging.get() + constant.startOffset, &mtx, constant.size);
-				}
-				else if (constant.elementCount == 2)
-				{
-					mtx = XMMatrixTranspose(XMMatrixInverse(nullptr, m_activeView.mtx));
-					memcpy(buffer.staging.get() + constant.startOffset, &mtx, constant.size / 2);
+	for(unsigned i=0; i<shader->GetContantBufferCount(); ++i)
+	{
+		ConstantBuffer& buffer = shader->GetConstantBuffer(i);
 
-					mtx = XMMatrixTranspose(XMMatrixInverse(nullptr, m_activeView.mtxRight));
-					memcpy(buffer.staging.get() + constant.startOffset + constant.size / 2, &mtx, constant.size / 2);
-				}
-				break;
-			case CONST_LIGHTVIEWPROJ_MATRIX:
-				mtx = XMMatrixTranspose(m_mtxLightViewProj);
-				memcpy(buffer.staging.get() + constant.startOffset, &mtx, constant.size);
-				break;
-			case CONST_LIGHTPOSV:
-				v = XMVector4Transform(vLights[uActiveLightIdx].vLightPosW, mtxCameraView);
-				memcpy(buffer.staging.get() + constant.startOffset, &v, constant.size);
-				break;
-			case CONST_INVVIEWLIGHTVIEWPROJ_MATRIX:
-				mtx = XMMatrixTranspose(XMMatrixMultiply(XMMatrixInverse(&v, mtxCameraView), m_mtxLightViewProj));
-				memcpy(buffer.staging.get() + constant.startOffset, &mtx, constant.size);
-				break;
-			case CONST_LIGHT_AMBIENT:
-				memcpy(buffer.staging.get() + constant.startOffset, &vAmbient, constant.size);
-				break;
-			case CONST_NEARPLANEHEIGHT:
-				memcpy(buffer.staging.get() + constant.startOffset, &cameraProj.fNearPlaneHeight, constant.size);
-				break;
-			case CONST_NEARPLANEWIDTH:
-				memcpy(buffer.staging.get() + constant.startOffset, &cameraProj.fNearPlaneWidth, constant.size);
-				break;
-			case CONST_NEARPLANEDIST:
-				memcpy(buffer.staging.get() + constant.startOffset, &cameraProj.fNear, constant.size);
-				break;
-			case CONST_FARPLANEDIST:
-				memcpy(buffer.staging.get() + constant.startOffset, &cameraProj.fFar, constant.size);
-				break;
-			case CONST_PROJECTIONRANGE:
-				memcpy(buffer.staging.get() + constant.startOffset, &cameraProj.fRange, constant.size);
-				break;
-			}
+		// The staging copy is shared by the draw calls of the shader, and holds what was last uploaded
+		if (WriteShaderConstants(buffer.constants.data(), buffer.constants.size(), m_frameConstants, m_drawConstants, eye, buffer.staging.get()) ||
+			buffer.d3dBufferNeedsUpdate)
+		{
+			D3D11_MAPPED_SUBRESOURCE mapped;
+			g_d3dContext->Map(buffer.d3dBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+			memcpy(mapped.pData, buffer.staging.get(), mapped.RowPitch);
+			g_d3dContext->Unmap(buffer.d3dBuffer.Get(), 0);
+			buffer.d3dBufferNeedsUpdate = false;
 		}
 
-		D3D11_MAPPED_SUBRESOURCE mapped;
-		g_d3dContext->Map(buffer.d3dBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
-		memcpy(mapped.pData, buffer.staging.get(), mapped.RowPitch);
-		g_d3dContext->Unmap(buffer.d3dBuffer.Get(), 0);
-
 		if(shader->GetType() == Shader::ST_VERTEX || shader->GetType() == Shader::ST_VERTEX_SPS)
 			g_d3dContext->VSSetConstantBuffers(buffer.slot, 1, buffer.d3dBuffer.GetAddressOf());
 		else if (shader->GetType() == Shader::ST_PIXEL)
@@ -42,11 +42,17 @@
 #include <DirectXCollision.h>
 using namespace DirectX;
 
+#include "MeshBvh.h"
+#include "MeshQuantization.h"
+#include "RenderQueue.h"
+#include "ShaderConstants.h"
+
 #include <vector>
 #include <string>
 #include <stack>
 #include <map>
 #include <memory>
+#include <tuple>
 
 #define RENDER_TARGET_COUNT 8
 
@@ -207,25 +213,6 @@ private:
 	void InitStagingTexture();
 };
 
-enum ConstantID
-{
-	CONST_WORLD_MATRIX,
-	CONST_WORLDVIEWPROJ_MATRIX,
-	CONST_VIEWPROJ_MATRIX,
-	CONST_VIEW_MATRIX,
-	CONST_INVVIEW_MATRIX,
-	CONST_LIGHTVIEWPROJ_MATRIX,
-	CONST_LIGHTPOSV,
-	CONST_INVVIEWLIGHTVIEWPROJ_MATRIX,
-	CONST_LIGHT_AMBIENT,
-	CONST_NEARPLANEHEIGHT,
-	CONST_NEARPLANEWIDTH,
-	CONST_NEARPLANEDIST,
-	CONST_FARPLANEDIST,
-	CONST_PROJECTIONRANGE,
-	CONST_COUNT,
-};
-
 static const char* g_vContantIDStrings[] = 
 {
 	"mtxWorld",
@@ -242,14 +229,8 @@ static const char* g_vContantIDStrings[] =
 	"fNear",
 	"fFar",
 	"fRange",
-};
-
-struct Constant
-{
-	unsigned id;			// Unique identifier so we know what to set it to
-	unsigned startOffset;
-	unsigned size;
-	unsigned elementCount;	// Number of elements if array variable. 0 if not an array.
+	"vPositionScale",
+	"vPositionOffset",
 };
 
 class ConstantBuffer
@@ -261,6 +242,7 @@ public:
 
 	std::unique_ptr<unsigned char> staging;
 	Microsoft::WRL::ComPtr<ID3D11Buffer> d3dBuffer;
+	bool d3dBufferNeedsUpdate = true;		// The staging copy is only uploaded when it changes
 
 	std::vector<Constant> constants;
 };
@@ -348,22 +330,6 @@ public:
 		}
 	};
 
-	struct BoundingBoxNode
-	{
-		BoundingBox boundingBox;
-
-		// Indices representing all the triangles that intersect this bounding box
-		//	These index directly into Mesh::m_vertices
-		std::vector<unsigned> indicesContained;
-
-		std::vector<BoundingBoxNode> children;
-
-		static const unsigned targetTriangleCount = 250;
-
-		void GenerateChildNodes(const std::vector<Mesh::Vertex>& vertices, const std::vector<unsigned>& indices, unsigned currentDepth);
-		bool TestRayIntersection(const std::vector<Vertex>& vertices, const XMVECTOR& rayOriginInWorldSpace, const XMVECTOR& rayDirectionInWorldSpace, const XMMATRIX& worldTransform, float &distance, XMVECTOR& normalInLocalSpace, float maxDistance = std::numeric_limits<float>::max(), bool returnFurthest = false);
-	};
-
 	struct Disc
 	{
 		XMVECTOR center;		// Position of the center of the disc
@@ -383,7 +349,8 @@ public:
 	Mesh(MeshType type = MT_EMPTY);							// Creates a procedural mesh, empty by default
 	Mesh(Mesh::Vertex* pVertices, unsigned vertexCount);	// Creates a mesh out of a list of vertices (nullptrs will cause empty mesh)
 	Mesh(Mesh::Vertex* pVertices, unsigned vertexCount, unsigned* pIndices, unsigned indexCount);	// Creates a mesh out of a list of vertices (nullptrs will result in empty mesh)
-	Mesh(std::string filename);								// Creates a mesh by loading from file
+	Mesh(std::string filename);								// Creates a mesh by loading from an OBJ file, or from the cache written next to it on the first load
+	~Mesh();												// Waits for the BVH build thread, if any
 
 	void LoadBox(const float width, const float height, const float depth);
 	void LoadPlane(MeshType type);	// Takes MT_PLANE or MT_UIPLANE or MT_ZERO_ONE_PLANE_XY
@@ -396,10 +363,18 @@ public:
 	//  If the first disc has the same center point as the second disc, the caps will not be smoothed
 	void AppendGeometryForDiscs(const std::vector<Disc>& discs, const unsigned segmentCount, const DiscMode discMode = DiscMode::Circle);
 
+	// The ray is transformed to the space of the mesh and tested against its BVH, built by UpdateBoundingBox
 	bool TestRayIntersection(const XMVECTOR& rayOriginInWorldSpace, const XMVECTOR& rayDirectionInWorldSpace, const XMMATRIX& worldTransform, float &distance, XMVECTOR &normal, float maxDistance = std::numeric_limits<float>::max(), bool returnFurthest = false);
 	bool TestRayIntersection(const XMVECTOR& rayOriginInWorldSpace, const XMVECTOR& rayDirectionInWorldSpace, const XMMATRIX& worldTransform, float& distance);
 	bool TestPointInside(const XMVECTOR& pointInWorldSpace, const XMMATRIX& worldTransform);	// This currently only tests against the bounding box
 	const BoundingBox& GetBoundingBox();
+	std::shared_ptr<const MeshBvh> GetBvh();	// Rebuilt, not modified, when the geometry changes: the returned BVH can be kept and used from other threads
+
+	// When enabled, the BVH is built on a thread of the mesh when the geometry changes. Until it is done, GetBvh
+	// returns nullptr and TestRayIntersection tests all the triangles. The next geometry update and the destructor
+	// wait for the build thread.
+	void SetAsyncBvhBuild(bool asyncBvhBuild) { m_asyncBvhBuild = asyncBvhBuild; }
+	bool IsBvhBuildPending();
 
 	void SetDrawStyle(DrawStyle drawStyle){m_drawStyle = drawStyle;}
 	DrawStyle GetDrawStyle() { return m_drawStyle; }
@@ -413,14 +388,23 @@ public:
 	std::vector<Vertex>& GetVertices();
 	std::vector<unsigned>& GetIndices();
 
-	unsigned GetVertexCount() { return (unsigned) m_vertices.size(); }
+	// Keeps the vertices as QuantizedVertex (16 bytes instead of 48) for ray tests and drawing.
+	//	GetVertices and the functions that edit the vertices convert them back to full vertices.
+	void Quantize();
+	bool IsQuantized() const { return !m_quantizedVertices.empty(); }
+	const PositionDequantization& GetPositionDequantization() const { return m_positionDequantization; }
+
+	unsigned GetVertexCount() { return (unsigned) (IsQuantized() ? m_quantizedVertices.size() : m_vertices.size()); }
+	unsigned GetVertexStride() { return IsQuantized() ? sizeof(QuantizedVertex) : sizeof(Vertex); }
 	unsigned GetIndexCount() { return (unsigned) m_indices.size(); }
-	bool IsEmpty() { return m_indices.empty() || m_vertices.empty(); }
+	bool IsEmpty() { return m_indices.empty() || GetVertexCount() == 0; }
 
 	ID3D11Buffer* GetVertexBuffer();
 	ID3D11Buffer* GetIndexBuffer();
 
-	void UpdateBoundingBox();
+	// The BVH is built on bvhThreadCount threads (the calling one included). The lazy updates of the ray tests and
+	//	bounds use the calling thread only.
+	void UpdateBoundingBox(unsigned bvhThreadCount = 1);
 
 	bool SaveToFile(const std::string& filename);
 
@@ -428,11 +412,19 @@ private:
 
 	DrawStyle m_drawStyle;
 
-	BoundingBoxNode m_boundingBoxNode;
+	BoundingBox m_boundingBox;
+	std::shared_ptr<const MeshBvh> m_bvh;
+
+	struct PendingBvhBuild;
+	std::unique_ptr<PendingBvhBuild> m_pendingBvhBuild;		// Owns the build thread
+	bool m_asyncBvhBuild = false;
 
 	std::vector<Vertex> m_vertices;
 	std::vector<unsigned> m_indices;
 
+	std::vector<QuantizedVertex> m_quantizedVertices;	// Replaces m_vertices once quantized
+	PositionDequantization m_positionDequantization;
+
 	bool m_d3dBuffersNeedUpdate;
 	bool m_boundingBoxNeedsUpdate;
 
@@ -443,6 +435,9 @@ private:
 	Microsoft::WRL::ComPtr<ID3D11Buffer> m_d3dIndexBuffer;
 	
 	void UpdateD3DBuffers();
+	void UpdateBoundingBox(std::shared_ptr<const MeshBvh> prebuiltBvh, unsigned bvhThreadCount);
+	void JoinBvhBuild();
+	void Dequantize();
 };
 
 class DrawCall
@@ -611,6 +606,10 @@ public:
 	static void AddGlobalRenderPass(const std::string& vertexShaderFilename, const std::string& pixelShaderFilename, const unsigned renderPassIndex);
 	static std::shared_ptr<Shader> LoadShaderUsingShaderStore(Shader::ShaderType type, const std::string& filename);
 
+	// Draws the draws queued by Submit. Done automatically before the render pass, view, projection, light view or
+	// single pass stereo mode changes, when a submission sees other lights or ambient than the queued ones, and before Present.
+	static void FlushRenderQueue();
+
 	static void Present();
 
 	// Draw text using the current redertarget
@@ -662,8 +661,33 @@ private:
 	static Microsoft::WRL::ComPtr<ID3D11DepthStencilState> m_d3dDepthTestDisabledState;
 	static Microsoft::WRL::ComPtr<ID3D11RasterizerState> m_d3dBackfaceCullingDisabledState;
 
+	// Shader constants that only depend on the view, projection and lights, computed again only when these change
+	static FrameConstants m_frameConstants;
+
+	// Draws queued by Submit, merged into instanced draws when they only differ by their instances
+	struct QueuedDraw
+	{
+		DrawCall* drawCall;
+		std::shared_ptr<Mesh> mesh;
+		BlendState blendState;
+		bool depthTest;
+		bool backfaceCulling;
+	};
+
+	static RenderQueue m_renderQueue;
+	static std::vector<QueuedDraw> m_queuedDraws;
+	static std::map<std::tuple<Shader*, Shader*, Shader*, bool, bool>, uint64_t> m_renderQueueShaderKeys;	// Shaders and input layout
+	static Microsoft::WRL::ComPtr<ID3D11Buffer> m_renderQueueInstanceBuffer;
+	static size_t m_renderQueueInstanceBufferSize;
+	static FrameConstants::Inputs m_renderQueueFrameInputs;	// Captured by Submit
+
 	static void SetCurrentRenderTargetsOnD3DDevice();
 	static bool IsRightEyePassActive();
+	static FrameConstants::Inputs GetFrameConstantInputs();
+	static void UpdateFrameConstants();
+	static void SetD3DBlendState(BlendState blendState);
+	static void SetD3DDepthTestState(bool enabled);
+	static void SetD3DBackfaceCullingState(bool enabled);
 
 	//
 	// Local stuff that affects only this draw call
@@ -699,15 +723,25 @@ public:
 
 	void Draw(unsigned instancesToDraw = 1);
 
+	// Same as Draw, but the draw is queued until FlushRenderQueue, which sorts the queued draws by states, shaders and mesh
+	// and merges those that only differ by their instances. The instances and world transform are copied, so the draw call
+	// can be changed and submitted again before the flush, but it must stay alive until then. Draws that use resources
+	// bound by the caller, such as textures, must use Draw.
+	void Submit(unsigned instancesToDraw = 1);
+
 	XMMATRIX allInstanceWorldTransform;	// Global world transform that will be applied to all instances
 
 private:
 
+	void PrepareDraw();
 	void SetupDraw(unsigned instancesToDraw);
+	DrawConstants::Inputs GetDrawConstantInputs();
+	void CreateInputLayouts();
 	void UpdateShaderConstants(std::shared_ptr<Shader> pShader);
 
 	Microsoft::WRL::ComPtr<ID3D11InputLayout> m_instancingLayout;
 	Microsoft::WRL::ComPtr<ID3D11InputLayout> m_instancingLayoutSPS;
+	bool m_quantizedVertexLayout = false;	// Whether the layouts are for QuantizedVertex, which follows the mesh
 	Microsoft::WRL::ComPtr<ID3D11Buffer> m_instanceBuffer;
 	bool m_instanceBufferNeedsUpdate;
 	bool m_particleInstancingEnabled;
@@ -717,6 +751,8 @@ private:
 
 	std::shared_ptr<Mesh> m_mesh;
 	std::map<unsigned, ShaderSet> m_shaderSets;
+
+	DrawConstants m_drawConstants;
 };
 
 #endif
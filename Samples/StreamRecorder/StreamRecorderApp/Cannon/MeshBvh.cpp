@@ -0,0 +1,996 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "MeshBvh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <thread>
+
+// Define MESH_BVH_NO_SIMD to build the scalar version on any target
+#if !defined(MESH_BVH_NO_SIMD) && (defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__))
+#define MESH_BVH_SSE
+#include <emmintrin.h>
+#elif !defined(MESH_BVH_NO_SIMD) && (defined(_M_ARM64) || defined(_M_ARM) || defined(__ARM_NEON))
+#define MESH_BVH_NEON
+#if defined(_MSC_VER) && defined(_M_ARM64)
+#include <arm64_neon.h>
+#else
+#include <arm_neon.h>
+#endif
+#endif
+
+using namespace std;
+
+namespace
+{
+	// Four float lanes, and the comparison masks between them
+#if defined(MESH_BVH_SSE)
+	typedef __m128 Float4;
+	typedef __m128 Mask4;
+
+	inline Float4 Load(const float* p) { return _mm_load_ps(p); }
+	inline void Store(float* p, Float4 a) { _mm_store_ps(p, a); }
+	inline Float4 Splat(float value) { return _mm_set1_ps(value); }
+	inline Float4 Add(Float4 a, Float4 b) { return _mm_add_ps(a, b); }
+	inline Float4 Sub(Float4 a, Float4 b) { return _mm_sub_ps(a, b); }
+	inline Float4 Mul(Float4 a, Float4 b) { return _mm_mul_ps(a, b); }
+	inline Float4 Min(Float4 a, Float4 b) { return _mm_min_ps(a, b); }
+	inline Float4 Max(Float4 a, Float4 b) { return _mm_max_ps(a, b); }
+	inline Float4 Abs(Float4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+	// a with its sign flipped where sign is negative
+	inline Float4 FlipSign(Float4 a, Float4 sign) { return _mm_xor_ps(a, _mm_and_ps(sign, _mm_set1_ps(-0.0f))); }
+	inline Mask4 LessEqual(Float4 a, Float4 b) { return _mm_cmple_ps(a, b); }
+	inline Mask4 Less(Float4 a, Float4 b) { return _mm_cmplt_ps(a, b); }
+	inline Mask4 And(Mask4 a, Mask4 b) { return _mm_and_ps(a, b); }
+	inline int MoveMask(Mask4 a) { return _mm_movemask_ps(a); }
+#elif defined(MESH_BVH_NEON)
+	typedef float32x4_t Float4;
+	typedef uint32x4_t Mask4;
+
+	inline Float4 Load(const float* p) { return vld1q_f32(p); }
+	inline void Store(float* p, Float4 a) { vst1q_f32(p, a); }
+	inline Float4 Splat(float value) { return vdupq_n_f32(value); }
+	inline Float4 Add(Float4 a, Float4 b) { return vaddq_f32(a, b); }
+	inline Float4 Sub(Float4 a, Float4 b) { return vsubq_f32(a, b); }
+	inline Float4 Mul(Float4 a, Float4 b) { return vmulq_f32(a, b); }
+	inline Float4 Min(Float4 a, Float4 b) { return vminq_f32(a, b); }
+	inline Float4 Max(Float4 a, Float4 b) { return vmaxq_f32(a, b); }
+	inline Float4 Abs(Float4 a) { return vabsq_f32(a); }
+	inline Float4 FlipSign(Float4 a, Float4 sign)
+	{
+		uint32x4_t signBits = vandq_u32(vreinterpretq_u32_f32(sign), vdupq_n_u32(0x80000000));
+		return vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(a), signBits));
+	}
+	inline Mask4 LessEqual(Float4 a, Float4 b) { return vcleq_f32(a, b); }
+	inline Mask4 Less(Float4 a, Float4 b) { return vcltq_f32(a, b); }
+	inline Mask4 And(Mask4 a, Mask4 b) { return vandq_u32(a, b); }
+	inline int MoveMask(Mask4 a)
+	{
+		static const uint32_t laneBits[4] = { 1, 2, 4, 8 };
+		uint32x4_t bits = vandq_u32(a, vld1q_u32(laneBits));
+#if defined(_M_ARM64) || defined(__aarch64__)
+		return (int) vaddvq_u32(bits);
+#else
+		uint32x2_t pairs = vadd_u32(vget_low_u32(bits), vget_high_u32(bits));
+		return (int) vget_lane_u32(vpadd_u32(pairs, pairs), 0);
+#endif
+	}
+#else
+	struct Float4 { float v[4]; };
+	struct Mask4 { bool v[4]; };
+
+	template <typename Operation>
+	inline Float4 PerLane(Float4 a, Float4 b, Operation operation)
+	{
+		Float4 result;
+		for (int i = 0; i < 4; ++i)
+			result.v[i] = operation(a.v[i], b.v[i]);
+		return result;
+	}
+
+	template <typename Operation>
+	inline Mask4 CompareLanes(Float4 a, Float4 b, Operation operation)
+	{
+		Mask4 result;
+		for (int i = 0; i < 4; ++i)
+			result.v[i] = operation(a.v[i], b.v[i]);
+		return result;
+	}
+
+	inline Float4 Load(const float* p) { return Float4{ { p[0], p[1], p[2], p[3] } }; }
+	inline void Store(float* p, Float4 a) { for (int i = 0; i < 4; ++i) p[i] = a.v[i]; }
+	inline Float4 Splat(float value) { return Float4{ { value, value, value, value } }; }
+	inline Float4 Add(Float4 a, Float4 b) { return PerLane(a, b, [](float x, float y) { return x + y; }); }
+	inline Float4 Sub(Float4 a, Float4 b) { return PerLane(a, b, [](float x, float y) { return x - y; }); }
+	inline Float4 Mul(Float4 a, Float4 b) { return PerLane(a, b, [](float x, float y) { return x * y; }); }
+	inline Float4 Min(Float4 a, Float4 b) { return PerLane(a, b, [](float x, float y) { return x < y ? x : y; }); }
+	inline Float4 Max(Float4 a, Float4 b) { return PerLane(a, b, [](float x, float y) { return x > y ? x : y; }); }
+	inline Float4 Abs(Float4 a) { return PerLane(a, a, [](float x, float) { return fabsf(x); }); }
+	inline Float4 FlipSign(Float4 a, Float4 sign) { return PerLane(a, sign, [](float x, float s) { return signbit(s) ? -x : x; }); }
+	inline Mask4 LessEqual(Float4 a, Float4 b) { return CompareLanes(a, b, [](float x, float y) { return x <= y; }); }
+	inline Mask4 Less(Float4 a, Float4 b) { return CompareLanes(a, b, [](float x, float y) { return x < y; }); }
+	inline Mask4 And(Mask4 a, Mask4 b) { return Mask4{ { a.v[0] && b.v[0], a.v[1] && b.v[1], a.v[2] && b.v[2], a.v[3] && b.v[3] } }; }
+	inline int MoveMask(Mask4 a) { return (a.v[0] ? 1 : 0) | (a.v[1] ? 2 : 0) | (a.v[2] ? 4 : 0) | (a.v[3] ? 8 : 0); }
+#endif
+
+	const unsigned kBinCount = 16;
+	const size_t kLocalStackSize = 128;
+
+	// Half of the surface area of a box, the SAH cost only needs relative areas
+	inline float HalfArea(const float boundsMin[3], const float boundsMax[3])
+	{
+		float dx = boundsMax[0] - boundsMin[0];
+		float dy = boundsMax[1] - boundsMin[1];
+		float dz = boundsMax[2] - boundsMin[2];
+		return dx * dy + dy * dz + dz * dx;
+	}
+
+	inline void ResetBounds(float boundsMin[3], float boundsMax[3])
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			boundsMin[axis] = FLT_MAX;
+			boundsMax[axis] = -FLT_MAX;
+		}
+	}
+
+	inline void GrowBounds(float boundsMin[3], float boundsMax[3], const float otherMin[3], const float otherMax[3])
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			boundsMin[axis] = min(boundsMin[axis], otherMin[axis]);
+			boundsMax[axis] = max(boundsMax[axis], otherMax[axis]);
+		}
+	}
+
+	inline unsigned GetBin(float centroid, float centroidMin, float binScale)
+	{
+		unsigned bin = (unsigned) ((centroid - centroidMin) * binScale);
+		return bin < kBinCount ? bin : kBinCount - 1;
+	}
+
+	struct StackEntry
+	{
+		uint32_t child;
+		float distance;		// Entry distance of the child box, or exit distance when looking for the furthest hit
+	};
+
+	// Triangles per chunk of the loops spread over the threads
+	const size_t kParallelChunkSize = 16384;
+
+	// Calls function(i) for i in [0, count), on up to threadCount threads including the calling one.
+	// The threads pick the next i as they go, so the calls should be ordered from the longest to the shortest.
+	template <typename Function>
+	void ParallelFor(unsigned threadCount, size_t count, const Function& function)
+	{
+		atomic<size_t> next(0);
+		auto Work = [&]()
+		{
+			for (size_t i = next++; i < count; i = next++)
+				function(i);
+		};
+
+		vector<thread> threads;
+		for (size_t i = 1; i < min((size_t) threadCount, count); ++i)
+			threads.emplace_back(Work);
+		Work();
+		for (auto& thread : threads)
+			thread.join();
+	}
+
+	struct Bounds
+	{
+		float boundsMin[3];
+		float boundsMax[3];
+		bool invalidIndex;
+	};
+}
+
+void MeshBvh::Clear()
+{
+	m_nodes.clear();
+	m_packets.clear();
+	m_root = kInvalidIndex;
+	m_triangleCount = 0;
+	m_traversalStackSize = 0;
+	ResetBounds(m_boundsMin, m_boundsMax);
+}
+
+bool MeshBvh::Build(const void* positions, size_t positionStride, size_t vertexCount, const uint32_t* indices, size_t indexCount, unsigned threadCount)
+{
+	Clear();
+
+	threadCount = max(threadCount, 1u);
+	const uint8_t* positionBytes = static_cast<const uint8_t*>(positions);
+	vector<BuildTriangle> triangles(indexCount / 3);
+
+	// The triangle bounds and the root bounds, by chunks
+	size_t chunkCount = (triangles.size() + kParallelChunkSize - 1) / kParallelChunkSize;
+	vector<Bounds> chunkBounds(chunkCount);
+	ParallelFor(threadCount, chunkCount, [&](size_t chunk)
+	{
+		Bounds& bounds = chunkBounds[chunk];
+		ResetBounds(bounds.boundsMin, bounds.boundsMax);
+		bounds.invalidIndex = false;
+
+		size_t end = min(triangles.size(), (chunk + 1) * kParallelChunkSize);
+		for (size_t i = chunk * kParallelChunkSize; i < end; ++i)
+		{
+			BuildTriangle& triangle = triangles[i];
+			triangle.triangleIndex = (uint32_t) i;
+			ResetBounds(triangle.boundsMin, triangle.boundsMax);
+
+			for (size_t corner = 0; corner < 3; ++corner)
+			{
+				uint32_t index = indices[3 * i + corner];
+				if (index >= vertexCount)
+				{
+					bounds.invalidIndex = true;
+					continue;
+				}
+				const float* position = reinterpret_cast<const float*>(positionBytes + index * positionStride);
+				GrowBounds(triangle.boundsMin, triangle.boundsMax, position, position);
+			}
+
+			for (int axis = 0; axis < 3; ++axis)
+				triangle.centroid[axis] = (triangle.boundsMin[axis] + triangle.boundsMax[axis]) * 0.5f;
+
+			GrowBounds(bounds.boundsMin, bounds.boundsMax, triangle.boundsMin, triangle.boundsMax);
+		}
+	});
+
+	for (auto& bounds : chunkBounds)
+	{
+		if (bounds.invalidIndex)
+			return false;
+	}
+
+	m_triangleCount = triangles.size();
+	if (triangles.empty())
+		return true;
+
+	BuildRange root;
+	root.begin = 0;
+	root.end = triangles.size();
+	ResetBounds(root.boundsMin, root.boundsMax);
+	for (auto& bounds : chunkBounds)
+		GrowBounds(root.boundsMin, root.boundsMax, bounds.boundsMin, bounds.boundsMax);
+	copy(root.boundsMin, root.boundsMin + 3, m_boundsMin);
+	copy(root.boundsMax, root.boundsMax + 3, m_boundsMax);
+
+	// The top of the hierarchy, which leaves the subtrees to the next step when the mesh is large
+	vector<SubtreeTask> subtreeTasks;
+	BuildContext context = { triangles, positionBytes, positionStride, indices, threadCount,
+		triangles.size() > kSubtreeTriangleCount ? &subtreeTasks : nullptr };
+	BuildOutput output;
+	output.packets.reserve(context.subtreeTasks ? 64 : triangles.size() / 3 + 1);
+	output.nodes.reserve(context.subtreeTasks ? 64 : triangles.size() / 9 + 1);
+	m_root = BuildChild(context, output, root, 0);
+
+	if (!subtreeTasks.empty())
+	{
+		// Largest subtrees first, so that the threads finish together
+		vector<size_t> order(subtreeTasks.size());
+		iota(order.begin(), order.end(), (size_t) 0);
+		stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+		{
+			return subtreeTasks[a].range.end - subtreeTasks[a].range.begin > subtreeTasks[b].range.end - subtreeTasks[b].range.begin;
+		});
+
+		BuildContext subtreeContext = context;
+		subtreeContext.threadCount = 1;
+		subtreeContext.subtreeTasks = nullptr;
+		ParallelFor(threadCount, subtreeTasks.size(), [&](size_t i)
+		{
+			SubtreeTask& task = subtreeTasks[order[i]];
+			size_t triangleCount = task.range.end - task.range.begin;
+			task.output.packets.reserve(triangleCount / 3 + 1);
+			task.output.nodes.reserve(triangleCount / 9 + 1);
+			task.root = BuildChild(subtreeContext, task.output, task.range, task.depth);
+
+			// The reserves are for the worst case, the merge copies all the outputs at once
+			task.output.packets.shrink_to_fit();
+			task.output.nodes.shrink_to_fit();
+		});
+
+		// The build triangles are not needed anymore, free them before the merge doubles the outputs
+		triangles = vector<BuildTriangle>();
+
+		// The subtrees are appended in the order in which the top left them
+		vector<size_t> nodeOffsets(subtreeTasks.size()), packetOffsets(subtreeTasks.size());
+		size_t nodeCount = output.nodes.size(), packetCount = output.packets.size();
+		for (size_t i = 0; i < subtreeTasks.size(); ++i)
+		{
+			nodeOffsets[i] = nodeCount;
+			packetOffsets[i] = packetCount;
+			nodeCount += subtreeTasks[i].output.nodes.size();
+			packetCount += subtreeTasks[i].output.packets.size();
+			output.traversalStackSize = max(output.traversalStackSize, subtreeTasks[i].output.traversalStackSize);
+		}
+		output.nodes.resize(nodeCount);
+		output.packets.resize(packetCount);
+
+		ParallelFor(threadCount, subtreeTasks.size(), [&](size_t i)
+		{
+			SubtreeTask& task = subtreeTasks[order[i]];
+			uint32_t nodeOffset = (uint32_t) nodeOffsets[order[i]];
+			uint32_t packetOffset = (uint32_t) packetOffsets[order[i]];
+			auto Relocate = [&](uint32_t child)
+			{
+				if (child == kInvalidIndex)
+					return child;
+				return (child & kLeafFlag) ? kLeafFlag | ((child & ~kLeafFlag) + packetOffset) : child + nodeOffset;
+			};
+
+			for (size_t node = 0; node < task.output.nodes.size(); ++node)
+			{
+				Node& relocatedNode = output.nodes[nodeOffset + node];
+				relocatedNode = task.output.nodes[node];
+				for (auto& child : relocatedNode.children)
+					child = Relocate(child);
+			}
+			copy(task.output.packets.begin(), task.output.packets.end(), output.packets.begin() + packetOffset);
+
+			// The tasks have different parent slots
+			output.nodes[task.parentNode].children[task.childSlot] = Relocate(task.root);
+			task.output = BuildOutput();
+		});
+	}
+
+	m_nodes = move(output.nodes);
+	m_packets = move(output.packets);
+	m_traversalStackSize = output.traversalStackSize;
+	return true;
+}
+
+size_t MeshBvh::GetSerializedSize() const
+{
+	return sizeof(uint32_t) + sizeof(uint64_t) + sizeof(m_boundsMin) + sizeof(m_boundsMax) +
+		sizeof(uint64_t) + m_nodes.size() * sizeof(Node) + sizeof(uint64_t) + m_packets.size() * sizeof(TrianglePacket);
+}
+
+void MeshBvh::WriteToBuffer(unsigned char** pWritePtr) const
+{
+	auto Write = [pWritePtr](const void* data, size_t size)
+	{
+		if (size > 0)
+			memcpy(*pWritePtr, data, size);
+		*pWritePtr += size;
+	};
+
+	uint64_t triangleCount = m_triangleCount;
+	uint64_t nodeCount = m_nodes.size();
+	uint64_t packetCount = m_packets.size();
+	Write(&m_root, sizeof(m_root));
+	Write(&triangleCount, sizeof(triangleCount));
+	Write(m_boundsMin, sizeof(m_boundsMin));
+	Write(m_boundsMax, sizeof(m_boundsMax));
+	Write(&nodeCount, sizeof(nodeCount));
+	Write(m_nodes.data(), m_nodes.size() * sizeof(Node));
+	Write(&packetCount, sizeof(packetCount));
+	Write(m_packets.data(), m_packets.size() * sizeof(TrianglePacket));
+}
+
+bool MeshBvh::ReadFromBuffer(const unsigned char** pReadPtr, const unsigned char* pEnd)
+{
+	Clear();
+
+	auto Read = [pReadPtr, pEnd](void* data, size_t size)
+	{
+		if ((size_t) (pEnd - *pReadPtr) < size)
+			return false;
+		if (size > 0)
+			memcpy(data, *pReadPtr, size);
+		*pReadPtr += size;
+		return true;
+	};
+
+	uint32_t root = kInvalidIndex;
+	uint64_t triangleCount = 0, nodeCount = 0, packetCount = 0;
+	bool valid = Read(&root, sizeof(root)) && Read(&triangleCount, sizeof(triangleCount)) &&
+		Read(m_boundsMin, sizeof(m_boundsMin)) && Read(m_boundsMax, sizeof(m_boundsMax)) && Read(&nodeCount, sizeof(nodeCount)) &&
+		nodeCount <= (size_t) (pEnd - *pReadPtr) / sizeof(Node);
+	if (valid)
+	{
+		m_nodes.resize((size_t) nodeCount);
+		valid = Read(m_nodes.data(), m_nodes.size() * sizeof(Node)) && Read(&packetCount, sizeof(packetCount)) &&
+			packetCount <= (size_t) (pEnd - *pReadPtr) / sizeof(TrianglePacket);
+	}
+	if (valid)
+	{
+		m_packets.resize((size_t) packetCount);
+		valid = Read(m_packets.data(), m_packets.size() * sizeof(TrianglePacket));
+	}
+
+	// Children always come after their parent node, so the depths are known in index order
+	auto IsValidChild = [&](uint32_t child, size_t parent)
+	{
+		if (child & kLeafFlag)
+			return (child & ~kLeafFlag) < m_packets.size();
+		return child < m_nodes.size() && (parent == kInvalidIndex || child > parent);
+	};
+
+	valid = valid && (root == kInvalidIndex ? m_nodes.empty() && m_packets.empty() : IsValidChild(root, kInvalidIndex));
+	vector<unsigned> depths(valid ? m_nodes.size() : 0, 0);
+	size_t traversalStackSize = root == kInvalidIndex ? 0 : 1;
+	for (size_t nodeIndex = 0; valid && nodeIndex < m_nodes.size(); ++nodeIndex)
+	{
+		traversalStackSize = max(traversalStackSize, (size_t) (depths[nodeIndex] + 1) * (kWidth - 1) + 1);
+		for (uint32_t child : m_nodes[nodeIndex].children)
+		{
+			if (child == kInvalidIndex)
+				continue;
+
+			valid = valid && IsValidChild(child, nodeIndex);
+			if (valid && !(child & kLeafFlag))
+				depths[child] = max(depths[child], depths[nodeIndex] + 1);
+		}
+	}
+	for (size_t packetIndex = 0; valid && packetIndex < m_packets.size(); ++packetIndex)
+	{
+		for (uint32_t triangleIndex : m_packets[packetIndex].triangleIndex)
+			valid = valid && (triangleIndex == kInvalidIndex || triangleIndex < triangleCount);
+	}
+
+	if (!valid)
+	{
+		Clear();
+		return false;
+	}
+
+	m_root = root;
+	m_triangleCount = (size_t) triangleCount;
+	m_traversalStackSize = traversalStackSize;
+	return true;
+}
+
+uint32_t MeshBvh::BuildChild(const BuildContext& context, BuildOutput& output, const BuildRange& range, unsigned depth)
+{
+	const vector<BuildTriangle>& triangles = context.triangles;
+	const uint8_t* positions = context.positions;
+	size_t positionStride = context.positionStride;
+	const uint32_t* indices = context.indices;
+	size_t triangleCount = range.end - range.begin;
+
+	if (triangleCount <= kWidth)
+	{
+		TrianglePacket packet = {};
+		for (unsigned lane = 0; lane < kWidth; ++lane)
+		{
+			packet.triangleIndex[lane] = kInvalidIndex;
+			if (lane >= triangleCount)
+				continue;
+
+			uint32_t triangleIndex = triangles[range.begin + lane].triangleIndex;
+			const float* v0 = reinterpret_cast<const float*>(positions + indices[3 * triangleIndex + 0] * positionStride);
+			const float* v1 = reinterpret_cast<const float*>(positions + indices[3 * triangleIndex + 1] * positionStride);
+			const float* v2 = reinterpret_cast<const float*>(positions + indices[3 * triangleIndex + 2] * positionStride);
+
+			packet.v0x[lane] = v0[0];
+			packet.v0y[lane] = v0[1];
+			packet.v0z[lane] = v0[2];
+			packet.e1x[lane] = v1[0] - v0[0];
+			packet.e1y[lane] = v1[1] - v0[1];
+			packet.e1z[lane] = v1[2] - v0[2];
+			packet.e2x[lane] = v2[0] - v0[0];
+			packet.e2y[lane] = v2[1] - v0[1];
+			packet.e2z[lane] = v2[2] - v0[2];
+			packet.triangleIndex[lane] = triangleIndex;
+		}
+
+		output.packets.push_back(packet);
+		return kLeafFlag | (uint32_t) (output.packets.size() - 1);
+	}
+
+	// Split the range in up to kWidth children, always splitting the child with the largest area
+	BuildRange childRanges[kWidth];
+	unsigned childCount = 1;
+	childRanges[0] = range;
+	while (childCount < kWidth)
+	{
+		int largestChild = -1;
+		float largestArea = -1.0f;
+		for (unsigned i = 0; i < childCount; ++i)
+		{
+			float area = HalfArea(childRanges[i].boundsMin, childRanges[i].boundsMax);
+			if (childRanges[i].end - childRanges[i].begin > kWidth && area > largestArea)
+			{
+				largestChild = (int) i;
+				largestArea = area;
+			}
+		}
+
+		if (largestChild < 0)
+			break;
+
+		BuildRange left, right;
+		SplitRange(context.triangles, childRanges[largestChild], left, right, context.threadCount);
+		childRanges[largestChild] = left;
+		childRanges[childCount++] = right;
+	}
+
+	output.traversalStackSize = max(output.traversalStackSize, (size_t) (depth + 1) * (kWidth - 1) + 1);
+
+	uint32_t nodeIndex = (uint32_t) output.nodes.size();
+	output.nodes.emplace_back();
+	for (unsigned i = 0; i < kWidth; ++i)
+	{
+		uint32_t child = kInvalidIndex;
+		float boundsMin[3], boundsMax[3];
+		ResetBounds(boundsMin, boundsMax);
+		if (i < childCount)
+		{
+			// The child of a subtree task is set once the subtree is built
+			if (context.subtreeTasks && childRanges[i].end - childRanges[i].begin <= kSubtreeTriangleCount)
+				context.subtreeTasks->push_back({ childRanges[i], depth + 1, nodeIndex, i, kInvalidIndex, BuildOutput() });
+			else
+				child = BuildChild(context, output, childRanges[i], depth + 1);
+
+			copy(childRanges[i].boundsMin, childRanges[i].boundsMin + 3, boundsMin);
+			copy(childRanges[i].boundsMax, childRanges[i].boundsMax + 3, boundsMax);
+		}
+
+		// BuildChild grows the nodes, so the node is only referenced after it
+		Node& node = output.nodes[nodeIndex];
+		node.children[i] = child;
+		node.minX[i] = boundsMin[0];
+		node.minY[i] = boundsMin[1];
+		node.minZ[i] = boundsMin[2];
+		node.maxX[i] = boundsMax[0];
+		node.maxY[i] = boundsMax[1];
+		node.maxZ[i] = boundsMax[2];
+	}
+
+	return nodeIndex;
+}
+
+// Splits a range in two with the lowest SAH cost among kBinCount - 1 planes per axis
+void MeshBvh::SplitRange(vector<BuildTriangle>& triangles, const BuildRange& range, BuildRange& left, BuildRange& right, unsigned threadCount)
+{
+	auto GrowCentroidBounds = [&](size_t begin, size_t end, Bounds& bounds)
+	{
+		for (size_t i = begin; i < end; ++i)
+			GrowBounds(bounds.boundsMin, bounds.boundsMax, triangles[i].centroid, triangles[i].centroid);
+	};
+
+	// Large ranges of the top of the hierarchy are binned by chunks, on several threads. The bins only hold counts,
+	// minimums and maximums, so merging the chunks gives the same bins as one pass.
+	size_t chunkCount = 1;
+	if (threadCount > 1 && range.end - range.begin >= 4 * kParallelChunkSize)
+		chunkCount = (range.end - range.begin) / kParallelChunkSize;
+	auto GetChunkBegin = [&](size_t chunk) { return range.begin + chunk * (range.end - range.begin) / chunkCount; };
+
+	Bounds centroidBounds;
+	ResetBounds(centroidBounds.boundsMin, centroidBounds.boundsMax);
+	if (chunkCount == 1)
+	{
+		GrowCentroidBounds(range.begin, range.end, centroidBounds);
+	}
+	else
+	{
+		vector<Bounds> chunkBounds(chunkCount, centroidBounds);
+		ParallelFor(threadCount, chunkCount, [&](size_t chunk) { GrowCentroidBounds(GetChunkBegin(chunk), GetChunkBegin(chunk + 1), chunkBounds[chunk]); });
+		for (auto& bounds : chunkBounds)
+			GrowBounds(centroidBounds.boundsMin, centroidBounds.boundsMax, bounds.boundsMin, bounds.boundsMax);
+	}
+	const float* centroidMin = centroidBounds.boundsMin;
+	const float* centroidMax = centroidBounds.boundsMax;
+
+	float binScales[3];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float extent = centroidMax[axis] - centroidMin[axis];
+		binScales[axis] = extent > 0.0f ? kBinCount / extent : 0.0f;
+	}
+
+	// The three axes are binned in one pass over the triangles
+	struct Bins
+	{
+		size_t counts[3][kBinCount];
+		float boundsMin[3][kBinCount][3];
+		float boundsMax[3][kBinCount][3];
+	};
+
+	auto ResetBins = [](Bins& bins)
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			for (unsigned bin = 0; bin < kBinCount; ++bin)
+			{
+				bins.counts[axis][bin] = 0;
+				ResetBounds(bins.boundsMin[axis][bin], bins.boundsMax[axis][bin]);
+			}
+		}
+	};
+
+	auto BinTriangles = [&](size_t begin, size_t end, Bins& bins)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			const BuildTriangle& triangle = triangles[i];
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				unsigned bin = GetBin(triangle.centroid[axis], centroidMin[axis], binScales[axis]);
+				bins.counts[axis][bin]++;
+				GrowBounds(bins.boundsMin[axis][bin], bins.boundsMax[axis][bin], triangle.boundsMin, triangle.boundsMax);
+			}
+		}
+	};
+
+	Bins bins;
+	ResetBins(bins);
+	if (chunkCount == 1)
+	{
+		BinTriangles(range.begin, range.end, bins);
+	}
+	else
+	{
+		vector<Bins> chunkBins(chunkCount, bins);
+		ParallelFor(threadCount, chunkCount, [&](size_t chunk) { BinTriangles(GetChunkBegin(chunk), GetChunkBegin(chunk + 1), chunkBins[chunk]); });
+		for (auto& chunk : chunkBins)
+		{
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				for (unsigned bin = 0; bin < kBinCount; ++bin)
+				{
+					bins.counts[axis][bin] += chunk.counts[axis][bin];
+					GrowBounds(bins.boundsMin[axis][bin], bins.boundsMax[axis][bin], chunk.boundsMin[axis][bin], chunk.boundsMax[axis][bin]);
+				}
+			}
+		}
+	}
+	auto& binCounts = bins.counts;
+	auto& binMin = bins.boundsMin;
+	auto& binMax = bins.boundsMax;
+
+	float bestCost = FLT_MAX;
+	int bestAxis = -1;
+	unsigned bestBin = 0;
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		if (binScales[axis] == 0.0f)
+			continue;
+
+		// Cost of the bins right of each plane, plane i being between bins i - 1 and i
+		float rightCosts[kBinCount] = {};
+		size_t rightCounts[kBinCount] = {};
+		size_t rightCount = 0;
+		float rightMin[3], rightMax[3];
+		ResetBounds(rightMin, rightMax);
+		for (unsigned bin = kBinCount - 1; bin > 0; --bin)
+		{
+			rightCount += binCounts[axis][bin];
+			GrowBounds(rightMin, rightMax, binMin[axis][bin], binMax[axis][bin]);
+			rightCounts[bin] = rightCount;
+			rightCosts[bin] = rightCount > 0 ? rightCount * HalfArea(rightMin, rightMax) : 0.0f;
+		}
+
+		size_t leftCount = 0;
+		float leftMin[3], leftMax[3];
+		ResetBounds(leftMin, leftMax);
+		for (unsigned bin = 1; bin < kBinCount; ++bin)
+		{
+			leftCount += binCounts[axis][bin - 1];
+			GrowBounds(leftMin, leftMax, binMin[axis][bin - 1], binMax[axis][bin - 1]);
+			if (leftCount == 0 || rightCounts[bin] == 0)
+				continue;
+
+			float cost = leftCount * HalfArea(leftMin, leftMax) + rightCosts[bin];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = bin;
+			}
+		}
+	}
+
+	left.begin = range.begin;
+	right.end = range.end;
+	ResetBounds(left.boundsMin, left.boundsMax);
+	ResetBounds(right.boundsMin, right.boundsMax);
+
+	if (bestAxis >= 0)
+	{
+		auto splitPoint = partition(triangles.begin() + range.begin, triangles.begin() + range.end,
+			[&](const BuildTriangle& triangle) { return GetBin(triangle.centroid[bestAxis], centroidMin[bestAxis], binScales[bestAxis]) < bestBin; });
+		left.end = right.begin = splitPoint - triangles.begin();
+
+		// The bins already hold the bounds of both sides
+		for (unsigned bin = 0; bin < kBinCount; ++bin)
+		{
+			if (bin < bestBin)
+				GrowBounds(left.boundsMin, left.boundsMax, binMin[bestAxis][bin], binMax[bestAxis][bin]);
+			else
+				GrowBounds(right.boundsMin, right.boundsMax, binMin[bestAxis][bin], binMax[bestAxis][bin]);
+		}
+	}
+	else
+	{
+		// All the centroids are at the same point, any split is as good
+		left.end = right.begin = range.begin + (range.end - range.begin) / 2;
+
+		for (size_t i = left.begin; i < left.end; ++i)
+			GrowBounds(left.boundsMin, left.boundsMax, triangles[i].boundsMin, triangles[i].boundsMax);
+		for (size_t i = right.begin; i < right.end; ++i)
+			GrowBounds(right.boundsMin, right.boundsMax, triangles[i].boundsMin, triangles[i].boundsMax);
+	}
+	assert(left.end > left.begin && right.end > right.begin);
+}
+
+bool MeshBvh::Intersect(const float rayOrigin[3], const float rayDirection[3], Hit& hit, HitMode mode, Culling culling, float maxDistance) const
+{
+	if (m_root == kInvalidIndex)
+		return false;
+
+	const bool furthest = (mode == HitMode::Furthest);
+	const bool anyHit = (mode == HitMode::Any);
+
+	// Hits are kept in [start, end]: the closest hit shrinks the end, the furthest one raises the start
+	float start = 0.0f;
+	float end = maxDistance;
+	bool hitFound = false;
+	uint32_t hitPacket = 0;
+	unsigned hitLane = 0;
+
+	// Inverse direction for the slab tests; tiny components are clamped so that no lane computes 0 * inf
+	float inverseDirection[3];
+	bool negativeDirection[3];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float component = rayDirection[axis];
+		if (fabsf(component) < 1e-20f)
+			component = copysignf(1e-20f, component);
+		inverseDirection[axis] = 1.0f / component;
+		negativeDirection[axis] = component < 0.0f;
+	}
+
+	const Float4 originX = Splat(rayOrigin[0]), originY = Splat(rayOrigin[1]), originZ = Splat(rayOrigin[2]);
+	const Float4 directionX = Splat(rayDirection[0]), directionY = Splat(rayDirection[1]), directionZ = Splat(rayDirection[2]);
+	const Float4 inverseX = Splat(inverseDirection[0]), inverseY = Splat(inverseDirection[1]), inverseZ = Splat(inverseDirection[2]);
+	const Float4 zero = Splat(0.0f);
+
+	StackEntry localStack[kLocalStackSize];
+	vector<StackEntry> largeStack;
+	StackEntry* stack = localStack;
+	if (m_traversalStackSize > kLocalStackSize)
+	{
+		largeStack.resize(m_traversalStackSize);
+		stack = largeStack.data();
+	}
+
+	size_t stackSize = 0;
+	stack[stackSize++] = { m_root, furthest ? maxDistance : 0.0f };
+
+	while (stackSize > 0)
+	{
+		StackEntry entry = stack[--stackSize];
+
+		// Boxes beyond the closest hit, or before the furthest one, found since they were pushed
+		if (furthest ? entry.distance < start : entry.distance > end)
+			continue;
+
+		if (entry.child & kLeafFlag)
+		{
+			const TrianglePacket& packet = m_packets[entry.child & ~kLeafFlag];
+
+			Float4 e1x = Load(packet.e1x), e1y = Load(packet.e1y), e1z = Load(packet.e1z);
+			Float4 e2x = Load(packet.e2x), e2y = Load(packet.e2y), e2z = Load(packet.e2z);
+
+			// Moller-Trumbore, without divisions: u, v and t are scaled by |det|
+			Float4 px = Sub(Mul(directionY, e2z), Mul(directionZ, e2y));
+			Float4 py = Sub(Mul(directionZ, e2x), Mul(directionX, e2z));
+			Float4 pz = Sub(Mul(directionX, e2y), Mul(directionY, e2x));
+			Float4 det = Add(Add(Mul(e1x, px), Mul(e1y, py)), Mul(e1z, pz));
+
+			Float4 sx = Sub(originX, Load(packet.v0x));
+			Float4 sy = Sub(originY, Load(packet.v0y));
+			Float4 sz = Sub(originZ, Load(packet.v0z));
+			Float4 u = Add(Add(Mul(sx, px), Mul(sy, py)), Mul(sz, pz));
+
+			Float4 qx = Sub(Mul(sy, e1z), Mul(sz, e1y));
+			Float4 qy = Sub(Mul(sz, e1x), Mul(sx, e1z));
+			Float4 qz = Sub(Mul(sx, e1y), Mul(sy, e1x));
+			Float4 v = Add(Add(Mul(directionX, qx), Mul(directionY, qy)), Mul(directionZ, qz));
+			Float4 t = Add(Add(Mul(e2x, qx), Mul(e2y, qy)), Mul(e2z, qz));
+
+			Float4 absDet = Abs(det);
+			u = FlipSign(u, det);
+			v = FlipSign(v, det);
+			t = FlipSign(t, det);
+
+			// Padding lanes have zero edges, so det is 0 and they are rejected here
+			Mask4 valid = And(Less(zero, absDet), And(LessEqual(zero, u), LessEqual(zero, v)));
+			valid = And(valid, LessEqual(Add(u, v), absDet));
+			valid = And(valid, And(LessEqual(Mul(Splat(start), absDet), t), LessEqual(t, Mul(Splat(end), absDet))));
+
+			// Front faces are clockwise, that is det < 0 for rays hitting them
+			if (culling == Culling::BackFaces)
+				valid = And(valid, Less(det, zero));
+			else if (culling == Culling::FrontFaces)
+				valid = And(valid, Less(zero, det));
+
+			int lanes = MoveMask(valid);
+			if (lanes == 0)
+				continue;
+
+			alignas(16) float scaledDistances[kWidth];
+			alignas(16) float scales[kWidth];
+			Store(scaledDistances, t);
+			Store(scales, absDet);
+
+			for (unsigned lane = 0; lane < kWidth; ++lane)
+			{
+				if (!(lanes & (1 << lane)))
+					continue;
+
+				float distance = scaledDistances[lane] / scales[lane];
+				if (distance < start || distance > end)
+					continue;
+
+				if (furthest)
+					start = distance;
+				else
+					end = distance;
+				hitFound = true;
+				hitPacket = entry.child & ~kLeafFlag;
+				hitLane = lane;
+			}
+
+			if (anyHit && hitFound)
+				break;
+			continue;
+		}
+
+		const Node& node = m_nodes[entry.child];
+
+		// Slab test of the four child boxes, with the near and far planes picked from the ray direction
+		Float4 nearX = Mul(Sub(Load(negativeDirection[0] ? node.maxX : node.minX), originX), inverseX);
+		Float4 nearY = Mul(Sub(Load(negativeDirection[1] ? node.maxY : node.minY), originY), inverseY);
+		Float4 nearZ = Mul(Sub(Load(negativeDirection[2] ? node.maxZ : node.minZ), originZ), inverseZ);
+		Float4 farX = Mul(Sub(Load(negativeDirection[0] ? node.minX : node.maxX), originX), inverseX);
+		Float4 farY = Mul(Sub(Load(negativeDirection[1] ? node.minY : node.maxY), originY), inverseY);
+		Float4 farZ = Mul(Sub(Load(negativeDirection[2] ? node.minZ : node.maxZ), originZ), inverseZ);
+
+		Float4 entryDistance = Max(Max(nearX, nearY), Max(nearZ, Splat(start)));
+		Float4 exitDistance = Min(Min(farX, farY), Min(farZ, Splat(end)));
+		int lanes = MoveMask(LessEqual(entryDistance, exitDistance));
+		if (lanes == 0)
+			continue;
+
+		alignas(16) float distances[kWidth];
+		Store(distances, furthest ? exitDistance : entryDistance);
+
+		// Push the hit children so that the closest (or furthest) one is popped first
+		StackEntry children[kWidth];
+		unsigned childCount = 0;
+		for (unsigned lane = 0; lane < kWidth; ++lane)
+		{
+			if (!(lanes & (1 << lane)))
+				continue;
+
+			StackEntry child = { node.children[lane], distances[lane] };
+			unsigned i = childCount++;
+			for (; i > 0 && (furthest ? children[i - 1].distance > child.distance : children[i - 1].distance < child.distance); --i)
+				children[i] = children[i - 1];
+			children[i] = child;
+		}
+
+		assert(stackSize + childCount <= max(m_traversalStackSize, kLocalStackSize));
+		for (unsigned i = 0; i < childCount; ++i)
+			stack[stackSize++] = children[i];
+	}
+
+	if (!hitFound)
+		return false;
+
+	const TrianglePacket& packet = m_packets[hitPacket];
+	float e1[3] = { packet.e1x[hitLane], packet.e1y[hitLane], packet.e1z[hitLane] };
+	float e2[3] = { packet.e2x[hitLane], packet.e2y[hitLane], packet.e2z[hitLane] };
+	float normal[3] = {
+		e2[1] * e1[2] - e2[2] * e1[1],
+		e2[2] * e1[0] - e2[0] * e1[2],
+		e2[0] * e1[1] - e2[1] * e1[0] };
+	float length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+
+	hit.distance = furthest ? start : end;
+	hit.triangleIndex = packet.triangleIndex[hitLane];
+	for (int axis = 0; axis < 3; ++axis)
+		hit.normal[axis] = length > 0.0f ? normal[axis] / length : 0.0f;
+
+	return true;
+}
+
+bool MeshBvh::IntersectTriangles(const void* positions, size_t positionStride, const uint32_t* indices, size_t indexCount,
+	const float rayOrigin[3], const float rayDirection[3], Hit& hit, HitMode mode, Culling culling, float maxDistance)
+{
+	const uint8_t* positionBytes = static_cast<const uint8_t*>(positions);
+	const bool furthest = (mode == HitMode::Furthest);
+
+	float start = 0.0f;
+	float end = maxDistance;
+	bool hitFound = false;
+	uint32_t hitTriangle = 0;
+	float hitE1[3] = {}, hitE2[3] = {};
+
+	const float* d = rayDirection;
+	for (size_t triangle = 0; triangle < indexCount / 3; ++triangle)
+	{
+		const float* v0 = reinterpret_cast<const float*>(positionBytes + indices[3 * triangle + 0] * positionStride);
+		const float* v1 = reinterpret_cast<const float*>(positionBytes + indices[3 * triangle + 1] * positionStride);
+		const float* v2 = reinterpret_cast<const float*>(positionBytes + indices[3 * triangle + 2] * positionStride);
+		float e1[3] = { v1[0] - v0[0], v1[1] - v0[1], v1[2] - v0[2] };
+		float e2[3] = { v2[0] - v0[0], v2[1] - v0[1], v2[2] - v0[2] };
+
+		// The packet test of Intersect, one triangle at a time
+		float p[3] = { d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0] };
+		float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+
+		float s[3] = { rayOrigin[0] - v0[0], rayOrigin[1] - v0[1], rayOrigin[2] - v0[2] };
+		float u = s[0] * p[0] + s[1] * p[1] + s[2] * p[2];
+
+		float q[3] = { s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0] };
+		float v = d[0] * q[0] + d[1] * q[1] + d[2] * q[2];
+		float t = e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2];
+
+		float absDet = fabsf(det);
+		if (signbit(det))
+		{
+			u = -u;
+			v = -v;
+			t = -t;
+		}
+
+		if (!(0.0f < absDet && 0.0f <= u && 0.0f <= v && u + v <= absDet && start * absDet <= t && t <= end * absDet))
+			continue;
+		if ((culling == Culling::BackFaces && !(det < 0.0f)) || (culling == Culling::FrontFaces && !(0.0f < det)))
+			continue;
+
+		float distance = t / absDet;
+		if (distance < start || distance > end)
+			continue;
+
+		if (furthest)
+			start = distance;
+		else
+			end = distance;
+		hitFound = true;
+		hitTriangle = (uint32_t) triangle;
+		copy(e1, e1 + 3, hitE1);
+		copy(e2, e2 + 3, hitE2);
+
+		if (mode == HitMode::Any)
+			break;
+	}
+
+	if (!hitFound)
+		return false;
+
+	float normal[3] = {
+		hitE2[1] * hitE1[2] - hitE2[2] * hitE1[1],
+		hitE2[2] * hitE1[0] - hitE2[0] * hitE1[2],
+		hitE2[0] * hitE1[1] - hitE2[1] * hitE1[0] };
+	float length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+
+	hit.distance = furthest ? start : end;
+	hit.triangleIndex = hitTriangle;
+	for (int axis = 0; axis < 3; ++axis)
+		hit.normal[axis] = length > 0.0f ? normal[axis] / length : 0.0f;
+
+	return true;
+}
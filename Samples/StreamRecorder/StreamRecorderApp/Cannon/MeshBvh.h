@@ -0,0 +1,176 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Bounding volume hierarchy for ray queries against a triangle mesh.
+//
+// Portable (no DirectX / WinRT dependencies) so that it can also be built and
+// checked by desktop tools. Positions are read from any vertex layout through
+// a byte stride, and rays are given in the space of the mesh vertices.
+//
+// The hierarchy is built once with the surface area heuristic (SAH) on binned
+// triangle centroids: each triangle is in exactly one leaf. Nodes have four
+// children whose bounds are stored as structure of arrays, and leaves hold
+// one packet of up to four triangles, so the traversal tests four boxes or
+// four triangles at a time (SSE on x86/x64, NEON on ARM, scalar otherwise).
+//
+// Large meshes are built on several threads: the top of the hierarchy is split
+// with the binning spread over the threads, down to subtrees of at most
+// kSubtreeTriangleCount triangles which are then built in parallel. The split
+// into subtrees does not depend on the thread count, so any thread count gives
+// the same hierarchy.
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+class MeshBvh
+{
+public:
+
+	static constexpr unsigned kWidth = 4;				// Children per node and triangles per leaf
+	static constexpr uint32_t kInvalidIndex = 0xffffffff;
+	static constexpr size_t kSubtreeTriangleCount = 16384;	// Meshes up to this size are built on the calling thread only
+
+	enum class HitMode
+	{
+		Closest,		// Closest hit along the ray
+		Furthest,		// Furthest hit along the ray
+		Any				// First hit found by the traversal, for occlusion tests
+	};
+
+	// Winding of the triangles: seen from the front, a triangle (a, b, c) is clockwise.
+	// Mirroring transforms flip the winding, see Mesh::TestRayIntersection.
+	enum class Culling
+	{
+		None,
+		BackFaces,
+		FrontFaces
+	};
+
+	struct Hit
+	{
+		float distance;				// In units of the ray direction
+		uint32_t triangleIndex;		// The triangle indices start at indices[3 * triangleIndex]
+		float normal[3];			// Unit front face normal, normalize(cross(c - a, b - a))
+	};
+
+	// Builds the hierarchy of a triangle list.
+	// positions points to the x, y, z floats of the first vertex, and the following vertices are positionStride bytes apart.
+	// threadCount includes the calling thread.
+	// Returns false, with an empty hierarchy, when an index is not below vertexCount.
+	bool Build(const void* positions, size_t positionStride, size_t vertexCount, const uint32_t* indices, size_t indexCount, unsigned threadCount = 1);
+	void Clear();
+
+	// Raw copy of the hierarchy, for caches that are read back by the same build of the code.
+	// ReadFromBuffer checks that the indices are consistent, and leaves the hierarchy empty if they are not.
+	size_t GetSerializedSize() const;
+	void WriteToBuffer(unsigned char** pWritePtr) const;
+	bool ReadFromBuffer(const unsigned char** pReadPtr, const unsigned char* pEnd);
+
+	bool IsEmpty() const { return m_packets.empty(); }
+	size_t GetNodeCount() const { return m_nodes.size(); }
+	size_t GetTriangleCount() const { return m_triangleCount; }
+
+	// Bounds of all the triangles, inverted (min > max) when empty
+	const float* GetBoundsMin() const { return m_boundsMin; }
+	const float* GetBoundsMax() const { return m_boundsMax; }
+
+	// Hits at a distance in [0, maxDistance], in units of the ray direction (which does not need to be normalized)
+	bool Intersect(const float rayOrigin[3], const float rayDirection[3], Hit& hit, HitMode mode = HitMode::Closest,
+		Culling culling = Culling::BackFaces, float maxDistance = std::numeric_limits<float>::max()) const;
+
+	// Same test against every triangle of a triangle list, without a hierarchy: for meshes whose BVH is being built
+	static bool IntersectTriangles(const void* positions, size_t positionStride, const uint32_t* indices, size_t indexCount,
+		const float rayOrigin[3], const float rayDirection[3], Hit& hit, HitMode mode = HitMode::Closest,
+		Culling culling = Culling::BackFaces, float maxDistance = std::numeric_limits<float>::max());
+
+private:
+
+	// Four child boxes. A child is either a node index, a packet index with kLeafFlag set, or kInvalidIndex.
+	// Unused children have inverted bounds, so they are never hit.
+	struct alignas(16) Node
+	{
+		float minX[kWidth], minY[kWidth], minZ[kWidth];
+		float maxX[kWidth], maxY[kWidth], maxZ[kWidth];
+		uint32_t children[kWidth];
+	};
+
+	// Four triangles (v0, e1 = v1 - v0, e2 = v2 - v0). Unused lanes have zero edges and triangleIndex kInvalidIndex.
+	struct alignas(16) TrianglePacket
+	{
+		float v0x[kWidth], v0y[kWidth], v0z[kWidth];
+		float e1x[kWidth], e1y[kWidth], e1z[kWidth];
+		float e2x[kWidth], e2y[kWidth], e2z[kWidth];
+		uint32_t triangleIndex[kWidth];
+	};
+
+	static constexpr uint32_t kLeafFlag = 0x80000000;
+
+	struct BuildTriangle
+	{
+		float boundsMin[3];
+		float boundsMax[3];
+		float centroid[3];
+		uint32_t triangleIndex;
+	};
+
+	struct BuildRange
+	{
+		size_t begin;
+		size_t end;
+		float boundsMin[3];
+		float boundsMax[3];
+	};
+
+	// Nodes and packets of the top of the hierarchy, or of a subtree built by one thread
+	struct BuildOutput
+	{
+		std::vector<Node> nodes;
+		std::vector<TrianglePacket> packets;
+		size_t traversalStackSize = 1;
+	};
+
+	// Subtree left by the top of the hierarchy to the worker threads. It is appended to the nodes and packets of the
+	// top once built, and its root becomes child childSlot of parentNode.
+	struct SubtreeTask
+	{
+		BuildRange range;
+		unsigned depth;
+		uint32_t parentNode;
+		unsigned childSlot;
+		uint32_t root;
+		BuildOutput output;
+	};
+
+	struct BuildContext
+	{
+		std::vector<BuildTriangle>& triangles;		// Partitioned in place, each thread in its own ranges
+		const uint8_t* positions;
+		size_t positionStride;
+		const uint32_t* indices;
+		unsigned threadCount;						// Threads that can bin the ranges of the top of the hierarchy
+		std::vector<SubtreeTask>* subtreeTasks;		// Where the top of the hierarchy leaves its subtrees, null in the subtrees
+	};
+
+	static uint32_t BuildChild(const BuildContext& context, BuildOutput& output, const BuildRange& range, unsigned depth);
+	static void SplitRange(std::vector<BuildTriangle>& triangles, const BuildRange& range, BuildRange& left, BuildRange& right, unsigned threadCount);
+
+	std::vector<Node> m_nodes;
+	std::vector<TrianglePacket> m_packets;
+	uint32_t m_root = kInvalidIndex;		// Node index, or packet index with kLeafFlag set when the mesh fits in one packet
+	size_t m_triangleCount = 0;
+	size_t m_traversalStackSize = 0;		// Deepest path of the hierarchy times (kWidth - 1), plus one
+	float m_boundsMin[3] = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+	float m_boundsMax[3] = { -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max() };
+};
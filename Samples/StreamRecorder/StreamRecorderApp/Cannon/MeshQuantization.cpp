@@ -0,0 +1,381 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "MeshQuantization.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+// Define MESH_QUANTIZATION_NO_SIMD to build the scalar version on any target
+#if !defined(MESH_QUANTIZATION_NO_SIMD) && (defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__))
+#define MESH_QUANTIZATION_SSE
+#include <emmintrin.h>
+#elif !defined(MESH_QUANTIZATION_NO_SIMD) && (defined(_M_ARM64) || defined(_M_ARM) || defined(__ARM_NEON))
+#define MESH_QUANTIZATION_NEON
+#if defined(_MSC_VER) && defined(_M_ARM64)
+#include <arm64_neon.h>
+#else
+#include <arm_neon.h>
+#endif
+#endif
+
+using namespace std;
+
+namespace
+{
+	// The SIMD versions divide by multiplying with these powers of two, which is exact
+	const float kSnorm16Divisor = 32768.0f;
+	const float kSnorm8Divisor = 128.0f;
+
+	inline float* GetVertex(void* destination, size_t destinationStride, size_t vertexIndex)
+	{
+		return (float*) ((unsigned char*) destination + vertexIndex * destinationStride);
+	}
+
+	inline const float* GetSourceVertex(const float* source, size_t sourceStride, size_t vertexIndex)
+	{
+		return (const float*) ((const unsigned char*) source + vertexIndex * sourceStride);
+	}
+
+	// As the input assembler converts DXGI_FORMAT_R16G16_SNORM
+	inline float Snorm16ToFloat(int16_t value)
+	{
+		return max(value / 32767.0f, -1.0f);
+	}
+
+	inline int16_t FloatToSnorm16(float value)
+	{
+		return (int16_t) lroundf(min(max(value, -1.0f), 1.0f) * 32767.0f);
+	}
+
+	inline void DecodeSnorm16Position(const int16_t* source, const float scale[3], float* destination)
+	{
+		destination[0] = source[0] / kSnorm16Divisor * scale[0];
+		destination[1] = source[1] / kSnorm16Divisor * scale[1];
+		destination[2] = source[2] / kSnorm16Divisor * scale[2];
+		destination[3] = 1.0f;
+	}
+
+	inline void DecodeSnorm8Normal(const int8_t* source, float* destination)
+	{
+		destination[0] = source[0] / kSnorm8Divisor;
+		destination[1] = source[1] / kSnorm8Divisor;
+		destination[2] = source[2] / kSnorm8Divisor;
+		destination[3] = 0.0f;
+	}
+}
+
+void DecodeSnorm16Positions(const int16_t* source, size_t vertexCount, const float scale[3], void* destination, size_t destinationStride)
+{
+	size_t i = 0;
+
+#if defined(MESH_QUANTIZATION_SSE)
+	const __m128 unit = _mm_set1_ps(1.0f / kSnorm16Divisor);
+	const __m128 scales = _mm_setr_ps(scale[0], scale[1], scale[2], 0.0f);
+	const __m128 xyzMask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+	const __m128 w = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+
+	// Two vertices per iteration, sign extended to 32 bit by shifting them down from the upper halves
+	for (; i + 2 <= vertexCount; i += 2)
+	{
+		__m128i packed = _mm_loadu_si128((const __m128i*) (source + i * 4));
+		__m128 first = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(packed, packed), 16));
+		__m128 second = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(packed, packed), 16));
+
+		first = _mm_or_ps(_mm_and_ps(_mm_mul_ps(_mm_mul_ps(first, unit), scales), xyzMask), w);
+		second = _mm_or_ps(_mm_and_ps(_mm_mul_ps(_mm_mul_ps(second, unit), scales), xyzMask), w);
+
+		_mm_storeu_ps(GetVertex(destination, destinationStride, i), first);
+		_mm_storeu_ps(GetVertex(destination, destinationStride, i + 1), second);
+	}
+#elif defined(MESH_QUANTIZATION_NEON)
+	const float32x4_t unit = vdupq_n_f32(1.0f / kSnorm16Divisor);
+	const float scaleLanes[4] = { scale[0], scale[1], scale[2], 0.0f };
+	const float32x4_t scales = vld1q_f32(scaleLanes);
+
+	for (; i + 2 <= vertexCount; i += 2)
+	{
+		int16x8_t packed = vld1q_s16(source + i * 4);
+		float32x4_t first = vcvtq_f32_s32(vmovl_s16(vget_low_s16(packed)));
+		float32x4_t second = vcvtq_f32_s32(vmovl_s16(vget_high_s16(packed)));
+
+		first = vsetq_lane_f32(1.0f, vmulq_f32(vmulq_f32(first, unit), scales), 3);
+		second = vsetq_lane_f32(1.0f, vmulq_f32(vmulq_f32(second, unit), scales), 3);
+
+		vst1q_f32(GetVertex(destination, destinationStride, i), first);
+		vst1q_f32(GetVertex(destination, destinationStride, i + 1), second);
+	}
+#endif
+
+	for (; i < vertexCount; ++i)
+		DecodeSnorm16Position(source + i * 4, scale, GetVertex(destination, destinationStride, i));
+}
+
+void DecodeSnorm8Normals(const int8_t* source, size_t vertexCount, void* destination, size_t destinationStride)
+{
+	size_t i = 0;
+
+#if defined(MESH_QUANTIZATION_SSE)
+	const __m128 unit = _mm_set1_ps(1.0f / kSnorm8Divisor);
+	const __m128 xyzMask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+
+	// Four vertices per iteration, sign extended to 16 then 32 bit
+	for (; i + 4 <= vertexCount; i += 4)
+	{
+		__m128i packed = _mm_loadu_si128((const __m128i*) (source + i * 4));
+		__m128i low = _mm_srai_epi16(_mm_unpacklo_epi8(packed, packed), 8);
+		__m128i high = _mm_srai_epi16(_mm_unpackhi_epi8(packed, packed), 8);
+
+		__m128i lanes[4] =
+		{
+			_mm_srai_epi32(_mm_unpacklo_epi16(low, low), 16),
+			_mm_srai_epi32(_mm_unpackhi_epi16(low, low), 16),
+			_mm_srai_epi32(_mm_unpacklo_epi16(high, high), 16),
+			_mm_srai_epi32(_mm_unpackhi_epi16(high, high), 16)
+		};
+
+		for (size_t j = 0; j < 4; ++j)
+		{
+			__m128 normal = _mm_and_ps(_mm_mul_ps(_mm_cvtepi32_ps(lanes[j]), unit), xyzMask);
+			_mm_storeu_ps(GetVertex(destination, destinationStride, i + j), normal);
+		}
+	}
+#elif defined(MESH_QUANTIZATION_NEON)
+	const float32x4_t unit = vdupq_n_f32(1.0f / kSnorm8Divisor);
+
+	for (; i + 4 <= vertexCount; i += 4)
+	{
+		int8x16_t packed = vld1q_s8(source + i * 4);
+		int16x8_t low = vmovl_s8(vget_low_s8(packed));
+		int16x8_t high = vmovl_s8(vget_high_s8(packed));
+
+		int32x4_t lanes[4] = { vmovl_s16(vget_low_s16(low)), vmovl_s16(vget_high_s16(low)), vmovl_s16(vget_low_s16(high)), vmovl_s16(vget_high_s16(high)) };
+
+		for (size_t j = 0; j < 4; ++j)
+		{
+			float32x4_t normal = vsetq_lane_f32(0.0f, vmulq_f32(vcvtq_f32_s32(lanes[j]), unit), 3);
+			vst1q_f32(GetVertex(destination, destinationStride, i + j), normal);
+		}
+	}
+#endif
+
+	for (; i < vertexCount; ++i)
+		DecodeSnorm8Normal(source + i * 4, GetVertex(destination, destinationStride, i));
+}
+
+void WidenIndices(const uint16_t* source, size_t indexCount, uint32_t* destination)
+{
+	size_t i = 0;
+
+#if defined(MESH_QUANTIZATION_SSE)
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 8 <= indexCount; i += 8)
+	{
+		__m128i packed = _mm_loadu_si128((const __m128i*) (source + i));
+		_mm_storeu_si128((__m128i*) (destination + i), _mm_unpacklo_epi16(packed, zero));
+		_mm_storeu_si128((__m128i*) (destination + i + 4), _mm_unpackhi_epi16(packed, zero));
+	}
+#elif defined(MESH_QUANTIZATION_NEON)
+	for (; i + 8 <= indexCount; i += 8)
+	{
+		uint16x8_t packed = vld1q_u16(source + i);
+		vst1q_u32(destination + i, vmovl_u16(vget_low_u16(packed)));
+		vst1q_u32(destination + i + 4, vmovl_u16(vget_high_u16(packed)));
+	}
+#endif
+
+	for (; i < indexCount; ++i)
+		destination[i] = source[i];
+}
+
+void QuantizeVertices(const float* positions, const float* normals, const float* texcoords, size_t stride, size_t vertexCount,
+	QuantizedVertex* destination, PositionDequantization& dequantization)
+{
+	float boundsMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float boundsMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (size_t i = 0; i < vertexCount; ++i)
+	{
+		const float* position = GetSourceVertex(positions, stride, i);
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			boundsMin[axis] = min(boundsMin[axis], position[axis]);
+			boundsMax[axis] = max(boundsMax[axis], position[axis]);
+		}
+	}
+
+	// Flat axes keep a zero scale, all their positions being quantized to 0
+	float inverseScale[3] = {};
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		dequantization.offset[axis] = vertexCount > 0 ? boundsMin[axis] : 0.0f;
+		dequantization.scale[axis] = vertexCount > 0 ? boundsMax[axis] - boundsMin[axis] : 0.0f;
+		if (dequantization.scale[axis] > 0.0f)
+			inverseScale[axis] = 65535.0f / dequantization.scale[axis];
+	}
+
+	for (size_t i = 0; i < vertexCount; ++i)
+	{
+		const float* position = GetSourceVertex(positions, stride, i);
+		QuantizedVertex& vertex = destination[i];
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			float quantized = (position[axis] - dequantization.offset[axis]) * inverseScale[axis];
+			vertex.position[axis] = (uint16_t) min(max(quantized + 0.5f, 0.0f), 65535.0f);
+		}
+		vertex.position[3] = 65535;
+
+		EncodeOctahedralNormal(GetSourceVertex(normals, stride, i), vertex.normal);
+
+		if (texcoords)
+		{
+			const float* texcoord = GetSourceVertex(texcoords, stride, i);
+			vertex.texcoord[0] = FloatToHalf(texcoord[0]);
+			vertex.texcoord[1] = FloatToHalf(texcoord[1]);
+		}
+		else
+		{
+			vertex.texcoord[0] = vertex.texcoord[1] = 0;
+		}
+	}
+}
+
+void DequantizeVertices(const QuantizedVertex* source, size_t vertexCount, const PositionDequantization& dequantization,
+	float* positions, float* normals, float* texcoords, size_t stride)
+{
+	for (size_t i = 0; i < vertexCount; ++i)
+	{
+		const QuantizedVertex& vertex = source[i];
+
+		if (positions)
+		{
+			float* position = GetVertex(positions, stride, i);
+			for (int axis = 0; axis < 3; ++axis)
+				position[axis] = vertex.position[axis] / 65535.0f * dequantization.scale[axis] + dequantization.offset[axis];
+			position[3] = 1.0f;
+		}
+
+		if (normals)
+		{
+			float* normal = GetVertex(normals, stride, i);
+			DecodeOctahedralNormal(vertex.normal, normal);
+			normal[3] = 0.0f;
+		}
+
+		if (texcoords)
+		{
+			float* texcoord = GetVertex(texcoords, stride, i);
+			texcoord[0] = HalfToFloat(vertex.texcoord[0]);
+			texcoord[1] = HalfToFloat(vertex.texcoord[1]);
+		}
+	}
+}
+
+// The normal is projected on the octahedron |x| + |y| + |z| = 1, whose lower half is folded over the upper one
+
+void EncodeOctahedralNormal(const float normal[3], int16_t encoded[2])
+{
+	float length = fabsf(normal[0]) + fabsf(normal[1]) + fabsf(normal[2]);
+	if (length == 0.0f)
+	{
+		encoded[0] = encoded[1] = 0;
+		return;
+	}
+
+	float x = normal[0] / length;
+	float y = normal[1] / length;
+	if (normal[2] < 0.0f)
+	{
+		float foldedX = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float foldedY = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = foldedX;
+		y = foldedY;
+	}
+
+	encoded[0] = FloatToSnorm16(x);
+	encoded[1] = FloatToSnorm16(y);
+}
+
+void DecodeOctahedralNormal(const int16_t encoded[2], float normal[3])
+{
+	float x = Snorm16ToFloat(encoded[0]);
+	float y = Snorm16ToFloat(encoded[1]);
+	float z = 1.0f - fabsf(x) - fabsf(y);
+
+	float fold = max(-z, 0.0f);
+	x += x >= 0.0f ? -fold : fold;
+	y += y >= 0.0f ? -fold : fold;
+
+	float inverseLength = 1.0f / sqrtf(x * x + y * y + z * z);
+	normal[0] = x * inverseLength;
+	normal[1] = y * inverseLength;
+	normal[2] = z * inverseLength;
+}
+
+uint16_t FloatToHalf(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	uint16_t sign = (uint16_t) ((bits >> 16) & 0x8000);
+	uint32_t absoluteBits = bits & 0x7fffffff;
+
+	// Infinity and NaN (kept quiet)
+	if (absoluteBits >= 0x7f800000)
+		return sign | 0x7c00 | (absoluteBits > 0x7f800000 ? 0x200 : 0);
+
+	// 65520 and above round to infinity
+	if (absoluteBits >= 0x477ff000)
+		return sign | 0x7c00;
+
+	// Below 2^-14, the half is subnormal: the value in units of 2^-24, rounded
+	if (absoluteBits < 0x38800000)
+	{
+		if (absoluteBits < 0x33000000)
+			return sign;
+
+		uint32_t exponent = absoluteBits >> 23;
+		uint32_t mantissa = (absoluteBits & 0x7fffff) | 0x800000;
+		uint32_t shift = 126 - exponent;
+		uint32_t half = mantissa >> shift;
+		uint32_t remainder = mantissa & ((1u << shift) - 1);
+		uint32_t halfway = 1u << (shift - 1);
+		if (remainder > halfway || (remainder == halfway && (half & 1)))
+			half++;
+		return sign | (uint16_t) half;
+	}
+
+	// Rebiased exponent and top of the mantissa; rounding up can carry into the exponent
+	uint32_t half = (absoluteBits - 0x38000000) >> 13;
+	uint32_t remainder = absoluteBits & 0x1fff;
+	if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+		half++;
+	return sign | (uint16_t) half;
+}
+
+float HalfToFloat(uint16_t value)
+{
+	uint32_t sign = (uint32_t) (value & 0x8000) << 16;
+	uint32_t exponent = (value >> 10) & 0x1f;
+	uint32_t mantissa = value & 0x3ff;
+
+	if (exponent == 0)
+	{
+		float subnormal = mantissa / 16777216.0f;
+		return sign ? -subnormal : subnormal;
+	}
+
+	uint32_t bits = sign | (exponent == 31 ? 0x7f800000 | (mantissa << 13) : ((exponent + 112) << 23) | (mantissa << 13));
+	float result;
+	memcpy(&result, &bits, sizeof(result));
+	return result;
+}
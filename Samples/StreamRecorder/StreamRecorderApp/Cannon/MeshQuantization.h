@@ -0,0 +1,72 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Quantized vertex formats: decoding of the spatial surface meshes
+// (SpatialSurfaceMesh) into float vertices, and the compact QuantizedVertex
+// format in which Mesh can keep its vertices.
+//
+// Portable (no DirectX / WinRT dependencies) so that it can also be built and
+// checked by desktop tools. The surface mesh decoders run four lanes at a time
+// (SSE2 on x86/x64, NEON on ARM) and give the same bits as the scalar version,
+// which is built instead with MESH_QUANTIZATION_NO_SIMD or on other targets.
+//
+// Decoded vertices are written as four floats (x, y, z, w) at a byte stride,
+// so that they can go straight into the XMVECTOR fields of Mesh::Vertex.
+
+#include <cstddef>
+#include <cstdint>
+
+// DXGI_FORMAT_R16G16B16A16_SNORM positions, scaled by the mesh vertex position scale: x / 32768 * scale, w = 1
+void DecodeSnorm16Positions(const int16_t* source, size_t vertexCount, const float scale[3], void* destination, size_t destinationStride);
+
+// DXGI_FORMAT_R8G8B8A8_SNORM normals: x / 128, w = 0
+void DecodeSnorm8Normals(const int8_t* source, size_t vertexCount, void* destination, size_t destinationStride);
+
+// DXGI_FORMAT_R16_UINT indices to 32 bit
+void WidenIndices(const uint16_t* source, size_t indexCount, uint32_t* destination);
+
+// Compact vertex, 16 bytes instead of the 48 of Mesh::Vertex. The input assembler reads the fields as
+//	position: DXGI_FORMAT_R16G16B16A16_UNORM, in the bounds of the mesh (see PositionDequantization), w = 1
+//	normal: DXGI_FORMAT_R16G16_SNORM, octahedral encoded
+//	texcoord: DXGI_FORMAT_R16G16_FLOAT
+struct QuantizedVertex
+{
+	uint16_t position[4];
+	int16_t normal[2];
+	uint16_t texcoord[2];
+};
+
+// A position is decoded as quantized / 65535 * scale + offset, the offset and scale being the bounds of the mesh
+struct PositionDequantization
+{
+	float scale[3];
+	float offset[3];
+};
+
+// positions, normals and texcoords point to the floats of the first vertex, and the following vertices are stride bytes apart.
+// texcoords can be nullptr. The normals are expected to be unit vectors.
+void QuantizeVertices(const float* positions, const float* normals, const float* texcoords, size_t stride, size_t vertexCount,
+	QuantizedVertex* destination, PositionDequantization& dequantization);
+
+// Writes the positions as x, y, z, 1, the normals as x, y, z, 0 and the texcoords as u, v, at the same stride.
+// Any of the destinations can be nullptr.
+void DequantizeVertices(const QuantizedVertex* source, size_t vertexCount, const PositionDequantization& dequantization,
+	float* positions, float* normals, float* texcoords, size_t stride);
+
+// Octahedral mapping of unit vectors to two SNORM16 values, and back (normalized)
+void EncodeOctahedralNormal(const float normal[3], int16_t encoded[2]);
+void DecodeOctahedralNormal(const int16_t encoded[2], float normal[3]);
+
+// IEEE half floats, rounded to nearest even
+uint16_t FloatToHalf(float value);
+float HalfToFloat(uint16_t value);
@@ -14,6 +14,7 @@
 #include "MixedReality.h"
 #include "Common/Timer.h"
 #include "Common/FileUtilities.h"
+#include "MeshQuantization.h"
 
 #include <windows.graphics.directx.direct3d11.interop.h>
 #include <winrt/Windows.Foundation.h>
@@ -329,7 +330,7 @@ void MixedReality::Update()
 	}
 
 	if(m_surfaceMapping)
-		m_surfaceMapping->Update(m_headPosition);
+		m_surfaceMapping->Update(m_headPosition, m_headForwardDirection);
 }
 
 long long MixedReality::GetPredictedDisplayTime()
@@ -893,9 +894,28 @@ SurfaceMapping::SurfaceMapping(winrt::Windows::Perception::Spatial::SpatialStati
 	m_isActive(false),
 	m_surfaceDrawMode(SurfaceDrawMode::None),
 	m_headPosition(XMVectorZero()),
-	m_numberOfSurfacesInProcessingQueue(0),
-	m_surfaceObservationThread(new std::thread(&SurfaceMapping::SurfaceObservationThreadFunction, this))
+	m_observedVolumeExtents(XMVectorSet(10.0f, 10.0f, 5.0f, 0.0f)),
+	m_rayQueries(m_rayQueryScene),
+	m_stopSurfaceObservation(false)
 {
+	// Surfaces are updated again once the system updated them for more than 5 s (in 100 ns units)
+	SurfaceScheduler::Settings settings;
+	settings.minUpdateInterval = 5 * 10000000;
+
+	m_surfaceUpdateScheduler = make_unique<SurfaceScheduler>([this](const winrt::guid&, const winrt::Windows::Perception::Spatial::Surfaces::SpatialSurfaceInfo& surfaceInfo)
+		{
+			return UpdateSurface(surfaceInfo);
+		}, settings);
+	m_surfaceObservationThread.reset(new std::thread(&SurfaceMapping::SurfaceObservationThreadFunction, this));
+}
+
+SurfaceMapping::~SurfaceMapping()
+{
+	m_stopSurfaceObservation = true;
+	m_surfaceObservationThread->join();
+
+	// Waits for the updates in progress
+	m_surfaceUpdateScheduler = nullptr;
 }
 
 void SurfaceMapping::CreaterObserverIfNeeded()
@@ -910,118 +930,114 @@ void SurfaceMapping::CreaterObserverIfNeeded()
 	}
 }
 
-// Returns the list of observed surfaces that are new or in need of an update.
-// The list is sorted newest to oldest with brand new meshes appearing after the oldest.
-// Code processing this list should work from back to front, so then new meshes get processed first,
-//  followed by meshes that have gone the longest without an update.
+// Lists the observed surfaces for the scheduler, and the mesh records of the surfaces that are not observed anymore
 
-void SurfaceMapping::GetLatestSurfacesToProcess(std::vector<TimestampSurfacePair>& surfacesToProcess)
+void SurfaceMapping::GetObservedSurfaces(std::vector<SurfaceScheduler::ObservedSurface>& observedSurfaces)
 {
-	auto observedSurfaces = m_surfaceObserver.GetObservedSurfaces();
+	auto surfaces = m_surfaceObserver.GetObservedSurfaces();
+	auto coordinateSystem = m_referenceFrame.CoordinateSystem();
 
-	m_meshRecordsMutex.lock();
-
-	for (auto const& observedSurfacePair : observedSurfaces)
+	observedSurfaces.clear();
+	for (auto const& surfacePair : surfaces)
 	{
-		auto surfaceInfo = observedSurfacePair.Value();
+		auto surfaceInfo = surfacePair.Value();
 
-		auto meshRecordIterator = m_meshRecords.find(surfaceInfo.Id());
-		if (meshRecordIterator == m_meshRecords.end())
+		SurfaceScheduler::ObservedSurface observedSurface = { surfaceInfo.Id(), surfaceInfo, surfaceInfo.UpdateTime().time_since_epoch().count(), { FLT_MAX, FLT_MAX, FLT_MAX } };
+		auto bounds = surfaceInfo.TryGetBounds(coordinateSystem);
+		if (bounds)
 		{
-			surfacesToProcess.push_back(pair<long long, winrt::Windows::Perception::Spatial::Surfaces::SpatialSurfaceInfo>(0, surfaceInfo));
-		}
-		else if (surfaceInfo.UpdateTime().time_since_epoch().count() - meshRecordIterator->second.lastSurfaceUpdateTime > 5 * 10000000 || !meshRecordIterator->second.mesh)
-		{
-			surfacesToProcess.push_back(pair<long long, winrt::Windows::Perception::Spatial::Surfaces::SpatialSurfaceInfo>(meshRecordIterator->second.lastMeshUpdateTime, surfaceInfo));
+			observedSurface.center[0] = bounds.Value().Center.x;
+			observedSurface.center[1] = bounds.Value().Center.y;
+			observedSurface.center[2] = bounds.Value().Center.z;
 		}
+		observedSurfaces.push_back(observedSurface);
 	}
 
+	m_meshRecordsMutex.lock();
+
 	for (auto& meshRecordPair : m_meshRecords)
 	{
-		if (!observedSurfaces.HasKey(meshRecordPair.first))
+		if (!surfaces.HasKey(meshRecordPair.first))
 			m_meshRecordIDsToErase.push_back(meshRecordPair.first);
 	}
 
 	m_meshRecordsMutex.unlock();
-
-	sort(surfacesToProcess.begin(), surfacesToProcess.end(), [](const pair<long long, winrt::Windows::Perception::Spatial::Surfaces::SpatialSurfaceInfo>& a, const pair<long long, winrt::Windows::Perception::Spatial::Surfaces::SpatialSurfaceInfo>& b)
-		{
-			return a.first > b.first;
-		});
 }
 
+// Reports the observed surfaces to the scheduler, whose workers compute and convert their meshes
+
 void SurfaceMapping::SurfaceObservationThreadFunction()
 {
-	vector<TimestampSurfacePair> surfacesToProcess;
+	vector<SurfaceScheduler::ObservedSurface> observedSurfaces;
 
-	for (;;)
+	while (!m_stopSurfaceObservation)
 	{
+		Sleep(kSurfaceObservationPeriod);
+
 		CreaterObserverIfNeeded();
 		if (!m_surfaceObserver || !m_referenceFrame)
-		{
-			Sleep(50);
 			continue;
-		}
 
 		m_headPositionMutex.lock();
-		winrt::Windows::Perception::Spatial::SpatialBoundingBox box = { { XMVectorGetX(m_headPosition), XMVectorGetY(m_headPosition), XMVectorGetZ(m_headPosition) }, { 10.f, 10.f, 5.f } };
+		XMFLOAT3 center, extents;
+		XMStoreFloat3(&center, m_headPosition);
+		XMStoreFloat3(&extents, m_observedVolumeExtents);
+		m_headPositionMutex.unlock();
+
+		winrt::Windows::Perception::Spatial::SpatialBoundingBox box = { { center.x, center.y, center.z }, { extents.x, extents.y, extents.z } };
 		winrt::Windows::Perception::Spatial::SpatialBoundingVolume bounds = winrt::Windows::Perception::Spatial::SpatialBoundingVolume::FromBox(m_referenceFrame.CoordinateSystem(), box);
 		m_surfaceObserver.SetBoundingVolume(bounds);
-		m_headPositionMutex.unlock();
 
-		if (surfacesToProcess.empty())
-		{
-			Sleep(50);
-			GetLatestSurfacesToProcess(surfacesToProcess);
-		}
+		GetObservedSurfaces(observedSurfaces);
+		m_surfaceUpdateScheduler->SetObservedSurfaces(observedSurfaces);
+	}
+}
 
-		while (!surfacesToProcess.empty())
-		{
-			Sleep(50);
+// Computes the mesh of a surface and queues its record for the next Update(); called by the workers of the scheduler
 
-			auto surfaceInfo = surfacesToProcess.back().second;
-			surfacesToProcess.pop_back();
+bool SurfaceMapping::UpdateSurface(const winrt::Windows::Perception::Spatial::Surfaces::SpatialSurfaceInfo& surfaceInfo)
+{
+	auto options = winrt::Windows::Perception::Spatial::Surfaces::SpatialSurfaceMeshOptions();
+	options.IncludeVertexNormals(true);
+	auto sourceMesh = surfaceInfo.TryComputeLatestMeshAsync(1000.0, options).get();
+	if (!sourceMesh)
+		return false;
 
-			m_numberOfSurfacesInProcessingQueueMutex.lock();
-			m_numberOfSurfacesInProcessingQueue = (unsigned)surfacesToProcess.size();
-			m_numberOfSurfacesInProcessingQueueMutex.unlock();
+	MeshRecord newMeshRecord;
+	newMeshRecord.id = sourceMesh.SurfaceInfo().Id();
+	newMeshRecord.sourceMesh = sourceMesh;
+	newMeshRecord.lastMeshUpdateTime = Timer::GetSystemRelativeTime();
+	newMeshRecord.lastSurfaceUpdateTime = sourceMesh.SurfaceInfo().UpdateTime().time_since_epoch().count();
+	newMeshRecord.color = XMVectorSet(0.5f, 0.5f, 0.5f, 1.0f);
 
-			auto options = winrt::Windows::Perception::Spatial::Surfaces::SpatialSurfaceMeshOptions();
-			options.IncludeVertexNormals(true);
-			auto sourceMesh = surfaceInfo.TryComputeLatestMeshAsync(1000.0, options).get();
-			if (sourceMesh)
-			{
-				MeshRecord newMeshRecord;
-				newMeshRecord.id = sourceMesh.SurfaceInfo().Id();
-				newMeshRecord.sourceMesh = sourceMesh;
-				newMeshRecord.lastMeshUpdateTime = Timer::GetSystemRelativeTime();
-				newMeshRecord.lastSurfaceUpdateTime = sourceMesh.SurfaceInfo().UpdateTime().time_since_epoch().count();
-				newMeshRecord.color = XMVectorSet(0.5f, 0.5f, 0.5f, 1.0f);
-
-				auto tryTransform = sourceMesh.CoordinateSystem().TryGetTransformTo(m_referenceFrame.CoordinateSystem());
-				if (tryTransform)
-					newMeshRecord.worldTransform = tryTransform.Value();
-
-				newMeshRecord.mesh = make_shared<Mesh>(nullptr, 0);
-				ConvertMesh(newMeshRecord.sourceMesh, newMeshRecord.mesh);
-				newMeshRecord.sourceMesh = nullptr;
-				newMeshRecord.mesh->UpdateBoundingBox();
-
-				if (m_surfaceDrawMode != SurfaceDrawMode::None)
-					newMeshRecord.InitDrawCall();
-
-				m_newMeshRecordsMutex.lock();
-				m_newMeshRecords.push_back(newMeshRecord);
-				m_newMeshRecordsMutex.unlock();
-			}
-		}
-	}
+	auto tryTransform = sourceMesh.CoordinateSystem().TryGetTransformTo(m_referenceFrame.CoordinateSystem());
+	if (tryTransform)
+		newMeshRecord.worldTransform = tryTransform.Value();
+
+	newMeshRecord.mesh = make_shared<Mesh>(nullptr, 0);
+	ConvertMesh(newMeshRecord.sourceMesh, newMeshRecord.mesh);
+	newMeshRecord.sourceMesh = nullptr;
+	newMeshRecord.mesh->Quantize();
+	newMeshRecord.mesh->UpdateBoundingBox(1);	// The scheduler already updates several surfaces at once
+
+	// The draw call is created by DrawMeshes() on the render thread, as the shader store is not thread safe
+
+	m_newMeshRecordsMutex.lock();
+	m_newMeshRecords.push_back(newMeshRecord);
+	m_newMeshRecordsMutex.unlock();
+
+	return true;
 }
 
 unsigned SurfaceMapping::GetNumberOfSurfacesInProcessingQueue()
 {
-	lock_guard<mutex> lock(m_numberOfSurfacesInProcessingQueueMutex);
-	return m_numberOfSurfacesInProcessingQueue;
+	return (unsigned) m_surfaceUpdateScheduler->GetQueuedCount();
+}
+
+void SurfaceMapping::SetObservedVolumeExtents(const XMVECTOR& extents)
+{
+	lock_guard<mutex> lock(m_headPositionMutex);
+	m_observedVolumeExtents = extents;
 }
 
 bool SurfaceMapping::IsActive()
@@ -1039,25 +1055,62 @@ SurfaceDrawMode SurfaceMapping::GetSurfaceDrawMode()
 	return m_surfaceDrawMode;
 }
 
-void SurfaceMapping::Update(const XMVECTOR& headPosition)
+void SurfaceMapping::Update(const XMVECTOR& headPosition, const XMVECTOR& headForwardDirection)
 {
 	m_headPositionMutex.lock();
 	m_headPosition = headPosition;
 	m_headPositionMutex.unlock();
 
+	XMFLOAT3 position, forward;
+	XMStoreFloat3(&position, headPosition);
+	XMStoreFloat3(&forward, XMVector3Normalize(headForwardDirection));
+	m_surfaceUpdateScheduler->SetViewer(&position.x, &forward.x);
+
+	// The scheduler threads keep adding to m_newMeshRecords while the records are updated
+	vector<MeshRecord> newMeshRecords;
+	m_newMeshRecordsMutex.lock();
+	swap(newMeshRecords, m_newMeshRecords);
+	m_newMeshRecordsMutex.unlock();
+
 	m_meshRecordsMutex.lock();
 
 	for (auto& guid : m_meshRecordIDsToErase)
 	{
-		m_meshRecords.erase(guid);
+		auto meshRecordIterator = m_meshRecords.find(guid);
+		if (meshRecordIterator == m_meshRecords.end())
+			continue;
+
+		if (meshRecordIterator->second.rayQueryInstance != SceneBvh::kInvalidInstance)
+			m_rayQueryScene.RemoveInstance(meshRecordIterator->second.rayQueryInstance);
+		m_meshRecords.erase(meshRecordIterator);
 	}
 	m_meshRecordIDsToErase.clear();
 
-	for (auto& meshRecord : m_newMeshRecords)
+	for (auto& meshRecord : newMeshRecords)
 	{
+		auto meshRecordIterator = m_meshRecords.find(meshRecord.id);
+		if (meshRecordIterator != m_meshRecords.end())
+			meshRecord.rayQueryInstance = meshRecordIterator->second.rayQueryInstance;
+
+		auto bvh = meshRecord.mesh->GetBvh();
+		if (bvh && meshRecord.rayQueryInstance == SceneBvh::kInvalidInstance)
+		{
+			meshRecord.rayQueryInstance = m_rayQueryScene.AddInstance(bvh, &meshRecord.worldTransform.m11);
+		}
+		else if (bvh)
+		{
+			m_rayQueryScene.UpdateInstance(meshRecord.rayQueryInstance, bvh, &meshRecord.worldTransform.m11);
+		}
+		else if (meshRecord.rayQueryInstance != SceneBvh::kInvalidInstance)
+		{
+			m_rayQueryScene.RemoveInstance(meshRecord.rayQueryInstance);
+			meshRecord.rayQueryInstance = SceneBvh::kInvalidInstance;
+		}
+
 		m_meshRecords[meshRecord.id] = meshRecord;
 	}
-	m_newMeshRecords.clear();
+
+	m_rayQueryScene.Commit();
 
 	if (!m_meshRecords.empty())
 		m_isActive = true;
@@ -1098,38 +1151,22 @@ void SurfaceMapping::ConvertMesh(winrt::Windows::Perception::Spatial::Surfaces::
 	bufferByteAccess->Buffer((unsigned char**)& pSourceNormalsBuffer);
 
 	auto vertexScaleFactor = sourceMesh.VertexPositionScale();
-	float short_max = pow(2.0f, 15.0f);
-	float char_max = pow(2.0f, 7.0f);
+	const float vertexScale[3] = { vertexScaleFactor.x, vertexScaleFactor.y, vertexScaleFactor.z };
 
 	assert(sourceMesh.VertexPositions().ElementCount() == sourceMesh.VertexNormals().ElementCount());
 
+	// Cleared first so that the texcoords are all zero
 	auto& vertexBuffer = destinationMesh->GetVertices();
+	vertexBuffer.clear();
 	vertexBuffer.resize(sourceMesh.VertexPositions().ElementCount());
 	auto& indexBuffer = destinationMesh->GetIndices();
 	indexBuffer.resize(sourceMesh.TriangleIndices().ElementCount());
 
-	for (unsigned i = 0; i < indexBuffer.size(); ++i)
-	{
-		indexBuffer[i] = pSourceIndexBuffer[i];
-	}
-
-	for (unsigned i = 0; i < vertexBuffer.size(); ++i)
-	{
-		unsigned sourceIndex = i * 4;
-
-		vertexBuffer[i].position = XMVectorSet(pSourcePositionsBuffer[sourceIndex + 0] / short_max * vertexScaleFactor.x,
-			pSourcePositionsBuffer[sourceIndex + 1] / short_max * vertexScaleFactor.y,
-			pSourcePositionsBuffer[sourceIndex + 2] / short_max * vertexScaleFactor.z,
-			1.0f);
-
-		vertexBuffer[i].normal = XMVectorSet(pSourceNormalsBuffer[sourceIndex + 0] / char_max,
-			pSourceNormalsBuffer[sourceIndex + 1] / char_max,
-			pSourceNormalsBuffer[sourceIndex + 2] / char_max,
-			0.0f);
+	WidenIndices(pSourceIndexBuffer, indexBuffer.size(), indexBuffer.data());
 
-		vertexBuffer[i].texcoord.x = 0;
-		vertexBuffer[i].texcoord.y = 0;
-	}
+	unsigned char* pVertices = (unsigned char*) vertexBuffer.data();
+	DecodeSnorm16Positions(pSourcePositionsBuffer, vertexBuffer.size(), vertexScale, pVertices + offsetof(Mesh::Vertex, position), sizeof(Mesh::Vertex));
+	DecodeSnorm8Normals((const int8_t*) pSourceNormalsBuffer, vertexBuffer.size(), pVertices + offsetof(Mesh::Vertex, normal), sizeof(Mesh::Vertex));
 }
 
 void SurfaceMapping::DrawMeshes()
@@ -1158,32 +1195,54 @@ void SurfaceMapping::DrawMeshes()
 
 bool SurfaceMapping::TestRayIntersection(XMVECTOR rayOrigin, XMVECTOR rayDirection, float& distance, XMVECTOR& normal)
 {
-	bool hit = false;
 	distance = FLT_MAX;
 
-	m_meshRecordsMutex.lock();
-	for (auto& meshRecordPair : m_meshRecords)
-	{
-		if (!meshRecordPair.second.mesh)
-			continue;
+	// The snapshot stays valid even if Update() commits a new one meanwhile
+	auto snapshot = m_rayQueryScene.GetSnapshot();
 
-		XMMATRIX worldTransform = XMLoadFloat4x4(&meshRecordPair.second.worldTransform);
+	XMFLOAT3 origin, direction;
+	XMStoreFloat3(&origin, rayOrigin);
+	XMStoreFloat3(&direction, rayDirection);
 
-		float currentDistance;
-		XMVECTOR currentNormal;
+	SceneBvh::Hit hit;
+	if (!snapshot->Intersect(&origin.x, &direction.x, hit))
+		return false;
 
-		bool result = meshRecordPair.second.mesh->TestRayIntersection(rayOrigin, rayDirection, worldTransform, currentDistance, currentNormal);
+	distance = hit.distance;
+	normal = XMVectorSet(hit.normal[0], hit.normal[1], hit.normal[2], 0.0f);
+	return true;
+}
 
-		if (result && currentDistance < distance)
-		{
-			hit = true;
-			distance = currentDistance;
-			normal = currentNormal;
-		}
-	}
-	m_meshRecordsMutex.unlock();
+RayQueryService::Handle SurfaceMapping::SubmitRayQuery(XMVECTOR rayOrigin, XMVECTOR rayDirection, SceneBvh::HitMode mode)
+{
+	XMFLOAT3 origin, direction;
+	XMStoreFloat3(&origin, rayOrigin);
+	XMStoreFloat3(&direction, rayDirection);
+
+	return m_rayQueries.Submit(&origin.x, &direction.x, mode);
+}
+
+void SurfaceMapping::DispatchRayQueries()
+{
+	m_rayQueries.Dispatch();
+}
+
+void SurfaceMapping::ExecuteRayQueries()
+{
+	m_rayQueries.Execute();
+}
 
-	return hit;
+bool SurfaceMapping::GetRayQueryResult(RayQueryService::Handle handle, float& distance, XMVECTOR& normal)
+{
+	distance = FLT_MAX;
+
+	SceneBvh::Hit hit;
+	if (!m_rayQueries.GetResult(handle, hit))
+		return false;
+
+	distance = hit.distance;
+	normal = XMVectorSet(hit.normal[0], hit.normal[1], hit.normal[2], 0.0f);
+	return true;
 }
 
 #ifdef ENABLE_QRCODE_API
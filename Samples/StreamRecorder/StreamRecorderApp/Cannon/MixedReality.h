@@ -29,10 +29,14 @@
 
 #include "Common/Intersectable.h"
 #include "DrawCall.h"
+#include "RayQueryService.h"
+#include "SceneBvh.h"
+#include "SurfaceUpdateScheduler.h"
 
 #include <d3d11.h>
 #include <DirectXMath.h>
 
+#include <atomic>
 #include <memory>
 #include <vector>
 #include <map>
@@ -286,6 +290,7 @@ public:
 
 	// If mesh draw is enabled, this class will automatically create draw calls to go with each mesh for debug viz
 	SurfaceMapping(winrt::Windows::Perception::Spatial::SpatialStationaryFrameOfReference const& referenceFrame);
+	~SurfaceMapping();
 
 	// Returns true once at least one mesh has been processed
 	bool IsActive();
@@ -293,14 +298,25 @@ public:
 	void SetSurfaceDrawMode(SurfaceDrawMode surfaceDrawMode);
 	SurfaceDrawMode GetSurfaceDrawMode();
 
-	void Update(const XMVECTOR& headPosition);
+	// The head pose prioritizes the surface updates: nearest and in view first
+	void Update(const XMVECTOR& headPosition, const XMVECTOR& headForwardDirection);
 
 	unsigned GetNumberOfSurfacesInProcessingQueue();
 
+	// Half size of the observed volume, centered on the head (10 x 10 x 5 m by default)
+	void SetObservedVolumeExtents(const XMVECTOR& extents);
+
 	void DrawMeshes();
 
 	virtual bool TestRayIntersection(XMVECTOR rayOrigin, XMVECTOR rayDirection, float& distance, XMVECTOR& normal);
 
+	// Batched ray tests: rays submitted during a frame are traversed together, either on a worker thread
+	//	(DispatchRayQueries, the results being read the next frame) or right away (ExecuteRayQueries)
+	RayQueryService::Handle SubmitRayQuery(XMVECTOR rayOrigin, XMVECTOR rayDirection, SceneBvh::HitMode mode = SceneBvh::HitMode::Closest);
+	void DispatchRayQueries();
+	void ExecuteRayQueries();
+	bool GetRayQueryResult(RayQueryService::Handle handle, float& distance, XMVECTOR& normal);
+
 private:
 
 	struct MeshRecord
@@ -318,12 +334,15 @@ private:
 
 		std::shared_ptr<DrawCall> drawCall;	// For visualization
 
+		uint32_t rayQueryInstance;			// Instance of the mesh in m_rayQueryScene, kept when the mesh is updated
+
 		MeshRecord()
 		{
 			memset(&id, 0, sizeof(id));
 
 			lastMeshUpdateTime = 0;
 			lastSurfaceUpdateTime = 0;
+			rayQueryInstance = SceneBvh::kInvalidInstance;
 
 			XMStoreFloat4x4(&worldTransform, XMMatrixIdentity());
 			color = XMVectorZero();
@@ -337,6 +356,7 @@ private:
 		}
 	};
 	typedef std::pair<winrt::guid, MeshRecord> MeshRecordPair;
+	typedef SurfaceUpdateScheduler<winrt::guid, winrt::Windows::Perception::Spatial::Surfaces::SpatialSurfaceInfo> SurfaceScheduler;
 
 	winrt::Windows::Perception::Spatial::SpatialStationaryFrameOfReference m_referenceFrame{ nullptr };
 	winrt::Windows::Perception::Spatial::Surfaces::SpatialSurfaceObserver m_surfaceObserver{ nullptr };
@@ -346,24 +366,31 @@ private:
 	SurfaceDrawMode m_surfaceDrawMode;
 
 	XMVECTOR m_headPosition;
+	XMVECTOR m_observedVolumeExtents;	// Also guarded by m_headPositionMutex
 	std::mutex m_headPositionMutex;
 
 	std::map<winrt::guid, MeshRecord> m_meshRecords;
 	std::vector<winrt::guid> m_meshRecordIDsToErase;
 	std::mutex m_meshRecordsMutex;
 
-	unsigned m_numberOfSurfacesInProcessingQueue;
-	std::mutex m_numberOfSurfacesInProcessingQueueMutex;
-
 	std::vector<MeshRecord> m_newMeshRecords;
 	std::mutex m_newMeshRecordsMutex;
 
+	// Two level BVH of the meshes, updated by Update() along with m_meshRecords.
+	//	Ray tests run on its latest snapshot, without locking m_meshRecordsMutex.
+	SceneBvh m_rayQueryScene;
+	RayQueryService m_rayQueries;
+
+	std::atomic<bool> m_stopSurfaceObservation;
+	std::unique_ptr<SurfaceScheduler> m_surfaceUpdateScheduler;
 	std::unique_ptr<std::thread> m_surfaceObservationThread;
 
-	typedef std::pair<long long, winrt::Windows::Perception::Spatial::Surfaces::SpatialSurfaceInfo> TimestampSurfacePair;
+	static constexpr unsigned kSurfaceObservationPeriod = 200;	// In milliseconds
+
 	void CreaterObserverIfNeeded();
-	void GetLatestSurfacesToProcess(std::vector<TimestampSurfacePair>& surfacesToProcess);
+	void GetObservedSurfaces(std::vector<SurfaceScheduler::ObservedSurface>& observedSurfaces);
 	void SurfaceObservationThreadFunction();
+	bool UpdateSurface(const winrt::Windows::Perception::Spatial::Surfaces::SpatialSurfaceInfo& surfaceInfo);
 	void ConvertMesh(winrt::Windows::Perception::Spatial::Surfaces::SpatialSurfaceMesh sourceMesh, std::shared_ptr<Mesh> destinationMesh);
 };
 
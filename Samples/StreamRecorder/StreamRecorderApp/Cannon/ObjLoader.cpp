@@ -0,0 +1,458 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "ObjLoader.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+namespace
+{
+	// Bump when the layout of ObjVertex or of the MeshBvh nodes and packets changes
+	const char kMeshCacheMagic[4] = { 'C', 'M', 'S', 'H' };
+	const uint32_t kMeshCacheVersion = 1;
+
+	struct MeshCacheHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t sourceSize;
+		uint64_t sourceLastWriteTime;
+		uint64_t vertexCount;
+		uint64_t indexCount;
+	};
+
+	inline bool IsSpace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f' || c == '\0';
+	}
+
+	inline bool IsDigit(char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+
+	inline const char* SkipSpaces(const char* p, const char* end)
+	{
+		while (p < end && IsSpace(*p))
+			++p;
+		return p;
+	}
+
+	inline const char* FindTokenEnd(const char* p, const char* end)
+	{
+		while (p < end && !IsSpace(*p))
+			++p;
+		return p;
+	}
+
+	// Same result as strtof: the common decimal numbers are converted exactly through a double (a single rounded
+	// multiplication or division), and the rest, which includes the double roundings to a float halfway point, by strtof.
+	bool ConvertFloat(const char* begin, const char* end, float& value)
+	{
+		static const double kPowersOfTen[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+		const char* p = begin;
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negative = *p++ == '-';
+
+		uint64_t mantissa = 0;
+		int significantDigits = 0;
+		int exponent = 0;
+		bool anyDigit = false;
+		for (; p < end && IsDigit(*p); ++p)
+		{
+			anyDigit = true;
+			if (mantissa != 0 || *p != '0')
+				++significantDigits;
+			mantissa = mantissa * 10 + (*p - '0');
+		}
+		if (p < end && *p == '.')
+		{
+			for (++p; p < end && IsDigit(*p); ++p)
+			{
+				anyDigit = true;
+				if (mantissa != 0 || *p != '0')
+					++significantDigits;
+				mantissa = mantissa * 10 + (*p - '0');
+				--exponent;
+			}
+		}
+		if (anyDigit && p < end && (*p == 'e' || *p == 'E'))
+		{
+			++p;
+			bool negativeExponent = false;
+			if (p < end && (*p == '-' || *p == '+'))
+				negativeExponent = *p++ == '-';
+
+			int explicitExponent = 0;
+			bool anyExponentDigit = false;
+			for (; p < end && IsDigit(*p); ++p)
+			{
+				anyExponentDigit = true;
+				if (explicitExponent < 10000)
+					explicitExponent = explicitExponent * 10 + (*p - '0');
+			}
+			if (!anyExponentDigit)
+				anyDigit = false;
+			exponent += negativeExponent ? -explicitExponent : explicitExponent;
+		}
+
+		if (anyDigit && p == end && significantDigits <= 19)
+		{
+			if (mantissa == 0)
+			{
+				value = negative ? -0.0f : 0.0f;
+				return true;
+			}
+
+			if (mantissa <= (1ull << 53) && exponent >= -22 && exponent <= 22)
+			{
+				double result = exponent < 0 ? (double) mantissa / kPowersOfTen[-exponent] : (double) mantissa * kPowersOfTen[exponent];
+
+				// The 29 bits that a float drops are exactly half of its last bit: the conversion could round the wrong way
+				uint64_t bits;
+				memcpy(&bits, &result, sizeof(bits));
+				if (result >= FLT_MIN && result <= FLT_MAX && (bits & 0x1fffffff) != 0x10000000)
+				{
+					value = negative ? -(float) result : (float) result;
+					return true;
+				}
+			}
+		}
+
+		char buffer[128];
+		size_t length = min((size_t) (end - begin), sizeof(buffer) - 1);
+		memcpy(buffer, begin, length);
+		buffer[length] = '\0';
+
+		char* parseEnd = nullptr;
+		value = strtof(buffer, &parseEnd);
+		return parseEnd != buffer;
+	}
+
+	// Reads up to count floats, the missing ones are 0
+	const char* ParseFloats(const char* p, const char* end, float* values, unsigned count)
+	{
+		bool valid = true;
+		for (unsigned i = 0; i < count; ++i)
+		{
+			p = SkipSpaces(p, end);
+			const char* tokenEnd = FindTokenEnd(p, end);
+			valid = valid && p < tokenEnd && ConvertFloat(p, tokenEnd, values[i]);
+			if (!valid)
+				values[i] = 0.0f;
+			p = tokenEnd;
+		}
+		return p;
+	}
+
+	// An index of a face corner: 1 based, negative ones count back from the last element, and 0 when it is left out
+	bool ResolveIndex(const char* begin, const char* end, size_t elementCount, uint32_t& index)
+	{
+		index = 0;
+		if (begin == end)
+			return true;
+
+		bool negative = *begin == '-';
+		if (negative)
+			++begin;
+
+		uint64_t value = 0;
+		for (const char* p = begin; p < end; ++p)
+		{
+			if (!IsDigit(*p) || value > elementCount)
+				return false;
+			value = value * 10 + (*p - '0');
+		}
+
+		if (value == 0 || value > elementCount)
+			return false;
+
+		index = (uint32_t) (negative ? elementCount - value + 1 : value);
+		return true;
+	}
+
+	// Open addressing hash map from the position/texcoord/normal triples of the face corners to the vertices
+	class CornerVertexMap
+	{
+	public:
+
+		CornerVertexMap()
+		{
+			m_slots.resize(1024, { 0, 0, 0, kEmpty });
+			m_shift = 64 - 10;
+		}
+
+		// Returns the vertex of the triple, or newVertex when it is added
+		uint32_t FindOrAdd(uint32_t position, uint32_t texcoord, uint32_t normal, uint32_t newVertex)
+		{
+			if ((m_count + 1) * 2 > m_slots.size())
+				Grow();
+
+			size_t mask = m_slots.size() - 1;
+			for (size_t i = GetSlot(position, texcoord, normal);; i = (i + 1) & mask)
+			{
+				Slot& slot = m_slots[i];
+				if (slot.vertex == kEmpty)
+				{
+					slot = { position, texcoord, normal, newVertex };
+					++m_count;
+					return newVertex;
+				}
+				if (slot.position == position && slot.texcoord == texcoord && slot.normal == normal)
+					return slot.vertex;
+			}
+		}
+
+	private:
+
+		static constexpr uint32_t kEmpty = 0xffffffff;
+
+		struct Slot
+		{
+			uint32_t position;
+			uint32_t texcoord;
+			uint32_t normal;
+			uint32_t vertex;
+		};
+
+		// The triple is packed in 64 bits (21 bits each, which is exact below two million elements), and the
+		// Fibonacci hash of the packed value gives the slot
+		size_t GetSlot(uint32_t position, uint32_t texcoord, uint32_t normal) const
+		{
+			uint64_t packed = ((uint64_t) position << 42) ^ ((uint64_t) texcoord << 21) ^ (uint64_t) normal;
+			return (size_t) ((packed * 0x9e3779b97f4a7c15ull) >> m_shift);
+		}
+
+		void Grow()
+		{
+			vector<Slot> slots(m_slots.size() * 2, { 0, 0, 0, kEmpty });
+			slots.swap(m_slots);
+			--m_shift;
+
+			size_t mask = m_slots.size() - 1;
+			for (const Slot& slot : slots)
+			{
+				if (slot.vertex == kEmpty)
+					continue;
+
+				size_t i = GetSlot(slot.position, slot.texcoord, slot.normal);
+				while (m_slots[i].vertex != kEmpty)
+					i = (i + 1) & mask;
+				m_slots[i] = slot;
+			}
+		}
+
+		vector<Slot> m_slots;
+		size_t m_count = 0;
+		unsigned m_shift;
+	};
+}
+
+bool ParseObj(const char* text, size_t size, vector<ObjVertex>& vertices, vector<uint32_t>& indices)
+{
+	vertices.clear();
+	indices.clear();
+
+	vector<float> positions;
+	vector<float> texcoords;
+	vector<float> normals;
+	CornerVertexMap cornerVertices;
+	vector<uint32_t> faceVertices;
+
+	const char* end = text + size;
+	for (const char* line = text; line < end;)
+	{
+		const char* lineEnd = static_cast<const char*>(memchr(line, '\n', end - line));
+		if (!lineEnd)
+			lineEnd = end;
+
+		const char* p = SkipSpaces(line, lineEnd);
+		const char* keywordEnd = FindTokenEnd(p, lineEnd);
+		size_t keywordLength = keywordEnd - p;
+
+		if (*line == '#' || keywordLength == 0 || keywordLength > 2)
+		{
+		}
+		else if (keywordLength == 1 && p[0] == 'v')
+		{
+			float position[3];
+			ParseFloats(keywordEnd, lineEnd, position, 3);
+			positions.insert(positions.end(), position, position + 3);
+		}
+		else if (keywordLength == 2 && p[0] == 'v' && p[1] == 'n')
+		{
+			float normal[3];
+			ParseFloats(keywordEnd, lineEnd, normal, 3);
+			normals.insert(normals.end(), normal, normal + 3);
+		}
+		else if (keywordLength == 2 && p[0] == 'v' && p[1] == 't')
+		{
+			float texcoord[2];
+			ParseFloats(keywordEnd, lineEnd, texcoord, 2);
+			texcoord[1] = 1 - texcoord[1];	// Invert v because DX likes texcoords top-down
+			texcoords.insert(texcoords.end(), texcoord, texcoord + 2);
+		}
+		else if (keywordLength == 1 && p[0] == 'f')
+		{
+			faceVertices.clear();
+			for (p = SkipSpaces(keywordEnd, lineEnd); p < lineEnd; p = SkipSpaces(p, lineEnd))
+			{
+				// position/texcoord/normal, where the last two can be left out
+				const char* cornerEnd = FindTokenEnd(p, lineEnd);
+				const char* texcoordBegin = static_cast<const char*>(memchr(p, '/', cornerEnd - p));
+				texcoordBegin = texcoordBegin ? texcoordBegin + 1 : cornerEnd;
+				const char* normalBegin = texcoordBegin < cornerEnd ? static_cast<const char*>(memchr(texcoordBegin, '/', cornerEnd - texcoordBegin)) : nullptr;
+				normalBegin = normalBegin ? normalBegin + 1 : cornerEnd;
+
+				uint32_t position, texcoord, normal;
+				if (!ResolveIndex(p, texcoordBegin == cornerEnd ? cornerEnd : texcoordBegin - 1, positions.size() / 3, position) ||
+					!ResolveIndex(texcoordBegin, normalBegin == cornerEnd ? cornerEnd : normalBegin - 1, texcoords.size() / 2, texcoord) ||
+					!ResolveIndex(normalBegin, cornerEnd, normals.size() / 3, normal))
+				{
+					return false;
+				}
+
+				uint32_t vertexIndex = cornerVertices.FindOrAdd(position, texcoord, normal, (uint32_t) vertices.size());
+				if (vertexIndex == vertices.size())
+				{
+					ObjVertex vertex = {};
+					if (position != 0)
+					{
+						memcpy(vertex.position, &positions[3 * (position - 1)], 3 * sizeof(float));
+						vertex.position[3] = 1.0f;
+					}
+					if (texcoord != 0)
+						memcpy(vertex.texcoord, &texcoords[2 * (texcoord - 1)], 2 * sizeof(float));
+					if (normal != 0)
+						memcpy(vertex.normal, &normals[3 * (normal - 1)], 3 * sizeof(float));
+					vertices.push_back(vertex);
+				}
+				faceVertices.push_back(vertexIndex);
+
+				p = cornerEnd;
+			}
+
+			// Fan, with the winding order inverted to account for DX default (clockwise)
+			for (size_t i = 1; i + 1 < faceVertices.size(); ++i)
+			{
+				indices.push_back(faceVertices[i + 1]);
+				indices.push_back(faceVertices[i]);
+				indices.push_back(faceVertices[0]);
+			}
+		}
+
+		line = lineEnd + 1;
+	}
+
+	return true;
+}
+
+bool ReadMeshCache(const unsigned char* data, size_t size, uint64_t sourceSize, uint64_t sourceLastWriteTime,
+	vector<ObjVertex>& vertices, vector<uint32_t>& indices, MeshBvh& bvh)
+{
+	vertices.clear();
+	indices.clear();
+	bvh.Clear();
+
+	MeshCacheHeader header;
+	if (!data || size < sizeof(header))
+		return false;
+	memcpy(&header, data, sizeof(header));
+
+	if (memcmp(header.magic, kMeshCacheMagic, sizeof(kMeshCacheMagic)) != 0 || header.version != kMeshCacheVersion ||
+		header.sourceSize != sourceSize || header.sourceLastWriteTime != sourceLastWriteTime)
+	{
+		return false;
+	}
+
+	const unsigned char* pReadPtr = data + sizeof(header);
+	const unsigned char* pEnd = data + size;
+	if (header.vertexCount > (size_t) (pEnd - pReadPtr) / sizeof(ObjVertex))
+		return false;
+	vertices.resize((size_t) header.vertexCount);
+	if (!vertices.empty())
+		memcpy(vertices.data(), pReadPtr, vertices.size() * sizeof(ObjVertex));
+	pReadPtr += vertices.size() * sizeof(ObjVertex);
+
+	if (header.indexCount > (size_t) (pEnd - pReadPtr) / sizeof(uint32_t))
+	{
+		vertices.clear();
+		return false;
+	}
+	indices.resize((size_t) header.indexCount);
+	if (!indices.empty())
+		memcpy(indices.data(), pReadPtr, indices.size() * sizeof(uint32_t));
+	pReadPtr += indices.size() * sizeof(uint32_t);
+
+	bool valid = bvh.ReadFromBuffer(&pReadPtr, pEnd) && pReadPtr == pEnd && bvh.GetTriangleCount() == indices.size() / 3;
+	for (size_t i = 0; valid && i < indices.size(); ++i)
+		valid = indices[i] < vertices.size();
+
+	if (!valid)
+	{
+		vertices.clear();
+		indices.clear();
+		bvh.Clear();
+		return false;
+	}
+
+	return true;
+}
+
+bool WriteMeshCache(const string& filename, uint64_t sourceSize, uint64_t sourceLastWriteTime,
+	const vector<ObjVertex>& vertices, const vector<uint32_t>& indices, const MeshBvh& bvh)
+{
+	MeshCacheHeader header;
+	memcpy(header.magic, kMeshCacheMagic, sizeof(kMeshCacheMagic));
+	header.version = kMeshCacheVersion;
+	header.sourceSize = sourceSize;
+	header.sourceLastWriteTime = sourceLastWriteTime;
+	header.vertexCount = vertices.size();
+	header.indexCount = indices.size();
+
+	vector<unsigned char> buffer(sizeof(header) + vertices.size() * sizeof(ObjVertex) + indices.size() * sizeof(uint32_t) + bvh.GetSerializedSize());
+	unsigned char* pWritePtr = buffer.data();
+	memcpy(pWritePtr, &header, sizeof(header));
+	pWritePtr += sizeof(header);
+	if (!vertices.empty())
+		memcpy(pWritePtr, vertices.data(), vertices.size() * sizeof(ObjVertex));
+	pWritePtr += vertices.size() * sizeof(ObjVertex);
+	if (!indices.empty())
+		memcpy(pWritePtr, indices.data(), indices.size() * sizeof(uint32_t));
+	pWritePtr += indices.size() * sizeof(uint32_t);
+	bvh.WriteToBuffer(&pWritePtr);
+
+	FILE* pFile = nullptr;
+#ifdef _WIN32
+	fopen_s(&pFile, filename.c_str(), "wb");
+#else
+	pFile = fopen(filename.c_str(), "wb");
+#endif
+	if (!pFile)
+		return false;
+
+	bool written = fwrite(buffer.data(), 1, buffer.size(), pFile) == buffer.size();
+	written = fclose(pFile) == 0 && written;
+
+	// A truncated cache would be rejected on reading, but there is no need to keep it
+	if (!written)
+		remove(filename.c_str());
+	return written;
+}
@@ -0,0 +1,53 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Wavefront OBJ parsing, and the binary cache that Mesh writes next to the OBJ
+// files so that the next loads skip the parsing and the BVH build.
+//
+// Portable (no DirectX / WinRT dependencies) so that it can also be built and
+// checked by desktop tools.
+
+#include "MeshBvh.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The fields of Mesh::Vertex
+struct ObjVertex
+{
+	float position[4];		// w = 1
+	float normal[4];		// w = 0
+	float texcoord[2];
+};
+
+// Parses the v, vt, vn and f lines of an OBJ file, the other lines are ignored.
+//	One vertex is made per distinct position/texcoord/normal triple, in the order in which the faces first use them.
+//	Polygons are split in triangle fans, whose winding is reversed to the clockwise D3D default.
+//	The texcoords are flipped vertically (v = 1 - v) because D3D textures are top-down.
+// Returns false, with partial results, if a face refers to an element that does not exist.
+bool ParseObj(const char* text, size_t size, std::vector<ObjVertex>& vertices, std::vector<uint32_t>& indices);
+
+// The cache is only read back if it was written by the same version of the code, for a source file of the same size
+// and last write time. Writing returns false if the file cannot be created, which is not an error for the caller.
+bool ReadMeshCache(const unsigned char* data, size_t size, uint64_t sourceSize, uint64_t sourceLastWriteTime,
+	std::vector<ObjVertex>& vertices, std::vector<uint32_t>& indices, MeshBvh& bvh);
+bool WriteMeshCache(const std::string& filename, uint64_t sourceSize, uint64_t sourceLastWriteTime,
+	const std::vector<ObjVertex>& vertices, const std::vector<uint32_t>& indices, const MeshBvh& bvh);
+
+// Name of the cache of an OBJ file
+inline std::string GetMeshCacheFilename(const std::string& sourceFilename)
+{
+	return sourceFilename + ".meshcache";
+}
@@ -0,0 +1,122 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "RayQueryService.h"
+
+#include <algorithm>
+
+using namespace std;
+
+RayQueryService::RayQueryService(const SceneBvh& scene) :
+	m_scene(scene)
+{
+	m_pendingBatch.serialNumber = 1;
+	m_workerThread = make_unique<thread>(&RayQueryService::WorkerThreadFunction, this);
+}
+
+RayQueryService::~RayQueryService()
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_exiting = true;
+	}
+	m_workCondition.notify_one();
+	m_workerThread->join();
+}
+
+RayQueryService::Handle RayQueryService::Submit(const float rayOrigin[3], const float rayDirection[3], SceneBvh::HitMode mode, float maxDistance)
+{
+	SceneBvh::Ray ray;
+	copy(rayOrigin, rayOrigin + 3, ray.origin);
+	copy(rayDirection, rayDirection + 3, ray.direction);
+	ray.maxDistance = maxDistance;
+	ray.mode = mode;
+
+	Handle handle = ((Handle) m_pendingBatch.serialNumber << 32) | m_pendingBatch.rays.size();
+	m_pendingBatch.rays.push_back(ray);
+	return handle;
+}
+
+void RayQueryService::Dispatch()
+{
+	Wait();
+
+	// The batch keeps the snapshot alive while the worker thread traverses it
+	uint32_t serialNumber = m_pendingBatch.serialNumber;
+	m_pendingBatch.snapshot = m_scene.GetSnapshot();
+	swap(m_currentBatch, m_pendingBatch);
+	m_pendingBatch.serialNumber = serialNumber + 1;
+	m_pendingBatch.rays.clear();
+	m_pendingBatch.snapshot = nullptr;
+
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_working = true;
+	}
+	m_workCondition.notify_one();
+}
+
+void RayQueryService::Execute()
+{
+	Wait();
+
+	uint32_t serialNumber = m_pendingBatch.serialNumber;
+	swap(m_currentBatch, m_pendingBatch);
+	m_pendingBatch.serialNumber = serialNumber + 1;
+	m_pendingBatch.rays.clear();
+
+	m_currentBatch.hits.resize(m_currentBatch.rays.size());
+	m_scene.GetSnapshot()->IntersectBatch(m_currentBatch.rays.data(), m_currentBatch.rays.size(), m_currentBatch.hits.data());
+}
+
+bool RayQueryService::GetResult(Handle handle, SceneBvh::Hit& hit)
+{
+	if (handle == kInvalidHandle || (uint32_t) (handle >> 32) != m_currentBatch.serialNumber)
+		return false;
+
+	Wait();
+
+	const SceneBvh::Hit& result = m_currentBatch.hits[(uint32_t) handle];
+	if (result.instance == SceneBvh::kInvalidInstance)
+		return false;
+
+	hit = result;
+	return true;
+}
+
+void RayQueryService::Wait()
+{
+	unique_lock<mutex> lock(m_mutex);
+	m_doneCondition.wait(lock, [this] { return !m_working; });
+}
+
+void RayQueryService::WorkerThreadFunction()
+{
+	for (;;)
+	{
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_workCondition.wait(lock, [this] { return m_working || m_exiting; });
+			if (m_exiting)
+				return;
+		}
+
+		m_currentBatch.hits.resize(m_currentBatch.rays.size());
+		m_currentBatch.snapshot->IntersectBatch(m_currentBatch.rays.data(), m_currentBatch.rays.size(), m_currentBatch.hits.data());
+		m_currentBatch.snapshot = nullptr;
+
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_working = false;
+		}
+		m_doneCondition.notify_one();
+	}
+}
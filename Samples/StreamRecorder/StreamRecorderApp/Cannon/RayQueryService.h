@@ -0,0 +1,87 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Collects the rays of a frame into a batch, and traverses them together
+// against the latest snapshot of a SceneBvh, either on a worker thread
+// (Dispatch, the results being read the next frame) or on the calling thread
+// (Execute). The results of a batch are read by the handles that Submit
+// returned, until the next batch is dispatched or executed.
+//
+// Submit, Dispatch, Execute and GetResult are called from one thread.
+//
+// Portable (no DirectX / WinRT dependencies), like SceneBvh.
+
+#include "SceneBvh.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class RayQueryService
+{
+public:
+
+	// Batch serial number in the upper 32 bits, ray index in the lower ones
+	typedef uint64_t Handle;
+	static constexpr Handle kInvalidHandle = 0xffffffffffffffff;
+
+	RayQueryService(const SceneBvh& scene);
+	~RayQueryService();
+
+	RayQueryService(const RayQueryService&) = delete;
+	RayQueryService& operator=(const RayQueryService&) = delete;
+
+	// Adds a ray to the next batch
+	Handle Submit(const float rayOrigin[3], const float rayDirection[3], SceneBvh::HitMode mode = SceneBvh::HitMode::Closest,
+		float maxDistance = std::numeric_limits<float>::max());
+
+	// Starts traversing the submitted rays on the worker thread, after waiting for the previous batch
+	void Dispatch();
+
+	// Traverses the submitted rays now, on the calling thread
+	void Execute();
+
+	// Result of a ray of the last dispatched or executed batch, waiting for the worker thread if needed.
+	// Returns false if the ray hit nothing, or if the handle is not from that batch.
+	bool GetResult(Handle handle, SceneBvh::Hit& hit);
+
+private:
+
+	struct Batch
+	{
+		uint32_t serialNumber = 0;
+		std::vector<SceneBvh::Ray> rays;
+		std::vector<SceneBvh::Hit> hits;
+		std::shared_ptr<const SceneBvh::Snapshot> snapshot;
+	};
+
+	void Wait();
+	void WorkerThreadFunction();
+
+	const SceneBvh& m_scene;
+
+	Batch m_pendingBatch;		// Being submitted
+	Batch m_currentBatch;		// Dispatched or executed; owned by the worker thread while m_working
+
+	bool m_working = false;
+	bool m_exiting = false;
+	std::mutex m_mutex;
+	std::condition_variable m_workCondition;
+	std::condition_variable m_doneCondition;
+
+	std::unique_ptr<std::thread> m_workerThread;
+};
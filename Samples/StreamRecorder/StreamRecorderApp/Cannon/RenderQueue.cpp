@@ -0,0 +1,158 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "RenderQueue.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+using namespace std;
+
+void RenderQueue::Submit(const Submission& submission)
+{
+	assert(submission.constantsSize == 0 || submission.constants);
+	assert(submission.instanceCount == 0 || submission.instances);
+
+	Record record;
+	record.stateKey = submission.stateKey;
+	record.shaderKey = submission.shaderKey;
+	record.meshKey = submission.meshKey;
+	record.ordered = submission.ordered;
+	record.constantsOffset = m_constantData.size();
+	record.constantsSize = submission.constantsSize;
+	record.instancesOffset = m_submittedInstanceData.size();
+	record.instanceCount = submission.instanceCount;
+	record.instanceStride = submission.instanceStride;
+	record.userData = submission.userData;
+
+	const unsigned char* constants = static_cast<const unsigned char*>(submission.constants);
+	m_constantData.insert(m_constantData.end(), constants, constants + submission.constantsSize);
+
+	const unsigned char* instances = static_cast<const unsigned char*>(submission.instances);
+	m_submittedInstanceData.insert(m_submittedInstanceData.end(), instances, instances + submission.instanceCount * submission.instanceStride);
+
+	m_submissions.push_back(record);
+}
+
+void RenderQueue::Build()
+{
+	m_order.resize(m_submissions.size());
+	m_batches.clear();
+	m_instanceData.clear();
+	m_statistics = {};
+	m_statistics.submissionCount = m_submissions.size();
+
+	// The unordered submissions are sorted up to the next ordered one
+	size_t runBegin = 0;
+	for (size_t i = 0; i <= m_submissions.size(); ++i)
+	{
+		if (i < m_submissions.size())
+		{
+			m_order[i] = (uint32_t) i;
+			if (!m_submissions[i].ordered)
+				continue;
+		}
+
+		stable_sort(m_order.begin() + runBegin, m_order.begin() + i, [this](uint32_t a, uint32_t b) { return IsLess(a, b); });
+		runBegin = i + 1;
+	}
+
+	m_instanceData.reserve(m_submittedInstanceData.size());
+	const Record* batchRecord = nullptr;
+	for (uint32_t index : m_order)
+	{
+		const Record& record = m_submissions[index];
+
+		if (!batchRecord || !CanMerge(*batchRecord, record))
+		{
+			Batch batch;
+			batch.stateKey = record.stateKey;
+			batch.shaderKey = record.shaderKey;
+			batch.meshKey = record.meshKey;
+			batch.constants = record.constantsSize > 0 ? m_constantData.data() + record.constantsOffset : nullptr;
+			batch.userData = record.userData;
+			batch.instanceOffset = m_instanceData.size();
+			batch.instanceCount = 0;
+			batch.instanceStride = record.instanceStride;
+
+			batch.changes = kAllChanged;
+			if (batchRecord)
+			{
+				batch.changes = 0;
+				if (record.stateKey != batchRecord->stateKey)
+					batch.changes |= kStateChanged;
+				if (record.shaderKey != batchRecord->shaderKey)
+					batch.changes |= kShaderChanged;
+				if (record.meshKey != batchRecord->meshKey)
+					batch.changes |= kMeshChanged;
+				if (!HaveSameConstants(record, *batchRecord))
+					batch.changes |= kConstantsChanged;
+			}
+
+			m_statistics.stateChangeCount += (batch.changes & kStateChanged) ? 1 : 0;
+			m_statistics.shaderChangeCount += (batch.changes & kShaderChanged) ? 1 : 0;
+			m_statistics.meshChangeCount += (batch.changes & kMeshChanged) ? 1 : 0;
+			m_statistics.constantsChangeCount += (batch.changes & kConstantsChanged) ? 1 : 0;
+
+			m_batches.push_back(batch);
+			batchRecord = &record;
+		}
+
+		const unsigned char* instances = m_submittedInstanceData.data() + record.instancesOffset;
+		m_instanceData.insert(m_instanceData.end(), instances, instances + record.instanceCount * record.instanceStride);
+		m_batches.back().instanceCount += record.instanceCount;
+	}
+
+	m_statistics.batchCount = m_batches.size();
+}
+
+void RenderQueue::Clear()
+{
+	m_submissions.clear();
+	m_constantData.clear();
+	m_submittedInstanceData.clear();
+	m_order.clear();
+	m_batches.clear();
+	m_instanceData.clear();
+	m_statistics = {};
+}
+
+bool RenderQueue::IsLess(uint32_t a, uint32_t b) const
+{
+	const Record& recordA = m_submissions[a];
+	const Record& recordB = m_submissions[b];
+
+	if (recordA.stateKey != recordB.stateKey)
+		return recordA.stateKey < recordB.stateKey;
+	if (recordA.shaderKey != recordB.shaderKey)
+		return recordA.shaderKey < recordB.shaderKey;
+	if (recordA.meshKey != recordB.meshKey)
+		return recordA.meshKey < recordB.meshKey;
+	if (recordA.instanceStride != recordB.instanceStride)
+		return recordA.instanceStride < recordB.instanceStride;
+	if (recordA.constantsSize != recordB.constantsSize)
+		return recordA.constantsSize < recordB.constantsSize;
+
+	return memcmp(m_constantData.data() + recordA.constantsOffset, m_constantData.data() + recordB.constantsOffset, recordA.constantsSize) < 0;
+}
+
+bool RenderQueue::CanMerge(const Record& a, const Record& b) const
+{
+	return a.stateKey == b.stateKey && a.shaderKey == b.shaderKey && a.meshKey == b.meshKey && a.ordered == b.ordered &&
+		a.instanceStride == b.instanceStride && HaveSameConstants(a, b);
+}
+
+bool RenderQueue::HaveSameConstants(const Record& a, const Record& b) const
+{
+	return a.constantsSize == b.constantsSize &&
+		memcmp(m_constantData.data() + a.constantsOffset, m_constantData.data() + b.constantsOffset, a.constantsSize) == 0;
+}
@@ -0,0 +1,137 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Sorting and merging of the draws submitted during a render pass, which
+// DrawCall::Submit and DrawCall::FlushRenderQueue use to draw them with fewer
+// state changes and draw calls.
+//
+// Each submission has a render state, shader and mesh key, per draw constants
+// and instance data. Build() sorts the submissions by state, shader, mesh and
+// constants, merges the submissions that only differ by their instances into
+// instanced batches, and tells for each batch what changed since the previous
+// one. The instance data of the batches is laid out contiguously, in batch
+// order, so that it can be uploaded at once.
+//
+// Ordered submissions (blended, or drawn without depth test) are never moved:
+// they are drawn in submission order, and the other submissions are only sorted
+// among those submitted between two ordered ones. Consecutive ordered
+// submissions are still merged when they can be.
+//
+// Portable (no DirectX / WinRT dependencies) so that it can also be built and
+// checked by desktop tools.
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class RenderQueue
+{
+public:
+
+	struct Submission
+	{
+		uint64_t stateKey;			// Render states, the most expensive to change
+		uint64_t shaderKey;			// Shaders and input layout
+		uint64_t meshKey;			// Vertex and index buffers
+		bool ordered;
+
+		const void* constants;		// Per draw constants, submissions are only merged when these are the same
+		size_t constantsSize;
+
+		const void* instances;
+		size_t instanceCount;
+		size_t instanceStride;		// Only submissions with the same stride are merged
+
+		size_t userData;			// Returned with the batches
+	};
+
+	// What differs between a batch and the previous one
+	enum Changes : uint32_t
+	{
+		kStateChanged = 1,
+		kShaderChanged = 2,
+		kMeshChanged = 4,
+		kConstantsChanged = 8,
+		kAllChanged = kStateChanged | kShaderChanged | kMeshChanged | kConstantsChanged
+	};
+
+	struct Batch
+	{
+		uint64_t stateKey;
+		uint64_t shaderKey;
+		uint64_t meshKey;
+		const void* constants;		// Valid until the next Submit or Clear
+		size_t userData;			// Of the first submission of the batch
+
+		size_t instanceOffset;		// In bytes, in GetInstanceData()
+		size_t instanceCount;
+		size_t instanceStride;
+
+		uint32_t changes;			// kAllChanged for the first batch
+	};
+
+	struct Statistics
+	{
+		size_t submissionCount;
+		size_t batchCount;
+		size_t stateChangeCount;	// Counting the first batch of each kind
+		size_t shaderChangeCount;
+		size_t meshChangeCount;
+		size_t constantsChangeCount;
+	};
+
+	// The constants and instances are copied, the caller can change them once this returns
+	void Submit(const Submission& submission);
+
+	// Sorts and merges the submissions made since the last Clear
+	void Build();
+
+	const std::vector<Batch>& GetBatches() const { return m_batches; }
+	const std::vector<unsigned char>& GetInstanceData() const { return m_instanceData; }
+	const Statistics& GetStatistics() const { return m_statistics; }
+
+	size_t GetSubmissionCount() const { return m_submissions.size(); }
+	bool IsEmpty() const { return m_submissions.empty(); }
+
+	// Keeps the memory for the next submissions
+	void Clear();
+
+private:
+
+	struct Record
+	{
+		uint64_t stateKey;
+		uint64_t shaderKey;
+		uint64_t meshKey;
+		bool ordered;
+		size_t constantsOffset;
+		size_t constantsSize;
+		size_t instancesOffset;
+		size_t instanceCount;
+		size_t instanceStride;
+		size_t userData;
+	};
+
+	bool IsLess(uint32_t a, uint32_t b) const;
+	bool CanMerge(const Record& a, const Record& b) const;
+	bool HaveSameConstants(const Record& a, const Record& b) const;
+
+	std::vector<Record> m_submissions;
+	std::vector<unsigned char> m_constantData;
+	std::vector<unsigned char> m_submittedInstanceData;
+
+	std::vector<uint32_t> m_order;
+	std::vector<Batch> m_batches;
+	std::vector<unsigned char> m_instanceData;
+	Statistics m_statistics = {};
+};
@@ -0,0 +1,555 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "SceneBvh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+
+using namespace std;
+
+namespace
+{
+	const unsigned kBinCount = 16;
+	const size_t kLocalStackSize = 64;
+
+	inline bool IsEmpty(const float boundsMin[3], const float boundsMax[3])
+	{
+		return boundsMin[0] > boundsMax[0];
+	}
+
+	inline float HalfArea(const float boundsMin[3], const float boundsMax[3])
+	{
+		if (IsEmpty(boundsMin, boundsMax))
+			return 0.0f;
+
+		float dx = boundsMax[0] - boundsMin[0];
+		float dy = boundsMax[1] - boundsMin[1];
+		float dz = boundsMax[2] - boundsMin[2];
+		return dx * dy + dy * dz + dz * dx;
+	}
+
+	inline void ResetBounds(float boundsMin[3], float boundsMax[3])
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			boundsMin[axis] = FLT_MAX;
+			boundsMax[axis] = -FLT_MAX;
+		}
+	}
+
+	inline void GrowBounds(float boundsMin[3], float boundsMax[3], const float otherMin[3], const float otherMax[3])
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			boundsMin[axis] = min(boundsMin[axis], otherMin[axis]);
+			boundsMax[axis] = max(boundsMax[axis], otherMax[axis]);
+		}
+	}
+
+	// Entry distance of a ray in a box, if it enters it before maxDistance
+	inline bool IntersectBounds(const float boundsMin[3], const float boundsMax[3], const float rayOrigin[3], const float inverseDirection[3], float maxDistance, float& entryDistance)
+	{
+		if (IsEmpty(boundsMin, boundsMax))
+			return false;
+
+		float entry = 0.0f;
+		float exit = maxDistance;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			float nearDistance = (boundsMin[axis] - rayOrigin[axis]) * inverseDirection[axis];
+			float farDistance = (boundsMax[axis] - rayOrigin[axis]) * inverseDirection[axis];
+			if (nearDistance > farDistance)
+				swap(nearDistance, farDistance);
+			entry = max(entry, nearDistance);
+			exit = min(exit, farDistance);
+		}
+
+		entryDistance = entry;
+		return entry <= exit;
+	}
+
+	// Tiny components are clamped so that the slab tests never compute 0 * inf
+	inline void GetInverseDirection(const float rayDirection[3], float inverseDirection[3])
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			float component = rayDirection[axis];
+			if (fabsf(component) < 1e-20f)
+				component = copysignf(1e-20f, component);
+			inverseDirection[axis] = 1.0f / component;
+		}
+	}
+
+	struct StackEntry
+	{
+		uint32_t node;
+		float distance;
+	};
+}
+
+SceneBvh::SceneBvh()
+	: m_snapshot(make_shared<Snapshot>())
+{
+}
+
+uint32_t SceneBvh::AddInstance(shared_ptr<const MeshBvh> mesh, const float localToWorld[16])
+{
+	assert(mesh);
+
+	uint32_t instance;
+	if (!m_freeInstances.empty())
+	{
+		instance = m_freeInstances.back();
+		m_freeInstances.pop_back();
+	}
+	else
+	{
+		instance = (uint32_t) m_scene.m_instances.size();
+		m_scene.m_instances.emplace_back();
+		m_leafNodes.push_back(kInvalidInstance);
+	}
+
+	m_scene.m_instanceCount++;
+	SetInstance(instance, mesh, localToWorld);
+	return instance;
+}
+
+void SceneBvh::UpdateInstance(uint32_t instance, shared_ptr<const MeshBvh> mesh, const float localToWorld[16])
+{
+	assert(instance < m_scene.m_instances.size() && m_scene.m_instances[instance].mesh && mesh);
+	SetInstance(instance, mesh, localToWorld);
+}
+
+void SceneBvh::RemoveInstance(uint32_t instance)
+{
+	assert(instance < m_scene.m_instances.size() && m_scene.m_instances[instance].mesh);
+
+	Snapshot::Instance& record = m_scene.m_instances[instance];
+	record.mesh = nullptr;
+	ResetBounds(record.boundsMin, record.boundsMax);
+
+	m_scene.m_instanceCount--;
+	m_freeInstances.push_back(instance);
+	m_changedInstances.push_back(instance);
+}
+
+void SceneBvh::SetInstance(uint32_t instance, shared_ptr<const MeshBvh> mesh, const float localToWorld[16])
+{
+	Snapshot::Instance& record = m_scene.m_instances[instance];
+	record.mesh = mesh;
+	ResetBounds(record.boundsMin, record.boundsMax);
+
+	// Column vector form: world = rotation * local + translation
+	double rotation[3][3], translation[3];
+	for (int row = 0; row < 3; ++row)
+	{
+		for (int column = 0; column < 3; ++column)
+			rotation[row][column] = localToWorld[column * 4 + row];
+		translation[row] = localToWorld[12 + row];
+	}
+
+	double cofactors[3][3];
+	for (int row = 0; row < 3; ++row)
+	{
+		for (int column = 0; column < 3; ++column)
+		{
+			int r0 = (row + 1) % 3, r1 = (row + 2) % 3;
+			int c0 = (column + 1) % 3, c1 = (column + 2) % 3;
+			cofactors[row][column] = rotation[r0][c0] * rotation[r1][c1] - rotation[r0][c1] * rotation[r1][c0];
+		}
+	}
+	double determinant = rotation[0][0] * cofactors[0][0] + rotation[0][1] * cofactors[0][1] + rotation[0][2] * cofactors[0][2];
+	record.mirrored = determinant < 0.0;
+
+	for (int row = 0; row < 3; ++row)
+	{
+		double offset = 0.0;
+		for (int column = 0; column < 3; ++column)
+		{
+			double inverse = determinant != 0.0 ? cofactors[column][row] / determinant : 0.0;
+			record.worldToLocal[row][column] = (float) inverse;
+			offset -= inverse * translation[column];
+		}
+		record.worldToLocal[row][3] = (float) offset;
+	}
+
+	// World space bounds of the transformed local bounds
+	const float* localMin = mesh->GetBoundsMin();
+	const float* localMax = mesh->GetBoundsMax();
+	if (!IsEmpty(localMin, localMax) && determinant != 0.0)
+	{
+		for (int row = 0; row < 3; ++row)
+		{
+			double low = translation[row], high = translation[row];
+			for (int column = 0; column < 3; ++column)
+			{
+				double a = rotation[row][column] * localMin[column];
+				double b = rotation[row][column] * localMax[column];
+				low += min(a, b);
+				high += max(a, b);
+			}
+			record.boundsMin[row] = (float) low;
+			record.boundsMax[row] = (float) high;
+		}
+	}
+
+	if (m_leafNodes[instance] == kInvalidInstance)
+		m_needsRebuild = true;
+	m_changedInstances.push_back(instance);
+}
+
+void SceneBvh::Commit()
+{
+	if (!m_needsRebuild && m_changedInstances.empty())
+		return;
+
+	// Removed instances keep their (empty) leaf until the next rebuild
+	size_t removedLeafCount = 0;
+	for (uint32_t instance : m_freeInstances)
+	{
+		if (m_leafNodes[instance] != kInvalidInstance)
+			removedLeafCount++;
+	}
+
+	if (m_needsRebuild || removedLeafCount > m_scene.m_instanceCount)
+	{
+		Rebuild();
+	}
+	else
+	{
+		Refit();
+		if (GetInnerNodeArea() > kMaxRefitAreaGrowth * m_rebuiltInnerNodeArea)
+			Rebuild();
+		else
+			m_refitCount++;
+	}
+
+	m_changedInstances.clear();
+	m_needsRebuild = false;
+
+	shared_ptr<const Snapshot> snapshot = make_shared<Snapshot>(m_scene);
+	atomic_store(&m_snapshot, snapshot);
+}
+
+shared_ptr<const SceneBvh::Snapshot> SceneBvh::GetSnapshot() const
+{
+	return atomic_load(&m_snapshot);
+}
+
+void SceneBvh::Rebuild()
+{
+	vector<uint32_t> instances;
+	instances.reserve(m_scene.m_instanceCount);
+	for (uint32_t instance = 0; instance < m_scene.m_instances.size(); ++instance)
+	{
+		m_leafNodes[instance] = kInvalidInstance;
+
+		// Instances without triangles get a leaf at the next rebuild after they have some
+		const Snapshot::Instance& record = m_scene.m_instances[instance];
+		if (record.mesh && !IsEmpty(record.boundsMin, record.boundsMax))
+			instances.push_back(instance);
+	}
+
+	m_scene.m_nodes.clear();
+	m_scene.m_depth = 0;
+	if (!instances.empty())
+	{
+		m_scene.m_nodes.reserve(2 * instances.size() - 1);
+		BuildNode(instances, 0, instances.size(), kInvalidInstance, 1);
+	}
+
+	m_rebuiltInnerNodeArea = GetInnerNodeArea();
+	m_rebuildCount++;
+}
+
+uint32_t SceneBvh::BuildNode(vector<uint32_t>& instances, size_t begin, size_t end, uint32_t parent, size_t depth)
+{
+	auto& nodes = m_scene.m_nodes;
+	const auto& records = m_scene.m_instances;
+
+	uint32_t nodeIndex = (uint32_t) nodes.size();
+	nodes.emplace_back();
+	nodes[nodeIndex].parent = parent;
+	m_scene.m_depth = max(m_scene.m_depth, depth);
+
+	if (end - begin == 1)
+	{
+		Snapshot::Node& leaf = nodes[nodeIndex];
+		leaf.instance = instances[begin];
+		leaf.secondChild = kInvalidInstance;
+		copy(records[leaf.instance].boundsMin, records[leaf.instance].boundsMin + 3, leaf.boundsMin);
+		copy(records[leaf.instance].boundsMax, records[leaf.instance].boundsMax + 3, leaf.boundsMax);
+		m_leafNodes[leaf.instance] = nodeIndex;
+		return nodeIndex;
+	}
+
+	auto getCentroid = [&](uint32_t instance, int axis)
+	{
+		return (records[instance].boundsMin[axis] + records[instance].boundsMax[axis]) * 0.5f;
+	};
+
+	float centroidMin[3], centroidMax[3];
+	ResetBounds(centroidMin, centroidMax);
+	for (size_t i = begin; i < end; ++i)
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			centroidMin[axis] = min(centroidMin[axis], getCentroid(instances[i], axis));
+			centroidMax[axis] = max(centroidMax[axis], getCentroid(instances[i], axis));
+		}
+	}
+
+	// Binned SAH split of the instance bounds
+	float bestCost = FLT_MAX;
+	int bestAxis = -1;
+	unsigned bestBin = 0;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float extent = centroidMax[axis] - centroidMin[axis];
+		if (!(extent > 0.0f))
+			continue;
+
+		float binScale = kBinCount / extent;
+		size_t binCounts[kBinCount] = {};
+		float binMin[kBinCount][3], binMax[kBinCount][3];
+		for (unsigned bin = 0; bin < kBinCount; ++bin)
+			ResetBounds(binMin[bin], binMax[bin]);
+
+		for (size_t i = begin; i < end; ++i)
+		{
+			unsigned bin = min(kBinCount - 1, (unsigned) ((getCentroid(instances[i], axis) - centroidMin[axis]) * binScale));
+			binCounts[bin]++;
+			GrowBounds(binMin[bin], binMax[bin], records[instances[i]].boundsMin, records[instances[i]].boundsMax);
+		}
+
+		for (unsigned split = 1; split < kBinCount; ++split)
+		{
+			size_t leftCount = 0, rightCount = 0;
+			float leftMin[3], leftMax[3], rightMin[3], rightMax[3];
+			ResetBounds(leftMin, leftMax);
+			ResetBounds(rightMin, rightMax);
+			for (unsigned bin = 0; bin < kBinCount; ++bin)
+			{
+				if (bin < split)
+				{
+					leftCount += binCounts[bin];
+					GrowBounds(leftMin, leftMax, binMin[bin], binMax[bin]);
+				}
+				else
+				{
+					rightCount += binCounts[bin];
+					GrowBounds(rightMin, rightMax, binMin[bin], binMax[bin]);
+				}
+			}
+
+			if (leftCount == 0 || rightCount == 0)
+				continue;
+
+			float cost = leftCount * HalfArea(leftMin, leftMax) + rightCount * HalfArea(rightMin, rightMax);
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = split;
+			}
+		}
+	}
+
+	size_t middle;
+	if (bestAxis >= 0)
+	{
+		float binScale = kBinCount / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+		auto splitPoint = partition(instances.begin() + begin, instances.begin() + end, [&](uint32_t instance)
+			{
+				return min(kBinCount - 1, (unsigned) ((getCentroid(instance, bestAxis) - centroidMin[bestAxis]) * binScale)) < bestBin;
+			});
+		middle = splitPoint - instances.begin();
+	}
+	else
+	{
+		// All the centroids are at the same point, any split is as good
+		middle = begin + (end - begin) / 2;
+	}
+	assert(middle > begin && middle < end);
+
+	BuildNode(instances, begin, middle, nodeIndex, depth + 1);
+	uint32_t secondChild = BuildNode(instances, middle, end, nodeIndex, depth + 1);
+
+	// BuildNode grows the node array, so the node is only referenced after it
+	Snapshot::Node& node = nodes[nodeIndex];
+	node.instance = kInvalidInstance;
+	node.secondChild = secondChild;
+	ResetBounds(node.boundsMin, node.boundsMax);
+	GrowBounds(node.boundsMin, node.boundsMax, nodes[nodeIndex + 1].boundsMin, nodes[nodeIndex + 1].boundsMax);
+	GrowBounds(node.boundsMin, node.boundsMax, nodes[secondChild].boundsMin, nodes[secondChild].boundsMax);
+	return nodeIndex;
+}
+
+void SceneBvh::Refit()
+{
+	auto& nodes = m_scene.m_nodes;
+	for (uint32_t instance : m_changedInstances)
+	{
+		uint32_t nodeIndex = m_leafNodes[instance];
+		assert(nodeIndex != kInvalidInstance);
+
+		const Snapshot::Instance& record = m_scene.m_instances[instance];
+		copy(record.boundsMin, record.boundsMin + 3, nodes[nodeIndex].boundsMin);
+		copy(record.boundsMax, record.boundsMax + 3, nodes[nodeIndex].boundsMax);
+
+		for (nodeIndex = nodes[nodeIndex].parent; nodeIndex != kInvalidInstance; nodeIndex = nodes[nodeIndex].parent)
+		{
+			Snapshot::Node& node = nodes[nodeIndex];
+			ResetBounds(node.boundsMin, node.boundsMax);
+			GrowBounds(node.boundsMin, node.boundsMax, nodes[nodeIndex + 1].boundsMin, nodes[nodeIndex + 1].boundsMax);
+			GrowBounds(node.boundsMin, node.boundsMax, nodes[node.secondChild].boundsMin, nodes[node.secondChild].boundsMax);
+		}
+	}
+}
+
+float SceneBvh::GetInnerNodeArea() const
+{
+	float area = 0.0f;
+	for (auto& node : m_scene.m_nodes)
+	{
+		if (node.instance == kInvalidInstance)
+			area += HalfArea(node.boundsMin, node.boundsMax);
+	}
+	return area;
+}
+
+bool SceneBvh::Snapshot::IntersectInstance(uint32_t instance, const float rayOrigin[3], const float rayDirection[3], HitMode mode, float maxDistance, MeshBvh::Hit& meshHit) const
+{
+	const Instance& record = m_instances[instance];
+	if (!record.mesh)
+		return false;
+
+	// The local direction is not renormalized, so local distances are world space distances
+	float localOrigin[3], localDirection[3];
+	for (int row = 0; row < 3; ++row)
+	{
+		const float* transform = record.worldToLocal[row];
+		localOrigin[row] = transform[0] * rayOrigin[0] + transform[1] * rayOrigin[1] + transform[2] * rayOrigin[2] + transform[3];
+		localDirection[row] = transform[0] * rayDirection[0] + transform[1] * rayDirection[1] + transform[2] * rayDirection[2];
+	}
+
+	return record.mesh->Intersect(localOrigin, localDirection, meshHit, mode == HitMode::Any ? MeshBvh::HitMode::Any : MeshBvh::HitMode::Closest,
+		record.mirrored ? MeshBvh::Culling::FrontFaces : MeshBvh::Culling::BackFaces, maxDistance);
+}
+
+void SceneBvh::Snapshot::SetHit(uint32_t instance, const MeshBvh::Hit& meshHit, Hit& hit) const
+{
+	// Normals transform with the inverse transpose, and mirroring flips the front faces
+	const Instance& record = m_instances[instance];
+	float normal[3];
+	for (int column = 0; column < 3; ++column)
+	{
+		normal[column] = record.worldToLocal[0][column] * meshHit.normal[0] +
+			record.worldToLocal[1][column] * meshHit.normal[1] +
+			record.worldToLocal[2][column] * meshHit.normal[2];
+	}
+	float length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+	float scale = length > 0.0f ? (record.mirrored ? -1.0f : 1.0f) / length : 0.0f;
+
+	hit.distance = meshHit.distance;
+	hit.instance = instance;
+	hit.triangleIndex = meshHit.triangleIndex;
+	for (int axis = 0; axis < 3; ++axis)
+		hit.normal[axis] = normal[axis] * scale;
+}
+
+bool SceneBvh::Snapshot::Intersect(const float rayOrigin[3], const float rayDirection[3], Hit& hit, HitMode mode, float maxDistance) const
+{
+	if (m_nodes.empty())
+		return false;
+
+	float inverseDirection[3];
+	GetInverseDirection(rayDirection, inverseDirection);
+
+	StackEntry localStack[kLocalStackSize];
+	vector<StackEntry> largeStack;
+	StackEntry* stack = localStack;
+	if (m_depth + 1 > kLocalStackSize)
+	{
+		largeStack.resize(m_depth + 1);
+		stack = largeStack.data();
+	}
+
+	float closestDistance = maxDistance;
+	uint32_t hitInstance = kInvalidInstance;
+	MeshBvh::Hit meshHit = {};
+
+	size_t stackSize = 0;
+	stack[stackSize++] = { 0, 0.0f };
+
+	while (stackSize > 0)
+	{
+		StackEntry entry = stack[--stackSize];
+		if (entry.distance > closestDistance)
+			continue;
+
+		const Node& node = m_nodes[entry.node];
+		if (node.instance != kInvalidInstance)
+		{
+			MeshBvh::Hit currentHit;
+			if (IntersectInstance(node.instance, rayOrigin, rayDirection, mode, closestDistance, currentHit))
+			{
+				closestDistance = currentHit.distance;
+				hitInstance = node.instance;
+				meshHit = currentHit;
+				if (mode == HitMode::Any)
+					break;
+			}
+			continue;
+		}
+
+		// Visit the closest child first
+		uint32_t children[2] = { entry.node + 1, node.secondChild };
+		float distances[2];
+		bool hits[2];
+		for (int i = 0; i < 2; ++i)
+			hits[i] = IntersectBounds(m_nodes[children[i]].boundsMin, m_nodes[children[i]].boundsMax, rayOrigin, inverseDirection, closestDistance, distances[i]);
+
+		int first = (hits[0] && hits[1] && distances[1] < distances[0]) ? 1 : 0;
+		for (int i = 1; i >= 0; --i)
+		{
+			int child = i == 0 ? first : 1 - first;
+			if (hits[child])
+			{
+				assert(stackSize < max(m_depth + 1, kLocalStackSize));
+				stack[stackSize++] = { children[child], distances[child] };
+			}
+		}
+	}
+
+	if (hitInstance == kInvalidInstance)
+		return false;
+
+	SetHit(hitInstance, meshHit, hit);
+	return true;
+}
+
+void SceneBvh::Snapshot::IntersectBatch(const Ray* rays, size_t rayCount, Hit* hits) const
+{
+	for (size_t ray = 0; ray < rayCount; ++ray)
+	{
+		if (!Intersect(rays[ray].origin, rays[ray].direction, hits[ray], rays[ray].mode, rays[ray].maxDistance))
+		{
+			hits[ray] = {};
+			hits[ray].distance = rays[ray].maxDistance;
+			hits[ray].instance = kInvalidInstance;
+		}
+	}
+}
@@ -0,0 +1,148 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Two level acceleration structure for ray queries against many meshes, such
+// as the surfaces of SurfaceMapping: a top level BVH over the world space
+// bounds of mesh instances, each instance being a MeshBvh and a transform.
+//
+// Instances are added, updated and removed on one thread (the writer), and
+// Commit() publishes an immutable Snapshot of the scene. Readers query the
+// latest snapshot from any thread without taking a lock, and keep it valid
+// for as long as they hold it.
+//
+// Commit() refits the bounds of the top level BVH when instances were only
+// updated or removed, and rebuilds it (binned SAH, one instance per leaf)
+// when instances were added or when refitting made it too loose.
+//
+// Portable (no DirectX / WinRT dependencies), like MeshBvh.
+
+#include "MeshBvh.h"
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+class SceneBvh
+{
+public:
+
+	static constexpr uint32_t kInvalidInstance = 0xffffffff;
+
+	enum class HitMode
+	{
+		Closest,		// Closest hit along the ray
+		Any				// First hit found by the traversal, for occlusion tests
+	};
+
+	struct Ray
+	{
+		float origin[3];
+		float direction[3];
+		float maxDistance;
+		HitMode mode;
+	};
+
+	struct Hit
+	{
+		float distance;				// In units of the world space ray direction
+		uint32_t instance;			// As returned by AddInstance, kInvalidInstance for the rays of a batch that hit nothing
+		uint32_t triangleIndex;
+		float normal[3];			// World space unit front face normal
+	};
+
+	class Snapshot
+	{
+	public:
+		// Hit at a distance in [0, maxDistance]; backfacing triangles are culled
+		bool Intersect(const float rayOrigin[3], const float rayDirection[3], Hit& hit, HitMode mode = HitMode::Closest,
+			float maxDistance = std::numeric_limits<float>::max()) const;
+
+		// Same as Intersect for each ray, with the result of rays[i] in hits[i], all against this snapshot
+		void IntersectBatch(const Ray* rays, size_t rayCount, Hit* hits) const;
+
+		size_t GetInstanceCount() const { return m_instanceCount; }
+
+	private:
+		friend class SceneBvh;
+
+		struct Instance
+		{
+			std::shared_ptr<const MeshBvh> mesh;	// nullptr for free slots
+			float worldToLocal[3][4];				// local = worldToLocal * (world, 1)
+			bool mirrored;							// Negative determinant: the winding of the triangles is flipped in world space
+			float boundsMin[3];						// World space
+			float boundsMax[3];
+		};
+
+		// Depth first layout: an inner node is followed by its first child.
+		// Leaves have an instance, inner nodes have secondChild. Nodes of removed instances have inverted bounds.
+		struct Node
+		{
+			float boundsMin[3];
+			float boundsMax[3];
+			uint32_t parent;
+			uint32_t secondChild;
+			uint32_t instance;
+		};
+
+		bool IntersectInstance(uint32_t instance, const float rayOrigin[3], const float rayDirection[3], HitMode mode, float maxDistance, MeshBvh::Hit& meshHit) const;
+		void SetHit(uint32_t instance, const MeshBvh::Hit& meshHit, Hit& hit) const;
+
+		std::vector<Node> m_nodes;
+		std::vector<Instance> m_instances;		// Indexed by instance
+		size_t m_instanceCount = 0;
+		size_t m_depth = 0;
+	};
+
+	SceneBvh();
+
+	// localToWorld is a 4x4 matrix with row vectors, as DirectX::XMFLOAT4X4: world = (local, 1) * localToWorld.
+	// Returns the instance to pass to UpdateInstance and RemoveInstance; instances of removed meshes are reused.
+	uint32_t AddInstance(std::shared_ptr<const MeshBvh> mesh, const float localToWorld[16]);
+	void UpdateInstance(uint32_t instance, std::shared_ptr<const MeshBvh> mesh, const float localToWorld[16]);
+	void RemoveInstance(uint32_t instance);
+
+	// Applies the changes made since the last commit to the top level BVH and publishes a new snapshot
+	void Commit();
+
+	// The snapshot of the last commit, never nullptr
+	std::shared_ptr<const Snapshot> GetSnapshot() const;
+
+	// Statistics of the commits, for tuning
+	size_t GetRebuildCount() const { return m_rebuildCount; }
+	size_t GetRefitCount() const { return m_refitCount; }
+
+private:
+
+	// Refitting stops when the total area of the inner nodes grew by this factor since the last rebuild
+	static constexpr float kMaxRefitAreaGrowth = 1.5f;
+
+	void SetInstance(uint32_t instance, std::shared_ptr<const MeshBvh> mesh, const float localToWorld[16]);
+	void Rebuild();
+	uint32_t BuildNode(std::vector<uint32_t>& instances, size_t begin, size_t end, uint32_t parent, size_t depth);
+	void Refit();
+	float GetInnerNodeArea() const;
+
+	// Working copy, only accessed by the writer
+	Snapshot m_scene;
+	std::vector<uint32_t> m_leafNodes;			// Leaf of each instance in m_scene.m_nodes, kInvalidInstance if added since the last rebuild
+	std::vector<uint32_t> m_freeInstances;
+	std::vector<uint32_t> m_changedInstances;
+	bool m_needsRebuild = false;
+	float m_rebuiltInnerNodeArea = 0.0f;
+	size_t m_rebuildCount = 0;
+	size_t m_refitCount = 0;
+
+	std::shared_ptr<const Snapshot> m_snapshot;	// Only accessed with std::atomic_load/atomic_store
+};
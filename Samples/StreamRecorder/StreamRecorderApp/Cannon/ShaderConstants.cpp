@@ -0,0 +1,279 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "ShaderConstants.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+
+using namespace std;
+
+namespace
+{
+	atomic<uint64_t> g_lastFrameConstantsVersion(0);
+
+	// result = a * b, which must not be a or b
+	void MultiplyMatrices(const float a[16], const float b[16], float result[16])
+	{
+		for (int row = 0; row < 4; ++row)
+		{
+			for (int column = 0; column < 4; ++column)
+			{
+				result[row * 4 + column] = a[row * 4] * b[column] + a[row * 4 + 1] * b[4 + column] +
+					a[row * 4 + 2] * b[8 + column] + a[row * 4 + 3] * b[12 + column];
+			}
+		}
+	}
+
+	void TransposeMatrix(const float matrix[16], float result[16])
+	{
+		for (int row = 0; row < 4; ++row)
+		{
+			for (int column = 0; column < 4; ++column)
+				result[column * 4 + row] = matrix[row * 4 + column];
+		}
+	}
+
+	// Through the cofactors. Singular matrices give infinities, as XMMatrixInverse.
+	void InvertMatrix(const float matrix[16], float result[16])
+	{
+		const float* m = matrix;
+		float s0 = m[0] * m[5] - m[1] * m[4];
+		float s1 = m[0] * m[6] - m[2] * m[4];
+		float s2 = m[0] * m[7] - m[3] * m[4];
+		float s3 = m[1] * m[6] - m[2] * m[5];
+		float s4 = m[1] * m[7] - m[3] * m[5];
+		float s5 = m[2] * m[7] - m[3] * m[6];
+		float c5 = m[10] * m[15] - m[11] * m[14];
+		float c4 = m[9] * m[15] - m[11] * m[13];
+		float c3 = m[9] * m[14] - m[10] * m[13];
+		float c2 = m[8] * m[15] - m[11] * m[12];
+		float c1 = m[8] * m[14] - m[10] * m[12];
+		float c0 = m[8] * m[13] - m[9] * m[12];
+
+		float inverseDeterminant = 1.0f / (s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0);
+
+		float adjugate[16] =
+		{
+			(m[5] * c5 - m[6] * c4 + m[7] * c3),
+			(-m[1] * c5 + m[2] * c4 - m[3] * c3),
+			(m[13] * s5 - m[14] * s4 + m[15] * s3),
+			(-m[9] * s5 + m[10] * s4 - m[11] * s3),
+			(-m[4] * c5 + m[6] * c2 - m[7] * c1),
+			(m[0] * c5 - m[2] * c2 + m[3] * c1),
+			(-m[12] * s5 + m[14] * s2 - m[15] * s1),
+			(m[8] * s5 - m[10] * s2 + m[11] * s1),
+			(m[4] * c4 - m[5] * c2 + m[7] * c0),
+			(-m[0] * c4 + m[1] * c2 - m[3] * c0),
+			(m[12] * s4 - m[13] * s2 + m[15] * s0),
+			(-m[8] * s4 + m[9] * s2 - m[11] * s0),
+			(-m[4] * c3 + m[5] * c1 - m[6] * c0),
+			(m[0] * c3 - m[1] * c1 + m[2] * c0),
+			(-m[12] * s3 + m[13] * s1 - m[14] * s0),
+			(m[8] * s3 - m[9] * s1 + m[10] * s0),
+		};
+
+		for (int i = 0; i < 16; ++i)
+			result[i] = adjugate[i] * inverseDeterminant;
+	}
+
+	// The size of each constant is that of the reflection, which is at most that of its value
+	inline bool WriteValue(unsigned char* destination, const void* value, size_t size)
+	{
+		if (memcmp(destination, value, size) == 0)
+			return false;
+
+		memcpy(destination, value, size);
+		return true;
+	}
+}
+
+bool FrameConstants::Update(const Inputs& inputs)
+{
+	if (m_version != 0 && memcmp(&inputs, &m_inputs, sizeof(Inputs)) == 0)
+		return false;
+
+	m_inputs = inputs;
+
+	float inverse[16], product[16];
+	for (unsigned eye = 0; eye < 2; ++eye)
+	{
+		MultiplyMatrices(inputs.view[eye], inputs.projection[eye], m_values.viewProjection[eye]);
+		TransposeMatrix(inputs.view[eye], m_values.transposedView[eye]);
+		InvertMatrix(inputs.view[eye], inverse);
+		TransposeMatrix(inverse, m_values.transposedInverseView[eye]);
+		TransposeMatrix(m_values.viewProjection[eye], m_values.transposedViewProjection[eye]);
+	}
+
+	TransposeMatrix(inputs.lightViewProjection, m_values.transposedLightViewProjection);
+
+	InvertMatrix(inputs.cameraView, inverse);
+	MultiplyMatrices(inverse, inputs.lightViewProjection, product);
+	TransposeMatrix(product, m_values.transposedInverseCameraViewLightViewProjection);
+
+	for (int column = 0; column < 4; ++column)
+	{
+		m_values.lightPositionInCameraView[column] = inputs.lightPosition[0] * inputs.cameraView[column] + inputs.lightPosition[1] * inputs.cameraView[4 + column] +
+			inputs.lightPosition[2] * inputs.cameraView[8 + column] + inputs.lightPosition[3] * inputs.cameraView[12 + column];
+	}
+
+	m_version = ++g_lastFrameConstantsVersion;
+	return true;
+}
+
+bool DrawConstants::Update(const Inputs& inputs, const FrameConstants& frameConstants)
+{
+	assert(frameConstants.GetVersion() != 0);
+
+	if (m_frameVersion == frameConstants.GetVersion() && memcmp(&inputs, &m_inputs, sizeof(Inputs)) == 0)
+		return false;
+
+	// The scale and offset are used as is
+	bool worldChanged = m_frameVersion == 0 || memcmp(inputs.world, m_inputs.world, sizeof(inputs.world)) != 0;
+	m_inputs = inputs;
+
+	if (worldChanged)
+		TransposeMatrix(inputs.world, m_values.transposedWorld);
+
+	if (worldChanged || m_frameVersion != frameConstants.GetVersion())
+	{
+		float product[16];
+		for (unsigned eye = 0; eye < 2; ++eye)
+		{
+			MultiplyMatrices(inputs.world, frameConstants.GetValues().viewProjection[eye], product);
+			TransposeMatrix(product, m_values.transposedWorldViewProjection[eye]);
+		}
+	}
+
+	m_frameVersion = frameConstants.GetVersion();
+	return true;
+}
+
+bool WriteShaderConstants(const Constant* constants, size_t constantCount, const FrameConstants& frameConstants,
+	const DrawConstants& drawConstants, unsigned eye, unsigned char* staging)
+{
+	assert(eye < 2);
+
+	const FrameConstants::Inputs& frameInputs = frameConstants.GetInputs();
+	const FrameConstants::Values& frameValues = frameConstants.GetValues();
+	const DrawConstants::Inputs& drawInputs = drawConstants.GetInputs();
+	const DrawConstants::Values& drawValues = drawConstants.GetValues();
+
+	bool changed = false;
+	for (size_t i = 0; i < constantCount; ++i)
+	{
+		const Constant& constant = constants[i];
+		unsigned char* destination = staging + constant.startOffset;
+
+		// Per eye matrices are float4x4 or float4x4[2]
+		const float (*eyeMatrices)[16] = nullptr;
+		const void* value = nullptr;
+		size_t valueSize = 0;
+
+		switch (constant.id)
+		{
+		case CONST_WORLD_MATRIX:
+			value = drawValues.transposedWorld;
+			valueSize = sizeof(drawValues.transposedWorld);
+			break;
+		case CONST_WORLDVIEWPROJ_MATRIX:
+			eyeMatrices = drawValues.transposedWorldViewProjection;
+			break;
+		case CONST_VIEWPROJ_MATRIX:
+			eyeMatrices = frameValues.transposedViewProjection;
+			break;
+		case CONST_VIEW_MATRIX:
+			eyeMatrices = frameValues.transposedView;
+			break;
+		case CONST_INVVIEW_MATRIX:
+			eyeMatrices = frameValues.transposedInverseView;
+			break;
+		case CONST_LIGHTVIEWPROJ_MATRIX:
+			value = frameValues.transposedLightViewProjection;
+			valueSize = sizeof(frameValues.transposedLightViewProjection);
+			break;
+		case CONST_LIGHTPOSV:
+			value = frameValues.lightPositionInCameraView;
+			valueSize = sizeof(frameValues.lightPositionInCameraView);
+			break;
+		case CONST_INVVIEWLIGHTVIEWPROJ_MATRIX:
+			value = frameValues.transposedInverseCameraViewLightViewProjection;
+			valueSize = sizeof(frameValues.transposedInverseCameraViewLightViewProjection);
+			break;
+		case CONST_LIGHT_AMBIENT:
+			value = frameInputs.ambient;
+			valueSize = sizeof(frameInputs.ambient);
+			break;
+		case CONST_NEARPLANEHEIGHT:
+			value = &frameInputs.nearPlaneHeight;
+			valueSize = sizeof(float);
+			break;
+		case CONST_NEARPLANEWIDTH:
+			value = &frameInputs.nearPlaneWidth;
+			valueSize = sizeof(float);
+			break;
+		case CONST_NEARPLANEDIST:
+			value = &frameInputs.nearPlaneDistance;
+			valueSize = sizeof(float);
+			break;
+		case CONST_FARPLANEDIST:
+			value = &frameInputs.farPlaneDistance;
+			valueSize = sizeof(float);
+			break;
+		case CONST_PROJECTIONRANGE:
+			value = &frameInputs.projectionRange;
+			valueSize = sizeof(float);
+			break;
+		case CONST_POSITIONSCALE:
+			value = drawInputs.positionScale;
+			valueSize = sizeof(drawInputs.positionScale);
+			break;
+		case CONST_POSITIONOFFSET:
+			value = drawInputs.positionOffset;
+			valueSize = sizeof(drawInputs.positionOffset);
+			break;
+		default:
+			assert(false);
+			continue;
+		}
+
+		// Constants larger than their value only get the value, in the builds without asserts too
+		if (eyeMatrices)
+		{
+			if (constant.elementCount == 0)
+			{
+				assert(constant.size <= sizeof(eyeMatrices[eye]));
+				changed |= WriteValue(destination, eyeMatrices[eye], min<size_t>(constant.size, sizeof(eyeMatrices[eye])));
+			}
+			else if (constant.elementCount == 2)
+			{
+				size_t elementSize = constant.size / 2;
+				assert(elementSize <= sizeof(eyeMatrices[0]));
+				changed |= WriteValue(destination, eyeMatrices[0], min(elementSize, sizeof(eyeMatrices[0])));
+				changed |= WriteValue(destination + elementSize, eyeMatrices[1], min(elementSize, sizeof(eyeMatrices[1])));
+			}
+			else
+			{
+				// Per eye matrices are not arrays of another size
+				assert(false);
+			}
+		}
+		else
+		{
+			assert(constant.size <= valueSize);
+			changed |= WriteValue(destination, value, min<size_t>(constant.size, valueSize));
+		}
+	}
+
+	return changed;
+}
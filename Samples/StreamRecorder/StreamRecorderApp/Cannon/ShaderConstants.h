@@ -0,0 +1,141 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Values of the shader constants that DrawCall sets from the reflection of the
+// shaders, and their writing into the staging copies of the constant buffers.
+//
+// The values are split in two blocks: FrameConstants, which only depend on the
+// view, projection and lights and are shared by all the draws, and
+// DrawConstants, which also depend on the world transform and mesh of a draw.
+// Each block only computes its values again when its inputs change, and
+// WriteShaderConstants tells whether a buffer changed so that uploading it can
+// be skipped otherwise.
+//
+// The matrices are 4x4 matrices with row vectors, as DirectX::XMFLOAT4X4. The
+// values are stored transposed, as the shaders expect them.
+//
+// Portable (no DirectX / WinRT dependencies) so that it can also be built and
+// checked by desktop tools.
+
+#include <cstddef>
+#include <cstdint>
+
+enum ConstantID
+{
+	CONST_WORLD_MATRIX,
+	CONST_WORLDVIEWPROJ_MATRIX,
+	CONST_VIEWPROJ_MATRIX,
+	CONST_VIEW_MATRIX,
+	CONST_INVVIEW_MATRIX,
+	CONST_LIGHTVIEWPROJ_MATRIX,
+	CONST_LIGHTPOSV,
+	CONST_INVVIEWLIGHTVIEWPROJ_MATRIX,
+	CONST_LIGHT_AMBIENT,
+	CONST_NEARPLANEHEIGHT,
+	CONST_NEARPLANEWIDTH,
+	CONST_NEARPLANEDIST,
+	CONST_FARPLANEDIST,
+	CONST_PROJECTIONRANGE,
+	CONST_POSITIONSCALE,
+	CONST_POSITIONOFFSET,
+	CONST_COUNT,
+};
+
+struct Constant
+{
+	unsigned id;			// Unique identifier so we know what to set it to
+	unsigned startOffset;
+	unsigned size;
+	unsigned elementCount;	// Number of elements if array variable. 0 if not an array.
+};
+
+class FrameConstants
+{
+public:
+
+	struct Inputs
+	{
+		float view[2][16];				// Left and right eye
+		float projection[2][16];
+		float cameraView[16];			// Camera view of the light constants, which differs from view during the fullscreen passes
+		float lightViewProjection[16];
+		float lightPosition[4];			// World space
+		float ambient[4];
+		float nearPlaneHeight;			// Of the camera projection, as cameraView
+		float nearPlaneWidth;
+		float nearPlaneDistance;
+		float farPlaneDistance;
+		float projectionRange;
+	};
+
+	struct Values
+	{
+		float viewProjection[2][16];	// Not transposed, for the world view projection of the draws
+		float transposedView[2][16];
+		float transposedInverseView[2][16];
+		float transposedViewProjection[2][16];
+		float transposedLightViewProjection[16];
+		float transposedInverseCameraViewLightViewProjection[16];
+		float lightPositionInCameraView[4];
+	};
+
+	// Computes the values again if the inputs differ from those of the last call, and returns whether they did
+	bool Update(const Inputs& inputs);
+
+	const Inputs& GetInputs() const { return m_inputs; }
+	const Values& GetValues() const { return m_values; }
+
+	// Changes each time the values are computed, 0 before the first Update. Unique across all the FrameConstants.
+	uint64_t GetVersion() const { return m_version; }
+
+private:
+
+	Inputs m_inputs = {};
+	Values m_values = {};
+	uint64_t m_version = 0;
+};
+
+class DrawConstants
+{
+public:
+
+	struct Inputs
+	{
+		float world[16];
+		float positionScale[4];			// Dequantization of the mesh positions, w = 1 for octahedral normals
+		float positionOffset[4];
+	};
+
+	struct Values
+	{
+		float transposedWorld[16];
+		float transposedWorldViewProjection[2][16];		// Left and right eye
+	};
+
+	// Computes the values again if the inputs or the frame values changed since the last call, and returns whether they did
+	bool Update(const Inputs& inputs, const FrameConstants& frameConstants);
+
+	const Inputs& GetInputs() const { return m_inputs; }
+	const Values& GetValues() const { return m_values; }
+
+private:
+
+	Inputs m_inputs = {};
+	Values m_values = {};
+	uint64_t m_frameVersion = 0;
+};
+
+// Writes the constants of a buffer in its staging copy, from the values of the eye (0 left, 1 right) for the constants
+// that are not arrays. Only the bytes that change are written; returns whether there were any.
+bool WriteShaderConstants(const Constant* constants, size_t constantCount, const FrameConstants& frameConstants,
+	const DrawConstants& drawConstants, unsigned eye, unsigned char* staging);
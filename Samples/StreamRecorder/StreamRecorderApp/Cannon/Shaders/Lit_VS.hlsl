@@ -26,6 +26,12 @@ cbuffer g_cbLight
 	float4 vLightPosV;
 };
 
+cbuffer g_cbVertexFormat
+{
+	float4 vPositionScale;
+	float4 vPositionOffset;
+};
+
 LitRasterData main(InstancedVertex vertex)
 {
 	LitRasterData output = (LitRasterData)0;
@@ -35,6 +41,8 @@ LitRasterData main(InstancedVertex vertex)
 	CalculateWorldPositionAndNormal(
 		vertex,
 		mtxWorld,
+		vPositionScale,
+		vPositionOffset,
 		worldPosition,
 		worldNormal);
 	output.projectedPosition = mul(worldPosition, mtxViewProj);
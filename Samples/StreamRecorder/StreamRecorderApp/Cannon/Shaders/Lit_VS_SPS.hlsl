@@ -26,6 +26,12 @@ cbuffer g_cbLight
 	float4 vLightPosV;
 };
 
+cbuffer g_cbVertexFormat
+{
+	float4 vPositionScale;
+	float4 vPositionOffset;
+};
+
 LitRasterDataSPS main(InstancedVertex vertex)
 {
 	LitRasterDataSPS output = (LitRasterDataSPS)0;
@@ -36,6 +42,8 @@ LitRasterDataSPS main(InstancedVertex vertex)
 	CalculateWorldPositionAndNormal(
 		vertex,
 		mtxWorld,
+		vPositionScale,
+		vPositionOffset,
 		worldPosition,
 		worldNormal);
 	output.projectedPosition = mul(worldPosition, mtxViewProj[idx]);
@@ -75,12 +75,28 @@ struct UnlitRasterDataSPS
 	uint   rtvId         : SV_RenderTargetArrayIndex;
 };
 
+// Quantized meshes (see QuantizedVertex) have positions in [0, 1] over the mesh bounds,
+// and octahedral encoded normals when positionScale.w is set. Float meshes use a scale of 1 and an offset of 0.
+float3 DecodeOctahedralNormal(float2 encoded)
+{
+	float3 normal = float3(encoded, 1.0f - abs(encoded.x) - abs(encoded.y));
+	float t = saturate(-normal.z);
+	normal.xy += (normal.xy >= 0.0f) ? -t : t;
+	return normalize(normal);
+}
+
 void CalculateWorldPositionAndNormal(
 	InstancedVertex vertex,
 	float4x4 worldTransform,
+	float4 positionScale,
+	float4 positionOffset,
 	inout float4 worldPosition,
 	inout float3 worldNormal)
 {
+	vertex.position.xyz = vertex.position.xyz * positionScale.xyz + positionOffset.xyz;
+	if (positionScale.w > 0.0f)
+		vertex.normal = DecodeOctahedralNormal(vertex.normal.xy);
+
 	float4x4 mtxWorldFinal;
 	mtxWorldFinal[0] = vertex.worldMatrixRow0;
 	mtxWorldFinal[1] = vertex.worldMatrixRow1;
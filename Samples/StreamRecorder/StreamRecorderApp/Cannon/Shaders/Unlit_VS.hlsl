@@ -24,6 +24,12 @@ cbuffer g_cbLight
 	float4 vLightPosV;
 };
 
+cbuffer g_cbVertexFormat
+{
+	float4 vPositionScale;
+	float4 vPositionOffset;
+};
+
 UnlitRasterData main(InstancedVertex vertex)
 {
 	UnlitRasterData output = (UnlitRasterData)0;
@@ -33,6 +39,8 @@ UnlitRasterData main(InstancedVertex vertex)
 	CalculateWorldPositionAndNormal(
 		vertex,
 		mtxWorld,
+		vPositionScale,
+		vPositionOffset,
 		worldPosition,
 		worldNormal);
 	output.projectedPosition = mul(worldPosition, mtxViewProj);
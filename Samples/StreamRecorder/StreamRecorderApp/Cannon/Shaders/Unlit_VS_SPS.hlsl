@@ -24,6 +24,12 @@ cbuffer g_cbLight
 	float4 vLightPosV;
 };
 
+cbuffer g_cbVertexFormat
+{
+	float4 vPositionScale;
+	float4 vPositionOffset;
+};
+
 UnlitRasterDataSPS main(InstancedVertex vertex)
 {
 	UnlitRasterDataSPS output = (UnlitRasterDataSPS)0;
@@ -34,6 +40,8 @@ UnlitRasterDataSPS main(InstancedVertex vertex)
 	CalculateWorldPositionAndNormal(
 		vertex,
 		mtxWorld,
+		vPositionScale,
+		vPositionOffset,
 		worldPosition,
 		worldNormal);
 	output.projectedPosition = mul(worldPosition, mtxViewProj[idx]);
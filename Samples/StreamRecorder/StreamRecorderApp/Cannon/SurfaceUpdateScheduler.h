@@ -0,0 +1,346 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Schedules the mesh updates of observed surfaces, as SurfaceMapping does with
+// the surfaces of a SpatialSurfaceObserver, on a pool of worker threads.
+//
+// The observer thread reports the surfaces it sees with SetObservedSurfaces:
+// new surfaces, and surfaces whose update time advanced enough since their
+// mesh was computed, are queued. The workers pick the queued surfaces in order
+// of priority: surfaces without a mesh first, then by distance to the viewer,
+// surfaces outside of the view counting as further away. Updates start at most
+// at the rate of the budget, with bursts of up to burstSize updates.
+//
+// SurfaceId needs operator<. Surface is what the update function needs to
+// compute the mesh (SpatialSurfaceInfo for SurfaceMapping).
+//
+// Portable (no DirectX / WinRT dependencies), so that the scheduling can be
+// checked with a simulated observer on desktop.
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+template <typename SurfaceId, typename Surface>
+class SurfaceUpdateScheduler
+{
+public:
+
+	struct Settings
+	{
+		unsigned workerCount = 2;
+		float surfacesPerSecond = 30.0f;		// Budget of updates started per second
+		float burstSize = 10.0f;				// Updates that can start at once after an idle period
+		long long minUpdateInterval = 0;		// A surface with a mesh is updated again once its update time advanced by more than this
+		float visibleCosine = 0.7f;				// Cosine of the angle to the viewer forward direction under which a surface is in view
+		float hiddenDistanceScale = 3.0f;		// Surfaces out of view are prioritized as if they were this much further
+		float retryDelay = 1.0f;				// Seconds before an update that failed is tried again
+	};
+
+	struct ObservedSurface
+	{
+		SurfaceId id;
+		Surface surface;
+		long long updateTime;
+		float center[3];						// Same space as the viewer position; FLT_MAX if unknown
+	};
+
+	// Computes the mesh of a surface, on a worker thread. Returns false if it could not.
+	typedef std::function<bool(const SurfaceId& id, const Surface& surface)> UpdateFunction;
+
+	SurfaceUpdateScheduler(UpdateFunction updateFunction, const Settings& settings = Settings());
+	~SurfaceUpdateScheduler();
+
+	SurfaceUpdateScheduler(const SurfaceUpdateScheduler&) = delete;
+	SurfaceUpdateScheduler& operator=(const SurfaceUpdateScheduler&) = delete;
+
+	// Replaces the observed surfaces; the surfaces that are not observed anymore are forgotten
+	void SetObservedSurfaces(const std::vector<ObservedSurface>& surfaces);
+
+	// forward is a unit vector
+	void SetViewer(const float position[3], const float forward[3]);
+
+	size_t GetQueuedCount();
+	size_t GetUpdatedCount();		// Successful updates since the creation of the scheduler
+
+private:
+
+	typedef std::chrono::steady_clock Clock;
+
+	struct Record
+	{
+		Record(const Surface& surface) : surface(surface) {}
+
+		Surface surface;
+		long long updateTime = 0;
+		long long meshUpdateTime = 0;	// Update time of the surface when its mesh was computed
+		float center[3];
+		bool hasMesh = false;
+		bool queued = false;
+		bool updating = false;
+		Clock::time_point retryTime;
+		size_t observation = 0;			// Last call of SetObservedSurfaces that reported the surface
+	};
+
+	bool NeedsUpdate(const Record& record) const;
+	void Queue(Record& record);
+	float GetPriorityDistance(const Record& record) const;
+	typename std::map<SurfaceId, Record>::iterator PickNext(Clock::time_point now);
+	void RefillBudget(Clock::time_point now);
+	void WorkerThreadFunction();
+
+	const UpdateFunction m_updateFunction;
+	const Settings m_settings;
+
+	std::map<SurfaceId, Record> m_records;
+	size_t m_observation = 0;
+	size_t m_queuedCount = 0;
+	size_t m_updatedCount = 0;
+
+	float m_viewerPosition[3] = { 0.0f, 0.0f, 0.0f };
+	float m_viewerForward[3] = { 0.0f, 0.0f, -1.0f };
+
+	float m_budget;
+	Clock::time_point m_budgetTime;
+
+	bool m_exiting = false;
+	std::mutex m_mutex;
+	std::condition_variable m_workCondition;
+	std::vector<std::thread> m_workerThreads;
+};
+
+template <typename SurfaceId, typename Surface>
+SurfaceUpdateScheduler<SurfaceId, Surface>::SurfaceUpdateScheduler(UpdateFunction updateFunction, const Settings& settings) :
+	m_updateFunction(updateFunction),
+	m_settings(settings),
+	m_budget(settings.burstSize),
+	m_budgetTime(Clock::now())
+{
+	assert(settings.workerCount > 0 && settings.surfacesPerSecond > 0.0f && settings.burstSize >= 1.0f);
+
+	for (unsigned i = 0; i < settings.workerCount; ++i)
+		m_workerThreads.emplace_back(&SurfaceUpdateScheduler::WorkerThreadFunction, this);
+}
+
+template <typename SurfaceId, typename Surface>
+SurfaceUpdateScheduler<SurfaceId, Surface>::~SurfaceUpdateScheduler()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_exiting = true;
+	}
+	m_workCondition.notify_all();
+
+	for (auto& workerThread : m_workerThreads)
+		workerThread.join();
+}
+
+template <typename SurfaceId, typename Surface>
+void SurfaceUpdateScheduler<SurfaceId, Surface>::SetObservedSurfaces(const std::vector<ObservedSurface>& surfaces)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_observation++;
+	for (const auto& surface : surfaces)
+	{
+		// Surface types such as WinRT classes have no default constructor
+		auto recordIterator = m_records.find(surface.id);
+		if (recordIterator == m_records.end())
+			recordIterator = m_records.emplace(surface.id, Record(surface.surface)).first;
+
+		Record& record = recordIterator->second;
+		record.surface = surface.surface;
+		record.updateTime = surface.updateTime;
+		std::copy(surface.center, surface.center + 3, record.center);
+		record.observation = m_observation;
+
+		if (!record.queued && !record.updating && NeedsUpdate(record))
+			Queue(record);
+	}
+
+	// Surfaces being updated are forgotten when their update completes
+	for (auto recordIterator = m_records.begin(); recordIterator != m_records.end();)
+	{
+		Record& record = recordIterator->second;
+		if (record.observation == m_observation || record.updating)
+		{
+			++recordIterator;
+			continue;
+		}
+
+		if (record.queued)
+			m_queuedCount--;
+		recordIterator = m_records.erase(recordIterator);
+	}
+
+	if (m_queuedCount > 0)
+		m_workCondition.notify_all();
+}
+
+template <typename SurfaceId, typename Surface>
+void SurfaceUpdateScheduler<SurfaceId, Surface>::SetViewer(const float position[3], const float forward[3])
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::copy(position, position + 3, m_viewerPosition);
+	std::copy(forward, forward + 3, m_viewerForward);
+}
+
+template <typename SurfaceId, typename Surface>
+size_t SurfaceUpdateScheduler<SurfaceId, Surface>::GetQueuedCount()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_queuedCount;
+}
+
+template <typename SurfaceId, typename Surface>
+size_t SurfaceUpdateScheduler<SurfaceId, Surface>::GetUpdatedCount()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_updatedCount;
+}
+
+template <typename SurfaceId, typename Surface>
+bool SurfaceUpdateScheduler<SurfaceId, Surface>::NeedsUpdate(const Record& record) const
+{
+	return !record.hasMesh || record.updateTime - record.meshUpdateTime > m_settings.minUpdateInterval;
+}
+
+template <typename SurfaceId, typename Surface>
+void SurfaceUpdateScheduler<SurfaceId, Surface>::Queue(Record& record)
+{
+	assert(!record.queued);
+	record.queued = true;
+	record.retryTime = Clock::time_point();
+	m_queuedCount++;
+}
+
+template <typename SurfaceId, typename Surface>
+float SurfaceUpdateScheduler<SurfaceId, Surface>::GetPriorityDistance(const Record& record) const
+{
+	float offset[3];
+	for (int axis = 0; axis < 3; ++axis)
+		offset[axis] = record.center[axis] - m_viewerPosition[axis];
+	float distance = sqrtf(offset[0] * offset[0] + offset[1] * offset[1] + offset[2] * offset[2]);
+
+	float forwardDistance = offset[0] * m_viewerForward[0] + offset[1] * m_viewerForward[1] + offset[2] * m_viewerForward[2];
+	bool inView = forwardDistance >= m_settings.visibleCosine * distance;
+	return inView ? distance : distance * m_settings.hiddenDistanceScale;
+}
+
+template <typename SurfaceId, typename Surface>
+typename std::map<SurfaceId, typename SurfaceUpdateScheduler<SurfaceId, Surface>::Record>::iterator SurfaceUpdateScheduler<SurfaceId, Surface>::PickNext(Clock::time_point now)
+{
+	auto bestIterator = m_records.end();
+	float bestDistance = 0.0f;
+	for (auto recordIterator = m_records.begin(); recordIterator != m_records.end(); ++recordIterator)
+	{
+		const Record& record = recordIterator->second;
+		if (!record.queued || record.retryTime > now)
+			continue;
+
+		float distance = GetPriorityDistance(record);
+		if (bestIterator == m_records.end() ||
+			(!record.hasMesh && bestIterator->second.hasMesh) ||
+			(record.hasMesh == bestIterator->second.hasMesh && distance < bestDistance))
+		{
+			bestIterator = recordIterator;
+			bestDistance = distance;
+		}
+	}
+	return bestIterator;
+}
+
+template <typename SurfaceId, typename Surface>
+void SurfaceUpdateScheduler<SurfaceId, Surface>::RefillBudget(Clock::time_point now)
+{
+	float elapsed = std::chrono::duration<float>(now - m_budgetTime).count();
+	m_budget = std::min(m_settings.burstSize, m_budget + elapsed * m_settings.surfacesPerSecond);
+	m_budgetTime = now;
+}
+
+template <typename SurfaceId, typename Surface>
+void SurfaceUpdateScheduler<SurfaceId, Surface>::WorkerThreadFunction()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (!m_exiting)
+	{
+		if (m_queuedCount == 0)
+		{
+			m_workCondition.wait(lock);
+			continue;
+		}
+
+		Clock::time_point now = Clock::now();
+		RefillBudget(now);
+		if (m_budget < 1.0f)
+		{
+			m_workCondition.wait_for(lock, std::chrono::duration<float>((1.0f - m_budget) / m_settings.surfacesPerSecond));
+			continue;
+		}
+
+		// Only surfaces waiting to be retried are queued
+		auto recordIterator = PickNext(now);
+		if (recordIterator == m_records.end())
+		{
+			m_workCondition.wait_for(lock, std::chrono::duration<float>(m_settings.retryDelay));
+			continue;
+		}
+
+		m_budget -= 1.0f;
+		m_queuedCount--;
+
+		Record& record = recordIterator->second;
+		record.queued = false;
+		record.updating = true;
+		SurfaceId id = recordIterator->first;
+		Surface surface = record.surface;
+		long long updateTime = record.updateTime;
+
+		lock.unlock();
+		bool updated = m_updateFunction(id, surface);
+		lock.lock();
+
+		// The record may have been updated, but not erased, meanwhile
+		recordIterator = m_records.find(id);
+		assert(recordIterator != m_records.end());
+		Record& updatedRecord = recordIterator->second;
+		updatedRecord.updating = false;
+
+		if (updatedRecord.observation != m_observation)
+		{
+			m_records.erase(recordIterator);
+			continue;
+		}
+
+		if (updated)
+		{
+			updatedRecord.hasMesh = true;
+			updatedRecord.meshUpdateTime = updateTime;
+			m_updatedCount++;
+			if (NeedsUpdate(updatedRecord))
+				Queue(updatedRecord);
+		}
+		else
+		{
+			Queue(updatedRecord);
+			updatedRecord.retryTime = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(m_settings.retryDelay));
+		}
+	}
+}
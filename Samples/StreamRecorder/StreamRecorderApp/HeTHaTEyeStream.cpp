@@ -162,30 +162,38 @@ void HeTHaTStreamVisualizer::Draw()
 {
     for (auto drawCall : m_drawCalls)
     {
-        drawCall->Draw();
+        drawCall->Submit();
     }
+
+    DrawCall::FlushRenderQueue();
 }
 
 void HeTHaTStreamVisualizer::Update(const HeTHaTEyeStream& stream)
 {
     m_drawCalls.clear();
+
+    if (!m_handMesh)
+    {
+        m_handMesh = std::make_shared<Mesh>(Mesh::MT_PLANE);
+        m_headMesh = std::make_shared<Mesh>(Mesh::MT_UIPLANE);
+    }
     
     const XMMATRIX scale = XMMatrixScaling(0.03f, 0.03f, 0.03f);
     for (int i_frame = 0; i_frame < stream.FrameCount(); i_frame += kStride)
     {
         const HeTHaTEyeFrame& frame = stream.Log()[i_frame];
 
-        auto drawCallLeft = std::make_shared<DrawCall>("Lit_VS.cso", "Lit_PS.cso", Mesh::MT_PLANE);
+        auto drawCallLeft = std::make_shared<DrawCall>("Lit_VS.cso", "Lit_PS.cso", m_handMesh);
         drawCallLeft->SetWorldTransform(scale * frame.leftHandTransform[(int)HandJointIndex::Palm]);
         drawCallLeft->SetColor(XMVectorSet(1.0f, 0.0f, 0.0f, 1.0f));
         m_drawCalls.push_back(drawCallLeft);
 
-        auto drawCallRight = std::make_shared<DrawCall>("Lit_VS.cso", "Lit_PS.cso", Mesh::MT_PLANE);
+        auto drawCallRight = std::make_shared<DrawCall>("Lit_VS.cso", "Lit_PS.cso", m_handMesh);
         drawCallRight->SetWorldTransform(scale * frame.rightHandTransform[(int)HandJointIndex::Palm]);
         drawCallRight->SetColor(XMVectorSet(0.0f, 1.0f, 0.0f, 1.0f));
         m_drawCalls.push_back(drawCallRight);
 
-        auto drawCallHead = std::make_shared<DrawCall>("Lit_VS.cso", "Lit_PS.cso", Mesh::MT_UIPLANE);
+        auto drawCallHead = std::make_shared<DrawCall>("Lit_VS.cso", "Lit_PS.cso", m_headMesh);
         drawCallHead->SetWorldTransform(scale * frame.headTransform);
         drawCallHead->SetColor(XMVectorSet(0.0f, 0.0f, 1.0f, 1.0f));
         m_drawCalls.push_back(drawCallHead);
@@ -59,4 +59,8 @@ private:
     static const int kStride = 10;
 
     std::vector<std::shared_ptr<DrawCall>> m_drawCalls;
+
+    // Shared by the draw calls, which the render queue merges into one instanced draw per mesh
+    std::shared_ptr<Mesh> m_handMesh;
+    std::shared_ptr<Mesh> m_headMesh;
 };
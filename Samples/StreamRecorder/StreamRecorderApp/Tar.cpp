@@ -157,6 +157,12 @@ namespace Io
     Tarball::Tarball(const std::wstring& tarballFileName) {
         m_tarballFile.open(tarballFileName, std::ios::binary);
         assert(m_tarballFile.is_open());
+
+        // Readers fall back to walking the headers when there is no index
+        if (!m_index.Open(std::filesystem::path(tarballFileName) += kTarIndexExtension))
+        {
+            OutputDebugStringW((L"Failed to open the index of " + tarballFileName + L", recording without it\n").c_str());
+        }
     }
 
     Tarball::~Tarball() {
@@ -171,6 +177,8 @@ namespace Io
             m_tarballFile.write(alignmentData.data(), alignmentData.size());
             m_tarballFile.close();
         }
+
+        m_index.Close();
     }
 
     void Tarball::AddFile(
@@ -210,6 +218,9 @@ namespace Io
         m_tarballFile.write(
             reinterpret_cast<const char*>(fileData), fileSize);
 
+        m_index.AddEntry(Utf16ToUtf8(fileName), m_offset + sizeof(header), fileSize);
+        m_offset += sizeof(header) + fileSize;
+
         // Make sure the file is aligned to 512 byes, otherwise
         // pad the file with zeros.
 
@@ -221,6 +232,7 @@ namespace Io
 
             m_tarballFile.write(
                 std::vector<char>(lastBlockPadding, 0).data(), lastBlockPadding);
+            m_offset += lastBlockPadding;
         }
     }
 }
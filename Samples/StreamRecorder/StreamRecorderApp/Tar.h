@@ -16,10 +16,14 @@
 #include <fstream>
 #include <vector>
 
+#include "TarIndex.h"
+
 namespace Io
 {	
 	// Class to create tarball, which allows for incremental
-	// streaming of files into the archive
+	// streaming of files into the archive.
+	// A sidecar index (<tarball>.idx, see TarIndex.h) is written alongside,
+	// so readers can seek to a member without walking all headers.
 	class Tarball
 	{
 	public:
@@ -35,5 +39,11 @@ namespace Io
 	private:
 		// The file handler to the tarball
 		std::ofstream m_tarballFile;
+
+		// Current write offset in the tarball
+		uint64_t m_offset = 0;
+
+		// Sidecar index of the members added so far
+		TarIndexWriter m_index;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,298 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#include "TarIndex.h"
+
+namespace Io
+{
+    static const char kTarIndexMagic[8] = { 'R', 'M', 'T', 'A', 'R', 'I', 'D', 'X' };
+
+    static constexpr size_t kTarBlockSize = 512;
+
+    uint64_t HashTarMemberName(const std::string& name)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (const char c : name)
+        {
+            hash ^= static_cast<uint8_t>(c);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    int64_t ParseTimestampFromFileName(const std::string& name)
+    {
+        // Ignore any directory part of the member name
+        const size_t nameStart = name.find_last_of('/');
+        size_t i = (nameStart == std::string::npos) ? 0 : nameStart + 1;
+
+        if (i >= name.size() || name[i] < '0' || name[i] > '9')
+        {
+            return -1;
+        }
+
+        int64_t timestamp = 0;
+        for (; i < name.size() && name[i] >= '0' && name[i] <= '9'; ++i)
+        {
+            timestamp = timestamp * 10 + (name[i] - '0');
+        }
+        return timestamp;
+    }
+
+    TarIndexWriter::~TarIndexWriter()
+    {
+        Close();
+    }
+
+    bool TarIndexWriter::Open(const std::filesystem::path& indexFileName)
+    {
+        Close();
+
+        m_indexFile.open(indexFileName, std::ios::binary | std::ios::trunc);
+        if (!m_indexFile.is_open())
+        {
+            return false;
+        }
+
+        m_entryCount = 0;
+        m_pendingEntries.reserve(kFlushInterval);
+
+        // Write an empty header, the entry count is patched on every flush
+        TarIndexHeader header = {};
+        std::memcpy(header.Magic, kTarIndexMagic, sizeof(header.Magic));
+        header.Version = kTarIndexVersion;
+        header.EntrySize = sizeof(TarIndexEntry);
+        header.EntryCount = 0;
+        m_indexFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        return m_indexFile.good();
+    }
+
+    void TarIndexWriter::Close()
+    {
+        if (m_indexFile.is_open())
+        {
+            Flush();
+            m_indexFile.close();
+        }
+    }
+
+    void TarIndexWriter::AddEntry(const std::string& fileName, uint64_t dataOffset, uint64_t dataSize)
+    {
+        // The index is optional, a tarball whose index could not be opened is still recorded
+        if (!m_indexFile.is_open())
+        {
+            return;
+        }
+
+        m_pendingEntries.push_back(TarIndexEntry{
+            HashTarMemberName(fileName),
+            ParseTimestampFromFileName(fileName),
+            dataOffset,
+            dataSize });
+
+        if (m_pendingEntries.size() >= kFlushInterval)
+        {
+            Flush();
+        }
+    }
+
+    void TarIndexWriter::Flush()
+    {
+        if (!m_indexFile.is_open() || m_pendingEntries.empty())
+        {
+            return;
+        }
+
+        static_assert(
+            sizeof(TarIndexEntry) == 32,
+            "Size of the TarIndexEntry structure must be equal to 32 bytes.");
+
+        m_indexFile.seekp(0, std::ios::end);
+        m_indexFile.write(
+            reinterpret_cast<const char*>(m_pendingEntries.data()),
+            m_pendingEntries.size() * sizeof(TarIndexEntry));
+        m_entryCount += m_pendingEntries.size();
+        m_pendingEntries.clear();
+
+        // Only publish the new entries once they have been written
+        m_indexFile.seekp(offsetof(TarIndexHeader, EntryCount), std::ios::beg);
+        m_indexFile.write(reinterpret_cast<const char*>(&m_entryCount), sizeof(m_entryCount));
+        m_indexFile.flush();
+    }
+
+    bool TarIndexReader::Load(const std::filesystem::path& indexFileName)
+    {
+        m_entries.clear();
+
+        std::ifstream indexFile(indexFileName, std::ios::binary);
+        if (!indexFile.is_open())
+        {
+            return false;
+        }
+
+        TarIndexHeader header = {};
+        indexFile.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!indexFile ||
+            std::memcmp(header.Magic, kTarIndexMagic, sizeof(header.Magic)) != 0 ||
+            header.Version != kTarIndexVersion ||
+            header.EntrySize != sizeof(TarIndexEntry))
+        {
+            return false;
+        }
+
+        m_entries.resize(static_cast<size_t>(header.EntryCount));
+        indexFile.read(
+            reinterpret_cast<char*>(m_entries.data()),
+            m_entries.size() * sizeof(TarIndexEntry));
+
+        // Keep whatever was completely written
+        m_entries.resize(static_cast<size_t>(indexFile.gcount()) / sizeof(TarIndexEntry));
+
+        std::stable_sort(m_entries.begin(), m_entries.end(),
+            [](const TarIndexEntry& a, const TarIndexEntry& b) { return a.Timestamp < b.Timestamp; });
+
+        return true;
+    }
+
+    const TarIndexEntry* TarIndexReader::FindByName(const std::string& fileName) const
+    {
+        const uint64_t nameHash = HashTarMemberName(fileName);
+        const int64_t timestamp = ParseTimestampFromFileName(fileName);
+
+        // Members sharing the timestamp (e.g. depth and AB) are adjacent
+        auto range = std::equal_range(m_entries.begin(), m_entries.end(), TarIndexEntry{ 0, timestamp, 0, 0 },
+            [](const TarIndexEntry& a, const TarIndexEntry& b) { return a.Timestamp < b.Timestamp; });
+
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (it->NameHash == nameHash)
+            {
+                return &(*it);
+            }
+        }
+        return nullptr;
+    }
+
+    const TarIndexEntry* TarIndexReader::FindNearestTimestamp(int64_t timestamp) const
+    {
+        if (m_entries.empty())
+        {
+            return nullptr;
+        }
+
+        auto it = std::lower_bound(m_entries.begin(), m_entries.end(), timestamp,
+            [](const TarIndexEntry& a, int64_t t) { return a.Timestamp < t; });
+
+        if (it == m_entries.end())
+        {
+            // Return the first of the entries sharing the last timestamp
+            it = std::lower_bound(m_entries.begin(), m_entries.end(), m_entries.back().Timestamp,
+                [](const TarIndexEntry& a, int64_t t) { return a.Timestamp < t; });
+            return &(*it);
+        }
+
+        if (it != m_entries.begin())
+        {
+            auto previous = std::prev(it);
+            if (timestamp - previous->Timestamp < it->Timestamp - timestamp)
+            {
+                it = std::lower_bound(m_entries.begin(), m_entries.end(), previous->Timestamp,
+                    [](const TarIndexEntry& a, int64_t t) { return a.Timestamp < t; });
+            }
+        }
+        return &(*it);
+    }
+
+    static uint64_t ParseTarOctal(const char* field, size_t fieldSize)
+    {
+        uint64_t value = 0;
+        size_t i = 0;
+
+        // Some writers pad numeric fields with leading spaces
+        while (i < fieldSize && field[i] == ' ')
+        {
+            ++i;
+        }
+
+        for (; i < fieldSize && field[i] != '\0' && field[i] != ' '; ++i)
+        {
+            if (field[i] < '0' || field[i] > '7')
+            {
+                break;
+            }
+            value = (value << 3) + (field[i] - '0');
+        }
+        return value;
+    }
+
+    int64_t RebuildTarIndex(const std::filesystem::path& tarballFileName, const std::filesystem::path& indexFileName)
+    {
+        std::ifstream tarballFile(tarballFileName, std::ios::binary);
+        if (!tarballFile.is_open())
+        {
+            return -1;
+        }
+
+        TarIndexWriter writer;
+        if (!writer.Open(indexFileName))
+        {
+            return -1;
+        }
+
+        // Offsets of the ustar header fields we need, see Tar.cpp
+        constexpr size_t kFileNameOffset = 0;
+        constexpr size_t kFileSizeOffset = 124;
+        constexpr size_t kTypeOffset = 156;
+        constexpr size_t kFileNamePrefixOffset = 345;
+
+        int64_t memberCount = 0;
+        uint64_t headerOffset = 0;
+        char block[kTarBlockSize];
+
+        while (tarballFile.read(block, kTarBlockSize))
+        {
+            // The archive ends with zero blocks
+            if (std::all_of(block, block + kTarBlockSize, [](char c) { return c == '\0'; }))
+            {
+                break;
+            }
+
+            const uint64_t dataSize = ParseTarOctal(block + kFileSizeOffset, 12);
+            const char type = block[kTypeOffset];
+
+            // Only index regular files, skip directories and extended headers
+            if (type == '0' || type == '\0')
+            {
+                std::string fileName(block + kFileNameOffset, strnlen(block + kFileNameOffset, 100));
+                const size_t prefixLength = strnlen(block + kFileNamePrefixOffset, 155);
+                if (prefixLength > 0)
+                {
+                    fileName = std::string(block + kFileNamePrefixOffset, prefixLength) + "/" + fileName;
+                }
+
+                writer.AddEntry(fileName, headerOffset + kTarBlockSize, dataSize);
+                ++memberCount;
+            }
+
+            const uint64_t paddedSize = (dataSize + kTarBlockSize - 1) / kTarBlockSize * kTarBlockSize;
+            headerOffset += kTarBlockSize + paddedSize;
+            tarballFile.seekg(static_cast<std::streamoff>(headerOffset), std::ios::beg);
+        }
+
+        writer.Close();
+        return memberCount;
+    }
+}
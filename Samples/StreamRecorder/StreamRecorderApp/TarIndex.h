@@ -0,0 +1,109 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Portable (no WinRT / Win32 dependencies) so that the index can also be
+// read and rebuilt by desktop tools.
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace Io
+{
+	// Extension appended to the tarball file name for the sidecar index,
+	// e.g. "Depth AHaT.tar" -> "Depth AHaT.tar.idx"
+	static constexpr const char* kTarIndexExtension = ".idx";
+
+	// Sidecar index layout: one TarIndexHeader followed by
+	// TarIndexHeader::EntryCount TarIndexEntry records (little endian).
+	// EntryCount is rewritten on every flush, so a truncated index
+	// written by a crashed recording is still valid up to the last flush.
+#pragma pack (push, 1)
+	struct TarIndexHeader
+	{
+		char Magic[8];              // "RMTARIDX"
+		uint32_t Version;
+		uint32_t EntrySize;         // sizeof(TarIndexEntry)
+		uint64_t EntryCount;
+	};
+
+	struct TarIndexEntry
+	{
+		uint64_t NameHash;          // HashTarMemberName of the member file name
+		int64_t Timestamp;          // Leading digits of the file name, -1 if none
+		uint64_t DataOffset;        // Offset of the member data (past its 512 byte header)
+		uint64_t DataSize;          // Size of the member data in bytes
+	};
+#pragma pack (pop)
+
+	static constexpr uint32_t kTarIndexVersion = 1;
+
+	// 64-bit FNV-1a hash of a tar member name
+	uint64_t HashTarMemberName(const std::string& name);
+
+	// Parses the timestamp the recorder encodes at the start of every file name
+	// ("<ticks>.pgm", "<ticks>_ab.pgm", "<ticks>.bytes"). Returns -1 if there is none.
+	int64_t ParseTimestampFromFileName(const std::string& name);
+
+	// Appends index entries while a tarball is being written
+	class TarIndexWriter
+	{
+	public:
+		TarIndexWriter() = default;
+		~TarIndexWriter();
+
+		bool Open(const std::filesystem::path& indexFileName);
+		void Close();
+		bool IsOpen() const { return m_indexFile.is_open(); }
+
+		// Does nothing if the index is not open
+		void AddEntry(const std::string& fileName, uint64_t dataOffset, uint64_t dataSize);
+
+		// Writes pending entries and updates the entry count in the header
+		void Flush();
+
+		// Number of entries buffered before they are flushed to disk
+		static constexpr size_t kFlushInterval = 64;
+
+	private:
+		std::ofstream m_indexFile;
+		std::vector<TarIndexEntry> m_pendingEntries;
+		uint64_t m_entryCount = 0;
+	};
+
+	// Loads a sidecar index for random access into a tarball
+	class TarIndexReader
+	{
+	public:
+		bool Load(const std::filesystem::path& indexFileName);
+
+		const std::vector<TarIndexEntry>& GetEntries() const { return m_entries; }
+
+		// Returns nullptr if the member is not in the index
+		const TarIndexEntry* FindByName(const std::string& fileName) const;
+
+		// Returns the first entry with the closest timestamp, nullptr if the index is empty
+		const TarIndexEntry* FindNearestTimestamp(int64_t timestamp) const;
+
+	private:
+		// Sorted by Timestamp, so that timestamp lookups are a binary search
+		std::vector<TarIndexEntry> m_entries;
+	};
+
+	// Scans the 512 byte headers of an existing tarball (e.g. recorded before
+	// the index was introduced) and writes its sidecar index.
+	// Returns the number of indexed members, or -1 if the tarball can not be read.
+	int64_t RebuildTarIndex(const std::filesystem::path& tarballFileName, const std::filesystem::path& indexFileName);
+}
@@ -0,0 +1,40 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Checks of the desktop tests. Unlike assert, they are kept in release builds
+// and report every failure instead of stopping at the first one.
+
+#include <cstdio>
+
+inline int g_checkFailureCount = 0;
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			++g_checkFailureCount; \
+			std::printf("%s(%d): CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+		} \
+	} while (false)
+
+// Returned by the main of the tests
+inline int CheckResult()
+{
+	if (g_checkFailureCount == 0)
+		std::printf("All checks passed\n");
+	else
+		std::printf("%d checks failed\n", g_checkFailureCount);
+
+	return g_checkFailureCount == 0 ? 0 : 1;
+}
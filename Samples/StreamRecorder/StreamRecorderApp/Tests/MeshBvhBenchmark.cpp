@@ -0,0 +1,127 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// Build time and peak memory of MeshBvh for 1, 2, 4... threads, and ray queries per
+// second through the hierarchy and through the brute-force triangle loop.
+//
+// MeshBvhBenchmark [triangle count] [ray count] [max thread count]
+// Defaults to a surface mesh sized closed mesh of about 50000 triangles, 100000 rays, and up to
+// the hardware threads. The peak memory is what the build allocates on top of the mesh.
+// MeshBvhScalarBenchmark is the same with the scalar traversal.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../Cannon/MeshBvh.h"
+#include "PeakMemory.h"
+#include "TestMeshes.h"
+
+namespace
+{
+	template <typename Function>
+	double BestMilliseconds(Function function)
+	{
+		double best = 1e30;
+		for (int i = 0; i < 5; ++i)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			function();
+			best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		}
+		return best;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const size_t triangleCount = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 50000;
+	const size_t rayCount = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 100000;
+	const unsigned maxThreadCount = argc > 3 ? (unsigned) std::strtoul(argv[3], nullptr, 10) : std::max(1u, std::thread::hardware_concurrency());
+
+	const TestMeshes::Mesh mesh = TestMeshes::MakeBumpySphere(std::max<size_t>(2, static_cast<size_t>(std::sqrt(triangleCount / 2.0))));
+	std::mt19937 random(0);
+	const std::vector<TestMeshes::Ray> rays = TestMeshes::MakeRays(random, rayCount);
+	std::printf("%zu triangles, %zu rays\n", mesh.indices.size() / 3, rays.size());
+
+	std::vector<unsigned> threadCounts;
+	for (unsigned threadCount = 1; threadCount < maxThreadCount; threadCount *= 2)
+		threadCounts.push_back(threadCount);
+	threadCounts.push_back(std::max(1u, maxThreadCount));
+
+	MeshBvh bvh;
+	double singleThreadMilliseconds = 0.0;
+	std::printf("%-24s %12s %12s %16s\n", "build", "time (ms)", "speedup", "peak memory (MB)");
+	for (const unsigned threadCount : threadCounts)
+	{
+		const double milliseconds = BestMilliseconds([&]
+		{
+			bvh.Build(mesh.vertices.data(), mesh.GetStride(), mesh.GetVertexCount(), mesh.indices.data(), mesh.indices.size(), threadCount);
+		});
+		if (threadCount == 1)
+			singleThreadMilliseconds = milliseconds;
+
+		// One more build into a new hierarchy, whose peak counts the output and the scratch memory
+		const size_t baseBytes = PeakMemory::GetCurrentBytes();
+		PeakMemory::ResetPeak();
+		{
+			MeshBvh peakBvh;
+			peakBvh.Build(mesh.vertices.data(), mesh.GetStride(), mesh.GetVertexCount(), mesh.indices.data(), mesh.indices.size(), threadCount);
+		}
+		const size_t peakBytes = PeakMemory::GetPeakBytes() - baseBytes;
+
+		std::printf("%-24s %12.2f %12.2f %16.2f\n", (std::to_string(threadCount) + (threadCount == 1 ? " thread" : " threads")).c_str(),
+			milliseconds, singleThreadMilliseconds / milliseconds, peakBytes / 1048576.0);
+	}
+	bvh.Build(mesh.vertices.data(), mesh.GetStride(), mesh.GetVertexCount(), mesh.indices.data(), mesh.indices.size(), threadCounts.back());
+	std::printf("%zu nodes, %zu bytes serialized, %.2f MB of triangles\n", bvh.GetNodeCount(), bvh.GetSerializedSize(),
+		mesh.indices.size() / 3 * sizeof(float) * 9 / 1048576.0);
+
+	// The brute-force loop only gets a sample of the rays
+	const size_t triangleLoopRayCount = std::max<size_t>(1, std::min(rays.size(), 200000000 / std::max<size_t>(1, mesh.indices.size())));
+	std::printf("%-24s %12s %12s\n", "query", "rays/s", "hits");
+	for (const MeshBvh::HitMode mode : { MeshBvh::HitMode::Closest, MeshBvh::HitMode::Any })
+	{
+		const char* modeName = mode == MeshBvh::HitMode::Closest ? "closest" : "any";
+		size_t hits = 0;
+		double milliseconds = BestMilliseconds([&]
+		{
+			hits = 0;
+			for (const TestMeshes::Ray& ray : rays)
+			{
+				MeshBvh::Hit hit;
+				hits += bvh.Intersect(ray.origin, ray.direction, hit, mode, MeshBvh::Culling::None);
+			}
+		});
+		std::printf("%-24s %12.0f %12zu\n", (std::string("bvh ") + modeName).c_str(), rays.size() / milliseconds * 1e3, hits);
+
+		milliseconds = BestMilliseconds([&]
+		{
+			hits = 0;
+			for (size_t i = 0; i < triangleLoopRayCount; ++i)
+			{
+				MeshBvh::Hit hit;
+				hits += MeshBvh::IntersectTriangles(mesh.vertices.data(), mesh.GetStride(), mesh.indices.data(), mesh.indices.size(),
+					rays[i].origin, rays[i].direction, hit, mode, MeshBvh::Culling::None);
+			}
+		});
+		std::printf("%-24s %12.0f %12s\n", (std::string("triangle loop ") + modeName).c_str(), triangleLoopRayCount / milliseconds * 1e3,
+			(std::to_string(hits) + "/" + std::to_string(triangleLoopRayCount)).c_str());
+	}
+
+	return 0;
+}
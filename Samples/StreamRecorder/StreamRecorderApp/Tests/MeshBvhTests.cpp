@@ -0,0 +1,304 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// Hits of MeshBvh::Intersect against a brute-force loop over the triangles in
+// double precision. Built once per traversal path (see CMakeLists.txt).
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "../Cannon/MeshBvh.h"
+#include "Check.h"
+#include "TestMeshes.h"
+
+namespace
+{
+	using HitMode = MeshBvh::HitMode;
+	using Culling = MeshBvh::Culling;
+
+	using TestMeshes::DistanceTolerance;
+	using TestMeshes::IntersectReference;
+	using TestMeshes::IntersectTriangle;
+	using TestMeshes::kMargin;
+
+	constexpr float kNoMaxDistance = std::numeric_limits<float>::max();
+
+	struct HitCounts
+	{
+		size_t rays = 0;
+		size_t hits = 0;
+	};
+
+	// Checks a hit (or a miss) of the BVH, or of MeshBvh::IntersectTriangles, against the brute-force loop
+	void CheckHit(const TestMeshes::Mesh& mesh, const TestMeshes::Ray& ray, HitMode mode, Culling culling, float maxDistance,
+		bool found, const MeshBvh::Hit& hit, HitCounts& counts)
+	{
+		++counts.rays;
+		double innerDistance = 0.0, outerDistance = 0.0;
+		bool innerFound = IntersectReference(mesh, ray, mode, culling, maxDistance, -kMargin, innerDistance);
+		bool outerFound = IntersectReference(mesh, ray, mode, culling, maxDistance, kMargin, outerDistance);
+		if (!found)
+		{
+			CHECK(!innerFound);
+			return;
+		}
+
+		++counts.hits;
+		CHECK(outerFound);
+		CHECK(hit.distance >= 0.0f && hit.distance <= maxDistance);
+
+		// The hit triangle is hit there
+		double triangleDistance = 0.0;
+		CHECK(hit.triangleIndex < mesh.indices.size() / 3);
+		CHECK(hit.triangleIndex < mesh.indices.size() / 3 &&
+			IntersectTriangle(mesh, hit.triangleIndex, ray, culling, maxDistance, kMargin, triangleDistance) &&
+			std::fabs(triangleDistance - hit.distance) <= DistanceTolerance(triangleDistance));
+
+		// And no triangle is hit before (or after) it
+		if (mode == HitMode::Closest)
+		{
+			CHECK(hit.distance >= outerDistance - DistanceTolerance(outerDistance));
+			CHECK(!innerFound || hit.distance <= innerDistance + DistanceTolerance(innerDistance));
+		}
+		else if (mode == HitMode::Furthest)
+		{
+			CHECK(hit.distance <= outerDistance + DistanceTolerance(outerDistance));
+			CHECK(!innerFound || hit.distance >= innerDistance - DistanceTolerance(innerDistance));
+		}
+
+		// Unit front face normal of the hit triangle
+		if (hit.triangleIndex < mesh.indices.size() / 3)
+		{
+			double normal[3];
+			double length = TestMeshes::GetFrontFaceNormal(mesh, hit.triangleIndex, normal);
+			CHECK(length > 0.0);
+			for (int axis = 0; axis < 3 && length > 0.0; ++axis)
+				CHECK(std::fabs(hit.normal[axis] - normal[axis]) <= 1e-3);
+		}
+	}
+
+	// Every mode, culling and distance range on the rays
+	void CheckRays(const TestMeshes::Mesh& mesh, const MeshBvh& bvh, const std::vector<TestMeshes::Ray>& rays,
+		HitCounts& bvhCounts, HitCounts& triangleLoopCounts)
+	{
+		for (size_t i = 0; i < rays.size(); ++i)
+		{
+			const TestMeshes::Ray& ray = rays[i];
+			for (HitMode mode : { HitMode::Closest, HitMode::Furthest, HitMode::Any })
+			{
+				for (Culling culling : { Culling::None, Culling::BackFaces, Culling::FrontFaces })
+				{
+					// Distance ranges that end inside the mesh bounds on some rays
+					float maxDistance = (i % 2 == 0) ? kNoMaxDistance : 0.25f * (i % 7);
+
+					MeshBvh::Hit hit = {};
+					bool found = bvh.Intersect(ray.origin, ray.direction, hit, mode, culling, maxDistance);
+					CheckHit(mesh, ray, mode, culling, maxDistance, found, hit, bvhCounts);
+
+					hit = {};
+					found = MeshBvh::IntersectTriangles(mesh.vertices.data(), mesh.GetStride(), mesh.indices.data(), mesh.indices.size(),
+						ray.origin, ray.direction, hit, mode, culling, maxDistance);
+					CheckHit(mesh, ray, mode, culling, maxDistance, found, hit, triangleLoopCounts);
+				}
+			}
+		}
+	}
+
+	MeshBvh BuildBvh(const TestMeshes::Mesh& mesh, unsigned threadCount)
+	{
+		MeshBvh bvh;
+		bvh.Build(mesh.vertices.data(), mesh.GetStride(), mesh.GetVertexCount(), mesh.indices.data(), mesh.indices.size(), threadCount);
+		return bvh;
+	}
+
+	std::vector<unsigned char> Serialize(const MeshBvh& bvh)
+	{
+		std::vector<unsigned char> buffer(bvh.GetSerializedSize());
+		unsigned char* writePtr = buffer.data();
+		bvh.WriteToBuffer(&writePtr);
+		CHECK(writePtr == buffer.data() + buffer.size());
+		return buffer;
+	}
+
+	void TestSmallMeshes()
+	{
+		// Empty
+		TestMeshes::Mesh mesh;
+		MeshBvh bvh = BuildBvh(mesh, 1);
+		CHECK(bvh.IsEmpty() && bvh.GetTriangleCount() == 0);
+		CHECK(bvh.GetBoundsMin()[0] > bvh.GetBoundsMax()[0]);
+
+		MeshBvh::Hit hit;
+		const float origin[3] = { 0.25f, 0.25f, 1.0f };
+		const float down[3] = { 0.0f, 0.0f, -1.0f };
+		CHECK(!bvh.Intersect(origin, down, hit));
+
+		// One triangle, whose front face is towards +z, in the root packet
+		mesh.AddVertex(0.0f, 0.0f, 0.0f);
+		mesh.AddVertex(0.0f, 1.0f, 0.0f);
+		mesh.AddVertex(1.0f, 0.0f, 0.0f);
+		mesh.indices = { 0, 1, 2 };
+		bvh = BuildBvh(mesh, 1);
+		CHECK(!bvh.IsEmpty() && bvh.GetTriangleCount() == 1 && bvh.GetNodeCount() == 0);
+
+		CHECK(bvh.Intersect(origin, down, hit, HitMode::Closest, Culling::BackFaces));
+		CHECK(hit.distance == 1.0f && hit.triangleIndex == 0);
+		CHECK(hit.normal[0] == 0.0f && hit.normal[1] == 0.0f && hit.normal[2] == 1.0f);
+		CHECK(!bvh.Intersect(origin, down, hit, HitMode::Closest, Culling::FrontFaces));
+		CHECK(!bvh.Intersect(origin, down, hit, HitMode::Closest, Culling::None, 0.5f));
+
+		const float below[3] = { 0.25f, 0.25f, -2.0f };
+		const float up[3] = { 0.0f, 0.0f, 0.5f };
+		CHECK(!bvh.Intersect(below, up, hit, HitMode::Closest, Culling::BackFaces));
+		CHECK(bvh.Intersect(below, up, hit, HitMode::Closest, Culling::FrontFaces));
+		CHECK(hit.distance == 4.0f && hit.normal[2] == 1.0f);
+		CHECK(bvh.Intersect(below, up, hit, HitMode::Any, Culling::None));
+
+		// Behind the ray, or off the triangle
+		CHECK(!bvh.Intersect(below, down, hit, HitMode::Closest, Culling::None));
+		const float outside[3] = { 0.75f, 0.75f, 1.0f };
+		CHECK(!bvh.Intersect(outside, down, hit, HitMode::Closest, Culling::None));
+
+		// An index past the vertices, in every build
+		mesh.indices = { 0, 1, 2, 2, 1, 3 };
+		CHECK(!bvh.Build(mesh.vertices.data(), mesh.GetStride(), mesh.GetVertexCount(), mesh.indices.data(), mesh.indices.size()));
+		CHECK(bvh.IsEmpty() && bvh.GetTriangleCount() == 0);
+		CHECK(!bvh.Intersect(origin, down, hit, HitMode::Closest, Culling::None));
+		mesh.indices = { 0, 1, 2 };
+		CHECK(bvh.Build(mesh.vertices.data(), mesh.GetStride(), mesh.GetVertexCount(), mesh.indices.data(), mesh.indices.size()));
+	}
+
+	void TestTriangleSoup()
+	{
+		std::mt19937 random(1);
+		TestMeshes::Mesh mesh = TestMeshes::MakeTriangleSoup(random, 3000, 0.2f);
+		MeshBvh bvh = BuildBvh(mesh, 1);
+		CHECK(bvh.GetTriangleCount() == 3000);
+
+		HitCounts bvhCounts, triangleLoopCounts;
+		CheckRays(mesh, bvh, TestMeshes::MakeRays(random, 400), bvhCounts, triangleLoopCounts);
+		CHECK(bvhCounts.hits > bvhCounts.rays / 4 && bvhCounts.hits < bvhCounts.rays);
+
+		// Sizes that leave partial packets
+		for (size_t triangleCount : { 2, 5, 17, 63 })
+		{
+			TestMeshes::Mesh smallMesh = TestMeshes::MakeTriangleSoup(random, triangleCount, 0.5f);
+			CheckRays(smallMesh, BuildBvh(smallMesh, 1), TestMeshes::MakeRays(random, 100), bvhCounts, triangleLoopCounts);
+		}
+	}
+
+	void TestClosedMesh()
+	{
+		// Large enough to be built on several threads
+		TestMeshes::Mesh mesh = TestMeshes::MakeBumpySphere(100);
+		CHECK(mesh.indices.size() / 3 > MeshBvh::kSubtreeTriangleCount);
+		MeshBvh bvh = BuildBvh(mesh, 1);
+
+		// Any thread count gives the same hierarchy
+		std::vector<unsigned char> buffer = Serialize(bvh);
+		for (unsigned threadCount : { 2, 4, 7 })
+			CHECK(Serialize(BuildBvh(mesh, threadCount)) == buffer);
+
+		std::mt19937 random(2);
+		HitCounts bvhCounts, triangleLoopCounts;
+		CheckRays(mesh, bvh, TestMeshes::MakeRays(random, 100), bvhCounts, triangleLoopCounts);
+		CHECK(bvhCounts.hits > bvhCounts.rays / 4);
+
+		// From outside towards the center, the closest front face is in front of the furthest back face
+		std::normal_distribution<float> normal;
+		size_t outsideHits = 0;
+		for (int i = 0; i < 200; ++i)
+		{
+			float direction[3] = { normal(random), normal(random), normal(random) };
+			float length = std::sqrt(direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2]);
+			for (float& value : direction)
+				value /= length;
+
+			float origin[3] = { -4.0f * direction[0], -4.0f * direction[1], -4.0f * direction[2] };
+			MeshBvh::Hit front, back;
+			bool frontFound = bvh.Intersect(origin, direction, front, HitMode::Closest, Culling::BackFaces);
+			bool backFound = bvh.Intersect(origin, direction, back, HitMode::Furthest, Culling::FrontFaces);
+			CHECK(frontFound && backFound);
+			CHECK(!frontFound || !backFound || front.distance < back.distance);
+			CHECK(!frontFound || front.normal[0] * direction[0] + front.normal[1] * direction[1] + front.normal[2] * direction[2] < 0.0f);
+			outsideHits += frontFound;
+		}
+		CHECK(outsideHits == 200);
+	}
+
+	void TestSerialization()
+	{
+		std::mt19937 random(3);
+		TestMeshes::Mesh mesh = TestMeshes::MakeTriangleSoup(random, 500, 0.3f);
+		MeshBvh bvh = BuildBvh(mesh, 1);
+		std::vector<unsigned char> buffer = Serialize(bvh);
+
+		MeshBvh readBvh;
+		const unsigned char* readPtr = buffer.data();
+		CHECK(readBvh.ReadFromBuffer(&readPtr, buffer.data() + buffer.size()));
+		CHECK(readPtr == buffer.data() + buffer.size());
+		CHECK(readBvh.GetNodeCount() == bvh.GetNodeCount() && readBvh.GetTriangleCount() == bvh.GetTriangleCount());
+		CHECK(Serialize(readBvh) == buffer);
+
+		for (const TestMeshes::Ray& ray : TestMeshes::MakeRays(random, 200))
+		{
+			MeshBvh::Hit hit = {}, readHit = {};
+			bool found = bvh.Intersect(ray.origin, ray.direction, hit, HitMode::Closest, Culling::None);
+			CHECK(readBvh.Intersect(ray.origin, ray.direction, readHit, HitMode::Closest, Culling::None) == found);
+			CHECK(!found || (readHit.distance == hit.distance && readHit.triangleIndex == hit.triangleIndex));
+		}
+
+		// Truncated
+		for (size_t size : { size_t(0), size_t(10), buffer.size() / 2, buffer.size() - 1 })
+		{
+			readPtr = buffer.data();
+			CHECK(!readBvh.ReadFromBuffer(&readPtr, buffer.data() + size));
+			CHECK(readBvh.IsEmpty() && readBvh.GetTriangleCount() == 0);
+		}
+
+		// Out of range root, after the root index (uint32) and the triangle count (uint64)
+		std::vector<unsigned char> corrupted = buffer;
+		const uint32_t badRoot = 0x7fffffff;
+		std::memcpy(corrupted.data(), &badRoot, sizeof(badRoot));
+		readPtr = corrupted.data();
+		CHECK(!readBvh.ReadFromBuffer(&readPtr, corrupted.data() + corrupted.size()));
+		CHECK(readBvh.IsEmpty());
+
+		// Fewer triangles than the packets refer to
+		corrupted = buffer;
+		const uint64_t badTriangleCount = 10;
+		std::memcpy(corrupted.data() + sizeof(uint32_t), &badTriangleCount, sizeof(badTriangleCount));
+		readPtr = corrupted.data();
+		CHECK(!readBvh.ReadFromBuffer(&readPtr, corrupted.data() + corrupted.size()));
+		CHECK(readBvh.IsEmpty());
+
+		// An empty hierarchy round trips
+		MeshBvh emptyBvh;
+		std::vector<unsigned char> emptyBuffer = Serialize(emptyBvh);
+		readPtr = emptyBuffer.data();
+		CHECK(readBvh.ReadFromBuffer(&readPtr, emptyBuffer.data() + emptyBuffer.size()));
+		CHECK(readBvh.IsEmpty());
+	}
+}
+
+int main()
+{
+	TestSmallMeshes();
+	TestTriangleSoup();
+	TestClosedMesh();
+	TestSerialization();
+
+	return CheckResult();
+}
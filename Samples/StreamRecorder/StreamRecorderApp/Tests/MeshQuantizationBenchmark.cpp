@@ -0,0 +1,307 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// Decoding of a surface mesh into interleaved vertices (as ConvertMesh does),
+// with the vertex by vertex loop it used to run and with the decoders of
+// MeshQuantization. Then the quantization of the vertices that Mesh::Quantize
+// runs on the decoded surfaces: the memory of the vertices before and after,
+// the time of the conversions, the worst position and normal errors, and the
+// rays per second of BVHs built from the float and the quantized positions.
+//
+// MeshQuantizationBenchmark [vertex count] [index count] [ray count]
+// Defaults to a surface of 20000 vertices and 120000 indices, quantized as a
+// 4 m wide bumpy sphere of about the same number of vertices, and 100000 rays.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "../Cannon/MeshBvh.h"
+#include "../Cannon/MeshQuantization.h"
+#include "PeakMemory.h"
+#include "TestMeshes.h"
+
+namespace
+{
+	const float kSurfaceRadius = 2.0f;
+
+	// Layout of Mesh::Vertex
+	struct Vertex
+	{
+		alignas(16) float position[4];
+		alignas(16) float normal[4];
+		alignas(16) float texcoord[2];
+	};
+
+	void DecodeVertexByVertex(const int16_t* positions, const int8_t* normals, const uint16_t* indices, const float scale[3],
+		std::vector<Vertex>& vertices, std::vector<uint32_t>& destinationIndices)
+	{
+		const float shortMax = 32768.0f;
+		const float charMax = 128.0f;
+		for (size_t i = 0; i < destinationIndices.size(); ++i)
+			destinationIndices[i] = indices[i];
+
+		for (size_t i = 0; i < vertices.size(); ++i)
+		{
+			size_t sourceIndex = i * 4;
+			Vertex& vertex = vertices[i];
+			vertex.position[0] = positions[sourceIndex + 0] / shortMax * scale[0];
+			vertex.position[1] = positions[sourceIndex + 1] / shortMax * scale[1];
+			vertex.position[2] = positions[sourceIndex + 2] / shortMax * scale[2];
+			vertex.position[3] = 1.0f;
+			vertex.normal[0] = normals[sourceIndex + 0] / charMax;
+			vertex.normal[1] = normals[sourceIndex + 1] / charMax;
+			vertex.normal[2] = normals[sourceIndex + 2] / charMax;
+			vertex.normal[3] = 0.0f;
+			vertex.texcoord[0] = 0.0f;
+			vertex.texcoord[1] = 0.0f;
+		}
+	}
+
+	void Decode(const int16_t* positions, const int8_t* normals, const uint16_t* indices, const float scale[3],
+		std::vector<Vertex>& vertices, std::vector<uint32_t>& destinationIndices)
+	{
+		WidenIndices(indices, destinationIndices.size(), destinationIndices.data());
+		unsigned char* destination = (unsigned char*) vertices.data();
+		DecodeSnorm16Positions(positions, vertices.size(), scale, destination + offsetof(Vertex, position), sizeof(Vertex));
+		DecodeSnorm8Normals(normals, vertices.size(), destination + offsetof(Vertex, normal), sizeof(Vertex));
+	}
+
+	template <typename Function>
+	double BestMilliseconds(Function function)
+	{
+		double best = 1e30;
+		for (int i = 0; i < 5; ++i)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			function();
+			best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		}
+		return best;
+	}
+
+	// Bumpy sphere of about vertexCount vertices, with unit normals and texcoords in [0, 1]
+	std::vector<Vertex> MakeSurface(size_t vertexCount, std::vector<uint32_t>& indices)
+	{
+		const TestMeshes::Mesh sphere = TestMeshes::MakeBumpySphere(std::max<size_t>(2, (size_t) std::sqrt((double) vertexCount)));
+		std::vector<Vertex> vertices(sphere.GetVertexCount());
+		for (size_t i = 0; i < vertices.size(); ++i)
+		{
+			const float* position = sphere.GetPosition((uint32_t) i);
+			const float length = std::sqrt(position[0] * position[0] + position[1] * position[1] + position[2] * position[2]);
+			Vertex& vertex = vertices[i];
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				vertex.position[axis] = position[axis] * kSurfaceRadius;
+				vertex.normal[axis] = position[axis] / length;
+			}
+			vertex.position[3] = 1.0f;
+			vertex.normal[3] = 0.0f;
+			vertex.texcoord[0] = 0.5f + 0.5f * vertex.normal[0];
+			vertex.texcoord[1] = 0.5f + 0.5f * vertex.normal[1];
+		}
+		indices = sphere.indices;
+		return vertices;
+	}
+
+	std::vector<MeshBvh::Hit> IntersectAll(const MeshBvh& bvh, const std::vector<TestMeshes::Ray>& rays)
+	{
+		std::vector<MeshBvh::Hit> hits(rays.size());
+		for (size_t i = 0; i < rays.size(); ++i)
+		{
+			if (!bvh.Intersect(rays[i].origin, rays[i].direction, hits[i]))
+				hits[i].distance = -1.0f;
+		}
+		return hits;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const size_t vertexCount = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20000;
+	const size_t indexCount = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 120000;
+
+	std::mt19937 random(0);
+	std::uniform_int_distribution<int> component(-32768, 32767);
+	std::vector<int16_t> positions(4 * vertexCount);
+	std::vector<int8_t> normals(4 * vertexCount);
+	std::vector<uint16_t> indices(indexCount);
+	for (size_t i = 0; i < positions.size(); ++i)
+	{
+		positions[i] = (int16_t) component(random);
+		normals[i] = (int8_t) (component(random) >> 8);
+	}
+	for (size_t i = 0; i < indices.size(); ++i)
+		indices[i] = (uint16_t) (component(random) & 0xffff) % std::max<size_t>(1, vertexCount);
+	const float scale[3] = { 4.0f, 4.0f, 4.0f };
+
+	std::vector<Vertex> referenceVertices(vertexCount), vertices(vertexCount);
+	std::vector<uint32_t> referenceIndices(indexCount), wideIndices(indexCount);
+
+	// Repeated so that each run is long enough to time
+	const int repeatCount = (int) std::max<size_t>(1, 20000000 / std::max<size_t>(1, vertexCount + indexCount));
+	const double referenceMilliseconds = BestMilliseconds([&]
+	{
+		for (int i = 0; i < repeatCount; ++i)
+			DecodeVertexByVertex(positions.data(), normals.data(), indices.data(), scale, referenceVertices, referenceIndices);
+	});
+	const double decoderMilliseconds = BestMilliseconds([&]
+	{
+		for (int i = 0; i < repeatCount; ++i)
+			Decode(positions.data(), normals.data(), indices.data(), scale, vertices, wideIndices);
+	});
+
+	const bool same = std::memcmp(referenceVertices.data(), vertices.data(), vertices.size() * sizeof(Vertex)) == 0 && referenceIndices == wideIndices;
+	std::printf("%zu vertices, %zu indices%s\n", vertexCount, indexCount, same ? "" : "  (different results)");
+	std::printf("%-24s %16s\n", "decode", "Mvertices/s");
+	std::printf("%-24s %16.1f\n", "vertex by vertex", repeatCount * vertexCount / referenceMilliseconds / 1e3);
+	std::printf("%-24s %16.1f\n", "MeshQuantization", repeatCount * vertexCount / decoderMilliseconds / 1e3);
+
+	const size_t rayCount = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 100000;
+	std::vector<uint32_t> surfaceIndices;
+	const std::vector<Vertex> surface = MakeSurface(vertexCount, surfaceIndices);
+	const size_t surfaceVertexCount = surface.size();
+	std::printf("\nMesh::Quantize of a %.0f m wide surface, %zu vertices, %zu triangles\n", 2.0f * kSurfaceRadius, surfaceVertexCount, surfaceIndices.size() / 3);
+
+	// Memory of the vertices kept by Mesh, and of the temporary arrays of Quantize and of the positions
+	// decoded for the bounds and the BVH (UpdateBoundingBox), as allocated
+	const size_t baseBytes = PeakMemory::GetCurrentBytes();
+	std::vector<Vertex> meshVertices(surface);
+	const size_t floatBytes = PeakMemory::GetCurrentBytes() - baseBytes;
+
+	PeakMemory::ResetPeak();
+	std::vector<QuantizedVertex> quantizedVertices(surfaceVertexCount);
+	PositionDequantization dequantization;
+	QuantizeVertices(meshVertices[0].position, meshVertices[0].normal, meshVertices[0].texcoord, sizeof(Vertex), surfaceVertexCount,
+		quantizedVertices.data(), dequantization);
+	std::vector<Vertex>().swap(meshVertices);
+	const size_t quantizePeakBytes = PeakMemory::GetPeakBytes() - baseBytes;
+	const size_t quantizedBytes = PeakMemory::GetCurrentBytes() - baseBytes;
+
+	PeakMemory::ResetPeak();
+	std::vector<float> dequantizedPositions(4 * surfaceVertexCount);
+	DequantizeVertices(quantizedVertices.data(), surfaceVertexCount, dequantization, dequantizedPositions.data(), nullptr, nullptr, 4 * sizeof(float));
+	const size_t decodePeakBytes = PeakMemory::GetPeakBytes() - baseBytes;
+
+	const size_t bvhBaseBytes = PeakMemory::GetCurrentBytes();
+	MeshBvh quantizedBvh;
+	quantizedBvh.Build(dequantizedPositions.data(), 4 * sizeof(float), surfaceVertexCount, surfaceIndices.data(), surfaceIndices.size());
+	const size_t bvhBytes = PeakMemory::GetCurrentBytes() - bvhBaseBytes;
+
+	std::printf("%-32s %16s %16s\n", "memory", "bytes", "bytes/vertex");
+	std::printf("%-32s %16zu %16.1f\n", "float vertices", floatBytes, (double) floatBytes / surfaceVertexCount);
+	std::printf("%-32s %16zu %16.1f\n", "quantized vertices", quantizedBytes, (double) quantizedBytes / surfaceVertexCount);
+	std::printf("%-32s %16zu %16.1f\n", "peak while quantizing", quantizePeakBytes, (double) quantizePeakBytes / surfaceVertexCount);
+	std::printf("%-32s %16zu %16.1f\n", "peak while decoding positions", decodePeakBytes, (double) decodePeakBytes / surfaceVertexCount);
+	std::printf("%-32s %16zu %16.1f\n", "BVH (either)", bvhBytes, (double) bvhBytes / surfaceVertexCount);
+
+	std::vector<QuantizedVertex> timedQuantizedVertices(surfaceVertexCount);
+	std::vector<Vertex> timedVertices(surfaceVertexCount);
+	const int conversionRepeatCount = (int) std::max<size_t>(1, 2000000 / std::max<size_t>(1, surfaceVertexCount));
+	const double quantizeMilliseconds = BestMilliseconds([&]
+	{
+		PositionDequantization timedDequantization;
+		for (int i = 0; i < conversionRepeatCount; ++i)
+			QuantizeVertices(surface[0].position, surface[0].normal, surface[0].texcoord, sizeof(Vertex), surfaceVertexCount, timedQuantizedVertices.data(), timedDequantization);
+	});
+	const double positionsMilliseconds = BestMilliseconds([&]
+	{
+		for (int i = 0; i < conversionRepeatCount; ++i)
+			DequantizeVertices(quantizedVertices.data(), surfaceVertexCount, dequantization, dequantizedPositions.data(), nullptr, nullptr, 4 * sizeof(float));
+	});
+	const double dequantizeMilliseconds = BestMilliseconds([&]
+	{
+		for (int i = 0; i < conversionRepeatCount; ++i)
+			DequantizeVertices(quantizedVertices.data(), surfaceVertexCount, dequantization, timedVertices[0].position, timedVertices[0].normal, timedVertices[0].texcoord, sizeof(Vertex));
+	});
+
+	std::printf("%-32s %16s %16s\n", "conversion", "ms", "Mvertices/s");
+	std::printf("%-32s %16.3f %16.1f\n", "quantize (Mesh::Quantize)", quantizeMilliseconds / conversionRepeatCount, conversionRepeatCount * surfaceVertexCount / quantizeMilliseconds / 1e3);
+	std::printf("%-32s %16.3f %16.1f\n", "positions (UpdateBoundingBox)", positionsMilliseconds / conversionRepeatCount, conversionRepeatCount * surfaceVertexCount / positionsMilliseconds / 1e3);
+	std::printf("%-32s %16.3f %16.1f\n", "dequantize (Mesh::Dequantize)", dequantizeMilliseconds / conversionRepeatCount, conversionRepeatCount * surfaceVertexCount / dequantizeMilliseconds / 1e3);
+
+	// Half a quantization step of the widest axis is the most a position can move
+	double worstPositionError = 0.0, worstNormalDegrees = 0.0, halfStep = 0.0;
+	for (int axis = 0; axis < 3; ++axis)
+		halfStep = std::max(halfStep, dequantization.scale[axis] / 65535.0 / 2.0);
+	for (size_t i = 0; i < surfaceVertexCount; ++i)
+	{
+		double cosine = 0.0;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			worstPositionError = std::max(worstPositionError, std::fabs((double) timedVertices[i].position[axis] - surface[i].position[axis]));
+			cosine += (double) timedVertices[i].normal[axis] * surface[i].normal[axis];
+		}
+		worstNormalDegrees = std::max(worstNormalDegrees, std::acos(std::min(1.0, cosine)) * 180.0 / 3.14159265358979);
+	}
+	std::printf("%-32s %16.4f mm (half a step: %.4f mm)\n", "worst position error", worstPositionError * 1e3, halfStep * 1e3);
+	std::printf("%-32s %16.4f degrees\n", "worst normal error", worstNormalDegrees);
+
+	// Rays from around the surface, as for MeshBvhBenchmark
+	std::mt19937 rayRandom(1);
+	std::vector<TestMeshes::Ray> rays = TestMeshes::MakeRays(rayRandom, rayCount);
+	for (TestMeshes::Ray& ray : rays)
+	{
+		for (int axis = 0; axis < 3; ++axis)
+			ray.origin[axis] *= kSurfaceRadius;
+	}
+
+	MeshBvh floatBvh;
+	const double floatBuildMilliseconds = BestMilliseconds([&]
+	{
+		floatBvh.Build(surface[0].position, sizeof(Vertex), surfaceVertexCount, surfaceIndices.data(), surfaceIndices.size());
+	});
+	const double quantizedBuildMilliseconds = BestMilliseconds([&]
+	{
+		DequantizeVertices(quantizedVertices.data(), surfaceVertexCount, dequantization, dequantizedPositions.data(), nullptr, nullptr, 4 * sizeof(float));
+		quantizedBvh.Build(dequantizedPositions.data(), 4 * sizeof(float), surfaceVertexCount, surfaceIndices.data(), surfaceIndices.size());
+	});
+
+	std::vector<MeshBvh::Hit> floatHits, quantizedHits;
+	const double floatMilliseconds = BestMilliseconds([&] { floatHits = IntersectAll(floatBvh, rays); });
+	const double quantizedMilliseconds = BestMilliseconds([&] { quantizedHits = IntersectAll(quantizedBvh, rays); });
+
+	// Hits found by one BVH only are at the edges of triangles, which quantization moves. The hits of
+	// grazing rays move along the surface by the position error divided by the sine of their angle.
+	size_t hitCount = 0, differentHits = 0, fartherHits = 0;
+	double worstDistanceError = 0.0;
+	for (size_t i = 0; i < rays.size(); ++i)
+	{
+		const bool floatFound = floatHits[i].distance >= 0.0f;
+		const bool quantizedFound = quantizedHits[i].distance >= 0.0f;
+		hitCount += floatFound;
+		if (floatFound != quantizedFound)
+		{
+			differentHits++;
+			continue;
+		}
+		const float* direction = rays[i].direction;
+		const double directionLength = std::sqrt(direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2]);
+		const double distanceError = floatFound ? std::fabs((double) floatHits[i].distance - quantizedHits[i].distance) * directionLength : 0.0;
+		worstDistanceError = std::max(worstDistanceError, distanceError);
+		fartherHits += distanceError > 1e-4;
+	}
+
+	std::printf("%-32s %16s %16s\n", "rays", "build (ms)", "rays/s");
+	std::printf("%-32s %16.3f %16.0f\n", "float positions", floatBuildMilliseconds, rays.size() / floatMilliseconds * 1e3);
+	std::printf("%-32s %16.3f %16.0f\n", "quantized positions", quantizedBuildMilliseconds, rays.size() / quantizedMilliseconds * 1e3);
+	std::printf("%zu rays, %zu hits, %zu found by one BVH only, %zu more than 0.1 mm apart (worst %.4f mm)\n", rays.size(), hitCount, differentHits,
+		fartherHits, worstDistanceError * 1e3);
+	return same ? 0 : 1;
+}
@@ -0,0 +1,204 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// Bits of the surface mesh decoders against the scalar loop that ConvertMesh
+// used to run, for every input value in every lane. Built once per decoding
+// path (see CMakeLists.txt).
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "../Cannon/MeshQuantization.h"
+#include "Check.h"
+
+namespace
+{
+	// Interleaved vertex of the decoders' destination, as Mesh::Vertex: position, normal and texcoord
+	constexpr size_t kVertexStride = 48;
+	constexpr size_t kNormalOffset = 16;
+	constexpr unsigned char kSentinel = 0xcd;
+
+	void DecodePositionReference(const int16_t* source, const float scale[3], float* destination)
+	{
+		const float shortMax = 32768.0f;
+		destination[0] = source[0] / shortMax * scale[0];
+		destination[1] = source[1] / shortMax * scale[1];
+		destination[2] = source[2] / shortMax * scale[2];
+		destination[3] = 1.0f;
+	}
+
+	void DecodeNormalReference(const int8_t* source, float* destination)
+	{
+		const float charMax = 128.0f;
+		destination[0] = source[0] / charMax;
+		destination[1] = source[1] / charMax;
+		destination[2] = source[2] / charMax;
+		destination[3] = 0.0f;
+	}
+
+	// Every int16 value in every lane, then random vertices
+	std::vector<int16_t> MakeSnorm16Source(std::mt19937& random, size_t extraVertexCount)
+	{
+		std::vector<int16_t> source;
+		for (int value = -32768; value <= 32767; ++value)
+		{
+			source.insert(source.end(), { (int16_t) value, (int16_t) ~value, (int16_t) (value * 7919), (int16_t) (value ^ 0x5555) });
+		}
+
+		std::uniform_int_distribution<int> component(-32768, 32767);
+		for (size_t i = 0; i < 4 * extraVertexCount; ++i)
+			source.push_back((int16_t) component(random));
+		return source;
+	}
+
+	std::vector<int8_t> MakeSnorm8Source(std::mt19937& random, size_t extraVertexCount)
+	{
+		std::vector<int8_t> source;
+		for (int value = -128; value <= 127; ++value)
+		{
+			source.insert(source.end(), { (int8_t) value, (int8_t) ~value, (int8_t) (value * 37), (int8_t) (value ^ 0x55) });
+		}
+
+		std::uniform_int_distribution<int> component(-128, 127);
+		for (size_t i = 0; i < 4 * extraVertexCount; ++i)
+			source.push_back((int8_t) component(random));
+		return source;
+	}
+
+	// The decoded floats have the bits of the reference, and the bytes around them are untouched
+	bool CheckVertices(const std::vector<unsigned char>& destination, size_t offset, size_t stride, size_t vertexCount,
+		const std::vector<float>& expected)
+	{
+		bool same = true;
+		for (size_t i = 0; i < destination.size(); ++i)
+		{
+			bool written = i >= offset && (i - offset) / stride < vertexCount && (i - offset) % stride < 4 * sizeof(float);
+			if (written)
+			{
+				size_t vertex = (i - offset) / stride;
+				size_t byte = (i - offset) % stride;
+				same = same && std::memcmp(&destination[i], (const unsigned char*) &expected[4 * vertex] + byte, 1) == 0;
+			}
+			else
+			{
+				same = same && destination[i] == kSentinel;
+			}
+		}
+		return same;
+	}
+
+	void TestPositions()
+	{
+		std::mt19937 random(30);
+		const std::vector<int16_t> source = MakeSnorm16Source(random, 1001);
+		const size_t vertexCount = source.size() / 4;
+
+		const float denormal = std::numeric_limits<float>::denorm_min();
+		const float scales[][3] =
+		{
+			{ 1.0f, 1.0f, 1.0f },
+			{ 3.7f, -0.001f, 12.5f },
+			{ 0.0f, -0.0f, 1e-38f },
+			{ denormal, 3e38f, -3e38f },
+			{ std::numeric_limits<float>::infinity(), 1.0f / 3.0f, 65536.0f }
+		};
+
+		for (const auto& scale : scales)
+		{
+			std::vector<float> expected(4 * vertexCount);
+			for (size_t i = 0; i < vertexCount; ++i)
+				DecodePositionReference(&source[4 * i], scale, &expected[4 * i]);
+
+			// Into the position of Mesh::Vertex, into a packed array, and at an offset that is not 16 byte aligned
+			for (size_t stride : { kVertexStride, 4 * sizeof(float) })
+			{
+				for (size_t offset : { size_t(0), size_t(4) })
+				{
+					std::vector<unsigned char> destination(offset + vertexCount * stride + 32, kSentinel);
+					DecodeSnorm16Positions(source.data(), vertexCount, scale, destination.data() + offset, stride);
+					CHECK(CheckVertices(destination, offset, stride, vertexCount, expected));
+				}
+			}
+
+			// Tails of every length, from a source that is not 16 byte aligned
+			for (size_t count = 0; count <= 9; ++count)
+			{
+				std::vector<unsigned char> destination(count * kVertexStride + 32, kSentinel);
+				DecodeSnorm16Positions(source.data() + 4 * 3, count, scale, destination.data(), kVertexStride);
+				CHECK(CheckVertices(destination, 0, kVertexStride, count, std::vector<float>(expected.begin() + 4 * 3, expected.end())));
+			}
+		}
+	}
+
+	void TestNormals()
+	{
+		std::mt19937 random(31);
+		const std::vector<int8_t> source = MakeSnorm8Source(random, 1003);
+		const size_t vertexCount = source.size() / 4;
+
+		std::vector<float> expected(4 * vertexCount);
+		for (size_t i = 0; i < vertexCount; ++i)
+			DecodeNormalReference(&source[4 * i], &expected[4 * i]);
+
+		for (size_t stride : { kVertexStride, 4 * sizeof(float) })
+		{
+			for (size_t offset : { size_t(0), kNormalOffset, size_t(4) })
+			{
+				std::vector<unsigned char> destination(offset + vertexCount * stride + 32, kSentinel);
+				DecodeSnorm8Normals(source.data(), vertexCount, destination.data() + offset, stride);
+				CHECK(CheckVertices(destination, offset, stride, vertexCount, expected));
+			}
+		}
+
+		for (size_t count = 0; count <= 9; ++count)
+		{
+			std::vector<unsigned char> destination(count * kVertexStride + 32, kSentinel);
+			DecodeSnorm8Normals(source.data() + 4 * 5, count, destination.data() + kNormalOffset, kVertexStride);
+			CHECK(CheckVertices(destination, kNormalOffset, kVertexStride, count, std::vector<float>(expected.begin() + 4 * 5, expected.end())));
+		}
+	}
+
+	void TestIndices()
+	{
+		std::vector<uint16_t> source;
+		for (uint32_t value = 0; value <= 0xffff; ++value)
+			source.push_back((uint16_t) value);
+		source.push_back(0xffff);
+
+		for (size_t first : { size_t(0), size_t(1), size_t(3) })
+		{
+			for (size_t count : { size_t(0), size_t(1), size_t(7), size_t(8), size_t(9), size_t(17), source.size() - first })
+			{
+				std::vector<uint32_t> destination(count + 5, 0xcdcdcdcd);
+				WidenIndices(source.data() + first, count, destination.data());
+
+				bool same = true;
+				for (size_t i = 0; i < count; ++i)
+					same = same && destination[i] == source[first + i];
+				for (size_t i = count; i < destination.size(); ++i)
+					same = same && destination[i] == 0xcdcdcdcd;
+				CHECK(same);
+			}
+		}
+	}
+}
+
+int main()
+{
+	TestPositions();
+	TestNormals();
+	TestIndices();
+
+	return CheckResult();
+}
@@ -0,0 +1,206 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// Load time of an OBJ file as Mesh(std::string) runs it: with the stringstream
+// loader it used to run, with a cold mesh cache (ParseObj, the BVH build and
+// the cache write of a first load) and with a warm one (the cache read of the
+// next loads). The BVH is built with all the hardware threads, as Mesh does.
+// The files are in the operating system cache in every case.
+//
+// ObjLoaderBenchmark [OBJ file] [stress triangle count]
+// Defaults to Media/Meshes/coord_axes.obj (from CMakeLists.txt), and to a
+// stress model of 500000 triangles with texcoords and normals.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../Cannon/Common/MappedFile.h"
+#include "../Cannon/ObjLoader.h"
+#include "TestMeshes.h"
+#include "TestObjs.h"
+
+namespace
+{
+	template <typename Function>
+	double BestMilliseconds(Function function)
+	{
+		double best = 1e30;
+		for (int i = 0; i < 5; ++i)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			function();
+			best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		}
+		return best;
+	}
+
+	// Bumpy sphere with a texcoord and a normal per position, as exported by modeling tools
+	std::string MakeStressObj(size_t triangleCount)
+	{
+		const TestMeshes::Mesh mesh = TestMeshes::MakeBumpySphere(std::max<size_t>(2, (size_t) std::sqrt(triangleCount / 2.0)));
+		std::string text = "# Stress model\no Sphere\n";
+		char line[128];
+		for (size_t i = 0; i < mesh.GetVertexCount(); ++i)
+		{
+			const float* position = mesh.GetPosition((uint32_t) i);
+			std::snprintf(line, sizeof(line), "v %.6f %.6f %.6f\n", position[0], position[1], position[2]);
+			text += line;
+		}
+		for (size_t i = 0; i < mesh.GetVertexCount(); ++i)
+		{
+			const float* position = mesh.GetPosition((uint32_t) i);
+			std::snprintf(line, sizeof(line), "vt %.6f %.6f\n", 0.5f + 0.5f * position[0], 0.5f + 0.5f * position[1]);
+			text += line;
+		}
+		for (size_t i = 0; i < mesh.GetVertexCount(); ++i)
+		{
+			const float* position = mesh.GetPosition((uint32_t) i);
+			const float length = std::sqrt(position[0] * position[0] + position[1] * position[1] + position[2] * position[2]);
+			std::snprintf(line, sizeof(line), "vn %.4f %.4f %.4f\n", position[0] / length, position[1] / length, position[2] / length);
+			text += line;
+		}
+		text += "usemtl None\ns off\n";
+		for (size_t i = 0; i < mesh.indices.size(); i += 3)
+		{
+			const uint32_t a = mesh.indices[i] + 1, b = mesh.indices[i + 1] + 1, c = mesh.indices[i + 2] + 1;
+			std::snprintf(line, sizeof(line), "f %u/%u/%u %u/%u/%u %u/%u/%u\n", a, a, a, b, b, b, c, c, c);
+			text += line;
+		}
+		return text;
+	}
+
+	bool SameMesh(const std::vector<ObjVertex>& vertices, const std::vector<uint32_t>& indices,
+		const std::vector<ObjVertex>& expectedVertices, const std::vector<uint32_t>& expectedIndices)
+	{
+		return vertices.size() == expectedVertices.size() && indices == expectedIndices &&
+			(vertices.empty() || std::memcmp(vertices.data(), expectedVertices.data(), vertices.size() * sizeof(ObjVertex)) == 0);
+	}
+
+	void BuildBvh(const std::vector<ObjVertex>& vertices, const std::vector<uint32_t>& indices, MeshBvh& bvh)
+	{
+		bvh.Build(vertices.empty() ? nullptr : vertices[0].position, sizeof(ObjVertex), vertices.size(), indices.data(), indices.size(),
+			std::max(std::thread::hardware_concurrency(), 1u));
+	}
+
+	// The stringstream loader read the whole file before parsing it
+	void LoadWithoutCache(const std::string& filename, std::vector<ObjVertex>& vertices, std::vector<uint32_t>& indices, MeshBvh& bvh)
+	{
+		MappedFile file;
+		file.Open(filename);
+		const std::string text(reinterpret_cast<const char*>(file.GetData()), file.GetSize());
+		file.Close();
+		TestObjs::ParseObjReference(text, vertices, indices);
+		BuildBvh(vertices, indices, bvh);
+	}
+
+	// Mesh(std::string), without the conversion to Mesh::Vertex
+	bool Load(const std::string& filename, std::vector<ObjVertex>& vertices, std::vector<uint32_t>& indices, MeshBvh& bvh)
+	{
+		MappedFile sourceFile;
+		sourceFile.Open(filename);
+		const uint64_t sourceSize = sourceFile.GetSize();
+		const uint64_t sourceLastWriteTime = sourceFile.GetLastWriteTime();
+
+		const std::string cacheFilename = GetMeshCacheFilename(filename);
+		MappedFile cacheFile;
+		const bool cached = cacheFile.Open(cacheFilename) &&
+			ReadMeshCache(cacheFile.GetData(), cacheFile.GetSize(), sourceSize, sourceLastWriteTime, vertices, indices, bvh);
+		cacheFile.Close();
+		if (cached)
+			return true;
+
+		const bool parsed = ParseObj(reinterpret_cast<const char*>(sourceFile.GetData()), sourceFile.GetSize(), vertices, indices);
+		sourceFile.Close();
+		BuildBvh(vertices, indices, bvh);
+		if (parsed)
+			WriteMeshCache(cacheFilename, sourceSize, sourceLastWriteTime, vertices, indices, bvh);
+		return false;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const std::string objFilename = argc > 1 ? argv[1] : OBJ_LOADER_BENCHMARK_FILE;
+	const size_t stressTriangleCount = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 500000;
+
+	// The files are copied so that their caches are not written next to the originals
+	const std::filesystem::path directory = std::filesystem::temp_directory_path() / "ObjLoaderBenchmark";
+	std::filesystem::remove_all(directory);
+	std::filesystem::create_directories(directory);
+	std::vector<std::filesystem::path> filenames;
+	if (std::filesystem::exists(objFilename))
+	{
+		filenames.push_back(directory / std::filesystem::path(objFilename).filename());
+		std::filesystem::copy_file(objFilename, filenames.back());
+	}
+	else
+	{
+		std::printf("%s not found\n", objFilename.c_str());
+	}
+	filenames.push_back(directory / "stress.obj");
+	{
+		const std::string text = MakeStressObj(stressTriangleCount);
+		FILE* file = std::fopen(filenames.back().string().c_str(), "wb");
+		if (file)
+		{
+			std::fwrite(text.data(), 1, text.size(), file);
+			std::fclose(file);
+		}
+	}
+
+	bool same = true;
+	std::printf("%-36s %12s %12s %12s %12s\n", "file", "vertices", "triangles", "size (MB)", "cache (MB)");
+	std::vector<double> results;
+	for (const std::filesystem::path& path : filenames)
+	{
+		const std::string filename = path.string();
+		const std::string cacheFilename = GetMeshCacheFilename(filename);
+
+		std::vector<ObjVertex> referenceVertices, vertices;
+		std::vector<uint32_t> referenceIndices, indices;
+		MeshBvh referenceBvh, bvh;
+		const double referenceMilliseconds = BestMilliseconds([&] { LoadWithoutCache(filename, referenceVertices, referenceIndices, referenceBvh); });
+
+		bool cold = true;
+		const double coldMilliseconds = BestMilliseconds([&]
+		{
+			std::filesystem::remove(cacheFilename);
+			cold = !Load(filename, vertices, indices, bvh) && cold;
+		});
+		same = same && cold && SameMesh(vertices, indices, referenceVertices, referenceIndices);
+
+		bool warm = true;
+		const double warmMilliseconds = BestMilliseconds([&] { warm = Load(filename, vertices, indices, bvh) && warm; });
+		same = same && warm && SameMesh(vertices, indices, referenceVertices, referenceIndices) && bvh.GetTriangleCount() == indices.size() / 3;
+
+		std::printf("%-36s %12zu %12zu %12.2f %12.2f\n", path.filename().string().c_str(), vertices.size(), indices.size() / 3,
+			std::filesystem::file_size(path) / 1e6, std::filesystem::file_size(cacheFilename) / 1e6);
+		results.insert(results.end(), { referenceMilliseconds, coldMilliseconds, warmMilliseconds });
+	}
+
+	std::printf("\n%-36s %12s %12s %12s\n", "load (ms)", "stringstream", "cold cache", "warm cache");
+	for (size_t i = 0; i < filenames.size(); ++i)
+		std::printf("%-36s %12.3f %12.3f %12.3f\n", filenames[i].filename().string().c_str(), results[3 * i], results[3 * i + 1], results[3 * i + 2]);
+	if (!same)
+		std::printf("(different results)\n");
+
+	std::filesystem::remove_all(directory);
+	return same ? 0 : 1;
+}
@@ -0,0 +1,279 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// Bytes of ParseObj against the stringstream loader that Mesh used to run, and
+// the mesh cache: read back as parsed, and rejected or consistent when it is
+// truncated or has flipped bits.
+//
+// ObjLoaderTests [OBJ file]
+// The OBJ file (Media/Meshes/coord_axes.obj from CMakeLists.txt) is checked
+// along with the generated ones.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../Cannon/Common/MappedFile.h"
+#include "../Cannon/ObjLoader.h"
+#include "Check.h"
+#include "TestObjs.h"
+
+namespace
+{
+	bool SameMesh(const std::vector<ObjVertex>& vertices, const std::vector<uint32_t>& indices,
+		const std::vector<ObjVertex>& expectedVertices, const std::vector<uint32_t>& expectedIndices)
+	{
+		return vertices.size() == expectedVertices.size() && indices == expectedIndices &&
+			(vertices.empty() || std::memcmp(vertices.data(), expectedVertices.data(), vertices.size() * sizeof(ObjVertex)) == 0);
+	}
+
+	std::string FormatFloat(std::mt19937& random, float value)
+	{
+		static const char* const kFormats[] = { "%f", "%.9g", "%.3g", "%e", "%.2E", "%.0f", "%+.7f" };
+		char text[64];
+		std::snprintf(text, sizeof(text), kFormats[random() % (sizeof(kFormats) / sizeof(kFormats[0]))], value);
+		return text;
+	}
+
+	// Triangles whose corners are shared, in the face formats that both loaders read, with comments, other
+	// statements, spaces and CRLF line ends. The last line has no line end.
+	std::string MakeObj(std::mt19937& random, size_t triangleCount)
+	{
+		std::uniform_real_distribution<float> coordinate(-100.0f, 100.0f);
+		std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+		std::uniform_real_distribution<float> exponent(-6.0f, 6.0f);
+
+		const size_t positionCount = triangleCount / 2 + 3;
+		const size_t texcoordCount = triangleCount / 3 + 1;
+		const size_t normalCount = triangleCount / 4 + 1;
+
+		std::string text = "# Generated\no Soup\n";
+		for (size_t i = 0; i < positionCount; ++i)
+		{
+			const float scale = std::pow(10.0f, exponent(random));
+			text += "v " + FormatFloat(random, coordinate(random) * scale) + " " + FormatFloat(random, coordinate(random)) + "\t" +
+				FormatFloat(random, coordinate(random) / scale) + (i % 7 == 0 ? "\r\n" : "\n");
+		}
+		for (size_t i = 0; i < texcoordCount; ++i)
+			text += "vt " + FormatFloat(random, unit(random) + 1.0f) + " " + FormatFloat(random, unit(random)) + "\n";
+		text += "\n  # Normals\n";
+		for (size_t i = 0; i < normalCount; ++i)
+			text += "vn " + FormatFloat(random, unit(random)) + " " + FormatFloat(random, unit(random)) + " " + FormatFloat(random, unit(random)) + "\n";
+
+		text += "usemtl None\ns off\n";
+		for (size_t i = 0; i < triangleCount; ++i)
+		{
+			text += i % 5 == 0 ? "  f" : "f";
+			const unsigned format = random() % 3;
+			for (int corner = 0; corner < 3; ++corner)
+			{
+				const std::string position = std::to_string(1 + random() % positionCount);
+				const std::string texcoord = std::to_string(1 + random() % texcoordCount);
+				const std::string normal = std::to_string(1 + random() % normalCount);
+				if (format == 0)
+					text += " " + position + "/" + texcoord + "/" + normal;
+				else if (format == 1)
+					text += " " + position + "//" + normal;
+				else
+					text += " " + position + "/" + texcoord;
+			}
+			if (i + 1 < triangleCount)
+				text += i % 11 == 0 ? " \r\n" : "\n";
+		}
+		return text;
+	}
+
+	void TestParse(const std::vector<std::string>& objs)
+	{
+		for (const std::string& text : objs)
+		{
+			std::vector<ObjVertex> expectedVertices, vertices;
+			std::vector<uint32_t> expectedIndices, indices;
+			TestObjs::ParseObjReference(text, expectedVertices, expectedIndices);
+			CHECK(ParseObj(text.data(), text.size(), vertices, indices));
+			CHECK(SameMesh(vertices, indices, expectedVertices, expectedIndices));
+		}
+	}
+
+	void TestPolygonsAndRelativeIndices()
+	{
+		// A quad is split in a fan, negative indices count back from the last element, the texcoord and normal can be left out
+		const std::string text =
+			"v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\n"
+			"vt 0.25 0.75\nvn 0 0 1\n"
+			"f 1/1/1 2/1/1 3/1/1 4/1/1\n"
+			"f -4 -3//-1 -2/-1\n";
+		std::vector<ObjVertex> vertices;
+		std::vector<uint32_t> indices;
+		CHECK(ParseObj(text.data(), text.size(), vertices, indices));
+		CHECK(indices == std::vector<uint32_t>({ 2, 1, 0, 3, 2, 0, 6, 5, 4 }));
+		CHECK(vertices.size() == 7);
+		if (vertices.size() == 7)
+		{
+			CHECK(vertices[3].position[0] == 0.0f && vertices[3].position[1] == 1.0f && vertices[3].position[3] == 1.0f);
+			CHECK(vertices[3].texcoord[0] == 0.25f && vertices[3].texcoord[1] == 0.25f && vertices[3].normal[2] == 1.0f);
+			CHECK(vertices[4].position[0] == 0.0f && vertices[4].texcoord[1] == 0.0f && vertices[4].normal[2] == 0.0f);
+			CHECK(vertices[5].position[0] == 1.0f && vertices[5].normal[2] == 1.0f && vertices[5].normal[3] == 0.0f);
+			CHECK(vertices[6].position[1] == 1.0f && vertices[6].texcoord[0] == 0.25f && vertices[6].normal[2] == 0.0f);
+		}
+
+		// References to elements that do not exist
+		for (const char* face : { "f 5 1 2\n", "f 0 1 2\n", "f -5 1 2\n", "f 1/2 2/1 3/1\n", "f 1//2 2//1 3//1\n", "f 1 2 x\n" })
+		{
+			const std::string badText = "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nvt 0 0\nvn 0 0 1\n" + std::string(face);
+			CHECK(!ParseObj(badText.data(), badText.size(), vertices, indices));
+		}
+	}
+
+	void BuildBvh(const std::vector<ObjVertex>& vertices, const std::vector<uint32_t>& indices, MeshBvh& bvh)
+	{
+		bvh.Build(vertices.empty() ? nullptr : vertices[0].position, sizeof(ObjVertex), vertices.size(), indices.data(), indices.size());
+	}
+
+	std::vector<unsigned char> Serialize(const MeshBvh& bvh)
+	{
+		std::vector<unsigned char> buffer(bvh.GetSerializedSize());
+		unsigned char* pWritePtr = buffer.data();
+		bvh.WriteToBuffer(&pWritePtr);
+		return buffer;
+	}
+
+	// The cache of the parsed OBJ, written to a file and mapped as Mesh does
+	std::vector<unsigned char> WriteCache(const std::string& text, uint64_t sourceSize, uint64_t sourceLastWriteTime)
+	{
+		std::vector<ObjVertex> vertices;
+		std::vector<uint32_t> indices;
+		ParseObj(text.data(), text.size(), vertices, indices);
+		MeshBvh bvh;
+		BuildBvh(vertices, indices, bvh);
+
+		const std::string filename = GetMeshCacheFilename("ObjLoaderTests.obj");
+		CHECK(WriteMeshCache(filename, sourceSize, sourceLastWriteTime, vertices, indices, bvh));
+		MappedFile cacheFile;
+		CHECK(cacheFile.Open(filename));
+		std::vector<unsigned char> cache(cacheFile.GetData(), cacheFile.GetData() + cacheFile.GetSize());
+		cacheFile.Close();
+		std::remove(filename.c_str());
+		return cache;
+	}
+
+	void TestCache(const std::vector<std::string>& objs)
+	{
+		for (const std::string& text : objs)
+		{
+			std::vector<ObjVertex> parsedVertices, vertices;
+			std::vector<uint32_t> parsedIndices, indices;
+			ParseObj(text.data(), text.size(), parsedVertices, parsedIndices);
+			MeshBvh parsedBvh, bvh;
+			BuildBvh(parsedVertices, parsedIndices, parsedBvh);
+
+			const std::vector<unsigned char> cache = WriteCache(text, text.size(), 0x1d2c3b4a59687706ull);
+			CHECK(ReadMeshCache(cache.data(), cache.size(), text.size(), 0x1d2c3b4a59687706ull, vertices, indices, bvh));
+			CHECK(SameMesh(vertices, indices, parsedVertices, parsedIndices));
+			CHECK(Serialize(bvh) == Serialize(parsedBvh));
+
+			// A source of another size or last write time
+			CHECK(!ReadMeshCache(cache.data(), cache.size(), text.size() + 1, 0x1d2c3b4a59687706ull, vertices, indices, bvh));
+			CHECK(!ReadMeshCache(cache.data(), cache.size(), text.size(), 0x1d2c3b4a59687707ull, vertices, indices, bvh));
+			CHECK(vertices.empty() && indices.empty() && bvh.IsEmpty());
+		}
+	}
+
+	// Truncated caches are rejected. With a flipped bit, a cache is rejected or gives a mesh whose indices, BVH and
+	// ray queries stay within its vertices; the header is always checked.
+	void TestCorruptCache(const std::vector<std::string>& objs)
+	{
+		const size_t kHeaderSize = 40;
+		std::mt19937 random(40);
+		for (const std::string& text : objs)
+		{
+			const std::vector<unsigned char> cache = WriteCache(text, text.size(), 1);
+			std::vector<ObjVertex> vertices;
+			std::vector<uint32_t> indices;
+			MeshBvh bvh;
+
+			bool truncatedRejected = true;
+			for (size_t size = 0; size < cache.size(); ++size)
+			{
+				std::vector<unsigned char> truncated(cache.begin(), cache.begin() + size);
+				truncatedRejected = truncatedRejected && !ReadMeshCache(truncated.data(), truncated.size(), text.size(), 1, vertices, indices, bvh);
+				truncatedRejected = truncatedRejected && vertices.empty() && indices.empty() && bvh.IsEmpty();
+			}
+			CHECK(truncatedRejected);
+
+			bool headerRejected = true;
+			bool consistent = true;
+			size_t acceptedCount = 0;
+			// Every bit of the header, and about 20000 bits of the rest
+			const size_t maxStep = std::max<size_t>(1, 8 * cache.size() / 10000);
+			std::vector<unsigned char> corrupt = cache;
+			for (size_t bit = 0; bit < 8 * cache.size(); bit += bit < 8 * kHeaderSize ? 1 : 1 + random() % maxStep)
+			{
+				corrupt[bit / 8] ^= 1 << (bit % 8);
+				bool accepted = ReadMeshCache(corrupt.data(), corrupt.size(), text.size(), 1, vertices, indices, bvh);
+				corrupt[bit / 8] ^= 1 << (bit % 8);
+
+				if (bit < 8 * kHeaderSize)
+				{
+					headerRejected = headerRejected && !accepted;
+					continue;
+				}
+				if (!accepted)
+					continue;
+
+				++acceptedCount;
+				consistent = consistent && bvh.GetTriangleCount() == indices.size() / 3;
+				for (uint32_t index : indices)
+					consistent = consistent && index < vertices.size();
+
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					const float origin[3] = { axis == 0 ? -1e4f : 0.0f, axis == 1 ? -1e4f : 0.0f, axis == 2 ? -1e4f : 0.0f };
+					const float direction[3] = { axis == 0 ? 1.0f : 0.0f, axis == 1 ? 1.0f : 0.0f, axis == 2 ? 1.0f : 0.0f };
+					MeshBvh::Hit hit;
+					if (bvh.Intersect(origin, direction, hit))
+						consistent = consistent && hit.triangleIndex < indices.size() / 3;
+				}
+			}
+			CHECK(headerRejected);
+			CHECK(consistent);
+			CHECK(acceptedCount > 0);
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::vector<std::string> objs;
+	std::mt19937 random(41);
+	for (size_t triangleCount : { 1, 2, 3, 10, 100, 1000 })
+		objs.push_back(MakeObj(random, triangleCount));
+
+	if (argc > 1)
+	{
+		MappedFile file;
+		CHECK(file.Open(argv[1]));
+		objs.push_back(std::string(reinterpret_cast<const char*>(file.GetData()), file.GetSize()));
+	}
+
+	TestParse(objs);
+	TestPolygonsAndRelativeIndices();
+	TestCache(objs);
+	TestCorruptCache(objs);
+
+	return CheckResult();
+}
@@ -0,0 +1,77 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// Bytes allocated through operator new by all the threads, and their peak since the last ResetPeak, for the
+// benchmarks. It replaces the global operator new and delete, so it is included by one file of an executable only.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace PeakMemory
+{
+	inline std::atomic<size_t>& CurrentBytes() { static std::atomic<size_t> bytes(0); return bytes; }
+	inline std::atomic<size_t>& PeakBytes() { static std::atomic<size_t> bytes(0); return bytes; }
+
+	inline size_t GetCurrentBytes() { return CurrentBytes().load(); }
+	inline size_t GetPeakBytes() { return PeakBytes().load(); }
+	inline void ResetPeak() { PeakBytes().store(CurrentBytes().load()); }
+
+	// The size is kept in front of the block, in a header that keeps the alignment of the block
+	inline void* Allocate(size_t size, size_t alignment)
+	{
+		const size_t header = alignment > alignof(std::max_align_t) ? alignment : alignof(std::max_align_t);
+		unsigned char* block = static_cast<unsigned char*>(std::malloc(size + 2 * header));
+		if (!block)
+			throw std::bad_alloc();
+
+		// malloc only aligns to max_align_t, the offset moves the block to the next multiple of alignment
+		size_t offset = header;
+		while ((reinterpret_cast<size_t>(block) + offset) % header != 0)
+			offset += alignof(std::max_align_t);
+		unsigned char* data = block + offset;
+		reinterpret_cast<size_t*>(data)[-1] = size;
+		reinterpret_cast<size_t*>(data)[-2] = offset;
+
+		const size_t current = CurrentBytes().fetch_add(size) + size;
+		size_t peak = PeakBytes().load();
+		while (current > peak && !PeakBytes().compare_exchange_weak(peak, current))
+		{
+		}
+		return data;
+	}
+
+	inline void Free(void* pointer)
+	{
+		if (!pointer)
+			return;
+
+		unsigned char* data = static_cast<unsigned char*>(pointer);
+		CurrentBytes().fetch_sub(reinterpret_cast<size_t*>(data)[-1]);
+		std::free(data - reinterpret_cast<size_t*>(data)[-2]);
+	}
+}
+
+void* operator new(size_t size) { return PeakMemory::Allocate(size, alignof(std::max_align_t)); }
+void* operator new[](size_t size) { return PeakMemory::Allocate(size, alignof(std::max_align_t)); }
+void* operator new(size_t size, std::align_val_t alignment) { return PeakMemory::Allocate(size, static_cast<size_t>(alignment)); }
+void* operator new[](size_t size, std::align_val_t alignment) { return PeakMemory::Allocate(size, static_cast<size_t>(alignment)); }
+void operator delete(void* pointer) noexcept { PeakMemory::Free(pointer); }
+void operator delete[](void* pointer) noexcept { PeakMemory::Free(pointer); }
+void operator delete(void* pointer, size_t) noexcept { PeakMemory::Free(pointer); }
+void operator delete[](void* pointer, size_t) noexcept { PeakMemory::Free(pointer); }
+void operator delete(void* pointer, std::align_val_t) noexcept { PeakMemory::Free(pointer); }
+void operator delete[](void* pointer, std::align_val_t) noexcept { PeakMemory::Free(pointer); }
+void operator delete(void* pointer, size_t, std::align_val_t) noexcept { PeakMemory::Free(pointer); }
+void operator delete[](void* pointer, size_t, std::align_val_t) noexcept { PeakMemory::Free(pointer); }
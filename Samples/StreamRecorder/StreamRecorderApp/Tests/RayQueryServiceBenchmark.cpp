@@ -0,0 +1,177 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// Time per frame of the ray queries of a frame, issued as individual calls
+// (each one taking the latest SceneBvh snapshot, as the separate
+// TestRayIntersection calls of AppMain did) and as a RayQueryService batch,
+// executed on the calling thread or dispatched to the worker thread and read
+// the next frame. For 3 rays per frame (gaze, head and hand) up to 4096, and
+// at most 200000 rays per batch size.
+//
+// RayQueryServiceBenchmark [frame count] [surface count]
+// Defaults to 2000 frames, against 300 surfaces of about 2000 triangles in a
+// 40 m wide space, with the rays of a frame from around one head position.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "../Cannon/RayQueryService.h"
+#include "TestMeshes.h"
+
+namespace
+{
+	const float kSpaceSize = 40.0f;
+
+	template <typename Function>
+	double BestMilliseconds(Function function)
+	{
+		double best = 1e30;
+		for (int i = 0; i < 5; ++i)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			function();
+			best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		}
+		return best;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const size_t frameCount = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000;
+	const size_t surfaceCount = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 300;
+
+	std::vector<std::shared_ptr<const MeshBvh>> bvhs;
+	for (size_t i = 0; i < 4; ++i)
+	{
+		const TestMeshes::Mesh mesh = TestMeshes::MakeBumpySphere(31 + i);
+		auto bvh = std::make_shared<MeshBvh>();
+		bvh->Build(mesh.vertices.data(), mesh.GetStride(), mesh.GetVertexCount(), mesh.indices.data(), mesh.indices.size());
+		bvhs.push_back(bvh);
+	}
+
+	std::mt19937 random(0);
+	std::uniform_real_distribution<float> position(-kSpaceSize / 2, kSpaceSize / 2);
+	std::uniform_real_distribution<float> scale(0.5f, 2.0f);
+	std::uniform_real_distribution<float> spread(-0.5f, 0.5f);
+
+	SceneBvh scene;
+	for (size_t i = 0; i < surfaceCount; ++i)
+	{
+		float localToWorld[16] = {};
+		const float surfaceScale = scale(random);
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			localToWorld[5 * axis] = surfaceScale;
+			localToWorld[12 + axis] = position(random);
+		}
+		localToWorld[15] = 1.0f;
+		scene.AddInstance(bvhs[i % bvhs.size()], localToWorld);
+	}
+	scene.Commit();
+
+	std::printf("%zu frames, %zu surfaces\n", frameCount, surfaceCount);
+	std::printf("%-14s %18s %18s %18s %12s\n", "rays/frame", "individual (us)", "execute (us)", "dispatch (us)", "rays/s");
+	for (const size_t frameRayCount : { 3, 16, 256, 4096 })
+	{
+		// The rays of a frame start around the head and go in a cone around its forward direction
+		const size_t frames = std::max<size_t>(1, std::min(frameCount, 200000 / frameRayCount));
+		std::vector<SceneBvh::Ray> rays(frames * frameRayCount);
+		for (size_t frame = 0; frame < frames; ++frame)
+		{
+			float head[3], forward[3];
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				head[axis] = position(random);
+				forward[axis] = position(random) - head[axis];
+			}
+
+			for (size_t i = 0; i < frameRayCount; ++i)
+			{
+				SceneBvh::Ray& ray = rays[frame * frameRayCount + i];
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					ray.origin[axis] = head[axis] + 0.1f * spread(random);
+					ray.direction[axis] = forward[axis] + kSpaceSize * spread(random);
+				}
+				ray.maxDistance = std::numeric_limits<float>::max();
+				ray.mode = i % 4 == 3 ? SceneBvh::HitMode::Any : SceneBvh::HitMode::Closest;
+			}
+		}
+
+		size_t individualHits = 0, executeHits = 0, dispatchHits = 0;
+		const double individualMilliseconds = BestMilliseconds([&]
+		{
+			individualHits = 0;
+			for (const SceneBvh::Ray& ray : rays)
+			{
+				SceneBvh::Hit hit;
+				individualHits += scene.GetSnapshot()->Intersect(ray.origin, ray.direction, hit, ray.mode, ray.maxDistance);
+			}
+		});
+
+		RayQueryService service(scene);
+		std::vector<RayQueryService::Handle> handles(frameRayCount);
+		const double executeMilliseconds = BestMilliseconds([&]
+		{
+			executeHits = 0;
+			for (size_t frame = 0; frame < frames; ++frame)
+			{
+				for (size_t i = 0; i < frameRayCount; ++i)
+				{
+					const SceneBvh::Ray& ray = rays[frame * frameRayCount + i];
+					handles[i] = service.Submit(ray.origin, ray.direction, ray.mode, ray.maxDistance);
+				}
+				service.Execute();
+
+				SceneBvh::Hit hit;
+				for (RayQueryService::Handle handle : handles)
+					executeHits += service.GetResult(handle, hit);
+			}
+		});
+
+		// The results of a frame are read during the next one, after its rays are submitted
+		const double dispatchMilliseconds = BestMilliseconds([&]
+		{
+			dispatchHits = 0;
+			std::vector<RayQueryService::Handle> previousHandles;
+			for (size_t frame = 0; frame <= frames; ++frame)
+			{
+				for (size_t i = 0; i < frameRayCount && frame < frames; ++i)
+				{
+					const SceneBvh::Ray& ray = rays[frame * frameRayCount + i];
+					handles[i] = service.Submit(ray.origin, ray.direction, ray.mode, ray.maxDistance);
+				}
+
+				SceneBvh::Hit hit;
+				for (RayQueryService::Handle handle : previousHandles)
+					dispatchHits += service.GetResult(handle, hit);
+
+				service.Dispatch();
+				previousHandles = handles;
+			}
+		});
+
+		const bool sameHits = individualHits == executeHits && individualHits == dispatchHits;
+		std::printf("%-14zu %18.2f %18.2f %18.2f %12.0f%s\n", frameRayCount, individualMilliseconds * 1e3 / frames,
+			executeMilliseconds * 1e3 / frames, dispatchMilliseconds * 1e3 / frames, rays.size() / executeMilliseconds * 1e3,
+			sameHits ? "" : "  (different hits)");
+	}
+
+	return 0;
+}
@@ -0,0 +1,222 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// Results of the batches of RayQueryService, dispatched to its worker thread
+// or executed on the calling thread, against single ray queries of the
+// snapshot they were traversed against.
+
+#include <limits>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "../Cannon/RayQueryService.h"
+#include "Check.h"
+#include "TestMeshes.h"
+
+namespace
+{
+	// Meshes translated around the origin
+	class TestScene
+	{
+	public:
+		TestScene()
+		{
+			std::mt19937 random(20);
+			m_meshes.push_back(TestMeshes::MakeBumpySphere(16));
+			m_meshes.push_back(TestMeshes::MakeTriangleSoup(random, 200, 0.3f));
+			for (const TestMeshes::Mesh& mesh : m_meshes)
+			{
+				auto bvh = std::make_shared<MeshBvh>();
+				bvh->Build(mesh.vertices.data(), mesh.GetStride(), mesh.GetVertexCount(), mesh.indices.data(), mesh.indices.size());
+				m_bvhs.push_back(bvh);
+			}
+
+			std::uniform_real_distribution<float> position(-4.0f, 4.0f);
+			for (int i = 0; i < 12; ++i)
+			{
+				float localToWorld[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, position(random), position(random), position(random), 1 };
+				m_instances.push_back(m_scene.AddInstance(m_bvhs[i % 2], localToWorld));
+			}
+			m_scene.Commit();
+		}
+
+		SceneBvh& GetScene() { return m_scene; }
+
+		void Move(std::mt19937& random)
+		{
+			std::uniform_real_distribution<float> position(-4.0f, 4.0f);
+			for (size_t i = 0; i < m_instances.size(); i += 3)
+			{
+				float localToWorld[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, position(random), position(random), position(random), 1 };
+				m_scene.UpdateInstance(m_instances[i], m_bvhs[i % 2], localToWorld);
+			}
+			m_scene.Commit();
+		}
+
+		void RemoveAll()
+		{
+			for (uint32_t instance : m_instances)
+				m_scene.RemoveInstance(instance);
+			m_instances.clear();
+			m_scene.Commit();
+		}
+
+	private:
+		std::vector<TestMeshes::Mesh> m_meshes;
+		std::vector<std::shared_ptr<const MeshBvh>> m_bvhs;
+		std::vector<uint32_t> m_instances;
+		SceneBvh m_scene;
+	};
+
+	// Rays between points of [-10, 10]^3 and of [-4, 4]^3, in both modes and with distance ranges that end in it
+	std::vector<SceneBvh::Ray> MakeQueries(std::mt19937& random, size_t rayCount)
+	{
+		std::vector<SceneBvh::Ray> queries;
+		for (const TestMeshes::Ray& ray : TestMeshes::MakeRays(random, rayCount))
+		{
+			SceneBvh::Ray query;
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				query.origin[axis] = 4.0f * ray.origin[axis];
+				query.direction[axis] = 4.0f * ray.direction[axis];
+			}
+			query.maxDistance = queries.size() % 3 == 0 ? 1.0f + queries.size() % 5 : std::numeric_limits<float>::max();
+			query.mode = queries.size() % 2 == 0 ? SceneBvh::HitMode::Closest : SceneBvh::HitMode::Any;
+			queries.push_back(query);
+		}
+		return queries;
+	}
+
+	std::vector<RayQueryService::Handle> Submit(RayQueryService& service, const std::vector<SceneBvh::Ray>& queries)
+	{
+		std::vector<RayQueryService::Handle> handles;
+		for (const SceneBvh::Ray& query : queries)
+			handles.push_back(service.Submit(query.origin, query.direction, query.mode, query.maxDistance));
+		return handles;
+	}
+
+	// The results of the handles are those of the queries one at a time. Returns the hit count.
+	size_t CheckResults(RayQueryService& service, const std::vector<RayQueryService::Handle>& handles,
+		const std::vector<SceneBvh::Ray>& queries, const SceneBvh::Snapshot& snapshot)
+	{
+		size_t hitCount = 0;
+		for (size_t i = 0; i < queries.size(); ++i)
+		{
+			const SceneBvh::Ray& query = queries[i];
+			SceneBvh::Hit expected = {}, hit = {};
+			bool expectedFound = snapshot.Intersect(query.origin, query.direction, expected, query.mode, query.maxDistance);
+			bool found = service.GetResult(handles[i], hit);
+			CHECK(found == expectedFound);
+			if (!found || !expectedFound)
+				continue;
+
+			++hitCount;
+			CHECK(hit.distance == expected.distance && hit.instance == expected.instance && hit.triangleIndex == expected.triangleIndex);
+			CHECK(hit.normal[0] == expected.normal[0] && hit.normal[1] == expected.normal[1] && hit.normal[2] == expected.normal[2]);
+		}
+		return hitCount;
+	}
+
+	void TestDispatchAndExecute()
+	{
+		TestScene testScene;
+		SceneBvh& scene = testScene.GetScene();
+		RayQueryService service(scene);
+		std::mt19937 random(21);
+
+		// Results are only there once dispatched
+		std::vector<SceneBvh::Ray> queries = MakeQueries(random, 500);
+		std::vector<RayQueryService::Handle> handles = Submit(service, queries);
+		SceneBvh::Hit hit;
+		CHECK(!service.GetResult(handles[0], hit));
+		CHECK(!service.GetResult(RayQueryService::kInvalidHandle, hit));
+
+		service.Dispatch();
+		CHECK(CheckResults(service, handles, queries, *scene.GetSnapshot()) > queries.size() / 10);
+
+		// Executed on this thread
+		std::vector<SceneBvh::Ray> executedQueries = MakeQueries(random, 300);
+		std::vector<RayQueryService::Handle> executedHandles = Submit(service, executedQueries);
+		service.Execute();
+		CHECK(CheckResults(service, executedHandles, executedQueries, *scene.GetSnapshot()) > 0);
+
+		// The handles of the previous batches are stale
+		for (RayQueryService::Handle handle : handles)
+			CHECK(!service.GetResult(handle, hit));
+
+		// Empty batches
+		service.Dispatch();
+		for (RayQueryService::Handle handle : executedHandles)
+			CHECK(!service.GetResult(handle, hit));
+		service.Execute();
+	}
+
+	void TestSnapshotOfDispatch()
+	{
+		TestScene testScene;
+		SceneBvh& scene = testScene.GetScene();
+		RayQueryService service(scene);
+		std::mt19937 random(22);
+
+		// A dispatched batch is traversed against the snapshot of the dispatch, whatever is committed since
+		std::shared_ptr<const SceneBvh::Snapshot> snapshot = scene.GetSnapshot();
+		std::vector<SceneBvh::Ray> queries = MakeQueries(random, 500);
+		std::vector<RayQueryService::Handle> handles = Submit(service, queries);
+		service.Dispatch();
+		testScene.RemoveAll();
+		CHECK(CheckResults(service, handles, queries, *snapshot) > 0);
+
+		handles = Submit(service, queries);
+		service.Dispatch();
+		CHECK(CheckResults(service, handles, queries, *scene.GetSnapshot()) == 0);
+	}
+
+	void TestFrames()
+	{
+		// A batch per frame, read the next frame while the scene changes
+		TestScene testScene;
+		SceneBvh& scene = testScene.GetScene();
+		std::mt19937 random(23);
+		size_t hitCount = 0;
+		{
+			RayQueryService service(scene);
+			std::vector<SceneBvh::Ray> previousQueries;
+			std::vector<RayQueryService::Handle> previousHandles;
+			std::shared_ptr<const SceneBvh::Snapshot> previousSnapshot;
+			for (int frame = 0; frame < 50; ++frame)
+			{
+				if (previousSnapshot)
+					hitCount += CheckResults(service, previousHandles, previousQueries, *previousSnapshot);
+
+				previousQueries = MakeQueries(random, 100 + 37 * (frame % 4));
+				previousHandles = Submit(service, previousQueries);
+				previousSnapshot = scene.GetSnapshot();
+				service.Dispatch();
+				testScene.Move(random);
+			}
+
+			// Destroyed with a batch in flight
+			previousHandles = Submit(service, MakeQueries(random, 1000));
+			service.Dispatch();
+		}
+		CHECK(hitCount > 0);
+	}
+}
+
+int main()
+{
+	TestDispatchAndExecute();
+	TestSnapshotOfDispatch();
+	TestFrames();
+
+	return CheckResult();
+}
@@ -0,0 +1,284 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// The draws of a frame made immediately, as DrawCall::Draw does, and through
+// the RenderQueue of DrawCall::Submit and FlushRenderQueue: the Direct3D calls
+// that each makes, and the CPU time of what runs without Direct3D (the shader
+// constants of the draws, the copies of their instances and the queue).
+//
+// Draw sets the shaders, constants, instance buffer and mesh buffers for every
+// draw, and the render states when the stacks change them (counted here when
+// they differ from the previous draw). The queue sets what changed since the
+// previous batch, and uploads the instances of all the batches at once.
+//
+// The draws are those of a scene of objects that share a few meshes, shaders
+// and render states, submitted in scene order. Most are drawn at their
+// instance transforms and can be merged, one in four has its own world
+// transform, and the last one in twenty are blended and keep their order.
+//
+// RenderQueueBenchmark [frame count]
+// Defaults to 20 frames of 250, 1000 and 4000 draws, with 50 meshes, 6 shader
+// sets and 3 render states.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "../Cannon/RenderQueue.h"
+#include "../Cannon/ShaderConstants.h"
+#include "TestConstants.h"
+
+namespace
+{
+	const size_t kMeshCount = 50;
+	const size_t kShaderCount = 6;
+	const size_t kStateCount = 3;
+
+	// The single pass stereo vertex shader and the pixel shader of TestConstants::MakeLayouts
+	const size_t kDrawLayouts[] = { 0, 2 };
+
+	// Layout of DrawCall::Instance
+	struct Instance
+	{
+		float worldTransform[16];
+		float color[4];
+	};
+
+	// A draw call of the scene, with its cached draw constants
+	struct Draw
+	{
+		uint64_t stateKey;
+		uint64_t shaderKey;
+		uint64_t meshKey;
+		bool ordered;
+		DrawConstants::Inputs constants;
+		DrawConstants drawConstants;
+		std::vector<Instance> instances;
+	};
+
+	// What each path sets
+	struct Counts
+	{
+		size_t drawCount;
+		size_t stateChangeCount;
+		size_t shaderChangeCount;
+		size_t meshChangeCount;
+		size_t constantUploadCount;
+		size_t instanceUploadCount;
+	};
+
+	template <typename Function>
+	double BestMilliseconds(Function function)
+	{
+		double best = 1e30;
+		for (int i = 0; i < 5; ++i)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			function();
+			best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		}
+		return best;
+	}
+
+	std::vector<Draw> MakeScene(std::mt19937& random, size_t drawCount)
+	{
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		DrawConstants::Inputs sharedConstants;
+		TestConstants::MakeObject(random, false, sharedConstants);
+		std::memset(sharedConstants.world, 0, sizeof(sharedConstants.world));
+		for (int i = 0; i < 4; ++i)
+			sharedConstants.world[5 * i] = 1.0f;
+
+		std::vector<Draw> draws(drawCount);
+		for (size_t i = 0; i < drawCount; ++i)
+		{
+			Draw& draw = draws[i];
+			const size_t mesh = random() % kMeshCount;
+			draw.meshKey = 1000 + mesh;
+			draw.shaderKey = mesh % kShaderCount;
+			draw.ordered = i >= drawCount - drawCount / 20;
+			draw.stateKey = draw.ordered ? kStateCount : random() % kStateCount;
+			if (i % 4 == 3)
+				TestConstants::MakeObject(random, false, draw.constants);
+			else
+				draw.constants = sharedConstants;
+
+			draw.instances.resize(1 + random() % 3);
+			for (Instance& instance : draw.instances)
+			{
+				TestConstants::MakeRigidTransform(random, 0.5f + unit(random), instance.worldTransform);
+				for (float& component : instance.color)
+					component = unit(random);
+			}
+		}
+		return draws;
+	}
+
+	size_t WriteConstants(const std::vector<TestConstants::Layout>& layouts, const FrameConstants& frameConstants, const DrawConstants& drawConstants,
+		std::vector<std::vector<unsigned char>>& stagings)
+	{
+		size_t changedCount = 0;
+		for (size_t layout : kDrawLayouts)
+		{
+			const std::vector<Constant>& constants = layouts[layout].constants;
+			changedCount += WriteShaderConstants(constants.data(), constants.size(), frameConstants, drawConstants, 0, stagings[layout].data());
+		}
+		return changedCount;
+	}
+
+	// DrawCall::Draw: everything but the render states is set again for each draw
+	void DrawImmediately(std::vector<Draw>& draws, const std::vector<TestConstants::Layout>& layouts, const FrameConstants& frameConstants,
+		std::vector<std::vector<unsigned char>>& stagings, std::vector<unsigned char>& instanceBuffer, Counts& counts)
+	{
+		counts = {};
+		for (size_t i = 0; i < draws.size(); ++i)
+		{
+			Draw& draw = draws[i];
+			counts.stateChangeCount += i == 0 || draw.stateKey != draws[i - 1].stateKey;
+			counts.shaderChangeCount++;
+			draw.drawConstants.Update(draw.constants, frameConstants);
+			counts.constantUploadCount += WriteConstants(layouts, frameConstants, draw.drawConstants, stagings);
+			std::memcpy(instanceBuffer.data(), draw.instances.data(), draw.instances.size() * sizeof(Instance));
+			counts.instanceUploadCount++;
+			counts.meshChangeCount++;
+			counts.drawCount++;
+		}
+	}
+
+	void Submit(const std::vector<Draw>& draws, RenderQueue& queue)
+	{
+		for (size_t i = 0; i < draws.size(); ++i)
+		{
+			const Draw& draw = draws[i];
+			RenderQueue::Submission submission;
+			submission.stateKey = draw.stateKey;
+			submission.shaderKey = draw.shaderKey;
+			submission.meshKey = draw.meshKey;
+			submission.ordered = draw.ordered;
+			submission.constants = &draw.constants;
+			submission.constantsSize = sizeof(draw.constants);
+			submission.instances = draw.instances.data();
+			submission.instanceCount = draw.instances.size();
+			submission.instanceStride = sizeof(Instance);
+			submission.userData = i;
+			queue.Submit(submission);
+		}
+	}
+
+	// DrawCall::Submit and FlushRenderQueue
+	void DrawQueued(std::vector<Draw>& draws, RenderQueue& queue, const std::vector<TestConstants::Layout>& layouts, const FrameConstants& frameConstants,
+		std::vector<std::vector<unsigned char>>& stagings, std::vector<unsigned char>& instanceBuffer, Counts& counts)
+	{
+		Submit(draws, queue);
+		queue.Build();
+		const std::vector<unsigned char>& instanceData = queue.GetInstanceData();
+		if (instanceBuffer.size() < instanceData.size())
+			instanceBuffer.resize(instanceData.size());
+		std::memcpy(instanceBuffer.data(), instanceData.data(), instanceData.size());
+
+		counts = {};
+		for (const RenderQueue::Batch& batch : queue.GetBatches())
+		{
+			if (batch.changes & (RenderQueue::kShaderChanged | RenderQueue::kConstantsChanged))
+			{
+				DrawConstants& drawConstants = draws[batch.userData].drawConstants;
+				drawConstants.Update(*static_cast<const DrawConstants::Inputs*>(batch.constants), frameConstants);
+				counts.constantUploadCount += WriteConstants(layouts, frameConstants, drawConstants, stagings);
+			}
+			counts.drawCount++;
+		}
+
+		const RenderQueue::Statistics& statistics = queue.GetStatistics();
+		counts.stateChangeCount = statistics.stateChangeCount;
+		counts.shaderChangeCount = statistics.shaderChangeCount;
+		counts.meshChangeCount = statistics.meshChangeCount;
+		counts.instanceUploadCount = instanceData.empty() ? 0 : 1;
+		queue.Clear();
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const size_t frameCount = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20;
+
+	const std::vector<TestConstants::Layout> layouts = TestConstants::MakeLayouts();
+	std::vector<std::vector<unsigned char>> stagings;
+	for (const TestConstants::Layout& layout : layouts)
+		stagings.push_back(std::vector<unsigned char>(layout.size, 0));
+
+	// The head moves on every frame, which changes the constants of every draw
+	std::mt19937 random(50);
+	FrameConstants::Inputs frameInputs[2] = {};
+	for (FrameConstants::Inputs& inputs : frameInputs)
+	{
+		TestConstants::MakeHead(random, inputs);
+		TestConstants::MakeLights(random, inputs);
+	}
+	FrameConstants frameConstants;
+
+	std::printf("%zu frames, %zu meshes, %zu shader sets, %zu render states\n", frameCount, kMeshCount, kShaderCount, kStateCount);
+	std::printf("%-8s %-10s %10s %10s %10s %10s %12s %12s %14s %14s\n", "draws", "", "draw calls", "states", "shaders", "meshes", "constants", "instances",
+		"CPU (us)", "queue (us)");
+	for (const size_t drawCount : { 250, 1000, 4000 })
+	{
+		std::vector<Draw> draws = MakeScene(random, drawCount);
+		std::vector<unsigned char> instanceBuffer(3 * sizeof(Instance));
+		RenderQueue queue;
+
+		Counts immediateCounts = {}, queuedCounts = {};
+		const double immediateMilliseconds = BestMilliseconds([&]
+		{
+			for (size_t frame = 0; frame < frameCount; ++frame)
+			{
+				frameConstants.Update(frameInputs[frame % 2]);
+				DrawImmediately(draws, layouts, frameConstants, stagings, instanceBuffer, immediateCounts);
+			}
+		});
+		const double queuedMilliseconds = BestMilliseconds([&]
+		{
+			for (size_t frame = 0; frame < frameCount; ++frame)
+			{
+				frameConstants.Update(frameInputs[frame % 2]);
+				DrawQueued(draws, queue, layouts, frameConstants, stagings, instanceBuffer, queuedCounts);
+			}
+		});
+
+		// Of which the submissions, sorting and merging of the queue
+		const double sortMilliseconds = BestMilliseconds([&]
+		{
+			for (size_t frame = 0; frame < frameCount; ++frame)
+			{
+				Submit(draws, queue);
+				queue.Build();
+				queue.Clear();
+			}
+		});
+
+		const char* const names[] = { "immediate", "queue" };
+		const Counts* const counts[] = { &immediateCounts, &queuedCounts };
+		const double milliseconds[] = { immediateMilliseconds, queuedMilliseconds };
+		const double queueMilliseconds[] = { 0.0, sortMilliseconds };
+		for (int path = 0; path < 2; ++path)
+		{
+			std::printf("%-8zu %-10s %10zu %10zu %10zu %10zu %12zu %12zu %14.1f %14.1f\n", drawCount, names[path], counts[path]->drawCount,
+				counts[path]->stateChangeCount, counts[path]->shaderChangeCount, counts[path]->meshChangeCount,
+				counts[path]->constantUploadCount, counts[path]->instanceUploadCount, milliseconds[path] * 1e3 / frameCount,
+				queueMilliseconds[path] * 1e3 / frameCount);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,307 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// Invariants of the batches that RenderQueue builds from random submissions:
+// every submitted instance is drawn exactly once, with the keys and constants
+// of its submission, the ordered submissions are drawn in submission order, and
+// no submission is moved across an ordered one, which is a barrier to sorting.
+
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "../Cannon/RenderQueue.h"
+#include "Check.h"
+
+namespace
+{
+	// The first bytes of each instance tell which one it is
+	struct InstanceTag
+	{
+		uint32_t submission;
+		uint32_t instance;
+	};
+
+	struct TestSubmission
+	{
+		RenderQueue::Submission submission;
+		std::vector<unsigned char> constants;
+	};
+
+	// Few distinct keys and constants so that many submissions can be merged, and ordered ones alone or in runs
+	std::vector<TestSubmission> MakeSubmissions(std::mt19937& random, size_t count)
+	{
+		std::vector<TestSubmission> submissions(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			RenderQueue::Submission& submission = submissions[i].submission;
+			submission.stateKey = random() % 4;
+			submission.shaderKey = random() % 3;
+			submission.meshKey = 1000 + random() % 5;
+			submission.ordered = random() % 8 == 0 || (i > 0 && submissions[i - 1].submission.ordered && random() % 2 == 0);
+
+			// No constants, or one of a few values of 16 or 32 bytes
+			const size_t constantsSize = (random() % 3) * 16;
+			const unsigned char value = (unsigned char) (random() % 3);
+			submissions[i].constants.assign(constantsSize, value);
+
+			submission.instanceCount = 1 + random() % 4;
+			submission.instanceStride = random() % 4 == 0 ? 16 : sizeof(InstanceTag);
+			submission.userData = i;
+		}
+		return submissions;
+	}
+
+	void Submit(RenderQueue& queue, std::vector<TestSubmission>& submissions)
+	{
+		std::vector<unsigned char> instances;
+		for (size_t i = 0; i < submissions.size(); ++i)
+		{
+			RenderQueue::Submission& submission = submissions[i].submission;
+			instances.assign(submission.instanceCount * submission.instanceStride, 0xcd);
+			for (size_t instance = 0; instance < submission.instanceCount; ++instance)
+			{
+				const InstanceTag tag = { (uint32_t) i, (uint32_t) instance };
+				std::memcpy(&instances[instance * submission.instanceStride], &tag, sizeof(tag));
+			}
+
+			// The caller's copies are overwritten once submitted
+			std::vector<unsigned char> constants = submissions[i].constants;
+			submission.constants = constants.empty() ? nullptr : constants.data();
+			submission.constantsSize = constants.size();
+			submission.instances = instances.data();
+			queue.Submit(submission);
+			std::memset(constants.data(), 0xee, constants.size());
+			std::memset(instances.data(), 0xee, instances.size());
+		}
+	}
+
+	bool SameConstants(const RenderQueue::Batch& batch, const TestSubmission& submission)
+	{
+		if (submission.constants.empty())
+			return batch.constants == nullptr;
+		return batch.constants && std::memcmp(batch.constants, submission.constants.data(), submission.constants.size()) == 0;
+	}
+
+	void CheckBatches(const RenderQueue& queue, const std::vector<TestSubmission>& submissions)
+	{
+		const std::vector<RenderQueue::Batch>& batches = queue.GetBatches();
+		const std::vector<unsigned char>& instanceData = queue.GetInstanceData();
+
+		// The instances in drawing order, and the batches laid out back to back
+		std::vector<InstanceTag> drawn;
+		bool contiguous = true;
+		bool matchingBatches = true;
+		bool tagsValid = true;
+		size_t instanceOffset = 0;
+		for (size_t b = 0; b < batches.size(); ++b)
+		{
+			const RenderQueue::Batch& batch = batches[b];
+			contiguous = contiguous && batch.instanceOffset == instanceOffset && batch.instanceCount > 0;
+			instanceOffset += batch.instanceCount * batch.instanceStride;
+
+			bool batchOrdered = false;
+			for (size_t i = 0; contiguous && i < batch.instanceCount; ++i)
+			{
+				InstanceTag tag;
+				std::memcpy(&tag, &instanceData[batch.instanceOffset + i * batch.instanceStride], sizeof(tag));
+				tagsValid = tagsValid && tag.submission < submissions.size() && tag.instance < submissions[tag.submission].submission.instanceCount;
+				if (!tagsValid)
+					break;
+
+				// Each instance is in a batch with the keys, constants and stride of its submission, ordered and
+				// unordered submissions are not merged, and the batch returns the user data of its first submission
+				const TestSubmission& submission = submissions[tag.submission];
+				matchingBatches = matchingBatches && batch.stateKey == submission.submission.stateKey &&
+					batch.shaderKey == submission.submission.shaderKey && batch.meshKey == submission.submission.meshKey &&
+					batch.instanceStride == submission.submission.instanceStride && SameConstants(batch, submission);
+				if (i == 0)
+				{
+					matchingBatches = matchingBatches && batch.userData == submission.submission.userData;
+					batchOrdered = submission.submission.ordered;
+				}
+				matchingBatches = matchingBatches && submission.submission.ordered == batchOrdered;
+
+				// The bytes after the tag are copied too
+				for (size_t byte = sizeof(tag); byte < batch.instanceStride; ++byte)
+					tagsValid = tagsValid && instanceData[batch.instanceOffset + i * batch.instanceStride + byte] == 0xcd;
+
+				drawn.push_back(tag);
+			}
+		}
+		CHECK(contiguous && instanceOffset == instanceData.size());
+		CHECK(tagsValid);
+		CHECK(matchingBatches);
+		if (!contiguous || !tagsValid)
+			return;
+
+		// Every instance exactly once, in submission order within a submission
+		std::vector<std::vector<size_t>> positions(submissions.size());
+		for (size_t position = 0; position < drawn.size(); ++position)
+			positions[drawn[position].submission].push_back(position);
+
+		bool everyInstanceOnce = true;
+		for (size_t i = 0; i < submissions.size(); ++i)
+		{
+			const std::vector<size_t>& submissionPositions = positions[i];
+			everyInstanceOnce = everyInstanceOnce && submissionPositions.size() == submissions[i].submission.instanceCount;
+			for (size_t instance = 0; everyInstanceOnce && instance < submissionPositions.size(); ++instance)
+			{
+				everyInstanceOnce = drawn[submissionPositions[instance]].instance == instance &&
+					(instance == 0 || submissionPositions[instance] == submissionPositions[instance - 1] + 1);
+			}
+		}
+		CHECK(everyInstanceOnce);
+		if (!everyInstanceOnce)
+			return;
+
+		// The ordered submissions are drawn in submission order, and the others stay between the same ordered ones
+		bool orderedKept = true;
+		bool barriersKept = true;
+		size_t previousOrderedEnd = 0;
+		size_t previousOrdered = submissions.size();
+		for (size_t i = 0; i < submissions.size(); ++i)
+		{
+			if (!submissions[i].submission.ordered)
+				continue;
+
+			orderedKept = orderedKept && positions[i].front() >= previousOrderedEnd;
+			for (size_t j = previousOrdered == submissions.size() ? 0 : previousOrdered + 1; j < i; ++j)
+				barriersKept = barriersKept && positions[j].front() >= previousOrderedEnd && positions[j].back() < positions[i].front();
+
+			previousOrderedEnd = positions[i].back() + 1;
+			previousOrdered = i;
+		}
+		for (size_t j = previousOrdered == submissions.size() ? 0 : previousOrdered + 1; j < submissions.size(); ++j)
+			barriersKept = barriersKept && positions[j].front() >= previousOrderedEnd;
+		CHECK(orderedKept);
+		CHECK(barriersKept);
+
+		// Between two ordered submissions, the batches are sorted by state (fewest state changes), and no two
+		// consecutive batches could have been merged
+		bool sorted = true;
+		bool merged = true;
+		for (size_t b = 1; b < batches.size(); ++b)
+		{
+			const RenderQueue::Batch& batch = batches[b];
+			const RenderQueue::Batch& previous = batches[b - 1];
+			const TestSubmission& first = submissions[batch.userData];
+			const TestSubmission& previousFirst = submissions[previous.userData];
+			if (!first.submission.ordered && !previousFirst.submission.ordered)
+				sorted = sorted && previous.stateKey <= batch.stateKey;
+
+			bool sameConstants = first.constants == previousFirst.constants;
+			merged = merged && !(batch.stateKey == previous.stateKey && batch.shaderKey == previous.shaderKey && batch.meshKey == previous.meshKey &&
+				batch.instanceStride == previous.instanceStride && sameConstants && first.submission.ordered == previousFirst.submission.ordered);
+		}
+		CHECK(sorted);
+		CHECK(merged);
+
+		// What changed since the previous batch, and the statistics
+		bool changesValid = batches.empty() || batches[0].changes == RenderQueue::kAllChanged;
+		RenderQueue::Statistics expected = {};
+		expected.submissionCount = submissions.size();
+		expected.batchCount = batches.size();
+		for (size_t b = 0; b < batches.size(); ++b)
+		{
+			uint32_t changes = RenderQueue::kAllChanged;
+			if (b > 0)
+			{
+				const RenderQueue::Batch& batch = batches[b];
+				const RenderQueue::Batch& previous = batches[b - 1];
+				changes = (batch.stateKey != previous.stateKey ? (uint32_t) RenderQueue::kStateChanged : 0u) |
+					(batch.shaderKey != previous.shaderKey ? (uint32_t) RenderQueue::kShaderChanged : 0u) |
+					(batch.meshKey != previous.meshKey ? (uint32_t) RenderQueue::kMeshChanged : 0u) |
+					(submissions[batch.userData].constants != submissions[previous.userData].constants ? (uint32_t) RenderQueue::kConstantsChanged : 0u);
+				changesValid = changesValid && batch.changes == changes;
+			}
+			expected.stateChangeCount += (changes & RenderQueue::kStateChanged) ? 1 : 0;
+			expected.shaderChangeCount += (changes & RenderQueue::kShaderChanged) ? 1 : 0;
+			expected.meshChangeCount += (changes & RenderQueue::kMeshChanged) ? 1 : 0;
+			expected.constantsChangeCount += (changes & RenderQueue::kConstantsChanged) ? 1 : 0;
+		}
+		const RenderQueue::Statistics& statistics = queue.GetStatistics();
+		CHECK(changesValid);
+		CHECK(statistics.submissionCount == expected.submissionCount && statistics.batchCount == expected.batchCount &&
+			statistics.stateChangeCount == expected.stateChangeCount && statistics.shaderChangeCount == expected.shaderChangeCount &&
+			statistics.meshChangeCount == expected.meshChangeCount && statistics.constantsChangeCount == expected.constantsChangeCount);
+	}
+
+	void TestRandomSubmissions()
+	{
+		// One queue flushed and reused, as DrawCall does, with nothing left from the previous flushes
+		RenderQueue queue;
+		std::mt19937 random(60);
+		for (size_t count : { 1, 2, 3, 10, 50, 200, 1000, 5000 })
+		{
+			for (int repeat = 0; repeat < 4; ++repeat)
+			{
+				std::vector<TestSubmission> submissions = MakeSubmissions(random, count);
+				Submit(queue, submissions);
+				CHECK(queue.GetSubmissionCount() == count);
+				queue.Build();
+				CheckBatches(queue, submissions);
+				queue.Clear();
+				CHECK(queue.IsEmpty() && queue.GetBatches().empty() && queue.GetInstanceData().empty());
+			}
+		}
+
+		// Built again without any change
+		std::vector<TestSubmission> submissions = MakeSubmissions(random, 300);
+		Submit(queue, submissions);
+		queue.Build();
+		const std::vector<unsigned char> instanceData = queue.GetInstanceData();
+		const size_t batchCount = queue.GetBatches().size();
+		queue.Build();
+		CHECK(queue.GetInstanceData() == instanceData && queue.GetBatches().size() == batchCount);
+		CheckBatches(queue, submissions);
+		queue.Clear();
+	}
+
+	void TestMerging()
+	{
+		RenderQueue queue;
+		std::mt19937 random(61);
+
+		// Interleaved opaque submissions of two meshes become one batch each, and consecutive ordered ones are merged
+		std::vector<TestSubmission> submissions = MakeSubmissions(random, 8);
+		for (size_t i = 0; i < submissions.size(); ++i)
+		{
+			RenderQueue::Submission& submission = submissions[i].submission;
+			submission.stateKey = i < 6 ? 0 : 4;
+			submission.shaderKey = 0;
+			submission.meshKey = i < 6 ? 1 + i % 2 : 3;
+			submission.ordered = i >= 6;
+			submission.instanceStride = sizeof(InstanceTag);
+			submissions[i].constants.assign(16, 7);
+		}
+		Submit(queue, submissions);
+		queue.Build();
+		CheckBatches(queue, submissions);
+		const std::vector<RenderQueue::Batch>& batches = queue.GetBatches();
+		CHECK(batches.size() == 3);
+		if (batches.size() == 3)
+		{
+			CHECK(batches[0].meshKey == 1 && batches[1].meshKey == 2 && batches[2].meshKey == 3);
+			CHECK(batches[1].changes == RenderQueue::kMeshChanged);
+			CHECK(batches[2].changes == (RenderQueue::kStateChanged | RenderQueue::kMeshChanged));
+		}
+	}
+}
+
+int main()
+{
+	TestRandomSubmissions();
+	TestMerging();
+
+	return CheckResult();
+}
@@ -0,0 +1,197 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// Closest hits per second of a SceneBvh snapshot, against the linear scan of
+// the surfaces that SurfaceMapping used to run (every mesh BVH tested with the
+// ray moved to its space), for 10 to 1000 surfaces, and the commit time.
+//
+// SceneBvhBenchmark [ray count] [triangles per surface]
+// Defaults to 20000 rays, and surfaces of about 2000 triangles scattered in a
+// 40 m wide space, with the rays between random points of that space.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../Cannon/SceneBvh.h"
+#include "TestMeshes.h"
+
+namespace
+{
+	const float kSpaceSize = 40.0f;
+
+	template <typename Function>
+	double BestMilliseconds(Function function)
+	{
+		double best = 1e30;
+		for (int i = 0; i < 5; ++i)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			function();
+			best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		}
+		return best;
+	}
+
+	// Scaled and translated surface: world = local * scale + translation
+	struct Surface
+	{
+		std::shared_ptr<const MeshBvh> bvh;
+		float scale;
+		float translation[3];
+
+		// Row vectors, as SceneBvh takes them
+		void GetLocalToWorld(float localToWorld[16]) const
+		{
+			std::fill(localToWorld, localToWorld + 16, 0.0f);
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				localToWorld[5 * axis] = scale;
+				localToWorld[12 + axis] = translation[axis];
+			}
+			localToWorld[15] = 1.0f;
+		}
+	};
+
+	bool IntersectLinearScan(const std::vector<Surface>& surfaces, const SceneBvh::Ray& ray, float& distance)
+	{
+		bool found = false;
+		distance = ray.maxDistance;
+		for (const Surface& surface : surfaces)
+		{
+			// The direction is scaled as the origin, so that the distances are world space ones
+			float origin[3], direction[3];
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				origin[axis] = (ray.origin[axis] - surface.translation[axis]) / surface.scale;
+				direction[axis] = ray.direction[axis] / surface.scale;
+			}
+
+			MeshBvh::Hit hit;
+			if (surface.bvh->Intersect(origin, direction, hit, MeshBvh::HitMode::Closest, MeshBvh::Culling::BackFaces, distance))
+			{
+				distance = hit.distance;
+				found = true;
+			}
+		}
+		return found;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const size_t rayCount = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20000;
+	const size_t surfaceTriangleCount = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 2000;
+
+	// A few different surface meshes, shared by the instances
+	std::vector<std::shared_ptr<const MeshBvh>> bvhs;
+	for (size_t i = 0; i < 4; ++i)
+	{
+		const TestMeshes::Mesh mesh = TestMeshes::MakeBumpySphere(std::max<size_t>(2, static_cast<size_t>(std::sqrt(surfaceTriangleCount / 2.0)) + i));
+		auto bvh = std::make_shared<MeshBvh>();
+		bvh->Build(mesh.vertices.data(), mesh.GetStride(), mesh.GetVertexCount(), mesh.indices.data(), mesh.indices.size());
+		bvhs.push_back(bvh);
+	}
+
+	std::mt19937 random(0);
+	std::uniform_real_distribution<float> position(-kSpaceSize / 2, kSpaceSize / 2);
+	std::uniform_real_distribution<float> scale(0.5f, 2.0f);
+	std::vector<SceneBvh::Ray> rays(rayCount);
+	for (SceneBvh::Ray& ray : rays)
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			ray.origin[axis] = position(random);
+			ray.direction[axis] = position(random) - ray.origin[axis];
+		}
+		ray.maxDistance = std::numeric_limits<float>::max();
+		ray.mode = SceneBvh::HitMode::Closest;
+	}
+
+	std::printf("%zu rays, %zu triangles per surface\n", rays.size(), bvhs[0]->GetTriangleCount());
+	std::printf("%-10s %14s %14s %10s %12s %10s\n", "surfaces", "linear rays/s", "bvh rays/s", "speedup", "commit (ms)", "hits");
+	for (const size_t surfaceCount : { 10, 30, 100, 300, 1000 })
+	{
+		std::vector<Surface> surfaces(surfaceCount);
+		SceneBvh scene;
+		for (size_t i = 0; i < surfaceCount; ++i)
+		{
+			Surface& surface = surfaces[i];
+			surface.bvh = bvhs[i % bvhs.size()];
+			surface.scale = scale(random);
+			for (int axis = 0; axis < 3; ++axis)
+				surface.translation[axis] = position(random);
+
+			float localToWorld[16];
+			surface.GetLocalToWorld(localToWorld);
+			scene.AddInstance(surface.bvh, localToWorld);
+		}
+
+		// Rebuilt from scratch every time, as after adding all the surfaces
+		const double commitMilliseconds = BestMilliseconds([&]
+		{
+			SceneBvh rebuiltScene;
+			for (const Surface& surface : surfaces)
+			{
+				float localToWorld[16];
+				surface.GetLocalToWorld(localToWorld);
+				rebuiltScene.AddInstance(surface.bvh, localToWorld);
+			}
+			rebuiltScene.Commit();
+		});
+		scene.Commit();
+		std::shared_ptr<const SceneBvh::Snapshot> snapshot = scene.GetSnapshot();
+
+		size_t bvhHits = 0, differentHits = 0;
+		const double linearMilliseconds = BestMilliseconds([&]
+		{
+			for (const SceneBvh::Ray& ray : rays)
+			{
+				float distance;
+				IntersectLinearScan(surfaces, ray, distance);
+			}
+		});
+		const double bvhMilliseconds = BestMilliseconds([&]
+		{
+			bvhHits = 0;
+			for (const SceneBvh::Ray& ray : rays)
+			{
+				SceneBvh::Hit hit;
+				bvhHits += snapshot->Intersect(ray.origin, ray.direction, hit, ray.mode, ray.maxDistance);
+			}
+		});
+
+		// Both find the same closest hits, up to the rounding of the ray transforms (0.1 mm)
+		for (const SceneBvh::Ray& ray : rays)
+		{
+			float distance;
+			SceneBvh::Hit hit;
+			bool linearFound = IntersectLinearScan(surfaces, ray, distance);
+			bool bvhFound = snapshot->Intersect(ray.origin, ray.direction, hit, ray.mode, ray.maxDistance);
+			float directionLength = std::sqrt(ray.direction[0] * ray.direction[0] + ray.direction[1] * ray.direction[1] + ray.direction[2] * ray.direction[2]);
+			if (linearFound != bvhFound || (bvhFound && std::fabs(hit.distance - distance) * directionLength > 1e-4f))
+				differentHits++;
+		}
+
+		std::printf("%-10zu %14.0f %14.0f %10.2f %12.3f %10s\n", surfaceCount, rays.size() / linearMilliseconds * 1e3,
+			rays.size() / bvhMilliseconds * 1e3, linearMilliseconds / bvhMilliseconds, commitMilliseconds,
+			differentHits ? (std::to_string(bvhHits) + " (" + std::to_string(differentHits) + " different)").c_str() : std::to_string(bvhHits).c_str());
+	}
+
+	return 0;
+}
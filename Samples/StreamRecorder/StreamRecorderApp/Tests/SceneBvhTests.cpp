@@ -0,0 +1,367 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// Hits of SceneBvh snapshots against a linear loop over the world space
+// triangles of all the instances, as the instances are added, moved and
+// removed between commits.
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "../Cannon/SceneBvh.h"
+#include "Check.h"
+#include "TestMeshes.h"
+
+namespace
+{
+	constexpr size_t kNoTriangle = std::numeric_limits<size_t>::max();
+
+	// Instances of a few meshes, and the same instances as one world space triangle list
+	class TestScene
+	{
+	public:
+		TestScene()
+		{
+			std::mt19937 random(10);
+			m_meshes.push_back(TestMeshes::MakeTriangleSoup(random, 300, 0.2f));
+			m_meshes.push_back(TestMeshes::MakeBumpySphere(12));
+			m_meshes.push_back(TestMeshes::MakeTriangleSoup(random, 3, 1.0f));
+			for (const TestMeshes::Mesh& mesh : m_meshes)
+			{
+				auto bvh = std::make_shared<MeshBvh>();
+				bvh->Build(mesh.vertices.data(), mesh.GetStride(), mesh.GetVertexCount(), mesh.indices.data(), mesh.indices.size());
+				m_bvhs.push_back(bvh);
+			}
+		}
+
+		SceneBvh& GetScene() { return m_scene; }
+
+		// Rotated, scaled (and mirrored) mesh around position
+		uint32_t Add(std::mt19937& random, size_t mesh, const float position[3], bool mirrored)
+		{
+			Record record;
+			record.mesh = mesh;
+			record.live = true;
+			MakeTransform(random, position, mirrored, record.localToWorld);
+			uint32_t instance = m_scene.AddInstance(m_bvhs[mesh], record.localToWorld);
+			if (instance >= m_records.size())
+				m_records.resize(instance + 1);
+			CHECK(!m_records[instance].live);
+			m_records[instance] = record;
+			return instance;
+		}
+
+		void Move(uint32_t instance, const float offset[3])
+		{
+			Record& record = m_records[instance];
+			for (int axis = 0; axis < 3; ++axis)
+				record.localToWorld[12 + axis] += offset[axis];
+			m_scene.UpdateInstance(instance, m_bvhs[record.mesh], record.localToWorld);
+		}
+
+		void Remove(uint32_t instance)
+		{
+			m_records[instance].live = false;
+			m_scene.RemoveInstance(instance);
+		}
+
+		std::vector<uint32_t> GetLiveInstances() const
+		{
+			std::vector<uint32_t> instances;
+			for (uint32_t instance = 0; instance < m_records.size(); ++instance)
+			{
+				if (m_records[instance].live)
+					instances.push_back(instance);
+			}
+			return instances;
+		}
+
+		// The live instances in world space. firstTriangles[instance] is the world triangle of its first triangle.
+		TestMeshes::Mesh GetWorldMesh(std::vector<size_t>& firstTriangles) const
+		{
+			TestMeshes::Mesh world;
+			firstTriangles.assign(m_records.size(), kNoTriangle);
+			for (uint32_t instance = 0; instance < m_records.size(); ++instance)
+			{
+				const Record& record = m_records[instance];
+				if (!record.live)
+					continue;
+
+				const TestMeshes::Mesh& mesh = m_meshes[record.mesh];
+				const float* m = record.localToWorld;
+				uint32_t firstVertex = static_cast<uint32_t>(world.GetVertexCount());
+				for (uint32_t vertex = 0; vertex < mesh.GetVertexCount(); ++vertex)
+				{
+					const float* p = mesh.GetPosition(vertex);
+					world.AddVertex(p[0] * m[0] + p[1] * m[4] + p[2] * m[8] + m[12],
+						p[0] * m[1] + p[1] * m[5] + p[2] * m[9] + m[13],
+						p[0] * m[2] + p[1] * m[6] + p[2] * m[10] + m[14]);
+				}
+
+				firstTriangles[instance] = world.indices.size() / 3;
+				for (uint32_t index : mesh.indices)
+					world.indices.push_back(firstVertex + index);
+			}
+			return world;
+		}
+
+	private:
+		struct Record
+		{
+			size_t mesh = 0;
+			float localToWorld[16] = {};
+			bool live = false;
+		};
+
+		// Row vector matrix, world = (local, 1) * localToWorld: rows are the images of the local axes
+		static void MakeTransform(std::mt19937& random, const float position[3], bool mirrored, float localToWorld[16])
+		{
+			std::normal_distribution<double> normal;
+			std::uniform_real_distribution<double> scale(0.5, 2.0);
+			double q[4] = { normal(random), normal(random), normal(random), normal(random) };
+			double length = std::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+			for (double& value : q)
+				value /= length;
+
+			double w = q[0], x = q[1], y = q[2], z = q[3];
+			double rotation[3][3] = {
+				{ 1 - 2 * (y * y + z * z), 2 * (x * y - w * z), 2 * (x * z + w * y) },
+				{ 2 * (x * y + w * z), 1 - 2 * (x * x + z * z), 2 * (y * z - w * x) },
+				{ 2 * (x * z - w * y), 2 * (y * z + w * x), 1 - 2 * (x * x + y * y) } };
+
+			std::memset(localToWorld, 0, 16 * sizeof(float));
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				double axisScale = scale(random) * (mirrored && axis == 0 ? -1.0 : 1.0);
+				for (int column = 0; column < 3; ++column)
+					localToWorld[axis * 4 + column] = (float) (rotation[column][axis] * axisScale);
+				localToWorld[12 + axis] = position[axis];
+			}
+			localToWorld[15] = 1.0f;
+		}
+
+		std::vector<TestMeshes::Mesh> m_meshes;
+		std::vector<std::shared_ptr<const MeshBvh>> m_bvhs;
+		std::vector<Record> m_records;		// Indexed by instance
+		SceneBvh m_scene;
+	};
+
+	// Rays between points of [-10, 10]^3 and of [-4, 4]^3
+	std::vector<TestMeshes::Ray> MakeSceneRays(std::mt19937& random, size_t rayCount)
+	{
+		std::vector<TestMeshes::Ray> rays = TestMeshes::MakeRays(random, rayCount);
+		for (TestMeshes::Ray& ray : rays)
+		{
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				ray.origin[axis] *= 4.0f;
+				ray.direction[axis] *= 4.0f;
+			}
+		}
+		return rays;
+	}
+
+	// Checks the hits of a snapshot against the brute-force loop over the world triangles. Returns the hit count.
+	size_t CheckSnapshot(const SceneBvh::Snapshot& snapshot, const TestMeshes::Mesh& world, const std::vector<size_t>& firstTriangles,
+		const std::vector<TestMeshes::Ray>& rays)
+	{
+		using TestMeshes::DistanceTolerance;
+		using TestMeshes::kMargin;
+
+		size_t hitCount = 0;
+		std::vector<SceneBvh::Ray> batch;
+		std::vector<SceneBvh::Hit> singleHits;
+		for (size_t i = 0; i < rays.size(); ++i)
+		{
+			const TestMeshes::Ray& ray = rays[i];
+			for (SceneBvh::HitMode mode : { SceneBvh::HitMode::Closest, SceneBvh::HitMode::Any })
+			{
+				float maxDistance = (i % 3 == 0) ? 0.5f * (i % 5) : std::numeric_limits<float>::max();
+				SceneBvh::Hit hit = {};
+				bool found = snapshot.Intersect(ray.origin, ray.direction, hit, mode, maxDistance);
+
+				// Backfaces are culled in world space, mirrored instances included
+				double innerDistance = 0.0, outerDistance = 0.0;
+				bool innerFound = TestMeshes::IntersectReference(world, ray, MeshBvh::HitMode::Closest, MeshBvh::Culling::BackFaces,
+					maxDistance, -kMargin, innerDistance);
+				bool outerFound = TestMeshes::IntersectReference(world, ray, MeshBvh::HitMode::Closest, MeshBvh::Culling::BackFaces,
+					maxDistance, kMargin, outerDistance);
+
+				batch.push_back({ { ray.origin[0], ray.origin[1], ray.origin[2] }, { ray.direction[0], ray.direction[1], ray.direction[2] }, maxDistance, mode });
+				if (!found)
+				{
+					CHECK(!innerFound);
+					hit.distance = maxDistance;
+					hit.instance = SceneBvh::kInvalidInstance;
+					singleHits.push_back(hit);
+					continue;
+				}
+
+				singleHits.push_back(hit);
+				++hitCount;
+				CHECK(outerFound);
+				CHECK(hit.instance < firstTriangles.size() && firstTriangles[hit.instance] != kNoTriangle);
+				if (!(hit.instance < firstTriangles.size() && firstTriangles[hit.instance] != kNoTriangle))
+					continue;
+
+				// The hit triangle is hit there, with its world space front face normal
+				size_t triangle = firstTriangles[hit.instance] + hit.triangleIndex;
+				double triangleDistance = 0.0;
+				CHECK(triangle < world.indices.size() / 3 &&
+					TestMeshes::IntersectTriangle(world, triangle, ray, MeshBvh::Culling::BackFaces, maxDistance, kMargin, triangleDistance) &&
+					std::fabs(triangleDistance - hit.distance) <= DistanceTolerance(triangleDistance));
+				if (triangle < world.indices.size() / 3)
+				{
+					double normal[3];
+					TestMeshes::GetFrontFaceNormal(world, triangle, normal);
+					for (int axis = 0; axis < 3; ++axis)
+						CHECK(std::fabs(hit.normal[axis] - normal[axis]) <= 1e-3);
+				}
+
+				if (mode == SceneBvh::HitMode::Closest)
+				{
+					CHECK(hit.distance >= outerDistance - DistanceTolerance(outerDistance));
+					CHECK(!innerFound || hit.distance <= innerDistance + DistanceTolerance(innerDistance));
+				}
+			}
+		}
+
+		// The batch gives the same hits, and maxDistance with no instance for the misses
+		std::vector<SceneBvh::Hit> batchHits(batch.size());
+		snapshot.IntersectBatch(batch.data(), batch.size(), batchHits.data());
+		for (size_t i = 0; i < batch.size(); ++i)
+		{
+			CHECK(batchHits[i].instance == singleHits[i].instance && batchHits[i].distance == singleHits[i].distance);
+			CHECK(batchHits[i].instance == SceneBvh::kInvalidInstance || batchHits[i].triangleIndex == singleHits[i].triangleIndex);
+		}
+		return hitCount;
+	}
+
+	void TestEmptyScene()
+	{
+		SceneBvh scene;
+		std::shared_ptr<const SceneBvh::Snapshot> snapshot = scene.GetSnapshot();
+		CHECK(snapshot && snapshot->GetInstanceCount() == 0);
+
+		const float origin[3] = { 0.0f, 0.0f, -5.0f };
+		const float direction[3] = { 0.0f, 0.0f, 1.0f };
+		SceneBvh::Hit hit;
+		CHECK(!snapshot->Intersect(origin, direction, hit));
+
+		// Nothing to publish
+		scene.Commit();
+		CHECK(scene.GetRebuildCount() == 0 && scene.GetRefitCount() == 0);
+	}
+
+	void TestSceneChanges()
+	{
+		TestScene testScene;
+		SceneBvh& scene = testScene.GetScene();
+		std::mt19937 random(11);
+		std::uniform_real_distribution<float> position(-4.0f, 4.0f);
+		const std::vector<TestMeshes::Ray> rays = MakeSceneRays(random, 300);
+		auto CheckScene = [&]
+		{
+			std::vector<size_t> firstTriangles;
+			TestMeshes::Mesh world = testScene.GetWorldMesh(firstTriangles);
+			return CheckSnapshot(*scene.GetSnapshot(), world, firstTriangles, rays);
+		};
+
+		// Mirrored instances have their winding flipped in world space
+		for (int i = 0; i < 30; ++i)
+		{
+			const float center[3] = { position(random), position(random), position(random) };
+			testScene.Add(random, i % 3, center, i % 4 == 1);
+		}
+		scene.Commit();
+		CHECK(scene.GetRebuildCount() == 1 && scene.GetRefitCount() == 0);
+		std::shared_ptr<const SceneBvh::Snapshot> firstSnapshot = scene.GetSnapshot();
+		std::vector<size_t> firstTriangles;
+		TestMeshes::Mesh firstWorld = testScene.GetWorldMesh(firstTriangles);
+		CHECK(firstSnapshot->GetInstanceCount() == 30);
+		CHECK(CheckScene() > rays.size() / 4);
+
+		// Small moves refit
+		std::vector<uint32_t> instances = testScene.GetLiveInstances();
+		for (size_t i = 0; i < instances.size(); i += 6)
+		{
+			const float offset[3] = { 0.1f, -0.05f, 0.02f };
+			testScene.Move(instances[i], offset);
+		}
+		scene.Commit();
+		CHECK(scene.GetRebuildCount() == 1 && scene.GetRefitCount() == 1);
+		CheckScene();
+
+		// So do removals
+		for (size_t i = 1; i < instances.size(); i += 5)
+			testScene.Remove(instances[i]);
+		scene.Commit();
+		CHECK(scene.GetRebuildCount() == 1 && scene.GetRefitCount() == 2);
+		CHECK(scene.GetSnapshot()->GetInstanceCount() == 24);
+		CheckScene();
+
+		// Additions reuse the instances of removed meshes, and their leaves
+		for (int i = 0; i < 3; ++i)
+		{
+			const float center[3] = { position(random), position(random), position(random) };
+			uint32_t instance = testScene.Add(random, i, center, i == 2);
+			CHECK(instance < 30 && (instance - 1) % 5 == 0);
+		}
+		scene.Commit();
+		CHECK(scene.GetRebuildCount() == 1 && scene.GetRefitCount() == 3);
+		CHECK(scene.GetSnapshot()->GetInstanceCount() == 27);
+		CheckScene();
+
+		// New instances rebuild
+		for (int i = 0; i < 6; ++i)
+		{
+			const float center[3] = { position(random), position(random), position(random) };
+			testScene.Add(random, i % 3, center, i % 2 == 0);
+		}
+		scene.Commit();
+		CHECK(scene.GetRebuildCount() == 2 && scene.GetRefitCount() == 3);
+		CHECK(scene.GetSnapshot()->GetInstanceCount() == 33);
+		CheckScene();
+
+		// Moves that make the refitted nodes too loose rebuild
+		instances = testScene.GetLiveInstances();
+		for (size_t i = 0; i < instances.size(); i += 2)
+		{
+			const float offset[3] = { i % 4 == 0 ? 6.0f : -6.0f, 0.0f, 0.0f };
+			testScene.Move(instances[i], offset);
+		}
+		scene.Commit();
+		CHECK(scene.GetRebuildCount() == 3 && scene.GetRefitCount() == 3);
+		CheckScene();
+
+		// The first snapshot still answers for the scene of its commit
+		CheckSnapshot(*firstSnapshot, firstWorld, firstTriangles, rays);
+
+		// Down to an empty scene
+		for (uint32_t instance : testScene.GetLiveInstances())
+			testScene.Remove(instance);
+		scene.Commit();
+		CHECK(scene.GetSnapshot()->GetInstanceCount() == 0);
+		CHECK(CheckScene() == 0);
+	}
+}
+
+int main()
+{
+	TestEmptyScene();
+	TestSceneChanges();
+
+	return CheckResult();
+}
@@ -0,0 +1,185 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// CPU time per frame of the constant buffers of thousands of draws, written
+// through the cached FrameConstants and DrawConstants of each draw call, and
+// computed from scratch for every draw as DrawCall::UpdateShaderConstants used
+// to do. Also the buffers that change and are uploaded; the old code uploaded
+// every buffer of every draw.
+//
+// The draws are those of the single pass stereo vertex shader and of the pixel
+// shader, whose staging copies are shared by all the draws as in Shader. Still
+// frames, frames where the head moves, and frames where one object in ten
+// moves too.
+//
+// ShaderConstantsBenchmark [draw count] [frame count]
+// Defaults to 5000 draws and 20 frames.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "../Cannon/ShaderConstants.h"
+#include "TestConstants.h"
+
+namespace
+{
+	// The single pass stereo vertex shader and the pixel shader of TestConstants::MakeLayouts
+	const size_t kDrawLayouts[] = { 0, 2 };
+
+	template <typename Function>
+	double BestMilliseconds(Function function)
+	{
+		double best = 1e30;
+		for (int i = 0; i < 5; ++i)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			function();
+			best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		}
+		return best;
+	}
+
+	// Frames alternate between two heads and two positions of the moving objects
+	struct Scene
+	{
+		FrameConstants::Inputs frames[2];
+		std::vector<DrawConstants::Inputs> draws[2];
+		bool headMoves;
+		size_t objectMoveInterval;		// One object in objectMoveInterval moves, none if 0
+
+		const FrameConstants::Inputs& GetFrame(size_t frame) const { return frames[headMoves ? frame % 2 : 0]; }
+
+		const DrawConstants::Inputs& GetDraw(size_t frame, size_t draw) const
+		{
+			const bool moves = objectMoveInterval != 0 && draw % objectMoveInterval == 0;
+			return draws[moves ? frame % 2 : 0][draw];
+		}
+	};
+
+	// Writes the buffers of a draw, returns the number that changed
+	size_t WriteDraw(const std::vector<TestConstants::Layout>& layouts, const FrameConstants& frameConstants, const DrawConstants& drawConstants,
+		std::vector<std::vector<unsigned char>>& stagings)
+	{
+		size_t changedCount = 0;
+		for (size_t layout : kDrawLayouts)
+		{
+			const std::vector<Constant>& constants = layouts[layout].constants;
+			changedCount += WriteShaderConstants(constants.data(), constants.size(), frameConstants, drawConstants, 0, stagings[layout].data());
+		}
+		return changedCount;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const size_t drawCount = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 5000;
+	const size_t frameCount = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 20;
+
+	const std::vector<TestConstants::Layout> layouts = TestConstants::MakeLayouts();
+	std::mt19937 random(49);
+	Scene scene;
+	for (FrameConstants::Inputs& frame : scene.frames)
+	{
+		frame = {};
+		TestConstants::MakeHead(random, frame);
+		TestConstants::MakeLights(random, frame);
+	}
+	for (std::vector<DrawConstants::Inputs>& draws : scene.draws)
+	{
+		draws.resize(drawCount);
+		for (size_t i = 0; i < drawCount; ++i)
+			TestConstants::MakeObject(random, i % 3 == 0, draws[i]);
+	}
+
+	std::printf("%zu draws, %zu frames\n", drawCount, frameCount);
+	std::printf("%-30s %16s %16s %10s %16s %16s\n", "frames", "per draw (us)", "cached (us)", "speedup", "per draw uploads", "cached uploads");
+	bool same = true;
+	for (int scenario = 0; scenario < 3; ++scenario)
+	{
+		static const char* const kNames[] = { "still", "head moving", "head and 10% of objects moving" };
+		scene.headMoves = scenario > 0;
+		scene.objectMoveInterval = scenario == 2 ? 10 : 0;
+
+		std::vector<std::vector<unsigned char>> referenceStagings, stagings;
+		for (const TestConstants::Layout& layout : layouts)
+		{
+			referenceStagings.push_back(std::vector<unsigned char>(layout.size, 0));
+			stagings.push_back(std::vector<unsigned char>(layout.size, 0));
+		}
+
+		// Every value computed again for every draw, and every buffer uploaded
+		size_t referenceUploads = 0;
+		const double referenceMilliseconds = BestMilliseconds([&]
+		{
+			referenceUploads = 0;
+			for (size_t frame = 0; frame < frameCount; ++frame)
+			{
+				for (size_t i = 0; i < drawCount; ++i)
+				{
+					FrameConstants frameConstants;
+					frameConstants.Update(scene.GetFrame(frame));
+					DrawConstants drawConstants;
+					drawConstants.Update(scene.GetDraw(frame, i), frameConstants);
+					WriteDraw(layouts, frameConstants, drawConstants, referenceStagings);
+					referenceUploads += sizeof(kDrawLayouts) / sizeof(kDrawLayouts[0]);
+				}
+			}
+		});
+
+		// The frame values once per frame, the draw values of each draw call when they change
+		FrameConstants frameConstants;
+		std::vector<DrawConstants> drawConstants(drawCount);
+		size_t uploads = 0;
+		const double cachedMilliseconds = BestMilliseconds([&]
+		{
+			uploads = 0;
+			for (size_t frame = 0; frame < frameCount; ++frame)
+			{
+				frameConstants.Update(scene.GetFrame(frame));
+				for (size_t i = 0; i < drawCount; ++i)
+				{
+					drawConstants[i].Update(scene.GetDraw(frame, i), frameConstants);
+					uploads += WriteDraw(layouts, frameConstants, drawConstants[i], stagings);
+				}
+			}
+		});
+
+		// Both write the same bytes, checked after every draw of two frames
+		for (size_t frame = 0; frame < 2; ++frame)
+		{
+			frameConstants.Update(scene.GetFrame(frame));
+			FrameConstants freshFrameConstants;
+			freshFrameConstants.Update(scene.GetFrame(frame));
+			for (size_t i = 0; i < drawCount; ++i)
+			{
+				drawConstants[i].Update(scene.GetDraw(frame, i), frameConstants);
+				WriteDraw(layouts, frameConstants, drawConstants[i], stagings);
+				DrawConstants freshDrawConstants;
+				freshDrawConstants.Update(scene.GetDraw(frame, i), freshFrameConstants);
+				WriteDraw(layouts, freshFrameConstants, freshDrawConstants, referenceStagings);
+				same = same && stagings == referenceStagings;
+			}
+		}
+
+		std::printf("%-30s %16.1f %16.1f %10.2f %16.0f %16.0f\n", kNames[scenario], referenceMilliseconds * 1e3 / frameCount,
+			cachedMilliseconds * 1e3 / frameCount, referenceMilliseconds / cachedMilliseconds,
+			(double) referenceUploads / frameCount, (double) uploads / frameCount);
+	}
+
+	if (!same)
+		std::printf("(different results)\n");
+	return same ? 0 : 1;
+}
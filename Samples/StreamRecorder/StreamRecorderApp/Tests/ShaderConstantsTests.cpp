@@ -0,0 +1,383 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// Constant buffers written through the cached FrameConstants and
+// DrawConstants, over frames where the head, lights and objects change or
+// not, against the buffers computed from scratch for every draw as
+// DrawCall::UpdateShaderConstants used to do.
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "../Cannon/ShaderConstants.h"
+#include "Check.h"
+#include "TestConstants.h"
+
+namespace
+{
+	void Transpose(const float matrix[16], float result[16])
+	{
+		for (int i = 0; i < 16; ++i)
+			result[(i % 4) * 4 + i / 4] = matrix[i];
+	}
+
+	// Gauss-Jordan elimination with partial pivoting
+	void InvertDouble(const double matrix[16], double result[16])
+	{
+		double m[4][8];
+		for (int row = 0; row < 4; ++row)
+		{
+			for (int column = 0; column < 4; ++column)
+			{
+				m[row][column] = matrix[row * 4 + column];
+				m[row][4 + column] = row == column ? 1.0 : 0.0;
+			}
+		}
+
+		for (int column = 0; column < 4; ++column)
+		{
+			int pivot = column;
+			for (int row = column + 1; row < 4; ++row)
+			{
+				if (std::fabs(m[row][column]) > std::fabs(m[pivot][column]))
+					pivot = row;
+			}
+			for (int i = 0; i < 8; ++i)
+				std::swap(m[column][i], m[pivot][i]);
+
+			double inverse = 1.0 / m[column][column];
+			for (int i = 0; i < 8; ++i)
+				m[column][i] *= inverse;
+			for (int row = 0; row < 4; ++row)
+			{
+				double factor = m[row][column];
+				for (int i = 0; row != column && i < 8; ++i)
+					m[row][i] -= factor * m[column][i];
+			}
+		}
+
+		for (int row = 0; row < 4; ++row)
+		{
+			for (int column = 0; column < 4; ++column)
+				result[row * 4 + column] = m[row][4 + column];
+		}
+	}
+
+	void MultiplyDouble(const double a[16], const double b[16], double result[16])
+	{
+		for (int row = 0; row < 4; ++row)
+		{
+			for (int column = 0; column < 4; ++column)
+			{
+				result[row * 4 + column] = 0.0;
+				for (int i = 0; i < 4; ++i)
+					result[row * 4 + column] += a[row * 4 + i] * b[i * 4 + column];
+			}
+		}
+	}
+
+	// Transposed inverse of a matrix, or of the product of the inverse of a matrix and another, in double precision
+	void TransposedInverseReference(const float matrix[16], const float* multiplier, float result[16])
+	{
+		double m[16], inverse[16], product[16];
+		for (int i = 0; i < 16; ++i)
+			m[i] = matrix[i];
+		InvertDouble(m, inverse);
+		if (multiplier)
+		{
+			double b[16];
+			for (int i = 0; i < 16; ++i)
+				b[i] = multiplier[i];
+			MultiplyDouble(inverse, b, product);
+		}
+		else
+		{
+			std::memcpy(product, inverse, sizeof(product));
+		}
+
+		float value[16];
+		for (int i = 0; i < 16; ++i)
+			value[i] = (float) product[i];
+		Transpose(value, result);
+	}
+
+	// The values that the old UpdateShaderConstants wrote for a constant, for one eye or both
+	struct ReferenceValue
+	{
+		float values[2][16];
+		bool perEye;
+		bool inverse;			// Compared with a tolerance, the other values must be identical
+	};
+
+	ReferenceValue ComputeReference(unsigned id, const FrameConstants::Inputs& frame, const DrawConstants::Inputs& draw)
+	{
+		ReferenceValue reference = {};
+		float product[16], viewProjection[16];
+		for (unsigned eye = 0; eye < 2; ++eye)
+		{
+			float* value = reference.values[eye];
+			switch (id)
+			{
+			case CONST_WORLD_MATRIX:
+				Transpose(draw.world, value);
+				break;
+			case CONST_WORLDVIEWPROJ_MATRIX:
+				TestConstants::Multiply(frame.view[eye], frame.projection[eye], viewProjection);
+				TestConstants::Multiply(draw.world, viewProjection, product);
+				Transpose(product, value);
+				reference.perEye = true;
+				break;
+			case CONST_VIEWPROJ_MATRIX:
+				TestConstants::Multiply(frame.view[eye], frame.projection[eye], product);
+				Transpose(product, value);
+				reference.perEye = true;
+				break;
+			case CONST_VIEW_MATRIX:
+				Transpose(frame.view[eye], value);
+				reference.perEye = true;
+				break;
+			case CONST_INVVIEW_MATRIX:
+				TransposedInverseReference(frame.view[eye], nullptr, value);
+				reference.perEye = true;
+				reference.inverse = true;
+				break;
+			case CONST_LIGHTVIEWPROJ_MATRIX:
+				Transpose(frame.lightViewProjection, value);
+				break;
+			case CONST_LIGHTPOSV:
+				for (int column = 0; column < 4; ++column)
+				{
+					float sum = frame.lightPosition[0] * frame.cameraView[column];
+					sum += frame.lightPosition[1] * frame.cameraView[4 + column];
+					sum += frame.lightPosition[2] * frame.cameraView[8 + column];
+					sum += frame.lightPosition[3] * frame.cameraView[12 + column];
+					value[column] = sum;
+				}
+				break;
+			case CONST_INVVIEWLIGHTVIEWPROJ_MATRIX:
+				TransposedInverseReference(frame.cameraView, frame.lightViewProjection, value);
+				reference.inverse = true;
+				break;
+			case CONST_LIGHT_AMBIENT:
+				std::memcpy(value, frame.ambient, sizeof(frame.ambient));
+				break;
+			case CONST_NEARPLANEHEIGHT:
+				value[0] = frame.nearPlaneHeight;
+				break;
+			case CONST_NEARPLANEWIDTH:
+				value[0] = frame.nearPlaneWidth;
+				break;
+			case CONST_NEARPLANEDIST:
+				value[0] = frame.nearPlaneDistance;
+				break;
+			case CONST_FARPLANEDIST:
+				value[0] = frame.farPlaneDistance;
+				break;
+			case CONST_PROJECTIONRANGE:
+				value[0] = frame.projectionRange;
+				break;
+			case CONST_POSITIONSCALE:
+				std::memcpy(value, draw.positionScale, sizeof(draw.positionScale));
+				break;
+			case CONST_POSITIONOFFSET:
+				std::memcpy(value, draw.positionOffset, sizeof(draw.positionOffset));
+				break;
+			}
+		}
+		return reference;
+	}
+
+	bool CheckFloats(const unsigned char* bytes, const float* expected, size_t size, bool inverse)
+	{
+		bool same = true;
+		for (size_t i = 0; i < size / sizeof(float); ++i)
+		{
+			float value;
+			std::memcpy(&value, bytes + i * sizeof(float), sizeof(float));
+			if (inverse)
+				same = same && std::fabs(value - expected[i]) <= 1e-5f * (1.0f + std::fabs(expected[i]));
+			else
+				same = same && std::memcmp(&value, &expected[i], sizeof(float)) == 0;
+		}
+		return same;
+	}
+
+	// The buffer has the values of the old code for the eye of the draw
+	bool CheckReference(const TestConstants::Layout& layout, const unsigned char* buffer, const FrameConstants::Inputs& frame, const DrawConstants::Inputs& draw, unsigned eye)
+	{
+		bool same = true;
+		for (const Constant& constant : layout.constants)
+		{
+			ReferenceValue reference = ComputeReference(constant.id, frame, draw);
+			const unsigned char* bytes = buffer + constant.startOffset;
+			if (reference.perEye && constant.elementCount == 2)
+			{
+				same = same && CheckFloats(bytes, reference.values[0], constant.size / 2, reference.inverse);
+				same = same && CheckFloats(bytes + constant.size / 2, reference.values[1], constant.size / 2, reference.inverse);
+			}
+			else
+			{
+				same = same && CheckFloats(bytes, reference.values[eye], constant.size, reference.inverse);
+			}
+		}
+		return same;
+	}
+
+	void TestFrames()
+	{
+		const std::vector<TestConstants::Layout> layouts = TestConstants::MakeLayouts();
+		std::mt19937 random(50);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+		FrameConstants::Inputs frameInputs = {};
+		TestConstants::MakeHead(random, frameInputs);
+		TestConstants::MakeLights(random, frameInputs);
+
+		std::vector<DrawConstants::Inputs> drawInputs(40);
+		for (size_t i = 0; i < drawInputs.size(); ++i)
+			TestConstants::MakeObject(random, i % 3 == 0, drawInputs[i]);
+
+		// The staging copies are shared by the draws of a shader, and start as new unsigned char[]
+		FrameConstants frameConstants;
+		std::vector<DrawConstants> drawConstants(drawInputs.size());
+		std::vector<std::vector<unsigned char>> stagings;
+		for (const TestConstants::Layout& layout : layouts)
+			stagings.push_back(std::vector<unsigned char>(layout.size, 0xcd));
+
+		size_t unchangedWriteCount = 0;
+		for (int frame = 0; frame < 60; ++frame)
+		{
+			// The head is still on some frames, the lights, ambient and objects change now and then
+			if (frame % 4 != 3)
+				TestConstants::MakeHead(random, frameInputs);
+			if (frame % 10 == 5)
+				TestConstants::MakeLights(random, frameInputs);
+			if (frame % 7 == 2)
+				frameInputs.ambient[1] = unit(random);
+			for (size_t i = 0; i < drawInputs.size(); ++i)
+			{
+				if (unit(random) < 0.2f)
+					TestConstants::MakeObject(random, i % 3 == 0, drawInputs[i]);
+			}
+
+			// Left eye, right eye, then a fullscreen pass with another view for the light and projection constants
+			for (unsigned pass = 0; pass < 3; ++pass)
+			{
+				FrameConstants::Inputs passInputs = frameInputs;
+				if (pass == 2)
+					TestConstants::MakeRigidTransform(random, 1.0f, passInputs.cameraView);
+				const uint64_t version = frameConstants.GetVersion();
+				const bool inputsChanged = version == 0 || std::memcmp(&passInputs, &frameConstants.GetInputs(), sizeof(passInputs)) != 0;
+				CHECK(frameConstants.Update(passInputs) == inputsChanged);
+				CHECK((frameConstants.GetVersion() != version) == inputsChanged);
+
+				FrameConstants freshFrameConstants;
+				freshFrameConstants.Update(passInputs);
+
+				const unsigned eye = pass == 1 ? 1 : 0;
+				for (size_t i = 0; i < drawInputs.size(); ++i)
+				{
+					drawConstants[i].Update(drawInputs[i], frameConstants);
+					DrawConstants freshDrawConstants;
+					freshDrawConstants.Update(drawInputs[i], freshFrameConstants);
+
+					for (size_t layout = 0; layout < layouts.size(); ++layout)
+					{
+						// Single pass stereo shaders are drawn once, the fullscreen pass shader only in the fullscreen pass
+						if ((layout == 0 && pass == 1) || (layout == 3) != (pass == 2))
+							continue;
+
+						const std::vector<Constant>& constants = layouts[layout].constants;
+						std::vector<unsigned char>& staging = stagings[layout];
+						const std::vector<unsigned char> previous = staging;
+						bool changed = WriteShaderConstants(constants.data(), constants.size(), frameConstants, drawConstants[i], eye, staging.data());
+
+						// The bytes of the constants are those computed from scratch, and the ones around them are untouched
+						std::vector<unsigned char> expected = previous;
+						WriteShaderConstants(constants.data(), constants.size(), freshFrameConstants, freshDrawConstants, eye, expected.data());
+						CHECK(staging == expected);
+						CHECK(changed == (staging != previous));
+						CHECK(CheckReference(layouts[layout], staging.data(), passInputs, drawInputs[i], eye));
+						unchangedWriteCount += changed ? 0 : 1;
+					}
+				}
+			}
+		}
+
+		// The pixel shader buffers do not change from a draw to the next
+		CHECK(unchangedWriteCount > 0);
+	}
+
+	void TestUpdates()
+	{
+		std::mt19937 random(51);
+		FrameConstants::Inputs frameInputs = {};
+		TestConstants::MakeHead(random, frameInputs);
+		TestConstants::MakeLights(random, frameInputs);
+		FrameConstants frameConstants;
+		CHECK(frameConstants.GetVersion() == 0);
+		CHECK(frameConstants.Update(frameInputs));
+		CHECK(!frameConstants.Update(frameInputs));
+
+		// Any input alone
+		static_assert(sizeof(FrameConstants::Inputs) % sizeof(float) == 0, "The frame inputs are floats");
+		bool everyInputCounts = true;
+		for (size_t i = 0; i < sizeof(FrameConstants::Inputs) / sizeof(float); ++i)
+		{
+			FrameConstants::Inputs changedInputs = frameInputs;
+			reinterpret_cast<float*>(&changedInputs)[i] += 1.0f;
+			uint64_t version = frameConstants.GetVersion();
+			everyInputCounts = everyInputCounts && frameConstants.Update(changedInputs) && frameConstants.GetVersion() != version;
+			everyInputCounts = everyInputCounts && frameConstants.Update(frameInputs);
+		}
+		CHECK(everyInputCounts);
+
+		DrawConstants::Inputs drawInputs;
+		TestConstants::MakeObject(random, true, drawInputs);
+		DrawConstants drawConstants;
+		CHECK(drawConstants.Update(drawInputs, frameConstants));
+		CHECK(!drawConstants.Update(drawInputs, frameConstants));
+
+		// The scale and offset alone
+		drawInputs.positionOffset[2] += 1.0f;
+		CHECK(drawConstants.Update(drawInputs, frameConstants));
+		CHECK(std::memcmp(drawConstants.GetInputs().positionOffset, drawInputs.positionOffset, sizeof(drawInputs.positionOffset)) == 0);
+
+		// Another FrameConstants with the same inputs has another version
+		FrameConstants otherFrameConstants;
+		CHECK(otherFrameConstants.Update(frameInputs));
+		CHECK(otherFrameConstants.GetVersion() != frameConstants.GetVersion());
+		CHECK(drawConstants.Update(drawInputs, otherFrameConstants));
+		CHECK(!drawConstants.Update(drawInputs, otherFrameConstants));
+
+		// The world view projection follows the frame
+		TestConstants::MakeHead(random, frameInputs);
+		CHECK(frameConstants.Update(frameInputs));
+		CHECK(drawConstants.Update(drawInputs, frameConstants));
+		float viewProjection[16], product[16], expected[16];
+		TestConstants::Multiply(frameInputs.view[1], frameInputs.projection[1], viewProjection);
+		TestConstants::Multiply(drawInputs.world, viewProjection, product);
+		Transpose(product, expected);
+		CHECK(std::memcmp(drawConstants.GetValues().transposedWorldViewProjection[1], expected, sizeof(expected)) == 0);
+	}
+}
+
+int main()
+{
+	TestFrames();
+	TestUpdates();
+
+	return CheckResult();
+}
@@ -0,0 +1,401 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// SurfaceUpdateScheduler driven by a simulated observer, in real time: the
+// updates are picked in order of priority, start within the token bucket budget,
+// are retried after a failure, and the surfaces removed while their update is in
+// flight are forgotten once it completes. The destructor waits for the updates in
+// flight and starts no other one. Finally, a random observer checks that every
+// surface ends up with the mesh of its last update time, and that a surface is
+// never updated by two workers at once.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "../Cannon/SurfaceUpdateScheduler.h"
+#include "Check.h"
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	// What SpatialSurfaceInfo is to SurfaceMapping: the update time of the surface
+	struct SimulatedSurface
+	{
+		long long updateTime;
+	};
+
+	typedef SurfaceUpdateScheduler<int, SimulatedSurface> Scheduler;
+
+	Scheduler::ObservedSurface MakeSurface(int id, long long updateTime, float x, float y, float z)
+	{
+		return { id, { updateTime }, updateTime, { x, y, z } };
+	}
+
+	double SecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration<double>(Clock::now() - start).count();
+	}
+
+	template <typename Predicate>
+	bool WaitFor(Predicate predicate, double timeoutSeconds = 10.0)
+	{
+		const Clock::time_point start = Clock::now();
+		while (!predicate())
+		{
+			if (SecondsSince(start) > timeoutSeconds)
+				return false;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		return true;
+	}
+
+	// Update function that records the surfaces in order, and can hold the updates of a surface until released
+	class Recorder
+	{
+	public:
+
+		bool Update(int id, const SimulatedSurface& surface)
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_calls.push_back({ id, surface.updateTime, SecondsSince(m_start) });
+			m_condition.notify_all();
+			m_condition.wait(lock, [&] { return m_heldId != id; });
+			return m_failures[id]-- <= 0;
+		}
+
+		void Hold(int id) { std::lock_guard<std::mutex> lock(m_mutex); m_heldId = id; }
+		void Release() { std::lock_guard<std::mutex> lock(m_mutex); m_heldId = -1; m_condition.notify_all(); }
+		void Fail(int id, int count) { std::lock_guard<std::mutex> lock(m_mutex); m_failures[id] = count; }
+
+		struct Call
+		{
+			int id;
+			long long updateTime;
+			double seconds;			// Since the recorder was created
+		};
+
+		double GetSeconds() const { return SecondsSince(m_start); }
+		std::vector<Call> GetCalls() { std::lock_guard<std::mutex> lock(m_mutex); return m_calls; }
+		size_t GetCallCount() { std::lock_guard<std::mutex> lock(m_mutex); return m_calls.size(); }
+
+		Scheduler::UpdateFunction GetFunction() { return [this](int id, const SimulatedSurface& surface) { return Update(id, surface); }; }
+
+	private:
+
+		const Clock::time_point m_start = Clock::now();
+		std::mutex m_mutex;
+		std::condition_variable m_condition;
+		std::vector<Call> m_calls;
+		std::map<int, int> m_failures;
+		int m_heldId = -1;
+	};
+
+	Scheduler::Settings UnlimitedSettings(unsigned workerCount)
+	{
+		Scheduler::Settings settings;
+		settings.workerCount = workerCount;
+		settings.surfacesPerSecond = 1e6f;
+		settings.burstSize = 1e6f;
+		return settings;
+	}
+
+	void TestPriorityOrder()
+	{
+		// One worker, held on a first surface while the others are queued, picks them in order of priority
+		Recorder recorder;
+		Scheduler scheduler(recorder.GetFunction(), UnlimitedSettings(1));
+		const float position[3] = { 0.0f, 0.0f, 0.0f };
+		const float forward[3] = { 0.0f, 0.0f, -1.0f };
+		scheduler.SetViewer(position, forward);
+
+		recorder.Hold(0);
+		std::vector<Scheduler::ObservedSurface> surfaces = { MakeSurface(0, 1, 0.0f, 0.0f, -100.0f) };
+		scheduler.SetObservedSurfaces(surfaces);
+		CHECK(WaitFor([&] { return recorder.GetCallCount() == 1; }));
+
+		// In view at 1, 2, 4 and 8 m, and behind the viewer at 1 and 2 m, which count as 3 and 6 m
+		surfaces.push_back(MakeSurface(1, 1, 0.0f, 0.0f, -8.0f));
+		surfaces.push_back(MakeSurface(2, 1, 0.0f, 0.0f, 1.0f));
+		surfaces.push_back(MakeSurface(3, 1, 0.0f, 0.0f, -2.0f));
+		surfaces.push_back(MakeSurface(4, 1, 0.0f, 0.0f, 2.0f));
+		surfaces.push_back(MakeSurface(5, 1, 0.0f, 0.0f, -1.0f));
+		surfaces.push_back(MakeSurface(6, 1, 0.0f, 0.0f, -4.0f));
+		scheduler.SetObservedSurfaces(surfaces);
+		recorder.Release();
+		CHECK(WaitFor([&] { return scheduler.GetUpdatedCount() == 7; }));
+
+		std::vector<int> order;
+		for (const auto& call : recorder.GetCalls())
+			order.push_back(call.id);
+		CHECK((order == std::vector<int>{ 0, 5, 3, 2, 6, 4, 1 }));
+
+		// The surfaces without a mesh go before the closer ones that have one
+		recorder.Hold(0);
+		surfaces[0].updateTime = surfaces[0].surface.updateTime = 2;
+		scheduler.SetObservedSurfaces(surfaces);
+		CHECK(WaitFor([&] { return recorder.GetCallCount() == 8; }));
+
+		for (int i = 1; i <= 6; ++i)
+			surfaces[i].updateTime = surfaces[i].surface.updateTime = 2;
+		surfaces.push_back(MakeSurface(7, 1, 0.0f, 0.0f, -50.0f));
+		scheduler.SetObservedSurfaces(surfaces);
+		recorder.Release();
+		CHECK(WaitFor([&] { return scheduler.GetUpdatedCount() == 15; }));
+
+		order.clear();
+		for (const auto& call : recorder.GetCalls())
+			order.push_back(call.id);
+		CHECK((order == std::vector<int>{ 0, 5, 3, 2, 6, 4, 1, 0, 7, 5, 3, 2, 6, 4, 1 }));
+		CHECK(scheduler.GetQueuedCount() == 0);
+	}
+
+	void TestBudget()
+	{
+		// The i-th update starts once the bucket holds i + 1 tokens: burstSize at creation, refilled at surfacesPerSecond
+		Scheduler::Settings settings;
+		settings.workerCount = 4;
+		settings.surfacesPerSecond = 40.0f;
+		settings.burstSize = 5.0f;
+
+		Recorder recorder;
+		const double createdSeconds = recorder.GetSeconds();
+		Scheduler scheduler(recorder.GetFunction(), settings);
+
+		const int surfaceCount = 25;
+		std::vector<Scheduler::ObservedSurface> surfaces;
+		for (int i = 0; i < surfaceCount; ++i)
+			surfaces.push_back(MakeSurface(i, 1, 0.0f, 0.0f, -1.0f - i));
+		scheduler.SetObservedSurfaces(surfaces);
+		CHECK(WaitFor([&] { return scheduler.GetUpdatedCount() == surfaceCount; }));
+
+		std::vector<Recorder::Call> calls = recorder.GetCalls();
+		CHECK(calls.size() == surfaceCount);
+		const double tolerance = 0.005;
+		for (size_t i = 0; i < calls.size(); ++i)
+		{
+			double earliest = (i + 1 - std::min<double>(i + 1, settings.burstSize)) / settings.surfacesPerSecond;
+			CHECK(calls[i].seconds - createdSeconds >= earliest - tolerance);
+		}
+
+		// The burst starts at once, and the bucket is not much slower than its rate
+		CHECK(calls.size() >= 5 && calls[4].seconds - createdSeconds < 0.1);
+		CHECK(!calls.empty() && calls.back().seconds - createdSeconds < (surfaceCount - settings.burstSize) / settings.surfacesPerSecond + 0.5);
+	}
+
+	void TestRetry()
+	{
+		Scheduler::Settings settings = UnlimitedSettings(1);
+		settings.retryDelay = 0.2f;
+
+		Recorder recorder;
+		recorder.Fail(0, 2);
+		Scheduler scheduler(recorder.GetFunction(), settings);
+		scheduler.SetObservedSurfaces({ MakeSurface(0, 1, 0.0f, 0.0f, -1.0f), MakeSurface(1, 1, 0.0f, 0.0f, -2.0f) });
+		CHECK(WaitFor([&] { return scheduler.GetUpdatedCount() == 2; }));
+
+		// The other surface does not wait for the retries, which are retryDelay apart
+		std::vector<Recorder::Call> calls = recorder.GetCalls();
+		CHECK(calls.size() == 4);
+		if (calls.size() == 4)
+		{
+			CHECK(calls[0].id == 0 && calls[1].id == 1 && calls[2].id == 0 && calls[3].id == 0);
+			CHECK(calls[2].seconds - calls[0].seconds >= settings.retryDelay - 0.005);
+			CHECK(calls[3].seconds - calls[2].seconds >= settings.retryDelay - 0.005);
+			CHECK(calls[3].seconds - calls[0].seconds < 2.0);
+		}
+		CHECK(scheduler.GetQueuedCount() == 0);
+
+		// A surface that failed is tried again when it is not observed, then observed again
+		recorder.Fail(2, 1);
+		scheduler.SetObservedSurfaces({ MakeSurface(2, 1, 0.0f, 0.0f, -1.0f) });
+		CHECK(WaitFor([&] { return recorder.GetCallCount() == 5; }));
+		CHECK(WaitFor([&] { return scheduler.GetQueuedCount() == 1; }));
+		scheduler.SetObservedSurfaces({});
+		CHECK(scheduler.GetQueuedCount() == 0);
+		scheduler.SetObservedSurfaces({ MakeSurface(2, 1, 0.0f, 0.0f, -1.0f) });
+		CHECK(WaitFor([&] { return scheduler.GetUpdatedCount() == 3; }));
+		CHECK(recorder.GetCallCount() == 6);
+	}
+
+	void TestRemovalInFlight()
+	{
+		Recorder recorder;
+		Scheduler scheduler(recorder.GetFunction(), UnlimitedSettings(2));
+
+		// Removed while its update runs: forgotten once it completes, and not counted
+		recorder.Hold(0);
+		scheduler.SetObservedSurfaces({ MakeSurface(0, 1, 0.0f, 0.0f, -1.0f) });
+		CHECK(WaitFor([&] { return recorder.GetCallCount() == 1; }));
+		scheduler.SetObservedSurfaces({ MakeSurface(1, 1, 0.0f, 0.0f, -1.0f) });
+		CHECK(WaitFor([&] { return scheduler.GetUpdatedCount() == 1; }));
+		recorder.Release();
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		CHECK(scheduler.GetUpdatedCount() == 1 && scheduler.GetQueuedCount() == 0 && recorder.GetCallCount() == 2);
+
+		// Observed again afterwards, it has no mesh anymore
+		scheduler.SetObservedSurfaces({ MakeSurface(0, 1, 0.0f, 0.0f, -1.0f), MakeSurface(1, 1, 0.0f, 0.0f, -1.0f) });
+		CHECK(WaitFor([&] { return scheduler.GetUpdatedCount() == 2; }));
+		CHECK(recorder.GetCallCount() == 3);
+
+		// Removed and observed again with a new update time while its update runs: kept, and updated again
+		recorder.Hold(1);
+		scheduler.SetObservedSurfaces({ MakeSurface(0, 1, 0.0f, 0.0f, -1.0f), MakeSurface(1, 2, 0.0f, 0.0f, -1.0f) });
+		CHECK(WaitFor([&] { return recorder.GetCallCount() == 4; }));
+		scheduler.SetObservedSurfaces({ MakeSurface(0, 1, 0.0f, 0.0f, -1.0f) });
+		scheduler.SetObservedSurfaces({ MakeSurface(0, 1, 0.0f, 0.0f, -1.0f), MakeSurface(1, 3, 0.0f, 0.0f, -1.0f) });
+		recorder.Release();
+		CHECK(WaitFor([&] { return scheduler.GetUpdatedCount() == 4; }));
+
+		std::vector<Recorder::Call> calls = recorder.GetCalls();
+		CHECK(calls.size() == 5);
+		if (calls.size() == 5)
+			CHECK(calls[3].id == 1 && calls[3].updateTime == 2 && calls[4].id == 1 && calls[4].updateTime == 3);
+		CHECK(scheduler.GetQueuedCount() == 0);
+	}
+
+	void TestShutdown()
+	{
+		// Workers waiting for work, for the budget and for an update in flight all stop
+		Scheduler::Settings settings;
+		settings.workerCount = 3;
+		settings.surfacesPerSecond = 0.1f;
+		settings.burstSize = 1.0f;
+
+		Recorder recorder;
+		recorder.Hold(0);
+		auto scheduler = std::make_unique<Scheduler>(recorder.GetFunction(), settings);
+		std::vector<Scheduler::ObservedSurface> surfaces;
+		for (int i = 0; i < 10; ++i)
+			surfaces.push_back(MakeSurface(i, 1, 0.0f, 0.0f, -1.0f - i));
+		scheduler->SetObservedSurfaces(surfaces);
+		CHECK(WaitFor([&] { return recorder.GetCallCount() == 1; }));
+		CHECK(scheduler->GetQueuedCount() == 9);
+
+		std::thread releaseThread([&recorder]
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			recorder.Release();
+		});
+
+		// The destructor returns once the update in flight does, without waiting for the budget
+		const Clock::time_point start = Clock::now();
+		scheduler.reset();
+		CHECK(SecondsSince(start) < 1.0);
+		CHECK(recorder.GetCallCount() == 1);
+		releaseThread.join();
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		CHECK(recorder.GetCallCount() == 1);
+	}
+
+	void TestSimulatedObserver()
+	{
+		// Surfaces appear, change and disappear at random, as the observer of SurfaceMapping reports them
+		Scheduler::Settings settings;
+		settings.workerCount = 3;
+		settings.surfacesPerSecond = 2000.0f;
+		settings.burstSize = 20.0f;
+		settings.retryDelay = 0.01f;
+
+		std::mutex mutex;
+		std::set<int> updating;
+		std::map<int, long long> meshUpdateTimes;
+		bool concurrentUpdate = false;
+		std::mt19937 random(0);
+		std::mt19937 failureRandom(1);
+
+		Scheduler scheduler([&](int id, const SimulatedSurface& surface)
+		{
+			bool failed;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				concurrentUpdate = concurrentUpdate || !updating.insert(id).second;
+				failed = failureRandom() % 5 == 0;
+			}
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+
+			std::lock_guard<std::mutex> lock(mutex);
+			updating.erase(id);
+			if (!failed)
+				meshUpdateTimes[id] = surface.updateTime;
+			return !failed;
+		}, settings);
+
+		// The update times of a surface keep increasing, also across its removals
+		std::map<int, Scheduler::ObservedSurface> observed;
+		std::map<int, long long> lastUpdateTimes;
+		for (int step = 0; step < 200; ++step)
+		{
+			for (int change = 0; change < 3; ++change)
+			{
+				int id = random() % 40;
+				if (random() % 4 == 0)
+				{
+					observed.erase(id);
+				}
+				else
+				{
+					observed[id] = MakeSurface(id, ++lastUpdateTimes[id], (float) (random() % 10), 0.0f, -(float) (random() % 10));
+				}
+			}
+
+			const float position[3] = { 0.0f, 0.0f, 0.0f };
+			const float forward[3] = { std::sin(step * 0.1f), 0.0f, -std::cos(step * 0.1f) };
+			scheduler.SetViewer(position, forward);
+
+			std::vector<Scheduler::ObservedSurface> surfaces;
+			for (const auto& surface : observed)
+				surfaces.push_back(surface.second);
+			scheduler.SetObservedSurfaces(surfaces);
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		}
+
+		// Once the observer stops, every observed surface gets the mesh of its last update time
+		CHECK(WaitFor([&]
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (const auto& surface : observed)
+			{
+				auto mesh = meshUpdateTimes.find(surface.first);
+				if (mesh == meshUpdateTimes.end() || mesh->second != surface.second.updateTime)
+					return false;
+			}
+			return updating.empty();
+		}));
+		CHECK(scheduler.GetQueuedCount() == 0);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		CHECK(!concurrentUpdate);
+	}
+}
+
+int main()
+{
+	TestPriorityOrder();
+	TestBudget();
+	TestRetry();
+	TestRemovalInFlight();
+	TestShutdown();
+	TestSimulatedObserver();
+
+	return CheckResult();
+}
@@ -0,0 +1,139 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// Time to the first frame read from a recorded tarball, at the start, middle
+// and end of the recording, walking the tar headers or through the index.
+//
+// TarIndexBenchmark [frame count] [frame size in bytes]
+// Defaults to an AHaT like recording: 4000 depth and AB frames of 512x512x2 bytes.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../TarIndex.h"
+#include "TestTarball.h"
+
+namespace
+{
+    int64_t FrameTimestamp(size_t frame)
+    {
+        return 132552243331225839 + 1111 * static_cast<int64_t>(frame);
+    }
+
+    uint64_t ParseOctal(const char* field, size_t fieldSize)
+    {
+        uint64_t value = 0;
+        for (size_t i = 0; i < fieldSize && field[i] >= '0' && field[i] <= '7'; ++i)
+        {
+            value = (value << 3) + (field[i] - '0');
+        }
+        return value;
+    }
+
+    // What the readers do without an index: walk the headers up to the member
+    std::vector<char> ReadFrameWithoutIndex(const std::filesystem::path& tarballFileName, const std::string& fileName)
+    {
+        std::ifstream file(tarballFileName, std::ios::binary);
+        char header[512];
+        uint64_t headerOffset = 0;
+        while (file.read(header, sizeof(header)) && header[0] != '\0')
+        {
+            const uint64_t dataSize = ParseOctal(header + 124, 12);
+            if (fileName.compare(0, std::string::npos, header, strnlen(header, 100)) == 0)
+            {
+                std::vector<char> data(static_cast<size_t>(dataSize));
+                file.read(data.data(), data.size());
+                return data;
+            }
+
+            headerOffset += sizeof(header) + (dataSize + 511) / 512 * 512;
+            file.seekg(static_cast<std::streamoff>(headerOffset));
+        }
+        return {};
+    }
+
+    std::vector<char> ReadFrameWithIndex(const std::filesystem::path& tarballFileName, int64_t timestamp)
+    {
+        Io::TarIndexReader reader;
+        if (!reader.Load(std::filesystem::path(tarballFileName) += Io::kTarIndexExtension))
+        {
+            return {};
+        }
+
+        const Io::TarIndexEntry* entry = reader.FindNearestTimestamp(timestamp);
+        std::ifstream file(tarballFileName, std::ios::binary);
+        std::vector<char> data(static_cast<size_t>(entry->DataSize));
+        file.seekg(static_cast<std::streamoff>(entry->DataOffset));
+        file.read(data.data(), data.size());
+        return data;
+    }
+
+    template <typename Function>
+    double BestMilliseconds(Function function)
+    {
+        double best = 1e30;
+        for (int i = 0; i < 5; ++i)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            function();
+            best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+        return best;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const size_t frameCount = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4000;
+    const size_t frameSize = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 512 * 512 * 2;
+
+    const std::filesystem::path directory = std::filesystem::temp_directory_path() / "TarIndexBenchmark";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    const std::filesystem::path tarballFileName = directory / "Depth AHaT.tar";
+
+    const auto writeStart = std::chrono::steady_clock::now();
+    {
+        TestTarball::Writer writer(tarballFileName, true);
+        const std::vector<char> data = TestTarball::MakeMemberData(frameSize, 0);
+        for (size_t i = 0; i < frameCount; ++i)
+        {
+            writer.AddFile(std::to_string(FrameTimestamp(i)) + ".pgm", data);
+            writer.AddFile(std::to_string(FrameTimestamp(i)) + "_ab.pgm", data);
+        }
+    }
+    std::printf("%zu frames of %zu bytes: %.0f MB written in %.0f ms\n", frameCount, frameSize,
+        std::filesystem::file_size(tarballFileName) / 1e6,
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - writeStart).count());
+
+    // The file system cache is warm, which favors the header walk
+    std::printf("%-8s %16s %16s\n", "frame", "headers (ms)", "index (ms)");
+    for (const size_t frame : { size_t(0), frameCount / 2, frameCount - 1 })
+    {
+        const int64_t timestamp = FrameTimestamp(frame);
+        const std::string fileName = std::to_string(timestamp) + ".pgm";
+        bool same = true;
+
+        const double withoutIndex = BestMilliseconds([&] { same &= ReadFrameWithoutIndex(tarballFileName, fileName).size() == frameSize; });
+        const double withIndex = BestMilliseconds([&] { same &= ReadFrameWithIndex(tarballFileName, timestamp).size() == frameSize; });
+        std::printf("%-8zu %16.3f %16.3f%s\n", frame, withoutIndex, withIndex, same ? "" : "  (frame not found)");
+    }
+
+    std::filesystem::remove_all(directory);
+    return 0;
+}
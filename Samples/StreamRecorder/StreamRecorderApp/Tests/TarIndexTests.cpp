@@ -0,0 +1,151 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "../TarIndex.h"
+#include "Check.h"
+#include "TestTarball.h"
+
+namespace
+{
+    std::vector<char> ReadFile(const std::filesystem::path& fileName)
+    {
+        std::ifstream file(fileName, std::ios::binary);
+        return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    std::vector<char> ReadMember(const std::filesystem::path& tarballFileName, const Io::TarIndexEntry& entry)
+    {
+        std::ifstream file(tarballFileName, std::ios::binary);
+        std::vector<char> data(static_cast<size_t>(entry.DataSize));
+        file.seekg(static_cast<std::streamoff>(entry.DataOffset));
+        file.read(data.data(), data.size());
+        return data;
+    }
+
+    void TestFileNames()
+    {
+        // FNV-1a reference values
+        CHECK(Io::HashTarMemberName("") == 14695981039346656037ull);
+        CHECK(Io::HashTarMemberName("a") == 0xaf63dc4c8601ec8cull);
+
+        CHECK(Io::ParseTimestampFromFileName("132552243331225839.pgm") == 132552243331225839);
+        CHECK(Io::ParseTimestampFromFileName("132552243331225839_ab.pgm") == 132552243331225839);
+        CHECK(Io::ParseTimestampFromFileName("Depth AHaT/1234.bytes") == 1234);
+        CHECK(Io::ParseTimestampFromFileName("Depth AHaT_lut.bin") == -1);
+        CHECK(Io::ParseTimestampFromFileName("") == -1);
+    }
+
+    void TestWriteAndRead(const std::filesystem::path& directory)
+    {
+        const std::filesystem::path tarballFileName = directory / "depth.tar";
+        const std::filesystem::path indexFileName = directory / "depth.tar.idx";
+
+        // Depth and AB frames share their timestamps, the sizes cover the padded and unpadded members
+        const size_t frameCount = 3 * Io::TarIndexWriter::kFlushInterval + 5;
+        std::vector<std::string> names;
+        {
+            TestTarball::Writer writer(tarballFileName, true);
+            for (size_t i = 0; i < frameCount; ++i)
+            {
+                const std::string timestamp = std::to_string(1000 + 10 * i);
+                names.push_back(timestamp + ".pgm");
+                names.push_back(timestamp + "_ab.pgm");
+                writer.AddFile(names[names.size() - 2], TestTarball::MakeMemberData(512 * (i % 3) + i, 2 * i));
+                writer.AddFile(names.back(), TestTarball::MakeMemberData(100 + i, 2 * i + 1));
+
+                // The entries are published once flushed, so a recording that stops here leaves a valid index
+                if (i == Io::TarIndexWriter::kFlushInterval)
+                {
+                    Io::TarIndexReader reader;
+                    CHECK(reader.Load(indexFileName));
+                    CHECK(reader.GetEntries().size() == 2 * Io::TarIndexWriter::kFlushInterval);
+                }
+            }
+        }
+
+        Io::TarIndexReader reader;
+        CHECK(reader.Load(indexFileName));
+        CHECK(reader.GetEntries().size() == names.size());
+
+        for (size_t i = 0; i < names.size(); ++i)
+        {
+            const Io::TarIndexEntry* entry = reader.FindByName(names[i]);
+            CHECK(entry != nullptr);
+            if (entry)
+            {
+                CHECK(ReadMember(tarballFileName, *entry) == TestTarball::MakeMemberData(i % 2 == 0 ? 512 * (i / 2 % 3) + i / 2 : 100 + i / 2, i));
+            }
+        }
+        CHECK(reader.FindByName("999.pgm") == nullptr);
+
+        // The nearest timestamp returns the first member of the frame, the later one on ties
+        CHECK(reader.FindNearestTimestamp(0)->Timestamp == 1000);
+        CHECK(reader.FindNearestTimestamp(1014)->Timestamp == 1010);
+        CHECK(reader.FindNearestTimestamp(1015)->Timestamp == 1020);
+        CHECK(reader.FindNearestTimestamp(1016)->Timestamp == 1020);
+        CHECK(reader.FindNearestTimestamp(1016)->NameHash == Io::HashTarMemberName("1020.pgm"));
+        CHECK(reader.FindNearestTimestamp(1000000)->Timestamp == static_cast<int64_t>(1000 + 10 * (frameCount - 1)));
+
+        // Rebuilding from the headers gives the same index
+        const std::filesystem::path rebuiltIndexFileName = directory / "rebuilt.idx";
+        CHECK(Io::RebuildTarIndex(tarballFileName, rebuiltIndexFileName) == static_cast<int64_t>(names.size()));
+        CHECK(ReadFile(rebuiltIndexFileName) == ReadFile(indexFileName));
+
+        // A partly written last entry is ignored
+        std::vector<char> indexData = ReadFile(indexFileName);
+        indexData.resize(indexData.size() - sizeof(Io::TarIndexEntry) / 2);
+        std::ofstream(indexFileName, std::ios::binary | std::ios::trunc).write(indexData.data(), indexData.size());
+        CHECK(reader.Load(indexFileName));
+        CHECK(reader.GetEntries().size() == names.size() - 1);
+    }
+
+    void TestInvalidFiles(const std::filesystem::path& directory)
+    {
+        Io::TarIndexReader reader;
+        CHECK(!reader.Load(directory / "missing.idx"));
+
+        const std::filesystem::path otherFileName = directory / "other.idx";
+        std::ofstream(otherFileName, std::ios::binary) << "not an index, but long enough for a header";
+        CHECK(!reader.Load(otherFileName));
+
+        CHECK(Io::RebuildTarIndex(directory / "missing.tar", directory / "missing.tar.idx") == -1);
+
+        // Recording goes on when the index can not be opened, without buffering its entries
+        Io::TarIndexWriter writer;
+        CHECK(!writer.Open(directory / "missing" / "depth.tar.idx"));
+        for (int i = 0; i < 1000; ++i)
+        {
+            writer.AddEntry(std::to_string(i) + ".pgm", 512 * i, 100);
+        }
+        writer.Close();
+        CHECK(!std::filesystem::exists(directory / "missing"));
+    }
+}
+
+int main()
+{
+    const std::filesystem::path directory = std::filesystem::temp_directory_path() / "TarIndexTests";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+
+    TestFileNames();
+    TestWriteAndRead(directory);
+    TestInvalidFiles(directory);
+
+    std::filesystem::remove_all(directory);
+    return CheckResult();
+}
@@ -0,0 +1,181 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Constant buffer layouts, views, lights and objects of the ShaderConstants
+// tests and benchmark.
+
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "../Cannon/ShaderConstants.h"
+
+namespace TestConstants
+{
+	// A constant buffer as the reflection of a shader gives it
+	struct Layout
+	{
+		std::vector<Constant> constants;
+		unsigned size;
+	};
+
+	// Shaped like the Cannon shaders: a single pass stereo vertex shader, a vertex shader drawn once per eye, a pixel
+	// shader and a fullscreen pass shader. Every constant is used, some with a smaller size than their value.
+	inline std::vector<Layout> MakeLayouts()
+	{
+		std::vector<Layout> layouts(4);
+		layouts[0].constants =
+		{
+			{ CONST_WORLDVIEWPROJ_MATRIX, 0, 128, 2 },
+			{ CONST_WORLD_MATRIX, 128, 64, 0 },
+			{ CONST_VIEWPROJ_MATRIX, 192, 128, 2 },
+			{ CONST_POSITIONSCALE, 320, 16, 0 },
+			{ CONST_POSITIONOFFSET, 336, 12, 0 },
+		};
+		layouts[0].size = 352;
+		layouts[1].constants =
+		{
+			{ CONST_WORLD_MATRIX, 0, 64, 0 },
+			{ CONST_WORLDVIEWPROJ_MATRIX, 64, 64, 0 },
+			{ CONST_VIEW_MATRIX, 128, 64, 0 },
+			{ CONST_VIEWPROJ_MATRIX, 192, 64, 0 },
+			{ CONST_POSITIONSCALE, 256, 16, 0 },
+			{ CONST_POSITIONOFFSET, 272, 16, 0 },
+		};
+		layouts[1].size = 288;
+		layouts[2].constants =
+		{
+			{ CONST_LIGHTPOSV, 0, 16, 0 },
+			{ CONST_LIGHT_AMBIENT, 16, 12, 0 },
+			{ CONST_INVVIEW_MATRIX, 32, 128, 2 },
+			{ CONST_VIEW_MATRIX, 160, 128, 2 },
+			{ CONST_NEARPLANEDIST, 288, 4, 0 },
+			{ CONST_FARPLANEDIST, 292, 4, 0 },
+		};
+		layouts[2].size = 304;
+		layouts[3].constants =
+		{
+			{ CONST_INVVIEW_MATRIX, 0, 64, 0 },
+			{ CONST_LIGHTVIEWPROJ_MATRIX, 64, 64, 0 },
+			{ CONST_INVVIEWLIGHTVIEWPROJ_MATRIX, 128, 64, 0 },
+			{ CONST_NEARPLANEHEIGHT, 192, 4, 0 },
+			{ CONST_NEARPLANEWIDTH, 196, 4, 0 },
+			{ CONST_PROJECTIONRANGE, 200, 4, 0 },
+			{ CONST_LIGHTPOSV, 208, 16, 0 },
+		};
+		layouts[3].size = 224;
+		return layouts;
+	}
+
+	// Row vectors, summed in the order of XMMatrixMultiply
+	inline void Multiply(const float a[16], const float b[16], float result[16])
+	{
+		for (int row = 0; row < 4; ++row)
+		{
+			for (int column = 0; column < 4; ++column)
+			{
+				float sum = a[row * 4] * b[column];
+				sum += a[row * 4 + 1] * b[4 + column];
+				sum += a[row * 4 + 2] * b[8 + column];
+				sum += a[row * 4 + 3] * b[12 + column];
+				result[row * 4 + column] = sum;
+			}
+		}
+	}
+
+	// Rotation from a random quaternion and a translation: the views, lights and objects
+	inline void MakeRigidTransform(std::mt19937& random, float scale, float matrix[16])
+	{
+		std::normal_distribution<float> normal;
+		float q[4] = { normal(random), normal(random), normal(random), normal(random) };
+		float length = std::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+		for (float& component : q)
+			component /= length;
+
+		const float x = q[0], y = q[1], z = q[2], w = q[3];
+		const float rotation[9] =
+		{
+			1 - 2 * (y * y + z * z), 2 * (x * y + z * w), 2 * (x * z - y * w),
+			2 * (x * y - z * w), 1 - 2 * (x * x + z * z), 2 * (y * z + x * w),
+			2 * (x * z + y * w), 2 * (y * z - x * w), 1 - 2 * (x * x + y * y)
+		};
+		std::uniform_real_distribution<float> translation(-5.0f, 5.0f);
+		for (int row = 0; row < 3; ++row)
+		{
+			for (int column = 0; column < 3; ++column)
+				matrix[row * 4 + column] = rotation[row * 3 + column] * scale;
+			matrix[row * 4 + 3] = 0.0f;
+		}
+		matrix[12] = translation(random);
+		matrix[13] = translation(random);
+		matrix[14] = translation(random);
+		matrix[15] = 1.0f;
+	}
+
+	// Right handed perspective projection, as XMMatrixPerspectiveFovRH
+	inline void MakeProjection(std::mt19937& random, float matrix[16])
+	{
+		std::uniform_real_distribution<float> scale(0.8f, 2.0f);
+		const float nearDistance = 0.1f, farDistance = 20.0f;
+		std::memset(matrix, 0, 16 * sizeof(float));
+		matrix[0] = scale(random);
+		matrix[5] = scale(random);
+		matrix[10] = farDistance / (nearDistance - farDistance);
+		matrix[11] = -1.0f;
+		matrix[14] = nearDistance * farDistance / (nearDistance - farDistance);
+	}
+
+	inline void MakeHead(std::mt19937& random, FrameConstants::Inputs& inputs)
+	{
+		MakeRigidTransform(random, 1.0f, inputs.view[0]);
+		std::memcpy(inputs.view[1], inputs.view[0], sizeof(inputs.view[0]));
+		inputs.view[1][12] -= 0.064f;
+		MakeProjection(random, inputs.projection[0]);
+		MakeProjection(random, inputs.projection[1]);
+		std::memcpy(inputs.cameraView, inputs.view[0], sizeof(inputs.cameraView));
+	}
+
+	inline void MakeLights(std::mt19937& random, FrameConstants::Inputs& inputs)
+	{
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		float lightView[16], orthographic[16] = { 0.1f, 0, 0, 0, 0, 0.1f, 0, 0, 0, 0, -0.05f, 0, 0, 0, 0.5f, 1 };
+		MakeRigidTransform(random, 1.0f, lightView);
+		Multiply(lightView, orthographic, inputs.lightViewProjection);
+		for (int i = 0; i < 3; ++i)
+		{
+			inputs.lightPosition[i] = 10.0f * unit(random) - 5.0f;
+			inputs.ambient[i] = unit(random);
+		}
+		inputs.lightPosition[3] = 1.0f;
+		inputs.ambient[3] = 1.0f;
+		inputs.nearPlaneHeight = unit(random);
+		inputs.nearPlaneWidth = unit(random);
+		inputs.nearPlaneDistance = 0.1f;
+		inputs.farPlaneDistance = 20.0f + unit(random);
+		inputs.projectionRange = inputs.farPlaneDistance / (inputs.nearPlaneDistance - inputs.farPlaneDistance);
+	}
+
+	inline void MakeObject(std::mt19937& random, bool quantized, DrawConstants::Inputs& inputs)
+	{
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		MakeRigidTransform(random, 0.1f + unit(random), inputs.world);
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			inputs.positionScale[axis] = quantized ? 4.0f * unit(random) : 1.0f;
+			inputs.positionOffset[axis] = quantized ? unit(random) - 0.5f : 0.0f;
+		}
+		inputs.positionScale[3] = quantized ? 1.0f : 0.0f;
+		inputs.positionOffset[3] = 0.0f;
+	}
+}
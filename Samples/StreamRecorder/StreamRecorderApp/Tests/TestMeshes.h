@@ -0,0 +1,229 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Meshes and rays of the MeshBvh tests and benchmark, and the brute-force ray
+// test in double precision the hits are checked against.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "../Cannon/MeshBvh.h"
+
+namespace TestMeshes
+{
+	// Positions interleaved with other vertex attributes, as in the vertex buffers of the app.
+	// The other attributes are NaNs, so reading them as positions shows in the hits.
+	struct Mesh
+	{
+		static constexpr size_t kVertexFloats = 8;
+
+		std::vector<float> vertices;
+		std::vector<uint32_t> indices;
+
+		size_t GetVertexCount() const { return vertices.size() / kVertexFloats; }
+		size_t GetStride() const { return kVertexFloats * sizeof(float); }
+		const float* GetPosition(uint32_t index) const { return &vertices[kVertexFloats * index]; }
+
+		uint32_t AddVertex(float x, float y, float z)
+		{
+			vertices.insert(vertices.end(), { x, y, z });
+			vertices.insert(vertices.end(), kVertexFloats - 3, std::numeric_limits<float>::quiet_NaN());
+			return static_cast<uint32_t>(GetVertexCount() - 1);
+		}
+	};
+
+	struct Ray
+	{
+		float origin[3];
+		float direction[3];
+	};
+
+	// Triangles of up to triangleSize in [-1, 1]^3, overlapping and of both windings.
+	// One in ten is degenerate (two equal corners, or three aligned ones).
+	inline Mesh MakeTriangleSoup(std::mt19937& random, size_t triangleCount, float triangleSize)
+	{
+		std::uniform_real_distribution<float> position(-1.0f, 1.0f);
+		std::uniform_real_distribution<float> offset(-triangleSize, triangleSize);
+
+		Mesh mesh;
+		for (size_t i = 0; i < triangleCount; ++i)
+		{
+			float center[3] = { position(random), position(random), position(random) };
+			uint32_t a = mesh.AddVertex(center[0] + offset(random), center[1] + offset(random), center[2] + offset(random));
+			uint32_t b = mesh.AddVertex(center[0] + offset(random), center[1] + offset(random), center[2] + offset(random));
+			uint32_t c = mesh.AddVertex(center[0] + offset(random), center[1] + offset(random), center[2] + offset(random));
+			if (i % 10 == 3)
+			{
+				c = b;
+			}
+			else if (i % 10 == 7)
+			{
+				const float* pa = mesh.GetPosition(a);
+				const float* pb = mesh.GetPosition(b);
+				c = mesh.AddVertex(2.0f * pb[0] - pa[0], 2.0f * pb[1] - pa[1], 2.0f * pb[2] - pa[2]);
+			}
+			mesh.indices.insert(mesh.indices.end(), { a, b, c });
+		}
+		return mesh;
+	}
+
+	// Closed surface of a bumpy sphere of radius about 1, 2 * n * n triangles, front faces outwards
+	inline Mesh MakeBumpySphere(size_t n)
+	{
+		const float pi = 3.14159265358979f;
+		Mesh mesh;
+		for (size_t i = 0; i <= n; ++i)
+		{
+			for (size_t j = 0; j < n; ++j)
+			{
+				float theta = pi * i / n;
+				float phi = 2.0f * pi * j / n;
+				float radius = 1.0f + 0.1f * std::sin(5.0f * theta) * std::cos(7.0f * phi);
+				mesh.AddVertex(radius * std::sin(theta) * std::cos(phi), radius * std::sin(theta) * std::sin(phi), radius * std::cos(theta));
+			}
+		}
+
+		// The poles are n vertices at the same place, so their triangles are degenerate
+		for (uint32_t i = 0; i < n; ++i)
+		{
+			for (uint32_t j = 0; j < n; ++j)
+			{
+				uint32_t a = i * (uint32_t) n + j;
+				uint32_t b = i * (uint32_t) n + (j + 1) % (uint32_t) n;
+				uint32_t c = a + (uint32_t) n;
+				uint32_t d = b + (uint32_t) n;
+				mesh.indices.insert(mesh.indices.end(), { a, b, c, b, d, c });
+			}
+		}
+		return mesh;
+	}
+
+	// Rays from around the mesh towards points of its bounds, with unnormalized directions.
+	// One in eight is along an axis, which has zero direction components.
+	inline std::vector<Ray> MakeRays(std::mt19937& random, size_t rayCount)
+	{
+		std::uniform_real_distribution<float> origin(-2.5f, 2.5f);
+		std::uniform_real_distribution<float> target(-1.0f, 1.0f);
+		std::uniform_real_distribution<float> logScale(-2.0f, 2.0f);
+
+		std::vector<Ray> rays(rayCount);
+		for (size_t i = 0; i < rayCount; ++i)
+		{
+			Ray& ray = rays[i];
+			float scale = std::exp(logScale(random));
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				ray.origin[axis] = origin(random);
+				ray.direction[axis] = (target(random) - ray.origin[axis]) * scale;
+			}
+
+			if (i % 8 == 5)
+			{
+				int axis = static_cast<int>(i / 8 % 3);
+				for (int other = 0; other < 3; ++other)
+				{
+					if (other != axis)
+						ray.direction[other] = 0.0f;
+				}
+				ray.origin[(axis + 1) % 3] = target(random);
+				ray.origin[(axis + 2) % 3] = target(random);
+			}
+		}
+		return rays;
+	}
+
+	// Relative margin on the barycentric coordinates and on the distance range. The float hits are
+	// between those of the triangles grown by the margin and those of the triangles shrunk by it.
+	constexpr double kMargin = 1e-4;
+
+	// Distance of the hit of a triangle in double precision. margin > 0 grows the triangle
+	// and the distance range, margin < 0 shrinks them.
+	inline bool IntersectTriangle(const Mesh& mesh, size_t triangle, const Ray& ray,
+		MeshBvh::Culling culling, float maxDistance, double margin, double& distance)
+	{
+		const float* v0 = mesh.GetPosition(mesh.indices[3 * triangle + 0]);
+		const float* v1 = mesh.GetPosition(mesh.indices[3 * triangle + 1]);
+		const float* v2 = mesh.GetPosition(mesh.indices[3 * triangle + 2]);
+		double d[3], e1[3], e2[3], s[3];
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			d[axis] = ray.direction[axis];
+			e1[axis] = (double) v1[axis] - v0[axis];
+			e2[axis] = (double) v2[axis] - v0[axis];
+			s[axis] = (double) ray.origin[axis] - v0[axis];
+		}
+
+		double p[3] = { d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0] };
+		double q[3] = { s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0] };
+		double det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+
+		// Nearly parallel rays, whose culling depends on rounding, are only in the grown triangles
+		double scale = std::sqrt((e1[0] * e1[0] + e1[1] * e1[1] + e1[2] * e1[2]) * (e2[0] * e2[0] + e2[1] * e2[1] + e2[2] * e2[2]) *
+			(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]));
+		bool grazing = std::fabs(det) <= std::fabs(margin) * scale;
+		if (det == 0.0 || (margin < 0.0 && grazing))
+			return false;
+		if (!grazing && ((culling == MeshBvh::Culling::BackFaces && !(det < 0.0)) || (culling == MeshBvh::Culling::FrontFaces && !(det > 0.0))))
+			return false;
+
+		double u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) / det;
+		double v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) / det;
+		distance = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) / det;
+		return u >= -margin && v >= -margin && u + v <= 1.0 + margin &&
+			distance >= -margin && distance <= (double) maxDistance * (1.0 + margin) + std::max(margin, 0.0);
+	}
+
+	// Closest or furthest hit of the brute-force loop, any hit counts as the closest one
+	inline bool IntersectReference(const Mesh& mesh, const Ray& ray, MeshBvh::HitMode mode,
+		MeshBvh::Culling culling, float maxDistance, double margin, double& distance)
+	{
+		bool found = false;
+		for (size_t triangle = 0; triangle < mesh.indices.size() / 3; ++triangle)
+		{
+			double triangleDistance;
+			if (!IntersectTriangle(mesh, triangle, ray, culling, maxDistance, margin, triangleDistance))
+				continue;
+
+			if (!found || (mode == MeshBvh::HitMode::Furthest ? triangleDistance > distance : triangleDistance < distance))
+				distance = triangleDistance;
+			found = true;
+		}
+		return found;
+	}
+
+	inline double DistanceTolerance(double distance)
+	{
+		return kMargin * (1.0 + std::fabs(distance));
+	}
+
+	// Unit front face normal of a triangle, normalize(cross(c - a, b - a)) as in MeshBvh::Hit. Returns the length before normalization.
+	inline double GetFrontFaceNormal(const Mesh& mesh, size_t triangle, double normal[3])
+	{
+		const float* a = mesh.GetPosition(mesh.indices[3 * triangle + 0]);
+		const float* b = mesh.GetPosition(mesh.indices[3 * triangle + 1]);
+		const float* c = mesh.GetPosition(mesh.indices[3 * triangle + 2]);
+		double ca[3] = { (double) c[0] - a[0], (double) c[1] - a[1], (double) c[2] - a[2] };
+		double ba[3] = { (double) b[0] - a[0], (double) b[1] - a[1], (double) b[2] - a[2] };
+		normal[0] = ca[1] * ba[2] - ca[2] * ba[1];
+		normal[1] = ca[2] * ba[0] - ca[0] * ba[2];
+		normal[2] = ca[0] * ba[1] - ca[1] * ba[0];
+		double length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		for (int axis = 0; axis < 3 && length > 0.0; ++axis)
+			normal[axis] /= length;
+		return length;
+	}
+}
@@ -0,0 +1,131 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// The OBJ loader that Mesh ran before ObjLoader, which the ObjLoader tests and
+// benchmark compare ParseObj with.
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../Cannon/ObjLoader.h"
+
+namespace TestObjs
+{
+	// The loop of Mesh(std::string) before ObjLoader, on lines instead of fgets. It only handles triangles, and faces
+	// whose corners have a texcoord or a normal index.
+	inline void ParseObjReference(const std::string& text, std::vector<ObjVertex>& vertices, std::vector<uint32_t>& indices)
+	{
+		vertices.clear();
+		indices.clear();
+
+		std::vector<std::vector<float>> positions;
+		std::vector<std::vector<float>> texcoords;
+		std::vector<std::vector<float>> normals;
+		std::map<std::vector<unsigned>, unsigned> knownVertices;
+
+		std::stringstream lines(text);
+		std::string rawLine;
+		std::stringstream line;
+		while (std::getline(lines, rawLine))
+		{
+			line.clear();
+			line.str(rawLine);
+
+			if (line.peek() == '#')
+				continue;
+
+			std::string word;
+			line >> word;
+
+			if (word == "v")
+			{
+				std::vector<float> position(3);
+				line >> position[0] >> position[1] >> position[2];
+				positions.push_back(position);
+			}
+
+			if (word == "vn")
+			{
+				std::vector<float> normal(3);
+				line >> normal[0] >> normal[1] >> normal[2];
+				normals.push_back(normal);
+			}
+
+			if (word == "vt")
+			{
+				std::vector<float> texcoord(2);
+				line >> texcoord[0] >> texcoord[1];
+				texcoord[1] = 1 - texcoord[1];
+				texcoords.push_back(texcoord);
+			}
+
+			if (word == "f")
+			{
+				for (;;)
+				{
+					line >> word;
+					if (line.fail())
+						break;
+
+					word += "/";
+
+					size_t startIndex = 0;
+					std::vector<unsigned> ptnSet { 0, 0, 0 };
+					for (size_t i = 0; i < 3; ++i)
+					{
+						size_t endIndex = word.find_first_of('/', startIndex);
+						if (endIndex != startIndex)
+						{
+							std::string value = word.substr(startIndex, endIndex - startIndex);
+							ptnSet[i] = atoi(value.c_str());
+						}
+						startIndex = endIndex + 1;
+					}
+
+					auto iterator = knownVertices.find(ptnSet);
+					if (iterator != knownVertices.end())
+					{
+						indices.push_back(iterator->second);
+					}
+					else
+					{
+						ObjVertex vertex;
+						std::memset(&vertex, 0, sizeof(vertex));
+						if (ptnSet[0] != 0)
+						{
+							std::memcpy(vertex.position, positions[ptnSet[0] - 1].data(), 3 * sizeof(float));
+							vertex.position[3] = 1.0f;
+						}
+						if (ptnSet[1] != 0)
+							std::memcpy(vertex.texcoord, texcoords[ptnSet[1] - 1].data(), 2 * sizeof(float));
+						if (ptnSet[2] != 0)
+							std::memcpy(vertex.normal, normals[ptnSet[2] - 1].data(), 3 * sizeof(float));
+
+						vertices.push_back(vertex);
+						indices.push_back((unsigned) vertices.size() - 1);
+						knownVertices[ptnSet] = (unsigned) vertices.size() - 1;
+					}
+				}
+			}
+		}
+
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+			std::swap(indices[i + 0], indices[i + 2]);
+	}
+}
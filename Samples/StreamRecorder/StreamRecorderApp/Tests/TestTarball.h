@@ -0,0 +1,105 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Writes tarballs laid out as those of Io::Tarball, whose sprintf_s and WinRT
+// dependencies keep it out of the desktop tests, along with their index.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../TarIndex.h"
+
+namespace TestTarball
+{
+    // Member data, e.g. of the frame "<timestamp>.pgm"
+    inline std::vector<char> MakeMemberData(size_t size, uint64_t seed)
+    {
+        std::vector<char> data(size);
+        for (size_t i = 0; i < size; ++i)
+        {
+            data[i] = static_cast<char>((seed * 31 + i * 7) & 0xFF);
+        }
+        return data;
+    }
+
+    class Writer
+    {
+    public:
+        Writer(const std::filesystem::path& tarballFileName, bool writeIndex)
+            : m_tarballFile(tarballFileName, std::ios::binary | std::ios::trunc)
+        {
+            if (writeIndex)
+            {
+                m_index.Open(std::filesystem::path(tarballFileName) += Io::kTarIndexExtension);
+            }
+        }
+
+        ~Writer()
+        {
+            Close();
+        }
+
+        void AddFile(const std::string& fileName, const std::vector<char>& data)
+        {
+            char header[512] = {};
+            std::memcpy(header, fileName.c_str(), fileName.size());
+            std::memcpy(header + 100, "0100777", 8);
+            std::memcpy(header + 108, "0000000", 8);
+            std::memcpy(header + 116, "0000000", 8);
+            std::snprintf(header + 124, 12, "%011llo", static_cast<unsigned long long>(data.size()));
+            std::memcpy(header + 136, "00000000000", 12);
+            std::memset(header + 148, ' ', 8);
+            header[156] = '0';
+            std::memcpy(header + 257, "ustar", 6);
+            std::memcpy(header + 263, "00", 2);
+
+            uint64_t checksum = 0;
+            for (const char c : header)
+            {
+                checksum += static_cast<uint8_t>(c);
+            }
+            std::snprintf(header + 148, 7, "%06llo", static_cast<unsigned long long>(checksum));
+
+            m_tarballFile.write(header, sizeof(header));
+            m_tarballFile.write(data.data(), data.size());
+
+            m_index.AddEntry(fileName, m_offset + sizeof(header), data.size());
+            m_offset += sizeof(header) + data.size();
+
+            const size_t padding = (512 - data.size() % 512) % 512;
+            m_tarballFile.write(std::vector<char>(padding, 0).data(), padding);
+            m_offset += padding;
+        }
+
+        void Close()
+        {
+            if (m_tarballFile.is_open())
+            {
+                std::vector<char> zeros(1024, 0);
+                m_tarballFile.write(zeros.data(), zeros.size());
+                m_tarballFile.close();
+            }
+            m_index.Close();
+        }
+
+    private:
+        std::ofstream m_tarballFile;
+        Io::TarIndexWriter m_index;
+        uint64_t m_offset = 0;
+    };
+}
@@ -0,0 +1,400 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import argparse
+import multiprocessing
+import time
+from pathlib import Path
+
+import numpy as np
+
+from project_hand_eye_to_pv import load_pv_data
+from save_pclouds import (cam2world, find_rig2world, get_grid_normals, get_points_grid,
+                          init_pcloud_worker, worker_state)
+from shared_arrays import SharedArrays
+from stream_tar import BoundedPool, iter_chunks
+from tsdf_fusion import iter_depth_frames, pack_keys, unpack_keys
+from utils import load_extrinsics, load_lut, load_rig2world_transforms, project_on_pv
+
+# Merge the depth frames of a recording in a single world space point cloud,
+# without writing one point cloud per frame.
+#
+# Each frame's points are put in world space with its rig2world transform,
+# and accumulated in a sparse voxel grid: every voxel keeps its point count
+# and the sums of its points' positions, colors and normals, so the merged
+# cloud has one point per voxel at the mean position, color and normal of
+# the points that fell in it.
+#
+# Workers compute the points, normals and colors of chunks of frames and
+# reduce them per voxel; only these per-voxel sums are sent to the main
+# process, which owns the grid. The grid grows with the volume observed,
+# not with the number of frames. If it outgrows max_voxels, its voxel size
+# is doubled (voxels are merged 8 by 8), so memory stays bounded whatever
+# the length of the session.
+
+DEFAULT_VOXEL_SIZE = 0.01
+DEFAULT_MAX_DEPTH = 7.8
+DEFAULT_MAX_VOXELS = 20000000
+DEFAULT_CHUNK_SIZE = 8
+# Initial capacity of the grid arrays, doubled when full
+INITIAL_VOXELS = 1 << 16
+
+
+class VoxelGrid(object):
+    """Sparse voxel grid of running point sums.
+
+    Voxels are looked up by their packed coordinates (see pack_keys) in a
+    sorted array of keys, so whole frames are merged with vectorized
+    searches instead of one dictionary lookup per voxel.
+    """
+
+    def __init__(self, voxel_size=DEFAULT_VOXEL_SIZE, max_voxels=DEFAULT_MAX_VOXELS):
+        self.base_voxel_size = voxel_size
+        # The voxels are 2^level times larger than base_voxel_size
+        self.level = 0
+        self.max_voxels = max_voxels
+        self.size = 0
+        self.peak_bytes = 0
+        self._reset(INITIAL_VOXELS)
+
+    @property
+    def voxel_size(self):
+        return self.base_voxel_size * (1 << self.level)
+
+    def __len__(self):
+        return self.size
+
+    def _reset(self, capacity):
+        self.sorted_keys = np.zeros(0, dtype=np.int64)
+        self.sorted_slots = np.zeros(0, dtype=np.int64)
+        self.counts = np.zeros(capacity, dtype=np.uint32)
+        self.color_counts = np.zeros(capacity, dtype=np.uint32)
+        self.position_sums = np.zeros((capacity, 3), dtype=np.float64)
+        self.color_sums = np.zeros((capacity, 3), dtype=np.float32)
+        self.normal_sums = np.zeros((capacity, 3), dtype=np.float32)
+        self.size = 0
+
+    def _grow(self, capacity):
+        for name in ['counts', 'color_counts', 'position_sums', 'color_sums', 'normal_sums']:
+            array = getattr(self, name)
+            grown = np.zeros((capacity,) + array.shape[1:], dtype=array.dtype)
+            grown[:self.size] = array[:self.size]
+            setattr(self, name, grown)
+
+    def get_nbytes(self):
+        return sum(array.nbytes for array in [self.sorted_keys, self.sorted_slots, self.counts,
+                                              self.color_counts, self.position_sums,
+                                              self.color_sums, self.normal_sums])
+
+    def add(self, voxel_sums):
+        """Merge per-voxel sums (see reduce_voxels), keyed at base_voxel_size"""
+        keys, counts, position_sums, color_counts, color_sums, normal_sums = voxel_sums
+        if self.level > 0:
+            keys, inverse = np.unique(pack_keys(unpack_keys(keys) >> self.level),
+                                      return_inverse=True)
+            counts, color_counts, position_sums, color_sums, normal_sums = sum_by_voxel(
+                inverse.reshape(-1), len(keys), counts, color_counts,
+                position_sums, color_sums, normal_sums)
+
+        # keys are unique and sorted: find the existing voxels, insert the new ones
+        positions = np.searchsorted(self.sorted_keys, keys)
+        found = positions < len(self.sorted_keys)
+        found[found] = self.sorted_keys[positions[found]] == keys[found]
+        slots = np.empty(len(keys), dtype=np.int64)
+        slots[found] = self.sorted_slots[positions[found]]
+
+        n_new = len(keys) - int(np.count_nonzero(found))
+        if self.size + n_new > len(self.counts):
+            self._grow(max(2 * len(self.counts), self.size + n_new))
+        slots[~found] = np.arange(self.size, self.size + n_new)
+        self.sorted_keys = np.insert(self.sorted_keys, positions[~found], keys[~found])
+        self.sorted_slots = np.insert(self.sorted_slots, positions[~found], slots[~found])
+        self.size += n_new
+
+        self.counts[slots] += counts.astype(np.uint32)
+        self.color_counts[slots] += color_counts.astype(np.uint32)
+        self.position_sums[slots] += position_sums
+        self.color_sums[slots] += color_sums
+        self.normal_sums[slots] += normal_sums
+        self.peak_bytes = max(self.peak_bytes, self.get_nbytes())
+
+        while self.size > self.max_voxels:
+            self.coarsen()
+
+    def coarsen(self):
+        """Double the voxel size, merging voxels 8 by 8"""
+        n = self.size
+        keys, inverse = np.unique(pack_keys(unpack_keys(self.sorted_keys) >> 1),
+                                  return_inverse=True)
+        # Sums of the voxels in sorted key order
+        order = self.sorted_slots
+        sums = sum_by_voxel(inverse.reshape(-1), len(keys), self.counts[order],
+                            self.color_counts[order], self.position_sums[order],
+                            self.color_sums[order], self.normal_sums[order])
+        self.level += 1
+        self._reset(max(INITIAL_VOXELS, len(keys)))
+        self.sorted_keys = keys
+        self.sorted_slots = np.arange(len(keys), dtype=np.int64)
+        self.size = len(keys)
+        (self.counts[:self.size], self.color_counts[:self.size], self.position_sums[:self.size],
+         self.color_sums[:self.size], self.normal_sums[:self.size]) = sums
+        print(f"More than {self.max_voxels} voxels ({n}), voxel size increased to "
+              f"{self.voxel_size:.3f}m ({self.size} voxels)")
+
+    def get_points(self, min_points=1):
+        """Merged cloud: (points, colors or None, normals) of the voxels with at
+        least min_points points, in voxel key order. Voxels never seen by the
+        PV camera are black."""
+        keep = self.sorted_slots[self.counts[self.sorted_slots] >= max(1, min_points)]
+        counts = self.counts[keep].astype(np.float64)[:, np.newaxis]
+        points = self.position_sums[keep] / counts
+
+        colors = None
+        if np.any(self.color_counts[:self.size]):
+            color_counts = self.color_counts[keep].astype(np.float32)[:, np.newaxis]
+            colors = np.divide(self.color_sums[keep], color_counts,
+                               out=np.zeros((len(keep), 3), dtype=np.float32),
+                               where=color_counts > 0)
+
+        # Mean of unit normals, renormalized
+        normals = self.normal_sums[keep]
+        norm = np.linalg.norm(normals, axis=1, keepdims=True)
+        normals = np.divide(normals, norm, out=np.zeros_like(normals), where=norm > 0)
+        return points, colors, normals
+
+
+def sum_by_voxel(inverse, n_voxels, counts, color_counts, position_sums, color_sums, normal_sums):
+    """Sums of per-point (or per-voxel) values grouped by voxel (inverse)"""
+    def sum_rows(values):
+        return np.stack([np.bincount(inverse, weights=values[:, axis], minlength=n_voxels)
+                         for axis in range(3)], axis=1)
+
+    return (np.bincount(inverse, weights=counts, minlength=n_voxels),
+            np.bincount(inverse, weights=color_counts, minlength=n_voxels),
+            sum_rows(position_sums), sum_rows(color_sums), sum_rows(normal_sums))
+
+
+def reduce_voxels(points, colors, normals, voxel_size):
+    """Per-voxel sums of world space points, as (keys, point counts,
+    position sums, colored point counts, color sums, normal sums)"""
+    keys, inverse = np.unique(pack_keys(np.floor(points / voxel_size)), return_inverse=True)
+    inverse = inverse.reshape(-1)
+    n_points = len(points)
+    if colors is None:
+        colors = np.zeros((n_points, 3), dtype=np.float32)
+    colored = np.any(colors > 0, axis=1).astype(np.float64)
+    counts, color_counts, position_sums, color_sums, normal_sums = sum_by_voxel(
+        inverse, len(keys), np.ones(n_points), colored, points, colors, normals)
+    return (keys, counts.astype(np.uint32), position_sums, color_counts.astype(np.uint32),
+            color_sums.astype(np.float32), normal_sums.astype(np.float32))
+
+
+def get_frame_points(timestamp, img):
+    """World space points, colors (None without PV) and normals of a depth frame,
+    None if the frame has no rig2world transform"""
+    config = worker_state['config']
+    arrays = worker_state['arrays']
+    rig2world = find_rig2world(float(timestamp))
+    if rig2world is None:
+        return None
+
+    height, width = img.shape
+    img = np.where(img <= config['max_depth'] * 1000., img, 0)
+    points_grid, valid = get_points_grid(img, arrays['lut'], worker_state['points_buffer'])
+    normals = get_grid_normals(points_grid, valid, width, height)[valid]
+    xyz, cam2world_transform = cam2world(points_grid[valid], arrays['rig2cam'], rig2world)
+    normals = normals @ cam2world_transform[:3, :3].T
+
+    rgb = None
+    if config['has_pv']:
+        target_id = worker_state['pv_index'].nearest(float(timestamp))
+        pv_img = worker_state['pv_frames'].read(arrays['pv_timestamps'][target_id])
+        if pv_img is not None:
+            rgb = project_on_pv(xyz, pv_img, arrays['pv2world_transforms'][target_id],
+                                arrays['focal_lengths'][target_id], config['principal_point'])[0]
+    return xyz, rgb, normals
+
+
+def aggregate_chunk(frames):
+    """Per-voxel sums of a chunk of (timestamp, depth image) frames.
+
+    Returns (voxel sums or None, frames aggregated, frames without pose, point count)
+    """
+    frame_points = [get_frame_points(timestamp, img) for timestamp, img in frames]
+    frame_points = [points for points in frame_points if points is not None]
+    n_skipped = len(frames) - len(frame_points)
+    if not frame_points:
+        return None, 0, n_skipped, 0
+
+    points = np.concatenate([xyz for xyz, _, _ in frame_points])
+    colors = None
+    if any(rgb is not None for _, rgb, _ in frame_points):
+        colors = np.concatenate([rgb if rgb is not None else np.zeros_like(xyz)
+                                 for xyz, rgb, _ in frame_points])
+    normals = np.concatenate([normals for _, _, normals in frame_points])
+    voxel_sums = reduce_voxels(points, colors, normals, worker_state['config']['voxel_size'])
+    return voxel_sums, len(frame_points), n_skipped, len(points)
+
+
+def save_points_ply(output_path, points, colors=None, normals=None):
+    """Save a point cloud as a binary ply"""
+    fields = [('x', '<f4'), ('y', '<f4'), ('z', '<f4')]
+    if normals is not None:
+        fields += [('nx', '<f4'), ('ny', '<f4'), ('nz', '<f4')]
+    if colors is not None:
+        fields += [('red', 'u1'), ('green', 'u1'), ('blue', 'u1')]
+    vertices = np.zeros(len(points), dtype=fields)
+    vertices['x'], vertices['y'], vertices['z'] = points.T
+    if normals is not None:
+        vertices['nx'], vertices['ny'], vertices['nz'] = normals.T
+    if colors is not None:
+        colors = np.clip(np.around(colors * 255.), 0, 255).astype(np.uint8)
+        vertices['red'], vertices['green'], vertices['blue'] = colors.T
+
+    ply_types = {'<f4': 'float', 'u1': 'uchar'}
+    header = ("ply\n"
+              "format binary_little_endian 1.0\n"
+              f"element vertex {len(points)}\n" +
+              "".join(f"property {ply_types[dtype]} {name}\n" for name, dtype in fields) +
+              "end_header\n")
+    with open(output_path, 'wb') as f:
+        f.write(header.encode('ascii'))
+        f.write(vertices.tobytes())
+
+
+def aggregate_pclouds(folder, sensor_name='Depth Long Throw', voxel_size=DEFAULT_VOXEL_SIZE,
+                      max_depth=DEFAULT_MAX_DEPTH, min_points=1, max_voxels=DEFAULT_MAX_VOXELS,
+                      workers=None, chunk_size=DEFAULT_CHUNK_SIZE, output_path=None):
+    """Merge the depth frames of a recording in one voxel downsampled point cloud.
+
+    Args:
+        folder ([Path]): Recording folder
+        sensor_name ([str]): Depth sensor
+        voxel_size ([float]): Voxel size (resolution of the merged cloud) in meters
+        max_depth ([float]): Depth values further than this (meters) are ignored
+        min_points ([int]): Voxels with fewer points are left out of the merged cloud
+        max_voxels ([int]): The voxel size is doubled when the grid has more voxels
+        workers ([int], optional): Number of worker processes, cpu count by default
+        chunk_size ([int]): Number of frames sent to a worker at once
+        output_path ([Path], optional): Output cloud, <folder>/<sensor_name>_aggregated.ply by default
+
+    Returns a dictionary with throughput and memory statistics.
+    """
+    lut = load_lut(folder / f'{sensor_name}_lut.bin')
+    rig2cam = load_extrinsics(folder / f'{sensor_name}_extrinsics.txt')
+    rig2world_timestamps, rig2world_transforms = load_rig2world_transforms(
+        folder / f'{sensor_name}_rig2world.txt')
+    output_path = output_path or folder / f'{sensor_name}_aggregated.ply'
+
+    # Color from the converted PV frames if there are any
+    pv_info_paths = sorted(folder.glob('*pv.txt'))
+    has_pv = len(pv_info_paths) > 0 and (folder / 'PV').exists()
+    pv_timestamps = focal_lengths = pv2world_transforms = principal_point = None
+    if has_pv:
+        (pv_timestamps, focal_lengths, pv2world_transforms, ox,
+         oy, _, _) = load_pv_data(pv_info_paths[0])
+        principal_point = np.array([ox, oy])
+
+    config = {'folder': folder,
+              'has_pv': has_pv,
+              'principal_point': principal_point,
+              'voxel_size': voxel_size,
+              'max_depth': max_depth}
+    shared = SharedArrays({'lut': lut,
+                           'rig2cam': rig2cam,
+                           'rig2world_timestamps': rig2world_timestamps,
+                           'rig2world_transforms': rig2world_transforms,
+                           'pv_timestamps': pv_timestamps,
+                           'focal_lengths': focal_lengths,
+                           'pv2world_transforms': pv2world_transforms})
+
+    workers = workers or multiprocessing.cpu_count()
+    grid = VoxelGrid(voxel_size, max_voxels)
+    totals = {'frames': 0, 'skipped_frames': 0, 'points': 0}
+    start = time.time()
+
+    def on_chunk_done(result):
+        voxel_sums, n_frames, n_skipped, n_points = result
+        if voxel_sums is not None:
+            grid.add(voxel_sums)
+        totals['frames'] += n_frames
+        totals['skipped_frames'] += n_skipped
+        totals['points'] += n_points
+
+    with shared:
+        # Keep at most two chunks per worker in flight
+        with BoundedPool(workers, 2 * workers,
+                         init_pcloud_worker, (shared.descriptors, config)) as pool:
+            for chunk in iter_chunks(iter_depth_frames(folder, sensor_name), chunk_size):
+                pool.submit(aggregate_chunk, (chunk,), callback=on_chunk_done)
+
+    points, colors, normals = grid.get_points(min_points)
+    save_points_ply(str(output_path), points, colors, normals)
+    seconds = time.time() - start
+
+    report = dict(totals)
+    report.update({'voxels': len(grid),
+                   'output_points': len(points),
+                   'voxel_size': grid.voxel_size,
+                   'grid_peak_bytes': grid.peak_bytes,
+                   'seconds': seconds,
+                   'frames_per_second': totals['frames'] / seconds if seconds > 0 else 0.,
+                   'points_per_second': totals['points'] / seconds if seconds > 0 else 0.,
+                   'workers': workers})
+    print(f"Aggregated {report['frames']} frames ({report['skipped_frames']} without pose, "
+          f"{report['points']} points) in {seconds:.2f}s: {report['frames_per_second']:.1f} "
+          f"frames/s, {report['points_per_second'] / 1e6:.2f} Mpoints/s with {workers} workers")
+    print(f"Saved {len(points)} points ({grid.voxel_size:.3f}m voxels, "
+          f"{grid.peak_bytes / 1e6:.1f} MB peak grid memory) to {output_path}")
+    return report
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Merge the depth frames in one point cloud')
+    parser.add_argument("--recording_path",
+                        required=True,
+                        help="Path to recording folder")
+    parser.add_argument("--sensor_name",
+                        default="Depth Long Throw",
+                        choices=["Depth Long Throw", "Depth AHaT"],
+                        help="Depth sensor to aggregate")
+    parser.add_argument("--voxel_size",
+                        type=float,
+                        default=DEFAULT_VOXEL_SIZE,
+                        help="Voxel size (resolution of the merged cloud) in meters")
+    parser.add_argument("--max_depth",
+                        type=float,
+                        default=DEFAULT_MAX_DEPTH,
+                        help="Ignore depth values further than this (meters)")
+    parser.add_argument("--min_points",
+                        type=int,
+                        default=1,
+                        help="Leave out the voxels with fewer points")
+    parser.add_argument("--max_voxels",
+                        type=int,
+                        default=DEFAULT_MAX_VOXELS,
+                        help="Double the voxel size when the grid has more voxels, "
+                        "bounds the memory used")
+    parser.add_argument("--workers",
+                        type=int,
+                        default=None,
+                        help="Number of worker processes, cpu count by default")
+    parser.add_argument("--chunk_size",
+                        type=int,
+                        default=DEFAULT_CHUNK_SIZE,
+                        help="Number of frames sent to a worker at once")
+
+    args = parser.parse_args()
+    aggregate_pclouds(Path(args.recording_path),
+                      args.sensor_name,
+                      args.voxel_size,
+                      args.max_depth,
+                      args.min_points,
+                      args.max_voxels,
+                      args.workers,
+                      args.chunk_size)
@@ -0,0 +1,176 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import argparse
+import contextlib
+import io
+import tempfile
+import time
+import tracemalloc
+from pathlib import Path
+
+import numpy as np
+
+from aggregate_pclouds import DEFAULT_VOXEL_SIZE, VoxelGrid, aggregate_pclouds, reduce_voxels
+from save_pclouds import cam2world, get_grid_normals, get_points_grid
+from tsdf_fusion_benchmark import (HEIGHT, WIDTH, get_camera_pose, get_pinhole_lut, render_depth,
+                                   write_synthetic_recording)
+
+# Throughput and peak memory of the merge of all the depth frames of a
+# recording in one voxel downsampled cloud: accumulated in the VoxelGrid of
+# aggregate_pclouds.py, chunk by chunk, and by the previous way of getting
+# that cloud, concatenating the points of every frame and downsampling them
+# at the end (one point per voxel at the mean position, color and normal of
+# its points, as open3d's voxel_down_sample). Both run in this process on
+# the frames of a synthetic long throw recording (tsdf_fusion_benchmark.py),
+# computed as aggregate_pclouds.py does; the time to compute the frames
+# alone is given apart. The peak memory is that of the numpy arrays
+# allocated (tracemalloc). Also the end to end time of aggregate_pclouds,
+# with its pool of workers, on the same recording.
+
+
+def iter_frame_points(n_frames):
+    """World space points and normals of the frames of the synthetic recording,
+    as aggregate_pclouds.get_frame_points computes them"""
+    lut = get_pinhole_lut()
+    for i_frame in range(n_frames):
+        rig2world = get_camera_pose(i_frame, n_frames)
+        points_grid, valid = get_points_grid(render_depth(rig2world, lut), lut)
+        normals = get_grid_normals(points_grid, valid, WIDTH, HEIGHT)[valid]
+        xyz, cam2world_transform = cam2world(points_grid[valid], np.eye(4), rig2world)
+        yield xyz, normals @ cam2world_transform[:3, :3].T
+
+
+def downsample(points, colors, normals, voxel_size):
+    """Mean point, color (over the colored points) and renormalized normal of
+    each voxel, in voxel coordinate order. Returns (voxel coordinates, points,
+    colors, normals)"""
+    coords, inverse = np.unique(np.floor(points / voxel_size).astype(np.int64), axis=0, return_inverse=True)
+    inverse = inverse.reshape(-1)
+
+    def mean(values, weights, n):
+        sums = np.stack([np.bincount(inverse, weights=values[:, axis] * weights, minlength=len(coords))
+                         for axis in range(3)], axis=1)
+        return np.divide(sums, n[:, np.newaxis], out=np.zeros_like(sums), where=n[:, np.newaxis] > 0)
+
+    ones = np.ones(len(points))
+    counts = np.bincount(inverse, minlength=len(coords)).astype(np.float64)
+    colored = np.any(colors > 0, axis=1).astype(np.float64)
+    color_counts = np.bincount(inverse, weights=colored, minlength=len(coords))
+    voxel_normals = mean(normals, ones, counts)
+    norm = np.linalg.norm(voxel_normals, axis=1, keepdims=True)
+    voxel_normals = np.divide(voxel_normals, norm, out=np.zeros_like(voxel_normals), where=norm > 0)
+    return coords, mean(points, ones, counts), mean(colors, colored, color_counts), voxel_normals
+
+
+def aggregate_concatenated(frames, voxel_size):
+    """All the points kept until the end, then downsampled"""
+    frame_points = list(frames)
+    points = np.concatenate([xyz for xyz, _ in frame_points])
+    normals = np.concatenate([normals for _, normals in frame_points])
+    del frame_points
+    return downsample(points, np.zeros_like(points), normals, voxel_size)
+
+
+def aggregate_voxel_grid(frames, voxel_size, chunk_size=8):
+    """Per-voxel sums of chunks of frames, merged in a VoxelGrid"""
+    grid = VoxelGrid(voxel_size)
+    chunk = []
+
+    def add_chunk():
+        points = np.concatenate([xyz for xyz, _ in chunk])
+        normals = np.concatenate([normals for _, normals in chunk])
+        grid.add(reduce_voxels(points, None, normals, voxel_size))
+        chunk.clear()
+
+    for frame in frames:
+        chunk.append(frame)
+        if len(chunk) == chunk_size:
+            add_chunk()
+    if chunk:
+        add_chunk()
+    return grid
+
+
+def measure(function):
+    """(result, seconds, peak bytes allocated) of function()"""
+    tracemalloc.start()
+    start = time.perf_counter()
+    result = function()
+    seconds = time.perf_counter() - start
+    peak = tracemalloc.get_traced_memory()[1]
+    tracemalloc.stop()
+    return result, seconds, peak
+
+
+def read_points_ply(path):
+    """Fields of a binary ply saved by save_points_ply"""
+    types = {'float': '<f4', 'uchar': 'u1'}
+    with open(path, 'rb') as f:
+        fields = []
+        n_points = 0
+        line = b''
+        while line != b'end_header\n':
+            line = f.readline()
+            words = line.decode('ascii').split()
+            if words[:2] == ['element', 'vertex']:
+                n_points = int(words[2])
+            elif words[:1] == ['property']:
+                fields.append((words[2], types[words[1]]))
+        return np.frombuffer(f.read(), dtype=fields, count=n_points)
+
+
+def run_benchmark(frame_counts, voxel_size, workers):
+    print(f"{'frames':>7} {'path':<22} {'seconds':>8} {'frames/s':>9} {'peak MB':>8} {'voxels':>9}")
+    for n_frames in frame_counts:
+        _, frames_seconds, frames_peak = measure(lambda: sum(len(xyz) for xyz, _ in iter_frame_points(n_frames)))
+        reference, concatenated_seconds, concatenated_peak = measure(
+            lambda: aggregate_concatenated(iter_frame_points(n_frames), voxel_size))
+        grid, grid_seconds, grid_peak = measure(lambda: aggregate_voxel_grid(iter_frame_points(n_frames), voxel_size))
+
+        # Same cloud: the voxel keys are in coordinate order too
+        points, _, normals = grid.get_points()
+        same = (len(points) == len(reference[1]) and np.allclose(points, reference[1], rtol=0, atol=1e-9) and
+                np.allclose(normals, reference[3], atol=1e-5))
+
+        for name, seconds, peak, n_voxels in [('frames only', frames_seconds, frames_peak, 0),
+                                              ('concatenated', concatenated_seconds, concatenated_peak,
+                                               len(reference[0])),
+                                              ('voxel grid', grid_seconds, grid_peak, len(grid))]:
+            print(f"{n_frames:>7} {name:<22} {seconds:>8.2f} {n_frames / seconds:>9.1f} {peak / 1e6:>8.1f} "
+                  f"{n_voxels:>9}")
+
+        with tempfile.TemporaryDirectory() as folder:
+            write_synthetic_recording(folder, n_frames)
+            with contextlib.redirect_stdout(io.StringIO()):
+                report = aggregate_pclouds(Path(folder), voxel_size=voxel_size, workers=workers)
+        print(f"{n_frames:>7} {f'aggregate_pclouds ({workers})':<22} {report['seconds']:>8.2f} "
+              f"{report['frames_per_second']:>9.1f} {report['grid_peak_bytes'] / 1e6:>8.1f} {report['voxels']:>9}")
+        if not same:
+            print("(different clouds)")
+    print("aggregate_pclouds: grid memory of the main process, without its workers")
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Point cloud aggregation benchmark')
+    parser.add_argument("--frames",
+                        type=int,
+                        nargs='+',
+                        default=[15, 60, 120],
+                        help="Frame counts of the synthetic recordings")
+    parser.add_argument("--voxel_size",
+                        type=float,
+                        default=DEFAULT_VOXEL_SIZE,
+                        help="Voxel size in meters")
+    parser.add_argument("--workers",
+                        type=int,
+                        default=2,
+                        help="Worker processes of aggregate_pclouds")
+
+    args = parser.parse_args()
+    run_benchmark(args.frames, args.voxel_size, args.workers)
@@ -0,0 +1,330 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import argparse
+import json
+import time
+from pathlib import Path
+
+import numpy as np
+
+from utils import folders_extensions, load_head_hand_eye_arrays, load_rig2world_transforms
+from project_hand_eye_to_pv import load_pv_data
+from tar_index import load_frame_timestamps
+from timestamp_matching import TimestampIndex
+
+HUNDREDS_OF_NS_TO_MS = 1e-4
+
+# Frame intervals longer than GAP_FACTOR times the nominal (median)
+# interval of the stream are gaps (dropped frames), intervals shorter than
+# SHORT_FACTOR times the nominal interval are short (frames bunched
+# together, usually right after a stall)
+GAP_FACTOR = 1.5
+SHORT_FACTOR = 0.5
+
+# Gaps less than this apart (in ms) are merged in a single drop burst
+BURST_MERGE_MS = 1000.
+
+# Bin edges of the frame interval histograms, relative to the nominal interval
+INTERVAL_HISTOGRAM_BINS = [0., 0.5, 0.9, 1.1, 1.5, 2.5, 4.5, np.inf]
+
+# At most this many gaps, duplicates, etc. are listed per stream in the
+# report, their counts are always complete
+MAX_LISTED = 100
+
+REPORT_NAME = 'session_report.json'
+
+
+def get_frame_suffix(extension):
+    """Frame file suffix of a stream from its folders_extensions pattern"""
+    return '.' + extension.split('.')[-1]
+
+
+def load_stream_timestamps(folder, name, extension):
+    """Frame timestamps of a stream, from its tarball index (or tar headers)
+    without extracting it, or from the extracted frames.
+
+    Returns (timestamps, source, ordered): ordered is True if the timestamps
+    are in the order the frames were recorded. None if the stream was not
+    recorded.
+    """
+    tar_path = folder / f'{name}.tar'
+    if tar_path.exists():
+        return load_frame_timestamps(tar_path, get_frame_suffix(extension)), 'tar', True
+    frames_folder = folder / name
+    if frames_folder.is_dir():
+        timestamps = sorted(int(path.stem) for path in frames_folder.glob('*%s' % extension))
+        return np.array(timestamps, dtype=np.int64), 'folder', False
+    return None
+
+
+def to_ms(hundreds_of_ns):
+    return float(hundreds_of_ns) * HUNDREDS_OF_NS_TO_MS
+
+
+def get_covered_intervals(sorted_timestamps, gap_threshold):
+    """[start, end] intervals covered by the stream, split at its gaps"""
+    if len(sorted_timestamps) == 0:
+        return np.zeros((0, 2), dtype=np.int64)
+    gap_ids = np.flatnonzero(np.diff(sorted_timestamps) > gap_threshold)
+    starts = np.concatenate([[sorted_timestamps[0]], sorted_timestamps[gap_ids + 1]])
+    ends = np.concatenate([sorted_timestamps[gap_ids], [sorted_timestamps[-1]]])
+    return np.stack([starts, ends], axis=1)
+
+
+def get_intervals_overlap(a, b):
+    """Total duration covered by both sorted, disjoint interval lists"""
+    total = 0
+    i = j = 0
+    while i < len(a) and j < len(b):
+        start = max(a[i][0], b[j][0])
+        end = min(a[i][1], b[j][1])
+        if end > start:
+            total += end - start
+        if a[i][1] < b[j][1]:
+            i += 1
+        else:
+            j += 1
+    return total
+
+
+def analyze_timestamps(timestamps, ordered=True):
+    """Frame rate and gap statistics of one stream.
+
+    Returns (report, covered intervals)
+    """
+    timestamps = np.asarray(timestamps, dtype=np.int64)
+    report = {'frame_count': int(len(timestamps))}
+    if len(timestamps) == 0:
+        return report, np.zeros((0, 2), dtype=np.int64)
+
+    # Timestamps going back in time, in recording order
+    if ordered:
+        reversal_ids = np.flatnonzero(np.diff(timestamps) < 0) + 1
+        report['reversals'] = {
+            'count': int(len(reversal_ids)),
+            'items': [{'index': int(i), 'timestamp': int(timestamps[i]),
+                       'previous_timestamp': int(timestamps[i - 1])}
+                      for i in reversal_ids[:MAX_LISTED]]}
+
+    sorted_timestamps = np.sort(timestamps)
+    unique_timestamps, counts = np.unique(sorted_timestamps, return_counts=True)
+    duplicate_ids = np.flatnonzero(counts > 1)
+    report['duplicates'] = {
+        'count': int(np.sum(counts[duplicate_ids] - 1)),
+        'items': [{'timestamp': int(unique_timestamps[i]), 'copies': int(counts[i])}
+                  for i in duplicate_ids[:MAX_LISTED]]}
+
+    report['first_timestamp'] = int(unique_timestamps[0])
+    report['last_timestamp'] = int(unique_timestamps[-1])
+    report['duration_s'] = to_ms(unique_timestamps[-1] - unique_timestamps[0]) * 1e-3
+    if len(unique_timestamps) < 2:
+        return report, get_covered_intervals(unique_timestamps, 0)
+
+    intervals = np.diff(unique_timestamps)
+    nominal = float(np.median(intervals))
+    report['nominal_interval_ms'] = to_ms(nominal)
+    report['nominal_fps'] = 1e3 / to_ms(nominal)
+    report['mean_fps'] = (len(unique_timestamps) - 1) / report['duration_s']
+
+    relative = intervals / nominal
+    histogram, _ = np.histogram(relative, bins=INTERVAL_HISTOGRAM_BINS)
+    report['interval_histogram'] = {
+        'relative_bin_edges': [float(edge) if np.isfinite(edge) else None
+                               for edge in INTERVAL_HISTOGRAM_BINS],
+        'counts': histogram.tolist()}
+    report['short_intervals'] = int(np.count_nonzero(relative < SHORT_FACTOR))
+
+    # Gaps: frames dropped between two recorded frames
+    gap_ids = np.flatnonzero(relative > GAP_FACTOR)
+    missing = np.maximum(np.rint(relative[gap_ids]).astype(np.int64) - 1, 1)
+    report['gaps'] = {
+        'count': int(len(gap_ids)),
+        'dropped_frames': int(np.sum(missing)),
+        'longest_ms': to_ms(intervals[gap_ids].max()) if len(gap_ids) else 0.,
+        'items': [{'start_timestamp': int(unique_timestamps[i]),
+                   'end_timestamp': int(unique_timestamps[i + 1]),
+                   'interval_ms': to_ms(intervals[i]),
+                   'dropped_frames': int(n)}
+                  for i, n in zip(gap_ids[:MAX_LISTED], missing[:MAX_LISTED])]}
+
+    # Drop bursts: gaps close to each other in time
+    bursts = []
+    for i, n in zip(gap_ids, missing):
+        start, end = int(unique_timestamps[i]), int(unique_timestamps[i + 1])
+        if bursts and to_ms(start - bursts[-1]['end_timestamp']) <= BURST_MERGE_MS:
+            bursts[-1]['end_timestamp'] = end
+            bursts[-1]['gaps'] += 1
+            bursts[-1]['dropped_frames'] += int(n)
+        else:
+            bursts.append({'start_timestamp': start, 'end_timestamp': end,
+                           'gaps': 1, 'dropped_frames': int(n)})
+    bursts = [burst for burst in bursts if burst['gaps'] > 1]
+    report['drop_bursts'] = {'count': len(bursts), 'items': bursts[:MAX_LISTED]}
+
+    return report, get_covered_intervals(unique_timestamps, GAP_FACTOR * nominal)
+
+
+def analyze_coverage(stream_intervals):
+    """Time covered by each stream (without its gaps), and by each pair of
+    streams, as fractions of the session span"""
+    spans = [(intervals[0][0], intervals[-1][1])
+             for intervals in stream_intervals.values() if len(intervals)]
+    if not spans:
+        return {}
+    session_start = min(span[0] for span in spans)
+    session_end = max(span[1] for span in spans)
+    session_span = max(session_end - session_start, 1)
+
+    names = list(stream_intervals)
+    coverage = {'session_start_timestamp': int(session_start),
+                'session_end_timestamp': int(session_end),
+                'session_duration_s': to_ms(session_end - session_start) * 1e-3,
+                'streams': {}, 'overlap': {}}
+    for name in names:
+        intervals = stream_intervals[name]
+        covered = int(np.sum(intervals[:, 1] - intervals[:, 0])) if len(intervals) else 0
+        coverage['streams'][name] = covered / session_span
+    for i, a in enumerate(names):
+        for b in names[i + 1:]:
+            overlap = get_intervals_overlap(stream_intervals[a], stream_intervals[b])
+            coverage['overlap'][f'{a} / {b}'] = overlap / session_span
+    return coverage
+
+
+def is_valid_transform(transforms):
+    return np.abs(np.linalg.det(transforms)) > 1e-12
+
+
+def analyze_rig2world(folder, name, timestamps):
+    """Frames without an (exactly matching, as required by save_pclouds)
+    rig2world transform, and invalid transforms"""
+    path = folder / f'{name}_rig2world.txt'
+    if not path.exists():
+        return None
+    rig2world_timestamps, transforms = load_rig2world_transforms(path)
+    ids = TimestampIndex(rig2world_timestamps).within(np.asarray(timestamps, dtype=np.float64), 0)
+    missing = np.asarray(timestamps)[ids < 0]
+    invalid = ~is_valid_transform(transforms)
+    return {'entry_count': int(len(rig2world_timestamps)),
+            'frames_without_rig2world': int(len(missing)),
+            'frames_without_rig2world_items': [int(t) for t in missing[:MAX_LISTED]],
+            'invalid_transforms': int(np.count_nonzero(invalid))}
+
+
+def analyze_pv_poses(folder, timestamps):
+    """PV frames missing from the PV pose log, and pose-less frames"""
+    pv_info_paths = list(folder.glob('*pv.txt'))
+    if not pv_info_paths:
+        return None
+    frame_timestamps, _, pv2world_transforms, _, _, _, _ = load_pv_data(pv_info_paths[0])
+    missing = np.setdiff1d(timestamps, frame_timestamps)
+    invalid = ~is_valid_transform(pv2world_transforms)
+    return {'entry_count': int(len(frame_timestamps)),
+            'frames_without_pose_entry': int(len(missing)),
+            'frames_without_pose_entry_items': [int(t) for t in missing[:MAX_LISTED]],
+            'frames_without_pose': int(np.count_nonzero(invalid)),
+            'frames_without_pose_items': [int(t) for t in frame_timestamps[invalid][:MAX_LISTED]]}
+
+
+def analyze_head_hand_eye(folder):
+    paths = list(folder.glob('*eye.csv'))
+    if not paths:
+        return None, None
+    data = load_head_hand_eye_arrays(paths[0])
+    # Timestamps are parsed as float64, the file order is the recording order
+    timestamps = data['timestamps'].astype(np.int64)
+    availability = {'left_hand': float(np.mean(data['left_hand_transs_available'])),
+                    'right_hand': float(np.mean(data['right_hand_transs_available'])),
+                    'eye_gaze': float(np.mean(data['gaze_available']))} if len(timestamps) else {}
+    return timestamps, availability
+
+
+def analyze_session(folder):
+    """Analyze the streams of a recording without extracting them.
+    Returns the report as a dictionary (see README)"""
+    start = time.time()
+    report = {'recording': str(folder), 'streams': {}}
+    stream_intervals = {}
+
+    for name, extension in folders_extensions:
+        loaded = load_stream_timestamps(folder, name, extension)
+        if loaded is None:
+            continue
+        timestamps, source, ordered = loaded
+        stream_report, stream_intervals[name] = analyze_timestamps(timestamps, ordered)
+        stream_report['source'] = source
+        if name == 'PV':
+            stream_report['poses'] = analyze_pv_poses(folder, timestamps)
+        else:
+            stream_report['rig2world'] = analyze_rig2world(folder, name, timestamps)
+        report['streams'][name] = stream_report
+
+    timestamps, availability = analyze_head_hand_eye(folder)
+    if timestamps is not None:
+        name = 'Head/hand/eye'
+        stream_report, stream_intervals[name] = analyze_timestamps(timestamps)
+        stream_report['source'] = 'log'
+        stream_report['availability'] = availability
+        report['streams'][name] = stream_report
+
+    report['coverage'] = analyze_coverage(stream_intervals)
+    report['analysis_time_s'] = time.time() - start
+    return report
+
+
+def print_report(report):
+    for name, stream in report['streams'].items():
+        if stream['frame_count'] < 2 or 'nominal_fps' not in stream:
+            print(f"{name}: {stream['frame_count']} frames")
+            continue
+        issues = []
+        if stream['gaps']['count']:
+            issues.append("{} gaps ({} dropped frames, longest {:.0f}ms), {} drop bursts".format(
+                stream['gaps']['count'], stream['gaps']['dropped_frames'],
+                stream['gaps']['longest_ms'], stream['drop_bursts']['count']))
+        if stream['duplicates']['count']:
+            issues.append("{} duplicate timestamps".format(stream['duplicates']['count']))
+        if stream.get('reversals', {}).get('count'):
+            issues.append("{} timestamp reversals".format(stream['reversals']['count']))
+        if stream.get('rig2world') and stream['rig2world']['frames_without_rig2world']:
+            issues.append("{} frames without rig2world".format(
+                stream['rig2world']['frames_without_rig2world']))
+        poses = stream.get('poses')
+        if poses and (poses['frames_without_pose_entry'] or poses['frames_without_pose']):
+            issues.append("{} frames missing from the pose log, {} without pose".format(
+                poses['frames_without_pose_entry'], poses['frames_without_pose']))
+        print("{}: {} frames, {:.1f}s, {:.2f} fps (nominal {:.2f}){}".format(
+            name, stream['frame_count'], stream['duration_s'], stream['mean_fps'],
+            stream['nominal_fps'], ''.join('\n    ' + issue for issue in issues)))
+
+    coverage = report['coverage']
+    if coverage:
+        print("Session: {:.1f}s, coverage {}".format(
+            coverage['session_duration_s'],
+            ', '.join('{} {:.0%}'.format(name, fraction)
+                      for name, fraction in coverage['streams'].items())))
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Analyze the frame rates, gaps and '
+                                     'missing poses of a recording')
+    parser.add_argument("--recording_path", required=True,
+                        help="Path to recording folder")
+    parser.add_argument("--output", required=False, default=None,
+                        help="Output json report (<recording_path>/session_report.json by default)")
+
+    args = parser.parse_args()
+    folder = Path(args.recording_path)
+    report = analyze_session(folder)
+    print_report(report)
+
+    output_path = Path(args.output) if args.output else folder / REPORT_NAME
+    with open(output_path, 'w') as f:
+        json.dump(report, f, indent=1)
+    print("Report saved to {} ({:.2f}s)".format(output_path, report['analysis_time_s']))
@@ -0,0 +1,252 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import hashlib
+import json
+import os
+import threading
+import time
+import traceback
+from concurrent.futures import ThreadPoolExecutor, FIRST_COMPLETED, wait
+from pathlib import Path
+
+# Per-session record of the conversion stages already run, so that
+# process_all only redoes the work whose inputs changed, and resumes
+# interrupted stages frame by frame.
+#
+# For each stage, the manifest stores the fingerprint of its inputs (size
+# and mtime of the input files, the stage parameters and the fingerprints
+# of the stages it depends on), the frames it has completed, and the size
+# of every output file. A stage is up to date if its fingerprint did not
+# change and all its outputs are still there with the same size.
+MANIFEST_NAME = 'conversion_manifest.json'
+MANIFEST_VERSION = 1
+
+# Seconds between two saves of the manifest while a stage runs
+SAVE_INTERVAL = 5.
+
+
+def fingerprint_inputs(folder, paths, params=None, dependencies=()):
+    """Fingerprint of a stage: its input files (size and mtime), parameters
+    and the fingerprints of the stages it depends on"""
+    files = []
+    for path in sorted(Path(path) for path in paths):
+        try:
+            stat = path.stat()
+            files.append([get_relative_path(folder, path), stat.st_size, stat.st_mtime_ns])
+        except FileNotFoundError:
+            files.append([get_relative_path(folder, path), -1, -1])
+    data = json.dumps([files, params, list(dependencies)], sort_keys=True, default=str)
+    return hashlib.sha1(data.encode('utf-8')).hexdigest()
+
+
+def get_relative_path(folder, path):
+    try:
+        return Path(path).relative_to(folder).as_posix()
+    except ValueError:
+        return Path(path).as_posix()
+
+
+class ConversionManifest(object):
+    """Conversion manifest of a recording folder (<folder>/conversion_manifest.json)"""
+
+    def __init__(self, folder):
+        self.folder = Path(folder)
+        self.path = self.folder / MANIFEST_NAME
+        self.lock = threading.RLock()
+        self.last_save = 0.
+        self.stages = {}
+        try:
+            with open(self.path) as f:
+                data = json.load(f)
+            if data.get('version') == MANIFEST_VERSION:
+                self.stages = data['stages']
+        except (FileNotFoundError, ValueError, KeyError):
+            pass
+
+    def save(self):
+        with self.lock:
+            # Write to a temporary file first so an interruption leaves the
+            # previous manifest intact
+            tmp_path = self.path.with_name(self.path.name + '.tmp')
+            with open(tmp_path, 'w') as f:
+                json.dump({'version': MANIFEST_VERSION, 'stages': self.stages}, f)
+            os.replace(tmp_path, self.path)
+            self.last_save = time.time()
+
+    def save_periodically(self):
+        with self.lock:
+            if time.time() - self.last_save >= SAVE_INTERVAL:
+                self.save()
+
+    def stage(self, name, fingerprint):
+        """Record of stage name. Records made with another fingerprint are discarded."""
+        with self.lock:
+            record = self.stages.get(name)
+            if record is None or record.get('fingerprint') != fingerprint:
+                record = {'fingerprint': fingerprint, 'complete': False, 'frames': {}}
+                self.stages[name] = record
+            return StageRecord(self, name, record)
+
+
+class StageRecord(object):
+    """Completed frames and outputs of one stage"""
+
+    def __init__(self, manifest, name, record):
+        self.manifest = manifest
+        self.name = name
+        self.record = record
+
+    @property
+    def fingerprint(self):
+        return self.record['fingerprint']
+
+    def _outputs_intact(self, outputs):
+        folder = self.manifest.folder
+        for path, size in outputs.items():
+            try:
+                if (folder / path).stat().st_size != size:
+                    return False
+            except FileNotFoundError:
+                return False
+        return True
+
+    def is_complete(self):
+        """True if the stage ran to completion and its outputs are intact"""
+        with self.manifest.lock:
+            if not self.record['complete']:
+                return False
+            frames = list(self.record['frames'].values())
+        return all(self._outputs_intact(frame['outputs']) for frame in frames)
+
+    def done_frames(self):
+        """Frames completed by a previous run whose outputs are intact,
+        as a dictionary frame name -> data given to frame_done"""
+        with self.manifest.lock:
+            frames = dict(self.record['frames'])
+        return {name: frame.get('data') for name, frame in frames.items()
+                if self._outputs_intact(frame['outputs'])}
+
+    def frame_done(self, name, outputs, data=None):
+        """Record that frame name is done. outputs are the files it wrote,
+        data is any json serializable information needed by later runs."""
+        folder = self.manifest.folder
+        sizes = {}
+        for path in outputs:
+            path = Path(path)
+            if path.exists():
+                sizes[get_relative_path(folder, path)] = path.stat().st_size
+        with self.manifest.lock:
+            self.record['frames'][name] = {'outputs': sizes, 'data': data}
+        self.manifest.save_periodically()
+
+    def mark_complete(self):
+        with self.manifest.lock:
+            self.record['complete'] = True
+        self.manifest.save()
+
+
+class Stage(object):
+    """A conversion stage.
+
+    Args:
+        name ([str]): Stage name
+        run ([function]): Called with the StageRecord of the stage. Stages
+            with frames call record.frame_done for each of them, and can
+            skip the ones in record.done_frames().
+        inputs ([list]): Input files of the stage
+        params ([dict], optional): Parameters changing the stage's outputs
+        dependencies ([list], optional): Names of the stages that must run first
+    """
+
+    def __init__(self, name, run, inputs, params=None, dependencies=()):
+        self.name = name
+        self.run = run
+        self.inputs = inputs
+        self.params = params
+        self.dependencies = list(dependencies)
+
+
+def run_stages(folder, stages, force=False, max_concurrent=None):
+    """Run the stages that are not up to date, in dependency order.
+    Stages whose dependencies are done run concurrently (at most
+    max_concurrent at a time, all of them by default).
+
+    Returns a dictionary stage name -> 'skipped', 'done' or 'failed'
+    """
+    manifest = ConversionManifest(folder)
+    stages = {stage.name: stage for stage in stages}
+    for stage in stages.values():
+        for dependency in stage.dependencies:
+            assert dependency in stages, f'{stage.name} depends on unknown stage {dependency}'
+
+    fingerprints = {}
+    status = {}
+    running = {}
+
+    def is_ready(stage):
+        return all(status.get(dependency) in ('skipped', 'done') for dependency in stage.dependencies)
+
+    def start(stage, executor):
+        # Fingerprint once the dependencies are done, they may have changed the inputs
+        fingerprint = fingerprint_inputs(
+            folder, stage.inputs, stage.params,
+            [fingerprints[dependency] for dependency in stage.dependencies])
+        fingerprints[stage.name] = fingerprint
+        if force:
+            manifest.stages.pop(stage.name, None)
+        record = manifest.stage(stage.name, fingerprint)
+        if record.is_complete():
+            print(f"Stage {stage.name} is up to date")
+            status[stage.name] = 'skipped'
+            return
+        n_done = len(record.done_frames())
+        if n_done:
+            print(f"Resuming stage {stage.name} ({n_done} frames already done)")
+        # Record on disk that the stage is no longer complete
+        manifest.save()
+        running[executor.submit(stage.run, record)] = (stage, record)
+
+    def run_ready_stages(executor):
+        while len(status) < len(stages):
+            started = False
+            for stage in stages.values():
+                if stage.name in status or any(s is stage for s, _ in running.values()):
+                    continue
+                if any(status.get(dependency) == 'failed' for dependency in stage.dependencies):
+                    print(f"Skipping stage {stage.name}, a dependency failed")
+                    status[stage.name] = 'failed'
+                    started = True
+                elif is_ready(stage):
+                    start(stage, executor)
+                    started = True
+            if started:
+                continue
+            if not running:
+                break
+
+            done, _ = wait(list(running), return_when=FIRST_COMPLETED)
+            for future in done:
+                stage, record = running.pop(future)
+                try:
+                    future.result()
+                    record.mark_complete()
+                    status[stage.name] = 'done'
+                except Exception:
+                    traceback.print_exc()
+                    print(f"Stage {stage.name} failed, completed frames are kept for the next run")
+                    status[stage.name] = 'failed'
+                    manifest.save()
+
+    try:
+        with ThreadPoolExecutor(max_concurrent or len(stages) or 1) as executor:
+            run_ready_stages(executor)
+    finally:
+        # Keep the frames completed so far if interrupted
+        manifest.save()
+    return status
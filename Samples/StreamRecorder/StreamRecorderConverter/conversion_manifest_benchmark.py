@@ -0,0 +1,90 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import argparse
+import tempfile
+import time
+from pathlib import Path
+
+from conversion_manifest import Stage, run_stages
+
+# Time of a no-op rerun of the conversion, which only checks the manifest,
+# and of a rerun after one output was deleted, compared with a full run.
+# On a recording, the stages are the ones of process_all.py. Otherwise
+# they are synthetic: each of n_stages stages writes one file per frame.
+
+
+def get_synthetic_stages(folder, n_stages, n_frames, frame_size):
+    inputs = []
+    for i_stage in range(n_stages):
+        input_path = folder / f'sensor{i_stage}.tar'
+        input_path.write_bytes(bytes(n_frames * frame_size))
+        inputs.append(input_path)
+        (folder / f'sensor{i_stage}').mkdir(exist_ok=True)
+
+    def run(record, i_stage):
+        done_frames = record.done_frames()
+        data = bytes(frame_size)
+        for i_frame in range(n_frames):
+            name = f'{i_frame}.pgm'
+            if name in done_frames:
+                continue
+            output_path = folder / f'sensor{i_stage}' / name
+            output_path.write_bytes(data)
+            record.frame_done(name, [output_path])
+
+    return [Stage(f'convert sensor{i_stage}', lambda record, i_stage=i_stage: run(record, i_stage),
+                  [inputs[i_stage]]) for i_stage in range(n_stages)]
+
+
+def time_run(name, folder, get_stages, force=False):
+    start = time.time()
+    status = run_stages(folder, get_stages(), force)
+    seconds = time.time() - start
+    counts = {value: list(status.values()).count(value) for value in sorted(set(status.values()))}
+    print(f"{name:<28} {seconds:8.3f} s  {counts}")
+    return seconds
+
+
+def run_benchmark(folder, get_stages, deleted_output):
+    full = time_run('full run', folder, get_stages, force=True)
+    noop = time_run('no-op rerun', folder, get_stages)
+    if deleted_output is not None:
+        deleted_output.unlink()
+        time_run('rerun, one output deleted', folder, get_stages)
+    print(f"no-op rerun: {100 * noop / full:.2f}% of the full run")
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Conversion manifest benchmark')
+    parser.add_argument("--recording_path",
+                        help="Recording to convert with the process_all.py stages, "
+                        "synthetic stages by default")
+    parser.add_argument("--stages",
+                        type=int,
+                        default=4,
+                        help="Number of synthetic stages")
+    parser.add_argument("--frames",
+                        type=int,
+                        default=5000,
+                        help="Number of frames of each synthetic stage")
+    parser.add_argument("--frame_size",
+                        type=int,
+                        default=320 * 288 * 2,
+                        help="Size of the synthetic frames, in bytes")
+
+    args = parser.parse_args()
+    if args.recording_path:
+        from process_all import get_conversion_stages
+        folder = Path(args.recording_path)
+        run_benchmark(folder, lambda: get_conversion_stages(folder), None)
+    else:
+        with tempfile.TemporaryDirectory() as folder:
+            folder = Path(folder)
+            stages = get_synthetic_stages(folder, args.stages, args.frames, args.frame_size)
+            run_benchmark(folder, lambda: stages, folder / 'sensor0' / '0.pgm')
@@ -14,6 +14,20 @@ import multiprocessing
 from pathlib import Path
 
 from utils import folders_extensions
+from stream_tar import BoundedPool, decode_bgra, iter_tar_members
+from tar_index import get_tar_index
+from pv_frames import (PV_FORMATS, PV_ENCODINGS, DEFAULT_CHUNK_FRAMES, CHUNK_NAME_FORMAT,
+                       get_chunk_path, write_pv_chunk)
+
+
+def write_pv_frame_to_png(data, output_path, width, height, overwrite=False):
+    print(".", end="", flush=True)
+
+    if not overwrite and os.path.exists(output_path):
+        return output_path
+
+    cv2.imwrite(output_path, decode_bgra(data, width, height))
+    return output_path
 
 
 def write_bytes_to_png(bytes_path, width, height):
@@ -45,7 +59,101 @@ def get_width_and_height(path):
     return (int(width), int(height))
 
 
-def convert_images(folder):
+def convert_images_from_tar(folder, done_frames=None, on_frame_done=None):
+    """Convert PV frames to png while streaming them from PV.tar,
+    without extracting the raw frames to disk.
+
+    Frames named in done_frames are skipped, the others are (re)written and
+    on_frame_done(name, output_path) is called once they are saved.
+    By default, frames whose png already exists are skipped.
+    """
+    pv_path = list(folder.glob('*pv.txt'))
+    assert len(list(pv_path)) == 1
+    (width, height) = get_width_and_height(pv_path[0])
+
+    output_folder = folder / 'PV'
+    output_folder.mkdir(exist_ok=True)
+
+    print("Processing images")
+    with BoundedPool() as pool:
+        for name, data in iter_tar_members(folder / 'PV.tar', r'^[0-9]+\.bytes$'):
+            if done_frames is not None and name in done_frames:
+                continue
+            output_path = str(output_folder / name.replace('bytes', 'png'))
+            callback = None
+            if on_frame_done is not None:
+                def callback(output_path, name=name):
+                    on_frame_done(name, output_path)
+            pool.submit(write_pv_frame_to_png,
+                        (data, output_path, width, height, done_frames is not None),
+                        callback=callback)
+
+
+def get_pv_frame_sources(folder, stream):
+    """Raw PV frames as (timestamp, path, offset, size), sorted by timestamp:
+    members of PV.tar (located with its index) or extracted .bytes files"""
+    if stream:
+        tar_path = folder / 'PV.tar'
+        entries = get_tar_index(tar_path)
+        return [(int(entry['timestamp']), tar_path, int(entry['data_offset']), int(entry['data_size']))
+                for entry in entries]
+    sources = [(int(path.stem), path, 0, path.stat().st_size)
+               for path in (folder / 'PV').glob('*.bytes')]
+    return sorted(sources, key=lambda source: source[0])
+
+
+def convert_images_to_chunks(folder, stream, pv_format, encoding='png',
+                             chunk_frames=DEFAULT_CHUNK_FRAMES,
+                             done_frames=None, on_frame_done=None):
+    """Convert PV frames to chunks of chunk_frames frames (see pv_frames.py),
+    one chunk per worker task.
+
+    Chunks named in done_frames are skipped, the others are (re)written and
+    on_frame_done(chunk name, output_path) is called once they are saved.
+    By default, chunks that already exist are skipped.
+    """
+    pv_path = list(folder.glob('*pv.txt'))
+    assert len(list(pv_path)) == 1
+    (width, height) = get_width_and_height(pv_path[0])
+
+    output_folder = folder / 'PV'
+    output_folder.mkdir(exist_ok=True)
+    sources = get_pv_frame_sources(folder, stream)
+
+    print("Processing images")
+    with BoundedPool() as pool:
+        for first_frame in range(0, len(sources), chunk_frames):
+            name = CHUNK_NAME_FORMAT.format(first_frame)
+            output_path = get_chunk_path(output_folder, first_frame, pv_format)
+            if done_frames is not None and name in done_frames:
+                continue
+            if done_frames is None and output_path.exists():
+                continue
+            chunk_sources = sources[first_frame:first_frame + chunk_frames]
+
+            def callback(output_path, name=name, chunk_sources=chunk_sources):
+                if not stream:
+                    # Delete the '*.bytes' files, like the png conversion
+                    for source in chunk_sources:
+                        source[1].unlink()
+                if on_frame_done is not None:
+                    on_frame_done(name, output_path)
+            pool.submit(write_pv_chunk,
+                        (chunk_sources, output_path, width, height, pv_format, encoding),
+                        callback=callback)
+
+
+def convert_images(folder, stream=False, done_frames=None, on_frame_done=None,
+                   pv_format='png', encoding='png', chunk_frames=DEFAULT_CHUNK_FRAMES):
+    """Convert the PV frames to pv_format (see pv_frames.py)"""
+    if pv_format != 'png':
+        convert_images_to_chunks(folder, stream, pv_format, encoding, chunk_frames,
+                                 done_frames, on_frame_done)
+        return
+    if stream:
+        convert_images_from_tar(folder, done_frames, on_frame_done)
+        return
+
     p = multiprocessing.Pool(multiprocessing.cpu_count())
     for (img_folder, extension) in folders_extensions:
         if img_folder == 'PV':
@@ -65,5 +173,17 @@ if __name__ == '__main__':
     parser = argparse.ArgumentParser(description='Convert images')
     parser.add_argument("--recording_path", required=True,
                         help="Path to recording folder")
+    parser.add_argument("--stream",
+                        required=False,
+                        action='store_true',
+                        help="Read frames directly from PV.tar instead of the extracted PV folder")
+    parser.add_argument("--pv_format", choices=PV_FORMATS, default='png',
+                        help="png: one png per frame, array: chunked image array files, "
+                        "video: chunked lossless (FFV1) videos")
+    parser.add_argument("--encoding", choices=list(PV_ENCODINGS), default='png',
+                        help="Frame encoding of the array format: png (lossless) or jpg")
+    parser.add_argument("--chunk_frames", type=int, default=DEFAULT_CHUNK_FRAMES,
+                        help="Number of frames per array or video file")
     args = parser.parse_args()
-    convert_images(Path(args.recording_path))
+    convert_images(Path(args.recording_path), args.stream, pv_format=args.pv_format,
+                   encoding=args.encoding, chunk_frames=args.chunk_frames)
@@ -0,0 +1,142 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import argparse
+import time
+
+import numpy as np
+
+from save_pclouds import get_grid_normals, get_points_grid
+from tsdf_fusion_benchmark import HEIGHT, WIDTH, get_camera_pose, get_pinhole_lut, render_depth, scene_distance
+
+# Time and accuracy of the normals of save_pclouds.py (--grid_normals) on
+# synthetic long throw frames (tsdf_fusion_benchmark.py), against open3d's
+# estimate_normals (a PCA of the 30 nearest points, oriented towards the
+# camera as save_ply does). Without open3d, that PCA is computed here over
+# the nearest points of a window of the depth grid, and only its accuracy
+# compares with open3d's.
+#
+# The errors are the angles with the exact normals of the scene, over the
+# pixels whose normals are set; the grid normals are not set on the pixels
+# with no usable neighbour along an axis (silhouettes, isolated pixels).
+
+KNN = 30
+WINDOW_RADIUS = 4
+
+
+def get_exact_normals(points, cam2world):
+    """Camera space normals of the scene at camera space points, towards the free space"""
+    world_points = points @ cam2world[:3, :3].T + cam2world[:3, 3]
+    epsilon = 1e-4
+    gradient = np.stack([scene_distance(world_points + epsilon * axis) - scene_distance(world_points - epsilon * axis)
+                         for axis in np.eye(3)], axis=1)
+    gradient /= np.linalg.norm(gradient, axis=1, keepdims=True)
+    return gradient @ cam2world[:3, :3]
+
+
+def estimate_normals_open3d(points):
+    import open3d as o3d
+
+    pcd = o3d.geometry.PointCloud()
+    pcd.points = o3d.utility.Vector3dVector(points)
+    pcd.estimate_normals(o3d.geometry.KDTreeSearchParamKNN(KNN))
+    pcd.orient_normals_towards_camera_location(np.zeros(3))
+    return np.asarray(pcd.normals)
+
+
+def estimate_normals_window(points_grid, valid):
+    """PCA of the KNN nearest valid points of the window around each valid pixel"""
+    grid = points_grid.reshape((HEIGHT, WIDTH, 3)).astype(np.float64)
+    valid = valid.reshape((HEIGHT, WIDTH))
+    size = 2 * WINDOW_RADIUS + 1
+    padded = np.pad(grid, ((WINDOW_RADIUS,), (WINDOW_RADIUS,), (0,)))
+    padded_valid = np.pad(valid, WINDOW_RADIUS)
+    y, x = np.nonzero(valid)
+    dy, dx = np.mgrid[:size, :size]
+    neighbours = padded[y[:, None] + dy.reshape(-1), x[:, None] + dx.reshape(-1)]
+    neighbours_valid = padded_valid[y[:, None] + dy.reshape(-1), x[:, None] + dx.reshape(-1)]
+
+    distances = np.linalg.norm(neighbours - grid[y, x][:, None], axis=2)
+    distances[~neighbours_valid] = np.inf
+    nearest = np.argpartition(distances, KNN, axis=1)[:, :KNN]
+    nearest_points = np.take_along_axis(neighbours, nearest[..., None], axis=1)
+    nearest_valid = np.take_along_axis(neighbours_valid, nearest, axis=1)[..., None]
+    count = np.sum(nearest_valid, axis=1)
+    mean = np.sum(nearest_points * nearest_valid, axis=1) / count
+    centered = (nearest_points - mean[:, None]) * nearest_valid
+    covariance = np.einsum('nki,nkj->nij', centered, centered)
+    normals = np.linalg.eigh(covariance)[1][:, :, 0]
+
+    facing_away = np.sum(normals * grid[y, x], axis=1) > 0
+    normals[facing_away] *= -1
+    return normals
+
+
+def get_angles(normals, exact_normals):
+    return np.degrees(np.arccos(np.clip(np.sum(normals * exact_normals, axis=1), -1, 1)))
+
+
+def run_benchmark(n_frames, repeat):
+    try:
+        import open3d  # noqa: F401
+        estimate_normals, estimate_name = estimate_normals_open3d, 'open3d estimate_normals'
+    except ImportError:
+        estimate_normals, estimate_name = None, f'PCA of {KNN} nearest (window)'
+
+    lut = get_pinhole_lut()
+    names = ['grid normals', estimate_name]
+    seconds = [[], []]
+    angles = [[], []]
+    n_points = n_normals = 0
+    for i_frame in range(n_frames):
+        cam2world = get_camera_pose(i_frame, n_frames)
+        img = render_depth(cam2world, lut)
+        points_grid, valid = get_points_grid(img, lut)
+        points = points_grid[valid]
+        exact_normals = get_exact_normals(points, cam2world)
+
+        runs = [lambda: get_grid_normals(points_grid, valid, WIDTH, HEIGHT)[valid],
+                (lambda: estimate_normals(points)) if estimate_normals is not None
+                else lambda: estimate_normals_window(points_grid, valid)]
+        for i_method, run in enumerate(runs):
+            best = float('inf')
+            for _ in range(repeat):
+                start = time.perf_counter()
+                normals = run()
+                best = min(best, time.perf_counter() - start)
+            seconds[i_method].append(best)
+            is_set = np.any(normals != 0, axis=1)
+            angles[i_method].append(get_angles(normals[is_set], exact_normals[is_set]))
+            if i_method == 0:
+                n_points += len(points)
+                n_normals += np.count_nonzero(is_set)
+
+    print(f"{n_frames} frames of {WIDTH}x{HEIGHT}, {n_points // n_frames} points per frame, "
+          f"{100. * n_normals / n_points:.1f}% with grid normals")
+    print(f"{'normals':<28} {'ms per frame':>13} {'median (deg)':>13} {'95% (deg)':>10} {'> 10 deg':>9}")
+    for name, method_seconds, method_angles in zip(names, seconds, angles):
+        method_angles = np.concatenate(method_angles)
+        print(f"{name:<28} {1000 * np.mean(method_seconds):>13.1f} {np.median(method_angles):>13.2f} "
+              f"{np.percentile(method_angles, 95):>10.2f} {100. * np.mean(method_angles > 10):>8.1f}%")
+    if estimate_normals is None:
+        print("open3d is not installed: the PCA time is not that of estimate_normals")
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Grid normals benchmark')
+    parser.add_argument("--frames",
+                        type=int,
+                        default=10,
+                        help="Number of synthetic frames, around the scene")
+    parser.add_argument("--repeat",
+                        type=int,
+                        default=3,
+                        help="Runs of each estimation per frame, the fastest is kept")
+
+    args = parser.parse_args()
+    run_benchmark(args.frames, args.repeat)
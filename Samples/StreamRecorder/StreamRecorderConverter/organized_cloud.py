@@ -0,0 +1,167 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import zlib
+from pathlib import Path
+
+import numpy as np
+
+from utils import load_lut
+
+# Organized point clouds keep the depth image grid. Instead of xyz, they
+# store the depth in mm and reference the session LUT:
+#   points = lut * depth / 1000 (camera space, meters)
+#
+# Layout (little endian):
+#   header (see organized_cloud_header_dtype)
+#   depth: uint16, height x width
+#   valid mask: height x width bits (np.packbits, row major)
+#   normals (if HAS_NORMALS): int8 x 3 per valid pixel, camera space, scaled by 127
+#   colors (if HAS_COLORS): uint8 RGB per valid pixel
+ORGANIZED_CLOUD_EXTENSION = '.opc'
+ORGANIZED_CLOUD_MAGIC = b'RMORGCLD'
+ORGANIZED_CLOUD_VERSION = 1
+
+# Flags
+HAS_NORMALS = 1
+HAS_COLORS = 2
+HAS_POSE = 4
+
+organized_cloud_header_dtype = np.dtype([('magic', 'S8'),
+                                         ('version', '<u4'),
+                                         ('width', '<u4'),
+                                         ('height', '<u4'),
+                                         ('flags', '<u4'),
+                                         # CRC32 of the LUT the depth must be used with
+                                         ('lut_crc32', '<u4'),
+                                         ('reserved', '<u4'),
+                                         # Camera to world transform, identity without HAS_POSE
+                                         ('cam2world', '<f8', (4, 4)),
+                                         # File name of the LUT in the recording folder
+                                         ('lut_name', 'S64')])
+
+
+def get_lut_crc32(lut):
+    return zlib.crc32(np.ascontiguousarray(lut, dtype=np.float32).tobytes()) & 0xFFFFFFFF
+
+
+def save_organized_cloud(output_path, depth, valid, lut_name, lut_crc32,
+                         normals=None, colors=None, cam2world_transform=None):
+    """Save an organized point cloud.
+
+    Args:
+        output_path ([str]): Output file
+        depth ([np.array]): Depth image in mm (height x width)
+        valid ([np.array]): Mask of the valid pixels (height x width or pixel count)
+        lut_name ([str]): File name of the session LUT
+        lut_crc32 ([int]): CRC32 of the session LUT, see get_lut_crc32
+        normals ([np.array], optional): Unit normals in camera space, one per pixel
+        colors ([np.array], optional): RGB colors in [0, 1], one per pixel
+        cam2world_transform ([np.array], optional): Camera to world transform
+    """
+    height, width = depth.shape
+    valid = valid.reshape(-1)
+
+    flags = 0
+    if normals is not None:
+        flags |= HAS_NORMALS
+    if colors is not None:
+        flags |= HAS_COLORS
+    if cam2world_transform is not None:
+        flags |= HAS_POSE
+    else:
+        cam2world_transform = np.eye(4)
+
+    header = np.zeros(1, dtype=organized_cloud_header_dtype)
+    header['magic'] = ORGANIZED_CLOUD_MAGIC
+    header['version'] = ORGANIZED_CLOUD_VERSION
+    header['width'] = width
+    header['height'] = height
+    header['flags'] = flags
+    header['lut_crc32'] = lut_crc32
+    header['cam2world'] = cam2world_transform
+    header['lut_name'] = lut_name.encode('utf-8')
+
+    with open(output_path, 'wb') as f:
+        f.write(header.tobytes())
+        f.write(np.ascontiguousarray(depth, dtype='<u2').tobytes())
+        f.write(np.packbits(valid).tobytes())
+        if normals is not None:
+            normals = normals.reshape((-1, 3))[valid]
+            f.write(np.around(np.clip(normals, -1, 1) * 127).astype(np.int8).tobytes())
+        if colors is not None:
+            colors = colors.reshape((-1, 3))[valid]
+            f.write(np.around(np.clip(colors, 0, 1) * 255).astype(np.uint8).tobytes())
+
+
+def load_organized_cloud(path, lut=None):
+    """Load an organized point cloud saved by save_organized_cloud.
+
+    The LUT is loaded from the recording folder (the parent of the frame's
+    folder) unless it is given.
+
+    Returns a dictionary of height x width grids: depth (mm), valid, points
+    (camera space, meters, 0 for invalid pixels), normals and colors (RGB, uint8)
+    or None if they were not saved, and the cam2world transform (None if the
+    cloud was saved in camera space).
+    """
+    path = Path(path)
+    with open(path, 'rb') as f:
+        header = np.frombuffer(f.read(organized_cloud_header_dtype.itemsize),
+                               dtype=organized_cloud_header_dtype)
+        assert len(header) == 1 and header['magic'][0] == ORGANIZED_CLOUD_MAGIC
+        assert header['version'][0] == ORGANIZED_CLOUD_VERSION
+        data = f.read()
+
+    width = int(header['width'][0])
+    height = int(header['height'][0])
+    flags = int(header['flags'][0])
+    n_pixels = width * height
+
+    offset = 0
+    depth = np.frombuffer(data, dtype='<u2', count=n_pixels, offset=offset)
+    offset += 2 * n_pixels
+    mask_size = (n_pixels + 7) // 8
+    valid = np.unpackbits(np.frombuffer(data, dtype=np.uint8, count=mask_size, offset=offset),
+                          count=n_pixels).astype(bool)
+    offset += mask_size
+    n_valid = int(np.count_nonzero(valid))
+
+    normals = None
+    if flags & HAS_NORMALS:
+        normals = np.zeros((n_pixels, 3), dtype=np.float32)
+        normals[valid] = np.frombuffer(
+            data, dtype=np.int8, count=3 * n_valid, offset=offset).reshape((-1, 3)) / 127.
+        offset += 3 * n_valid
+        normals = normals.reshape((height, width, 3))
+
+    colors = None
+    if flags & HAS_COLORS:
+        colors = np.zeros((n_pixels, 3), dtype=np.uint8)
+        colors[valid] = np.frombuffer(
+            data, dtype=np.uint8, count=3 * n_valid, offset=offset).reshape((-1, 3))
+        offset += 3 * n_valid
+        colors = colors.reshape((height, width, 3))
+
+    if lut is None:
+        lut_name = header['lut_name'][0].decode('utf-8')
+        lut = load_lut(path.parent.parent / lut_name)
+    assert len(lut) == n_pixels
+    assert get_lut_crc32(lut) == header['lut_crc32'][0], 'Cloud was saved with a different LUT'
+
+    # Same computation as save_pclouds.get_points_grid
+    points = np.multiply(depth.reshape((-1, 1)), lut, dtype=np.float32)
+    points /= 1000.
+    points[~valid] = 0
+
+    return {'depth': depth.reshape((height, width)),
+            'valid': valid.reshape((height, width)),
+            'points': points.reshape((height, width, 3)),
+            'normals': normals,
+            'colors': colors,
+            'cam2world': header['cam2world'][0].copy() if flags & HAS_POSE else None}
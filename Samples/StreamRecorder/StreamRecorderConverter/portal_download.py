@@ -0,0 +1,306 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import http.client
+import json
+import os
+import socket
+import tarfile
+import threading
+import time
+import urllib.error
+import urllib.request
+from concurrent.futures import ThreadPoolExecutor
+from pathlib import Path
+
+# Download engine of recorder_console.py.
+#
+# Files are downloaded to <name>.part, next to a <name>.part.json sidecar
+# that records how many bytes of each chunk were written. Large files are
+# split in chunks downloaded in parallel with HTTP range requests; an
+# interrupted download (disconnect, Ctrl-C) resumes from the sidecar. Once
+# all chunks are done, the file size is checked against the size listed by
+# the Device Portal, tarballs are checked by walking their headers (each
+# tar header has its own checksum), and <name>.part is renamed to <name>.
+PART_EXTENSION = '.part'
+PROGRESS_EXTENSION = '.json'
+
+DEFAULT_MAX_FILES = 4
+DEFAULT_CONNECTIONS_PER_FILE = 4
+# Files smaller than this are downloaded with a single request
+DEFAULT_CHUNK_SIZE = 32 * 1024 * 1024
+READ_SIZE = 1024 * 1024
+
+MAX_RETRIES = 10
+RETRY_DELAY = 1.
+TIMEOUT = 30.
+# Seconds between two saves of the sidecar, and two progress reports
+SAVE_INTERVAL = 2.
+REPORT_INTERVAL = 1.
+
+TRANSIENT_ERRORS = (urllib.error.URLError, http.client.HTTPException,
+                    ConnectionError, socket.timeout, TimeoutError)
+
+
+class DownloadError(Exception):
+    pass
+
+
+class ServerIgnoredRange(Exception):
+    """The server answered a range request with the whole file"""
+    pass
+
+
+class DownloadProgress(object):
+    """Throughput and ETA of all the running downloads"""
+
+    def __init__(self, total_bytes, already_done=0):
+        self.lock = threading.Lock()
+        self.total_bytes = total_bytes
+        self.done_bytes = already_done
+        self.already_done = already_done
+        self.start = time.time()
+        self.last_report = 0.
+
+    def add(self, n_bytes):
+        with self.lock:
+            self.done_bytes += n_bytes
+        self.report()
+
+    def restart(self, n_bytes):
+        """A chunk restarted from scratch, forget its n_bytes"""
+        with self.lock:
+            self.done_bytes -= n_bytes
+
+    def get_rate(self):
+        elapsed = time.time() - self.start
+        return (self.done_bytes - self.already_done) / elapsed if elapsed > 0 else 0.
+
+    def report(self, force=False):
+        with self.lock:
+            now = time.time()
+            if not force and now - self.last_report < REPORT_INTERVAL:
+                return
+            self.last_report = now
+            rate = self.get_rate()
+            remaining = self.total_bytes - self.done_bytes
+            eta = "{:.0f}s".format(remaining / rate) if rate > 0 else "-"
+            percent = 100. * self.done_bytes / self.total_bytes if self.total_bytes else 100.
+            print("\r=> {:5.1f}% {:.1f}/{:.1f} MB, {:.2f} MB/s, ETA {}   ".format(
+                percent, self.done_bytes / 1e6, self.total_bytes / 1e6, rate / 1e6, eta),
+                end="", flush=True)
+
+
+class FileDownload(object):
+    """Chunked, resumable download of one file"""
+
+    def __init__(self, url, destination_path, size, chunk_size=DEFAULT_CHUNK_SIZE):
+        self.url = url
+        self.destination_path = Path(destination_path)
+        self.part_path = self.destination_path.with_name(self.destination_path.name + PART_EXTENSION)
+        self.progress_path = self.part_path.with_name(self.part_path.name + PROGRESS_EXTENSION)
+        self.size = size
+        self.lock = threading.Lock()
+        self.last_save = 0.
+        self.cancel = threading.Event()
+
+        n_chunks = max(1, (size + chunk_size - 1) // chunk_size) if size else 1
+        self.chunks = [[i * chunk_size, min(size, (i + 1) * chunk_size) if size else 0, 0]
+                       for i in range(n_chunks)]
+        self.load_progress()
+
+    def load_progress(self):
+        """Resume from the sidecar if it matches this download"""
+        try:
+            with open(self.progress_path) as f:
+                data = json.load(f)
+            if (data['size'] == self.size and self.part_path.exists() and
+                    self.part_path.stat().st_size == self.size and
+                    [c[:2] for c in data['chunks']] == [c[:2] for c in self.chunks]):
+                self.chunks = data['chunks']
+        except (FileNotFoundError, ValueError, KeyError, TypeError):
+            pass
+
+    def save_progress(self, force=False):
+        with self.lock:
+            if not force and time.time() - self.last_save < SAVE_INTERVAL:
+                return
+            tmp_path = self.progress_path.with_name(self.progress_path.name + '.tmp')
+            with open(tmp_path, 'w') as f:
+                json.dump({'size': self.size, 'chunks': self.chunks}, f)
+            os.replace(tmp_path, self.progress_path)
+            self.last_save = time.time()
+
+    def get_done_bytes(self):
+        return sum(chunk[2] for chunk in self.chunks)
+
+    def prepare(self):
+        """Create <name>.part with the final size, so chunks can be written in place"""
+        if not self.part_path.exists() or self.part_path.stat().st_size != self.size:
+            for chunk in self.chunks:
+                chunk[2] = 0
+            with open(self.part_path, 'wb') as f:
+                f.truncate(self.size)
+        self.save_progress(force=True)
+
+    def download_chunk(self, chunk, progress):
+        """Download the remaining bytes of chunk, retrying on transient errors"""
+        retries = 0
+        while not self.is_chunk_done(chunk):
+            try:
+                self.request_range(chunk, progress)
+                retries = 0
+            except TRANSIENT_ERRORS as e:
+                retries += 1
+                if retries > MAX_RETRIES:
+                    raise DownloadError("{}: {}".format(self.destination_path.name, e))
+                time.sleep(RETRY_DELAY * min(retries, 5))
+
+    def is_chunk_done(self, chunk):
+        begin, end, done = chunk
+        if self.size == 0:
+            # Unknown size, done once a request reached the end of the file
+            return end < 0
+        return done >= end - begin
+
+    def request_range(self, chunk, progress):
+        begin, end, done = chunk
+        request = urllib.request.Request(self.url)
+        ranged = self.size > 0 and (begin + done > 0 or end < self.size)
+        if ranged:
+            request.add_header('Range', 'bytes={}-{}'.format(begin + done, end - 1))
+        with urllib.request.urlopen(request, timeout=TIMEOUT) as response:
+            if response.status != 206 and (ranged or done):
+                if len(self.chunks) > 1:
+                    raise ServerIgnoredRange()
+                # The whole file is sent again, start over
+                progress.restart(chunk[2])
+                chunk[2] = 0
+            with open(self.part_path, 'r+b') as f:
+                f.seek(begin + chunk[2])
+                if self.size == 0:
+                    f.truncate()
+                while self.size == 0 or chunk[2] < end - begin:
+                    data = response.read(READ_SIZE if self.size == 0 else
+                                         min(READ_SIZE, end - begin - chunk[2]))
+                    if not data:
+                        break
+                    if self.cancel.is_set():
+                        raise DownloadError("{}: cancelled".format(self.destination_path.name))
+                    f.write(data)
+                    # Written bytes must be on disk before the sidecar counts them
+                    f.flush()
+                    chunk[2] += len(data)
+                    progress.add(len(data))
+                    self.save_progress()
+        if self.size == 0:
+            chunk[1] = -1
+        elif chunk[2] < end - begin:
+            raise http.client.IncompleteRead(b'', end - begin - chunk[2])
+
+    def finish(self):
+        """Verify the download and move it to its destination"""
+        self.save_progress(force=True)
+        size = self.part_path.stat().st_size
+        if self.size and (size != self.size or self.get_done_bytes() != self.size):
+            raise DownloadError("{}: expected {} bytes, got {}".format(
+                self.destination_path.name, self.size, self.get_done_bytes()))
+        if self.destination_path.suffix == '.tar' and not verify_tar(self.part_path):
+            # Corrupted data cannot be located, start over next time
+            self.part_path.unlink()
+            self.progress_path.unlink()
+            raise DownloadError("{}: corrupted tar file".format(self.destination_path.name))
+        os.replace(self.part_path, self.destination_path)
+        self.progress_path.unlink()
+
+
+def verify_tar(tar_path):
+    """Walk the tar headers, each of them has a checksum. tarfile stops at
+    the first zero block, so also check that only the end-of-archive blocks
+    (and padding) follow the last member."""
+    try:
+        with tarfile.open(tar_path, 'r:') as tar:
+            for _ in tar:
+                pass
+            end = tar.offset
+    except tarfile.TarError:
+        return False
+    with open(tar_path, 'rb') as f:
+        f.seek(end)
+        trailer = f.read(tarfile.RECORDSIZE + 2 * tarfile.BLOCKSIZE + 1)
+    return len(trailer) <= tarfile.RECORDSIZE + 2 * tarfile.BLOCKSIZE and not any(trailer)
+
+
+def is_downloaded(destination_path, size):
+    destination_path = Path(destination_path)
+    return destination_path.exists() and (size is None or destination_path.stat().st_size == size)
+
+
+def download_files(files, max_files=DEFAULT_MAX_FILES,
+                   connections_per_file=DEFAULT_CONNECTIONS_PER_FILE,
+                   chunk_size=DEFAULT_CHUNK_SIZE):
+    """Download files, a list of (url, destination_path, size in bytes).
+
+    Up to max_files are downloaded concurrently, each with up to
+    connections_per_file range requests. Files already downloaded with the
+    right size are skipped, partial downloads are resumed.
+
+    Returns the list of destination paths that could not be downloaded.
+    """
+    downloads = [FileDownload(url, path, size or 0, chunk_size) for url, path, size in files]
+    progress = DownloadProgress(sum(d.size for d in downloads),
+                                sum(d.get_done_bytes() for d in downloads))
+    cancel = threading.Event()
+    for download in downloads:
+        download.cancel = cancel
+
+    def download_file(download):
+        done_bytes = download.get_done_bytes()
+        if done_bytes:
+            print("\r=> Resuming {} ({:.1f}/{:.1f} MB)".format(
+                download.destination_path.name, done_bytes / 1e6, download.size / 1e6))
+        download.prepare()
+        try:
+            with ThreadPoolExecutor(max(1, connections_per_file)) as chunk_executor:
+                futures = [chunk_executor.submit(download.download_chunk, chunk, progress)
+                           for chunk in download.chunks if not download.is_chunk_done(chunk)]
+                for future in futures:
+                    future.result()
+        except ServerIgnoredRange:
+            # Start over with a single request
+            progress.restart(download.get_done_bytes())
+            download.chunks = [[0, download.size, 0]]
+            download.download_chunk(download.chunks[0], progress)
+        download.finish()
+
+    failed = []
+    start = time.time()
+    try:
+        with ThreadPoolExecutor(max(1, max_files)) as file_executor:
+            futures = [(d, file_executor.submit(download_file, d)) for d in downloads]
+            try:
+                for download, future in futures:
+                    try:
+                        future.result()
+                    except DownloadError as e:
+                        print("\r=> Failed: {}".format(e))
+                        failed.append(download.destination_path)
+            except KeyboardInterrupt:
+                # Stop the running requests, the next download resumes them
+                cancel.set()
+                raise
+    finally:
+        for download in downloads:
+            if download.part_path.exists():
+                download.save_progress(force=True)
+
+    progress.report(force=True)
+    elapsed = time.time() - start
+    print("\n=> Downloaded {:.1f} MB in {:.1f}s ({:.2f} MB/s)".format(
+        (progress.done_bytes - progress.already_done) / 1e6, elapsed, progress.get_rate() / 1e6))
+    return failed
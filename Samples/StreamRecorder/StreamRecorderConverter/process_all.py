@@ -8,34 +8,133 @@
 """
 import argparse
 from pathlib import Path
-from project_hand_eye_to_pv import project_hand_eye_to_pv
+from project_hand_eye_to_pv import project_hand_eye_to_pv, HAND_EYE_ANNOTATIONS_NAME
 from utils import check_framerates, extract_tar_file
-from save_pclouds import save_pclouds
+from save_pclouds import (save_pclouds, pinhole_record_from_json,
+                          pinhole_record_to_json)
 from convert_images import convert_images
+from conversion_manifest import Stage, run_stages
+from tsdf_fusion import fuse_depth
+from aggregate_pclouds import aggregate_pclouds
+from tone_map_ab import tone_map_ab
+from pv_frames import PV_FORMATS, PV_ENCODINGS
 
 
-def process_all(w_path, project_hand_eye=False):
-    # Extract all tar
-    for tar_fname in w_path.glob("*.tar"):
-        print(f"Extracting {tar_fname}")
-        tar_output = ''
-        tar_output = w_path / Path(tar_fname.stem)
-        tar_output.mkdir(exist_ok=True)
-        extract_tar_file(tar_fname, tar_output)
+def get_conversion_stages(w_path, project_hand_eye=False, extract=False, tsdf=False,
+                          pv_format='png', pv_encoding='png', aggregate=False,
+                          tone_map=False, pcloud_format='ply'):
+    """Conversion stages of a recording and their dependencies,
+    see conversion_manifest.run_stages"""
+    stages = []
+    pv_info_paths = sorted(w_path.glob('*pv.txt'))
+    has_pv = (w_path / "PV.tar").exists()
+
+    # By default frames are streamed from the tarballs straight to the
+    # conversion workers. Extract all tar only if requested.
+    if extract:
+        tar_paths = sorted(w_path.glob("*.tar"))
+
+        def run_extract(record):
+            for tar_fname in tar_paths:
+                print(f"Extracting {tar_fname}")
+                tar_output = w_path / Path(tar_fname.stem)
+                tar_output.mkdir(exist_ok=True)
+                extract_tar_file(tar_fname, tar_output)
+
+        stages.append(Stage('extract', run_extract, tar_paths))
+    extract_dependency = ['extract'] if extract else []
 
     # Process PV if recorded
-    if (w_path / "PV.tar").exists():
-        # Convert images
-        convert_images(w_path)
+    if has_pv:
+        def run_convert_images(record):
+            if extract and pv_format == 'png':
+                convert_images(w_path, stream=False)
+                return
+            convert_images(w_path, stream=not extract,
+                           done_frames=record.done_frames(),
+                           on_frame_done=lambda name, output_path: record.frame_done(name, [output_path]),
+                           pv_format=pv_format, encoding=pv_encoding)
+
+        stages.append(Stage('convert_images', run_convert_images,
+                            [w_path / "PV.tar"] + pv_info_paths,
+                            params={'pv_format': pv_format, 'encoding': pv_encoding},
+                            dependencies=extract_dependency))
 
         # Project
         if project_hand_eye:
-            project_hand_eye_to_pv(w_path)
-# Process depth if recorded
+            def run_project_hand_eye(record):
+                project_hand_eye_to_pv(w_path)
+                record.frame_done('eye_hands', [w_path / HAND_EYE_ANNOTATIONS_NAME] +
+                                  sorted((w_path / 'eye_hands').glob('*.png')))
+
+            stages.append(Stage('project_hand_eye', run_project_hand_eye,
+                                list(w_path.glob('*_eye.csv')) + pv_info_paths,
+                                dependencies=['convert_images']))
+
+    # Process depth if recorded
     for sensor_name in ["Depth Long Throw", "Depth AHaT"]:
-        if (w_path / "{}.tar".format(sensor_name)).exists():
-            # Save point clouds
-            save_pclouds(w_path, sensor_name)
+        if not (w_path / "{}.tar".format(sensor_name)).exists():
+            continue
+        sensor_inputs = [w_path / f"{sensor_name}.tar",
+                         w_path / f"{sensor_name}_lut.bin",
+                         w_path / f"{sensor_name}_extrinsics.txt",
+                         w_path / f"{sensor_name}_rig2world.txt"]
+
+        # Save point clouds, colored from the PV pngs if recorded
+        def run_save_pclouds(record, sensor_name=sensor_name):
+            done_frames = {name: pinhole_record_from_json(data) if data is not None else None
+                           for name, data in record.done_frames().items()}
+
+            def on_frame_done(name, outputs, pinhole_record):
+                record.frame_done(name, outputs, pinhole_record_to_json(pinhole_record)
+                                  if pinhole_record is not None else None)
+
+            save_pclouds(w_path, sensor_name, stream=not extract, output_format=pcloud_format,
+                         done_frames=done_frames, on_frame_done=on_frame_done)
+
+        stages.append(Stage(f'save_pclouds {sensor_name}', run_save_pclouds,
+                            sensor_inputs + pv_info_paths,
+                            params={'output_format': pcloud_format},
+                            dependencies=['convert_images'] if has_pv else extract_dependency))
+
+        if tsdf and sensor_name == "Depth Long Throw":
+            def run_tsdf_fusion(record, sensor_name=sensor_name):
+                fuse_depth(w_path, sensor_name)
+                record.frame_done('mesh', [w_path / 'tsdf-fusion-mesh.ply'])
+
+            stages.append(Stage('tsdf_fusion', run_tsdf_fusion, sensor_inputs))
+
+        # Merge the frames in one point cloud, colored from the PV frames if recorded
+        if aggregate:
+            def run_aggregate_pclouds(record, sensor_name=sensor_name):
+                aggregate_pclouds(w_path, sensor_name)
+                record.frame_done('cloud', [w_path / f'{sensor_name}_aggregated.ply'])
+
+            stages.append(Stage(f'aggregate_pclouds {sensor_name}', run_aggregate_pclouds,
+                                sensor_inputs + pv_info_paths,
+                                dependencies=['convert_images'] if has_pv else extract_dependency))
+
+        # Save the AB images as 8 bit pngs
+        if tone_map:
+            def run_tone_map_ab(record, sensor_name=sensor_name):
+                tone_map_ab(w_path, sensor_name, done_frames=record.done_frames(),
+                            on_frame_done=lambda name, output_path: record.frame_done(name, [output_path]))
+
+            stages.append(Stage(f'tone_map_ab {sensor_name}', run_tone_map_ab,
+                                [w_path / f"{sensor_name}.tar"], dependencies=extract_dependency))
+
+    return stages
+
+
+def process_all(w_path, project_hand_eye=False, extract=False, tsdf=False, force=False,
+                pv_format='png', pv_encoding='png', aggregate=False, tone_map=False,
+                pcloud_format='ply'):
+    """Run the conversion stages that are not up to date (see
+    conversion_manifest.py). Independent stages run concurrently, and
+    interrupted stages resume from the last completed frame."""
+    stages = get_conversion_stages(w_path, project_hand_eye, extract, tsdf,
+                                   pv_format, pv_encoding, aggregate, tone_map, pcloud_format)
+    run_stages(w_path, stages, force)
     print("")
     check_framerates(w_path)
 
@@ -48,9 +147,41 @@ if __name__ == '__main__':
                         required=False,
                         action='store_true',
                         help="Project hand joints (and eye gaze, if recorded) to rgb images")
+    parser.add_argument("--extract",
+                        required=False,
+                        action='store_true',
+                        help="Extract all tar files to disk before processing, "
+                        "instead of streaming frames from them")
+    parser.add_argument("--tsdf",
+                        required=False,
+                        action='store_true',
+                        help="Fuse the long throw depth frames in a TSDF mesh")
+    parser.add_argument("--aggregate",
+                        required=False,
+                        action='store_true',
+                        help="Merge the depth frames of each sensor in one voxel "
+                        "downsampled point cloud")
+    parser.add_argument("--tone_map_ab",
+                        required=False,
+                        action='store_true',
+                        help="Save the AB images of the depth sensors as tone mapped 8 bit pngs")
+    parser.add_argument("--force",
+                        required=False,
+                        action='store_true',
+                        help="Redo all the conversion stages, even if they are up to date")
+    parser.add_argument("--pv_format", choices=PV_FORMATS, default='png',
+                        help="png: one png per PV frame, array: chunked image array files, "
+                        "video: chunked lossless (FFV1) videos")
+    parser.add_argument("--pv_encoding", choices=list(PV_ENCODINGS), default='png',
+                        help="Frame encoding of the array format: png (lossless) or jpg")
+    parser.add_argument("--pcloud_format", choices=["ply", "organized"], default='ply',
+                        help="Depth frames saved as ply point clouds, or as organized "
+                        "point clouds (see save_pclouds.py)")
 
     args = parser.parse_args()
 
     w_path = Path(args.recording_path)
 
-    process_all(w_path, args.project_hand_eye)
+    process_all(w_path, args.project_hand_eye, args.extract, args.tsdf, args.force,
+                args.pv_format, args.pv_encoding, args.aggregate, args.tone_map_ab,
+                args.pcloud_format)
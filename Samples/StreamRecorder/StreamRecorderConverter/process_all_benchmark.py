@@ -0,0 +1,141 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import argparse
+import contextlib
+import io
+import os
+import shutil
+import tempfile
+import threading
+import time
+from pathlib import Path
+
+from organized_cloud import ORGANIZED_CLOUD_EXTENSION
+from process_all import process_all
+from pv_frames_benchmark import write_pv_recording
+from tsdf_fusion_benchmark import SENSOR_NAME, write_synthetic_recording
+
+# End to end time and disk usage of process_all.py when the frames are
+# streamed from the tarballs (default) and when the tarballs are extracted
+# first (--extract), on a synthetic recording: long throw depth frames
+# (tsdf_fusion_benchmark.py) and PV frames (pv_frames_benchmark.py). The
+# point clouds are saved as organized clouds, which do not need open3d. The
+# disk usage of the recording folder is sampled during a separate run, so
+# that the sampling does not slow down the timed one; it is given on top of
+# the recording itself (the tarballs and logs). The outputs of both paths
+# are compared.
+
+
+def get_folder_size(folder):
+    size = 0
+    for root, _, files in os.walk(folder):
+        for name in files:
+            try:
+                size += os.stat(os.path.join(root, name)).st_size
+            except FileNotFoundError:
+                # Deleted or renamed while walking
+                pass
+    return size
+
+
+class DiskSampler(object):
+    """Peak size of a folder, sampled every interval seconds in a thread"""
+
+    def __init__(self, folder, interval=0.02):
+        self.folder = folder
+        self.interval = interval
+        self.peak = 0
+        self.stop = threading.Event()
+        self.thread = threading.Thread(target=self.run, daemon=True)
+
+    def run(self):
+        while not self.stop.is_set():
+            self.peak = max(self.peak, get_folder_size(self.folder))
+            self.stop.wait(self.interval)
+
+    def __enter__(self):
+        self.thread.start()
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.stop.set()
+        self.thread.join()
+        self.peak = max(self.peak, get_folder_size(self.folder))
+
+
+def write_recording(folder, n_frames, pv_width, pv_height):
+    write_synthetic_recording(folder, n_frames)
+    write_pv_recording(folder, n_frames, pv_width, pv_height)
+
+
+def read_outputs(folder, sensor_name=SENSOR_NAME):
+    """Relative path -> content of the converted PV frames, point clouds and
+    pinhole projections, without the files extracted from the tarballs"""
+    folder = Path(folder)
+    paths = (list((folder / 'PV').glob('*.png')) +
+             list((folder / sensor_name).glob(f'*{ORGANIZED_CLOUD_EXTENSION}')) +
+             [path for path in (folder / 'pinhole_projection').rglob('*') if path.is_file()])
+    return {str(path.relative_to(folder)): path.read_bytes() for path in sorted(paths)}
+
+
+def run_process_all(folder, extract):
+    with contextlib.redirect_stdout(io.StringIO()):
+        process_all(Path(folder), extract=extract, pcloud_format='organized')
+
+
+def copy_recording(source, folder):
+    if Path(folder).exists():
+        shutil.rmtree(folder)
+    shutil.copytree(source, folder)
+
+
+def run_benchmark(n_frames, pv_width, pv_height):
+    with tempfile.TemporaryDirectory() as tmp:
+        source = Path(tmp) / 'source'
+        write_recording(source, n_frames, pv_width, pv_height)
+        recording_size = get_folder_size(source)
+        print(f"{n_frames} depth and PV frames ({pv_width}x{pv_height}), "
+              f"recording of {recording_size / 1e6:.1f} MB")
+        print(f"{'path':<10} {'seconds':>8} {'frames/s':>9} {'peak MB':>8} {'final MB':>9} {'outputs':>8}")
+        reference = None
+        for name, extract in [('stream', False), ('extract', True)]:
+            folder = Path(tmp) / name
+            copy_recording(source, folder)
+            start = time.perf_counter()
+            run_process_all(folder, extract)
+            seconds = time.perf_counter() - start
+            outputs = read_outputs(folder)
+            if reference is None:
+                reference = outputs
+
+            copy_recording(source, folder)
+            with DiskSampler(folder) as sampler:
+                run_process_all(folder, extract)
+            final_size = get_folder_size(folder)
+
+            print(f"{name:<10} {seconds:>8.2f} {n_frames / seconds:>9.1f} "
+                  f"{(sampler.peak - recording_size) / 1e6:>8.1f} {(final_size - recording_size) / 1e6:>9.1f} "
+                  f"{'same' if outputs == reference else 'DIFFER':>8}")
+            shutil.rmtree(folder)
+        print("MB on top of the recording")
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Streamed and extracted conversion benchmark')
+    parser.add_argument("--frames",
+                        type=int,
+                        default=60,
+                        help="Number of depth and PV frames of the synthetic recording")
+    parser.add_argument("--pv_resolution",
+                        default='760x428',
+                        help="PV frame size, as <width>x<height>")
+
+    args = parser.parse_args()
+    pv_width, pv_height = (int(v) for v in args.pv_resolution.split('x'))
+    run_benchmark(args.frames, pv_width, pv_height)
@@ -7,12 +7,30 @@
  PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
 """
 import cv2
+import time
 import argparse
 import numpy as np
 from pathlib import Path
 import ast
 
-from utils import load_head_hand_eye_data
+from utils import load_cached_log, load_head_hand_eye_arrays, parse_csv_lines
+from timestamp_matching import TimestampIndex
+from stream_tar import BoundedPool
+from pv_frames import PvFrames
+
+
+# Hand/eye samples further than this from a PV frame are reported as unmatched
+# (in hundreds of nanoseconds, i.e. 100ms)
+MAX_HAND_PV_DELTA = 1000000
+
+# Distance of the head forward point, in meters
+HEAD_FORWARD_DISTANCE = 1.0
+
+# Per-frame 2D annotations, see compute_hand_eye_annotations
+HAND_EYE_ANNOTATIONS_NAME = 'hand_eye_2d.npz'
+
+# BGR colors of the left hand, right hand and eye gaze overlays
+OVERLAY_COLORS = [(0, 0, 255), (0, 255, 0), (255, 0, 0)]
 
 
 def process_timestamps(path):
@@ -22,35 +40,40 @@ def process_timestamps(path):
     return np.array([int(elem) for elem in lines if len(elem)])
 
 
-def load_pv_data(csv_path):
+def parse_pv_log(csv_path):
     with open(csv_path) as f:
-        lines = f.readlines()
+        lines = [line for line in f.read().splitlines() if line.strip()]
 
     # The first line contains info about the intrinsics.
     # The following lines (one per frame) contain timestamp, focal length and transform PVtoWorld
-    n_frames = len(lines) - 1
-    frame_timestamps = np.zeros(n_frames, dtype=np.longlong)
-    focal_lengths = np.zeros((n_frames, 2))
-    pv2world_transforms = np.zeros((n_frames, 4, 4))
+    intrinsics = np.array(ast.literal_eval(lines[0]), dtype=np.float64)
 
-    intrinsics_ox, intrinsics_oy, \
-        intrinsics_width, intrinsics_height = ast.literal_eval(lines[0])
+    # Row format is
+    # timestamp, focal length (2), transform PVtoWorld (4x4)
+    data = parse_csv_lines(lines[1:]).reshape((-1, 19))
+    # Parse timestamps separately, they do not fit in a float64 without loss
+    frame_timestamps = np.array([line[:line.index(',')] for line in lines[1:]]).astype(np.longlong)
+
+    return {'intrinsics': intrinsics,
+            'frame_timestamps': frame_timestamps,
+            'focal_lengths': data[:, 1:3],
+            'pv2world_transforms': data[:, 3:19].reshape((-1, 4, 4))}
+
+
+def load_pv_data(csv_path):
+    data = load_cached_log(csv_path, parse_pv_log)
 
-    for i_frame, frame in enumerate(lines[1:]):
-        # Row format is
-        # timestamp, focal length (2), transform PVtoWorld (4x4)
-        frame = frame.split(',')
-        frame_timestamps[i_frame] = int(frame[0])
-        focal_lengths[i_frame, 0] = float(frame[1])
-        focal_lengths[i_frame, 1] = float(frame[2])
-        pv2world_transforms[i_frame] = np.array(frame[3:20]).astype(float).reshape((4, 4))
+    intrinsics_ox, intrinsics_oy, \
+        intrinsics_width, intrinsics_height = data['intrinsics']
 
-    return (frame_timestamps, focal_lengths, pv2world_transforms,
-            intrinsics_ox, intrinsics_oy, intrinsics_width, intrinsics_height)
+    return (data['frame_timestamps'], data['focal_lengths'], data['pv2world_transforms'],
+            intrinsics_ox, intrinsics_oy, int(intrinsics_width), int(intrinsics_height))
 
 
 def match_timestamp(target, all_timestamps):
-    return np.argmin([abs(x - target) for x in all_timestamps])
+    """Index of the timestamp closest to target.
+    To match many targets against the same stream, use TimestampIndex instead."""
+    return np.abs(np.asarray(all_timestamps) - target).argmin()
 
 
 def get_eye_gaze_point(gaze_data):
@@ -64,73 +87,190 @@ def get_eye_gaze_point(gaze_data):
     return point[:3]
 
 
-def project_hand_eye_to_pv(folder):
-    print("")
+def get_eye_gaze_points(gaze_data):
+    """Vectorized get_eye_gaze_point, for gaze_data (N, 9)"""
+    directions = gaze_data[:, 4:8]
+    with np.errstate(divide='ignore', invalid='ignore'):
+        directions = directions / np.linalg.norm(directions, axis=1, keepdims=True)
+    dists = np.where(gaze_data[:, 8] > 0.0, gaze_data[:, 8], 1.0)
+    return (gaze_data[:, :4] + directions * dists[:, np.newaxis])[:, :3]
+
+
+def get_head_forward_points(head_transforms, distance=HEAD_FORWARD_DISTANCE):
+    """Points distance meters in front of the head, for head_transforms (N, 4, 4).
+    The head looks along -z."""
+    return head_transforms[:, :3, 3] - head_transforms[:, :3, 2] * distance
+
+
+def project_world_points(points, pv2world_transforms, focal_lengths, principal_point, width):
+    """Project world points (F, P, 3), P points per PV frame, in the F PV frames
+    at once. Same pinhole model as cv2.projectPoints without distortion, with
+    the x axis mirrored (width - x) like the PV images.
+
+    Returns xy (F, P, 2), a mask (F, P) of the points in front of a camera
+    with a valid pose, and the mask (F) of the frames with a valid pose.
+    """
+    n_frames = len(pv2world_transforms)
+    # Frames without a pose have a singular (zero) pv2world transform
+    valid_pose = np.abs(np.linalg.det(pv2world_transforms)) > 1e-12
+    world2pv = np.zeros_like(pv2world_transforms)
+    world2pv[valid_pose] = np.linalg.inv(pv2world_transforms[valid_pose])
+
+    cam_points = (np.einsum('fij,fpj->fpi', world2pv[:, :3, :3], points) +
+                  world2pv[:, np.newaxis, :3, 3])
+    z = cam_points[:, :, 2]
+    with np.errstate(divide='ignore', invalid='ignore'):
+        xy = (cam_points[:, :, :2] / z[:, :, np.newaxis] *
+              focal_lengths.reshape((n_frames, 1, 2)) + principal_point)
+    xy[:, :, 0] = width - xy[:, :, 0]
+    in_front = (z > 0) & valid_pose[:, np.newaxis]
+    return xy, in_front, valid_pose
+
+
+def compute_hand_eye_annotations(folder):
+    """Project the hand joints, eye gaze point and head forward point of the
+    whole session in all the PV frames listed in the PV pose log.
+
+    Returns a dictionary of per-frame arrays (F PV frames, J joints per hand):
+        pv_timestamps (F), hand_timestamps (F): matched hand/eye sample
+        left_hand, right_hand (F, J, 2), gaze, head_forward (F, 2): pixel
+            coordinates in the PV image (x mirrored, as drawn on the pngs)
+        left_hand_visible, right_hand_visible (F, J), gaze_visible,
+            head_forward_visible (F): tracked at the matched sample, and in
+            front of the camera
+        valid_pose (F): the frame has a pv2world transform
+        width, height: PV image size
+    """
     head_hat_stream_path = list(folder.glob('*_eye.csv'))[0]
     pv_info_path = list(folder.glob('*pv.txt'))[0]
-    pv_paths = sorted(list((folder / 'PV').glob('*png')))
-    assert(len(pv_paths))
 
     # load head, hand, eye data
-    (timestamps, _,
-     left_hand_transs, left_hand_transs_available,
-     right_hand_transs, right_hand_transs_available,
-     gaze_data, gaze_available) = load_head_hand_eye_data(head_hat_stream_path)
-
-    eye_str = " and eye gaze" if np.any(gaze_available) else ""
-    print("Projecting hand joints{} to PV".format(eye_str))
+    data = load_head_hand_eye_arrays(head_hat_stream_path)
+    timestamps = data['timestamps']
 
     # load pv info
     (frame_timestamps, focal_lengths, pv2world_transforms,
      ox, oy, width, height) = load_pv_data(pv_info_path)
-
     principal_point = np.array([ox, oy])
 
-    n_frames = len(pv_paths)
+    # Match all PV frames to the hand/eye stream at once
+    hand_index = TimestampIndex(timestamps)
+    hand_ids = hand_index.nearest(frame_timestamps)
+
+    report = hand_index.report(frame_timestamps, MAX_HAND_PV_DELTA)
+    if len(report['unmatched']) or len(report['duplicate_timestamps']):
+        print("{} PV frames without hand data within {:.0f}ms, {} duplicate hand timestamps".format(
+            len(report['unmatched']), MAX_HAND_PV_DELTA * 1e-4, len(report['duplicate_timestamps'])))
+
+    # All the points of a frame, projected in a single pass:
+    # left joints, right joints, gaze point, head forward point
+    left = data['left_hand_transs'][hand_ids]
+    right = data['right_hand_transs'][hand_ids]
+    n_joints = left.shape[1]
+    points = np.concatenate([left, right,
+                             get_eye_gaze_points(data['gaze_data'][hand_ids])[:, np.newaxis],
+                             get_head_forward_points(data['head_transforms'][hand_ids])[:, np.newaxis]],
+                            axis=1)
+    xy, in_front, valid_pose = project_world_points(points, pv2world_transforms, focal_lengths,
+                                        principal_point, width)
+
+    left_available = data['left_hand_transs_available'][hand_ids]
+    right_available = data['right_hand_transs_available'][hand_ids]
+    gaze_available = data['gaze_available'][hand_ids]
+    return {'pv_timestamps': frame_timestamps,
+            'hand_timestamps': timestamps[hand_ids].astype(np.int64),
+            'left_hand': xy[:, :n_joints],
+            'right_hand': xy[:, n_joints:2 * n_joints],
+            'gaze': xy[:, 2 * n_joints],
+            'head_forward': xy[:, 2 * n_joints + 1],
+            'left_hand_visible': in_front[:, :n_joints] & left_available[:, np.newaxis],
+            'right_hand_visible': in_front[:, n_joints:2 * n_joints] & right_available[:, np.newaxis],
+            'gaze_visible': in_front[:, 2 * n_joints] & gaze_available,
+            'head_forward_visible': in_front[:, 2 * n_joints + 1],
+            'valid_pose': valid_pose,
+            'width': width,
+            'height': height}
+
+
+def save_hand_eye_annotations(output_path, annotations):
+    """Save the annotations of compute_hand_eye_annotations, with the pixel
+    coordinates in float32"""
+    np.savez_compressed(output_path, **{
+        key: value.astype(np.float32) if np.asarray(value).dtype == np.float64 else value
+        for key, value in annotations.items()})
+
+
+def load_hand_eye_annotations(path):
+    with np.load(path) as data:
+        return {key: data[key] for key in data.files}
+
+
+def to_pixel(xy, width):
+    # Same rounding as the unbatched projection: truncate the unmirrored
+    # coordinates, then mirror
+    return (width - int(width - xy[0]), int(xy[1]))
+
+
+# Per-process state of the overlay workers, set by init_overlay_worker
+worker_state = {}
+
+
+def init_overlay_worker(folder):
+    worker_state['pv_frames'] = PvFrames(folder)
+
+
+def render_overlay(pv_timestamp, output_path, width, left, left_visible, right, right_visible,
+                   gaze, gaze_visible):
+    img = worker_state['pv_frames'].read(pv_timestamp)
+    for xys, visible, color in [(left, left_visible, OVERLAY_COLORS[0]),
+                                (right, right_visible, OVERLAY_COLORS[1]),
+                                (gaze[np.newaxis], [gaze_visible], OVERLAY_COLORS[2])]:
+        for xy, is_visible in zip(xys, visible):
+            if is_visible:
+                img = cv2.circle(img, to_pixel(xy, width), radius=3, color=color)
+    cv2.imwrite(str(output_path), img)
+
+
+def render_overlays(folder, annotations, workers=None):
+    """Draw the projected hand joints and gaze on the PV frames, on a worker pool"""
+    pv_timestamps = PvFrames(folder).timestamps
+    assert(len(pv_timestamps))
     output_folder = folder / 'eye_hands'
     output_folder.mkdir(exist_ok=True)
-    for pv_id in range(n_frames):
-        print(".", end="", flush=True)
-        pv_path = pv_paths[pv_id]
-        sample_timestamp = int(str(pv_path.name).replace('.png', ''))
-
-        hand_ts = match_timestamp(sample_timestamp, timestamps)
-        # print('Frame-hand delta: {:.3f}ms'.format((sample_timestamp - timestamps[hand_ts]) * 1e-4))
-
-        img = cv2.imread(str(pv_path))
-        # pinhole
-        K = np.array([[focal_lengths[pv_id][0], 0, principal_point[0]],
-                      [0, focal_lengths[pv_id][1], principal_point[1]],
-                      [0, 0, 1]])
-        try:
-            Rt = np.linalg.inv(pv2world_transforms[pv_id])
-        except np.linalg.LinAlgError:
-            print('No pv2world transform')
-            continue
-        rvec, _ = cv2.Rodrigues(Rt[:3, :3])
-        tvec = Rt[:3, 3]
-
-        colors = [(0, 0, 255), (0, 255, 0), (255, 0, 0)]
-        hands = [(left_hand_transs, left_hand_transs_available),
-                 (right_hand_transs, right_hand_transs_available)]
-        for hand_id, hand in enumerate(hands):
-            transs, avail = hand
-            if avail[hand_ts]:
-                for joint in transs[hand_ts]:
-                    hand_tr = joint.reshape((1, 3))
-                    xy, _ = cv2.projectPoints(hand_tr, rvec, tvec, K, None)
-                    ixy = (int(xy[0][0][0]), int(xy[0][0][1]))
-                    ixy = (width - ixy[0], ixy[1])
-                    img = cv2.circle(img, ixy, radius=3, color=colors[hand_id])
-
-        if gaze_available[hand_ts]:
-            point = get_eye_gaze_point(gaze_data[hand_ts])
-            xy, _ = cv2.projectPoints(point.reshape((1, 3)), rvec, tvec, K, None)
-            ixy = (int(xy[0][0][0]), int(xy[0][0][1]))
-            ixy = (width - ixy[0], ixy[1])
-            img = cv2.circle(img, ixy, radius=3, color=colors[2])
-
-        cv2.imwrite(str(output_folder / 'hands') + 'proj{}.png'.format(str(pv_id).zfill(4)), img)
+
+    frame_ids = {timestamp: i for i, timestamp in enumerate(annotations['pv_timestamps'])}
+    width = annotations['width']
+    with BoundedPool(workers, initializer=init_overlay_worker, initargs=(folder,)) as pool:
+        for pv_id, pv_timestamp in enumerate(pv_timestamps):
+            frame_id = frame_ids.get(pv_timestamp)
+            if frame_id is None or not annotations['valid_pose'][frame_id]:
+                print('No pv2world transform')
+                continue
+            print(".", end="", flush=True)
+            pool.submit(render_overlay, (
+                pv_timestamp, output_folder / 'handsproj{}.png'.format(str(pv_id).zfill(4)), width,
+                annotations['left_hand'][frame_id], annotations['left_hand_visible'][frame_id],
+                annotations['right_hand'][frame_id], annotations['right_hand_visible'][frame_id],
+                annotations['gaze'][frame_id], annotations['gaze_visible'][frame_id]))
+
+
+def project_hand_eye_to_pv(folder, render=True, workers=None):
+    """Project the hand joints, eye gaze and head forward points to the PV
+    frames, save them to <folder>/hand_eye_2d.npz and, if render, draw them
+    on the PV pngs in <folder>/eye_hands"""
+    print("")
+    start = time.time()
+    annotations = compute_hand_eye_annotations(folder)
+    save_hand_eye_annotations(folder / HAND_EYE_ANNOTATIONS_NAME, annotations)
+    projection_time = time.time() - start
+
+    eye_str = " and eye gaze" if np.any(annotations['gaze_visible']) else ""
+    print("Projected hand joints{} to {} PV frames in {:.2f}s".format(
+        eye_str, len(annotations['pv_timestamps']), projection_time))
+
+    if render:
+        render_overlays(folder, annotations, workers)
+        print("\nRendered overlays in {:.2f}s".format(time.time() - start - projection_time))
 
 
 if __name__ == "__main__":
@@ -138,6 +278,12 @@ if __name__ == "__main__":
     parser = argparse.ArgumentParser(description='Process recorded data.')
     parser.add_argument("--recording_path", required=True,
                         help="Path to recording folder")
+    parser.add_argument("--no_overlays",
+                        required=False,
+                        action='store_true',
+                        help="Only save the 2D annotations, do not draw them on the PV images")
+    parser.add_argument("--workers", type=int, default=None,
+                        help="Number of processes drawing the overlays (cpu count by default)")
 
     args = parser.parse_args()
-    project_hand_eye_to_pv(Path(args.recording_path))
+    project_hand_eye_to_pv(Path(args.recording_path), not args.no_overlays, args.workers)
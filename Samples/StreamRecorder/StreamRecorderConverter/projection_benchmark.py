@@ -0,0 +1,160 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import argparse
+import time
+
+import cv2
+import numpy as np
+
+from tsdf_fusion_benchmark import get_camera_pose, get_pinhole_lut, render_depth
+from utils import project_on_depth, project_on_pv, transform_points
+
+# Time per frame of the projections of save_pclouds.py, against the per-point
+# loops they replaced: the coloring of the points of a depth frame from a PV
+# frame (project_on_pv, the frame's points occluding each other) and their
+# rendering in the 320x288 pinhole camera and in one at PV resolution
+# (project_on_depth). On a synthetic long throw frame (tsdf_fusion_benchmark.py),
+# with the PV camera 5 cm above the depth camera.
+
+PV_FOCAL_LENGTH = 0.77      # Of the PV width
+
+
+def project_on_pv_per_point(points, pv_img, pv2world_transform, focal_length, principal_point):
+    """project_on_pv before the z-buffer: nearest pixel colors, and the depth
+    of the last point projected in each pixel"""
+    height, width, _ = pv_img.shape
+
+    homog_points = np.hstack((points, np.ones(len(points)).reshape((-1, 1))))
+    world2pv_transform = np.linalg.inv(pv2world_transform)
+    points_pv = (world2pv_transform @ homog_points.T).T[:, :3]
+
+    intrinsic_matrix = np.array([[focal_length[0], 0, principal_point[0]], [
+        0, focal_length[1], principal_point[1]], [0, 0, 1]])
+    rvec = np.zeros(3)
+    tvec = np.zeros(3)
+    xy, _ = cv2.projectPoints(points_pv, rvec, tvec, intrinsic_matrix, None)
+    xy = np.squeeze(xy)
+    xy[:, 0] = width - xy[:, 0]
+    xy = np.around(xy).astype(int)
+
+    rgb = np.zeros_like(points)
+    width_check = np.logical_and(0 <= xy[:, 0], xy[:, 0] < width)
+    height_check = np.logical_and(0 <= xy[:, 1], xy[:, 1] < height)
+    valid_ids = np.where(np.logical_and(width_check, height_check))[0]
+
+    z = points_pv[valid_ids, 2]
+    xy = xy[valid_ids, :]
+
+    depth_image = np.zeros((height, width))
+    for i, p in enumerate(xy):
+        depth_image[p[1], p[0]] = z[i]
+
+    colors = pv_img[xy[:, 1], xy[:, 0], :]
+    rgb[valid_ids, :] = colors[:, ::-1] / 255.
+
+    return rgb, depth_image
+
+
+def project_on_depth_per_point(points, rgb, intrinsic_matrix, width, height):
+    """project_on_depth before the z-buffer: the last point projected in each pixel"""
+    rvec = np.zeros(3)
+    tvec = np.zeros(3)
+    xy, _ = cv2.projectPoints(points, rvec, tvec, intrinsic_matrix, None)
+    xy = np.squeeze(xy)
+    xy = np.around(xy).astype(int)
+
+    width_check = np.logical_and(0 <= xy[:, 0], xy[:, 0] < width)
+    height_check = np.logical_and(0 <= xy[:, 1], xy[:, 1] < height)
+    valid_ids = np.where(np.logical_and(width_check, height_check))[0]
+    xy = xy[valid_ids, :]
+
+    z = points[valid_ids, 2]
+    depth_image = np.zeros((height, width))
+    image = np.zeros((height, width, 3))
+    rgb = rgb[valid_ids, :]
+    rgb = rgb[:, ::-1]
+    for i, p in enumerate(xy):
+        depth_image[p[1], p[0]] = z[i]
+        image[p[1], p[0]] = rgb[i]
+
+    image = image * 255.
+
+    return image, depth_image
+
+
+def make_frame(pv_width, pv_height, i_frame=0, n_frames=60):
+    """Camera space points of a synthetic depth frame, their cam2world
+    transform, and a PV frame with its pv2world transform and intrinsics"""
+    lut = get_pinhole_lut()
+    cam2world = get_camera_pose(i_frame, n_frames)
+    depth = render_depth(cam2world, lut).reshape(-1)
+    valid = depth > 0
+    points = lut[valid] * depth[valid, np.newaxis] / 1000.
+
+    pv2world = cam2world.copy()
+    pv2world[:3, 3] += cam2world[:3, 1] * -0.05
+    # The PV camera looks along -z, with x mirrored (see project_on_pv)
+    pv2world[:3, :3] = cam2world[:3, :3] @ np.diag([-1., 1., 1.])
+    focal_length = np.array([PV_FOCAL_LENGTH * pv_width] * 2)
+    principal_point = np.array([pv_width / 2., pv_height / 2.])
+
+    rng = np.random.default_rng(i_frame)
+    pv_img = cv2.GaussianBlur(rng.integers(0, 256, (pv_height, pv_width, 3), dtype=np.uint8), (5, 5), 0)
+    return points, cam2world, pv_img, pv2world, focal_length, principal_point
+
+
+def best_seconds(function, repeat):
+    best = float('inf')
+    for _ in range(repeat):
+        start = time.perf_counter()
+        function()
+        best = min(best, time.perf_counter() - start)
+    return best
+
+
+def run_benchmark(pv_resolutions, repeat):
+    print(f"{'PV frame':<12} {'projection':<28} {'per point (ms)':>15} {'vectorized (ms)':>16} {'speedup':>8}")
+    for pv_width, pv_height in pv_resolutions:
+        points, cam2world, pv_img, pv2world, focal_length, principal_point = make_frame(pv_width, pv_height)
+        xyz = transform_points(points, cam2world)
+        rgb, _ = project_on_pv(xyz, pv_img, pv2world, focal_length, principal_point)
+
+        cases = [
+            ('project_on_pv',
+             lambda: project_on_pv_per_point(xyz, pv_img, pv2world, focal_length, principal_point),
+             lambda: project_on_pv(xyz, pv_img, pv2world, focal_length, principal_point, occluders=xyz))]
+        for width, height, splat_size in [(320, 288, 1), (pv_width, pv_height, int(np.ceil(pv_width / 320)))]:
+            scale = width / 320
+            intrinsic_matrix = np.array([[200 * scale, 0, width / 2.], [0, 200 * scale, height / 2.], [0, 0, 1.]])
+            cases.append((f'project_on_depth {width}x{height}',
+                          lambda m=intrinsic_matrix, w=width, h=height: project_on_depth_per_point(points, rgb, m, w, h),
+                          lambda m=intrinsic_matrix, w=width, h=height, s=splat_size:
+                          project_on_depth(points, rgb, m, w, h, splat_size=s)))
+
+        for name, per_point, vectorized in cases:
+            per_point_seconds = best_seconds(per_point, repeat)
+            vectorized_seconds = best_seconds(vectorized, repeat)
+            print(f"{f'{pv_width}x{pv_height}':<12} {name:<28} {1000 * per_point_seconds:>15.1f} "
+                  f"{1000 * vectorized_seconds:>16.1f} {per_point_seconds / vectorized_seconds:>8.1f}")
+    print(f"{len(points)} points per depth frame")
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Projection benchmark')
+    parser.add_argument("--pv_resolutions",
+                        nargs='+',
+                        default=['760x428', '1920x1080'],
+                        help="PV frame sizes, as <width>x<height>")
+    parser.add_argument("--repeat",
+                        type=int,
+                        default=5,
+                        help="Runs of each projection, the fastest is kept")
+
+    args = parser.parse_args()
+    run_benchmark([tuple(int(v) for v in resolution.split('x')) for resolution in args.pv_resolutions], args.repeat)
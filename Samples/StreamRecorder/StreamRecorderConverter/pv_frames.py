@@ -0,0 +1,218 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import os
+import re
+from pathlib import Path
+
+import cv2
+import numpy as np
+
+from stream_tar import decode_bgra
+
+# Converted PV frames are stored in <recording>/PV in one of these formats:
+#   png: one png per frame, <timestamp>.png
+#   array: chunks of frames, frames_<first frame>.pva (see below), each
+#       frame encoded as png (lossless) or jpg (visually lossless)
+#   video: chunks of frames, frames_<first frame>.mkv encoded with FFV1
+#       (lossless), and the timestamps of the chunk's frames in
+#       frames_<first frame>.mkv.npy. Meant to be read in order: seeking
+#       costs about as much as decoding MAX_VIDEO_SKIP_FRAMES frames.
+# Use PvFrames to read the frames of a recording whatever their format.
+PV_FORMATS = ['png', 'array', 'video']
+PV_ENCODINGS = {'png': 1, 'jpg': 2}
+JPG_QUALITY = 95
+DEFAULT_CHUNK_FRAMES = 300
+
+# Image array chunk layout (little endian):
+#   header (see pv_array_header_dtype)
+#   encoded frames, back to back
+#   index: frame_count entries (see pv_array_entry_dtype), at index_offset
+PV_ARRAY_EXTENSION = '.pva'
+PV_ARRAY_MAGIC = b'RMPVARRY'
+PV_ARRAY_VERSION = 1
+PV_VIDEO_EXTENSION = '.mkv'
+PV_VIDEO_FOURCC = 'FFV1'
+# Reading forward up to this many frames is faster than seeking
+MAX_VIDEO_SKIP_FRAMES = 16
+CHUNK_NAME_FORMAT = 'frames_{:06d}'
+
+pv_array_header_dtype = np.dtype([('magic', 'S8'),
+                                  ('version', '<u4'),
+                                  ('encoding', '<u4'),
+                                  ('width', '<u4'),
+                                  ('height', '<u4'),
+                                  # Written once the chunk is complete
+                                  ('frame_count', '<u8'),
+                                  ('index_offset', '<u8')])
+
+pv_array_entry_dtype = np.dtype([('timestamp', '<i8'),
+                                 ('offset', '<u8'),
+                                 ('size', '<u8')])
+
+
+def get_chunk_path(output_folder, first_frame, pv_format):
+    extension = PV_ARRAY_EXTENSION if pv_format == 'array' else PV_VIDEO_EXTENSION
+    return Path(output_folder) / (CHUNK_NAME_FORMAT.format(first_frame) + extension)
+
+
+def get_chunk_paths(pv_folder, pv_format):
+    """Complete chunks of a PV folder, in frame order"""
+    extension = PV_ARRAY_EXTENSION if pv_format == 'array' else PV_VIDEO_EXTENSION
+    return sorted(path for path in Path(pv_folder).glob('frames_*' + extension)
+                  if re.match(r'^frames_[0-9]+\.[a-z]+$', path.name))
+
+
+def read_frame_source(source, width, height):
+    """Read a raw PV frame from (timestamp, path, offset, size): a member of
+    PV.tar or an extracted .bytes file"""
+    _, path, offset, size = source
+    with open(path, 'rb') as f:
+        f.seek(offset)
+        data = f.read(size)
+    return decode_bgra(data, width, height)
+
+
+def write_pv_chunk(sources, output_path, width, height, pv_format, encoding='png'):
+    """Convert the raw frames sources (see read_frame_source) into one chunk.
+    The chunk is written to a temporary file, renamed once complete."""
+    print(".", end="", flush=True)
+    output_path = Path(output_path)
+    tmp_path = output_path.with_name(output_path.name + '.tmp' + output_path.suffix)
+    timestamps = np.array([source[0] for source in sources], dtype=np.int64)
+
+    if pv_format == 'video':
+        writer = cv2.VideoWriter(str(tmp_path), cv2.VideoWriter_fourcc(*PV_VIDEO_FOURCC),
+                                 30, (width, height))
+        assert writer.isOpened(), 'FFV1 video encoding is not available in this OpenCV build'
+        for source in sources:
+            writer.write(np.ascontiguousarray(read_frame_source(source, width, height)))
+        writer.release()
+        np.save(str(output_path) + '.npy', timestamps)
+    else:
+        header = np.zeros(1, dtype=pv_array_header_dtype)
+        header['magic'] = PV_ARRAY_MAGIC
+        header['version'] = PV_ARRAY_VERSION
+        header['encoding'] = PV_ENCODINGS[encoding]
+        header['width'] = width
+        header['height'] = height
+        entries = np.zeros(len(sources), dtype=pv_array_entry_dtype)
+        entries['timestamp'] = timestamps
+        params = [cv2.IMWRITE_JPEG_QUALITY, JPG_QUALITY] if encoding == 'jpg' else []
+        with open(tmp_path, 'wb') as f:
+            f.write(header.tobytes())
+            for i, source in enumerate(sources):
+                ok, data = cv2.imencode('.' + encoding, read_frame_source(source, width, height), params)
+                assert ok
+                entries[i]['offset'] = f.tell()
+                entries[i]['size'] = len(data)
+                f.write(data.tobytes())
+            header['frame_count'] = len(entries)
+            header['index_offset'] = f.tell()
+            f.write(entries.tobytes())
+            f.seek(0)
+            f.write(header.tobytes())
+    os.replace(tmp_path, output_path)
+    return output_path
+
+
+def load_pv_array_index(path):
+    """Header and frame index of an image array chunk.
+    A chunk whose index or frames do not fit in the file (truncated) is rejected."""
+    with open(path, 'rb') as f:
+        file_size = os.fstat(f.fileno()).st_size
+        data = f.read(pv_array_header_dtype.itemsize)
+        assert len(data) == pv_array_header_dtype.itemsize, f'Truncated PV chunk {path}'
+        header = np.frombuffer(data, dtype=pv_array_header_dtype)
+        assert header['magic'][0] == PV_ARRAY_MAGIC
+        assert header['version'][0] == PV_ARRAY_VERSION
+        index_offset = int(header['index_offset'][0])
+        index_size = int(header['frame_count'][0]) * pv_array_entry_dtype.itemsize
+        assert index_offset + index_size == file_size, f'Truncated PV chunk {path}'
+        f.seek(index_offset)
+        entries = np.frombuffer(f.read(index_size), dtype=pv_array_entry_dtype)
+    assert np.all((entries['offset'] >= pv_array_header_dtype.itemsize) &
+                  (entries['offset'] + entries['size'] <= index_offset)), f'Corrupt PV chunk index {path}'
+    return header[0], entries
+
+
+class PvFrames(object):
+    """Random access to the converted PV frames of a recording, whatever
+    their format. Frames are BGR images, looked up by timestamp."""
+
+    def __init__(self, folder):
+        self.pv_folder = Path(folder) / 'PV'
+        self.open_files = {}
+        self.frames = {}
+
+        array_paths = get_chunk_paths(self.pv_folder, 'array')
+        video_paths = get_chunk_paths(self.pv_folder, 'video')
+        if array_paths:
+            self.format = 'array'
+            for path in array_paths:
+                _, entries = load_pv_array_index(path)
+                for entry in entries:
+                    self.frames[int(entry['timestamp'])] = (path, int(entry['offset']), int(entry['size']))
+        elif video_paths:
+            self.format = 'video'
+            for path in video_paths:
+                for i, timestamp in enumerate(np.load(str(path) + '.npy')):
+                    self.frames[int(timestamp)] = (path, i, 0)
+        else:
+            self.format = 'png'
+            for path in self.pv_folder.glob('*.png'):
+                if re.match(r'^[0-9]+$', path.stem):
+                    self.frames[int(path.stem)] = (path, 0, 0)
+        self.timestamps = np.array(sorted(self.frames), dtype=np.int64)
+
+    def __len__(self):
+        return len(self.timestamps)
+
+    def __contains__(self, timestamp):
+        return int(timestamp) in self.frames
+
+    def read(self, timestamp):
+        """BGR image of the frame at timestamp, None if there is no such frame"""
+        frame = self.frames.get(int(timestamp))
+        if frame is None:
+            return None
+        path, offset, size = frame
+        if self.format == 'png':
+            return cv2.imread(str(path))
+        if self.format == 'array':
+            f = self.open_files.get(path)
+            if f is None:
+                f = self.open_files[path] = open(path, 'rb')
+            f.seek(offset)
+            return cv2.imdecode(np.frombuffer(f.read(size), dtype=np.uint8), cv2.IMREAD_COLOR)
+
+        capture, next_frame = self.open_files.get(path, (None, 0))
+        if capture is None:
+            capture = cv2.VideoCapture(str(path))
+        if 0 <= offset - next_frame <= MAX_VIDEO_SKIP_FRAMES:
+            for _ in range(offset - next_frame):
+                capture.grab()
+        else:
+            capture.set(cv2.CAP_PROP_POS_FRAMES, offset)
+        ok, image = capture.read()
+        self.open_files[path] = (capture, offset + 1)
+        return image if ok else None
+
+    def close(self):
+        for f in self.open_files.values():
+            if isinstance(f, tuple):
+                f[0].release()
+            else:
+                f.close()
+        self.open_files = {}
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.close()
@@ -0,0 +1,149 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import argparse
+import contextlib
+import io
+import shutil
+import tarfile
+import tempfile
+import time
+from pathlib import Path
+
+import cv2
+import numpy as np
+
+from convert_images import convert_images
+from pv_frames import DEFAULT_CHUNK_FRAMES, PvFrames
+from tar_index import rebuild_tar_index
+
+# Conversion time, size on disk and read throughput of the PV frame formats
+# of pv_frames.py: one png per frame, packed .pva chunks of png or jpg frames,
+# and FFV1 video chunks. The frames are read in order, as save_pclouds.py and
+# project_hand_eye_to_pv.py do, and at random timestamps, each from a fresh
+# PvFrames (which includes loading the chunk indices). On a synthetic PV
+# stream: a moving gradient with noise, so that png does not compress it
+# much better than a camera frame.
+
+FIRST_TIMESTAMP = 132552243331225839
+FRAME_INTERVAL = 333333
+FORMATS = [('png', 'png'), ('array', 'png'), ('array', 'jpg'), ('video', 'png')]
+
+
+def make_pv_frame(rng, i_frame, width, height):
+    """BGRA frame, as recorded in PV.tar"""
+    y, x = np.mgrid[:height, :width]
+    image = np.empty((height, width, 4), dtype=np.uint8)
+    image[..., 0] = (x + 4 * i_frame) * 255 // width % 256
+    image[..., 1] = (y + 2 * i_frame) * 255 // height % 256
+    image[..., 2] = (x + y) * 255 // (width + height)
+    image[..., :3] = np.clip(image[..., :3] + rng.integers(-8, 9, (height, width, 3)), 0, 255)
+    image[..., 3] = 255
+    return image
+
+
+def write_pv_recording(folder, n_frames, width, height, skipped_frames=(), seed=0):
+    """PV.tar (indexed) and pose log of a synthetic PV stream, without the
+    frames of skipped_frames. Returns the recorded timestamps and BGR frames."""
+    folder = Path(folder)
+    folder.mkdir(parents=True, exist_ok=True)
+    rng = np.random.default_rng(seed)
+    timestamps = []
+    frames = []
+    with tarfile.open(folder / 'PV.tar', 'w') as tar, open(folder / '2021-01-01-000000_pv.txt', 'w') as pv_file:
+        pv_file.write(f'{width / 2 - 0.5},{height / 2 - 0.25},{width},{height}\n')
+        for i_frame in range(n_frames):
+            if i_frame in skipped_frames:
+                continue
+            timestamp = FIRST_TIMESTAMP + i_frame * FRAME_INTERVAL
+            image = make_pv_frame(rng, i_frame, width, height)
+            data = image.tobytes()
+            info = tarfile.TarInfo(f'{timestamp}.bytes')
+            info.size = len(data)
+            tar.addfile(info, io.BytesIO(data))
+            pose = np.eye(4).reshape(-1)
+            pv_file.write(f'{timestamp},{0.77 * width},{0.77 * width},' + ','.join(map(str, pose)) + '\n')
+            timestamps.append(timestamp)
+            frames.append(image[..., :3])
+    rebuild_tar_index(folder / 'PV.tar')
+    return np.array(timestamps, dtype=np.int64), frames
+
+
+def convert_pv(folder, pv_format, encoding, chunk_frames=DEFAULT_CHUNK_FRAMES):
+    with contextlib.redirect_stdout(io.StringIO()):
+        convert_images(Path(folder), stream=True, pv_format=pv_format, encoding=encoding,
+                       chunk_frames=chunk_frames)
+
+
+def get_folder_size(folder):
+    return sum(path.stat().st_size for path in Path(folder).iterdir() if path.is_file())
+
+
+def run_benchmark(n_frames, width, height, chunk_frames, n_random):
+    rng = np.random.default_rng(37)
+    with tempfile.TemporaryDirectory() as tmp:
+        source = Path(tmp) / 'source'
+        timestamps, _ = write_pv_recording(source, n_frames, width, height)
+        raw_size = n_frames * width * height * 4
+        print(f"{n_frames} PV frames of {width}x{height}, chunks of {chunk_frames} frames, "
+              f"{n_random} random reads")
+        print(f"{'format':<10} {'convert (s)':>12} {'MB':>8} {'of raw':>7} {'open (ms)':>10} "
+              f"{'in order (fps)':>15} {'random (ms)':>12}")
+        for pv_format, encoding in FORMATS:
+            folder = Path(tmp) / f'{pv_format}_{encoding}'
+            folder.mkdir()
+            for path in source.iterdir():
+                shutil.copy(path, folder / path.name)
+
+            start = time.perf_counter()
+            convert_pv(folder, pv_format, encoding, chunk_frames)
+            convert_seconds = time.perf_counter() - start
+            size = get_folder_size(folder / 'PV')
+
+            start = time.perf_counter()
+            with PvFrames(folder) as frames:
+                open_seconds = time.perf_counter() - start
+                start = time.perf_counter()
+                for timestamp in timestamps:
+                    assert frames.read(timestamp) is not None
+                in_order_seconds = time.perf_counter() - start
+
+            random_timestamps = rng.choice(timestamps, n_random)
+            start = time.perf_counter()
+            for timestamp in random_timestamps:
+                with PvFrames(folder) as frames:
+                    assert frames.read(timestamp) is not None
+            random_seconds = time.perf_counter() - start
+
+            name = pv_format if pv_format != 'array' else f'pva {encoding}'
+            print(f"{name:<10} {convert_seconds:>12.2f} {size / 1e6:>8.1f} {100. * size / raw_size:>6.1f}% "
+                  f"{1000 * open_seconds:>10.1f} {n_frames / in_order_seconds:>15.1f} "
+                  f"{1000 * random_seconds / n_random:>12.1f}")
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='PV frame store benchmark')
+    parser.add_argument("--frames",
+                        type=int,
+                        default=300,
+                        help="Number of synthetic PV frames")
+    parser.add_argument("--resolution",
+                        default='760x428',
+                        help="PV frame size, as <width>x<height>")
+    parser.add_argument("--chunk_frames",
+                        type=int,
+                        default=100,
+                        help="Number of frames per array or video chunk")
+    parser.add_argument("--random_reads",
+                        type=int,
+                        default=50,
+                        help="Number of frames read at random timestamps")
+
+    args = parser.parse_args()
+    width, height = (int(v) for v in args.resolution.split('x'))
+    run_benchmark(args.frames, width, height, args.chunk_frames, args.random_reads)
@@ -14,6 +14,8 @@ import urllib.request
 from pathlib import Path
 from urllib.parse import quote
 from process_all import process_all
+from portal_download import (download_files, is_downloaded,
+                             DEFAULT_MAX_FILES, DEFAULT_CONNECTIONS_PER_FILE)
 
 
 class RecorderShell(cmd.Cmd):
@@ -102,6 +104,11 @@ def parse_args():
     parser.add_argument("--workspace_path", required=True,
                         help="Path to workspace folder used for downloading "
                              "recordings")
+    parser.add_argument("--max_downloads", type=int, default=DEFAULT_MAX_FILES,
+                        help="Number of files downloaded concurrently")
+    parser.add_argument("--connections_per_download", type=int,
+                        default=DEFAULT_CONNECTIONS_PER_FILE,
+                        help="Number of parallel range requests per file")
 
     args = parser.parse_args()
 
@@ -109,6 +116,8 @@ def parse_args():
 
 
 class DevicePortalBrowser(object):
+    max_downloads = DEFAULT_MAX_FILES
+    connections_per_download = DEFAULT_CONNECTIONS_PER_FILE
 
     def connect(self, address, username, password):
         print("Connecting to HoloLens Device Portal...")
@@ -188,21 +197,28 @@ class DevicePortalBrowser(object):
                 self.url, self.package_full_name, recording_name))
         files = json.loads(response.read().decode())
 
+        downloads = []
         for file in files["Items"]:
             if file["Type"] != 32:
                 continue
 
             destination_path = recording_path / file["Id"]
-            if destination_path.exists():
+            size = file.get("FileSize")
+            if is_downloaded(destination_path, size):
                 print("=> Skipping, already downloaded:", file["Id"])
                 continue
 
             print("=> Downloading:", file["Id"])
-            urllib.request.urlretrieve(
+            downloads.append((
                 "{}/api/filesystem/apps/file?knownfolderid=LocalAppData&"
                 "packagefullname={}&filename=\\LocalState\\{}\\{}".format(
                     self.url, self.package_full_name,
-                    recording_name, quote(file["Id"])), str(destination_path))
+                    recording_name, quote(file["Id"])), destination_path, size))
+
+        failed = download_files(downloads, self.max_downloads, self.connections_per_download)
+        if failed:
+            print("=> {} files were not downloaded, download the recording again to resume".format(
+                len(failed)))
 
     def delete_recording(self, recording_idx):
         recording_name = self.get_recording_name(recording_idx)
@@ -260,6 +276,8 @@ def main():
     w_path.mkdir(exist_ok=True)
 
     dev_portal_browser = DevicePortalBrowser()
+    dev_portal_browser.max_downloads = args.max_downloads
+    dev_portal_browser.connections_per_download = args.connections_per_download
     dev_portal_browser.connect(args.dev_portal_address,
                                args.dev_portal_username,
                                args.dev_portal_password)
@@ -8,18 +8,71 @@
 """
 import argparse
 import multiprocessing
+import time
 from pathlib import Path
 
 import numpy as np
 import cv2
-import open3d as o3d
 
-from project_hand_eye_to_pv import load_pv_data, match_timestamp
-from utils import extract_tar_file, load_lut, DEPTH_SCALING_FACTOR, project_on_depth, project_on_pv
-
-
-def save_output_txt_files(folder, shared_dict):
-    """Save output txt files saved inside shared_dict
+from project_hand_eye_to_pv import load_pv_data
+from timestamp_matching import TimestampIndex
+from utils import (extract_tar_file, load_lut, load_extrinsics, load_rig2world_transforms,
+                   DEPTH_SCALING_FACTOR, backproject_depth, project_on_depth, project_on_pv,
+                   transform_points)
+from stream_tar import BoundedPool, decode_pgm, iter_chunks, iter_tar_members
+from shared_arrays import SharedArrays, attach_shared_arrays
+from organized_cloud import ORGANIZED_CLOUD_EXTENSION, get_lut_crc32, save_organized_cloud
+from pv_frames import PvFrames
+
+
+# Number of frames sent to a worker at once
+DEFAULT_CHUNK_SIZE = 8
+
+# Grid neighbours whose range differs by more than this fraction of the
+# pixel's range are considered to be on another surface (depth discontinuity)
+DEPTH_DISCONTINUITY_RATIO = 0.05
+
+
+class PcloudProgress(object):
+    """Progress and throughput of the point cloud export"""
+
+    # Seconds between two progress lines
+    REPORT_INTERVAL = 2.
+
+    def __init__(self):
+        self.start_time = time.perf_counter()
+        self.last_report_time = self.start_time
+        self.n_frames = 0
+        self.n_points = 0
+
+    def add_frame(self, n_points):
+        self.n_frames += 1
+        self.n_points += n_points
+        now = time.perf_counter()
+        if now - self.last_report_time >= self.REPORT_INTERVAL:
+            self.last_report_time = now
+            elapsed = now - self.start_time
+            print(f"Saved {self.n_frames} point clouds ({self.n_frames / elapsed:.1f} frames/s)",
+                  flush=True)
+
+    def report(self, workers, chunk_size):
+        elapsed = max(time.perf_counter() - self.start_time, 1e-9)
+        report = {'frames': self.n_frames,
+                  'points': self.n_points,
+                  'seconds': elapsed,
+                  'frames_per_second': self.n_frames / elapsed,
+                  'points_per_second': self.n_points / elapsed,
+                  'workers': workers,
+                  'chunk_size': chunk_size}
+        print(f"Saved {report['frames']} point clouds ({report['points']} points) "
+              f"in {report['seconds']:.2f}s: {report['frames_per_second']:.1f} frames/s, "
+              f"{report['points_per_second'] / 1e6:.2f} Mpoints/s "
+              f"({workers} workers, chunks of {chunk_size} frames)")
+        return report
+
+
+def save_output_txt_files(folder, pinhole_records):
+    """Save output txt files from the records in pinhole_records
     depth.txt -> list of depth images
     rgb.txt -> list of rgb images
     trajectory.xyz -> list of camera centers
@@ -27,7 +80,7 @@ def save_output_txt_files(folder, shared_dict):
 
     Args:
         folder ([Path]): Output folder
-        shared_dict ([dictionary]): Dictionary containing depth image filename, rgb image filename, camera position, pose
+        pinhole_records ([dictionary]): Dictionary containing depth image filename, rgb image filename, camera position, pose
     """
     depth_path = Path(folder / 'depth.txt')
     rgb_path = Path(folder / 'rgb.txt')
@@ -39,12 +92,13 @@ def save_output_txt_files(folder, shared_dict):
             with open(str(traj_path), "w") as tf:
                 with open(str(odo_path), "w") as of:
                     i = 0
-                    for timestamp in shared_dict:
-                        df.write(f"{timestamp} {shared_dict[timestamp][0]}\n")
-                        rf.write(f"{timestamp} {shared_dict[timestamp][1]}\n")
-                        camera_string = ' '.join(map(str, shared_dict[timestamp][2]))
+                    # Frames are processed in parallel, restore the timestamp order
+                    for timestamp in sorted(pinhole_records.keys()):
+                        df.write(f"{timestamp} {pinhole_records[timestamp][0]}\n")
+                        rf.write(f"{timestamp} {pinhole_records[timestamp][1]}\n")
+                        camera_string = ' '.join(map(str, pinhole_records[timestamp][2]))
                         tf.write(f"{camera_string}\n")
-                        pose = shared_dict[timestamp][3]
+                        pose = pinhole_records[timestamp][3]
                         of.write(f"{i} {i} {i}\n")
                         of.write(f"{pose[0,0]} {pose[0,1]} {pose[0,2]} {pose[0,3]}\n")
                         of.write(f"{pose[1,0]} {pose[1,1]} {pose[1,2]} {pose[1,3]}\n")
@@ -53,40 +107,74 @@ def save_output_txt_files(folder, shared_dict):
                         i = i + 1
 
 
-def save_single_pcloud(shared_dict,
-                       path,
-                       folder,
-                       pinhole_folder,
-                       save_in_cam_space,
-                       lut,
-                       has_pv,
-                       focal_lengths,
-                       principal_point,
-                       rig2world_transforms,
-                       rig2cam,
-                       pv_timestamps,
-                       pv2world_transforms,
-                       discard_no_rgb,
-                       clamp_min,
-                       clamp_max,
-                       depth_path_suffix,
-                       disable_project_pinhole
-                       ):
-    suffix = '_cam' if save_in_cam_space else ''
-    output_path = str(path)[:-4] + f'{suffix}.ply'
+def pinhole_record_to_json(record):
+    depth_path, rgb_path, camera_center, pose = record
+    return [str(depth_path), str(rgb_path), camera_center.tolist(), pose.tolist()]
+
+
+def pinhole_record_from_json(record):
+    depth_path, rgb_path, camera_center, pose = record
+    return [Path(depth_path), Path(rgb_path), np.array(camera_center), np.array(pose)]
+
+
+# Per-process state of the point cloud workers, set by init_pcloud_worker
+worker_state = {}
+
+
+def init_pcloud_worker(shared_descriptors, config):
+    """Initialize a point cloud worker process
+
+    Args:
+        shared_descriptors ([dict]): Descriptors of the read-only arrays in shared memory
+        (LUT, extrinsics, rig2world and PV poses), see SharedArrays
+        config ([dict]): Export settings, see save_pclouds
+    """
+    arrays, blocks = attach_shared_arrays(shared_descriptors)
+    worker_state['blocks'] = blocks
+    set_pcloud_worker_state(arrays, config)
+
+
+def set_pcloud_worker_state(arrays, config):
+    worker_state['arrays'] = arrays
+    worker_state['config'] = config
+    worker_state['rig2world_index'] = TimestampIndex(
+        arrays['rig2world_timestamps'] if arrays['rig2world_timestamps'] is not None else [])
+    if arrays['pv_timestamps'] is not None:
+        worker_state['pv_index'] = TimestampIndex(arrays['pv_timestamps'])
+        worker_state['pv_frames'] = PvFrames(config['folder'])
+    # Reused for every frame processed by this worker
+    worker_state['points_buffer'] = np.empty(arrays['lut'].shape, dtype=np.float32)
 
 
-#    if Path(output_path).exists():
-#        print(output_path + ' is already exists, skip generating this pclouds')
-#        return
+def save_pcloud_chunk(frames):
+    """Save the point clouds of a chunk of (path, img) depth frames.
+    img is None if the frame has to be loaded from path.
+
+    Returns a list of (frame name, pinhole record or None, point count, output paths)
+    """
+    return [save_single_pcloud(path, img) for path, img in frames]
 
 
-    print(".", end="", flush=True)
+def save_single_pcloud(path, img=None):
+    config = worker_state['config']
+    arrays = worker_state['arrays']
+    lut = arrays['lut']
+    rig2cam = arrays['rig2cam']
+    save_in_cam_space = config['save_in_cam_space']
+    depth_path_suffix = config['depth_path_suffix']
+    clamp_min = config['clamp_min']
+    clamp_max = config['clamp_max']
+    organized = config['output_format'] == 'organized'
+
+    suffix = '_cam' if save_in_cam_space else ''
+    extension = ORGANIZED_CLOUD_EXTENSION if organized else '.ply'
+    output_path = str(path)[:-4] + f'{suffix}{extension}'
 
     # extract the timestamp for this frame
     timestamp = extract_timestamp(path.name.replace(depth_path_suffix, ''))
-    # load depth img
-    img = cv2.imread(str(path), -1)
+    # load depth img, unless it was already decoded from the tar stream
+    if img is None:
+        img = cv2.imread(str(path), -1)
     height, width = img.shape
     assert len(lut) == width * height
 
@@ -96,100 +184,172 @@ def save_single_pcloud(shared_dict,
         clamp_min = clamp_min * 1000.
         clamp_max = clamp_max * 1000.
         # Clamp depth values
+        img = img.copy()
         img[img < clamp_min] = 0
         img[img > clamp_max] = 0
 
     # Get xyz points in camera space
-    points = get_points_in_cam_space(img, lut)
+    points_grid, valid = get_points_grid(img, lut, worker_state['points_buffer'])
+    points = points_grid[valid]
+    normals = normals_grid = None
+    if config['grid_normals'] or organized:
+        normals_grid = get_grid_normals(points_grid, valid, width, height)
+        normals = normals_grid[valid]
+
     if save_in_cam_space:
-        save_ply(output_path, points, rgb=None)
-        # print('Saved %s' % output_path)
-    else:
-        if rig2world_transforms and (timestamp in rig2world_transforms):
-            # if we have the transform from rig to world for this frame,
-            # then put the point clouds in world space
-            rig2world = rig2world_transforms[timestamp]
-            # print('Transform found for timestamp %s' % timestamp)
-            xyz, cam2world_transform = cam2world(points, rig2cam, rig2world)
-
-            rgb = None
-            if has_pv:
-                # if we have pv, get vertex colors
-                # get the pv frame which is closest in time
-                target_id = match_timestamp(timestamp, pv_timestamps)
-                pv_ts = pv_timestamps[target_id]
-                rgb_path = str(folder / 'PV' / f'{pv_ts}.png')
-                assert Path(rgb_path).exists()
-                pv_img = cv2.imread(rgb_path)
-
-                # Project from depth to pv going via world space
-                rgb, depth = project_on_pv(
-                    xyz, pv_img, pv2world_transforms[target_id], 
-                    focal_lengths[target_id], principal_point)
-
-                # Project depth on virtual pinhole camera and save corresponding
-                # rgb image inside <workspace>/pinhole_projection folder
-                if not disable_project_pinhole:
-                    # Create virtual pinhole camera
-                    scale = 1
-                    width = 320 * scale
-                    height = 288 * scale
-                    focal_length = 200 * scale
-                    intrinsic_matrix = np.array([[focal_length, 0, width / 2.],
-                                                 [0, focal_length, height / 2.],
-                                                 [0, 0, 1.]])
-                    rgb_proj, depth = project_on_depth(
-                        points, rgb, intrinsic_matrix, width, height)
-
-                    # Save depth image
-                    depth_proj_folder = pinhole_folder / 'depth' / f'{pv_ts}.png'
-                    depth_proj_path = str(depth_proj_folder)[:-4] + f'{suffix}_proj.png'
-                    depth = (depth * DEPTH_SCALING_FACTOR).astype(np.uint16)
-                    cv2.imwrite(depth_proj_path, (depth).astype(np.uint16))
-
-                    # Save rgb image
-                    rgb_proj_folder = pinhole_folder / 'rgb' / f'{pv_ts}.png'
-                    rgb_proj_path = str(rgb_proj_folder)[:-4] + f'{suffix}_proj.png'
-                    cv2.imwrite(rgb_proj_path, rgb_proj)
-
-                    # Save virtual pinhole information inside calibration.txt
-                    intrinsic_path = pinhole_folder / Path('calibration.txt')
-                    intrinsic_list = [intrinsic_matrix[0, 0], intrinsic_matrix[1, 1],
-                                      intrinsic_matrix[0, 2], intrinsic_matrix[1, 2]]
-                    with open(str(intrinsic_path), "w") as p:
-                        p.write(f"{intrinsic_list[0]} \
-                                {intrinsic_list[1]} \
-                                {intrinsic_list[2]} \
-                                {intrinsic_list[3]} \n")
-
-                    # Create rgb and depth paths
-                    rgb_parts = Path(rgb_proj_path).parts[2:]
-                    rgb_tmp = Path(rgb_parts[-2]) / Path(rgb_parts[-1])
-                    depth_parts = Path(depth_proj_path).parts[2:]
-                    depth_tmp = Path(depth_parts[-2]) / Path(depth_parts[-1])
-
-                    # Compute camera center
-                    camera_center = cam2world_transform @ np.array([0, 0, 0, 1])
-
-                    # Save depth, rgb, camera center, extrinsics inside shared dictionary
-                    shared_dict[path.stem] = [depth_tmp, rgb_tmp,
-                                              camera_center[:3], cam2world_transform]
-
-            if discard_no_rgb:
-                colored_points = rgb[:, 0] > 0
-                xyz = xyz[colored_points]
-                rgb = rgb[colored_points]
-            save_ply(output_path, xyz, rgb, cam2world_transform)
-            # print('Saved %s' % output_path)
+        if organized:
+            save_organized_cloud(output_path, img, valid, config['lut_name'], config['lut_crc32'],
+                                 normals_grid)
         else:
-            print('Transform not found for timestamp %s' % timestamp)
-
+            save_ply(output_path, points, rgb=None, normals=normals)
+        return (path.stem, None, len(points), [output_path])
+
+    rig2world = find_rig2world(timestamp)
+    if rig2world is None:
+        print('Transform not found for timestamp %s' % timestamp)
+        return (path.stem, None, 0, [])
+
+    # if we have the transform from rig to world for this frame,
+    # then put the point clouds in world space
+    xyz, cam2world_transform = cam2world(points, rig2cam, rig2world)
+    if normals is not None:
+        normals = normals @ cam2world_transform[:3, :3].T
+
+    rgb = None
+    pinhole_record = None
+    outputs = [output_path]
+    if config['has_pv']:
+        pv_timestamps = arrays['pv_timestamps']
+        # if we have pv, get vertex colors
+        # get the pv frame which is closest in time
+        target_id = worker_state['pv_index'].nearest(timestamp)
+        pv_ts = pv_timestamps[target_id]
+        pv_img = worker_state['pv_frames'].read(pv_ts)
+        assert pv_img is not None, f'PV frame {pv_ts} was not converted'
+
+        def color_from_pv(world_points):
+            # Project from depth to pv going via world space,
+            # the frame's points occlude each other
+            return project_on_pv(
+                world_points, pv_img, arrays['pv2world_transforms'][target_id],
+                arrays['focal_lengths'][target_id], config['principal_point'],
+                occluders=xyz)[0]
+
+        rgb = color_from_pv(xyz)
+
+        # Project depth on virtual pinhole camera and save corresponding
+        # rgb image inside <workspace>/pinhole_projection folder
+        if not config['disable_project_pinhole']:
+            pinhole_record = save_pinhole_projection(
+                config['pinhole_folder'], points, rgb, pv_ts, suffix, cam2world_transform,
+                config['pinhole_resolution'], pv_img.shape, color_from_pv)
+            outputs += [str(config['pinhole_folder'] / image_path) for image_path in pinhole_record[:2]]
+
+    if organized:
+        # Keep the image grid, normals stay in camera space
+        colors = None
+        if rgb is not None:
+            colors = np.zeros((len(valid), 3))
+            colors[valid] = rgb
+            if config['discard_no_rgb']:
+                valid = valid & (colors[:, 0] > 0)
+        save_organized_cloud(output_path, img, valid, config['lut_name'], config['lut_crc32'],
+                             normals_grid, colors, cam2world_transform)
+        return (path.stem, pinhole_record, int(np.count_nonzero(valid)), outputs)
+
+    if config['discard_no_rgb']:
+        colored_points = rgb[:, 0] > 0
+        xyz = xyz[colored_points]
+        rgb = rgb[colored_points]
+        if normals is not None:
+            normals = normals[colored_points]
+    save_ply(output_path, xyz, rgb, cam2world_transform, normals)
+    return (path.stem, pinhole_record, len(xyz), outputs)
+
+
+def save_pinhole_projection(pinhole_folder, points, rgb, pv_ts, suffix, cam2world_transform,
+                            resolution='depth', pv_shape=None, color_from_pv=None):
+    """Project depth on a virtual pinhole camera and save the depth and rgb images.
+
+    With resolution 'depth', the virtual camera is 320x288 and each pixel
+    takes the color of the closest point (rgb). With resolution 'pv', the
+    virtual camera has the size of the PV frames (pv_shape): points are
+    splatted to cover the gaps between them and each pixel is colored by
+    color_from_pv (world space points -> rgb).
+
+    Returns the [depth path, rgb path, camera center, extrinsics] record
+    used to write the pinhole file lists.
+    """
+    # Create virtual pinhole camera
+    if resolution == 'pv':
+        height, width = pv_shape[:2]
+        scale = width / 320
+    else:
+        scale = 1
+        width = 320 * scale
+        height = 288 * scale
+    focal_length = 200 * scale
+    intrinsic_matrix = np.array([[focal_length, 0, width / 2.],
+                                 [0, focal_length, height / 2.],
+                                 [0, 0, 1.]])
+    if resolution == 'pv':
+        _, depth = project_on_depth(
+            points, rgb, intrinsic_matrix, width, height, splat_size=int(np.ceil(scale)))
+        # Color each pixel from the surface point it sees
+        covered = depth > 0
+        pixel_points = transform_points(backproject_depth(depth, intrinsic_matrix), cam2world_transform)
+        rgb_proj = np.zeros((height, width, 3))
+        rgb_proj[covered] = color_from_pv(pixel_points)[:, ::-1] * 255.
+    else:
+        rgb_proj, depth = project_on_depth(
+            points, rgb, intrinsic_matrix, width, height)
+
+    # Save depth image
+    depth_proj_folder = pinhole_folder / 'depth' / f'{pv_ts}.png'
+    depth_proj_path = str(depth_proj_folder)[:-4] + f'{suffix}_proj.png'
+    depth = (depth * DEPTH_SCALING_FACTOR).astype(np.uint16)
+    cv2.imwrite(depth_proj_path, (depth).astype(np.uint16))
+
+    # Save rgb image
+    rgb_proj_folder = pinhole_folder / 'rgb' / f'{pv_ts}.png'
+    rgb_proj_path = str(rgb_proj_folder)[:-4] + f'{suffix}_proj.png'
+    cv2.imwrite(rgb_proj_path, rgb_proj)
+
+    # Save virtual pinhole information inside calibration.txt
+    intrinsic_path = pinhole_folder / Path('calibration.txt')
+    intrinsic_list = [intrinsic_matrix[0, 0], intrinsic_matrix[1, 1],
+                      intrinsic_matrix[0, 2], intrinsic_matrix[1, 2]]
+    with open(str(intrinsic_path), "w") as p:
+        p.write(f"{intrinsic_list[0]} \
+                {intrinsic_list[1]} \
+                {intrinsic_list[2]} \
+                {intrinsic_list[3]} \n")
+
+    # Create rgb and depth paths
+    rgb_parts = Path(rgb_proj_path).parts[2:]
+    rgb_tmp = Path(rgb_parts[-2]) / Path(rgb_parts[-1])
+    depth_parts = Path(depth_proj_path).parts[2:]
+    depth_tmp = Path(depth_parts[-2]) / Path(depth_parts[-1])
+
+    # Compute camera center
+    camera_center = cam2world_transform @ np.array([0, 0, 0, 1])
+
+    return [depth_tmp, rgb_tmp, camera_center[:3], cam2world_transform]
+
+
+def save_ply(output_path, points, rgb=None, cam2world_transform=None, normals=None):
+    # Only ply output needs open3d, organized clouds and grid normals do not
+    import open3d as o3d
 
-def save_ply(output_path, points, rgb=None, cam2world_transform=None):
     pcd = o3d.geometry.PointCloud()
     pcd.points = o3d.utility.Vector3dVector(points)
     if rgb is not None:
         pcd.colors = o3d.utility.Vector3dVector(rgb)
+    if normals is not None:
+        # Normals computed from the depth grid are already oriented
+        pcd.normals = o3d.utility.Vector3dVector(normals)
+        o3d.io.write_point_cloud(output_path, pcd)
+        return
     pcd.estimate_normals()
     if cam2world_transform is not None:
         # Camera center
@@ -199,19 +359,80 @@ def save_ply(output_path, points, rgb=None, cam2world_transform=None):
     o3d.io.write_point_cloud(output_path, pcd)
 
 
-def load_extrinsics(extrinsics_path):
-    assert Path(extrinsics_path).exists()
-    mtx = np.loadtxt(str(extrinsics_path), delimiter=',').reshape((4, 4))
-    return mtx
+def get_points_in_cam_space(img, lut):
+    points, valid = get_points_grid(img, lut)
+    return points[valid]
+
 
+def get_points_grid(img, lut, out=None):
+    """Get xyz points (in meters) in camera space for every depth pixel,
+    keeping the image grid (row major, one point per pixel).
 
-def get_points_in_cam_space(img, lut):
-    img = np.tile(img.flatten().reshape((-1, 1)), (1, 3))
-    points = img * lut
-    remove_ids = np.where(np.sum(points, axis=1) < 1e-6)[0]
-    points = np.delete(points, remove_ids, axis=0)
+    Args:
+        img ([np.array]): Depth image in mm
+        lut ([np.array]): Unit vectors, one per pixel
+        out ([np.array], optional): float32 buffer of lut's shape to reuse
+
+    Returns:
+        (points, valid): points (pixel count x 3) and the mask of the valid ones
+    """
+    points = np.multiply(img.reshape((-1, 1)), lut, out=out, dtype=np.float32)
+    valid = np.sum(points, axis=1) >= 1e-6
     points /= 1000.
-    return points
+    return points, valid
+
+
+def get_grid_normals(points, valid, width, height,
+                     discontinuity_ratio=DEPTH_DISCONTINUITY_RATIO):
+    """Per-pixel normals from the cross product of the neighbour differences
+    in the depth grid, oriented towards the camera (in camera space).
+
+    A neighbour whose range differs from the pixel's by more than
+    discontinuity_ratio times the pixel's range is on another surface and
+    is not used. Central differences are used when both neighbours along
+    an axis are usable, one-sided differences otherwise. Normals of pixels
+    without a usable neighbour along both axes are set to 0.
+    """
+    grid = points.reshape((height, width, 3))
+    valid = valid.reshape((height, width))
+    ranges = np.linalg.norm(grid, axis=2)
+    max_step = discontinuity_ratio * ranges
+
+    def neighbour_difference(axis):
+        # Differences with the next and previous pixels along axis
+        forward = np.zeros_like(grid)
+        backward = np.zeros_like(grid)
+        forward_ok = np.zeros_like(valid)
+        backward_ok = np.zeros_like(valid)
+        current = (slice(None, -1), slice(None)) if axis == 0 else (slice(None), slice(None, -1))
+        following = (slice(1, None), slice(None)) if axis == 0 else (slice(None), slice(1, None))
+
+        step = grid[following] - grid[current]
+        continuous = (valid[current] & valid[following] &
+                      (np.abs(ranges[following] - ranges[current]) <= max_step[current]))
+        forward[current] = step
+        forward_ok[current] = continuous
+        backward[following] = step
+        backward_ok[following] = (valid[current] & valid[following] &
+                                  (np.abs(ranges[following] - ranges[current]) <= max_step[following]))
+
+        difference = np.where((forward_ok & backward_ok)[..., np.newaxis], forward + backward,
+                              np.where(forward_ok[..., np.newaxis], forward, backward))
+        return difference, forward_ok | backward_ok
+
+    dx, dx_ok = neighbour_difference(1)
+    dy, dy_ok = neighbour_difference(0)
+    normals = np.cross(dx, dy)
+    norm = np.linalg.norm(normals, axis=2, keepdims=True)
+    normals_valid = valid & dx_ok & dy_ok & (norm[..., 0] > 0)
+    normals = np.divide(normals, norm, out=np.zeros_like(normals), where=norm > 0)
+    normals[~normals_valid] = 0
+
+    # The camera is at the origin: flip normals facing away from it
+    facing_away = np.sum(normals * grid, axis=2) > 0
+    normals[facing_away] *= -1
+
+    return normals.reshape((-1, 3))
 
 
 def cam2world(points, rig2cam, rig2world):
@@ -225,14 +446,10 @@ def extract_timestamp(path):
     return float(path.split('.')[0])
 
 
-def load_rig2world_transforms(path):
-    transforms = {}
-    data = np.loadtxt(str(path), delimiter=',')
-    for value in data:
-        timestamp = value[0]
-        transform = value[1:].reshape((4, 4))
-        transforms[timestamp] = transform
-    return transforms
+def find_rig2world(timestamp):
+    """Return the rig2world transform recorded for timestamp, None if there is none"""
+    i = worker_state['rig2world_index'].within(timestamp, 0)
+    return worker_state['arrays']['rig2world_transforms'][i] if i >= 0 else None
 
 
 def save_pclouds(folder,
@@ -242,8 +459,39 @@ def save_pclouds(folder,
                  clamp_min=0.,
                  clamp_max=0.,
                  depth_path_suffix='',
-                 disable_project_pinhole=False
+                 disable_project_pinhole=False,
+                 stream=False,
+                 grid_normals=False,
+                 pinhole_resolution='depth',
+                 output_format='ply',
+                 workers=None,
+                 chunk_size=DEFAULT_CHUNK_SIZE,
+                 done_frames=None,
+                 on_frame_done=None
                  ):
+    """Save one point cloud per depth frame.
+
+    Frames are distributed in chunks of chunk_size frames to a pool of
+    workers processes (cpu count by default). The LUT and the poses are
+    shared with the workers through shared memory. With workers 0, the
+    frames are processed in order in this process.
+
+    If stream is set, depth frames are decoded directly from <sensor_name>.tar
+    instead of being loaded from the extracted depth folder.
+    If grid_normals is set, normals are computed from the neighbours in the
+    depth image instead of open3d's estimate_normals.
+    pinhole_resolution ('depth' or 'pv') sets the resolution of the
+    pinhole projection images, see save_pinhole_projection.
+    output_format 'organized' saves organized point clouds (see
+    organized_cloud.py) with grid normals instead of ply files.
+
+    done_frames (frame name -> pinhole record or None) are skipped, their
+    pinhole records are only used to write the pinhole file lists.
+    on_frame_done(name, output paths, pinhole record) is called for every
+    frame saved.
+
+    Returns a dictionary with throughput statistics.
+    """
     print("")
     print("Saving point clouds")
 
@@ -278,8 +526,8 @@ def save_pclouds(folder,
     rig2cam = load_extrinsics(rig2campath)
 
     # from rig to world transformations (one per frame)
-    rig2world_transforms = load_rig2world_transforms(
-        rig2world_path) if rig2world_path != '' and Path(rig2world_path).exists() else None
+    rig2world_timestamps, rig2world_transforms = load_rig2world_transforms(
+        rig2world_path) if rig2world_path != '' and Path(rig2world_path).exists() else (None, None)
     depth_path = Path(folder / sensor_name)
     depth_path.mkdir(exist_ok=True)
 
@@ -299,42 +547,78 @@ def save_pclouds(folder,
     if __name__ == '__main__':
         extract_tar_file(str(folder / '{}.tar'.format(sensor_name)), str(depth_path))
 
-    # Depth path suffix used for now only if we load masked AHAT
-    depth_paths = sorted(depth_path.glob('*[0-9]{}.pgm'.format(depth_path_suffix)))
-    assert len(list(depth_paths)) > 0 
-
-    # Create shared dictionary to save odometry and file list
-    manager = multiprocessing.Manager()
-    shared_dict = manager.dict()
-
-    multiprocess_pool = multiprocessing.Pool(multiprocessing.cpu_count())
-    for path in depth_paths:
-        multiprocess_pool.apply_async(
-            save_single_pcloud(shared_dict,
-                               path,
-                               folder,
-                               pinhole_folder,
-                               save_in_cam_space,
-                               lut,
-                               has_pv,
-                               focal_lengths,
-                               principal_point,
-                               rig2world_transforms,
-                               rig2cam,
-                               pv_timestamps,
-                               pv2world_transforms,
-                               discard_no_rgb,
-                               clamp_min,
-                               clamp_max,
-                               depth_path_suffix,
-                               disable_project_pinhole
-                               )
-        )
-    multiprocess_pool.close()
-    multiprocess_pool.join()
+    if stream:
+        # Only plain depth frames are recorded, the suffix applies to postprocessed files
+        assert depth_path_suffix == ''
+        depth_frames = ((depth_path / name, decode_pgm(data)) for name, data in
+                        iter_tar_members(folder / '{}.tar'.format(sensor_name), r'^[0-9]+\.pgm$')
+                        if done_frames is None or name[:-4] not in done_frames)
+    else:
+        # Depth path suffix used for now only if we load masked AHAT
+        depth_paths = sorted(depth_path.glob('*[0-9]{}.pgm'.format(depth_path_suffix)))
+        assert len(list(depth_paths)) > 0
+        depth_frames = ((path, None) for path in depth_paths
+                        if done_frames is None or path.stem not in done_frames)
+
+    config = {'folder': folder,
+              'pinhole_folder': pinhole_folder,
+              'save_in_cam_space': save_in_cam_space,
+              'has_pv': has_pv,
+              'principal_point': principal_point,
+              'discard_no_rgb': discard_no_rgb,
+              'clamp_min': clamp_min,
+              'clamp_max': clamp_max,
+              'depth_path_suffix': depth_path_suffix,
+              'disable_project_pinhole': disable_project_pinhole,
+              'grid_normals': grid_normals,
+              'pinhole_resolution': pinhole_resolution,
+              'output_format': output_format,
+              'lut_name': calib,
+              'lut_crc32': get_lut_crc32(lut)}
+
+    shared = SharedArrays({'lut': lut,
+                           'rig2cam': rig2cam,
+                           'rig2world_timestamps': rig2world_timestamps,
+                           'rig2world_transforms': rig2world_transforms,
+                           'pv_timestamps': pv_timestamps,
+                           'focal_lengths': focal_lengths,
+                           'pv2world_transforms': pv2world_transforms})
+
+    workers = multiprocessing.cpu_count() if workers is None else workers
+    progress = PcloudProgress()
+    pinhole_records = {name: record for name, record in (done_frames or {}).items()
+                       if record is not None}
+
+    def on_chunk_done(results):
+        for name, pinhole_record, n_points, outputs in results:
+            if pinhole_record is not None:
+                pinhole_records[name] = pinhole_record
+            progress.add_frame(n_points)
+            if on_frame_done is not None:
+                on_frame_done(name, outputs, pinhole_record)
+
+    with shared:
+        if workers == 0:
+            set_pcloud_worker_state(shared.arrays, config)
+            try:
+                for chunk in iter_chunks(depth_frames, chunk_size):
+                    on_chunk_done(save_pcloud_chunk(chunk))
+            finally:
+                # The shared memory can not be released while its arrays are referenced
+                worker_state.clear()
+        else:
+            # Keep at most two chunks per worker in flight
+            with BoundedPool(workers, 2 * workers,
+                             init_pcloud_worker, (shared.descriptors, config)) as pool:
+                for chunk in iter_chunks(depth_frames, chunk_size):
+                    pool.submit(save_pcloud_chunk, (chunk,), callback=on_chunk_done)
+
+    report = progress.report(workers, chunk_size)
 
     if not disable_project_pinhole and has_pv:
-        save_output_txt_files(pinhole_folder, shared_dict)
+        save_output_txt_files(pinhole_folder, pinhole_records)
+
+    return report
 
 
 if __name__ == '__main__':
@@ -373,6 +657,32 @@ if __name__ == '__main__':
                         choices=["", "_masked"],
                         help="Specify the suffix for depth img filenames, in order"
                              "to work on postprocessed ones (e.g. masked AHAT)")
+    parser.add_argument("--grid_normals",
+                        required=False,
+                        action='store_true',
+                        help="Compute normals from neighbouring depth pixels, "
+                        "faster than open3d normal estimation")
+    parser.add_argument("--pinhole_resolution",
+                        default="depth",
+                        choices=["depth", "pv"],
+                        help="Resolution of the pinhole projection images: "
+                        "depth (320x288) or pv (size of the PV frames)")
+    parser.add_argument("--output_format",
+                        default="ply",
+                        choices=["ply", "organized"],
+                        help="ply point clouds, or organized point clouds keeping "
+                        "the depth image grid (compact, references the LUT)")
+    parser.add_argument("--workers",
+                        required=False,
+                        type=int,
+                        default=None,
+                        help="Number of worker processes, cpu count by default, "
+                        "0 to process the frames in this process")
+    parser.add_argument("--chunk_size",
+                        required=False,
+                        type=int,
+                        default=DEFAULT_CHUNK_SIZE,
+                        help="Number of frames sent to a worker at once")
 
     args = parser.parse_args()
     for sensor_name in ["Depth Long Throw", "Depth AHaT"]:
@@ -384,4 +694,9 @@ if __name__ == '__main__':
                          args.clamp_min,
                          args.clamp_max,
                          args.depth_path_suffix,
-                         args.disable_project_pinhole)
+                         args.disable_project_pinhole,
+                         grid_normals=args.grid_normals,
+                         pinhole_resolution=args.pinhole_resolution,
+                         output_format=args.output_format,
+                         workers=args.workers,
+                         chunk_size=args.chunk_size)
@@ -0,0 +1,88 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import argparse
+import contextlib
+import io
+import multiprocessing
+import tempfile
+from pathlib import Path
+
+from organized_cloud import ORGANIZED_CLOUD_EXTENSION
+from save_pclouds import DEFAULT_CHUNK_SIZE, save_pclouds
+from tsdf_fusion_benchmark import SENSOR_NAME, write_synthetic_recording
+
+# Throughput of save_pclouds.py for several worker counts, against its
+# serial path (workers 0: the frames are processed in order in the calling
+# process, without the pool and the shared memory). On a recording
+# (--recording_path) or by default on a synthetic long throw recording
+# (tsdf_fusion_benchmark.py) without PV, streamed from the tarball and
+# saved as organized clouds, which do not need open3d. The outputs of each
+# worker count are compared with those of the serial path.
+
+
+def read_outputs(folder, sensor_name=SENSOR_NAME):
+    """Output file name -> content, of the clouds saved in folder"""
+    return {path.name: path.read_bytes()
+            for path in sorted((Path(folder) / sensor_name).glob(f'*{ORGANIZED_CLOUD_EXTENSION}'))}
+
+
+def clear_outputs(folder, sensor_name=SENSOR_NAME):
+    for path in (Path(folder) / sensor_name).glob(f'*{ORGANIZED_CLOUD_EXTENSION}'):
+        path.unlink()
+
+
+def run_save_pclouds(folder, workers, chunk_size, sensor_name=SENSOR_NAME):
+    """Report of save_pclouds, without its progress output"""
+    with contextlib.redirect_stdout(io.StringIO()):
+        return save_pclouds(Path(folder), sensor_name, stream=True, output_format='organized',
+                            disable_project_pinhole=True, workers=workers, chunk_size=chunk_size)
+
+
+def run_benchmark(folder, workers, chunk_size, sensor_name=SENSOR_NAME):
+    print(f"{multiprocessing.cpu_count()} cpus, chunks of {chunk_size} frames")
+    print(f"{'workers':>8} {'frames':>7} {'seconds':>8} {'frames/s':>9} {'Mpoints/s':>10} {'speedup':>8} {'outputs':>8}")
+    serial_seconds = reference = None
+    for n_workers in [0] + [n for n in workers if n > 0]:
+        clear_outputs(folder, sensor_name)
+        report = run_save_pclouds(folder, n_workers, chunk_size, sensor_name)
+        outputs = read_outputs(folder, sensor_name)
+        if n_workers == 0:
+            serial_seconds, reference = report['seconds'], outputs
+        print(f"{n_workers if n_workers else 'serial':>8} {report['frames']:>7} {report['seconds']:>8.2f} "
+              f"{report['frames_per_second']:>9.1f} {report['points_per_second'] / 1e6:>10.2f} "
+              f"{serial_seconds / report['seconds']:>8.2f} {'same' if outputs == reference else 'DIFFER':>8}")
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Point cloud export benchmark')
+    parser.add_argument("--recording_path",
+                        default=None,
+                        help="Recording folder (with the depth tarball), "
+                        "a synthetic recording by default")
+    parser.add_argument("--frames",
+                        type=int,
+                        default=60,
+                        help="Number of frames of the synthetic recording")
+    parser.add_argument("--workers",
+                        type=int,
+                        nargs='+',
+                        default=[1, 2, 4],
+                        help="Worker counts to measure, after the serial path")
+    parser.add_argument("--chunk_size",
+                        type=int,
+                        default=DEFAULT_CHUNK_SIZE,
+                        help="Number of frames sent to a worker at once")
+
+    args = parser.parse_args()
+    if args.recording_path is not None:
+        run_benchmark(args.recording_path, args.workers, args.chunk_size)
+    else:
+        with tempfile.TemporaryDirectory() as folder:
+            write_synthetic_recording(folder, args.frames)
+            run_benchmark(folder, args.workers, args.chunk_size)
@@ -0,0 +1,74 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+from multiprocessing import shared_memory
+
+import numpy as np
+
+
+class SharedArrays(object):
+    """Read-only numpy arrays shared with worker processes.
+
+    The owner copies the arrays once into shared memory and passes
+    the (picklable) descriptors to the workers, which attach to them
+    without copying. This avoids pickling large arrays (e.g. the depth
+    LUT) with every task.
+    """
+
+    def __init__(self, arrays):
+        self._blocks = []
+        self.arrays = {}
+        self.descriptors = {}
+        for name, array in arrays.items():
+            if array is None:
+                self.descriptors[name] = None
+                self.arrays[name] = None
+                continue
+            array = np.ascontiguousarray(array)
+            block = shared_memory.SharedMemory(create=True, size=max(array.nbytes, 1))
+            shared = np.ndarray(array.shape, dtype=array.dtype, buffer=block.buf)
+            shared[...] = array
+            self._blocks.append(block)
+            self.arrays[name] = shared
+            self.descriptors[name] = (block.name, array.shape, array.dtype.str)
+
+    def release(self):
+        self.arrays = {}
+        for block in self._blocks:
+            block.close()
+            block.unlink()
+        self._blocks = []
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.release()
+
+
+def attach_shared_arrays(descriptors):
+    """Attach to arrays created by SharedArrays in another process.
+
+    Returns (arrays, blocks): the blocks must be kept alive as long as
+    the arrays are used.
+    """
+    arrays = {}
+    blocks = []
+    for name, descriptor in descriptors.items():
+        if descriptor is None:
+            arrays[name] = None
+            continue
+        block_name, shape, dtype = descriptor
+        # Worker processes share the owner's resource tracker, which
+        # releases the block once the owner unlinks it
+        block = shared_memory.SharedMemory(name=block_name)
+        array = np.ndarray(shape, dtype=np.dtype(dtype), buffer=block.buf)
+        array.flags.writeable = False
+        arrays[name] = array
+        blocks.append(block)
+    return arrays, blocks
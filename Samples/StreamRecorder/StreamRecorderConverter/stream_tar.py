@@ -0,0 +1,129 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import re
+import tarfile
+import threading
+import multiprocessing
+from pathlib import Path
+
+import numpy as np
+
+# Default number of frames that can be waiting for a worker at any time.
+# Bounds the memory used by frames read from the tar ahead of the workers.
+DEFAULT_MAX_PENDING_FRAMES = 64
+
+
+def iter_tar_members(tar_path, name_pattern=None):
+    """Iterate over the (name, data) of the files in a tarball in a single
+    sequential pass, without extracting them to disk.
+
+    Args:
+        tar_path ([Path]): Tarball to read
+        name_pattern ([str], optional): Only yield files whose name matches this regex
+    """
+    name_regex = re.compile(name_pattern) if name_pattern is not None else None
+    # 'r|' opens the tarball as a stream, members are read in order
+    with tarfile.open(str(tar_path), 'r|') as tar:
+        for member in tar:
+            if not member.isfile():
+                continue
+            name = Path(member.name).name
+            if name_regex is not None and not name_regex.match(name):
+                continue
+            yield name, tar.extractfile(member).read()
+
+
+def iter_chunks(iterable, chunk_size):
+    """Group the items of iterable in lists of chunk_size items (fewer for the last one)"""
+    chunk = []
+    for item in iterable:
+        chunk.append(item)
+        if len(chunk) == chunk_size:
+            yield chunk
+            chunk = []
+    if chunk:
+        yield chunk
+
+
+def decode_pgm(data):
+    """Decode a binary (P5) PGM, as written by the recorder, from memory"""
+    # Header is "P5\n<width> <height>\n<max value>\n"
+    fields = data[:64].split(maxsplit=4)
+    assert fields[0] == b'P5'
+    width, height, max_value = int(fields[1]), int(fields[2]), int(fields[3])
+    header_size = len(data) - width * height * (2 if max_value > 255 else 1)
+    if max_value > 255:
+        # 16 bit PGM values are big endian
+        img = np.frombuffer(data, dtype='>u2', offset=header_size).astype(np.uint16)
+    else:
+        img = np.frombuffer(data, dtype=np.uint8, offset=header_size)
+    return img.reshape((height, width))
+
+
+def decode_bgra(data, width, height):
+    """Decode a raw PV frame (BGRA, 8 bits per channel) into a BGR image"""
+    image = np.frombuffer(data, dtype=np.uint8).reshape((height, width, 4))
+    return image[:, :, :3]
+
+
+class BoundedPool(object):
+    """Process pool that blocks submission once max_pending tasks are queued,
+    so a fast producer (e.g. a tar stream) can not run ahead of the workers.
+    """
+
+    def __init__(self, processes=None, max_pending=DEFAULT_MAX_PENDING_FRAMES,
+                 initializer=None, initargs=()):
+        self.pool = multiprocessing.Pool(processes or multiprocessing.cpu_count(),
+                                         initializer, initargs)
+        self.semaphore = threading.BoundedSemaphore(max_pending)
+        self.errors = []
+
+    def submit(self, func, args=(), callback=None):
+        """Run func(*args) on a worker. callback, if given, is called
+        with the result in this process (on the pool's result thread).
+        Raises the first error of the previous tasks or callbacks, so that
+        the producer stops as soon as one failed."""
+        self.semaphore.acquire()
+        if self.errors:
+            self.semaphore.release()
+            raise self.errors[0]
+
+        def on_done(result):
+            try:
+                if callback is not None:
+                    callback(result)
+            except Exception as error:
+                # Raising on the pool's result thread would hang join()
+                self.errors.append(error)
+            finally:
+                self.semaphore.release()
+
+        self.pool.apply_async(func, args,
+                              callback=on_done,
+                              error_callback=self._on_error)
+
+    def _on_error(self, error):
+        self.errors.append(error)
+        self.semaphore.release()
+
+    def close(self):
+        self.pool.close()
+        self.pool.join()
+        if self.errors:
+            raise self.errors[0]
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        if exc_type is None:
+            self.close()
+        else:
+            self.pool.terminate()
+            self.pool.join()
@@ -0,0 +1,230 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import argparse
+import tarfile
+from pathlib import Path
+
+import numpy as np
+
+# Sidecar index written next to each tarball by the recorder app
+# (see StreamRecorderApp/TarIndex.h for the layout)
+TAR_INDEX_EXTENSION = '.idx'
+TAR_INDEX_MAGIC = b'RMTARIDX'
+TAR_INDEX_VERSION = 1
+TAR_BLOCK_SIZE = 512
+
+tar_index_header_dtype = np.dtype([('magic', 'S8'),
+                                   ('version', '<u4'),
+                                   ('entry_size', '<u4'),
+                                   ('entry_count', '<u8')])
+
+tar_index_entry_dtype = np.dtype([('name_hash', '<u8'),
+                                  ('timestamp', '<i8'),
+                                  ('data_offset', '<u8'),
+                                  ('data_size', '<u8')])
+
+
+def hash_member_name(name):
+    """64-bit FNV-1a hash of a tar member name, as computed by the recorder"""
+    h = 14695981039346656037
+    for c in name.encode('utf-8'):
+        h ^= c
+        h = (h * 1099511628211) & 0xFFFFFFFFFFFFFFFF
+    return h
+
+
+def hash_timestamp_names(timestamps, suffix):
+    """Vectorized hash_member_name of the names f'{timestamp}{suffix}'"""
+    timestamps = np.asarray(timestamps, dtype=np.int64)
+    hashes = np.full(len(timestamps), 14695981039346656037, dtype=np.uint64)
+    if len(timestamps) == 0:
+        return hashes
+    # Digits as a (N, max digits) matrix of characters, shorter names padded with 0
+    digits = np.char.encode(np.char.mod('%d', timestamps), 'ascii')
+    chars = digits.view(np.uint8).reshape((len(timestamps), digits.dtype.itemsize))
+    prime = np.uint64(1099511628211)
+    for column in chars.T:
+        c = column.astype(np.uint64)
+        hashes = np.where(column != 0, (hashes ^ c) * prime, hashes)
+    for c in suffix.encode('utf-8'):
+        hashes = (hashes ^ np.uint64(c)) * prime
+    return hashes
+
+
+def parse_timestamp(name):
+    """Leading digits of the file name, -1 if there are none"""
+    name = name.rsplit('/', 1)[-1]
+    digits = len(name) - len(name.lstrip('0123456789'))
+    return int(name[:digits]) if digits else -1
+
+
+def get_index_path(tar_path):
+    tar_path = Path(tar_path)
+    return tar_path.with_name(tar_path.name + TAR_INDEX_EXTENSION)
+
+
+def get_header_member(block):
+    """(name, data size) of a ustar member header block, None if it is not
+    the header of a regular file"""
+    if len(block) != TAR_BLOCK_SIZE or block[156:157] not in (b'0', b'\0'):
+        return None
+    try:
+        name = block[0:100].split(b'\0', 1)[0].decode('utf-8')
+        prefix = block[345:500].split(b'\0', 1)[0].decode('utf-8')
+        size = int(block[124:136].split(b'\0', 1)[0].strip() or b'0', 8)
+    except ValueError:
+        return None
+    return (prefix + '/' + name if prefix else name), size
+
+
+def check_tar_index(tar_path, entries):
+    """Whether the index entries match the tarball: every member lies in the
+    tarball, the last indexed member has the indexed name and size, and no
+    member follows it (the index of a recording stopped between two flushes
+    of the index misses its last members)."""
+    tar_size = Path(tar_path).stat().st_size
+    if np.any((entries['data_offset'] < TAR_BLOCK_SIZE) |
+              (entries['data_offset'] + entries['data_size'] > tar_size)):
+        return False
+
+    with open(tar_path, 'rb') as f:
+        end = 0
+        if len(entries):
+            last = entries[np.argmax(entries['data_offset'])]
+            f.seek(int(last['data_offset']) - TAR_BLOCK_SIZE)
+            member = get_header_member(f.read(TAR_BLOCK_SIZE))
+            if (member is None or hash_member_name(member[0]) != last['name_hash'] or
+                    member[1] != last['data_size']):
+                return False
+            end = int(last['data_offset']) + -(-int(last['data_size']) // TAR_BLOCK_SIZE) * TAR_BLOCK_SIZE
+        f.seek(end)
+        # Past the last member, the archive ends (zero blocks, or a truncated recording)
+        return not f.read(TAR_BLOCK_SIZE).strip(b'\0')
+
+
+def load_tar_index(tar_path, sort=True):
+    """Load the sidecar index of tar_path.
+
+    Returns a structured array (see tar_index_entry_dtype) sorted by timestamp
+    (in the order the members were written if not sort), or None if the index
+    does not exist or is not valid: unreadable, or stale (see check_tar_index).
+    """
+    index_path = get_index_path(tar_path)
+    if not index_path.exists():
+        return None
+
+    with open(index_path, 'rb') as f:
+        header = np.frombuffer(f.read(tar_index_header_dtype.itemsize),
+                               dtype=tar_index_header_dtype)
+        if (len(header) != 1 or header['magic'][0] != TAR_INDEX_MAGIC or
+                header['version'][0] != TAR_INDEX_VERSION or
+                header['entry_size'][0] != tar_index_entry_dtype.itemsize):
+            return None
+        entry_count = int(header['entry_count'][0])
+        data = f.read(entry_count * tar_index_entry_dtype.itemsize)
+
+    # Keep whatever was completely written
+    n_entries = len(data) // tar_index_entry_dtype.itemsize
+    entries = np.frombuffer(data[:n_entries * tar_index_entry_dtype.itemsize],
+                            dtype=tar_index_entry_dtype)
+    if not check_tar_index(tar_path, entries):
+        return None
+    return np.sort(entries, order='timestamp', kind='stable') if sort else entries
+
+
+def load_frame_timestamps(tar_path, suffix):
+    """Timestamps of the frames f'{timestamp}{suffix}' of a tarball, in the
+    order they were written. Uses the sidecar index, or only reads the
+    member headers if there is none."""
+    entries = load_tar_index(tar_path, sort=False)
+    if entries is not None:
+        timestamps = entries['timestamp']
+        return timestamps[entries['name_hash'] == hash_timestamp_names(timestamps, suffix)]
+
+    timestamps = []
+    with tarfile.open(tar_path, 'r:') as tar:
+        for member in tar:
+            name = Path(member.name).name
+            timestamp = parse_timestamp(name)
+            if member.isfile() and timestamp >= 0 and name == f'{timestamp}{suffix}':
+                timestamps.append(timestamp)
+    return np.array(timestamps, dtype=np.int64)
+
+
+def find_member(entries, name):
+    """Return the index entry of the member called name, None if not found"""
+    timestamp = parse_timestamp(name)
+    name_hash = hash_member_name(name)
+    start = np.searchsorted(entries['timestamp'], timestamp, side='left')
+    end = np.searchsorted(entries['timestamp'], timestamp, side='right')
+    for entry in entries[start:end]:
+        if entry['name_hash'] == name_hash:
+            return entry
+    return None
+
+
+def read_member(tar_file, entry):
+    """Read the data of an indexed member from an open (binary) tar file"""
+    tar_file.seek(int(entry['data_offset']))
+    return tar_file.read(int(entry['data_size']))
+
+
+def get_tar_index(tar_path, sort=True):
+    """Sidecar index of tar_path (see load_tar_index), rebuilt first if it
+    is missing, stale or corrupt"""
+    entries = load_tar_index(tar_path, sort)
+    if entries is None:
+        rebuild_tar_index(tar_path)
+        entries = load_tar_index(tar_path, sort)
+    return entries
+
+
+def rebuild_tar_index(tar_path):
+    """Write the sidecar index of a tarball recorded without one.
+
+    Only the member headers are read, the member data is skipped.
+    Returns the number of indexed members.
+    """
+    entries = []
+    with tarfile.open(tar_path, 'r:') as tar:
+        for member in tar:
+            if not member.isfile():
+                continue
+            entries.append((hash_member_name(member.name),
+                            parse_timestamp(member.name),
+                            member.offset_data,
+                            member.size))
+
+    entries = np.array(entries, dtype=tar_index_entry_dtype)
+    header = np.array([(TAR_INDEX_MAGIC, TAR_INDEX_VERSION,
+                        tar_index_entry_dtype.itemsize, len(entries))],
+                      dtype=tar_index_header_dtype)
+    with open(get_index_path(tar_path), 'wb') as f:
+        f.write(header.tobytes())
+        f.write(entries.tobytes())
+
+    return len(entries)
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Rebuild tar sidecar indices')
+    parser.add_argument("--recording_path", required=True,
+                        help="Path to recording folder")
+    parser.add_argument("--force",
+                        required=False,
+                        action='store_true',
+                        help="Rebuild indices that already exist")
+
+    args = parser.parse_args()
+    for tar_path in sorted(Path(args.recording_path).glob('*.tar')):
+        if not args.force and load_tar_index(tar_path) is not None:
+            print(f"Index already exists for {tar_path}")
+            continue
+        n_members = rebuild_tar_index(tar_path)
+        print(f"Indexed {n_members} members of {tar_path}")
@@ -0,0 +1,192 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import argparse
+import json
+import random
+import re
+import threading
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from pathlib import Path
+from urllib.parse import parse_qs, quote, urlparse
+
+# Local stand-in for the HoloLens Device Portal endpoints used by
+# recorder_console.py, serving the recordings of a folder as the
+# StreamRecorder LocalState folder. Faults can be injected to test the
+# downloads: connections dropped in the middle of a response, range
+# requests ignored, or no bytes served at all once a budget is spent.
+#
+# python device_portal_server.py --recordings_path <folder> --disconnect_rate 0.3
+# python recorder_console.py --workspace_path <workspace> --dev_portal_address 127.0.0.1:<port>
+#   --dev_portal_username any --dev_portal_password any
+
+PACKAGE_FULL_NAME = 'StreamRecorder_1.0.0.0_arm64__test'
+DIRECTORY_TYPE = 16
+FILE_TYPE = 32
+SEND_SIZE = 16 * 1024
+
+
+class DevicePortalServer(ThreadingHTTPServer):
+    daemon_threads = True
+
+    def __init__(self, recordings_path, port=0, disconnect_rate=0., support_ranges=True, seed=0):
+        super().__init__(('127.0.0.1', port), DevicePortalHandler)
+        self.recordings_path = Path(recordings_path)
+        self.disconnect_rate = disconnect_rate
+        self.support_ranges = support_ranges
+        # Once this many bytes are served, connections are dropped before sending any
+        self.byte_budget = None
+        self.lock = threading.Lock()
+        self.random = random.Random(seed)
+        self.served_bytes = 0
+        self.range_requests = 0
+        self.thread = None
+
+    @property
+    def url(self):
+        return 'http://{}:{}'.format(*self.server_address)
+
+    def file_url(self, recording_name, file_name):
+        return (f'{self.url}/api/filesystem/apps/file?knownfolderid=LocalAppData&'
+                f'packagefullname={PACKAGE_FULL_NAME}&filename=\\LocalState\\{recording_name}\\{quote(file_name)}')
+
+    def start(self):
+        self.thread = threading.Thread(target=self.serve_forever, daemon=True)
+        self.thread.start()
+        return self
+
+    def stop(self):
+        self.shutdown()
+        self.server_close()
+        self.thread.join()
+
+    def __enter__(self):
+        return self.start()
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.stop()
+
+    def get_response_bytes(self, n_bytes):
+        """Number of bytes to send before dropping the connection, n_bytes if it is kept"""
+        with self.lock:
+            if self.byte_budget is not None:
+                n_bytes = min(n_bytes, max(0, self.byte_budget - self.served_bytes))
+            if n_bytes and self.random.random() < self.disconnect_rate:
+                n_bytes = self.random.randrange(n_bytes)
+            self.served_bytes += n_bytes
+            return n_bytes
+
+
+class DevicePortalHandler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def log_message(self, format, *args):
+        pass
+
+    def get_local_path(self, query, key):
+        """Path of the recordings folder named by the \\LocalState\\... query parameter"""
+        parts = [part for part in re.split(r'[\\/]+', query.get(key, [''])[0]) if part]
+        if not parts or parts[0] != 'LocalState' or '..' in parts:
+            return None
+        return self.server.recordings_path.joinpath(*parts[1:])
+
+    def send_json(self, data):
+        body = json.dumps(data).encode('utf-8')
+        self.send_response(200)
+        self.send_header('Content-Type', 'application/json')
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def do_GET(self):
+        url = urlparse(self.path)
+        query = parse_qs(url.query)
+        if url.path == '/api/app/packagemanager/packages':
+            self.send_json({'InstalledPackages': [{'Name': 'StreamRecorder',
+                                                   'PackageFullName': PACKAGE_FULL_NAME}]})
+        elif url.path == '/api/filesystem/apps/files':
+            folder = self.get_local_path(query, 'path')
+            if folder is None or not folder.is_dir():
+                self.send_error(404)
+                return
+            self.send_json({'Items': [
+                {'Id': path.name, 'Type': DIRECTORY_TYPE} if path.is_dir() else
+                {'Id': path.name, 'Type': FILE_TYPE, 'FileSize': path.stat().st_size}
+                for path in sorted(folder.iterdir())]})
+        elif url.path == '/api/filesystem/apps/file':
+            self.send_file(self.get_local_path(query, 'filename'))
+        elif url.path == '/':
+            self.send_json({})
+        else:
+            self.send_error(404)
+
+    def do_DELETE(self):
+        url = urlparse(self.path)
+        path = self.get_local_path(parse_qs(url.query), 'filename')
+        if url.path != '/api/filesystem/apps/file' or path is None or not path.is_file():
+            self.send_error(404)
+            return
+        path.unlink()
+        self.send_json({})
+
+    def send_file(self, path):
+        if path is None or not path.is_file():
+            self.send_error(404)
+            return
+        size = path.stat().st_size
+        begin, end = 0, size
+        match = re.fullmatch(r'bytes=(\d+)-(\d*)', self.headers.get('Range', ''))
+        ranged = match is not None and self.server.support_ranges
+        if ranged:
+            with self.server.lock:
+                self.server.range_requests += 1
+            begin = int(match.group(1))
+            end = min(size, int(match.group(2)) + 1) if match.group(2) else size
+            if begin >= size or begin >= end:
+                self.send_response(416)
+                self.send_header('Content-Range', f'bytes */{size}')
+                self.send_header('Content-Length', '0')
+                self.end_headers()
+                return
+
+        self.send_response(206 if ranged else 200)
+        self.send_header('Content-Type', 'application/octet-stream')
+        self.send_header('Content-Length', str(end - begin))
+        if ranged:
+            self.send_header('Content-Range', f'bytes {begin}-{end - 1}/{size}')
+        self.end_headers()
+
+        n_bytes = self.server.get_response_bytes(end - begin)
+        with open(path, 'rb') as f:
+            f.seek(begin)
+            remaining = n_bytes
+            while remaining > 0:
+                data = f.read(min(SEND_SIZE, remaining))
+                self.wfile.write(data)
+                remaining -= len(data)
+        if n_bytes < end - begin:
+            # Drop the connection with the response incomplete
+            self.close_connection = True
+            self.wfile.flush()
+            self.connection.shutdown(2)
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Local stand-in for the Device Portal')
+    parser.add_argument("--recordings_path", required=True,
+                        help="Folder of recordings, served as the recorder LocalState folder")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--disconnect_rate", type=float, default=0.,
+                        help="Probability of dropping a connection in the middle of a file")
+    parser.add_argument("--no_ranges", action='store_true',
+                        help="Ignore range requests")
+
+    args = parser.parse_args()
+    server = DevicePortalServer(args.recordings_path, args.port, args.disconnect_rate, not args.no_ranges)
+    print(f"Serving {args.recordings_path} at {server.url}")
+    server.serve_forever()
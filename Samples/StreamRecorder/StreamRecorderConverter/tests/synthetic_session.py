@@ -0,0 +1,120 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import io
+import tarfile
+
+import numpy as np
+
+from tar_index import rebuild_tar_index
+
+# Recordings laid out as the recorder writes them (tarballs with their
+# sidecar index, rig2world and PV pose logs, head/hand/eye log), with
+# injected gaps, duplicated and out of order frames and missing poses.
+# The member data is a few bytes, only the timestamps matter.
+
+FIRST_TIMESTAMP = 132552243331225839
+HEAD_HAND_EYE_COLUMNS = 861
+LEFT_HAND_FLAG = 17
+RIGHT_HAND_FLAG = 17 + 26 * 16 + 1
+GAZE_FLAG = 851
+
+
+def get_stream_timestamps(n_frames, interval, gaps=(), duplicates=(), reversals=(),
+                          start=FIRST_TIMESTAMP):
+    """Timestamps of a stream in recording order.
+
+    Args:
+        n_frames ([int]): Number of recorded frames, without the duplicates
+        interval ([int]): Nominal frame interval, in hundreds of ns
+        gaps ([list]): (frame, dropped frames): frames dropped after a recorded frame
+        duplicates ([list]): Recorded frames written twice in a row
+        reversals ([list]): Recorded frames written after the next one
+    """
+    dropped = dict(gaps)
+    frame_ids = []
+    frame_id = 0
+    while len(frame_ids) < n_frames:
+        frame_ids.append(frame_id)
+        frame_id += 1 + dropped.get(len(frame_ids) - 1, 0)
+    timestamps = [start + interval * i for i in frame_ids]
+    for i in reversals:
+        timestamps[i], timestamps[i + 1] = timestamps[i + 1], timestamps[i]
+    for i in sorted(duplicates, reverse=True):
+        timestamps.insert(i, timestamps[i])
+    return np.array(timestamps, dtype=np.int64)
+
+
+def write_tarball(path, names, index=True):
+    with tarfile.open(path, 'w') as tar:
+        for name in names:
+            data = name.encode('ascii')
+            info = tarfile.TarInfo(name)
+            info.size = len(data)
+            tar.addfile(info, io.BytesIO(data))
+    if index:
+        rebuild_tar_index(path)
+
+
+def format_transform_row(timestamp, transform):
+    return '%d,' % timestamp + ','.join('%.8g' % value for value in transform.reshape(-1))
+
+
+def get_transform(rng):
+    transform = np.eye(4)
+    transform[:3, 3] = rng.normal(0, 1, 3)
+    return transform
+
+
+def write_depth_stream(folder, name, timestamps, without_rig2world=(), invalid_rig2world=(),
+                       index=True, extracted=False, seed=0):
+    """Depth tarball (depth and AB frames), or its extracted frames, and
+    rig2world log, without the entries of the frames without_rig2world,
+    and with zero transforms for invalid_rig2world"""
+    names = []
+    for timestamp in timestamps:
+        names += [f'{timestamp}.pgm', f'{timestamp}_ab.pgm']
+    if extracted:
+        (folder / name).mkdir()
+        for file_name in names:
+            (folder / name / file_name).write_bytes(b'')
+    else:
+        write_tarball(folder / f'{name}.tar', [f'{name}_lut.bin'] + names, index)
+
+    rng = np.random.default_rng(seed)
+    with open(folder / f'{name}_rig2world.txt', 'w') as f:
+        for timestamp in np.unique(timestamps):
+            if timestamp in without_rig2world:
+                continue
+            transform = np.zeros((4, 4)) if timestamp in invalid_rig2world else get_transform(rng)
+            f.write(format_transform_row(timestamp, transform) + '\n')
+
+
+def write_pv_stream(folder, timestamps, without_pose_entry=(), without_pose=(), index=True, seed=0):
+    """PV tarball and pose log, without the entries of the frames
+    without_pose_entry, and with zero poses for without_pose"""
+    write_tarball(folder / 'PV.tar', [f'{timestamp}.bytes' for timestamp in timestamps], index)
+
+    rng = np.random.default_rng(seed)
+    with open(folder / '2021-01-01-000000_pv.txt', 'w') as f:
+        f.write('959.5,539.25,1920,1080\n')
+        for timestamp in np.unique(timestamps):
+            if timestamp in without_pose_entry:
+                continue
+            transform = np.zeros((4, 4)) if timestamp in without_pose else get_transform(rng)
+            f.write(format_transform_row(timestamp, np.concatenate([[1450., 1450.], transform.reshape(-1)])) + '\n')
+
+
+def write_head_hand_eye_log(folder, timestamps, left_available, right_available, gaze_available):
+    with open(folder / '2021-01-01-000000_head_hand_eye.csv', 'w') as f:
+        for i, timestamp in enumerate(timestamps):
+            row = np.zeros(HEAD_HAND_EYE_COLUMNS)
+            row[LEFT_HAND_FLAG] = left_available[i]
+            row[RIGHT_HAND_FLAG] = right_available[i]
+            row[GAZE_FLAG] = gaze_available[i]
+            f.write('%d,' % timestamp + ','.join('%g' % value for value in row[1:]) + '\n')
@@ -0,0 +1,112 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import contextlib
+import io
+
+import numpy as np
+
+from aggregate_pclouds import VoxelGrid, aggregate_pclouds, reduce_voxels
+from aggregate_pclouds_benchmark import downsample, iter_frame_points, read_points_ply
+from tsdf_fusion_benchmark import SENSOR_NAME, write_synthetic_recording
+
+VOXEL_SIZE = 0.05
+
+
+def make_points(rng, n_points):
+    """Clustered points around the origin, with unit normals and colors, a third of them black"""
+    centers = rng.uniform(-1, 1, (20, 3))
+    points = centers[rng.integers(0, len(centers), n_points)] + rng.normal(0, 0.1, (n_points, 3))
+    normals = rng.normal(size=(n_points, 3)).astype(np.float32)
+    normals /= np.linalg.norm(normals, axis=1, keepdims=True)
+    colors = rng.uniform(0.1, 1, (n_points, 3)).astype(np.float32)
+    colors[rng.uniform(size=n_points) < 1 / 3] = 0
+    return points, colors, normals
+
+
+def add_batches(grid, points, colors, normals, n_batches):
+    for batch in np.array_split(np.arange(len(points)), n_batches):
+        grid.add(reduce_voxels(points[batch], colors[batch], normals[batch], VOXEL_SIZE))
+
+
+def assert_same_cloud(cloud, reference, atol=1e-9):
+    points, colors, normals = cloud
+    _, reference_points, reference_colors, reference_normals = reference
+    assert len(points) == len(reference_points)
+    assert np.allclose(points, reference_points, rtol=0, atol=atol)
+    assert np.allclose(colors, reference_colors, atol=1e-5)
+    assert np.allclose(normals, reference_normals, atol=1e-5)
+
+
+def test_voxel_grid_matches_downsample():
+    rng = np.random.default_rng(39)
+    points, colors, normals = make_points(rng, 20000)
+
+    grid = VoxelGrid(VOXEL_SIZE)
+    add_batches(grid, points, colors, normals, 7)
+    assert grid.level == 0
+    assert_same_cloud(grid.get_points(), downsample(points, colors, normals, VOXEL_SIZE))
+
+    # The order of the batches does not matter
+    shuffled = rng.permutation(len(points))
+    other = VoxelGrid(VOXEL_SIZE)
+    add_batches(other, points[shuffled], colors[shuffled], normals[shuffled], 3)
+    assert_same_cloud(other.get_points(), downsample(points, colors, normals, VOXEL_SIZE))
+
+
+def test_voxel_grid_min_points():
+    rng = np.random.default_rng(40)
+    points, colors, normals = make_points(rng, 5000)
+    grid = VoxelGrid(VOXEL_SIZE)
+    add_batches(grid, points, colors, normals, 2)
+
+    coords, reference_points, _, _ = downsample(points, colors, normals, VOXEL_SIZE)
+    counts = np.unique(np.floor(points / VOXEL_SIZE).astype(np.int64), axis=0, return_counts=True)[1]
+    kept, _, _ = grid.get_points(min_points=3)
+    assert len(kept) == np.count_nonzero(counts >= 3) < len(coords)
+    assert np.allclose(kept, reference_points[counts >= 3], rtol=0, atol=1e-9)
+
+
+def test_voxel_grid_coarsens_to_larger_voxels():
+    rng = np.random.default_rng(41)
+    points, colors, normals = make_points(rng, 20000)
+    n_voxels = len(downsample(points, colors, normals, VOXEL_SIZE)[0])
+
+    # Coarsened once the grid holds voxels of several batches, then again
+    grid = VoxelGrid(VOXEL_SIZE, max_voxels=n_voxels // 4)
+    with contextlib.redirect_stdout(io.StringIO()):
+        add_batches(grid, points, colors, normals, 20)
+    assert grid.level == 2 and len(grid) <= n_voxels // 4
+    assert np.isclose(grid.voxel_size, VOXEL_SIZE * 2 ** grid.level)
+    # The batches added after the grid was coarsened are merged at its voxel size too
+    assert_same_cloud(grid.get_points(), downsample(points, colors, normals, grid.voxel_size))
+
+
+def test_aggregate_pclouds_matches_downsample(tmp_path):
+    n_frames = 6
+    write_synthetic_recording(tmp_path, n_frames)
+    # A frame without pose is left out
+    rig2world_path = tmp_path / f'{SENSOR_NAME}_rig2world.txt'
+    lines = rig2world_path.read_text().splitlines(keepends=True)
+    rig2world_path.write_text(''.join(lines[:2] + lines[3:]))
+
+    with contextlib.redirect_stdout(io.StringIO()):
+        report = aggregate_pclouds(tmp_path, voxel_size=VOXEL_SIZE, workers=2, chunk_size=4)
+    assert (report['frames'], report['skipped_frames']) == (n_frames - 1, 1)
+
+    frames = [frame for i, frame in enumerate(iter_frame_points(n_frames)) if i != 2]
+    points = np.concatenate([xyz for xyz, _ in frames])
+    normals = np.concatenate([normals for _, normals in frames])
+    reference = downsample(points, np.zeros_like(points), normals, VOXEL_SIZE)
+    assert report['points'] == len(points) and report['voxels'] == len(reference[0])
+
+    # Saved as float, without colors
+    cloud = read_points_ply(tmp_path / f'{SENSOR_NAME}_aggregated.ply')
+    assert cloud.dtype.names == ('x', 'y', 'z', 'nx', 'ny', 'nz')
+    assert np.allclose(np.stack((cloud['x'], cloud['y'], cloud['z']), axis=1), reference[1], rtol=0, atol=1e-6)
+    assert np.allclose(np.stack((cloud['nx'], cloud['ny'], cloud['nz']), axis=1), reference[3], atol=1e-5)
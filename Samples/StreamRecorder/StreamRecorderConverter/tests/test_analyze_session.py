@@ -0,0 +1,114 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import numpy as np
+import pytest
+
+from analyze_session import analyze_session, analyze_timestamps
+from synthetic_session import (FIRST_TIMESTAMP, get_stream_timestamps, write_depth_stream,
+                               write_head_hand_eye_log, write_pv_stream)
+from tar_index import get_index_path
+
+LONG_THROW_INTERVAL = 2000000
+PV_INTERVAL = 333333
+AHAT_INTERVAL = 222222
+HEAD_HAND_EYE_INTERVAL = 166666
+
+
+@pytest.fixture
+def session(tmp_path):
+    # Long throw: two gaps 200ms apart (a drop burst), a lone gap, a duplicate and a reversal
+    long_throw = get_stream_timestamps(200, LONG_THROW_INTERVAL, gaps=[(20, 1), (22, 2), (150, 4)],
+                                       duplicates=[50], reversals=[100])
+    write_depth_stream(tmp_path, 'Depth Long Throw', long_throw,
+                       without_rig2world=long_throw[[5, 6, 120]], invalid_rig2world=long_throw[[7, 8]])
+
+    pv = get_stream_timestamps(300, PV_INTERVAL, gaps=[(100, 10)], start=long_throw[0] + 1000)
+    write_pv_stream(tmp_path, pv, without_pose_entry=pv[[0, 1, 2, 299]], without_pose=pv[[10, 11, 12, 13, 14]])
+
+    # Extracted AHaT frames, the recording order is lost
+    ahat = get_stream_timestamps(100, AHAT_INTERVAL, gaps=[(10, 1)], start=long_throw[0] + 2000)
+    write_depth_stream(tmp_path, 'Depth AHaT', ahat, extracted=True)
+
+    head_hand_eye = get_stream_timestamps(600, HEAD_HAND_EYE_INTERVAL, gaps=[(300, 2)], reversals=[400],
+                                          start=long_throw[0] + 3000)
+    write_head_hand_eye_log(tmp_path, head_hand_eye, np.arange(600) % 4 != 0,
+                            np.arange(600) % 2 == 0, np.ones(600))
+    return tmp_path
+
+
+def test_stream_counts(session):
+    report = analyze_session(session)
+    assert set(report['streams']) == {'PV', 'Depth Long Throw', 'Depth AHaT', 'Head/hand/eye'}
+
+    long_throw = report['streams']['Depth Long Throw']
+    assert long_throw['source'] == 'tar'
+    # The AB frames and the LUT are not counted
+    assert long_throw['frame_count'] == 201
+    assert long_throw['nominal_interval_ms'] == pytest.approx(200.)
+    assert long_throw['gaps']['count'] == 3
+    assert long_throw['gaps']['dropped_frames'] == 7
+    assert long_throw['gaps']['longest_ms'] == pytest.approx(1000.)
+    assert [gap['dropped_frames'] for gap in long_throw['gaps']['items']] == [1, 2, 4]
+    assert long_throw['drop_bursts']['count'] == 1
+    assert long_throw['drop_bursts']['items'][0]['gaps'] == 2
+    assert long_throw['drop_bursts']['items'][0]['dropped_frames'] == 3
+    assert long_throw['duplicates']['count'] == 1
+    assert long_throw['reversals']['count'] == 1
+    assert long_throw['short_intervals'] == 0
+    assert long_throw['rig2world']['frames_without_rig2world'] == 3
+    assert long_throw['rig2world']['invalid_transforms'] == 2
+
+    pv = report['streams']['PV']
+    assert pv['frame_count'] == 300
+    assert pv['gaps']['count'] == 1 and pv['gaps']['dropped_frames'] == 10
+    assert pv['drop_bursts']['count'] == 0
+    assert pv['duplicates']['count'] == 0 and pv['reversals']['count'] == 0
+    assert pv['poses']['entry_count'] == 296
+    assert pv['poses']['frames_without_pose_entry'] == 4
+    assert pv['poses']['frames_without_pose'] == 5
+
+    ahat = report['streams']['Depth AHaT']
+    assert ahat['source'] == 'folder'
+    assert 'reversals' not in ahat
+    assert ahat['frame_count'] == 100
+    assert ahat['gaps']['count'] == 1 and ahat['gaps']['dropped_frames'] == 1
+    assert ahat['rig2world']['frames_without_rig2world'] == 0
+
+    head_hand_eye = report['streams']['Head/hand/eye']
+    assert head_hand_eye['frame_count'] == 600
+    assert head_hand_eye['gaps']['count'] == 1 and head_hand_eye['gaps']['dropped_frames'] == 2
+    assert head_hand_eye['reversals']['count'] == 1
+    assert head_hand_eye['availability'] == {'left_hand': 0.75, 'right_hand': 0.5, 'eye_gaze': 1.}
+
+    coverage = report['coverage']
+    assert coverage['session_start_timestamp'] == FIRST_TIMESTAMP
+    # The gaps are not covered
+    for name, fraction in coverage['streams'].items():
+        assert 0 < fraction < 1
+    for fraction in coverage['overlap'].values():
+        assert 0 < fraction < 1
+
+
+def test_index_and_header_walk_agree(session):
+    report = analyze_session(session)
+    for tar_path in session.glob('*.tar'):
+        get_index_path(tar_path).unlink()
+    header_walk_report = analyze_session(session)
+    del report['analysis_time_s'], header_walk_report['analysis_time_s']
+    assert header_walk_report == report
+
+
+def test_short_streams():
+    report, intervals = analyze_timestamps([])
+    assert report == {'frame_count': 0} and len(intervals) == 0
+
+    report, intervals = analyze_timestamps([5, 5])
+    assert report['frame_count'] == 2 and report['duplicates']['count'] == 1
+    assert 'gaps' not in report
+    assert intervals.tolist() == [[5, 5]]
@@ -0,0 +1,149 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import os
+
+import pytest
+
+from conversion_manifest import MANIFEST_NAME, ConversionManifest, Stage, run_stages
+
+
+class Session(object):
+    """Recording with one input file per frame, a stage converting each
+    frame and a stage merging the converted frames"""
+
+    def __init__(self, folder, n_frames=5):
+        self.folder = folder
+        self.inputs = [folder / f'{i_frame}.raw' for i_frame in range(n_frames)]
+        for i_frame, path in enumerate(self.inputs):
+            path.write_text(f'frame {i_frame}')
+        (folder / 'converted').mkdir()
+        self.converted = []
+        self.merged = 0
+        self.fail_after = None
+
+    def get_output(self, path):
+        return self.folder / 'converted' / (path.stem + '.txt')
+
+    def run_convert(self, record):
+        done_frames = record.done_frames()
+        for path in self.inputs:
+            if path.name in done_frames:
+                continue
+            if self.fail_after is not None and len(self.converted) == self.fail_after:
+                raise self.fail_after_error
+            output = self.get_output(path)
+            output.write_text(path.read_text().upper())
+            self.converted.append(path.name)
+            record.frame_done(path.name, [output])
+
+    def run_merge(self, record):
+        self.merged += 1
+        outputs = [self.get_output(path) for path in self.inputs]
+        merged_path = self.folder / 'merged.txt'
+        merged_path.write_text('\n'.join(output.read_text() for output in outputs))
+        record.frame_done('merged', [merged_path])
+
+    def run(self, force=False, params=None):
+        self.converted = []
+        self.merged = 0
+        stages = [Stage('merge', self.run_merge, [self.get_output(path) for path in self.inputs],
+                        dependencies=['convert']),
+                  Stage('convert', self.run_convert, self.inputs, params)]
+        return run_stages(self.folder, stages, force)
+
+
+def test_first_run_and_noop_rerun(tmp_path):
+    session = Session(tmp_path)
+    assert session.run() == {'convert': 'done', 'merge': 'done'}
+    assert len(session.converted) == 5 and session.merged == 1
+    assert (tmp_path / 'merged.txt').read_text().splitlines()[0] == 'FRAME 0'
+
+    assert session.run() == {'convert': 'skipped', 'merge': 'skipped'}
+    assert session.converted == [] and session.merged == 0
+
+
+def test_deleted_output_is_redone(tmp_path):
+    session = Session(tmp_path)
+    session.run()
+
+    session.get_output(session.inputs[2]).unlink()
+    assert session.run() == {'convert': 'done', 'merge': 'done'}
+    # Only the missing frame, then the merge of the rewritten frame
+    assert session.converted == ['2.raw'] and session.merged == 1
+
+    # An output truncated by an interruption is redone as well
+    session.get_output(session.inputs[3]).write_text('')
+    session.run()
+    assert session.converted == ['3.raw']
+
+    (tmp_path / 'merged.txt').unlink()
+    assert session.run() == {'convert': 'skipped', 'merge': 'done'}
+
+
+def test_touched_input_redoes_stage_and_dependents(tmp_path):
+    session = Session(tmp_path)
+    session.run()
+
+    stat = session.inputs[0].stat()
+    os.utime(session.inputs[0], ns=(stat.st_atime_ns, stat.st_mtime_ns + 1000000000))
+    assert session.run() == {'convert': 'done', 'merge': 'done'}
+    # The fingerprint changed, so the frames of the previous run are not reused
+    assert len(session.converted) == 5 and session.merged == 1
+
+    # Same with other parameters
+    assert session.run(params={'scale': 2}) == {'convert': 'done', 'merge': 'done'}
+    assert len(session.converted) == 5
+    assert session.run(params={'scale': 2}) == {'convert': 'skipped', 'merge': 'skipped'}
+
+
+def test_force_redoes_everything(tmp_path):
+    session = Session(tmp_path)
+    session.run()
+
+    assert session.run(force=True) == {'convert': 'done', 'merge': 'done'}
+    assert len(session.converted) == 5 and session.merged == 1
+    assert session.run() == {'convert': 'skipped', 'merge': 'skipped'}
+
+
+def test_failed_stage_resumes(tmp_path):
+    session = Session(tmp_path)
+    session.fail_after = 2
+    session.fail_after_error = RuntimeError('conversion failed')
+    assert session.run() == {'convert': 'failed', 'merge': 'failed'}
+    assert session.converted == ['0.raw', '1.raw'] and session.merged == 0
+
+    session.fail_after = None
+    assert session.run() == {'convert': 'done', 'merge': 'done'}
+    assert session.converted == ['2.raw', '3.raw', '4.raw'] and session.merged == 1
+
+
+def test_interrupted_stage_resumes(tmp_path):
+    session = Session(tmp_path)
+    session.fail_after = 3
+    session.fail_after_error = KeyboardInterrupt()
+    with pytest.raises(KeyboardInterrupt):
+        session.run()
+
+    # The frames done before the interruption were saved, but not the completion
+    manifest = ConversionManifest(tmp_path)
+    assert sorted(manifest.stages['convert']['frames']) == ['0.raw', '1.raw', '2.raw']
+    assert not manifest.stages['convert']['complete']
+
+    session.fail_after = None
+    assert session.run() == {'convert': 'done', 'merge': 'done'}
+    assert session.converted == ['3.raw', '4.raw']
+
+
+def test_unreadable_manifest_redoes_everything(tmp_path):
+    session = Session(tmp_path)
+    session.run()
+
+    (tmp_path / MANIFEST_NAME).write_text('{"version": 1, "stag')
+    assert session.run() == {'convert': 'done', 'merge': 'done'}
+    assert len(session.converted) == 5
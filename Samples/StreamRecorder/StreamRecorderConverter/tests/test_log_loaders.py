@@ -0,0 +1,174 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import ast
+import os
+
+import numpy as np
+
+from hand_defs import HandJointIndex
+from project_hand_eye_to_pv import load_pv_data
+from utils import get_log_cache_path, load_head_hand_eye_data
+
+
+def reference_load_head_hand_eye_data(csv_path):
+    """Loader the vectorized one replaced, one frame and joint at a time"""
+    joint_count = HandJointIndex.Count.value
+
+    data = np.loadtxt(csv_path, delimiter=',')
+
+    n_frames = len(data)
+    timestamps = np.zeros(n_frames)
+    head_transs = np.zeros((n_frames, 3))
+
+    left_hand_transs = np.zeros((n_frames, joint_count, 3))
+    left_hand_transs_available = np.ones(n_frames, dtype=bool)
+    right_hand_transs = np.zeros((n_frames, joint_count, 3))
+    right_hand_transs_available = np.ones(n_frames, dtype=bool)
+
+    gaze_data = np.zeros((n_frames, 9))
+    gaze_available = np.ones(n_frames, dtype=bool)
+
+    for i_frame, frame in enumerate(data):
+        timestamps[i_frame] = frame[0]
+        head_transs[i_frame, :] = frame[1:17].reshape((4, 4))[:3, 3]
+        left_hand_transs_available[i_frame] = (frame[17] == 1)
+        left_start_id = 18
+        for i_j in range(joint_count):
+            j_start_id = left_start_id + 16 * i_j
+            left_hand_transs[i_frame, i_j, :] = frame[j_start_id:j_start_id + 16].reshape((4, 4))[:3, 3]
+        right_hand_transs_available[i_frame] = (frame[left_start_id + joint_count * 4 * 4] == 1)
+        right_start_id = left_start_id + joint_count * 4 * 4 + 1
+        for i_j in range(joint_count):
+            j_start_id = right_start_id + 16 * i_j
+            right_hand_transs[i_frame, i_j, :] = frame[j_start_id:j_start_id + 16].reshape((4, 4))[:3, 3]
+
+        gaze_available[i_frame] = (frame[851] == 1)
+        gaze_data[i_frame, :4] = frame[852:856]
+        gaze_data[i_frame, 4:8] = frame[856:860]
+        gaze_data[i_frame, 8] = frame[860]
+
+    return (timestamps, head_transs, left_hand_transs, left_hand_transs_available,
+            right_hand_transs, right_hand_transs_available, gaze_data, gaze_available)
+
+
+def reference_load_pv_data(csv_path):
+    with open(csv_path) as f:
+        lines = f.readlines()
+
+    n_frames = len(lines) - 1
+    frame_timestamps = np.zeros(n_frames, dtype=np.longlong)
+    focal_lengths = np.zeros((n_frames, 2))
+    pv2world_transforms = np.zeros((n_frames, 4, 4))
+
+    intrinsics_ox, intrinsics_oy, \
+        intrinsics_width, intrinsics_height = ast.literal_eval(lines[0])
+
+    for i_frame, frame in enumerate(lines[1:]):
+        frame = frame.split(',')
+        frame_timestamps[i_frame] = int(frame[0])
+        focal_lengths[i_frame, 0] = float(frame[1])
+        focal_lengths[i_frame, 1] = float(frame[2])
+        pv2world_transforms[i_frame] = np.array(frame[3:20]).astype(float).reshape((4, 4))
+
+    return (frame_timestamps, focal_lengths, pv2world_transforms,
+            intrinsics_ox, intrinsics_oy, intrinsics_width, intrinsics_height)
+
+
+def format_row(values):
+    # As the recorder, with 8 significant digits
+    return ','.join('%.8g' % value for value in values)
+
+
+def write_head_hand_eye_log(path, n_frames, seed=0):
+    rng = np.random.default_rng(seed)
+    with open(path, 'w') as f:
+        for i_frame in range(n_frames):
+            row = rng.uniform(-2, 2, 861)
+            row[0] = 132552243331225839 + 333333 * i_frame
+            # Hands and gaze are sometimes lost
+            for flag_id in [17, 17 + 26 * 16 + 1, 851]:
+                row[flag_id] = float(rng.random() < 0.8)
+            f.write(format_row(row) + '\n')
+
+
+def write_pv_log(path, n_frames, seed=0):
+    rng = np.random.default_rng(seed)
+    with open(path, 'w') as f:
+        f.write('959.5,539.25,1920,1080\n')
+        for i_frame in range(n_frames):
+            f.write('%d,' % (132552243331225839 + 333333 * i_frame))
+            f.write(format_row(np.concatenate([rng.uniform(1400, 1500, 2), rng.uniform(-2, 2, 16)])) + '\n')
+
+
+def assert_same_outputs(outputs, reference_outputs):
+    assert len(outputs) == len(reference_outputs)
+    for output, reference_output in zip(outputs, reference_outputs):
+        output = np.asarray(output)
+        reference_output = np.asarray(reference_output)
+        assert output.shape == reference_output.shape
+        assert output.dtype.kind == reference_output.dtype.kind
+        assert np.array_equal(output, reference_output)
+
+
+def test_head_hand_eye_log_matches_reference(tmp_path):
+    log_path = tmp_path / '2021-01-01-000000_head_hand_eye.csv'
+    write_head_hand_eye_log(log_path, 200)
+    assert HandJointIndex.Count.value == 26
+
+    reference_outputs = reference_load_head_hand_eye_data(log_path)
+    assert_same_outputs(load_head_hand_eye_data(log_path), reference_outputs)
+
+    # Then from the cache
+    assert get_log_cache_path(log_path).exists()
+    assert_same_outputs(load_head_hand_eye_data(log_path), reference_outputs)
+
+
+def test_pv_log_matches_reference(tmp_path):
+    log_path = tmp_path / '2021-01-01-000000_pv.txt'
+    write_pv_log(log_path, 300)
+
+    reference_outputs = reference_load_pv_data(log_path)
+    outputs = load_pv_data(log_path)
+    assert_same_outputs(outputs, reference_outputs)
+    # Timestamps do not fit in a float64
+    assert outputs[0][1] - outputs[0][0] == 333333
+    assert isinstance(outputs[5], int) and isinstance(outputs[6], int)
+
+    assert_same_outputs(load_pv_data(log_path), reference_outputs)
+
+
+def test_cache_is_rebuilt_when_log_changes(tmp_path):
+    log_path = tmp_path / 'log_pv.txt'
+    write_pv_log(log_path, 20, seed=1)
+    load_pv_data(log_path)
+
+    write_pv_log(log_path, 30, seed=2)
+    os.utime(log_path, ns=(0, 1))
+    assert_same_outputs(load_pv_data(log_path), reference_load_pv_data(log_path))
+
+
+def test_corrupt_cache_is_ignored(tmp_path):
+    log_path = tmp_path / 'log_head_hand_eye.csv'
+    write_head_hand_eye_log(log_path, 10)
+    load_head_hand_eye_data(log_path)
+
+    cache_path = get_log_cache_path(log_path)
+    cache_data = cache_path.read_bytes()
+    reference_outputs = reference_load_head_hand_eye_data(log_path)
+
+    middle = len(cache_data) // 2
+    truncated_data = cache_data[:100]
+    flipped_data = cache_data[:middle] + bytes([cache_data[middle] ^ 1]) + cache_data[middle + 1:]
+
+    for corrupt_data in [truncated_data, flipped_data]:
+        cache_path.write_bytes(corrupt_data)
+        assert_same_outputs(load_head_hand_eye_data(log_path), reference_outputs)
+
+        # An unusable cache is replaced
+        assert cache_path.read_bytes() == cache_data
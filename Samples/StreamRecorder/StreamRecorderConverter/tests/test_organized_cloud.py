@@ -0,0 +1,136 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import numpy as np
+import pytest
+
+from grid_normals_benchmark import get_angles, get_exact_normals
+from organized_cloud import (HAS_COLORS, HAS_NORMALS, HAS_POSE, get_lut_crc32,
+                             load_organized_cloud, organized_cloud_header_dtype, save_organized_cloud)
+from save_pclouds import get_grid_normals, get_points_grid
+from tsdf_fusion_benchmark import HEIGHT, WIDTH, get_camera_pose, get_pinhole_lut, render_depth
+
+LUT_NAME = 'Depth Long Throw_lut.bin'
+
+
+def make_frame(i_frame=3):
+    lut = get_pinhole_lut()
+    cam2world = get_camera_pose(i_frame, 12)
+    img = render_depth(cam2world, lut)
+    # Holes, as the sensor leaves where it gets no signal
+    img[100:120, 50:90] = 0
+    img[::37, ::41] = 0
+    return lut, cam2world, img
+
+
+def test_round_trip(tmp_path):
+    lut, cam2world, img = make_frame()
+    points_grid, valid = get_points_grid(img, lut)
+    normals = get_grid_normals(points_grid, valid, WIDTH, HEIGHT)
+    rng = np.random.default_rng(32)
+    colors = rng.uniform(0, 1, (len(valid), 3))
+
+    # In the layout of a recording: the LUT next to the folder of the clouds
+    lut.tofile(str(tmp_path / LUT_NAME))
+    (tmp_path / 'long_throw_pclouds').mkdir()
+    path = tmp_path / 'long_throw_pclouds' / '132552243331225839.opc'
+    save_organized_cloud(str(path), img, valid, LUT_NAME, get_lut_crc32(lut), normals, colors, cam2world)
+
+    cloud = load_organized_cloud(path)
+    assert np.array_equal(cloud['depth'], img)
+    assert np.array_equal(cloud['valid'], valid.reshape((HEIGHT, WIDTH)))
+    expected_points = points_grid.copy()
+    expected_points[~valid] = 0
+    assert np.array_equal(cloud['points'].reshape((-1, 3)), expected_points)
+    assert np.allclose(cloud['normals'].reshape((-1, 3))[valid], normals[valid], atol=0.5 / 127 + 1e-6)
+    assert np.all(cloud['normals'].reshape((-1, 3))[~valid] == 0)
+    assert np.array_equal(cloud['colors'].reshape((-1, 3))[valid], np.around(colors[valid] * 255))
+    assert np.array_equal(cloud['cam2world'], cam2world)
+
+    # Depth, mask, 3 bytes of normals and 3 of colors per valid pixel after the header
+    n_valid = np.count_nonzero(valid)
+    assert path.stat().st_size == (organized_cloud_header_dtype.itemsize + 2 * len(valid) +
+                                   (len(valid) + 7) // 8 + 6 * n_valid)
+    header = np.fromfile(str(path), dtype=organized_cloud_header_dtype, count=1)[0]
+    assert header['flags'] == HAS_NORMALS | HAS_COLORS | HAS_POSE
+
+
+def test_round_trip_camera_space(tmp_path):
+    lut, _, img = make_frame()
+    _, valid = get_points_grid(img, lut)
+    path = tmp_path / 'cloud.opc'
+    save_organized_cloud(str(path), img, valid, LUT_NAME, get_lut_crc32(lut))
+
+    cloud = load_organized_cloud(path, lut=lut)
+    assert np.array_equal(cloud['depth'], img)
+    assert cloud['normals'] is None and cloud['colors'] is None and cloud['cam2world'] is None
+
+    # The depth must be used with the LUT it was saved with
+    other_lut = lut.copy()
+    other_lut[0] *= -1
+    with pytest.raises(AssertionError):
+        load_organized_cloud(path, lut=other_lut)
+
+
+def test_grid_normals_match_scene():
+    lut, cam2world, img = make_frame()
+    points_grid, valid = get_points_grid(img, lut)
+    normals = get_grid_normals(points_grid, valid, WIDTH, HEIGHT)
+    is_set = np.any(normals != 0, axis=1)
+    assert np.all(is_set <= valid)
+    assert np.count_nonzero(is_set) > 0.95 * np.count_nonzero(valid)
+    assert np.allclose(np.linalg.norm(normals[is_set], axis=1), 1)
+
+    angles = get_angles(normals[is_set], get_exact_normals(points_grid[is_set], cam2world))
+    assert np.median(angles) < 2
+    assert np.percentile(angles, 95) < 10
+
+
+def make_step(left_depth, right_depth):
+    """A wall facing the camera, with its right half further away (depth not rounded to mm)"""
+    lut = get_pinhole_lut()
+    z = np.where(np.arange(WIDTH) < WIDTH // 2, left_depth, right_depth)
+    ranges = z[np.newaxis, :] / lut[:, 2].reshape((HEIGHT, WIDTH))
+    return get_points_grid(ranges * 1000, lut)
+
+
+def test_grid_normals_across_discontinuities():
+    points_grid, valid = make_step(1., 1.5)
+    normals = get_grid_normals(points_grid, valid, WIDTH, HEIGHT).reshape((HEIGHT, WIDTH, 3))
+
+    # The pixels on both sides of the step only use their own side, and face the camera
+    for column in (WIDTH // 2 - 1, WIDTH // 2):
+        assert np.all(np.degrees(np.arccos(-normals[:, column, 2])) < 0.1)
+
+    # Taking the other side would tilt them by tens of degrees
+    tilted = get_grid_normals(points_grid, valid, WIDTH, HEIGHT, discontinuity_ratio=1.).reshape((HEIGHT, WIDTH, 3))
+    assert np.all(np.degrees(np.arccos(-tilted[:, WIDTH // 2, 2])) > 20)
+
+
+def test_grid_normals_without_neighbours():
+    points_grid, valid = make_step(1., 1.)
+    valid = valid.reshape((HEIGHT, WIDTH)).copy()
+    # An isolated pixel, a pixel with a neighbour along x only, and a pixel in a
+    # column of one, with invalid pixels or a jump in depth around them
+    valid[140:143, 200:203] = False
+    valid[141, 201] = True
+    valid[150:153, 210:214] = False
+    valid[151, 211:213] = True
+    points_grid = points_grid.copy().reshape((HEIGHT, WIDTH, 3))
+    points_grid[160:163, 220:223] *= 2
+    points_grid[161, 221] /= 2
+    points_grid = points_grid.reshape((-1, 3))
+    valid = valid.reshape(-1)
+
+    normals = get_grid_normals(points_grid, valid, WIDTH, HEIGHT).reshape((HEIGHT, WIDTH, 3))
+    assert np.all(normals[141, 201] == 0)
+    assert np.all(normals[151, 211:213] == 0)
+    assert np.all(normals[161, 221] == 0)
+    assert np.all(normals[~valid.reshape((HEIGHT, WIDTH))] == 0)
+    # Next to them, the wall
+    assert np.allclose(normals[[139, 149, 160], [201, 210, 224]], [0, 0, -1], atol=1e-3)
@@ -0,0 +1,158 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import io
+import json
+import tarfile
+
+import numpy as np
+import pytest
+
+import portal_download
+from device_portal_server import DevicePortalServer
+from portal_download import download_files, is_downloaded
+
+RECORDING_NAME = '2021-01-01-000000'
+CHUNK_SIZE = 64 * 1024
+
+
+@pytest.fixture(autouse=True)
+def no_retry_delay(monkeypatch):
+    monkeypatch.setattr(portal_download, 'RETRY_DELAY', 0.)
+
+
+@pytest.fixture
+def recording(tmp_path):
+    """Recording served by the stand-in Device Portal: a tarball of frames and a log"""
+    folder = tmp_path / 'device' / RECORDING_NAME
+    folder.mkdir(parents=True)
+    rng = np.random.default_rng(0)
+    with tarfile.open(folder / 'Depth AHaT.tar', 'w') as tar:
+        for i_frame in range(20):
+            data = rng.integers(0, 256, 50000 + 997 * i_frame, dtype=np.uint8).tobytes()
+            info = tarfile.TarInfo(f'{132552243331225839 + i_frame}.pgm')
+            info.size = len(data)
+            tar.addfile(info, io.BytesIO(data))
+    (folder / 'pv.txt').write_bytes(rng.integers(0, 256, 3 * CHUNK_SIZE + 5, dtype=np.uint8).tobytes())
+    (folder / 'empty.txt').write_bytes(b'')
+    return folder
+
+
+def get_downloads(server, recording, destination_folder):
+    destination_folder.mkdir(exist_ok=True)
+    return [(server.file_url(RECORDING_NAME, path.name), destination_folder / path.name, path.stat().st_size)
+            for path in sorted(recording.iterdir())]
+
+
+def assert_downloaded(recording, destination_folder):
+    for path in recording.iterdir():
+        assert (destination_folder / path.name).read_bytes() == path.read_bytes()
+    assert not list(destination_folder.glob('*.part*'))
+
+
+def test_download_with_disconnects(recording, tmp_path):
+    with DevicePortalServer(recording.parent, disconnect_rate=0.3) as server:
+        failed = download_files(get_downloads(server, recording, tmp_path / 'workspace'),
+                                max_files=2, connections_per_file=3, chunk_size=CHUNK_SIZE)
+        assert server.range_requests > 0
+    assert failed == []
+    assert_downloaded(recording, tmp_path / 'workspace')
+
+
+def test_download_without_ranges(recording, tmp_path):
+    with DevicePortalServer(recording.parent, disconnect_rate=0.3, support_ranges=False) as server:
+        failed = download_files(get_downloads(server, recording, tmp_path / 'workspace'),
+                                chunk_size=CHUNK_SIZE)
+    assert failed == []
+    assert_downloaded(recording, tmp_path / 'workspace')
+
+
+def test_interrupted_download_resumes(recording, tmp_path, monkeypatch):
+    workspace = tmp_path / 'workspace'
+    total_bytes = sum(path.stat().st_size for path in recording.iterdir())
+    tar_path = workspace / 'Depth AHaT.tar'
+
+    # The connection is lost for good after half of the bytes
+    with monkeypatch.context() as patch, DevicePortalServer(recording.parent) as server:
+        patch.setattr(portal_download, 'MAX_RETRIES', 1)
+        server.byte_budget = total_bytes // 2
+        failed = download_files(get_downloads(server, recording, workspace),
+                                max_files=1, connections_per_file=2, chunk_size=CHUNK_SIZE)
+    assert tar_path in failed
+    assert not tar_path.exists()
+
+    # The sidecars only count bytes that are in the .part files
+    done_bytes = 0
+    for progress_path in workspace.glob('*.part.json'):
+        part_path = progress_path.with_suffix('')
+        source = (recording / part_path.stem).read_bytes()
+        part = part_path.read_bytes()
+        assert len(part) == len(source)
+        for begin, end, done in json.loads(progress_path.read_text())['chunks']:
+            assert part[begin:begin + done] == source[begin:begin + done]
+            done_bytes += done
+    assert 0 < done_bytes < total_bytes
+
+    # Only the missing bytes are downloaded again
+    with DevicePortalServer(recording.parent, disconnect_rate=0.3, seed=1) as server:
+        downloads = [download for download in get_downloads(server, recording, workspace)
+                     if not is_downloaded(download[1], download[2])]
+        assert tar_path in [download[1] for download in downloads]
+        failed = download_files(downloads, max_files=1, connections_per_file=2, chunk_size=CHUNK_SIZE)
+        assert server.served_bytes == sum(size for _, _, size in downloads) - done_bytes
+    assert failed == []
+    assert_downloaded(recording, workspace)
+
+
+def test_mismatched_sidecar_restarts(recording, tmp_path):
+    workspace = tmp_path / 'workspace'
+    workspace.mkdir()
+    source = (recording / 'pv.txt').read_bytes()
+    # Sidecar of a download of another size, over a .part of garbage
+    (workspace / 'pv.txt.part').write_bytes(b'x' * len(source))
+    (workspace / 'pv.txt.part.json').write_text(json.dumps(
+        {'size': len(source) - 1, 'chunks': [[0, len(source) - 1, len(source) - 1]]}))
+
+    with DevicePortalServer(recording.parent) as server:
+        failed = download_files([(server.file_url(RECORDING_NAME, 'pv.txt'), workspace / 'pv.txt', len(source))],
+                                chunk_size=CHUNK_SIZE)
+        assert server.served_bytes == len(source)
+    assert failed == []
+    assert (workspace / 'pv.txt').read_bytes() == source
+
+
+def test_corrupted_tar_is_not_kept(recording, tmp_path):
+    tar_path = recording / 'Depth AHaT.tar'
+    data = bytearray(tar_path.read_bytes())
+    # Second member header
+    second_header = 512 + (50000 + 511) // 512 * 512
+    data[second_header] ^= 1
+    tar_path.write_bytes(bytes(data))
+
+    workspace = tmp_path / 'workspace'
+    with DevicePortalServer(recording.parent) as server:
+        failed = download_files(get_downloads(server, recording, workspace), chunk_size=CHUNK_SIZE)
+    assert failed == [workspace / 'Depth AHaT.tar']
+    assert not (workspace / 'Depth AHaT.tar').exists()
+    # The next download starts over
+    assert not list(workspace.glob('Depth AHaT.tar.part*'))
+
+
+def test_recorder_console_download(recording, tmp_path):
+    # recorder_console imports the conversion, which needs open3d
+    pytest.importorskip('open3d')
+    from recorder_console import DevicePortalBrowser
+
+    workspace = tmp_path / 'workspace'
+    workspace.mkdir()
+    with DevicePortalServer(recording.parent, disconnect_rate=0.3) as server:
+        browser = DevicePortalBrowser()
+        browser.connect(server.url.replace('http://', ''), 'user', 'password')
+        assert browser.recording_names == [RECORDING_NAME]
+        browser.download_recording(0, workspace)
+    assert_downloaded(recording, workspace / RECORDING_NAME)
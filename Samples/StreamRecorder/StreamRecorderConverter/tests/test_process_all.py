@@ -0,0 +1,41 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import shutil
+
+from organized_cloud import ORGANIZED_CLOUD_EXTENSION
+from process_all_benchmark import DiskSampler, get_folder_size, read_outputs, run_process_all, write_recording
+from tsdf_fusion_benchmark import SENSOR_NAME
+
+N_FRAMES = 6
+
+
+def test_streamed_matches_extracted(tmp_path):
+    source = tmp_path / 'source'
+    write_recording(source, N_FRAMES, 64, 48)
+    recording_size = get_folder_size(source)
+    streamed = tmp_path / 'stream'
+    extracted = tmp_path / 'extract'
+    shutil.copytree(source, streamed)
+    shutil.copytree(source, extracted)
+
+    with DiskSampler(streamed, interval=0.001) as streamed_disk:
+        run_process_all(streamed, extract=False)
+    with DiskSampler(extracted, interval=0.001) as extracted_disk:
+        run_process_all(extracted, extract=True)
+
+    outputs = read_outputs(streamed)
+    assert len([name for name in outputs if name.endswith('.png') and name.startswith('PV')]) == N_FRAMES
+    assert len([name for name in outputs if name.endswith(ORGANIZED_CLOUD_EXTENSION)]) == N_FRAMES
+    assert outputs == read_outputs(extracted)
+
+    # No raw frame written to disk when streaming
+    assert not list((streamed / 'PV').glob('*.bytes'))
+    assert not list((streamed / SENSOR_NAME).glob('*.pgm'))
+    assert list((extracted / SENSOR_NAME).glob('*.pgm'))
+    assert recording_size < streamed_disk.peak < extracted_disk.peak
@@ -0,0 +1,148 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import cv2
+import numpy as np
+
+from project_hand_eye_to_pv import (compute_hand_eye_annotations, get_eye_gaze_point,
+                                    project_world_points, to_pixel)
+
+WIDTH = 1920
+HEIGHT = 1080
+PRINCIPAL_POINT = np.array([959.5, 539.25])
+FIRST_TIMESTAMP = 132552243331225839
+JOINT_COUNT = 26
+
+
+def get_random_poses(rng, n_frames):
+    """Camera to world transforms, looking towards the origin from about 1m"""
+    poses = np.zeros((n_frames, 4, 4))
+    for i_frame in range(n_frames):
+        rotation, _ = cv2.Rodrigues(rng.normal(0, 0.3, 3))
+        poses[i_frame, :3, :3] = rotation
+        poses[i_frame, :3, 3] = -rotation[:, 2] + rng.normal(0, 0.1, 3)
+        poses[i_frame, 3, 3] = 1
+    return poses
+
+
+def project_with_opencv(point, pv2world_transform, focal_length):
+    """Projection of the script before it was batched, before mirroring"""
+    K = np.array([[focal_length[0], 0, PRINCIPAL_POINT[0]],
+                  [0, focal_length[1], PRINCIPAL_POINT[1]],
+                  [0, 0, 1]])
+    Rt = np.linalg.inv(pv2world_transform)
+    rvec, _ = cv2.Rodrigues(Rt[:3, :3])
+    xy, _ = cv2.projectPoints(point.reshape((1, 3)), rvec, Rt[:3, 3], K, None)
+    return xy[0, 0]
+
+
+def test_projection_matches_opencv():
+    rng = np.random.default_rng(0)
+    n_frames = 50
+    pv2world_transforms = get_random_poses(rng, n_frames)
+    focal_lengths = rng.uniform(1400, 1500, (n_frames, 2))
+    points = rng.normal(0, 0.3, (n_frames, 20, 3))
+
+    xy, in_front, valid_pose = project_world_points(points, pv2world_transforms, focal_lengths,
+                                                    PRINCIPAL_POINT, WIDTH)
+    assert valid_pose.all() and in_front.all()
+    for i_frame in range(n_frames):
+        for i_point in range(points.shape[1]):
+            reference = project_with_opencv(points[i_frame, i_point], pv2world_transforms[i_frame],
+                                            focal_lengths[i_frame])
+            assert np.all(np.abs(xy[i_frame, i_point] - [WIDTH - reference[0], reference[1]]) < 1e-8)
+            # Drawn at the same pixel
+            assert to_pixel(xy[i_frame, i_point], WIDTH) == (WIDTH - int(reference[0]), int(reference[1]))
+
+
+def test_points_behind_camera_and_missing_poses():
+    rng = np.random.default_rng(1)
+    pv2world_transforms = get_random_poses(rng, 3)
+    pv2world_transforms[1] = 0
+    focal_lengths = np.full((3, 2), 1450.)
+    camera_positions = pv2world_transforms[:, :3, 3]
+    forward = pv2world_transforms[:, :3, 2]
+    points = np.stack([camera_positions + forward, camera_positions - forward], axis=1)
+
+    _, in_front, valid_pose = project_world_points(points, pv2world_transforms, focal_lengths,
+                                                   PRINCIPAL_POINT, WIDTH)
+    assert valid_pose.tolist() == [True, False, True]
+    assert in_front.tolist() == [[True, False], [False, False], [True, False]]
+
+
+def format_row(values):
+    return ','.join('%.17g' % value for value in values)
+
+
+def write_session(folder, rng, n_frames):
+    """Head/hand/eye log and PV pose log of a session, one hand/eye sample per
+    PV frame, 1 ms after it. Returns the PV frame timestamps."""
+    pv_timestamps = FIRST_TIMESTAMP + 333333 * np.arange(n_frames)
+    pv2world_transforms = get_random_poses(rng, n_frames)
+    # Frames without a pose
+    pv2world_transforms[[3, 7]] = 0
+    with open(folder / '2021-01-01-000000_pv.txt', 'w') as f:
+        f.write('{},{},{},{}\n'.format(*PRINCIPAL_POINT, WIDTH, HEIGHT))
+        for timestamp, pv2world in zip(pv_timestamps, pv2world_transforms):
+            f.write('%d,' % timestamp + format_row(np.concatenate([[1450.5, 1451.25], pv2world.reshape(-1)])) + '\n')
+
+    with open(folder / '2021-01-01-000000_head_hand_eye.csv', 'w') as f:
+        for timestamp in pv_timestamps + 10000:
+            row = np.zeros(861)
+            row[0] = timestamp
+            row[1:17] = np.eye(4).reshape(-1)
+            for flag_id in [17, 17 + JOINT_COUNT * 16 + 1]:
+                row[flag_id] = float(rng.random() < 0.8)
+                for i_joint in range(JOINT_COUNT):
+                    joint = np.eye(4)
+                    # Some joints behind the cameras
+                    joint[:3, 3] = rng.normal(0, 0.4, 3)
+                    row[flag_id + 1 + 16 * i_joint:flag_id + 17 + 16 * i_joint] = joint.reshape(-1)
+            row[851] = float(rng.random() < 0.8)
+            row[852:860] = np.concatenate([rng.normal(0, 0.1, 3), [1], rng.normal(0, 1, 3), [0]])
+            row[860] = rng.uniform(0.5, 2)
+            f.write(format_row(row) + '\n')
+    return pv_timestamps
+
+
+def test_annotations_match_opencv(tmp_path):
+    rng = np.random.default_rng(2)
+    pv_timestamps = write_session(tmp_path, rng, 30)
+    annotations = compute_hand_eye_annotations(tmp_path)
+    assert np.array_equal(annotations['pv_timestamps'], pv_timestamps)
+    # The hand/eye log timestamps are parsed as float64
+    assert np.all(np.abs(annotations['hand_timestamps'] - (pv_timestamps + 10000)) <= 16)
+    assert annotations['width'] == WIDTH and annotations['height'] == HEIGHT
+
+    hand_data = np.loadtxt(tmp_path / '2021-01-01-000000_head_hand_eye.csv', delimiter=',')
+    pv_data = np.loadtxt(tmp_path / '2021-01-01-000000_pv.txt', delimiter=',', skiprows=1)
+    n_visible = 0
+    for i_frame, (frame, pv_frame) in enumerate(zip(hand_data, pv_data)):
+        pv2world = pv_frame[3:19].reshape((4, 4))
+        assert annotations['valid_pose'][i_frame] == (i_frame not in (3, 7))
+        if not annotations['valid_pose'][i_frame]:
+            assert not annotations['left_hand_visible'][i_frame].any()
+            continue
+
+        world2pv = np.linalg.inv(pv2world)
+        for name, flag_id in [('left_hand', 17), ('right_hand', 17 + JOINT_COUNT * 16 + 1)]:
+            for i_joint in range(JOINT_COUNT):
+                point = frame[flag_id + 1 + 16 * i_joint:flag_id + 17 + 16 * i_joint].reshape((4, 4))[:3, 3]
+                in_front = (world2pv[:3, :3] @ point + world2pv[:3, 3])[2] > 0
+                visible = annotations[name + '_visible'][i_frame, i_joint]
+                assert visible == (frame[flag_id] == 1 and in_front)
+                if visible:
+                    reference = project_with_opencv(point, pv2world, pv_frame[1:3])
+                    xy = annotations[name][i_frame, i_joint]
+                    assert np.all(np.abs(xy - [WIDTH - reference[0], reference[1]]) < 1e-6)
+                    n_visible += 1
+
+        if annotations['gaze_visible'][i_frame]:
+            reference = project_with_opencv(get_eye_gaze_point(frame[852:861]), pv2world, pv_frame[1:3])
+            assert np.all(np.abs(annotations['gaze'][i_frame] - [WIDTH - reference[0], reference[1]]) < 1e-6)
+    assert n_visible > 100
@@ -0,0 +1,117 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import numpy as np
+import pytest
+
+from projection_benchmark import make_frame, project_on_depth_per_point, project_on_pv_per_point
+from utils import project_on_depth, project_on_pv, project_points, render_zbuffer, transform_points
+
+
+def render_zbuffer_per_point(xy, z, width, height, splat_size):
+    """The closest point of each pixel, one point at a time"""
+    pixels = np.around(xy).astype(int)
+    depth_image = np.zeros((height, width))
+    index_image = np.full((height, width), -1)
+    for i, (x, y) in enumerate(pixels):
+        if index_image[y, x] < 0 or z[i] < z[index_image[y, x]]:
+            index_image[y, x] = i
+
+    radius = splat_size // 2
+    for y, x in zip(*np.nonzero(index_image >= 0)):
+        d = z[index_image[y, x]]
+        window = depth_image[max(y - radius, 0):y + radius + 1, max(x - radius, 0):x + radius + 1]
+        window[(window == 0) | (window > d)] = d
+    return depth_image, index_image
+
+
+@pytest.mark.parametrize('splat_size', [1, 3, 5])
+def test_render_zbuffer_matches_per_point(splat_size):
+    rng = np.random.default_rng(31)
+    width, height = 40, 30
+    xy = rng.uniform([-0.49, -0.49], [width - 0.51, height - 0.51], (2000, 2))
+    z = rng.uniform(0.5, 4, len(xy))
+
+    depth_image, index_image = render_zbuffer(xy, z, width, height, splat_size)
+    reference_depth, reference_index = render_zbuffer_per_point(xy, z, width, height, splat_size)
+    assert np.array_equal(index_image, reference_index)
+    assert np.allclose(depth_image, reference_depth, rtol=1e-6)
+    assert np.all((depth_image > 0) >= (index_image >= 0))
+
+
+def test_project_on_depth_matches_per_point():
+    points, _, _, _, _, _ = make_frame(160, 90)
+    rng = np.random.default_rng(32)
+    rgb = rng.uniform(0, 1, points.shape)
+    width, height = 320, 288
+    # Not the intrinsics of the depth camera, so that several points can land in the same pixel
+    intrinsic_matrix = np.array([[171., 0, 158.7], [0, 171., 145.2], [0, 0, 1]])
+
+    image, depth_image = project_on_depth(points, rgb, intrinsic_matrix, width, height)
+    reference_image, reference_depth = project_on_depth_per_point(points, rgb, intrinsic_matrix, width, height)
+
+    xy, inside = project_points(points, intrinsic_matrix, width, height)
+    pixels = np.around(xy[inside]).astype(int)
+    counts = np.zeros((height, width), dtype=int)
+    np.add.at(counts, (pixels[:, 1], pixels[:, 0]), 1)
+    assert np.any(counts == 1) and np.any(counts > 1)
+
+    # Where a single point lands, the same as the per-point loop
+    single = counts == 1
+    assert np.array_equal(depth_image[single], reference_depth[single])
+    assert np.array_equal(image[single], reference_image[single])
+    assert np.all(depth_image[counts == 0] == 0) and np.all(image[counts == 0] == 0)
+
+    # Elsewhere, the closest point rather than the last one
+    ids = np.where(inside)[0]
+    closest = np.full((height, width), np.inf)
+    np.minimum.at(closest, (pixels[:, 1], pixels[:, 0]), points[ids, 2])
+    several = counts > 1
+    assert np.array_equal(depth_image[several], closest[several])
+    assert np.all(depth_image <= np.where(reference_depth > 0, reference_depth, np.inf))
+
+
+def test_project_on_pv_matches_per_point():
+    width, height = 64, 48
+    focal_length = np.array([50., 52.])
+    principal_point = np.array([31.3, 24.6])
+    rng = np.random.default_rng(33)
+    pv_img = rng.integers(0, 256, (height, width, 3), dtype=np.uint8)
+    pv2world = np.eye(4)
+    pv2world[:3, :3] = np.linalg.qr(rng.normal(size=(3, 3)))[0]
+    pv2world[:3, 3] = [0.3, -1.2, 0.8]
+
+    # A point on the center of every pixel (mirrored in x, see project_on_pv), on a bumpy surface,
+    # where bilinear interpolation gives the nearest pixel color of the per-point loop
+    u, v = np.meshgrid(np.arange(width), np.arange(height))
+    u, v = u.reshape(-1), v.reshape(-1)
+    z = 1 + 0.2 * np.sin(u / 5.) * np.cos(v / 7.)
+    front = np.stack(((width - u - principal_point[0]) * z / focal_length[0],
+                      (v - principal_point[1]) * z / focal_length[1], z), axis=1)
+
+    # And a point behind it in one pixel out of five
+    behind_ids = np.arange(0, len(front), 5)
+    behind = front[behind_ids] * 1.5
+    points = transform_points(np.vstack((front, behind)), pv2world)
+
+    rgb, depth_image = project_on_pv(points, pv_img, pv2world, focal_length, principal_point, splat_size=1)
+    reference_rgb, reference_depth = project_on_pv_per_point(points, pv_img, pv2world, focal_length, principal_point)
+
+    n_front = len(front)
+    assert np.allclose(rgb[:n_front], reference_rgb[:n_front], atol=1e-6)
+    assert np.all(reference_rgb[:n_front].any(axis=1))
+    # The hidden points are black, where the per-point loop colored them as well
+    assert np.all(rgb[n_front:] == 0)
+    assert np.allclose(reference_rgb[n_front:], reference_rgb[behind_ids], atol=1e-6)
+
+    # The depth of the front points, where the per-point loop kept the last one written
+    assert np.allclose(depth_image[v, u], z)
+    single = np.ones(n_front, dtype=bool)
+    single[behind_ids] = False
+    assert np.allclose(reference_depth[v[single], u[single]], z[single])
+    assert np.allclose(reference_depth[v[behind_ids], u[behind_ids]], 1.5 * z[behind_ids])
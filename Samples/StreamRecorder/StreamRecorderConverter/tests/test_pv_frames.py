@@ -0,0 +1,133 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import numpy as np
+import pytest
+
+from pv_frames import (PV_ARRAY_MAGIC, PV_ENCODINGS, PvFrames, get_chunk_paths, load_pv_array_index,
+                       pv_array_entry_dtype, pv_array_header_dtype)
+from pv_frames_benchmark import FIRST_TIMESTAMP, FRAME_INTERVAL, convert_pv, write_pv_recording
+
+WIDTH = 64
+HEIGHT = 48
+# Frames 5 and 6 were dropped by the recorder
+N_FRAMES = 12
+SKIPPED_FRAMES = (5, 6)
+
+
+@pytest.fixture
+def recording(tmp_path):
+    timestamps, frames = write_pv_recording(tmp_path, N_FRAMES, WIDTH, HEIGHT, SKIPPED_FRAMES)
+    return tmp_path, timestamps, frames
+
+
+@pytest.mark.parametrize('pv_format, encoding', [('png', 'png'), ('array', 'png'), ('video', 'png')])
+def test_lossless_formats(recording, pv_format, encoding):
+    folder, timestamps, frames = recording
+    convert_pv(folder, pv_format, encoding, chunk_frames=4)
+
+    with PvFrames(folder) as pv_frames:
+        assert pv_frames.format == pv_format
+        assert np.array_equal(pv_frames.timestamps, timestamps)
+        # In order, then backwards and in random order
+        order = list(range(len(timestamps)))
+        for i in order + order[::-1] + list(np.random.default_rng(37).permutation(order)):
+            assert np.array_equal(pv_frames.read(timestamps[i]), frames[i])
+
+
+def test_array_index(recording):
+    folder, timestamps, frames = recording
+    convert_pv(folder, 'array', 'jpg', chunk_frames=4)
+
+    paths = get_chunk_paths(folder / 'PV', 'array')
+    assert [path.name for path in paths] == ['frames_000000.pva', 'frames_000004.pva', 'frames_000008.pva']
+    indexed = []
+    for path in paths:
+        header, entries = load_pv_array_index(path)
+        assert header['magic'] == PV_ARRAY_MAGIC and header['encoding'] == PV_ENCODINGS['jpg']
+        assert (header['width'], header['height']) == (WIDTH, HEIGHT)
+        assert header['frame_count'] == len(entries)
+        # Frames back to back after the header, then the index
+        assert entries['offset'][0] == pv_array_header_dtype.itemsize
+        assert np.array_equal(entries['offset'][1:], entries['offset'][:-1] + entries['size'][:-1])
+        assert header['index_offset'] == entries['offset'][-1] + entries['size'][-1]
+        indexed += list(entries['timestamp'])
+    assert np.array_equal(indexed, timestamps)
+
+    with PvFrames(folder) as pv_frames:
+        for i, timestamp in enumerate(timestamps):
+            image = pv_frames.read(timestamp)
+            assert image.shape == frames[i].shape
+            # Lossy, but closest to its own frame
+            errors = [np.mean(np.abs(image.astype(int) - frame)) for frame in frames]
+            assert np.argmin(errors) == i and errors[i] < 10
+
+
+@pytest.mark.parametrize('pv_format', ['png', 'array', 'video'])
+def test_missing_frame(recording, pv_format):
+    folder, timestamps, _ = recording
+    convert_pv(folder, pv_format, 'png', chunk_frames=4)
+
+    with PvFrames(folder) as pv_frames:
+        assert len(pv_frames) == N_FRAMES - len(SKIPPED_FRAMES)
+        for i in SKIPPED_FRAMES:
+            missing = FIRST_TIMESTAMP + i * FRAME_INTERVAL
+            assert missing not in pv_frames
+            assert pv_frames.read(missing) is None
+        assert pv_frames.read(timestamps[0] - 1) is None
+        # The frames around the gap are still read
+        assert timestamps[4] in pv_frames and pv_frames.read(timestamps[4]) is not None
+        assert pv_frames.read(timestamps[5]) is not None
+
+
+def truncate(path, size):
+    with open(path, 'r+b') as f:
+        f.truncate(size)
+
+
+def test_truncated_chunk(recording):
+    folder, _, _ = recording
+    convert_pv(folder, 'array', 'png', chunk_frames=4)
+    path = get_chunk_paths(folder / 'PV', 'array')[1]
+    data = path.read_bytes()
+    header, entries = load_pv_array_index(path)
+
+    # In the header, the index, and the frames (the index no longer where the header says)
+    for size in (pv_array_header_dtype.itemsize - 1,
+                 len(data) - 1,
+                 len(data) - pv_array_entry_dtype.itemsize,
+                 int(entries['offset'][2]) + 10):
+        path.write_bytes(data)
+        truncate(path, size)
+        with pytest.raises(AssertionError, match='Truncated PV chunk'):
+            load_pv_array_index(path)
+        with pytest.raises(AssertionError):
+            PvFrames(folder)
+
+    # An index pointing past its frames
+    corrupt = np.array(entries)
+    corrupt['size'][-1] += 1
+    path.write_bytes(data[:int(header['index_offset'])] + corrupt.tobytes())
+    with pytest.raises(AssertionError, match='Corrupt PV chunk index'):
+        load_pv_array_index(path)
+
+    path.write_bytes(data)
+    load_pv_array_index(path)
+
+
+def test_unfinished_chunk_ignored(recording):
+    folder, timestamps, _ = recording
+    convert_pv(folder, 'array', 'png', chunk_frames=4)
+    # A chunk being written when the conversion was stopped
+    paths = get_chunk_paths(folder / 'PV', 'array')
+    paths[-1].rename(paths[-1].with_name(paths[-1].name + '.tmp.pva'))
+
+    assert len(get_chunk_paths(folder / 'PV', 'array')) == 2
+    with PvFrames(folder) as pv_frames:
+        assert np.array_equal(pv_frames.timestamps, timestamps[:8])
+        assert pv_frames.read(timestamps[8]) is None
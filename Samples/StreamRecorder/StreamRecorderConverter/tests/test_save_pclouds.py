@@ -0,0 +1,90 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import multiprocessing
+from multiprocessing import shared_memory
+
+import numpy as np
+import pytest
+
+from save_pclouds_benchmark import clear_outputs, read_outputs, run_save_pclouds
+from shared_arrays import SharedArrays, attach_shared_arrays
+from tsdf_fusion_benchmark import SENSOR_NAME, write_synthetic_recording
+
+N_FRAMES = 12
+
+
+@pytest.fixture(scope='module')
+def recording(tmp_path_factory):
+    folder = tmp_path_factory.mktemp('recording')
+    write_synthetic_recording(folder, N_FRAMES)
+    return folder
+
+
+@pytest.mark.parametrize('workers, chunk_size', [(1, 1), (2, 5), (3, 8)])
+def test_pool_writes_serial_outputs(recording, workers, chunk_size):
+    clear_outputs(recording)
+    serial_report = run_save_pclouds(recording, 0, chunk_size)
+    serial_outputs = read_outputs(recording)
+    assert serial_report['frames'] == N_FRAMES and len(serial_outputs) == N_FRAMES
+
+    clear_outputs(recording)
+    report = run_save_pclouds(recording, workers, chunk_size)
+    assert read_outputs(recording) == serial_outputs
+    assert report['frames'] == N_FRAMES and report['points'] == serial_report['points']
+    assert report['workers'] == workers
+
+
+def test_pool_worker_error(recording, tmp_path):
+    # A LUT of another sensor fails the first frame of the workers, and stops the export
+    broken = tmp_path / 'broken'
+    broken.mkdir()
+    for path in recording.iterdir():
+        if path.is_file():
+            (broken / path.name).write_bytes(path.read_bytes())
+    lut = np.fromfile(str(broken / f'{SENSOR_NAME}_lut.bin'), dtype=np.float32)
+    lut[:-3].tofile(str(broken / f'{SENSOR_NAME}_lut.bin'))
+
+    for workers in (0, 2):
+        with pytest.raises(AssertionError):
+            run_save_pclouds(broken, workers, 2)
+    assert read_outputs(broken) == {}
+
+
+def sum_shared_arrays(descriptors):
+    arrays, blocks = attach_shared_arrays(descriptors)
+    writeable = [name for name, array in arrays.items() if array is not None and array.flags.writeable]
+    sums = {name: None if array is None else array.sum() for name, array in arrays.items()}
+    del arrays
+    for block in blocks:
+        block.close()
+    return sums, writeable
+
+
+def test_shared_arrays_in_workers():
+    rng = np.random.default_rng(28)
+    arrays = {'lut': rng.normal(size=(320 * 288, 3)).astype(np.float32),
+              'timestamps': np.arange(10, dtype=np.int64),
+              'empty': np.zeros((0, 4, 4)),
+              'missing': None}
+    with SharedArrays(arrays) as shared:
+        for name, array in arrays.items():
+            assert array is None and shared.arrays[name] is None or np.array_equal(shared.arrays[name], array)
+        with multiprocessing.Pool(2) as pool:
+            results = pool.map(sum_shared_arrays, [shared.descriptors] * 4)
+        names = [block.name for block in shared._blocks]
+
+    for sums, writeable in results:
+        assert writeable == []
+        assert sums['missing'] is None
+        for name in ('lut', 'timestamps', 'empty'):
+            assert sums[name] == arrays[name].sum()
+    # The owner unlinks the blocks
+    for name in names:
+        with pytest.raises(FileNotFoundError):
+            shared_memory.SharedMemory(name=name)
@@ -0,0 +1,77 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import io
+import tarfile
+
+import numpy as np
+import pytest
+
+from stream_tar import BoundedPool, decode_pgm, iter_chunks, iter_tar_members
+
+
+def fail_on(value, failing_value):
+    if value == failing_value:
+        raise ValueError('task %d failed' % value)
+    return value
+
+
+def test_iter_tar_members(tmp_path):
+    tar_path = tmp_path / 'frames.tar'
+    with tarfile.open(str(tar_path), 'w') as tar:
+        for name in ['1000.pgm', '1000_ab.pgm', 'lut.bin', '2000.pgm']:
+            data = name.encode()
+            info = tarfile.TarInfo(name)
+            info.size = len(data)
+            tar.addfile(info, io.BytesIO(data))
+
+    members = list(iter_tar_members(tar_path, r'^\d+\.pgm$'))
+    assert members == [('1000.pgm', b'1000.pgm'), ('2000.pgm', b'2000.pgm')]
+    assert len(list(iter_tar_members(tar_path))) == 4
+
+
+def test_iter_chunks():
+    assert list(iter_chunks(range(7), 3)) == [[0, 1, 2], [3, 4, 5], [6]]
+    assert list(iter_chunks([], 3)) == []
+
+
+def test_decode_pgm():
+    image = np.arange(12, dtype=np.uint16).reshape((3, 4)) * 1000
+    data = b'P5\n4 3\n65535\n' + image.astype('>u2').tobytes()
+    assert np.array_equal(decode_pgm(data), image)
+
+
+def test_bounded_pool_results():
+    results = []
+    with BoundedPool(2, 4) as pool:
+        for value in range(50):
+            pool.submit(fail_on, (value, -1), results.append)
+    assert sorted(results) == list(range(50))
+
+
+def test_bounded_pool_stops_producer_on_task_error():
+    submitted = 0
+    with pytest.raises(ValueError, match='task 3 failed'):
+        with BoundedPool(2, 4) as pool:
+            for value in range(100000):
+                pool.submit(fail_on, (value, 3))
+                submitted += 1
+    # The producer stops within a few tasks, not at the end of the input
+    assert submitted < 1000
+
+
+def test_bounded_pool_reports_callback_error():
+    def callback(value):
+        if value == 5:
+            raise RuntimeError('callback failed')
+
+    # Would hang in close() if the error escaped on the result thread
+    with pytest.raises(RuntimeError, match='callback failed'):
+        with BoundedPool(2, 4) as pool:
+            for value in range(100000):
+                pool.submit(fail_on, (value, -1), callback)
@@ -0,0 +1,206 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import io
+import shutil
+import struct
+import subprocess
+import tarfile
+from pathlib import Path
+
+import numpy as np
+import pytest
+
+from tar_index import (TAR_INDEX_MAGIC, TAR_INDEX_VERSION, find_member, get_index_path, get_tar_index,
+                       hash_member_name, load_frame_timestamps, load_tar_index, parse_timestamp, read_member,
+                       rebuild_tar_index)
+
+APP_DIR = Path(__file__).resolve().parents[2] / 'StreamRecorderApp'
+FIRST_TIMESTAMP = 132552243331225839
+
+# Rebuilds the index of a tarball with the recorder's TarIndex.cpp
+REBUILD_SOURCE = r'''
+#include <iostream>
+#include "TarIndex.h"
+
+int main(int argc, char** argv)
+{
+    if (argc != 3)
+    {
+        return 2;
+    }
+    const int64_t memberCount = Io::RebuildTarIndex(argv[1], argv[2]);
+    std::cout << memberCount << std::endl;
+    return memberCount < 0 ? 1 : 0;
+}
+'''
+
+# C++ layout of TarIndexHeader and TarIndexEntry (packed, little endian)
+HEADER_FORMAT = '<8sIIQ'
+ENTRY_FORMAT = '<QqQQ'
+
+
+def get_member_names(n_frames):
+    """Members as the depth recorder writes them: depth and AB frames, then a non frame file"""
+    names = []
+    for i in range(n_frames):
+        timestamp = FIRST_TIMESTAMP + 1000 * i
+        names += [f'{timestamp}.pgm', f'{timestamp}_ab.pgm']
+    return names + ['lut.bin']
+
+
+def add_members(tar_path, names, mode='w'):
+    with tarfile.open(tar_path, mode, format=tarfile.USTAR_FORMAT) as tar:
+        for name in names:
+            data = name.encode() * (1 + hash_member_name(name) % 50)
+            info = tarfile.TarInfo(name)
+            info.size = len(data)
+            tar.addfile(info, io.BytesIO(data))
+
+
+def write_cpp_index(index_path, members, entry_count=None, extra_bytes=b''):
+    """Index of (name, data offset, data size) members in the C++ layout,
+    declaring entry_count entries (all by default)"""
+    entry_count = len(members) if entry_count is None else entry_count
+    data = struct.pack(HEADER_FORMAT, TAR_INDEX_MAGIC, TAR_INDEX_VERSION, struct.calcsize(ENTRY_FORMAT),
+                       entry_count)
+    for name, offset, size in members:
+        data += struct.pack(ENTRY_FORMAT, hash_member_name(name), parse_timestamp(name), offset, size)
+    Path(index_path).write_bytes(data + extra_bytes)
+
+
+def get_tar_members(tar_path):
+    with tarfile.open(tar_path, 'r:') as tar:
+        return [(member.name, member.offset_data, member.size) for member in tar if member.isfile()]
+
+
+@pytest.fixture
+def tarball(tmp_path):
+    tar_path = tmp_path / 'Depth Long Throw.tar'
+    add_members(tar_path, get_member_names(40))
+    return tar_path
+
+
+@pytest.fixture(scope='module')
+def cpp_rebuild(tmp_path_factory):
+    """Path of a program rebuilding an index with TarIndex.cpp"""
+    compiler = shutil.which('c++') or shutil.which('g++') or shutil.which('clang++')
+    if compiler is None:
+        pytest.skip('no C++ compiler')
+    folder = tmp_path_factory.mktemp('cpp')
+    source = folder / 'rebuild_tar_index.cpp'
+    source.write_text(REBUILD_SOURCE)
+    program = folder / 'rebuild_tar_index'
+    subprocess.run([compiler, '-std=c++17', '-O1', f'-I{APP_DIR}', str(source), str(APP_DIR / 'TarIndex.cpp'),
+                    '-o', str(program)], check=True)
+    return program
+
+
+def check_index(tar_path, entries):
+    """The entries are those of every member of the tarball, sorted by timestamp"""
+    members = get_tar_members(tar_path)
+    assert len(entries) == len(members)
+    assert np.all(np.diff(entries['timestamp']) >= 0)
+    with open(tar_path, 'rb') as f:
+        for name, offset, size in members:
+            entry = find_member(entries, name)
+            assert (entry['data_offset'], entry['data_size']) == (offset, size)
+            assert read_member(f, entry) == name.encode() * (1 + hash_member_name(name) % 50)
+
+
+def test_reads_cpp_layout(tarball):
+    write_cpp_index(get_index_path(tarball), get_tar_members(tarball))
+    entries = load_tar_index(tarball)
+    check_index(tarball, entries)
+    # Members without a timestamp first
+    assert find_member(entries, 'lut.bin')['timestamp'] == -1 == entries['timestamp'][0]
+
+    # Same bytes as the index written by tar_index.py
+    cpp_index = get_index_path(tarball).read_bytes()
+    rebuild_tar_index(tarball)
+    assert get_index_path(tarball).read_bytes() == cpp_index
+
+
+def test_reads_index_written_by_the_recorder_code(tarball, cpp_rebuild):
+    index_path = get_index_path(tarball)
+    output = subprocess.run([str(cpp_rebuild), str(tarball), str(index_path)], check=True,
+                            capture_output=True, text=True).stdout
+    assert int(output) == len(get_member_names(40))
+    check_index(tarball, load_tar_index(tarball))
+
+    cpp_index = index_path.read_bytes()
+    rebuild_tar_index(tarball)
+    assert index_path.read_bytes() == cpp_index
+
+
+def test_recording_stopped_between_flushes(tarball):
+    members = get_tar_members(tarball)
+    index_path = get_index_path(tarball)
+
+    # The header only counts the entries of the last flush, a partial entry follows
+    write_cpp_index(index_path, members[:64], entry_count=64, extra_bytes=b'\1' * 20)
+    last_offset, last_size = members[63][1:]
+    end = last_offset + -(-last_size // 512) * 512
+    # Valid if the tarball stops there too
+    data = tarball.read_bytes()
+    tarball.write_bytes(data[:end])
+    assert len(load_tar_index(tarball)) == 64
+
+    # Stale if the tarball has more members, rebuilt with all of them
+    tarball.write_bytes(data)
+    assert load_tar_index(tarball) is None
+    check_index(tarball, get_tar_index(tarball))
+    check_index(tarball, load_tar_index(tarball))
+
+
+def test_stale_index_rebuilt(tarball):
+    rebuild_tar_index(tarball)
+    # Members appended after the index was written
+    add_members(tarball, [f'{FIRST_TIMESTAMP + 100000}.pgm', f'{FIRST_TIMESTAMP - 1}.pgm'], mode='a')
+    assert load_tar_index(tarball) is None
+    # Not used to list the frames either
+    assert len(load_frame_timestamps(tarball, '.pgm')) == 42
+
+    entries = get_tar_index(tarball)
+    check_index(tarball, entries)
+    assert entries['timestamp'][1] == FIRST_TIMESTAMP - 1
+
+
+@pytest.mark.parametrize('corruption', ['magic', 'entry_size', 'name_hash', 'data_size', 'offset',
+                                        'past_end', 'other_tarball'])
+def test_corrupt_index_rebuilt(tarball, corruption):
+    members = get_tar_members(tarball)
+    index_path = get_index_path(tarball)
+    write_cpp_index(index_path, members)
+    data = bytearray(index_path.read_bytes())
+    header_size = struct.calcsize(HEADER_FORMAT)
+    last_entry = header_size + (len(members) - 1) * struct.calcsize(ENTRY_FORMAT)
+
+    if corruption == 'magic':
+        data[0] ^= 1
+    elif corruption == 'entry_size':
+        data[12] = 24
+    elif corruption == 'name_hash':
+        data[last_entry] ^= 1
+    elif corruption == 'data_size':
+        data[last_entry + 24] ^= 1
+    elif corruption == 'offset':
+        # Points at the member data instead of past its header
+        struct.pack_into('<Q', data, last_entry + 16, members[-1][1] - 512)
+    elif corruption == 'past_end':
+        struct.pack_into('<Q', data, header_size + 16, tarball.stat().st_size)
+    else:
+        other = tarball.with_name('other.tar')
+        add_members(other, get_member_names(10))
+        rebuild_tar_index(other)
+        data = get_index_path(other).read_bytes()
+    index_path.write_bytes(bytes(data))
+
+    assert load_tar_index(tarball) is None
+    check_index(tarball, get_tar_index(tarball))
+    check_index(tarball, load_tar_index(tarball))
@@ -0,0 +1,106 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import numpy as np
+import pytest
+
+from project_hand_eye_to_pv import match_timestamp
+from timestamp_matching import TimestampIndex
+
+
+def make_stream(rng, n_frames, interval=333333, jitter=20000):
+    """Recording-like timestamps (100 ns ticks), in order, with jitter and a few repeated ones"""
+    timestamps = 132552243331225839 + np.arange(n_frames) * interval + rng.integers(-jitter, jitter, n_frames)
+    timestamps = np.sort(timestamps)
+    timestamps[5::17] = timestamps[4::17][:len(timestamps[5::17])]
+    return timestamps
+
+
+def test_nearest_matches_argmin():
+    rng = np.random.default_rng(29)
+    timestamps = make_stream(rng, 500)
+    # Targets of another stream, with some at exact timestamps and some outside of the stream
+    targets = np.concatenate([make_stream(rng, 700, interval=222222),
+                              timestamps[::7],
+                              [timestamps[0] - 10 ** 7, timestamps[-1] + 10 ** 7]])
+
+    index = TimestampIndex(timestamps)
+    ids = index.nearest(targets)
+    assert ids.dtype.kind == 'i'
+    assert np.array_equal(ids, [match_timestamp(target, timestamps) for target in targets])
+
+
+def test_nearest_ties():
+    # Halfway between two frames, and between repeated timestamps: the earlier frame, as argmin gives it
+    timestamps = np.array([100, 200, 200, 300, 400])
+    index = TimestampIndex(timestamps)
+    targets = np.array([150, 200, 250, 350])
+    assert np.array_equal(index.nearest(targets), [0, 1, 1, 3])
+    assert np.array_equal(index.nearest(targets), [match_timestamp(target, timestamps) for target in targets])
+
+    # Unsorted streams still go to the earlier timestamp, where argmin goes to the first one in the array
+    shuffled = np.array([300, 100, 200])
+    index = TimestampIndex(shuffled)
+    assert index.nearest(250) == 2
+    assert match_timestamp(250, shuffled) == 0
+    assert abs(shuffled[index.nearest(250)] - 250) == abs(shuffled[match_timestamp(250, shuffled)] - 250)
+
+
+def test_nearest_unsorted_matches_argmin_distance():
+    rng = np.random.default_rng(30)
+    timestamps = rng.permutation(make_stream(rng, 300))
+    targets = rng.integers(timestamps.min() - 10 ** 6, timestamps.max() + 10 ** 6, 1000)
+    ids = TimestampIndex(timestamps).nearest(targets)
+    reference = np.array([match_timestamp(target, timestamps) for target in targets])
+    assert np.array_equal(np.abs(timestamps[ids] - targets), np.abs(timestamps[reference] - targets))
+
+
+def test_out_of_range():
+    timestamps = np.array([1000, 2000, 3000])
+    index = TimestampIndex(timestamps)
+    assert np.array_equal(index.nearest([-5, 0, 999, 3001, 10 ** 9]), [0, 0, 0, 2, 2])
+    assert np.array_equal(index.within([-5, 999, 3001, 10 ** 9], 1), [-1, 0, 2, -1])
+    assert np.array_equal(index.within([1000, 1500, 2999], 0), [0, -1, -1])
+
+
+def test_within_matches_argmin():
+    rng = np.random.default_rng(31)
+    timestamps = make_stream(rng, 400)
+    targets = make_stream(rng, 600, interval=222222)
+    tolerance = 50000
+    ids = TimestampIndex(timestamps).within(targets, tolerance)
+    for target, i in zip(targets, ids):
+        reference = match_timestamp(target, timestamps)
+        expected = reference if abs(timestamps[reference] - target) <= tolerance else -1
+        assert i == expected
+    assert np.any(ids < 0) and np.any(ids >= 0)
+
+
+def test_empty_stream():
+    index = TimestampIndex(np.array([], dtype=np.int64))
+    assert len(index) == 0
+    assert np.array_equal(index.within(np.array([1, 2, 3]), 10), [-1, -1, -1])
+    assert index.within(5, 10) == -1
+    with pytest.raises(AssertionError):
+        index.nearest(5)
+    with pytest.raises(ValueError):
+        match_timestamp(5, [])
+
+    # No targets
+    index = TimestampIndex(np.array([1, 2, 3]))
+    assert len(index.nearest(np.array([], dtype=np.int64))) == 0
+    assert len(index.within(np.array([], dtype=np.int64), 0)) == 0
+
+
+def test_scalar_queries():
+    timestamps = np.array([10, 20, 30])
+    index = TimestampIndex(timestamps)
+    assert np.ndim(index.nearest(24)) == 0 and index.nearest(24) == 1
+    assert np.ndim(index.within(26, 1)) == 0 and index.within(26, 1) == -1
+    before, after, weight = index.bracket(25)
+    assert (before, after, weight) == (1, 2, 0.5)
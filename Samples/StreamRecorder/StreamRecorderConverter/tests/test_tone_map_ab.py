@@ -0,0 +1,126 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import io
+import tarfile
+
+import cv2
+import numpy as np
+import pytest
+
+from tone_map_ab import (get_histogram, get_histogram_range, get_tone_mapping_lut, tone_map,
+                         tone_map_ab)
+
+SENSOR_NAME = 'Depth Long Throw'
+FIRST_TIMESTAMP = 132552243331225839
+
+
+def get_ab_frame(rng, brightness, shape=(288, 320)):
+    """Long tailed AB values, as seen on a scene with a few reflective objects"""
+    img = rng.lognormal(np.log(brightness), 0.8, shape)
+    return np.clip(img, 0, 65535).astype(np.uint16)
+
+
+def write_ab_frames(folder, n_frames, extracted=False):
+    """AB frames (and depth frames) of a depth sensor, getting brighter over the session"""
+    rng = np.random.default_rng(0)
+    frames = {f'{FIRST_TIMESTAMP + 2000000 * i}_ab.pgm': get_ab_frame(rng, 100 * (1 + i))
+              for i in range(n_frames)}
+    depth = cv2.imencode('.pgm', np.zeros((288, 320), np.uint16))[1].tobytes()
+    if extracted:
+        (folder / SENSOR_NAME).mkdir()
+        for name, img in frames.items():
+            cv2.imwrite(str(folder / SENSOR_NAME / name), img)
+            (folder / SENSOR_NAME / name.replace('_ab', '')).write_bytes(depth)
+        return frames
+
+    with tarfile.open(folder / f'{SENSOR_NAME}.tar', 'w') as tar:
+        for name, img in frames.items():
+            for member_name, data in [(name.replace('_ab', ''), depth),
+                                      (name, cv2.imencode('.pgm', img)[1].tobytes())]:
+                info = tarfile.TarInfo(member_name)
+                info.size = len(data)
+                tar.addfile(info, io.BytesIO(data))
+    return frames
+
+
+def load_output(folder, name):
+    return cv2.imread(str(folder / SENSOR_NAME / name.replace('.pgm', '.png')), -1)
+
+
+@pytest.mark.parametrize('percentiles', [(1., 99.), (0., 100.), (5., 95.), (50., 50.)])
+def test_histogram_range_matches_percentile(percentiles):
+    rng = np.random.default_rng(1)
+    img = get_ab_frame(rng, 500)
+    low, high = get_histogram_range(get_histogram(img), *percentiles)
+    expected_low, expected_high = np.percentile(img, percentiles, method='inverted_cdf')
+    assert low == expected_low
+    assert high == max(expected_high, expected_low + 1)
+
+
+@pytest.mark.parametrize('curve', ['gamma', 'log'])
+def test_lut_range(curve):
+    low, high = 200, 3000
+    lut = get_tone_mapping_lut(low, high, curve)
+    assert lut.dtype == np.uint8 and len(lut) == 65536
+    assert np.all(lut[:low + 1] == 0)
+    assert np.all(lut[high:] == 255)
+    assert np.all(np.diff(lut.astype(np.int64)) >= 0)
+
+    if curve == 'gamma':
+        # Same as clipping, scaling and applying the gamma in float, up to the rounding
+        values = np.arange(65536)
+        expected = np.clip((values - low) / (high - low), 0, 1) ** (1 / 2.2) * 255
+        assert np.max(np.abs(lut - expected)) <= 0.5 + 1e-9
+
+
+def test_session_range(tmp_path):
+    frames = write_ab_frames(tmp_path, 20)
+    done = {}
+    report = tone_map_ab(tmp_path, SENSOR_NAME, 'session', workers=2, chunk_size=3,
+                         on_frame_done=lambda name, output_path: done.setdefault(name, output_path))
+    assert report['frames'] == 20
+    assert sorted(done) == sorted(name[:-4] for name in frames)
+
+    session_histogram = sum(get_histogram(img) for img in frames.values())
+    assert tuple(report['range']) == get_histogram_range(session_histogram)
+
+    # An AB value has the same 8 bit value in every frame
+    inputs = np.concatenate([img.reshape(-1) for img in frames.values()])
+    outputs = np.concatenate([load_output(tmp_path, name).reshape(-1) for name in frames])
+    assert np.array_equal(outputs, tone_map(inputs, get_tone_mapping_lut(*report['range'])))
+    order = np.argsort(inputs, kind='stable')
+    assert np.all(np.diff(outputs[order].astype(np.int64)) >= 0)
+
+    # The darkest frames are darker than the brightest ones
+    names = list(frames)
+    assert load_output(tmp_path, names[0]).mean() < load_output(tmp_path, names[-1]).mean()
+
+
+@pytest.mark.parametrize('extracted', [False, True])
+def test_frame_range(tmp_path, extracted):
+    frames = write_ab_frames(tmp_path, 10, extracted)
+    report = tone_map_ab(tmp_path, SENSOR_NAME, 'frame', workers=1, chunk_size=4)
+    assert report['frames'] == 10 and report['range'] is None
+
+    for name, img in frames.items():
+        output = load_output(tmp_path, name)
+        assert output.shape == img.shape and output.dtype == np.uint8
+        # Every frame is stretched to its own range
+        assert np.percentile(output, 1, method='inverted_cdf') == 0
+        assert np.percentile(output, 99, method='inverted_cdf') == 255
+
+
+def test_done_frames_are_skipped(tmp_path):
+    frames = write_ab_frames(tmp_path, 6)
+    names = [name[:-4] for name in frames]
+    done = []
+    report = tone_map_ab(tmp_path, SENSOR_NAME, 'frame', workers=1, done_frames={names[0]: None, names[3]: None},
+                         on_frame_done=lambda name, output_path: done.append(name))
+    assert report['frames'] == 4
+    assert sorted(done) == sorted(names[1:3] + names[4:])
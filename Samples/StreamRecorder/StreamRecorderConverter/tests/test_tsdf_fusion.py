@@ -0,0 +1,126 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import numpy as np
+import pytest
+
+from tsdf_fusion import (BLOCK_SIZE, CUBE_CORNERS, CUBE_EDGES, CUBE_TRIANGLE_COUNTS, CUBE_TRIANGLES,
+                         TsdfFusion, TsdfVolume, fuse_depth, load_mesh_ply, merge_block_meshes,
+                         pack_keys)
+from tsdf_fusion_benchmark import (SENSOR_NAME, get_camera_pose, get_pinhole_lut, render_depth,
+                                   scene_distance, write_synthetic_recording)
+
+
+def fill_volume(volume, sdf_function, first_block, last_block):
+    """Set the voxels of the blocks from first_block to last_block (included)
+    to a signed distance function of their center (meters)"""
+    side = BLOCK_SIZE + 1
+    blocks = np.stack(np.meshgrid(*[np.arange(first_block, last_block + 1)] * 3, indexing='ij'),
+                      axis=-1).reshape((-1, 3))
+    slots = volume._allocate(pack_keys(blocks))
+    local = np.stack(np.unravel_index(np.arange(side ** 3), (side,) * 3), axis=-1)
+    centers = (blocks[:, np.newaxis, :] * BLOCK_SIZE + local + 0.5) * volume.voxel_size
+    volume.tsdf[slots] = np.clip(sdf_function(centers) / volume.truncation, -1, 1)
+    volume.weight[slots] = 1
+    volume.dirty.update(slots.tolist())
+
+
+def check_closed_mesh(vertices, triangles):
+    """Every edge is shared by two triangles, which go through it in opposite directions"""
+    assert len(triangles) > 0
+    directed = np.concatenate([triangles[:, [0, 1]], triangles[:, [1, 2]], triangles[:, [2, 0]]])
+    assert len(np.unique(directed, axis=0)) == len(directed)
+    undirected, counts = np.unique(np.sort(directed, axis=1), axis=0, return_counts=True)
+    assert np.all(counts == 2)
+    assert len(np.unique(triangles)) == len(vertices)
+    return len(undirected)
+
+
+def get_signed_volume(vertices, triangles):
+    v0, v1, v2 = vertices[triangles[:, 0]], vertices[triangles[:, 1]], vertices[triangles[:, 2]]
+    return np.sum(np.einsum('ij,ij->i', v0, np.cross(v1, v2))) / 6
+
+
+def test_marching_cubes_cases():
+    assert CUBE_TRIANGLE_COUNTS[0] == 0 and CUBE_TRIANGLE_COUNTS[255] == 0
+    for case in range(256):
+        inside = np.array([bool(case & (1 << c)) for c in range(8)])
+        triangles = CUBE_TRIANGLES[case, :CUBE_TRIANGLE_COUNTS[case]]
+        crossed = np.where(inside[CUBE_EDGES[:, 0]] != inside[CUBE_EDGES[:, 1]])[0]
+        assert set(triangles.reshape(-1).tolist()) == set(crossed.tolist())
+
+        # With the vertices in the middle of the edges, no triangle faces the inside corners
+        midpoints = CUBE_CORNERS[CUBE_EDGES].mean(axis=1)
+        for triangle in triangles:
+            normal = np.cross(midpoints[triangle[1]] - midpoints[triangle[0]],
+                              midpoints[triangle[2]] - midpoints[triangle[0]])
+            outward = sum((CUBE_CORNERS[b] - CUBE_CORNERS[a]) * (1 if inside[a] else -1)
+                          for a, b in CUBE_EDGES[triangle])
+            assert np.dot(normal, outward) >= 0
+
+
+def test_random_field_gives_closed_mesh():
+    # Closed because the border of the filled blocks is outside
+    rng = np.random.default_rng(0)
+    volume = TsdfVolume(voxel_size=0.1)
+    grid = rng.uniform(-1, 1, (4 * BLOCK_SIZE + 1,) * 3)
+    grid[[0, -1], :, :] = grid[:, [0, -1], :] = grid[:, :, [0, -1]] = 1
+
+    def sdf(centers):
+        voxels = np.floor(centers / volume.voxel_size).astype(np.int64)
+        return grid[voxels[..., 0], voxels[..., 1], voxels[..., 2]] * volume.truncation
+
+    fill_volume(volume, sdf, 0, 3)
+    vertices, triangles = merge_block_meshes(volume.extract_dirty_meshes())
+    check_closed_mesh(vertices, triangles)
+    assert get_signed_volume(vertices, triangles) > 0
+
+
+def test_sphere_mesh():
+    voxel_size = 0.02
+    radius = 0.3
+    volume = TsdfVolume(voxel_size=voxel_size)
+    fill_volume(volume, lambda centers: np.linalg.norm(centers, axis=-1) - radius, -3, 2)
+    vertices, triangles = merge_block_meshes(volume.extract_dirty_meshes())
+
+    edge_count = check_closed_mesh(vertices, triangles)
+    assert len(vertices) - edge_count + len(triangles) == 2
+    # The triangles face the outside, so the volume is positive
+    assert get_signed_volume(vertices, triangles) == pytest.approx(4 / 3 * np.pi * radius ** 3, rel=0.01)
+    assert np.max(np.abs(np.linalg.norm(vertices, axis=1) - radius)) < 0.1 * voxel_size
+
+
+def test_incremental_meshing_matches_full_meshing():
+    lut = get_pinhole_lut()
+    n_frames = 8
+    with TsdfFusion(lut, voxel_size=0.05) as incremental, TsdfFusion(lut, voxel_size=0.05) as full:
+        for i_frame in range(n_frames):
+            cam2world = get_camera_pose(i_frame, n_frames)
+            img = render_depth(cam2world, lut)
+            incremental.integrate(img, cam2world)
+            full.integrate(img, cam2world)
+            if i_frame % 3 == 0:
+                incremental.extract_mesh()
+        vertices, triangles = incremental.extract_mesh()
+        full_vertices, full_triangles = full.extract_mesh()
+    assert np.array_equal(vertices, full_vertices)
+    assert np.array_equal(triangles, full_triangles)
+
+
+def test_fuse_depth_matches_scene(tmp_path):
+    write_synthetic_recording(tmp_path, 12)
+    output_path = tmp_path / 'mesh.ply'
+    report = fuse_depth(tmp_path, SENSOR_NAME, voxel_size=0.05, output_path=output_path)
+    assert report['frames'] == 12
+
+    vertices, triangles = load_mesh_ply(output_path)
+    assert (len(vertices), len(triangles)) == (report['vertices'], report['triangles'])
+    assert len(triangles) > 1000
+    errors = np.abs(scene_distance(vertices))
+    assert np.mean(errors) < 0.05 * 0.1
+    assert np.percentile(errors, 99) < 0.05 * 0.5
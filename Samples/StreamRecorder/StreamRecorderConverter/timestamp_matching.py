@@ -0,0 +1,104 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import numpy as np
+
+
+class TimestampIndex(object):
+    """Sorted index over the timestamps of one stream.
+
+    Built once per stream, then answers batches of queries with binary
+    searches (O(log M) per query) instead of scanning all timestamps
+    for every frame. All returned indices refer to the original
+    (unsorted) timestamps array. Scalar queries return scalars.
+    """
+
+    def __init__(self, timestamps):
+        self.timestamps = np.asarray(timestamps)
+        self.order = np.argsort(self.timestamps, kind='stable')
+        self.sorted = self.timestamps[self.order]
+
+    def __len__(self):
+        return len(self.sorted)
+
+    def _neighbours(self, targets):
+        # Positions of the sorted timestamps just before and just after each target
+        right = np.searchsorted(self.sorted, targets, side='left')
+        right = np.clip(right, 0, len(self.sorted) - 1)
+        left = np.clip(right - 1, 0, len(self.sorted) - 1)
+        return left, right
+
+    def nearest(self, targets):
+        """Index of the closest timestamp for each target.
+        Ties go to the earlier timestamp, and a repeated timestamp to its
+        first frame, as an argmin over the distances gives them."""
+        assert len(self.sorted) > 0
+        scalar = np.ndim(targets) == 0
+        targets = np.atleast_1d(targets)
+        left, right = self._neighbours(targets)
+        use_left = np.abs(targets - self.sorted[left]) <= np.abs(self.sorted[right] - targets)
+        closest = np.where(use_left, left, right)
+        # The sort is stable, so the first of equal timestamps has the lowest index
+        closest = np.searchsorted(self.sorted, self.sorted[closest], side='left')
+        ids = self.order[closest]
+        return ids[0] if scalar else ids
+
+    def within(self, targets, tolerance):
+        """Index of the closest timestamp for each target, or -1 if it is
+        further than tolerance (use 0 for exact matches)."""
+        scalar = np.ndim(targets) == 0
+        targets = np.atleast_1d(targets)
+        if len(self.sorted) == 0:
+            ids = np.full(len(targets), -1, dtype=np.int64)
+        else:
+            ids = self.nearest(targets)
+            ids = np.where(np.abs(self.timestamps[ids] - targets) <= tolerance, ids, -1)
+        return ids[0] if scalar else ids
+
+    def bracket(self, targets):
+        """Indices of the timestamps before and after each target, and the
+        interpolation weight of the later one:
+            value = (1 - weight) * values[before] + weight * values[after]
+        Targets outside of the stream are clamped to its first/last timestamp.
+        """
+        assert len(self.sorted) > 0
+        scalar = np.ndim(targets) == 0
+        targets = np.atleast_1d(targets)
+        after = np.searchsorted(self.sorted, targets, side='right')
+        after = np.clip(after, 1, len(self.sorted) - 1) if len(self.sorted) > 1 else np.zeros_like(after)
+        before = np.maximum(after - 1, 0)
+
+        span = (self.sorted[after] - self.sorted[before]).astype(np.float64)
+        weight = np.divide(targets - self.sorted[before], span,
+                           out=np.zeros(len(targets)), where=span > 0)
+        weight = np.clip(weight, 0., 1.)
+
+        before = self.order[before]
+        after = self.order[after]
+        if scalar:
+            return before[0], after[0], weight[0]
+        return before, after, weight
+
+    def duplicates(self):
+        """Timestamps that appear more than once in the stream"""
+        repeated = self.sorted[1:] == self.sorted[:-1]
+        return np.unique(self.sorted[1:][repeated])
+
+    def report(self, targets, tolerance):
+        """Summary of how well targets (e.g. another stream's timestamps)
+        can be matched to this stream"""
+        targets = np.atleast_1d(targets)
+        ids = self.within(targets, tolerance)
+        unmatched = np.where(ids < 0)[0]
+        matched = ids[ids >= 0]
+        return {'targets': len(targets),
+                'matched': len(matched),
+                'unmatched': unmatched,
+                'duplicate_timestamps': self.duplicates(),
+                # Frames of this stream used by more than one target
+                'reused': int(len(matched) - len(np.unique(matched)))}
@@ -0,0 +1,76 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import argparse
+import time
+
+import numpy as np
+
+from project_hand_eye_to_pv import match_timestamp
+from timestamp_matching import TimestampIndex
+
+# Time to match every frame of one stream to the closest frame of another,
+# with an argmin over all the timestamps for each frame (match_timestamp)
+# and with the binary searches of TimestampIndex, including its sort. For
+# recordings of a few minutes: 30 fps PV frames matched to 45 fps head
+# poses (rig2world), as save_pclouds.py and project_hand_eye_to_pv.py do.
+
+FIRST_TIMESTAMP = 132552243331225839
+TICKS_PER_SECOND = 10 ** 7
+
+
+def make_stream(rng, seconds, fps):
+    n_frames = int(seconds * fps)
+    interval = TICKS_PER_SECOND // fps
+    jitter = rng.integers(-interval // 10, interval // 10, n_frames)
+    return np.sort(FIRST_TIMESTAMP + np.arange(n_frames) * interval + jitter)
+
+
+def best_seconds(function, repeat=3):
+    best = float('inf')
+    for _ in range(repeat):
+        start = time.perf_counter()
+        result = function()
+        best = min(best, time.perf_counter() - start)
+    return best, result
+
+
+def run_benchmark(minutes, target_fps, stream_fps):
+    rng = np.random.default_rng(0)
+    print(f"{target_fps} fps targets matched to a {stream_fps} fps stream")
+    print(f"{'minutes':>8} {'targets':>9} {'argmin (s)':>12} {'index (s)':>12} {'speedup':>9}")
+    for n_minutes in minutes:
+        timestamps = make_stream(rng, 60 * n_minutes, stream_fps)
+        targets = make_stream(rng, 60 * n_minutes, target_fps)
+
+        argmin_seconds, reference = best_seconds(
+            lambda: np.array([match_timestamp(target, timestamps) for target in targets]), repeat=1)
+        index_seconds, ids = best_seconds(lambda: TimestampIndex(timestamps).nearest(targets))
+        assert np.array_equal(ids, reference)
+        print(f"{n_minutes:>8} {len(targets):>9} {argmin_seconds:>12.3f} {index_seconds:>12.5f} "
+              f"{argmin_seconds / index_seconds:>9.0f}")
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Timestamp matching benchmark')
+    parser.add_argument("--minutes",
+                        type=float,
+                        nargs='+',
+                        default=[1, 5, 20],
+                        help="Lengths of the synthetic recordings, in minutes")
+    parser.add_argument("--target_fps",
+                        type=int,
+                        default=30,
+                        help="Frame rate of the matched stream (PV)")
+    parser.add_argument("--stream_fps",
+                        type=int,
+                        default=45,
+                        help="Frame rate of the stream matched to (head poses)")
+
+    args = parser.parse_args()
+    run_benchmark(args.minutes, args.target_fps, args.stream_fps)
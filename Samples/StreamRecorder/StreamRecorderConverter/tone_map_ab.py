@@ -0,0 +1,240 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import argparse
+import multiprocessing
+import time
+from pathlib import Path
+
+import cv2
+import numpy as np
+
+from stream_tar import BoundedPool, decode_pgm, iter_chunks, iter_tar_members
+
+# Tone mapping of the 16 bit active brightness (AB) images of the depth
+# sensors to 8 bit pngs, <folder>/<sensor_name>/<timestamp>_ab.png.
+#
+# The input range is robust: it goes from the low_percentile to the
+# high_percentile of the AB values, found on a 16 bit histogram instead of
+# sorting the pixels. With range 'session', the histogram of all the frames
+# is computed in a first pass, so a given AB value has the same 8 bit value
+# in every frame. With range 'frame', each frame is stretched on its own.
+#
+# The range is then mapped to 8 bits with a gamma or log curve, tabulated
+# in a 65536 entry lookup table: converting a frame is a single gather.
+
+AB_VALUES = 1 << 16
+CURVES = ['gamma', 'log']
+RANGES = ['session', 'frame']
+DEFAULT_LOW_PERCENTILE = 1.
+DEFAULT_HIGH_PERCENTILE = 99.
+DEFAULT_GAMMA = 2.2
+DEFAULT_CHUNK_SIZE = 16
+AB_NAME_PATTERN = r'^[0-9]+_ab\.pgm$'
+
+
+def get_histogram(img):
+    """Histogram of the values of a 16 bit image, one bin per value"""
+    return np.bincount(img.reshape(-1), minlength=AB_VALUES)
+
+
+def get_histogram_range(histogram, low_percentile=DEFAULT_LOW_PERCENTILE,
+                        high_percentile=DEFAULT_HIGH_PERCENTILE):
+    """Values at the low and high percentiles of a histogram (the smallest
+    values with at least that percentage of the samples at or below them)"""
+    cumulative = np.cumsum(histogram)
+    total = cumulative[-1]
+    if total == 0:
+        return 0, AB_VALUES - 1
+    # At least one sample, so that percentile 0 is the smallest value
+    low, high = np.searchsorted(cumulative, np.maximum([total * low_percentile / 100.,
+                                                        total * high_percentile / 100.], 1))
+    return int(low), int(max(high, low + 1))
+
+
+def get_tone_mapping_lut(low, high, curve='gamma', gamma=DEFAULT_GAMMA):
+    """16 to 8 bit lookup table mapping [low, high] to [0, 255]"""
+    lut = np.zeros(AB_VALUES, dtype=np.uint8)
+    lut[high:] = 255
+    # Only the values inside the range need the curve
+    x = (np.arange(low, high, dtype=np.float64) - low) / (high - low)
+    if curve == 'log':
+        y = np.log1p(x * (high - low)) / np.log1p(high - low)
+    else:
+        y = x ** (1. / gamma)
+    lut[low:high] = np.around(y * 255.)
+    return lut
+
+
+def tone_map(img, lut):
+    return np.take(lut, img)
+
+
+def iter_ab_frames(folder, sensor_name):
+    """(name, raw pgm data or path) of the AB frames of a depth sensor, streamed
+    from the tarball when there is one, read from the extracted frames otherwise"""
+    tar_path = folder / f'{sensor_name}.tar'
+    if tar_path.exists():
+        yield from iter_tar_members(tar_path, AB_NAME_PATTERN)
+    else:
+        for path in sorted((folder / sensor_name).glob('*[0-9]_ab.pgm')):
+            yield path.name, path
+
+
+def load_ab_frame(source):
+    if isinstance(source, Path):
+        return cv2.imread(str(source), -1)
+    return decode_pgm(source)
+
+
+# Per-process state of the tone mapping workers, set by init_tone_map_worker
+worker_state = {}
+
+
+def init_tone_map_worker(config):
+    worker_state['config'] = config
+
+
+def get_chunk_histogram(frames):
+    """Sum of the histograms of a chunk of (name, source) frames"""
+    histogram = np.zeros(AB_VALUES, dtype=np.int64)
+    for _, source in frames:
+        histogram += get_histogram(load_ab_frame(source))
+    return histogram
+
+
+def tone_map_chunk(frames):
+    """Tone map and save a chunk of (name, source) frames.
+
+    Returns a list of (frame name, output path, (low, high) range)
+    """
+    config = worker_state['config']
+    results = []
+    for name, source in frames:
+        img = load_ab_frame(source)
+        if config['lut'] is not None:
+            lut = config['lut']
+            ab_range = config['range']
+        else:
+            ab_range = get_histogram_range(get_histogram(img), config['low_percentile'],
+                                           config['high_percentile'])
+            lut = get_tone_mapping_lut(*ab_range, config['curve'], config['gamma'])
+        output_path = str(config['output_folder'] / (name[:-4] + '.png'))
+        cv2.imwrite(output_path, tone_map(img, lut))
+        results.append((name[:-4], output_path, ab_range))
+    return results
+
+
+def tone_map_ab(folder, sensor_name, ab_range='session', curve='gamma', gamma=DEFAULT_GAMMA,
+                low_percentile=DEFAULT_LOW_PERCENTILE, high_percentile=DEFAULT_HIGH_PERCENTILE,
+                workers=None, chunk_size=DEFAULT_CHUNK_SIZE, done_frames=None, on_frame_done=None):
+    """Save the AB images of a depth sensor as tone mapped 8 bit pngs.
+
+    Args:
+        folder ([Path]): Recording folder
+        sensor_name ([str]): Depth sensor
+        ab_range ([str]): 'session' (one range for all the frames) or 'frame'
+        curve ([str]): 'gamma' or 'log'
+        gamma ([float]): Gamma of the gamma curve
+        low_percentile, high_percentile ([float]): Percentiles mapped to 0 and 255
+        workers ([int], optional): Number of worker processes, cpu count by default
+        chunk_size ([int]): Number of frames sent to a worker at once
+        done_frames ([dict], optional): Frames already saved, skipped
+        on_frame_done ([function], optional): Called with (name, output path)
+            for every frame saved
+
+    Returns a dictionary with the session range and throughput statistics.
+    """
+    output_folder = folder / sensor_name
+    output_folder.mkdir(exist_ok=True)
+    workers = workers or multiprocessing.cpu_count()
+    start = time.time()
+
+    lut = session_range = None
+    if ab_range == 'session':
+        histogram = np.zeros(AB_VALUES, dtype=np.int64)
+
+        def add_histogram(chunk_histogram):
+            histogram[:] += chunk_histogram
+
+        with BoundedPool(workers, 2 * workers) as pool:
+            for chunk in iter_chunks(iter_ab_frames(folder, sensor_name), chunk_size):
+                pool.submit(get_chunk_histogram, (chunk,), callback=add_histogram)
+        session_range = get_histogram_range(histogram, low_percentile, high_percentile)
+        lut = get_tone_mapping_lut(*session_range, curve, gamma)
+        print(f"{sensor_name} AB range: {session_range[0]} - {session_range[1]}")
+
+    config = {'output_folder': output_folder,
+              'lut': lut,
+              'range': session_range,
+              'curve': curve,
+              'gamma': gamma,
+              'low_percentile': low_percentile,
+              'high_percentile': high_percentile}
+    frame_ranges = []
+
+    def on_chunk_done(results):
+        for name, output_path, frame_range in results:
+            frame_ranges.append(frame_range)
+            if on_frame_done is not None:
+                on_frame_done(name, output_path)
+
+    frames = ((name, source) for name, source in iter_ab_frames(folder, sensor_name)
+              if done_frames is None or name[:-4] not in done_frames)
+    with BoundedPool(workers, 2 * workers, init_tone_map_worker, (config,)) as pool:
+        for chunk in iter_chunks(frames, chunk_size):
+            pool.submit(tone_map_chunk, (chunk,), callback=on_chunk_done)
+    seconds = time.time() - start
+
+    report = {'frames': len(frame_ranges),
+              'range': session_range,
+              'seconds': seconds,
+              'frames_per_second': len(frame_ranges) / seconds if seconds > 0 else 0.,
+              'workers': workers}
+    print(f"Saved {report['frames']} {sensor_name} AB images in {seconds:.2f}s: "
+          f"{report['frames_per_second']:.1f} frames/s with {workers} workers")
+    return report
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Tone map the AB images to 8 bit pngs')
+    parser.add_argument("--recording_path",
+                        required=True,
+                        help="Path to recording folder")
+    parser.add_argument("--range",
+                        choices=RANGES,
+                        default='session',
+                        help="session: same input range for all the frames, "
+                        "frame: range of each frame")
+    parser.add_argument("--curve",
+                        choices=CURVES,
+                        default='gamma',
+                        help="Tone curve from the input range to 8 bits")
+    parser.add_argument("--gamma",
+                        type=float,
+                        default=DEFAULT_GAMMA,
+                        help="Gamma of the gamma curve")
+    parser.add_argument("--low_percentile",
+                        type=float,
+                        default=DEFAULT_LOW_PERCENTILE,
+                        help="Percentile of the AB values mapped to 0")
+    parser.add_argument("--high_percentile",
+                        type=float,
+                        default=DEFAULT_HIGH_PERCENTILE,
+                        help="Percentile of the AB values mapped to 255")
+    parser.add_argument("--workers",
+                        type=int,
+                        default=None,
+                        help="Number of worker processes, cpu count by default")
+
+    args = parser.parse_args()
+    for sensor_name in ["Depth Long Throw", "Depth AHaT"]:
+        folder = Path(args.recording_path)
+        if (folder / f"{sensor_name}.tar").exists() or (folder / sensor_name).exists():
+            tone_map_ab(folder, sensor_name, args.range, args.curve, args.gamma,
+                        args.low_percentile, args.high_percentile, args.workers)
@@ -0,0 +1,549 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import argparse
+import time
+from pathlib import Path
+
+import numpy as np
+import cv2
+
+from stream_tar import decode_pgm, iter_tar_members
+from timestamp_matching import TimestampIndex
+from utils import load_extrinsics, load_lut, load_rig2world_transforms
+
+# TSDF fusion of depth frames, directly from the recording (depth, LUT and
+# rig2world poses), without going through the pinhole projection.
+#
+# The volume is sparse: voxels are allocated in blocks of BLOCK_SIZE^3
+# voxels, found through a hash map of the block coordinates. Each block
+# also stores a one voxel apron shared with its neighbours in +x, +y and +z,
+# so that blocks can be meshed independently of each other.
+
+BLOCK_SIZE = 8
+DEFAULT_VOXEL_SIZE = 0.04
+# Truncation distance, in voxels
+DEFAULT_TRUNCATION = 3.
+# Depth values further than this (in meters) are ignored
+DEFAULT_MAX_DEPTH = 7.8
+# Distance between two samples along a ray, in voxels
+RAY_STEP = 0.5
+# Blocks meshed at once, bounds the memory used by mesh extraction
+MESH_BATCH_BLOCKS = 512
+
+# Voxel coordinates are packed in 20 bits per axis
+KEY_BITS = 20
+KEY_OFFSET = 1 << (KEY_BITS - 1)
+KEY_MASK = (1 << KEY_BITS) - 1
+
+
+def pack_keys(coords):
+    """Pack integer (N, 3) coordinates in an int64 key"""
+    coords = coords.astype(np.int64) + KEY_OFFSET
+    return (coords[:, 0] << (2 * KEY_BITS)) | (coords[:, 1] << KEY_BITS) | coords[:, 2]
+
+
+def unpack_keys(keys):
+    keys = np.asarray(keys, dtype=np.int64)
+    return np.stack(((keys >> (2 * KEY_BITS)) & KEY_MASK,
+                     (keys >> KEY_BITS) & KEY_MASK,
+                     keys & KEY_MASK), axis=-1) - KEY_OFFSET
+
+
+# Cube corners, corner c is at offset ((c >> 2) & 1, (c >> 1) & 1, c & 1)
+CUBE_CORNERS = np.array([((c >> 2) & 1, (c >> 1) & 1, c & 1) for c in range(8)])
+
+
+# Cube edges, as (corner, corner) pairs with the lower corner first
+CUBE_EDGES = np.array([(c, c | axis) for axis in (4, 2, 1) for c in range(8) if not c & axis])
+
+
+def get_cube_faces():
+    """Corners of the 6 cube faces, in order around each face"""
+    faces = []
+    for axis, (u, v) in ((4, (2, 1)), (2, (1, 4)), (1, (4, 2))):
+        for side in (0, axis):
+            faces.append([side, side | u, side | u | v, side | v])
+    return faces
+
+
+def get_marching_cubes_cases():
+    """Triangles crossing a cube for each of the 256 inside/outside cases
+    of its corners (corner c inside if bit c of the case is set), as
+    (triangle count, (cases, triangles, 3) cube edge) tables.
+
+    The tables are built rather than typed in: on each face, the crossed
+    edges are joined in segments, the segments are chained in loops around
+    the cube and the loops are split in triangles. On a face with two
+    diagonal inside corners, each inside corner is cut off on its own.
+    This only depends on the corners of the face, so the two cubes sharing
+    a face cut it the same way and the mesh has no cracks. The triangles
+    face the outside (positive tsdf, the observed side).
+    """
+    edge_ids = {tuple(edge): i for i, edge in enumerate(CUBE_EDGES.tolist())}
+    corner_positions = CUBE_CORNERS.astype(np.float64)
+    case_triangles = []
+    for case in range(256):
+        inside = [bool(case & (1 << c)) for c in range(8)]
+
+        # Segments joining the crossed edges on each face
+        segments = []
+        for face in get_cube_faces():
+            face_edges = [edge_ids[tuple(sorted((face[i], face[(i + 1) % 4])))] for i in range(4)]
+            crossed = [i for i in range(4) if inside[face[i]] != inside[face[(i + 1) % 4]]]
+            if len(crossed) == 2:
+                segments.append((face_edges[crossed[0]], face_edges[crossed[1]]))
+            elif len(crossed) == 4:
+                # Edges i - 1 and i meet at face corner i
+                for i in range(4):
+                    if inside[face[i]]:
+                        segments.append((face_edges[i - 1], face_edges[i]))
+
+        # Every crossed edge is on two faces, so the segments form closed loops
+        neighbours = {}
+        for a, b in segments:
+            neighbours.setdefault(a, []).append(b)
+            neighbours.setdefault(b, []).append(a)
+        triangles = []
+        while neighbours:
+            loop = [min(neighbours)]
+            previous = None
+            while True:
+                following = [e for e in neighbours[loop[-1]] if e != previous]
+                previous = loop[-1]
+                if following[0] == loop[0]:
+                    break
+                loop.append(following[0])
+            for edge in loop:
+                del neighbours[edge]
+
+            # Orient the loop so that its normal points from the inside to the outside corners
+            midpoints = corner_positions[CUBE_EDGES[loop]].mean(axis=1)
+            normal = np.sum(np.cross(midpoints, np.roll(midpoints, -1, axis=0)), axis=0)
+            outward = sum(corner_positions[b] - corner_positions[a] if inside[a] else
+                          corner_positions[a] - corner_positions[b] for a, b in CUBE_EDGES[loop])
+            if np.dot(normal, outward) < 0:
+                loop = loop[::-1]
+            triangles += [(loop[0], loop[i], loop[i + 1]) for i in range(1, len(loop) - 1)]
+        case_triangles.append(triangles)
+
+    counts = np.array([len(triangles) for triangles in case_triangles], dtype=np.int64)
+    table = np.zeros((256, counts.max(), 3), dtype=np.int64)
+    for case, triangles in enumerate(case_triangles):
+        if triangles:
+            table[case, :len(triangles)] = triangles
+    return counts, table
+
+
+CUBE_TRIANGLE_COUNTS, CUBE_TRIANGLES = get_marching_cubes_cases()
+
+
+class TsdfVolume(object):
+    """Sparse TSDF volume"""
+
+    def __init__(self, voxel_size=DEFAULT_VOXEL_SIZE, truncation=DEFAULT_TRUNCATION,
+                 initial_blocks=1024):
+        self.voxel_size = voxel_size
+        self.truncation = truncation * voxel_size
+
+        # Block key -> slot in the block arrays
+        self.block_slots = {}
+        self.block_keys = np.zeros(initial_blocks, dtype=np.int64)
+        side = BLOCK_SIZE + 1
+        self.tsdf = np.ones((initial_blocks, side ** 3), dtype=np.float32)
+        self.weight = np.zeros((initial_blocks, side ** 3), dtype=np.float32)
+        # Slots of the blocks updated since the last mesh extraction
+        self.dirty = set()
+
+    def __len__(self):
+        return len(self.block_slots)
+
+    def _allocate(self, keys):
+        """Slots of the blocks with the given (unique) keys, allocating new ones"""
+        slots = np.empty(len(keys), dtype=np.int64)
+        for i, key in enumerate(keys.tolist()):
+            slot = self.block_slots.get(key)
+            if slot is None:
+                slot = len(self.block_slots)
+                if slot == len(self.block_keys):
+                    self._grow()
+                self.block_slots[key] = slot
+                self.block_keys[slot] = key
+            slots[i] = slot
+        return slots
+
+    def _grow(self):
+        capacity = 2 * len(self.block_keys)
+        side = BLOCK_SIZE + 1
+        self.block_keys = np.resize(self.block_keys, capacity)
+        tsdf = np.ones((capacity, side ** 3), dtype=np.float32)
+        weight = np.zeros((capacity, side ** 3), dtype=np.float32)
+        tsdf[:len(self.tsdf)] = self.tsdf
+        weight[:len(self.weight)] = self.weight
+        self.tsdf = tsdf
+        self.weight = weight
+
+    def integrate(self, ranges, directions, cam2world_transform):
+        """Integrate one depth frame.
+
+        Args:
+            ranges ([np.array]): Distance along the ray (meters) of the valid pixels
+            directions ([np.array]): Unit ray directions (camera space) of the valid pixels
+            cam2world_transform ([np.array]): Camera to world transform of the frame
+        """
+        if len(ranges) == 0:
+            return
+        voxel_size = self.voxel_size
+        # Work in voxel units and single precision, enough for voxel indices
+        origin = (cam2world_transform[:3, 3] / voxel_size).astype(np.float32)
+        directions = (directions @ cam2world_transform[:3, :3].T).astype(np.float32)
+        ranges = (ranges / voxel_size).astype(np.float32)
+        truncation = self.truncation / voxel_size
+
+        # Visit the voxels around each measurement along its ray
+        n_steps = int(np.ceil(truncation / RAY_STEP))
+        offsets = (np.arange(-n_steps, n_steps + 1) * RAY_STEP).astype(np.float32)
+        samples = directions[:, np.newaxis, :] * (ranges[:, np.newaxis] + offsets)[..., np.newaxis]
+        samples += origin
+        voxels = np.floor(samples.reshape((-1, 3))).astype(np.int64)
+        pixel_ids = np.repeat(np.arange(len(ranges)), len(offsets))
+
+        # Signed distance of the voxel centers along the ray
+        centers = voxels.astype(np.float32) + (0.5 - origin)
+        sdf = ranges[pixel_ids] - np.sqrt(np.einsum('ij,ij->i', centers, centers))
+        in_band = sdf >= -truncation
+        voxels = voxels[in_band]
+        tsdf = np.minimum(sdf[in_band] / truncation, 1.)
+
+        # Average the measurements of each voxel in this frame
+        voxel_keys, inverse = np.unique(pack_keys(voxels), return_inverse=True)
+        inverse = inverse.reshape(-1)
+        tsdf_sum = np.bincount(inverse, weights=tsdf)
+        counts = np.bincount(inverse).astype(np.float64)
+        voxels = unpack_keys(voxel_keys)
+
+        # A voxel on the low side of a block is also in the apron of the
+        # blocks before it, update all its copies
+        blocks = voxels // BLOCK_SIZE
+        local = voxels - blocks * BLOCK_SIZE
+        # Axes along which each voxel is on the low side of its block, as corner bits
+        low_side = (local == 0) @ np.array([4, 2, 1])
+        entry_blocks = []
+        entry_locals = []
+        entry_ids = []
+        for c, corner in enumerate(CUBE_CORNERS):
+            on_apron = (c & ~low_side) == 0
+            entry_blocks.append(blocks[on_apron] - corner)
+            entry_locals.append(local[on_apron] + corner * BLOCK_SIZE)
+            entry_ids.append(np.where(on_apron)[0])
+        entry_blocks = np.concatenate(entry_blocks)
+        entry_locals = np.concatenate(entry_locals)
+        entry_ids = np.concatenate(entry_ids)
+
+        block_keys, block_inverse = np.unique(pack_keys(entry_blocks), return_inverse=True)
+        slots = self._allocate(block_keys)
+        self.dirty.update(slots.tolist())
+
+        side = BLOCK_SIZE + 1
+        rows = slots[block_inverse.reshape(-1)]
+        columns = (entry_locals[:, 0] * side + entry_locals[:, 1]) * side + entry_locals[:, 2]
+
+        # Running weighted average, every measurement has a weight of 1
+        old_weight = self.weight[rows, columns]
+        new_weight = old_weight + counts[entry_ids]
+        self.tsdf[rows, columns] = ((self.tsdf[rows, columns] * old_weight + tsdf_sum[entry_ids]) /
+                                    new_weight)
+        self.weight[rows, columns] = new_weight
+
+    def extract_dirty_meshes(self):
+        """Mesh the blocks updated since the last call, with marching cubes.
+
+        Returns a dictionary block key -> (triangle vertex keys (T, 3),
+        triangle vertices (T, 3, 3)). Vertices are identified by the voxel
+        edge they lie on, so that the meshes of neighbouring blocks can be
+        stitched (see merge_block_meshes). Blocks whose mesh became empty
+        are included.
+        """
+        slots = np.array(sorted(self.dirty), dtype=np.int64)
+        self.dirty = set()
+        meshes = {}
+        for start in range(0, len(slots), MESH_BATCH_BLOCKS):
+            meshes.update(self._extract_meshes(slots[start:start + MESH_BATCH_BLOCKS]))
+        return meshes
+
+    def _extract_meshes(self, slots):
+        side = BLOCK_SIZE + 1
+        cubes_per_block = BLOCK_SIZE ** 3
+        tsdf = self.tsdf[slots].reshape((-1, side, side, side))
+        weight = self.weight[slots].reshape((-1, side, side, side))
+        block_keys = self.block_keys[slots]
+        block_origins = unpack_keys(block_keys) * BLOCK_SIZE
+
+        # Values at the 8 corners of every cube of the blocks
+        corner_tsdf = np.stack([tsdf[:, dx:dx + BLOCK_SIZE, dy:dy + BLOCK_SIZE, dz:dz + BLOCK_SIZE]
+                                for dx, dy, dz in CUBE_CORNERS], axis=-1).reshape((-1, 8))
+        corner_weight = np.stack([weight[:, dx:dx + BLOCK_SIZE, dy:dy + BLOCK_SIZE, dz:dz + BLOCK_SIZE]
+                                  for dx, dy, dz in CUBE_CORNERS], axis=-1).reshape((-1, 8))
+        observed = np.all(corner_weight > 0, axis=1)
+        inside = corner_tsdf < 0
+        crossing = observed & np.any(inside, axis=1) & ~np.all(inside, axis=1)
+        cube_ids = np.where(crossing)[0]
+        cube_blocks = cube_ids // cubes_per_block
+        cubes = (np.stack(np.unravel_index(cube_ids % cubes_per_block, (BLOCK_SIZE,) * 3), axis=1) +
+                 block_origins[cube_blocks])
+        corner_tsdf = corner_tsdf[cube_ids]
+        inside = inside[cube_ids]
+
+        case = inside.astype(np.int64) @ (1 << np.arange(8))
+        triangle_counts = CUBE_TRIANGLE_COUNTS[case]
+        edge_keys = []
+        edge_t = []
+        edge_a = []
+        edge_b = []
+        triangle_blocks = []
+        for n_triangle in range(CUBE_TRIANGLES.shape[1]):
+            ids = np.where(triangle_counts > n_triangle)[0]
+            if len(ids) == 0:
+                break
+            # (triangles, 3 vertices) cube corners of the crossed edges, an
+            # edge is identified by (first voxel, axis)
+            edges = CUBE_TRIANGLES[case[ids], n_triangle]
+            corners_a = CUBE_EDGES[edges, 0]
+            corners_b = CUBE_EDGES[edges, 1]
+            tsdf_a = np.take_along_axis(corner_tsdf[ids], corners_a, axis=1)
+            tsdf_b = np.take_along_axis(corner_tsdf[ids], corners_b, axis=1)
+            voxel_a = (cubes[ids][:, np.newaxis, :] + CUBE_CORNERS[corners_a]).reshape((-1, 3))
+            edge_keys.append((pack_keys(voxel_a) << 3) | (corners_b - corners_a).reshape(-1))
+            edge_t.append((tsdf_a / (tsdf_a - tsdf_b)).reshape(-1))
+            edge_a.append(voxel_a)
+            edge_b.append((cubes[ids][:, np.newaxis, :] + CUBE_CORNERS[corners_b]).reshape((-1, 3)))
+            triangle_blocks.append(cube_blocks[ids])
+
+        empty = (np.zeros((0, 3), dtype=np.int64), np.zeros((0, 3, 3)))
+        if not edge_keys:
+            return {int(key): empty for key in block_keys}
+
+        edge_keys = np.concatenate(edge_keys).reshape((-1, 3))
+        edge_t = np.concatenate(edge_t)[:, np.newaxis]
+        edge_a = np.concatenate(edge_a)
+        edge_b = np.concatenate(edge_b)
+        vertices = (((edge_a + 0.5) * (1 - edge_t) + (edge_b + 0.5) * edge_t) *
+                    self.voxel_size).reshape((-1, 3, 3))
+
+        # Split the triangles by block
+        triangle_blocks = np.concatenate(triangle_blocks)
+        order = np.argsort(triangle_blocks, kind='stable')
+        bounds = np.searchsorted(triangle_blocks[order], np.arange(len(slots) + 1))
+        meshes = {}
+        for i, key in enumerate(block_keys.tolist()):
+            ids = order[bounds[i]:bounds[i + 1]]
+            meshes[key] = (edge_keys[ids], vertices[ids]) if len(ids) else empty
+        return meshes
+
+
+def merge_block_meshes(block_meshes):
+    """Stitch the block meshes (block key -> mesh, see
+    TsdfVolume.extract_dirty_meshes) into one (vertices, triangles) mesh.
+    Vertices on the border of two blocks are computed from the same voxels
+    by both, and merged."""
+    meshes = [block_meshes[key] for key in sorted(block_meshes) if len(block_meshes[key][0])]
+    if not meshes:
+        return np.zeros((0, 3)), np.zeros((0, 3), dtype=np.int64)
+
+    keys = np.concatenate([keys for keys, _ in meshes]).reshape(-1)
+    vertices = np.concatenate([vertices for _, vertices in meshes]).reshape((-1, 3))
+    _, first, inverse = np.unique(keys, return_index=True, return_inverse=True)
+    return vertices[first], inverse.reshape((-1, 3))
+
+
+def save_mesh_ply(output_path, vertices, triangles):
+    """Save a triangle mesh as a binary ply"""
+    header = ("ply\n"
+              "format binary_little_endian 1.0\n"
+              f"element vertex {len(vertices)}\n"
+              "property float x\n"
+              "property float y\n"
+              "property float z\n"
+              f"element face {len(triangles)}\n"
+              "property list uchar int vertex_indices\n"
+              "end_header\n")
+    faces = np.zeros(len(triangles), dtype=[('count', 'u1'), ('indices', '<i4', (3,))])
+    faces['count'] = 3
+    faces['indices'] = triangles
+    with open(output_path, 'wb') as f:
+        f.write(header.encode('ascii'))
+        f.write(np.ascontiguousarray(vertices, dtype='<f4').tobytes())
+        f.write(faces.tobytes())
+
+
+def load_mesh_ply(path):
+    """Load a mesh saved by save_mesh_ply, as (vertices, triangles)"""
+    with open(path, 'rb') as f:
+        data = f.read()
+    header_size = data.index(b'end_header\n') + len(b'end_header\n')
+    counts = {line.split()[1]: int(line.split()[2]) for line in data[:header_size].decode('ascii').splitlines()
+              if line.startswith('element')}
+    vertices = np.frombuffer(data, dtype='<f4', count=3 * counts['vertex'], offset=header_size)
+    faces = np.frombuffer(data, dtype=[('count', 'u1'), ('indices', '<i4', (3,))], count=counts['face'],
+                          offset=header_size + vertices.nbytes)
+    return vertices.reshape((-1, 3)).astype(np.float64), faces['indices'].astype(np.int64)
+
+
+def get_frame_rays(img, lut, max_depth):
+    """Ranges (meters) and camera space ray directions of the valid pixels"""
+    depth = img.reshape(-1)
+    valid = (depth > 0) & (depth <= max_depth * 1000.)
+    return depth[valid] / 1000., lut[valid]
+
+
+class TsdfFusion(object):
+    """TSDF fusion of a sequence of depth frames.
+
+    The mesh is extracted incrementally: extract_mesh only re-meshes the
+    blocks updated since the previous extraction.
+    """
+
+    def __init__(self, lut, voxel_size=DEFAULT_VOXEL_SIZE, truncation=DEFAULT_TRUNCATION,
+                 max_depth=DEFAULT_MAX_DEPTH):
+        self.lut = lut
+        self.max_depth = max_depth
+        self.volume = TsdfVolume(voxel_size, truncation)
+        self.block_meshes = {}
+        self.block_count = 0
+
+    def integrate(self, img, cam2world_transform):
+        """Integrate a depth image (mm) seen from cam2world_transform"""
+        ranges, directions = get_frame_rays(img, self.lut, self.max_depth)
+        self.volume.integrate(ranges, directions, cam2world_transform)
+
+    def extract_mesh(self):
+        """Mesh of the frames integrated so far, as (vertices, triangles)"""
+        self.block_count = len(self.volume)
+        self.block_meshes.update(self.volume.extract_dirty_meshes())
+        return merge_block_meshes(self.block_meshes)
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        pass
+
+
+def iter_depth_frames(folder, sensor_name):
+    """(timestamp, depth image) of the depth frames of a recording, streamed
+    from the tarball when there is one, read from the extracted frames otherwise"""
+    tar_path = folder / f'{sensor_name}.tar'
+    if tar_path.exists():
+        for name, data in iter_tar_members(tar_path, r'^[0-9]+\.pgm$'):
+            yield int(name.split('.')[0]), decode_pgm(data)
+    else:
+        for path in sorted((folder / sensor_name).glob('*[0-9].pgm')):
+            yield int(path.stem), cv2.imread(str(path), -1)
+
+
+def fuse_depth(folder, sensor_name='Depth Long Throw', voxel_size=DEFAULT_VOXEL_SIZE,
+               truncation=DEFAULT_TRUNCATION, max_depth=DEFAULT_MAX_DEPTH,
+               mesh_interval=0, output_path=None):
+    """Fuse the depth frames of a recording in a TSDF volume and save its mesh.
+
+    Args:
+        folder ([Path]): Recording folder
+        sensor_name ([str]): Depth sensor
+        voxel_size ([float]): Voxel size in meters
+        truncation ([float]): Truncation distance in voxels
+        max_depth ([float]): Depth values further than this (meters) are ignored
+        mesh_interval ([int]): Extract the mesh every mesh_interval frames (0: only at the end)
+        output_path ([Path], optional): Output mesh, <folder>/tsdf-fusion-mesh.ply by default
+
+    Returns a dictionary with throughput statistics.
+    """
+    lut = load_lut(folder / f'{sensor_name}_lut.bin')
+    rig2cam = load_extrinsics(folder / f'{sensor_name}_extrinsics.txt')
+    rig2world_timestamps, rig2world_transforms = load_rig2world_transforms(
+        folder / f'{sensor_name}_rig2world.txt')
+    # Same float conversion as the rig2world timestamps
+    rig2world_index = TimestampIndex(rig2world_timestamps)
+    cam2rig = np.linalg.inv(rig2cam)
+    output_path = output_path or folder / 'tsdf-fusion-mesh.ply'
+
+    n_frames = 0
+    n_skipped = 0
+    mesh_seconds = 0.
+    start = time.time()
+    with TsdfFusion(lut, voxel_size, truncation, max_depth) as fusion:
+        for timestamp, img in iter_depth_frames(folder, sensor_name):
+            i = rig2world_index.within(float(timestamp), 0)
+            if i < 0:
+                n_skipped += 1
+                continue
+            fusion.integrate(img, rig2world_transforms[i] @ cam2rig)
+            n_frames += 1
+            if mesh_interval > 0 and n_frames % mesh_interval == 0:
+                mesh_start = time.time()
+                vertices, triangles = fusion.extract_mesh()
+                mesh_seconds += time.time() - mesh_start
+                print(f"{n_frames} frames: {len(fusion.block_meshes)} meshed blocks, "
+                      f"{len(triangles)} triangles")
+
+        mesh_start = time.time()
+        vertices, triangles = fusion.extract_mesh()
+        mesh_seconds += time.time() - mesh_start
+        block_count = fusion.block_count
+    seconds = time.time() - start
+
+    save_mesh_ply(str(output_path), vertices, triangles)
+    report = {'frames': n_frames,
+              'skipped_frames': n_skipped,
+              'blocks': block_count,
+              'vertices': len(vertices),
+              'triangles': len(triangles),
+              'seconds': seconds,
+              'mesh_seconds': mesh_seconds,
+              'frames_per_second': n_frames / seconds if seconds > 0 else 0.}
+    print(f"Fused {n_frames} frames ({n_skipped} without pose) in {seconds:.2f}s: "
+          f"{report['frames_per_second']:.1f} frames/s, "
+          f"{mesh_seconds:.2f}s meshing")
+    print(f"Saved mesh ({len(vertices)} vertices, {len(triangles)} triangles, "
+          f"{block_count} blocks) to {output_path}")
+    return report
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='TSDF fusion of depth frames')
+    parser.add_argument("--recording_path",
+                        required=True,
+                        help="Path to recording folder")
+    parser.add_argument("--sensor_name",
+                        default="Depth Long Throw",
+                        choices=["Depth Long Throw", "Depth AHaT"],
+                        help="Depth sensor to fuse")
+    parser.add_argument("--voxel_size",
+                        type=float,
+                        default=DEFAULT_VOXEL_SIZE,
+                        help="Voxel size in meters")
+    parser.add_argument("--truncation",
+                        type=float,
+                        default=DEFAULT_TRUNCATION,
+                        help="Truncation distance, in voxels")
+    parser.add_argument("--max_depth",
+                        type=float,
+                        default=DEFAULT_MAX_DEPTH,
+                        help="Ignore depth values further than this (meters)")
+    parser.add_argument("--mesh_interval",
+                        type=int,
+                        default=0,
+                        help="Extract the mesh every mesh_interval frames, "
+                        "only re-meshing the updated blocks (0: only at the end)")
+
+    args = parser.parse_args()
+    fuse_depth(Path(args.recording_path),
+               args.sensor_name,
+               args.voxel_size,
+               args.truncation,
+               args.max_depth,
+               args.mesh_interval)
@@ -0,0 +1,198 @@
+"""
+ Copyright (c) Microsoft. All rights reserved.
+ This code is licensed under the MIT License (MIT).
+ THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+ ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+ IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+ PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+"""
+import argparse
+import io
+import tarfile
+import tempfile
+import time
+from pathlib import Path
+
+import numpy as np
+
+from tsdf_fusion import DEFAULT_MAX_DEPTH, DEFAULT_TRUNCATION, fuse_depth, load_mesh_ply
+
+# Throughput of tsdf_fusion.py, and accuracy of its mesh, on a recording or on a synthetic long throw recording: a room
+# with a sphere in its middle, seen from a camera going around the sphere.
+# The synthetic depth is noise free and rendered with a pinhole LUT, so the
+# mesh can be compared with the exact surface and, when open3d is installed,
+# with the mesh of open3d's ScalableTSDFVolume fed with the same frames.
+
+SENSOR_NAME = 'Depth Long Throw'
+WIDTH = 320
+HEIGHT = 288
+FOCAL_LENGTH = 200.
+ROOM_HALF_SIZE = np.array([2., 1.5, 2.])
+SPHERE_CENTER = np.array([0., 0., 0.])
+SPHERE_RADIUS = 0.5
+ORBIT_RADIUS = 1.5
+FIRST_TIMESTAMP = 132552243331225839
+FRAME_INTERVAL = 2222222
+
+
+def get_pinhole_lut():
+    """Unit ray directions of the pixels, x right, y down and z forward"""
+    v, u = np.mgrid[:HEIGHT, :WIDTH]
+    directions = np.stack(((u + 0.5 - WIDTH / 2) / FOCAL_LENGTH,
+                           (v + 0.5 - HEIGHT / 2) / FOCAL_LENGTH,
+                           np.ones((HEIGHT, WIDTH))), axis=-1).reshape((-1, 3))
+    return (directions / np.linalg.norm(directions, axis=1, keepdims=True)).astype(np.float32)
+
+
+def get_camera_pose(i_frame, n_frames):
+    """Camera to world transform of a frame, looking at the sphere"""
+    angle = 2 * np.pi * i_frame / n_frames
+    position = np.array([ORBIT_RADIUS * np.sin(angle), 0.2 + 0.2 * np.sin(3 * angle),
+                         -ORBIT_RADIUS * np.cos(angle)])
+    forward = SPHERE_CENTER - position
+    forward /= np.linalg.norm(forward)
+    right = np.cross(np.array([0., -1., 0.]), forward)
+    right /= np.linalg.norm(right)
+    down = np.cross(forward, right)
+    cam2world = np.eye(4)
+    cam2world[:3, :3] = np.stack((right, down, forward), axis=1)
+    cam2world[:3, 3] = position
+    return cam2world
+
+
+def scene_distance(points):
+    """Distance of points to the surface of the scene, positive in the free space"""
+    room = np.min(ROOM_HALF_SIZE - np.abs(points), axis=-1)
+    sphere = np.linalg.norm(points - SPHERE_CENTER, axis=-1) - SPHERE_RADIUS
+    return np.minimum(room, sphere)
+
+
+def render_depth(cam2world, lut):
+    """Range (mm) of the pixels seen from cam2world"""
+    origin = cam2world[:3, 3]
+    directions = lut.astype(np.float64) @ cam2world[:3, :3].T
+
+    # Walls
+    with np.errstate(divide='ignore'):
+        wall_ranges = (np.sign(directions) * ROOM_HALF_SIZE - origin) / directions
+    ranges = np.min(np.where(wall_ranges > 0, wall_ranges, np.inf), axis=1)
+
+    # Sphere, from the outside
+    offset = origin - SPHERE_CENTER
+    b = directions @ offset
+    discriminant = b * b - (offset @ offset - SPHERE_RADIUS ** 2)
+    hit = discriminant >= 0
+    sphere_ranges = -b[hit] - np.sqrt(discriminant[hit])
+    ranges[hit] = np.where(sphere_ranges > 0, np.minimum(ranges[hit], sphere_ranges), ranges[hit])
+
+    depth = np.round(ranges * 1000.)
+    depth[depth > 65535] = 0
+    return depth.astype(np.uint16).reshape((HEIGHT, WIDTH))
+
+
+def encode_pgm(img):
+    header = f'P5\n{img.shape[1]} {img.shape[0]}\n65535\n'.encode('ascii')
+    return header + img.astype('>u2').tobytes()
+
+
+def write_synthetic_recording(folder, n_frames):
+    """Write the depth tarball, LUT, extrinsics and rig2world poses of a
+    synthetic long throw recording, as the recorder does"""
+    folder = Path(folder)
+    folder.mkdir(parents=True, exist_ok=True)
+    lut = get_pinhole_lut()
+    lut.tofile(str(folder / f'{SENSOR_NAME}_lut.bin'))
+    # Rig and camera are the same
+    np.savetxt(str(folder / f'{SENSOR_NAME}_extrinsics.txt'), np.eye(4).reshape((1, -1)), delimiter=',')
+
+    with tarfile.open(str(folder / f'{SENSOR_NAME}.tar'), 'w') as tar, \
+            open(folder / f'{SENSOR_NAME}_rig2world.txt', 'w') as rig2world_file:
+        for i_frame in range(n_frames):
+            timestamp = FIRST_TIMESTAMP + i_frame * FRAME_INTERVAL
+            cam2world = get_camera_pose(i_frame, n_frames)
+            data = encode_pgm(render_depth(cam2world, lut))
+            info = tarfile.TarInfo(f'{timestamp}.pgm')
+            info.size = len(data)
+            tar.addfile(info, io.BytesIO(data))
+            rig2world_file.write(f'{timestamp},' + ','.join(repr(float(v)) for v in cam2world.reshape(-1)) + '\n')
+
+
+def get_surface_errors(vertices):
+    return np.abs(scene_distance(vertices))
+
+
+def fuse_with_open3d(folder, n_frames, voxel_size, truncation):
+    """Mesh of the synthetic recording fused by open3d, and its fusion time"""
+    import open3d as o3d
+    from stream_tar import decode_pgm, iter_tar_members
+
+    lut = get_pinhole_lut()
+    intrinsic = o3d.camera.PinholeCameraIntrinsic(WIDTH, HEIGHT, FOCAL_LENGTH, FOCAL_LENGTH,
+                                                  WIDTH / 2 - 0.5, HEIGHT / 2 - 0.5)
+    volume = o3d.pipelines.integration.ScalableTSDFVolume(
+        voxel_length=voxel_size, sdf_trunc=truncation * voxel_size,
+        color_type=o3d.pipelines.integration.TSDFVolumeColorType.NoColor)
+
+    start = time.time()
+    for i_frame, (_, data) in enumerate(iter_tar_members(folder / f'{SENSOR_NAME}.tar', r'^[0-9]+\.pgm$')):
+        # open3d expects the depth along z, not along the ray
+        depth = (decode_pgm(data).reshape(-1) * lut[:, 2]).reshape((HEIGHT, WIDTH)).astype(np.float32)
+        rgbd = o3d.geometry.RGBDImage.create_from_color_and_depth(
+            o3d.geometry.Image(np.zeros((HEIGHT, WIDTH, 3), dtype=np.uint8)), o3d.geometry.Image(depth),
+            depth_scale=1000., depth_trunc=DEFAULT_MAX_DEPTH, convert_rgb_to_intensity=False)
+        volume.integrate(rgbd, intrinsic, np.linalg.inv(get_camera_pose(i_frame, n_frames)))
+    mesh = volume.extract_triangle_mesh()
+    seconds = time.time() - start
+    return np.asarray(mesh.vertices), np.asarray(mesh.triangles), seconds
+
+
+def report_mesh(name, vertices, triangles, seconds, n_frames):
+    errors = get_surface_errors(vertices)
+    print(f"{name:<24} {n_frames / seconds:8.2f} frames/s {len(triangles):9d} triangles "
+          f"{1000 * errors.mean():7.2f} mm mean {1000 * np.percentile(errors, 99):7.2f} mm p99 error")
+
+
+def run_benchmark(folder, output_folder, n_frames, voxel_size, truncation, synthetic):
+    print(f"{n_frames} frames, {voxel_size * 100:g} cm voxels")
+    output_path = output_folder / 'tsdf-fusion-mesh.ply'
+    report = fuse_depth(folder, SENSOR_NAME, voxel_size, truncation, output_path=output_path)
+    if synthetic:
+        vertices, triangles = load_mesh_ply(output_path)
+        report_mesh('tsdf_fusion', vertices, triangles, report['seconds'], n_frames)
+
+    if not synthetic:
+        return
+    try:
+        vertices, triangles, seconds = fuse_with_open3d(folder, n_frames, voxel_size, truncation)
+        report_mesh('open3d', vertices, triangles, seconds, n_frames)
+    except ImportError:
+        print("open3d is not installed, not compared")
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='TSDF fusion benchmark')
+    parser.add_argument("--recording_path",
+                        help="Recording to fuse, a synthetic one by default")
+    parser.add_argument("--frames",
+                        type=int,
+                        default=60,
+                        help="Number of frames of the synthetic recording")
+    parser.add_argument("--voxel_size",
+                        type=float,
+                        default=0.02,
+                        help="Voxel size in meters")
+    parser.add_argument("--truncation",
+                        type=float,
+                        default=DEFAULT_TRUNCATION,
+                        help="Truncation distance, in voxels")
+
+    args = parser.parse_args()
+    with tempfile.TemporaryDirectory() as output_folder:
+        output_folder = Path(output_folder)
+        if args.recording_path:
+            folder = Path(args.recording_path)
+            n_frames = len(np.loadtxt(str(folder / f'{SENSOR_NAME}_rig2world.txt'), delimiter=',', ndmin=2))
+            run_benchmark(folder, output_folder, n_frames, args.voxel_size, args.truncation, False)
+        else:
+            write_synthetic_recording(output_folder, args.frames)
+            run_benchmark(output_folder, output_folder, args.frames, args.voxel_size, args.truncation, True)
@@ -6,12 +6,16 @@
  IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
  PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
 """
+import os
 import tarfile
+import zipfile
+from pathlib import Path
 
 import numpy as np
 import cv2
 
 from hand_defs import HandJointIndex
+from tar_index import load_frame_timestamps
 
 # Depth values are saved inside a 16bit png with the following scaling factor
 # This correponds to the scaling factor used by the TUM slam dataset:w
@@ -39,6 +43,18 @@ def load_lut(lut_filename):
     return lut
 
 
+def load_extrinsics(extrinsics_path):
+    assert Path(extrinsics_path).exists()
+    mtx = np.loadtxt(str(extrinsics_path), delimiter=',').reshape((4, 4))
+    return mtx
+
+
+def load_rig2world_transforms(path):
+    """Load rig2world transforms as (timestamps, transforms) arrays"""
+    data = np.loadtxt(str(path), delimiter=',', ndmin=2)
+    return data[:, 0], data[:, 1:].reshape((-1, 4, 4))
+
+
 def check_framerates(capture_path):
     HundredsOfNsToMilliseconds = 1e-4
     MillisecondsToSeconds = 1e-3
@@ -50,8 +66,12 @@ def check_framerates(capture_path):
     for (img_folder, img_ext) in folders_extensions:
         base_folder = capture_path / img_folder
         paths = base_folder.glob('*%s' % img_ext)
-        timestamps = [int(path.stem) for path in paths]
-        if len(timestamps):
+        timestamps = sorted(int(path.stem) for path in paths)
+        tar_path = capture_path / f'{img_folder}.tar'
+        if not len(timestamps) and tar_path.exists():
+            # Frames were streamed from the tarball instead of extracted
+            timestamps = np.sort(load_frame_timestamps(tar_path, '.' + img_ext.split('.')[-1]))
+        if len(timestamps) > 1:
             avg_delta = get_avg_delta(timestamps) * HundredsOfNsToMilliseconds
             print('Average {} delta: {:.3f}ms, fps: {:.3f}'.format(
                 img_folder, avg_delta, 1/(avg_delta * MillisecondsToSeconds)))
@@ -67,109 +87,276 @@ def check_framerates(capture_path):
         pass
 
 
-def load_head_hand_eye_data(csv_path):
-    joint_count = HandJointIndex.Count.value
+# Bump when the layout of the cached arrays changes
+LOG_CACHE_VERSION = 1
+
+
+def get_log_cache_path(log_path):
+    log_path = Path(log_path)
+    return log_path.with_name(log_path.name + '.npz')
+
+
+def load_cached_log(log_path, parse_function):
+    """Load the arrays parsed from a text log by parse_function, using a
+    binary cache (<log>.npz) next to the log when it is up to date.
+    The cache is invalidated when the size or mtime of the log change.
+    """
+    log_path = Path(log_path)
+    cache_path = get_log_cache_path(log_path)
+    stat = log_path.stat()
+    source_key = np.array([LOG_CACHE_VERSION, stat.st_size, stat.st_mtime_ns], dtype=np.int64)
+
+    if cache_path.exists():
+        try:
+            with np.load(cache_path) as cache:
+                if np.array_equal(cache['source_key'], source_key):
+                    return {name: cache[name] for name in cache.files if name != 'source_key'}
+        except (OSError, ValueError, KeyError, zipfile.BadZipFile):
+            # Truncated or corrupt cache, parsed again and replaced
+            pass
+
+    arrays = parse_function(log_path)
+
+    # Write to a temporary file first so an interrupted run leaves no partial cache
+    try:
+        tmp_path = cache_path.with_name(cache_path.name + '.tmp')
+        with open(tmp_path, 'wb') as f:
+            np.savez(f, source_key=source_key, **arrays)
+        os.replace(tmp_path, cache_path)
+    except OSError:
+        # e.g. read-only recording folder, the cache is only an optimization
+        pass
+
+    return arrays
 
-    data = np.loadtxt(csv_path, delimiter=',')
+
+def parse_csv_lines(lines):
+    """Parse comma separated rows of numbers in one vectorized pass.
+    Returns a (rows, columns) float64 array."""
+    lines = [line for line in lines if line.strip()]
+    if len(lines) == 0:
+        return np.zeros((0, 0))
+    return np.loadtxt(lines, delimiter=',', ndmin=2)
+
+
+def parse_head_hand_eye_log(csv_path):
+    joint_count = HandJointIndex.Count.value
+    with open(csv_path) as f:
+        data = parse_csv_lines(f.read().splitlines())
 
     n_frames = len(data)
-    timestamps = np.zeros(n_frames)
-    head_transs = np.zeros((n_frames, 3))
-
-    left_hand_transs = np.zeros((n_frames, joint_count, 3))
-    left_hand_transs_available = np.ones(n_frames, dtype=bool)
-    right_hand_transs = np.zeros((n_frames, joint_count, 3))
-    right_hand_transs_available = np.ones(n_frames, dtype=bool)
-
-    # origin (vector, homog) + direction (vector, homog) + distance (scalar)
-    gaze_data = np.zeros((n_frames, 9))
-    gaze_available = np.ones(n_frames, dtype=bool)
-
-    for i_frame, frame in enumerate(data):
-        timestamps[i_frame] = frame[0]
-        # head
-        head_transs[i_frame, :] = frame[1:17].reshape((4, 4))[:3, 3]
-        # left hand
-        left_hand_transs_available[i_frame] = (frame[17] == 1)
-        left_start_id = 18
-        for i_j in range(joint_count):
-            j_start_id = left_start_id + 16 * i_j
-            j_trans = frame[j_start_id:j_start_id + 16].reshape((4, 4))[:3, 3]
-            left_hand_transs[i_frame, i_j, :] = j_trans
-        # right hand
-        right_hand_transs_available[i_frame] = (
-            frame[left_start_id + joint_count * 4 * 4] == 1)
-        right_start_id = left_start_id + joint_count * 4 * 4 + 1
-        for i_j in range(joint_count):
-            j_start_id = right_start_id + 16 * i_j
-            j_trans = frame[j_start_id:j_start_id + 16].reshape((4, 4))[:3, 3]
-            right_hand_transs[i_frame, i_j, :] = j_trans
-
-        assert(j_start_id + 16 == 851)
-        gaze_available[i_frame] = (frame[851] == 1)
-        gaze_data[i_frame, :4] = frame[852:856]
-        gaze_data[i_frame, 4:8] = frame[856:860]
-        gaze_data[i_frame, 8] = frame[860]
-
-    return (timestamps, head_transs, left_hand_transs, left_hand_transs_available,
-            right_hand_transs, right_hand_transs_available, gaze_data, gaze_available)
-
-
-def project_on_pv(points, pv_img, pv2world_transform, focal_length, principal_point):
+    left_start_id = 18
+    right_start_id = left_start_id + joint_count * 4 * 4 + 1
+    gaze_start_id = right_start_id + joint_count * 4 * 4
+    assert gaze_start_id == 851
+
+    def joint_translations(start_id):
+        joints = data[:, start_id:start_id + joint_count * 16]
+        return joints.reshape((n_frames, joint_count, 4, 4))[:, :, :3, 3]
+
+    return {'timestamps': data[:, 0],
+            'head_transforms': data[:, 1:17].reshape((n_frames, 4, 4)),
+            'left_hand_transs': joint_translations(left_start_id),
+            'left_hand_transs_available': data[:, 17] == 1,
+            'right_hand_transs': joint_translations(right_start_id),
+            'right_hand_transs_available': data[:, right_start_id - 1] == 1,
+            # origin (vector, homog) + direction (vector, homog) + distance (scalar)
+            'gaze_data': data[:, gaze_start_id + 1:gaze_start_id + 10],
+            'gaze_available': data[:, gaze_start_id] == 1}
+
+
+def load_head_hand_eye_arrays(csv_path):
+    """Load the head, hand and eye log as a dictionary of arrays (see parse_head_hand_eye_log)"""
+    return load_cached_log(csv_path, parse_head_hand_eye_log)
+
+
+def load_head_hand_eye_data(csv_path):
+    data = load_head_hand_eye_arrays(csv_path)
+    head_transs = data['head_transforms'][:, :3, 3]
+
+    return (data['timestamps'], head_transs,
+            data['left_hand_transs'], data['left_hand_transs_available'],
+            data['right_hand_transs'], data['right_hand_transs_available'],
+            data['gaze_data'], data['gaze_available'])
+
+
+# Points further than this fraction of their depth behind the closest
+# surface seen by the PV camera are considered occluded
+PV_OCCLUSION_TOLERANCE = 0.05
+
+# Largest square (in pixels) covered by a single point in a z-buffer
+MAX_SPLAT_SIZE = 9
+
+
+def project_points(points, intrinsic_matrix, width, height, mirror_x=False):
+    """Project camera space points (N, 3) with a pinhole camera (no distortion).
+
+    Returns (xy, inside): continuous pixel coordinates (N, 2), pixel centers
+    being at integer coordinates, and the mask of the points in front of
+    the camera whose nearest pixel is inside the image.
+    """
+    z = points[:, 2]
+    with np.errstate(divide='ignore', invalid='ignore'):
+        xy = (points[:, :2] / z[:, np.newaxis]) * np.diag(intrinsic_matrix)[:2] + intrinsic_matrix[:2, 2]
+    if mirror_x:
+        xy[:, 0] = width - xy[:, 0]
+
+    inside = ((z > 0) &
+              (xy[:, 0] >= -0.5) & (xy[:, 0] < width - 0.5) &
+              (xy[:, 1] >= -0.5) & (xy[:, 1] < height - 0.5))
+    return xy, inside
+
+
+def estimate_splat_size(xy, width, height):
+    """Splat size that roughly closes the gaps between projected points,
+    from the average area covered by each point"""
+    if len(xy) == 0:
+        return 1
+    extent = np.ptp(xy, axis=0) + 1
+    spacing = np.sqrt(min(extent[0] * extent[1], width * height) / len(xy))
+    return int(np.clip(np.ceil(spacing), 1, MAX_SPLAT_SIZE))
+
+
+def render_zbuffer(xy, z, width, height, splat_size=1):
+    """Keep the closest point for each pixel.
+
+    xy and z must only contain points inside the image (see project_points).
+    With splat_size > 1, each point also covers the splat_size x splat_size
+    square of pixels around its nearest pixel in the depth image, to close
+    the gaps between sparse points.
+
+    Returns (depth_image, index_image): depth of the closest point (0 where
+    no point was projected) and the index in xy of the closest point whose
+    nearest pixel it is (-1 where there is none, not affected by splat_size).
+    """
+    pixels = np.around(xy).astype(np.int64)
+
+    # Sort by pixel, then by depth: the first entry of each pixel is the closest point
+    linear = pixels[:, 1] * width + pixels[:, 0]
+    order = np.lexsort((z, linear))
+    linear = linear[order]
+    first = np.ones(len(linear), dtype=bool)
+    first[1:] = linear[1:] != linear[:-1]
+
+    index_image = np.full(height * width, -1, dtype=np.int64)
+    index_image[linear[first]] = order[first]
+    index_image = index_image.reshape((height, width))
+
+    covered = index_image >= 0
+    if splat_size > 1:
+        # Minimum depth over the splat around each pixel, empty pixels do not count
+        depth_image = np.full((height, width), np.inf, dtype=np.float32)
+        depth_image[covered] = z[index_image[covered]]
+        depth_image = cv2.erode(depth_image, np.ones((splat_size, splat_size), np.uint8),
+                                borderType=cv2.BORDER_CONSTANT, borderValue=np.inf)
+        depth_image = depth_image.astype(np.float64)
+        depth_image[np.isinf(depth_image)] = 0
+    else:
+        depth_image = np.zeros((height, width))
+        depth_image[covered] = z[index_image[covered]]
+    return depth_image, index_image
+
+
+def sample_bilinear(image, xy):
+    """Bilinearly interpolate image at the continuous pixel coordinates xy (N, 2).
+    Coordinates outside of the image are clamped to its border."""
+    height, width = image.shape[:2]
+    x = np.clip(xy[:, 0], 0, width - 1)
+    y = np.clip(xy[:, 1], 0, height - 1)
+    x0 = np.minimum(np.floor(x).astype(np.int64), width - 2) if width > 1 else np.zeros(len(x), dtype=np.int64)
+    y0 = np.minimum(np.floor(y).astype(np.int64), height - 2) if height > 1 else np.zeros(len(y), dtype=np.int64)
+    x1 = np.minimum(x0 + 1, width - 1)
+    y1 = np.minimum(y0 + 1, height - 1)
+    wx = (x - x0).astype(np.float32)
+    wy = (y - y0).astype(np.float32)
+    if image.ndim == 3:
+        wx = wx[:, np.newaxis]
+        wy = wy[:, np.newaxis]
+
+    top = image[y0, x0] * (1 - wx) + image[y0, x1] * wx
+    bottom = image[y1, x0] * (1 - wx) + image[y1, x1] * wx
+    return top * (1 - wy) + bottom * wy
+
+
+def transform_points(points, transform):
+    return points @ transform[:3, :3].T + transform[:3, 3]
+
+
+def project_on_pv(points, pv_img, pv2world_transform, focal_length, principal_point,
+                  occluders=None, splat_size=None, occlusion_tolerance=PV_OCCLUSION_TOLERANCE):
+    """Color world space points (N, 3) from a PV frame.
+
+    The occluders (the points themselves by default) are splatted in a
+    z-buffer at PV resolution, and the colors of the points that are not
+    behind it are interpolated bilinearly. splat_size is estimated from
+    the density of the projected occluders when not given.
+
+    Returns (rgb, depth_image): colors (N, 3) in [0, 1], black for points
+    occluded or outside of the frame, and the z-buffer of the occluders
+    at PV resolution (0 where empty).
+    """
     height, width, _ = pv_img.shape
 
-    homog_points = np.hstack((points, np.ones(len(points)).reshape((-1, 1))))
     world2pv_transform = np.linalg.inv(pv2world_transform)
-    points_pv = (world2pv_transform @ homog_points.T).T[:, :3]
-
     intrinsic_matrix = np.array([[focal_length[0], 0, principal_point[0]], [
         0, focal_length[1], principal_point[1]], [0, 0, 1]])
-    rvec = np.zeros(3)
-    tvec = np.zeros(3)
-    xy, _ = cv2.projectPoints(points_pv, rvec, tvec, intrinsic_matrix, None)
-    xy = np.squeeze(xy)
-    xy[:, 0] = width - xy[:, 0]
-    xy = np.around(xy).astype(int)
-
-    rgb = np.zeros_like(points)
-    width_check = np.logical_and(0 <= xy[:, 0], xy[:, 0] < width)
-    height_check = np.logical_and(0 <= xy[:, 1], xy[:, 1] < height)
-    valid_ids = np.where(np.logical_and(width_check, height_check))[0]
 
+    points_pv = transform_points(points, world2pv_transform)
+    xy, inside = project_points(points_pv, intrinsic_matrix, width, height, mirror_x=True)
+
+    if occluders is None:
+        occluders_pv, occluders_xy, occluders_inside = points_pv, xy, inside
+    else:
+        occluders_pv = transform_points(occluders, world2pv_transform)
+        occluders_xy, occluders_inside = project_points(
+            occluders_pv, intrinsic_matrix, width, height, mirror_x=True)
+    occluders_xy = occluders_xy[occluders_inside]
+    if splat_size is None:
+        splat_size = estimate_splat_size(occluders_xy, width, height)
+    depth_image, _ = render_zbuffer(
+        occluders_xy, occluders_pv[occluders_inside, 2], width, height, splat_size)
+
+    # Only keep the points that are not behind the closest surface
+    valid_ids = np.where(inside)[0]
+    pixels = np.around(xy[valid_ids]).astype(np.int64)
     z = points_pv[valid_ids, 2]
-    xy = xy[valid_ids, :]
+    closest = depth_image[pixels[:, 1], pixels[:, 0]]
+    visible = (closest == 0) | (z <= closest * (1 + occlusion_tolerance))
+    valid_ids = valid_ids[visible]
 
-    depth_image = np.zeros((height, width))
-    for i, p in enumerate(xy):
-        depth_image[p[1], p[0]] = z[i]
-
-    colors = pv_img[xy[:, 1], xy[:, 0], :]
+    rgb = np.zeros_like(points, dtype=np.float64)
+    colors = sample_bilinear(pv_img, xy[valid_ids])
     rgb[valid_ids, :] = colors[:, ::-1] / 255.
 
     return rgb, depth_image
 
 
-def project_on_depth(points, rgb, intrinsic_matrix, width, height):
-    rvec = np.zeros(3)
-    tvec = np.zeros(3)
-    xy, _ = cv2.projectPoints(points, rvec, tvec, intrinsic_matrix, None)
-    xy = np.squeeze(xy)
-    xy = np.around(xy).astype(int)
+def project_on_depth(points, rgb, intrinsic_matrix, width, height, splat_size=1):
+    """Render camera space points (N, 3) and their colors (N, 3, in [0, 1])
+    in a pinhole camera, keeping the closest point for each pixel.
+
+    Returns (image, depth_image): BGR image in [0, 255] and depth image.
+    """
+    xy, inside = project_points(points, intrinsic_matrix, width, height)
+    valid_ids = np.where(inside)[0]
 
-    width_check = np.logical_and(0 <= xy[:, 0], xy[:, 0] < width)
-    height_check = np.logical_and(0 <= xy[:, 1], xy[:, 1] < height)
-    valid_ids = np.where(np.logical_and(width_check, height_check))[0]
-    xy = xy[valid_ids, :]
+    depth_image, index_image = render_zbuffer(
+        xy[valid_ids], points[valid_ids, 2], width, height, splat_size)
 
-    z = points[valid_ids, 2]
-    depth_image = np.zeros((height, width))
     image = np.zeros((height, width, 3))
-    rgb = rgb[valid_ids, :]
-    rgb = rgb[:, ::-1]
-    for i, p in enumerate(xy):
-        depth_image[p[1], p[0]] = z[i]
-        image[p[1], p[0]] = rgb[i]
+    covered = index_image >= 0
+    image[covered] = rgb[valid_ids[index_image[covered]], ::-1]
 
     image = image * 255.
 
     return image, depth_image
+
+
+def backproject_depth(depth_image, intrinsic_matrix):
+    """Camera space points (N, 3) of the non zero pixels of depth_image,
+    in row major order"""
+    y, x = np.nonzero(depth_image)
+    z = depth_image[y, x]
+    return np.stack(((x - intrinsic_matrix[0, 2]) * z / intrinsic_matrix[0, 0],
+                     (y - intrinsic_matrix[1, 2]) * z / intrinsic_matrix[1, 1],
+                     z), axis=1)